@@ -24,10 +24,28 @@
 
 static int	alerts_fired;
 
+/*
+ * Windows with monitor-silence are kept in a wheel of one second slots by the
+ * time silence is due. Output only changes the time in the window; a single
+ * timer looks at the current slot once a second and moves any window whose
+ * time has been pushed back to its new slot.
+ */
+#define ALERTS_WHEEL_SIZE 64
+#define ALERTS_WHEEL_SLOT(t) ((((t) + 999) / 1000) % ALERTS_WHEEL_SIZE)
+static TAILQ_HEAD(alerts_slot, window) alerts_wheel[ALERTS_WHEEL_SIZE];
+static int		alerts_wheel_ready;
+static u_int		alerts_wheel_count;
+static uint64_t		alerts_wheel_tick;
+static struct event	alerts_wheel_timer;
+
 static void	alerts_timer(int, short, void *);
+static void	alerts_schedule(uint64_t);
+static void	alerts_add(struct window *);
 static int	alerts_enabled(struct window *, int);
 static void	alerts_callback(int, short, void *);
 static void	alerts_reset(struct window *);
+static void	alerts_start(void);
+static void	alerts_finish(void);
 
 static int	alerts_action_applies(struct winlink *, const char *);
 static int	alerts_check_all(struct window *);
@@ -40,12 +58,89 @@ static void	alerts_set_message(struct winlink *, const char *,
 static TAILQ_HEAD(, window) alerts_list = TAILQ_HEAD_INITIALIZER(alerts_list);
 
 static void
-alerts_timer(__unused int fd, __unused short events, void *arg)
+alerts_timer(__unused int fd, __unused short events, __unused void *arg)
 {
-	struct window	*w = arg;
+	struct alerts_slot	*slot;
+	struct window		*w, *w1;
+	uint64_t		 now, tick;
+	u_int			 idx;
+
+	now = get_timer();
+	tick = now / 1000;
+	if (tick >= alerts_wheel_tick &&
+	    tick - alerts_wheel_tick >= ALERTS_WHEEL_SIZE)
+		alerts_wheel_tick = tick - ALERTS_WHEEL_SIZE + 1;
+
+	for (; alerts_wheel_tick <= tick; alerts_wheel_tick++) {
+		idx = alerts_wheel_tick % ALERTS_WHEEL_SIZE;
+		slot = &alerts_wheel[idx];
+		TAILQ_FOREACH_SAFE(w, slot, silence_entry, w1) {
+			if (w->silence_time > now) {
+				if (ALERTS_WHEEL_SLOT(w->silence_time) == idx)
+					continue;
+				alerts_remove(w);
+				alerts_add(w);
+				continue;
+			}
+			log_debug("@%u alerts timer expired", w->id);
+			alerts_remove(w);
+			alerts_queue(w, WINDOW_SILENCE);
+		}
+	}
+	alerts_wheel_tick = tick + 1;
 
-	log_debug("@%u alerts timer expired", w->id);
-	alerts_queue(w, WINDOW_SILENCE);
+	if (alerts_wheel_count != 0)
+		alerts_schedule(now);
+}
+
+/* Start the wheel timer for the next slot. */
+static void
+alerts_schedule(uint64_t now)
+{
+	struct timeval	tv;
+	uint64_t	left;
+
+	left = 1000 - (now % 1000);
+	tv.tv_sec = left / 1000;
+	tv.tv_usec = (left % 1000) * 1000;
+	evtimer_add(&alerts_wheel_timer, &tv);
+}
+
+/* Add a window to the wheel in the slot for its silence time. */
+static void
+alerts_add(struct window *w)
+{
+	u_int	i;
+
+	if (!alerts_wheel_ready) {
+		for (i = 0; i < ALERTS_WHEEL_SIZE; i++)
+			TAILQ_INIT(&alerts_wheel[i]);
+		evtimer_set(&alerts_wheel_timer, alerts_timer, NULL);
+		alerts_wheel_ready = 1;
+	}
+	if (w->silence_queued)
+		return;
+
+	i = ALERTS_WHEEL_SLOT(w->silence_time);
+	TAILQ_INSERT_TAIL(&alerts_wheel[i], w, silence_entry);
+	w->silence_queued = 1;
+	w->silence_slot = i;
+	if (alerts_wheel_count++ == 0 &&
+	    !evtimer_pending(&alerts_wheel_timer, NULL)) {
+		alerts_wheel_tick = get_timer() / 1000;
+		alerts_schedule(get_timer());
+	}
+}
+
+/* Remove a window from the wheel. */
+void
+alerts_remove(struct window *w)
+{
+	if (!w->silence_queued)
+		return;
+	TAILQ_REMOVE(&alerts_wheel[w->silence_slot], w, silence_entry);
+	w->silence_queued = 0;
+	alerts_wheel_count--;
 }
 
 static void
@@ -54,6 +149,7 @@ alerts_callback(__unused int fd, __unused short events, __unused void *arg)
 	struct window	*w, *w1;
 	int		 alerts;
 
+	alerts_start();
 	TAILQ_FOREACH_SAFE(w, &alerts_list, alerts_entry, w1) {
 		alerts = alerts_check_all(w);
 		log_debug("@%u alerts check, alerts %#x", w->id, alerts);
@@ -64,9 +160,36 @@ alerts_callback(__unused int fd, __unused short events, __unused void *arg)
 		w->flags &= ~WINDOW_ALERTFLAGS;
 		window_remove_ref(w, __func__);
 	}
+	alerts_finish();
 	alerts_fired = 0;
 }
 
+/*
+ * Start a batch of alert checks. However many windows have alerts, each
+ * session gets at most one message of each type and one status redraw.
+ */
+static void
+alerts_start(void)
+{
+	struct session	*s;
+
+	RB_FOREACH(s, sessions, &sessions)
+		s->flags &= ~SESSION_ALERTFLAGS;
+}
+
+/* Finish a batch of alert checks and redraw the status of sessions. */
+static void
+alerts_finish(void)
+{
+	struct session	*s;
+
+	RB_FOREACH(s, sessions, &sessions) {
+		if (s->flags & SESSION_ALERTSTATUS)
+			server_status_session(s);
+		s->flags &= ~SESSION_ALERTFLAGS;
+	}
+}
+
 static int
 alerts_action_applies(struct winlink *wl, const char *name)
 {
@@ -104,8 +227,10 @@ alerts_check_session(struct session *s)
 {
 	struct winlink	*wl;
 
+	alerts_start();
 	RB_FOREACH(wl, winlinks, &s->windows)
 		alerts_check_all(wl->window);
+	alerts_finish();
 }
 
 static int
@@ -138,20 +263,27 @@ alerts_reset_all(void)
 static void
 alerts_reset(struct window *w)
 {
-	struct timeval	tv;
-
-	if (!event_initialized(&w->alerts_timer))
-		evtimer_set(&w->alerts_timer, alerts_timer, w);
+	u_int		silence;
+	uint64_t	t;
 
 	w->flags &= ~WINDOW_SILENCE;
-	event_del(&w->alerts_timer);
 
-	timerclear(&tv);
-	tv.tv_sec = options_get_number(w->options, "monitor-silence");
+	silence = options_get_number(w->options, "monitor-silence");
+	log_debug("@%u alerts timer reset %u", w->id, silence);
+	if (silence == 0) {
+		alerts_remove(w);
+		return;
+	}
 
-	log_debug("@%u alerts timer reset %u", w->id, (u_int)tv.tv_sec);
-	if (tv.tv_sec != 0)
-		event_add(&w->alerts_timer, &tv);
+	/*
+	 * If the window is already in the wheel and the time is later, it is
+	 * moved when its old slot comes round.
+	 */
+	t = get_timer() + silence * 1000ULL;
+	if (w->silence_queued && t < w->silence_time)
+		alerts_remove(w);
+	w->silence_time = t;
+	alerts_add(w);
 }
 
 void
@@ -190,9 +322,6 @@ alerts_check_bell(struct window *w)
 	if (!options_get_number(w->options, "monitor-bell"))
 		return (0);
 
-	TAILQ_FOREACH(wl, &w->winlinks, wentry)
-		wl->session->flags &= ~SESSION_ALERTED;
-
 	TAILQ_FOREACH(wl, &w->winlinks, wentry) {
 		/*
 		 * Bells are allowed even if there is an existing bell (so do
@@ -201,15 +330,15 @@ alerts_check_bell(struct window *w)
 		s = wl->session;
 		if (s->curw != wl || s->attached == 0) {
 			wl->flags |= WINLINK_BELL;
-			server_status_session(s);
+			s->flags |= SESSION_ALERTSTATUS;
 		}
 		if (!alerts_action_applies(wl, "bell-action"))
 			continue;
 		notify_winlink("alert-bell", wl);
 
-		if (s->flags & SESSION_ALERTED)
+		if (s->flags & SESSION_BELLALERTED)
 			continue;
-		s->flags |= SESSION_ALERTED;
+		s->flags |= SESSION_BELLALERTED;
 
 		alerts_set_message(wl, "Bell", "visual-bell");
 	}
@@ -228,24 +357,21 @@ alerts_check_activity(struct window *w)
 	if (!options_get_number(w->options, "monitor-activity"))
 		return (0);
 
-	TAILQ_FOREACH(wl, &w->winlinks, wentry)
-		wl->session->flags &= ~SESSION_ALERTED;
-
 	TAILQ_FOREACH(wl, &w->winlinks, wentry) {
 		if (wl->flags & WINLINK_ACTIVITY)
 			continue;
 		s = wl->session;
 		if (s->curw != wl || s->attached == 0) {
 			wl->flags |= WINLINK_ACTIVITY;
-			server_status_session(s);
+			s->flags |= SESSION_ALERTSTATUS;
 		}
 		if (!alerts_action_applies(wl, "activity-action"))
 			continue;
 		notify_winlink("alert-activity", wl);
 
-		if (s->flags & SESSION_ALERTED)
+		if (s->flags & SESSION_ACTIVITYALERTED)
 			continue;
-		s->flags |= SESSION_ALERTED;
+		s->flags |= SESSION_ACTIVITYALERTED;
 
 		alerts_set_message(wl, "Activity", "visual-activity");
 	}
@@ -264,24 +390,21 @@ alerts_check_silence(struct window *w)
 	if (options_get_number(w->options, "monitor-silence") == 0)
 		return (0);
 
-	TAILQ_FOREACH(wl, &w->winlinks, wentry)
-		wl->session->flags &= ~SESSION_ALERTED;
-
 	TAILQ_FOREACH(wl, &w->winlinks, wentry) {
 		if (wl->flags & WINLINK_SILENCE)
 			continue;
 		s = wl->session;
 		if (s->curw != wl || s->attached == 0) {
 			wl->flags |= WINLINK_SILENCE;
-			server_status_session(s);
+			s->flags |= SESSION_ALERTSTATUS;
 		}
 		if (!alerts_action_applies(wl, "silence-action"))
 			continue;
 		notify_winlink("alert-silence", wl);
 
-		if (s->flags & SESSION_ALERTED)
+		if (s->flags & SESSION_SILENCEALERTED)
 			continue;
-		s->flags |= SESSION_ALERTED;
+		s->flags |= SESSION_SILENCEALERTED;
 
 		alerts_set_message(wl, "Silence", "visual-silence");
 	}
@@ -22,75 +22,219 @@
 #include <string.h>
 #include <unistd.h>
 
+#define XMALLOC_TAG XMALLOC_CMDQ
 #include "tmux.h"
 
 /*
  * Manipulate command arguments.
+ *
+ * Arguments are parsed once into a single block holding the flags (sorted by
+ * flag), their values (grouped by flag) and a copy of the argument strings.
+ * They are not changed after parsing, so a parsed command may be run many
+ * times without parsing again.
  */
 
 struct args_value {
+	u_char			 flag;
 	char			*value;
-	TAILQ_ENTRY(args_value)	 entry;
 };
-TAILQ_HEAD(args_values, args_value);
 
 struct args_entry {
 	u_char			 flag;
-	struct args_values	 values;
 	u_int			 count;
-	RB_ENTRY(args_entry)	 entry;
+	u_int			 value;
+	u_int			 nvalues;
 };
 
-static struct args_entry	*args_find(struct args *, u_char);
+/* Number of possible flags (digits and letters). */
+#define ARGS_FLAGS 62
 
-static int	args_cmp(struct args_entry *, struct args_entry *);
-RB_GENERATE_STATIC(args_tree, args_entry, entry, args_cmp);
+/* Per-flag counts while scanning the arguments. */
+struct args_scan {
+	u_int		 count[ARGS_FLAGS];
+	u_int		 nvalues[ARGS_FLAGS];
+	u_int		 next[ARGS_FLAGS];
+};
 
-/* Arguments tree comparison function. */
+/* Get the index for a flag, or -1 if it is not a digit or letter. */
 static int
-args_cmp(struct args_entry *a1, struct args_entry *a2)
+args_index(u_char flag)
 {
-	return (a1->flag - a2->flag);
+	if (flag >= '0' && flag <= '9')
+		return (flag - '0');
+	if (flag >= 'A' && flag <= 'Z')
+		return (10 + flag - 'A');
+	if (flag >= 'a' && flag <= 'z')
+		return (36 + flag - 'a');
+	return (-1);
 }
 
-/* Find a flag in the arguments tree. */
+/* Get the flag for an index. */
+static u_char
+args_flag(int idx)
+{
+	if (idx < 10)
+		return ('0' + idx);
+	if (idx < 36)
+		return ('A' + idx - 10);
+	return ('a' + idx - 36);
+}
+
+/* Find a flag in the arguments. */
 static struct args_entry *
 args_find(struct args *args, u_char flag)
 {
-	struct args_entry	entry;
+	struct args_entry	*entry;
+	int			 idx;
 
-	entry.flag = flag;
-	return (RB_FIND(args_tree, &args->tree, &entry));
+	idx = args_index(flag);
+	if (idx == -1 || (~args->set & (1ULL << idx)))
+		return (NULL);
+	for (entry = args->entries; entry->flag != 0; entry++) {
+		if (entry->flag == flag)
+			return (entry);
+	}
+	return (NULL);
+}
+
+/*
+ * Scan the flags in an argv in the same way as getopt(3). If args is NULL,
+ * count the flags and values and report any errors; otherwise fill in the
+ * values. Returns the index of the first argument or -1 on error.
+ */
+static int
+args_scan(const char *template, int argc, char **argv, struct args *args,
+    struct args_scan *as)
+{
+	const char		*place, *value, *found;
+	char			**copies;
+	struct args_value	*av;
+	u_char			 flag;
+	int			 i, idx;
+
+	for (i = 1; i < argc; i++) {
+		place = argv[i];
+		if (place[0] != '-' || place[1] == '\0')
+			break;
+		if (place[1] == '-') {
+			if (place[2] != '\0')
+				return (-1);
+			return (i + 1);
+		}
+		place++;
+
+		while (*place != '\0') {
+			flag = *place++;
+			if (flag == '-')
+				return (i);
+			found = NULL;
+			if (flag != ':')
+				found = strchr(template, flag);
+			if (found == NULL || (idx = args_index(flag)) == -1) {
+				if (args == NULL) {
+					fprintf(stderr,
+					    "%s: unknown option -- %c\n",
+					    getprogname(), flag);
+				}
+				return (-1);
+			}
+
+			value = NULL;
+			if (found[1] == ':') {
+				if (*place != '\0')
+					value = place;
+				else if (i + 1 < argc)
+					value = argv[++i];
+				else {
+					if (args == NULL) {
+						fprintf(stderr, "%s: option "
+						    "requires an argument -- "
+						    "%c\n", getprogname(),
+						    flag);
+					}
+					return (-1);
+				}
+				place = "";
+			}
+
+			if (args == NULL) {
+				as->count[idx]++;
+				if (value != NULL)
+					as->nvalues[idx]++;
+			} else if (value != NULL) {
+				copies = args->argv - args->first;
+				av = &args->values[as->next[idx]++];
+				av->flag = flag;
+				av->value = copies[i - 1] + (value - argv[i]);
+			}
+		}
+	}
+	return (i);
 }
 
 /* Parse an argv and argc into a new argument set. */
 struct args *
 args_parse(const char *template, int argc, char **argv)
 {
-	struct args	*args;
-	int		 opt;
+	struct args		*args;
+	struct args_scan	 as;
+	struct args_entry	*entry;
+	char			**copies, *cp;
+	size_t			 size, len;
+	u_int			 nentries = 0, nvalues = 0;
+	int			 first, idx, i;
+
+	memset(&as, 0, sizeof as);
+	if ((first = args_scan(template, argc, argv, NULL, &as)) == -1)
+		return (NULL);
+	for (idx = 0; idx < ARGS_FLAGS; idx++) {
+		if (as.count[idx] != 0) {
+			as.next[idx] = nvalues;
+			nentries++;
+			nvalues += as.nvalues[idx];
+		}
+	}
 
-	args = xcalloc(1, sizeof *args);
+	/*
+	 * Everything goes in one block: the arguments, the values, the copied
+	 * strings (with a NULL after them for argv), the entries and then the
+	 * strings themselves.
+	 */
+	size = sizeof *args;
+	size += (nvalues + 1) * sizeof *args->values;
+	size += (argc + 1) * sizeof *copies;
+	size += (nentries + 1) * sizeof *args->entries;
+	for (i = 1; i < argc; i++)
+		size += strlen(argv[i]) + 1;
+	args = xcalloc(1, size);
+
+	args->values = (struct args_value *)(args + 1);
+	copies = (char **)(args->values + nvalues + 1);
+	args->entries = (struct args_entry *)(copies + argc + 1);
+	cp = (char *)(args->entries + nentries + 1);
+	for (i = 1; i < argc; i++) {
+		len = strlen(argv[i]) + 1;
+		memcpy(cp, argv[i], len);
+		copies[i - 1] = cp;
+		cp += len;
+	}
 
-	optreset = 1;
-	optind = 1;
-	optarg = NULL;
+	args->first = first - 1;
+	args->argc = argc - first;
+	args->argv = copies + args->first;
 
-	while ((opt = getopt(argc, argv, template)) != -1) {
-		if (opt < 0)
+	entry = args->entries;
+	for (idx = 0; idx < ARGS_FLAGS; idx++) {
+		if (as.count[idx] == 0)
 			continue;
-		if (opt == '?' || strchr(template, opt) == NULL) {
-			args_free(args);
-			return (NULL);
-		}
-		args_set(args, opt, optarg);
-		optarg = NULL;
+		args->set |= 1ULL << idx;
+		entry->flag = args_flag(idx);
+		entry->count = as.count[idx];
+		entry->value = as.next[idx];
+		entry->nvalues = as.nvalues[idx];
+		entry++;
 	}
-	argc -= optind;
-	argv += optind;
-
-	args->argc = argc;
-	args->argv = cmd_copy_argv(argc, argv);
+	args_scan(template, argc, argv, args, &as);
 
 	return (args);
 }
@@ -99,23 +243,6 @@ args_parse(const char *template, int argc, char **argv)
 void
 args_free(struct args *args)
 {
-	struct args_entry	*entry;
-	struct args_entry	*entry1;
-	struct args_value	*value;
-	struct args_value	*value1;
-
-	cmd_free_argv(args->argc, args->argv);
-
-	RB_FOREACH_SAFE(entry, args_tree, &args->tree, entry1) {
-		RB_REMOVE(args_tree, &args->tree, entry);
-		TAILQ_FOREACH_SAFE(value, &entry->values, entry, value1) {
-			TAILQ_REMOVE(&entry->values, value, entry);
-			free(value->value);
-			free(value);
-		}
-		free(entry);
-	}
-
 	free(args);
 }
 
@@ -140,15 +267,14 @@ args_print_add(char **buf, size_t *len, const char *fmt, ...)
 
 /* Add value to string. */
 static void
-args_print_add_value(char **buf, size_t *len, struct args_entry *entry,
-    struct args_value *value)
+args_print_add_value(char **buf, size_t *len, struct args_value *value)
 {
 	char	*escaped;
 
 	if (**buf != '\0')
-		args_print_add(buf, len, " -%c ", entry->flag);
+		args_print_add(buf, len, " -%c ", value->flag);
 	else
-		args_print_add(buf, len, "-%c ", entry->flag);
+		args_print_add(buf, len, "-%c ", value->flag);
 
 	escaped = args_escape(value->value);
 	args_print_add(buf, len, "%s", escaped);
@@ -184,8 +310,8 @@ args_print(struct args *args)
 	buf = xcalloc(1, len);
 
 	/* Process the flags first. */
-	RB_FOREACH(entry, args_tree, &args->tree) {
-		if (!TAILQ_EMPTY(&entry->values))
+	for (entry = args->entries; entry->flag != 0; entry++) {
+		if (entry->nvalues != 0)
 			continue;
 
 		if (*buf == '\0')
@@ -195,10 +321,8 @@ args_print(struct args *args)
 	}
 
 	/* Then the flags with arguments. */
-	RB_FOREACH(entry, args_tree, &args->tree) {
-		TAILQ_FOREACH(value, &entry->values, entry)
-			args_print_add_value(&buf, &len, entry, value);
-	}
+	for (value = args->values; value->flag != 0; value++)
+		args_print_add_value(&buf, &len, value);
 
 	/* And finally the argument vector. */
 	for (i = 0; i < args->argc; i++)
@@ -266,30 +390,6 @@ args_has(struct args *args, u_char flag)
 	return (entry->count);
 }
 
-/* Set argument value in the arguments tree. */
-void
-args_set(struct args *args, u_char flag, const char *s)
-{
-	struct args_entry	*entry;
-	struct args_value	*value;
-
-	entry = args_find(args, flag);
-	if (entry == NULL) {
-		entry = xcalloc(1, sizeof *entry);
-		entry->flag = flag;
-		entry->count = 1;
-		TAILQ_INIT(&entry->values);
-		RB_INSERT(args_tree, &args->tree, entry);
-	} else
-		entry->count++;
-
-	if (s != NULL) {
-		value = xcalloc(1, sizeof *value);
-		value->value = xstrdup(s);
-		TAILQ_INSERT_TAIL(&entry->values, value, entry);
-	}
-}
-
 /* Get argument value. Will be NULL if it isn't present. */
 const char *
 args_get(struct args *args, u_char flag)
@@ -298,18 +398,16 @@ args_get(struct args *args, u_char flag)
 
 	if ((entry = args_find(args, flag)) == NULL)
 		return (NULL);
-	if (TAILQ_EMPTY(&entry->values))
+	if (entry->nvalues == 0)
 		return (NULL);
-	return (TAILQ_LAST(&entry->values, args_values)->value);
+	return (args->values[entry->value + entry->nvalues - 1].value);
 }
 
 /* Get first argument. */
 u_char
 args_first(struct args *args, struct args_entry **entry)
 {
-	*entry = RB_MIN(args_tree, &args->tree);
-	if (*entry == NULL)
-		return (0);
+	*entry = args->entries;
 	return ((*entry)->flag);
 }
 
@@ -317,9 +415,9 @@ args_first(struct args *args, struct args_entry **entry)
 u_char
 args_next(struct args_entry **entry)
 {
-	*entry = RB_NEXT(args_tree, &args->tree, *entry);
-	if (*entry == NULL)
+	if ((*entry)->flag == 0)
 		return (0);
+	(*entry)++;
 	return ((*entry)->flag);
 }
 
@@ -329,12 +427,11 @@ args_first_value(struct args *args, u_char flag, struct args_value **value)
 {
 	struct args_entry	*entry;
 
-	if ((entry = args_find(args, flag)) == NULL)
-		return (NULL);
-
-	*value = TAILQ_FIRST(&entry->values);
-	if (*value == NULL)
+	if ((entry = args_find(args, flag)) == NULL || entry->nvalues == 0) {
+		*value = NULL;
 		return (NULL);
+	}
+	*value = &args->values[entry->value];
 	return ((*value)->value);
 }
 
@@ -344,9 +441,11 @@ args_next_value(struct args_value **value)
 {
 	if (*value == NULL)
 		return (NULL);
-	*value = TAILQ_NEXT(*value, entry);
-	if (*value == NULL)
+	if ((*value)[1].flag != (*value)->flag) {
+		*value = NULL;
 		return (NULL);
+	}
+	(*value)++;
 	return ((*value)->value);
 }
 
@@ -355,18 +454,15 @@ long long
 args_strtonum(struct args *args, u_char flag, long long minval,
     long long maxval, char **cause)
 {
-	const char		*errstr;
+	const char		*errstr, *value;
 	long long 	 	 ll;
-	struct args_entry	*entry;
-	struct args_value	*value;
 
-	if ((entry = args_find(args, flag)) == NULL) {
+	if ((value = args_get(args, flag)) == NULL) {
 		*cause = xstrdup("missing");
 		return (0);
 	}
-	value = TAILQ_LAST(&entry->values, args_values);
 
-	ll = strtonum(value->value, minval, maxval, &errstr);
+	ll = strtonum(value, minval, maxval, &errstr);
 	if (errstr != NULL) {
 		*cause = xstrdup(errstr);
 		return (0);
@@ -382,13 +478,11 @@ args_percentage(struct args *args, u_char flag, long long minval,
     long long maxval, long long curval, char **cause)
 {
 	const char		*value;
-	struct args_entry	*entry;
 
-	if ((entry = args_find(args, flag)) == NULL) {
+	if ((value = args_get(args, flag)) == NULL) {
 		*cause = xstrdup("missing");
 		return (0);
 	}
-	value = TAILQ_LAST(&entry->values, args_values)->value;
 	return (args_string_percentage(value, minval, maxval, curval, cause));
 }
 
@@ -17,12 +17,14 @@
  */
 
 #include <sys/types.h>
+#include <sys/stat.h>
 
 #include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "tmux.h"
 
@@ -32,9 +34,287 @@ static char		**cfg_causes;
 static u_int		  cfg_ncauses;
 static struct cmdq_item	 *cfg_item;
 
+/* Number of slowest startup commands kept. */
+#define CFG_TIMING_SLOWEST 10
+
+/* Time taken by each configuration file loaded at startup. */
+struct cfg_timing {
+	char		*file;
+	u_int		 commands;
+	uint64_t	 parse;
+	uint64_t	 run;
+};
+static struct cfg_timing	*cfg_timings;
+static u_int			 cfg_ntimings;
+static uint64_t			 cfg_start;
+static uint64_t			 cfg_total;
+
+/* A slow command run at startup. */
+struct cfg_timing_command {
+	const char	*file;
+	u_int		 line;
+	const char	*name;
+	uint64_t	 time;
+};
+static struct cfg_timing_command cfg_slowest[CFG_TIMING_SLOWEST];
+
 int                       cfg_quiet = 1;
 char                    **cfg_files;
 u_int                     cfg_nfiles;
+char			 *cfg_cache_file;
+
+/*
+ * Commands parsed from configuration files at startup may be saved to a cache
+ * file and used next time if the file has not changed (same size, inode,
+ * modification and change times and a hash of the contents, since the times
+ * may only change once a second). Files whose parsing depended on something
+ * else (such as an environment variable or a %if) are not cached.
+ */
+#define CFG_CACHE_MAGIC "tmux configuration cache 2\n"
+struct cfg_cache_entry {
+	char		*file;
+	uint64_t	 key[6];
+	void		*data;
+	size_t		 size;
+	int		 used;
+};
+static struct cfg_cache_entry	*cfg_cache;
+static u_int			 cfg_ncache;
+static int			 cfg_cache_changed;
+
+/* Make the key for a file, then go back to the start of it. */
+static int
+cfg_cache_key(FILE *f, uint64_t *key)
+{
+	struct stat	sb;
+	char		buf[BUFSIZ];
+	size_t		n, i;
+	uint64_t	hash = 14695981039346656037ULL;
+
+	if (fstat(fileno(f), &sb) != 0 || !S_ISREG(sb.st_mode))
+		return (-1);
+	key[0] = sb.st_dev;
+	key[1] = sb.st_ino;
+	key[2] = sb.st_size;
+	key[3] = sb.st_mtime;
+	key[4] = sb.st_ctime;
+
+	while ((n = fread(buf, 1, sizeof buf, f)) != 0) {
+		for (i = 0; i < n; i++) {
+			hash ^= (u_char)buf[i];
+			hash *= 1099511628211ULL;
+		}
+	}
+	if (ferror(f)) {
+		rewind(f);
+		return (-1);
+	}
+	rewind(f);
+	key[5] = hash;
+	return (0);
+}
+
+static int
+cfg_cache_get(const u_char **buf, size_t *len, void *out, size_t size)
+{
+	if (*len < size)
+		return (0);
+	memcpy(out, *buf, size);
+	(*buf) += size;
+	(*len) -= size;
+	return (1);
+}
+
+static void
+cfg_cache_free(void)
+{
+	u_int	i;
+
+	for (i = 0; i < cfg_ncache; i++) {
+		free(cfg_cache[i].file);
+		free(cfg_cache[i].data);
+	}
+	free(cfg_cache);
+	cfg_cache = NULL;
+	cfg_ncache = 0;
+}
+
+/* Read the cache file, ignoring it entirely if it is not valid. */
+static void
+cfg_cache_load(void)
+{
+	struct cfg_cache_entry	*cce;
+	FILE			*f;
+	struct stat		 sb;
+	u_char			*buf = NULL;
+	const u_char		*cp;
+	size_t			 len;
+	uint64_t		 size;
+
+	if ((f = fopen(cfg_cache_file, "rb")) == NULL) {
+		log_debug("%s: %s: %s", __func__, cfg_cache_file,
+		    strerror(errno));
+		return;
+	}
+	if (fstat(fileno(f), &sb) != 0 || sb.st_size < 0)
+		goto fail;
+	len = sb.st_size;
+	buf = xmalloc(len + 1);
+	if (fread(buf, 1, len, f) != len)
+		goto fail;
+
+	cp = buf;
+	if (len < strlen(CFG_CACHE_MAGIC) ||
+	    memcmp(cp, CFG_CACHE_MAGIC, strlen(CFG_CACHE_MAGIC)) != 0)
+		goto fail;
+	cp += strlen(CFG_CACHE_MAGIC);
+	len -= strlen(CFG_CACHE_MAGIC);
+
+	while (len != 0) {
+		cfg_cache = xreallocarray(cfg_cache, cfg_ncache + 1,
+		    sizeof *cfg_cache);
+		cce = &cfg_cache[cfg_ncache++];
+		memset(cce, 0, sizeof *cce);
+
+		if (!cfg_cache_get(&cp, &len, &size, sizeof size))
+			goto fail;
+		if (size == 0 || size > len)
+			goto fail;
+		cce->file = xmalloc(size + 1);
+		memcpy(cce->file, cp, size);
+		cce->file[size] = '\0';
+		cp += size;
+		len -= size;
+
+		if (!cfg_cache_get(&cp, &len, cce->key, sizeof cce->key))
+			goto fail;
+		if (!cfg_cache_get(&cp, &len, &size, sizeof size))
+			goto fail;
+		if (size > len)
+			goto fail;
+		cce->data = xmalloc(size);
+		memcpy(cce->data, cp, size);
+		cce->size = size;
+		cp += size;
+		len -= size;
+	}
+	log_debug("%s: %s: %u files", __func__, cfg_cache_file, cfg_ncache);
+
+	free(buf);
+	fclose(f);
+	return;
+
+fail:
+	log_debug("%s: %s: invalid cache", __func__, cfg_cache_file);
+	cfg_cache_free();
+	cfg_cache_changed = 1;
+	free(buf);
+	fclose(f);
+}
+
+/* Write the cache file if it has changed, then free the cache. */
+static void
+cfg_cache_save(void)
+{
+	struct cfg_cache_entry	*cce;
+	char			*path;
+	FILE			*f;
+	int			 fd;
+	uint64_t		 size;
+	u_int			 i;
+
+	for (i = 0; i < cfg_ncache; i++) {
+		if (!cfg_cache[i].used)
+			cfg_cache_changed = 1;
+	}
+	if (!cfg_cache_changed)
+		goto out;
+
+	xasprintf(&path, "%s.XXXXXX", cfg_cache_file);
+	if ((fd = mkstemp(path)) == -1 || (f = fdopen(fd, "wb")) == NULL) {
+		log_debug("%s: %s: %s", __func__, path, strerror(errno));
+		if (fd != -1) {
+			close(fd);
+			unlink(path);
+		}
+		free(path);
+		goto out;
+	}
+
+	fputs(CFG_CACHE_MAGIC, f);
+	for (i = 0; i < cfg_ncache; i++) {
+		cce = &cfg_cache[i];
+		if (!cce->used)
+			continue;
+		size = strlen(cce->file);
+		fwrite(&size, sizeof size, 1, f);
+		fwrite(cce->file, 1, size, f);
+		fwrite(cce->key, sizeof cce->key, 1, f);
+		size = cce->size;
+		fwrite(&size, sizeof size, 1, f);
+		fwrite(cce->data, 1, cce->size, f);
+	}
+	if (fclose(f) != 0 || rename(path, cfg_cache_file) != 0) {
+		log_debug("%s: %s: %s", __func__, path, strerror(errno));
+		unlink(path);
+	} else
+		log_debug("%s: %s: saved", __func__, cfg_cache_file);
+	free(path);
+
+out:
+	cfg_cache_free();
+}
+
+/* Parse a file, using and updating the cache if enabled. */
+static struct cmd_parse_result *
+cfg_cache_parse(FILE *f, const char *path, struct cmd_parse_input *pi)
+{
+	struct cmd_parse_result	*pr;
+	struct cfg_cache_entry	*cce = NULL;
+	struct evbuffer		*saved;
+	uint64_t		 key[6];
+	u_int			 i;
+
+	if (cfg_cache_file == NULL || cfg_finished || cfg_cache_key(f, key) != 0)
+		return (cmd_parse_from_file(f, pi));
+
+	for (i = 0; i < cfg_ncache; i++) {
+		if (strcmp(cfg_cache[i].file, path) == 0) {
+			cce = &cfg_cache[i];
+			break;
+		}
+	}
+	if (cce != NULL && memcmp(cce->key, key, sizeof key) == 0) {
+		pr = cmd_parse_from_saved(cce->data, cce->size, pi);
+		if (pr != NULL) {
+			log_debug("%s: %s: using cache", __func__, path);
+			cce->used = 1;
+			return (pr);
+		}
+	}
+
+	saved = evbuffer_new();
+	if (saved == NULL)
+		fatalx("out of memory");
+	pr = cmd_parse_from_file_save(f, pi, saved);
+	if (EVBUFFER_LENGTH(saved) != 0) {
+		if (cce == NULL) {
+			cfg_cache = xreallocarray(cfg_cache, cfg_ncache + 1,
+			    sizeof *cfg_cache);
+			cce = &cfg_cache[cfg_ncache++];
+			cce->file = xstrdup(path);
+		} else
+			free(cce->data);
+		memcpy(cce->key, key, sizeof cce->key);
+		cce->size = EVBUFFER_LENGTH(saved);
+		cce->data = xmalloc(cce->size);
+		memcpy(cce->data, EVBUFFER_DATA(saved), cce->size);
+		cce->used = 1;
+		cfg_cache_changed = 1;
+	}
+	evbuffer_free(saved);
+	return (pr);
+}
 
 static enum cmd_retval
 cfg_client_done(__unused struct cmdq_item *item, __unused void *data)
@@ -51,6 +331,13 @@ cfg_done(__unused struct cmdq_item *item, __unused void *data)
 		return (CMD_RETURN_NORMAL);
 	cfg_finished = 1;
 
+	if (cfg_cache_file != NULL)
+		cfg_cache_save();
+
+	cfg_total = get_timer_usec() - cfg_start;
+	log_debug("%s: configuration loaded in %llu us", __func__,
+	    (unsigned long long)cfg_total);
+
 	if (!RB_EMPTY(&sessions))
 		cfg_show_causes(RB_MIN(sessions, &sessions));
 
@@ -78,6 +365,10 @@ start_cfg(void)
 	 * command queue is currently empty and our callback will be at the
 	 * front - we need to get in before MSG_COMMAND.
 	 */
+	cfg_start = get_timer_usec();
+	if (cfg_cache_file != NULL)
+		cfg_cache_load();
+
 	cfg_client = c = TAILQ_FIRST(&clients);
 	if (c != NULL) {
 		cfg_item = cmdq_get_callback(cfg_client_done, NULL);
@@ -94,6 +385,124 @@ start_cfg(void)
 	cmdq_append(NULL, cmdq_get_callback(cfg_done, NULL));
 }
 
+static struct cfg_timing *
+cfg_find_timing(const char *file)
+{
+	u_int	i;
+
+	for (i = cfg_ntimings; i > 0; i--) {
+		if (strcmp(cfg_timings[i - 1].file, file) == 0)
+			return (&cfg_timings[i - 1]);
+	}
+	return (NULL);
+}
+
+/* Record how long a file took to parse if loading at startup. */
+static void
+cfg_add_timing(const char *path, uint64_t start, struct cmd_parse_result *pr)
+{
+	struct cfg_timing	*ct;
+	struct cmd		*cmd;
+	uint64_t		 t;
+	u_int			 n = 0;
+
+	if (cfg_finished)
+		return;
+	t = get_timer_usec() - start;
+
+	if (pr->status == CMD_PARSE_SUCCESS) {
+		cmd = cmd_list_first(pr->cmdlist);
+		for (; cmd != NULL; cmd = cmd_list_next(cmd))
+			n++;
+	}
+
+	if ((ct = cfg_find_timing(path)) == NULL) {
+		cfg_timings = xreallocarray(cfg_timings, cfg_ntimings + 1,
+		    sizeof *cfg_timings);
+		ct = &cfg_timings[cfg_ntimings++];
+		memset(ct, 0, sizeof *ct);
+		ct->file = xstrdup(path);
+	}
+	ct->commands += n;
+	ct->parse += t;
+	log_debug("%s: %s: %u commands parsed in %llu us", __func__, path, n,
+	    (unsigned long long)t);
+}
+
+/* Record how long a command from a configuration file took at startup. */
+void
+cfg_add_command_timing(struct cmd *cmd, uint64_t t)
+{
+	struct cfg_timing		*ct;
+	struct cfg_timing_command	*ctc;
+	const char			*file, *name;
+	u_int				 line, i;
+
+	cmd_get_source(cmd, &file, &line);
+	if (file == NULL || (ct = cfg_find_timing(file)) == NULL)
+		return;
+	ct->run += t;
+
+	name = cmd_get_entry(cmd)->name;
+	if (log_get_level() > 1) {
+		log_debug("%s: %s:%u: %s took %llu us", __func__, file, line,
+		    name, (unsigned long long)t);
+	}
+
+	/* Keep the slowest commands in order, the slowest first. */
+	for (i = 0; i < CFG_TIMING_SLOWEST; i++) {
+		if (cfg_slowest[i].file == NULL || t > cfg_slowest[i].time)
+			break;
+	}
+	if (i == CFG_TIMING_SLOWEST)
+		return;
+	memmove(&cfg_slowest[i + 1], &cfg_slowest[i],
+	    (CFG_TIMING_SLOWEST - i - 1) * sizeof *cfg_slowest);
+	ctc = &cfg_slowest[i];
+	ctc->file = ct->file;
+	ctc->line = line;
+	ctc->name = name;
+	ctc->time = t;
+}
+
+/* Print startup configuration timings. */
+int
+cfg_print_timings(struct cmdq_item *item, int blank)
+{
+	struct cfg_timing		*ct;
+	struct cfg_timing_command	*ctc;
+	u_int				 i;
+
+	if (cfg_ntimings == 0)
+		return (blank);
+	if (blank)
+		cmdq_print(item, "%s", "");
+
+	if (cfg_finished) {
+		cmdq_print(item, "Configuration loaded in %llu us:",
+		    (unsigned long long)cfg_total);
+	} else
+		cmdq_print(item, "Configuration loading:");
+	for (i = 0; i < cfg_ntimings; i++) {
+		ct = &cfg_timings[i];
+		cmdq_print(item, "  %s: %u commands, parsed in %llu us, "
+		    "run in %llu us", ct->file, ct->commands,
+		    (unsigned long long)ct->parse, (unsigned long long)ct->run);
+	}
+
+	if (cfg_slowest[0].file == NULL)
+		return (1);
+	cmdq_print(item, "Slowest commands:");
+	for (i = 0; i < CFG_TIMING_SLOWEST; i++) {
+		ctc = &cfg_slowest[i];
+		if (ctc->file == NULL)
+			break;
+		cmdq_print(item, "  %s:%u: %s, %llu us", ctc->file, ctc->line,
+		    ctc->name, (unsigned long long)ctc->time);
+	}
+	return (1);
+}
+
 int
 load_cfg(const char *path, struct client *c, struct cmdq_item *item, int flags,
     struct cmdq_item **new_item)
@@ -103,6 +512,7 @@ load_cfg(const char *path, struct client *c, struct cmdq_item *item, int flags,
 	struct cmd_parse_result	*pr;
 	struct cmdq_item	*new_item0;
 	struct cmdq_state	*state;
+	uint64_t		 start;
 
 	if (new_item != NULL)
 		*new_item = NULL;
@@ -122,8 +532,10 @@ load_cfg(const char *path, struct client *c, struct cmdq_item *item, int flags,
 	pi.item = item;
 	pi.c = c;
 
-	pr = cmd_parse_from_file(f, &pi);
+	start = get_timer_usec();
+	pr = cfg_cache_parse(f, path, &pi);
 	fclose(f);
+	cfg_add_timing(path, start, pr);
 	if (pr->status == CMD_PARSE_EMPTY)
 		return (0);
 	if (pr->status == CMD_PARSE_ERROR) {
@@ -164,6 +576,7 @@ load_cfg_from_buffer(const void *buf, size_t len, const char *path,
 	struct cmd_parse_result	*pr;
 	struct cmdq_item	*new_item0;
 	struct cmdq_state	*state;
+	uint64_t		 start;
 
 	if (new_item != NULL)
 		*new_item = NULL;
@@ -177,7 +590,9 @@ load_cfg_from_buffer(const void *buf, size_t len, const char *path,
 	pi.item = item;
 	pi.c = c;
 
+	start = get_timer_usec();
 	pr = cmd_parse_from_buffer(buf, len, &pi);
+	cfg_add_timing(path, start, pr);
 	if (pr->status == CMD_PARSE_EMPTY)
 		return (0);
 	if (pr->status == CMD_PARSE_ERROR) {
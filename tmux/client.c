@@ -56,6 +56,7 @@ static const char	*client_execshell;
 static const char	*client_execcmd;
 static int		 client_attached;
 static struct client_files client_files = RB_INITIALIZER(&client_files);
+static struct file_ring	*client_ring;
 
 static __dead void	 client_exec(const char *,const char *);
 static int		 client_get_lock(char *);
@@ -253,19 +254,23 @@ client_main(struct event_base *base, int argc, char **argv, uint64_t flags,
 		flags |= CLIENT_STARTSERVER;
 	} else if (argc == 0) {
 		msg = MSG_COMMAND;
-		flags |= CLIENT_STARTSERVER;
+		if (~flags & CLIENT_CONTROL_PIPE)
+			flags |= CLIENT_STARTSERVER;
 	} else {
 		msg = MSG_COMMAND;
 
 		/*
 		 * It sucks parsing the command string twice (in client and
 		 * later in server) but it is necessary to get the start server
-		 * flag.
+		 * flag and to know if the command needs the environment and
+		 * terminal.
 		 */
 		pr = cmd_parse_from_arguments(argc, argv, NULL);
 		if (pr->status == CMD_PARSE_SUCCESS) {
 			if (cmd_list_any_have(pr->cmdlist, CMD_STARTSERVER))
 				flags |= CLIENT_STARTSERVER;
+			if (!cmd_list_any_have(pr->cmdlist, CMD_CLIENTENV))
+				flags |= CLIENT_COMMANDONLY;
 			cmd_list_free(pr->cmdlist);
 		} else
 			free(pr->error);
@@ -308,15 +313,17 @@ client_main(struct event_base *base, int argc, char **argv, uint64_t flags,
 	 * "tty" is needed to restore termios(4) and also for some reason -CC
 	 * does not work properly without it (input is not recognised).
 	 *
-	 * "sendfd" is dropped later in client_dispatch_wait().
+	 * "sendfd" is kept so the client can pass the server a ring if it asks
+	 * for one (MSG_RING_OPEN).
 	 */
 	if (pledge(
 	    "stdio rpath wpath cpath unix sendfd proc exec tty",
 	    NULL) != 0)
 		fatal("pledge failed");
 
-	/* Load terminfo entry if any. */
-	if (isatty(STDIN_FILENO) &&
+	/* Load terminfo entry if any and the command could attach. */
+	if (~client_flags & CLIENT_COMMANDONLY &&
+	    isatty(STDIN_FILENO) &&
 	    *termname != '\0' &&
 	    tty_term_read_list(termname, STDIN_FILENO, &caps, &ncaps,
 	    &cause) != 0) {
@@ -358,8 +365,12 @@ client_main(struct event_base *base, int argc, char **argv, uint64_t flags,
 	client_send_identify(ttynam, termname, caps, ncaps, cwd, feat);
 	tty_term_free_list(caps, ncaps);
 
-	/* Send first command. */
-	if (msg == MSG_COMMAND) {
+	/*
+	 * Send first command. In pipe mode there may be none: the client
+	 * waits for commands on stdin.
+	 */
+	if (msg == MSG_COMMAND && (argc != 0 ||
+	    (~client_flags & CLIENT_CONTROL_PIPE))) {
 		/* How big is the command? */
 		size = 0;
 		for (i = 0; i < argc; i++)
@@ -437,6 +448,17 @@ client_main(struct event_base *base, int argc, char **argv, uint64_t flags,
 	return (client_exitval);
 }
 
+/*
+ * Is this environment variable needed by a client that only runs a command?
+ * The server uses these to find the current session and pane.
+ */
+static int
+client_command_environ(const char *s)
+{
+	return (strncmp(s, "TMUX=", 5) == 0 ||
+	    strncmp(s, "TMUX_PANE=", 10) == 0);
+}
+
 /* Send identify messages to server. */
 static void
 client_send_identify(const char *ttynam, const char *termname, char **caps,
@@ -448,6 +470,9 @@ client_send_identify(const char *ttynam, const char *termname, char **caps,
 	pid_t	  pid;
 	u_int	  i;
 
+	/* The server may ask for a ring to send large output through. */
+	client_flags |= CLIENT_RING;
+
 	proc_send(client_peer, MSG_IDENTIFY_FLAGS, -1, &flags, sizeof flags);
 	proc_send(client_peer, MSG_IDENTIFY_LONGFLAGS, -1, &client_flags,
 	    sizeof client_flags);
@@ -476,6 +501,9 @@ client_send_identify(const char *ttynam, const char *termname, char **caps,
 	proc_send(client_peer, MSG_IDENTIFY_CLIENTPID, -1, &pid, sizeof pid);
 
 	for (ss = environ; *ss != NULL; ss++) {
+		if ((client_flags & CLIENT_COMMANDONLY) &&
+		    !client_command_environ(*ss))
+			continue;
 		sslen = strlen(*ss) + 1;
 		if (sslen > MAX_IMSGSIZE - IMSG_HEADER_SIZE)
 			continue;
@@ -620,22 +648,6 @@ client_dispatch_wait(struct imsg *imsg)
 {
 	char		*data;
 	ssize_t		 datalen;
-	static int	 pledge_applied;
-
-	/*
-	 * "sendfd" is no longer required once all of the identify messages
-	 * have been sent. We know the server won't send us anything until that
-	 * point (because we don't ask it to), so we can drop "sendfd" once we
-	 * get the first message from the server.
-	 */
-	if (!pledge_applied) {
-		if (pledge(
-		    "stdio rpath wpath cpath unix proc exec tty",
-		    NULL) != 0)
-			fatal("pledge failed");
-		pledge_applied = 1;
-	}
-
 	data = imsg->data;
 	datalen = imsg->hdr.len - IMSG_HEADER_SIZE;
 
@@ -697,6 +709,15 @@ client_dispatch_wait(struct imsg *imsg)
 	case MSG_WRITE:
 		file_write_data(&client_files, imsg);
 		break;
+	case MSG_WRITE_RING:
+		file_write_ring(&client_files, client_ring, imsg);
+		break;
+	case MSG_RING_OPEN:
+		if (datalen != 0)
+			fatalx("bad MSG_RING_OPEN size");
+		if (client_ring == NULL)
+			client_ring = file_ring_create(client_peer);
+		break;
 	case MSG_WRITE_CLOSE:
 		file_write_close(&client_files, imsg);
 		break;
@@ -728,11 +749,20 @@ client_dispatch_attached(struct imsg *imsg)
 		memcpy(&client_flags, data, sizeof client_flags);
 		log_debug("new flags are %#llx",
 		    (unsigned long long)client_flags);
+		if (~client_flags & CLIENT_RENDER)
+			render_stop();
+		break;
+	case MSG_RENDER_RESET:
+	case MSG_RENDER_LINE:
+	case MSG_RENDER_CURSOR:
+		if (client_flags & CLIENT_RENDER)
+			render_dispatch(imsg, client_flags);
 		break;
 	case MSG_DETACH:
 	case MSG_DETACHKILL:
 		if (datalen == 0 || data[datalen - 1] != '\0')
 			fatalx("bad MSG_DETACH string");
+		render_stop();
 
 		client_exitsession = xstrdup(data);
 		client_exittype = imsg->hdr.type;
@@ -748,6 +778,7 @@ client_dispatch_attached(struct imsg *imsg)
 			fatalx("bad MSG_EXEC string");
 		client_execcmd = xstrdup(data);
 		client_execshell = xstrdup(data + strlen(data) + 1);
+		render_stop();
 
 		client_exittype = imsg->hdr.type;
 		proc_send(client_peer, MSG_EXITING, -1, NULL, 0);
@@ -756,6 +787,7 @@ client_dispatch_attached(struct imsg *imsg)
 		client_dispatch_exit_message(data, datalen);
 		if (client_exitreason == CLIENT_EXIT_NONE)
 			client_exitreason = CLIENT_EXIT_EXITED;
+		render_stop();
 		proc_send(client_peer, MSG_EXITING, -1, NULL, 0);
 		break;
 	case MSG_EXITED:
@@ -768,6 +800,7 @@ client_dispatch_attached(struct imsg *imsg)
 		if (datalen != 0)
 			fatalx("bad MSG_SHUTDOWN size");
 
+		render_stop();
 		proc_send(client_peer, MSG_EXITING, -1, NULL, 0);
 		client_exitreason = CLIENT_EXIT_SERVER_EXITED;
 		client_exitval = 1;
@@ -776,6 +809,7 @@ client_dispatch_attached(struct imsg *imsg)
 		if (datalen != 0)
 			fatalx("bad MSG_SUSPEND size");
 
+		render_stop();
 		memset(&sigact, 0, sizeof sigact);
 		sigemptyset(&sigact.sa_mask);
 		sigact.sa_flags = SA_RESTART;
@@ -32,8 +32,14 @@ static enum cmd_retval	cmd_capture_pane_exec(struct cmd *, struct cmdq_item *);
 static char	*cmd_capture_pane_append(char *, size_t *, char *, size_t);
 static char	*cmd_capture_pane_pending(struct args *, struct window_pane *,
 		     size_t *);
+static int	 cmd_capture_pane_range(struct args *, struct cmdq_item *,
+		     struct window_pane *, struct grid **, u_int *, u_int *);
+static char	*cmd_capture_pane_line(char *, size_t *, struct grid *, u_int,
+		     u_int, struct grid_cell **, struct args *);
 static char	*cmd_capture_pane_history(struct args *, struct cmdq_item *,
 		     struct window_pane *, size_t *);
+static enum cmd_retval cmd_capture_pane_stream(struct args *,
+		     struct cmdq_item *, struct window_pane *);
 
 const struct cmd_entry cmd_capture_pane_entry = {
 	.name = "capture-pane",
@@ -49,6 +55,27 @@ const struct cmd_entry cmd_capture_pane_entry = {
 	.exec = cmd_capture_pane_exec
 };
 
+/* Lines written at a time and output allowed to wait for the client. */
+#define CAPTURE_PANE_LINES 1000
+#define CAPTURE_PANE_LEFT (1024 * 1024)
+
+struct cmd_capture_pane_data {
+	struct cmdq_item	*item;
+	struct args		*args;
+	struct client		*c;
+
+	struct grid		*gd;
+	u_int			 sx;
+	u_int			 next;
+	u_int			 end;
+
+	struct grid_cell	 cell;
+	struct grid_cell	*lastgc;
+	int			 newline;
+
+	struct event		 timer;
+};
+
 const struct cmd_entry cmd_clear_history_entry = {
 	.name = "clear-history",
 	.alias = "clearhist",
@@ -103,31 +130,28 @@ cmd_capture_pane_pending(struct args *args, struct window_pane *wp,
 	return (buf);
 }
 
-static char *
-cmd_capture_pane_history(struct args *args, struct cmdq_item *item,
-    struct window_pane *wp, size_t *len)
+static int
+cmd_capture_pane_range(struct args *args, struct cmdq_item *item,
+    struct window_pane *wp, struct grid **gdp, u_int *topp, u_int *bottomp)
 {
 	struct grid		*gd;
-	const struct grid_line	*gl;
-	struct grid_cell	*gc = NULL;
-	int			 n, with_codes, escape_c0, join_lines, no_trim;
-	u_int			 i, sx, top, bottom, tmp;
-	char			*cause, *buf, *line;
+	int			 n;
+	u_int			 top, bottom, tmp;
+	char			*cause;
 	const char		*Sflag, *Eflag;
-	size_t			 linelen;
 
-	sx = screen_size_x(&wp->base);
 	if (args_has(args, 'a')) {
 		gd = wp->base.saved_grid;
 		if (gd == NULL) {
 			if (!args_has(args, 'q')) {
 				cmdq_error(item, "no alternate screen");
-				return (NULL);
+				return (-1);
 			}
-			return (xstrdup(""));
+			return (0);
 		}
 	} else
 		gd = wp->base.grid;
+	grid_reflow_pending(gd, 1);
 
 	Sflag = args_get(args, 'S');
 	if (Sflag != NULL && strcmp(Sflag, "-") == 0)
@@ -167,28 +191,178 @@ cmd_capture_pane_history(struct args *args, struct cmdq_item *item,
 		top = tmp;
 	}
 
+	*gdp = gd;
+	*topp = top;
+	*bottomp = bottom;
+	return (1);
+}
+
+static char *
+cmd_capture_pane_line(char *buf, size_t *len, struct grid *gd, u_int py,
+    u_int sx, struct grid_cell **gc, struct args *args)
+{
+	const struct grid_line	*gl;
+	int			 with_codes, escape_c0, join_lines, no_trim;
+	char			*line;
+	size_t			 size;
+
 	with_codes = args_has(args, 'e');
 	escape_c0 = args_has(args, 'C');
 	join_lines = args_has(args, 'J');
 	no_trim = args_has(args, 'N');
 
-	buf = NULL;
-	for (i = top; i <= bottom; i++) {
-		line = grid_string_cells(gd, 0, i, sx, &gc, with_codes,
+	if (with_codes || escape_c0) {
+		line = grid_string_cells(gd, 0, py, sx, gc, with_codes,
 		    escape_c0, !join_lines && !no_trim);
-		linelen = strlen(line);
+		buf = cmd_capture_pane_append(buf, len, line, strlen(line));
+		free(line);
+	} else {
+		/* Plain text can be copied straight into the buffer. */
+		size = grid_string_text(gd, 0, py, sx, NULL, 0);
+		buf = xrealloc(buf, *len + size + 1);
+		grid_string_text(gd, 0, py, sx, buf + *len, 0);
+		if (!join_lines && !no_trim) {
+			while (size > 0 && buf[*len + size - 1] == ' ')
+				size--;
+		}
+		*len += size;
+	}
 
-		buf = cmd_capture_pane_append(buf, len, line, linelen);
+	gl = grid_peek_line(gd, py);
+	if (!join_lines || !(gl->flags & GRID_LINE_WRAPPED))
+		buf[(*len)++] = '\n';
+	return (buf);
+}
 
-		gl = grid_peek_line(gd, i);
-		if (!join_lines || !(gl->flags & GRID_LINE_WRAPPED))
-			buf[(*len)++] = '\n';
+static char *
+cmd_capture_pane_history(struct args *args, struct cmdq_item *item,
+    struct window_pane *wp, size_t *len)
+{
+	struct grid		*gd;
+	struct grid_cell	*gc = NULL;
+	u_int			 i, sx, top, bottom;
+	char			*buf;
 
-		free(line);
+	switch (cmd_capture_pane_range(args, item, wp, &gd, &top, &bottom)) {
+	case -1:
+		return (NULL);
+	case 0:
+		return (xstrdup(""));
 	}
+	sx = screen_size_x(&wp->base);
+
+	buf = NULL;
+	for (i = top; i <= bottom; i++)
+		buf = cmd_capture_pane_line(buf, len, gd, i, sx, &gc, args);
+	grid_pack_history(gd);
 	return (buf);
 }
 
+static void
+cmd_capture_pane_free(struct cmd_capture_pane_data *cd)
+{
+	if (event_initialized(&cd->timer))
+		evtimer_del(&cd->timer);
+	grid_destroy(cd->gd);
+	free(cd);
+}
+
+/* Write lines until done or until the client has enough waiting. */
+static int
+cmd_capture_pane_write(struct cmd_capture_pane_data *cd)
+{
+	char	*buf;
+	size_t	 len;
+	u_int	 i, n;
+
+	while (cd->next != cd->end) {
+		if (file_print_left(cd->c) > CAPTURE_PANE_LEFT)
+			return (0);
+
+		n = cd->end - cd->next;
+		if (n > CAPTURE_PANE_LINES)
+			n = CAPTURE_PANE_LINES;
+
+		buf = NULL;
+		len = 0;
+		for (i = cd->next; i < cd->next + n; i++) {
+			buf = cmd_capture_pane_line(buf, &len, cd->gd, i,
+			    cd->sx, &cd->lastgc, cd->args);
+		}
+		file_print_buffer(cd->c, buf, len);
+		cd->newline = (buf[len - 1] == '\n');
+		free(buf);
+
+		/* These lines are finished with, so free their cells. */
+		grid_clear_lines(cd->gd, cd->next, n, 8);
+		cd->next += n;
+	}
+	if (!cd->newline)
+		file_print(cd->c, "\n");
+	return (1);
+}
+
+static void
+cmd_capture_pane_timer(__unused int fd, __unused short events, void *arg)
+{
+	struct cmd_capture_pane_data	*cd = arg;
+	struct timeval			 tv = { .tv_usec = 10000 };
+
+	if ((~cd->c->flags & CLIENT_DEAD) && !cmd_capture_pane_write(cd)) {
+		evtimer_add(&cd->timer, &tv);
+		return;
+	}
+	cmdq_continue(cd->item);
+	cmd_capture_pane_free(cd);
+}
+
+/*
+ * Print history to a client without building it all in one buffer. The lines
+ * are copied into a snapshot, which shares most of the history with the pane,
+ * and written a batch at a time as the client reads them.
+ */
+static enum cmd_retval
+cmd_capture_pane_stream(struct args *args, struct cmdq_item *item,
+    struct window_pane *wp)
+{
+	struct client			*c = cmdq_get_client(item);
+	struct cmd_capture_pane_data	*cd;
+	struct grid			*gd;
+	struct timeval			 tv = { .tv_usec = 10000 };
+	u_int				 top, bottom, ny;
+
+	switch (cmd_capture_pane_range(args, item, wp, &gd, &top, &bottom)) {
+	case -1:
+		return (CMD_RETURN_ERROR);
+	case 0:
+		file_print(c, "\n");
+		return (CMD_RETURN_NORMAL);
+	}
+	ny = bottom - top + 1;
+
+	cd = xcalloc(1, sizeof *cd);
+	cd->item = item;
+	cd->args = args;
+	cd->c = c;
+
+	cd->gd = grid_create(gd->sx, gd->sy, 0);
+	grid_snapshot(cd->gd, gd, top, ny);
+	grid_pack_history(gd);
+	cd->sx = screen_size_x(&wp->base);
+	cd->end = ny;
+
+	memcpy(&cd->cell, &grid_default_cell, sizeof cd->cell);
+	cd->lastgc = &cd->cell;
+
+	if (cmd_capture_pane_write(cd)) {
+		cmd_capture_pane_free(cd);
+		return (CMD_RETURN_NORMAL);
+	}
+	evtimer_set(&cd->timer, cmd_capture_pane_timer, cd);
+	evtimer_add(&cd->timer, &tv);
+	return (CMD_RETURN_WAIT);
+}
+
 static enum cmd_retval
 cmd_capture_pane_exec(struct cmd *self, struct cmdq_item *item)
 {
@@ -205,6 +379,16 @@ cmd_capture_pane_exec(struct cmd *self, struct cmdq_item *item)
 		return (CMD_RETURN_NORMAL);
 	}
 
+	if (args_has(args, 'p') &&
+	    !args_has(args, 'P') &&
+	    (c == NULL || (~c->flags & CLIENT_CONTROL))) {
+		if (!file_can_print(c)) {
+			cmdq_error(item, "can't write to client");
+			return (CMD_RETURN_ERROR);
+		}
+		return (cmd_capture_pane_stream(args, item, wp));
+	}
+
 	len = 0;
 	if (args_has(args, 'P'))
 		buf = cmd_capture_pane_pending(args, wp, &len);
@@ -0,0 +1,73 @@
+/* $OpenBSD$ */
+
+/*
+ * Copyright (c) 2021 The tmux authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER
+ * IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tmux.h"
+
+/*
+ * Replace the server with a new binary, keeping the panes.
+ */
+
+static enum cmd_retval	cmd_exec_server_exec(struct cmd *, struct cmdq_item *);
+
+const struct cmd_entry cmd_exec_server_entry = {
+	.name = "exec-server",
+	.alias = NULL,
+
+	.args = { "", 1, 1 },
+	.usage = "path",
+
+	.flags = CMD_AFTERHOOK,
+	.exec = cmd_exec_server_exec
+};
+
+static enum cmd_retval
+cmd_exec_server_exec(struct cmd *self, struct cmdq_item *item)
+{
+	struct args	*args = cmd_get_args(self);
+	struct client	*c = cmdq_get_client(item);
+	char		*path, *expanded;
+
+	expanded = format_single_from_target(item, args->argv[0]);
+	if (*expanded == '/')
+		path = expanded;
+	else {
+		xasprintf(&path, "%s/%s", server_client_get_cwd(c, NULL),
+		    expanded);
+		free(expanded);
+	}
+
+	if (access(path, X_OK) != 0) {
+		cmdq_error(item, "%s: %s", path, strerror(errno));
+		free(path);
+		return (CMD_RETURN_ERROR);
+	}
+	if (server_exec(path) != 0) {
+		cmdq_error(item, "server is already being replaced");
+		free(path);
+		return (CMD_RETURN_ERROR);
+	}
+	free(path);
+	return (CMD_RETURN_NORMAL);
+}
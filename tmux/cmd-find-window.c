@@ -48,8 +48,8 @@ cmd_find_window_exec(struct cmd *self, struct cmdq_item *item)
 	struct cmd_find_state	*target = cmdq_get_target(item);
 	struct window_pane	*wp = target->wp;
 	const char		*s = args->argv[0], *suffix = "";
-	char			*filter, *argv = { NULL };
-	int			 C, N, T;
+	char			*filter, *argv[4];
+	int			 C, N, T, argc = 0;
 
 	C = args_has(args, 'C');
 	N = args_has(args, 'N');
@@ -91,10 +91,12 @@ cmd_find_window_exec(struct cmd *self, struct cmdq_item *item)
 	else
 		xasprintf(&filter, "#{m%s:*%s*,#{pane_title}}", suffix, s);
 
-	new_args = args_parse("", 1, &argv);
+	argv[argc++] = (char *)"";
 	if (args_has(args, 'Z'))
-		args_set(new_args, 'Z', NULL);
-	args_set(new_args, 'f', filter);
+		argv[argc++] = (char *)"-Z";
+	argv[argc++] = (char *)"-f";
+	argv[argc++] = filter;
+	new_args = args_parse("Zf:", argc, argv);
 
 	window_pane_set_mode(wp, NULL, &window_tree_mode, target, new_args);
 
@@ -85,10 +85,9 @@ cmd_find_inside_pane(struct client *c)
 	if (c == NULL)
 		return (NULL);
 
-	RB_FOREACH(wp, window_pane_tree, &all_window_panes) {
-		if (wp->fd != -1 && strcmp(wp->tty, c->ttyname) == 0)
-			break;
-	}
+	wp = window_pane_find_by_tty(c->ttyname);
+	if (wp != NULL && wp->fd == -1)
+		wp = NULL;
 	if (wp == NULL) {
 		envent = environ_find(c->environ, "TMUX_PANE");
 		if (envent != NULL)
@@ -177,16 +176,18 @@ cmd_find_best_session_with_window(struct cmd_find_state *fs)
 {
 	struct session	**slist = NULL;
 	u_int		  ssize;
-	struct session	 *s;
+	struct winlink	 *wl;
 
 	log_debug("%s: window is @%u", __func__, fs->w->id);
 
+	/*
+	 * Use the sessions the window is linked into rather than looking
+	 * through every session (a session may appear more than once).
+	 */
 	ssize = 0;
-	RB_FOREACH(s, sessions, &sessions) {
-		if (!session_has(s, fs->w))
-			continue;
+	TAILQ_FOREACH(wl, &fs->w->winlinks, wentry) {
 		slist = xreallocarray(slist, ssize + 1, sizeof *slist);
-		slist[ssize++] = s;
+		slist[ssize++] = wl->session;
 	}
 	if (ssize == 0)
 		goto fail;
@@ -44,7 +44,7 @@ const struct cmd_entry cmd_if_shell_entry = {
 
 	.target = { 't', CMD_FIND_PANE, CMD_FIND_CANFAIL },
 
-	.flags = 0,
+	.flags = CMD_CLIENTENV,
 	.exec = cmd_if_shell_exec
 };
 
@@ -130,7 +130,7 @@ cmd_if_shell_exec(struct cmd *self, struct cmdq_item *item)
 
 	if (job_run(shellcmd, 0, NULL, s,
 	    server_client_get_cwd(cmdq_get_client(item), s), NULL,
-	    cmd_if_shell_callback, cmd_if_shell_free, cdata, 0, -1,
+	    cmd_if_shell_callback, cmd_if_shell_free, cdata, JOB_LIMIT, -1,
 	    -1) == NULL) {
 		cmdq_error(item, "failed to run command: %s", shellcmd);
 		free(shellcmd);
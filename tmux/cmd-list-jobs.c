@@ -0,0 +1,81 @@
+/* $OpenBSD$ */
+
+/*
+ * Copyright (c) 2021 The tmux authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER
+ * IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+
+#include "tmux.h"
+
+/*
+ * List running and queued shell jobs.
+ */
+
+#define LIST_JOBS_TEMPLATE						\
+	"#{job_id}: [#{job_state}#{?job_pid, #{job_pid},}] "		\
+	"#{job_command}#{?job_low_priority, (low priority),}"
+
+static enum cmd_retval	cmd_list_jobs_exec(struct cmd *, struct cmdq_item *);
+
+const struct cmd_entry cmd_list_jobs_entry = {
+	.name = "list-jobs",
+	.alias = "lsj",
+
+	.args = { "F:f:", 0, 0 },
+	.usage = "[-F format] [-f filter]",
+
+	.flags = CMD_AFTERHOOK,
+	.exec = cmd_list_jobs_exec
+};
+
+static enum cmd_retval
+cmd_list_jobs_exec(struct cmd *self, struct cmdq_item *item)
+{
+	struct args		*args = cmd_get_args(self);
+	struct job		*job;
+	struct format_tree	*ft;
+	const char		*template, *filter;
+	char			*line, *expanded;
+	int			 flag;
+
+	if ((template = args_get(args, 'F')) == NULL)
+		template = LIST_JOBS_TEMPLATE;
+	filter = args_get(args, 'f');
+
+	job = NULL;
+	while ((job = job_walk(job)) != NULL) {
+		ft = format_create(cmdq_get_client(item), item, FORMAT_NONE, 0);
+		job_add_formats(job, ft);
+
+		if (filter != NULL) {
+			expanded = format_expand(ft, filter);
+			flag = format_true(expanded);
+			free(expanded);
+		} else
+			flag = 1;
+		if (flag) {
+			line = format_expand(ft, template);
+			cmdq_print(item, "%s", line);
+			free(line);
+		}
+
+		format_free(ft);
+	}
+
+	return (CMD_RETURN_NORMAL);
+}
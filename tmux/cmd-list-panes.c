@@ -28,11 +28,13 @@
 
 static enum cmd_retval	cmd_list_panes_exec(struct cmd *, struct cmdq_item *);
 
-static void	cmd_list_panes_server(struct cmd *, struct cmdq_item *);
+static void	cmd_list_panes_server(struct cmd *, struct cmdq_item *,
+		    struct format_tree *);
 static void	cmd_list_panes_session(struct cmd *, struct session *,
-		    struct cmdq_item *, int);
+		    struct cmdq_item *, struct format_tree *, int);
 static void	cmd_list_panes_window(struct cmd *, struct session *,
-		    struct winlink *, struct cmdq_item *, int);
+		    struct winlink *, struct cmdq_item *, struct format_tree *,
+		    int);
 
 const struct cmd_entry cmd_list_panes_entry = {
 	.name = "list-panes",
@@ -54,44 +56,48 @@ cmd_list_panes_exec(struct cmd *self, struct cmdq_item *item)
 	struct cmd_find_state	*target = cmdq_get_target(item);
 	struct session		*s = target->s;
 	struct winlink		*wl = target->wl;
+	struct format_tree	*ft;
 
+	/* The same tree is cleared and used again for each pane. */
+	ft = format_create(cmdq_get_client(item), item, FORMAT_NONE, 0);
 	if (args_has(args, 'a'))
-		cmd_list_panes_server(self, item);
+		cmd_list_panes_server(self, item, ft);
 	else if (args_has(args, 's'))
-		cmd_list_panes_session(self, s, item, 1);
+		cmd_list_panes_session(self, s, item, ft, 1);
 	else
-		cmd_list_panes_window(self, s, wl, item, 0);
+		cmd_list_panes_window(self, s, wl, item, ft, 0);
+	format_free(ft);
 
 	return (CMD_RETURN_NORMAL);
 }
 
 static void
-cmd_list_panes_server(struct cmd *self, struct cmdq_item *item)
+cmd_list_panes_server(struct cmd *self, struct cmdq_item *item,
+    struct format_tree *ft)
 {
 	struct session	*s;
 
 	RB_FOREACH(s, sessions, &sessions)
-		cmd_list_panes_session(self, s, item, 2);
+		cmd_list_panes_session(self, s, item, ft, 2);
 }
 
 static void
 cmd_list_panes_session(struct cmd *self, struct session *s,
-    struct cmdq_item *item, int type)
+    struct cmdq_item *item, struct format_tree *ft, int type)
 {
 	struct winlink	*wl;
 
 	RB_FOREACH(wl, winlinks, &s->windows)
-		cmd_list_panes_window(self, s, wl, item, type);
+		cmd_list_panes_window(self, s, wl, item, ft, type);
 }
 
 static void
 cmd_list_panes_window(struct cmd *self, struct session *s, struct winlink *wl,
-    struct cmdq_item *item, int type)
+    struct cmdq_item *item, struct format_tree *ft, int type)
 {
 	struct args		*args = cmd_get_args(self);
 	struct window_pane	*wp;
 	u_int			 n;
-	struct format_tree	*ft;
 	const char		*template, *filter;
 	char			*line, *expanded;
 	int			 flag;
@@ -126,7 +132,6 @@ cmd_list_panes_window(struct cmd *self, struct session *s, struct winlink *wl,
 
 	n = 0;
 	TAILQ_FOREACH(wp, &wl->window->panes, entry) {
-		ft = format_create(cmdq_get_client(item), item, FORMAT_NONE, 0);
 		format_add(ft, "line", "%u", n);
 		format_defaults(ft, NULL, s, wl, wp);
 
@@ -142,7 +147,7 @@ cmd_list_panes_window(struct cmd *self, struct session *s, struct winlink *wl,
 			free(line);
 		}
 
-		format_free(ft);
+		format_clear(ft);
 		n++;
 	}
 }
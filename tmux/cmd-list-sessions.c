@@ -64,9 +64,11 @@ cmd_list_sessions_exec(struct cmd *self, struct cmdq_item *item)
 		template = LIST_SESSIONS_TEMPLATE;
 	filter = args_get(args, 'f');
 
+	/* The same tree is cleared and used again for each session. */
+	ft = format_create(cmdq_get_client(item), item, FORMAT_NONE, 0);
+
 	n = 0;
 	RB_FOREACH(s, sessions, &sessions) {
-		ft = format_create(cmdq_get_client(item), item, FORMAT_NONE, 0);
 		format_add(ft, "line", "%u", n);
 		format_defaults(ft, NULL, s, NULL, NULL);
 
@@ -82,9 +84,10 @@ cmd_list_sessions_exec(struct cmd *self, struct cmdq_item *item)
 			free(line);
 		}
 
-		format_free(ft);
+		format_clear(ft);
 		n++;
 	}
+	format_free(ft);
 
 	return (CMD_RETURN_NORMAL);
 }
@@ -41,9 +41,10 @@
 
 static enum cmd_retval	cmd_list_windows_exec(struct cmd *, struct cmdq_item *);
 
-static void	cmd_list_windows_server(struct cmd *, struct cmdq_item *);
+static void	cmd_list_windows_server(struct cmd *, struct cmdq_item *,
+		    struct format_tree *);
 static void	cmd_list_windows_session(struct cmd *, struct session *,
-		    struct cmdq_item *, int);
+		    struct cmdq_item *, struct format_tree *, int);
 
 const struct cmd_entry cmd_list_windows_entry = {
 	.name = "list-windows",
@@ -63,32 +64,36 @@ cmd_list_windows_exec(struct cmd *self, struct cmdq_item *item)
 {
 	struct args		*args = cmd_get_args(self);
 	struct cmd_find_state	*target = cmdq_get_target(item);
+	struct format_tree	*ft;
 
+	/* The same tree is cleared and used again for each window. */
+	ft = format_create(cmdq_get_client(item), item, FORMAT_NONE, 0);
 	if (args_has(args, 'a'))
-		cmd_list_windows_server(self, item);
+		cmd_list_windows_server(self, item, ft);
 	else
-		cmd_list_windows_session(self, target->s, item, 0);
+		cmd_list_windows_session(self, target->s, item, ft, 0);
+	format_free(ft);
 
 	return (CMD_RETURN_NORMAL);
 }
 
 static void
-cmd_list_windows_server(struct cmd *self, struct cmdq_item *item)
+cmd_list_windows_server(struct cmd *self, struct cmdq_item *item,
+    struct format_tree *ft)
 {
 	struct session	*s;
 
 	RB_FOREACH(s, sessions, &sessions)
-		cmd_list_windows_session(self, s, item, 1);
+		cmd_list_windows_session(self, s, item, ft, 1);
 }
 
 static void
 cmd_list_windows_session(struct cmd *self, struct session *s,
-    struct cmdq_item *item, int type)
+    struct cmdq_item *item, struct format_tree *ft, int type)
 {
 	struct args		*args = cmd_get_args(self);
 	struct winlink		*wl;
 	u_int			 n;
-	struct format_tree	*ft;
 	const char		*template, *filter;
 	char			*line, *expanded;
 	int			 flag;
@@ -108,7 +113,6 @@ cmd_list_windows_session(struct cmd *self, struct session *s,
 
 	n = 0;
 	RB_FOREACH(wl, winlinks, &s->windows) {
-		ft = format_create(cmdq_get_client(item), item, FORMAT_NONE, 0);
 		format_add(ft, "line", "%u", n);
 		format_defaults(ft, NULL, s, wl, NULL);
 
@@ -124,7 +128,7 @@ cmd_list_windows_session(struct cmd *self, struct session *s,
 			free(line);
 		}
 
-		format_free(ft);
+		format_clear(ft);
 		n++;
 	}
 }
@@ -66,6 +66,38 @@ struct cmd_parse_state {
 };
 static struct cmd_parse_state parse_state;
 
+/*
+ * Command lists parsed from strings, kept so the same string does not need to
+ * be parsed again. Lists are never changed once parsed so may be shared, each
+ * user holding a reference. The least recently used are freed first.
+ */
+#define CMD_PARSE_CACHE_SIZE 256
+struct cmd_parse_cache {
+	char				*s;
+	int				 flags;
+	char				*file;
+	u_int				 line;
+
+	u_int				 end;
+	struct cmd_list			*cmdlist;
+
+	RB_ENTRY(cmd_parse_cache)	 entry;
+	TAILQ_ENTRY(cmd_parse_cache)	 lru_entry;
+};
+RB_HEAD(cmd_parse_caches, cmd_parse_cache);
+static struct cmd_parse_caches cmd_parse_caches =
+    RB_INITIALIZER(&cmd_parse_caches);
+static TAILQ_HEAD(cmd_parse_caches_lru, cmd_parse_cache) cmd_parse_caches_lru =
+    TAILQ_HEAD_INITIALIZER(cmd_parse_caches_lru);
+static u_int cmd_parse_caches_count;
+
+/*
+ * Set if parsing depended on anything but the string itself: environment
+ * variables, the home directory, formats or conditions. Assignments also
+ * cannot be skipped.
+ */
+static int cmd_parse_uncacheable;
+
 static char	*cmd_parse_get_error(const char *, u_int, const char *);
 static void	 cmd_parse_free_command(struct cmd_parse_command *);
 static struct cmd_parse_commands *cmd_parse_new_commands(void);
@@ -74,7 +106,7 @@ static char	*cmd_parse_commands_to_string(struct cmd_parse_commands *);
 static void	 cmd_parse_print_commands(struct cmd_parse_input *, u_int,
 		     struct cmd_list *);
 
-#line 86 "cmd-parse.y"
+#line 118 "cmd-parse.y"
 #ifndef YYSTYPE_DEFINED
 #define YYSTYPE_DEFINED
 typedef union
@@ -93,7 +125,7 @@ typedef union
 	struct cmd_parse_command		 *command;
 } YYSTYPE;
 #endif /* YYSTYPE_DEFINED */
-#line 97 "cmd-parse.c"
+#line 129 "cmd-parse.c"
 #define ERROR 257
 #define HIDDEN 258
 #define IF 259
@@ -317,7 +349,7 @@ short *yysslim;
 YYSTYPE *yyvs;
 unsigned int yystacksize;
 int yyparse(void);
-#line 546 "cmd-parse.y"
+#line 581 "cmd-parse.y"
 
 static char *
 cmd_parse_get_error(const char *file, u_int line, const char *error)
@@ -556,9 +588,11 @@ cmd_parse_build_commands(struct cmd_parse_commands *cmds,
 		cmd_list_free(cmdlist);
 	}
 
-	s = cmd_list_print(result, 0);
-	log_debug("%s: %s", __func__, s);
-	free(s);
+	if (log_get_level() != 0) {
+		s = cmd_list_print(result, 0);
+		log_debug("%s: %s", __func__, s);
+		free(s);
+	}
 
 	pr.status = CMD_PARSE_SUCCESS;
 	pr.cmdlist = result;
@@ -571,11 +605,26 @@ out:
 
 struct cmd_parse_result *
 cmd_parse_from_file(FILE *f, struct cmd_parse_input *pi)
+{
+	return (cmd_parse_from_file_save(f, pi, NULL));
+}
+
+/*
+ * Parse a file and, if the commands depend only on the file itself, save them
+ * to a buffer which may be given to cmd_parse_from_saved to build them again
+ * without parsing.
+ */
+struct cmd_parse_result *
+cmd_parse_from_file_save(FILE *f, struct cmd_parse_input *pi,
+    struct evbuffer *saved)
 {
 	static struct cmd_parse_result	 pr;
 	struct cmd_parse_input		 input;
 	struct cmd_parse_commands	*cmds;
+	struct cmd_parse_command	*cmd;
 	char				*cause;
+	uint32_t			 n, size;
+	int				 i;
 
 	if (pi == NULL) {
 		memset(&input, 0, sizeof input);
@@ -583,19 +632,201 @@ cmd_parse_from_file(FILE *f, struct cmd_parse_input *pi)
 	}
 	memset(&pr, 0, sizeof pr);
 
+	cmd_parse_uncacheable = 0;
 	cmds = cmd_parse_do_file(f, pi, &cause);
 	if (cmds == NULL) {
 		pr.status = CMD_PARSE_ERROR;
 		pr.error = cause;
 		return (&pr);
 	}
+
+	if (saved != NULL && !cmd_parse_uncacheable) {
+		n = 0;
+		TAILQ_FOREACH(cmd, cmds, entry)
+			n++;
+		evbuffer_add(saved, &n, sizeof n);
+		TAILQ_FOREACH(cmd, cmds, entry) {
+			n = cmd->line;
+			evbuffer_add(saved, &n, sizeof n);
+			n = cmd->argc;
+			evbuffer_add(saved, &n, sizeof n);
+			for (i = 0; i < cmd->argc; i++) {
+				size = strlen(cmd->argv[i]);
+				evbuffer_add(saved, &size, sizeof size);
+				evbuffer_add(saved, cmd->argv[i], size);
+			}
+		}
+	}
 	return (cmd_parse_build_commands(cmds, pi));
 }
 
+static int
+cmd_parse_get_saved(const u_char **buf, size_t *len, uint32_t *n)
+{
+	if (*len < sizeof *n)
+		return (0);
+	memcpy(n, *buf, sizeof *n);
+	(*buf) += sizeof *n;
+	(*len) -= sizeof *n;
+	return (1);
+}
+
+/*
+ * Build commands saved by cmd_parse_from_file_save. Returns NULL if the saved
+ * commands are not valid.
+ */
+struct cmd_parse_result *
+cmd_parse_from_saved(const void *buf, size_t len, struct cmd_parse_input *pi)
+{
+	struct cmd_parse_input		 input;
+	struct cmd_parse_commands	*cmds;
+	struct cmd_parse_command	*cmd;
+	const u_char			*cp = buf;
+	uint32_t			 n, argc, size, i;
+
+	if (pi == NULL) {
+		memset(&input, 0, sizeof input);
+		pi = &input;
+	}
+
+	cmds = cmd_parse_new_commands();
+	if (!cmd_parse_get_saved(&cp, &len, &n))
+		goto fail;
+	for (; n != 0; n--) {
+		cmd = xcalloc(1, sizeof *cmd);
+		TAILQ_INSERT_TAIL(cmds, cmd, entry);
+
+		if (!cmd_parse_get_saved(&cp, &len, &size))
+			goto fail;
+		cmd->line = size;
+		if (!cmd_parse_get_saved(&cp, &len, &argc))
+			goto fail;
+		if (argc == 0 || argc > len / sizeof size)
+			goto fail;
+		cmd->argv = xcalloc(argc, sizeof *cmd->argv);
+		for (i = 0; i < argc; i++) {
+			if (!cmd_parse_get_saved(&cp, &len, &size))
+				goto fail;
+			if (size > len)
+				goto fail;
+			cmd->argv[i] = xmalloc(size + 1);
+			memcpy(cmd->argv[i], cp, size);
+			cmd->argv[i][size] = '\0';
+			cmd->argc++;
+			cp += size;
+			len -= size;
+		}
+	}
+	if (len != 0)
+		goto fail;
+	return (cmd_parse_build_commands(cmds, pi));
+
+fail:
+	cmd_parse_free_commands(cmds);
+	return (NULL);
+}
+
+static int
+cmd_parse_cache_cmp(struct cmd_parse_cache *cache1,
+    struct cmd_parse_cache *cache2)
+{
+	int	retval;
+
+	if ((retval = strcmp(cache1->s, cache2->s)) != 0)
+		return (retval);
+	if (cache1->flags != cache2->flags)
+		return (cache1->flags < cache2->flags ? -1 : 1);
+	if (cache1->line != cache2->line)
+		return (cache1->line < cache2->line ? -1 : 1);
+	if (cache1->file == NULL || cache2->file == NULL) {
+		if (cache1->file == cache2->file)
+			return (0);
+		return (cache1->file == NULL ? -1 : 1);
+	}
+	return (strcmp(cache1->file, cache2->file));
+}
+RB_GENERATE_STATIC(cmd_parse_caches, cmd_parse_cache, entry,
+    cmd_parse_cache_cmp);
+
+/* Remove a parsed string from the cache. */
+static void
+cmd_parse_remove_cache(struct cmd_parse_cache *cache)
+{
+	TAILQ_REMOVE(&cmd_parse_caches_lru, cache, lru_entry);
+	RB_REMOVE(cmd_parse_caches, &cmd_parse_caches, cache);
+	cmd_parse_caches_count--;
+
+	cmd_list_free(cache->cmdlist);
+	free(cache->s);
+	free(cache->file);
+	free(cache);
+}
+
+/* Free all parsed strings, for example when aliases change. */
+void
+cmd_parse_clear_cache(void)
+{
+	struct cmd_parse_cache	*cache, *cache1;
+
+	TAILQ_FOREACH_SAFE(cache, &cmd_parse_caches_lru, lru_entry, cache1)
+		cmd_parse_remove_cache(cache);
+}
+
+/* Look for a string that has already been parsed. */
+static struct cmd_parse_cache *
+cmd_parse_find_cache(const char *s, struct cmd_parse_input *pi)
+{
+	struct cmd_parse_cache	 find, *cache;
+
+	find.s = (char *)s;
+	find.flags = pi->flags;
+	find.file = (char *)pi->file;
+	find.line = pi->line;
+	cache = RB_FIND(cmd_parse_caches, &cmd_parse_caches, &find);
+	if (cache != NULL) {
+		TAILQ_REMOVE(&cmd_parse_caches_lru, cache, lru_entry);
+		TAILQ_INSERT_HEAD(&cmd_parse_caches_lru, cache, lru_entry);
+	}
+	return (cache);
+}
+
+/* Keep a parsed string, removing the least recently used if full. */
+static void
+cmd_parse_add_cache(const char *s, int flags, const char *file, u_int line,
+    u_int end, struct cmd_list *cmdlist)
+{
+	struct cmd_parse_cache	*cache;
+
+	if (cmd_parse_caches_count == CMD_PARSE_CACHE_SIZE) {
+		cache = TAILQ_LAST(&cmd_parse_caches_lru, cmd_parse_caches_lru);
+		cmd_parse_remove_cache(cache);
+	}
+
+	cache = xcalloc(1, sizeof *cache);
+	cache->s = xstrdup(s);
+	cache->flags = flags;
+	if (file != NULL)
+		cache->file = xstrdup(file);
+	cache->line = line;
+	cache->end = end;
+	cache->cmdlist = cmdlist;
+	cmdlist->references++;
+
+	if (RB_INSERT(cmd_parse_caches, &cmd_parse_caches, cache) != NULL)
+		fatalx("duplicate parsed string");
+	TAILQ_INSERT_HEAD(&cmd_parse_caches_lru, cache, lru_entry);
+	cmd_parse_caches_count++;
+}
+
 struct cmd_parse_result *
 cmd_parse_from_string(const char *s, struct cmd_parse_input *pi)
 {
-	struct cmd_parse_input	input;
+	static struct cmd_parse_result	 pr;
+	struct cmd_parse_input		 input;
+	struct cmd_parse_result		*result;
+	struct cmd_parse_cache		*cache;
+	int				 flags;
+	u_int				 line;
 
 	if (pi == NULL) {
 		memset(&input, 0, sizeof input);
@@ -608,7 +839,31 @@ cmd_parse_from_string(const char *s, struct cmd_parse_input *pi)
 	 * given as an argument to another command.
 	 */
 	pi->flags |= CMD_PARSE_ONEGROUP;
-	return (cmd_parse_from_buffer(s, strlen(s), pi));
+
+	/* Verbose parsing prints the commands so cannot be skipped. */
+	if (pi->flags & CMD_PARSE_VERBOSE)
+		return (cmd_parse_from_buffer(s, strlen(s), pi));
+
+	if ((cache = cmd_parse_find_cache(s, pi)) != NULL) {
+		log_debug("%s: found %s", __func__, s);
+		pi->line = cache->end;
+		cache->cmdlist->references++;
+
+		memset(&pr, 0, sizeof pr);
+		pr.status = CMD_PARSE_SUCCESS;
+		pr.cmdlist = cache->cmdlist;
+		return (&pr);
+	}
+
+	flags = pi->flags;
+	line = pi->line;
+	cmd_parse_uncacheable = 0;
+	result = cmd_parse_from_buffer(s, strlen(s), pi);
+	if (result->status == CMD_PARSE_SUCCESS && !cmd_parse_uncacheable) {
+		cmd_parse_add_cache(s, flags, pi->file, line, pi->line,
+		    result->cmdlist);
+	}
+	return (result);
 }
 
 enum cmd_parse_status
@@ -979,6 +1234,7 @@ yylex(void)
 			if (*cp == '\0')
 				return (TOKEN);
 			ps->condition = 1;
+			cmd_parse_uncacheable = 1;
 			if (strcmp(yylval.token, "%hidden") == 0) {
 				free(yylval.token);
 				return (HIDDEN);
@@ -1206,6 +1462,7 @@ yylex_token_variable(char **buf, size_t *len)
 	}
 	name[namelen] = '\0';
 
+	cmd_parse_uncacheable = 1;
 	envent = environ_find(global_environ, name);
 	if (envent != NULL && envent->value != NULL) {
 		value = envent->value;
@@ -1239,6 +1496,7 @@ yylex_token_tilde(char **buf, size_t *len)
 	}
 	name[namelen] = '\0';
 
+	cmd_parse_uncacheable = 1;
 	if (*name == '\0') {
 		envent = environ_find(global_environ, "HOME");
 		if (envent != NULL && *envent->value != '\0')
@@ -1361,7 +1619,7 @@ error:
 	free(buf);
 	return (NULL);
 }
-#line 1357 "cmd-parse.c"
+#line 1615 "cmd-parse.c"
 /* allocate initial stack or double stack size, up to YYMAXDEPTH */
 static int yygrowstack(void)
 {
@@ -1554,7 +1812,7 @@ yyreduce:
     switch (yyn)
     {
 case 2:
-#line 122 "cmd-parse.y"
+#line 154 "cmd-parse.y"
 {
 			struct cmd_parse_state	*ps = &parse_state;
 
@@ -1562,13 +1820,13 @@ case 2:
 		}
 break;
 case 3:
-#line 129 "cmd-parse.y"
+#line 161 "cmd-parse.y"
 {
 			yyval.commands = yyvsp[-1].commands;
 		}
 break;
 case 4:
-#line 133 "cmd-parse.y"
+#line 165 "cmd-parse.y"
 {
 			yyval.commands = yyvsp[-2].commands;
 			TAILQ_CONCAT(yyval.commands, yyvsp[-1].commands, entry);
@@ -1576,21 +1834,21 @@ case 4:
 		}
 break;
 case 5:
-#line 140 "cmd-parse.y"
+#line 172 "cmd-parse.y"
 {
 			yyval.commands = xmalloc (sizeof *yyval.commands);
 			TAILQ_INIT(yyval.commands);
 		}
 break;
 case 6:
-#line 145 "cmd-parse.y"
+#line 177 "cmd-parse.y"
 {
 			yyval.commands = xmalloc (sizeof *yyval.commands);
 			TAILQ_INIT(yyval.commands);
 		}
 break;
 case 7:
-#line 150 "cmd-parse.y"
+#line 182 "cmd-parse.y"
 {
 			struct cmd_parse_state	*ps = &parse_state;
 
@@ -1603,7 +1861,7 @@ case 7:
 		}
 break;
 case 8:
-#line 161 "cmd-parse.y"
+#line 193 "cmd-parse.y"
 {
 			struct cmd_parse_state	*ps = &parse_state;
 
@@ -1616,19 +1874,19 @@ case 8:
 		}
 break;
 case 9:
-#line 173 "cmd-parse.y"
+#line 205 "cmd-parse.y"
 {
 			yyval.token = yyvsp[0].token;
 		}
 break;
 case 10:
-#line 177 "cmd-parse.y"
+#line 209 "cmd-parse.y"
 {
 			yyval.token = yyvsp[0].token;
 		}
 break;
 case 11:
-#line 182 "cmd-parse.y"
+#line 214 "cmd-parse.y"
 {
 			struct cmd_parse_state	*ps = &parse_state;
 			struct cmd_parse_input	*pi = ps->input;
@@ -1647,17 +1905,19 @@ case 11:
 			ft = format_create(NULL, pi->item, FORMAT_NONE, flags);
 			format_defaults(ft, c, fsp->s, fsp->wl, fsp->wp);
 
+			cmd_parse_uncacheable = 1;
 			yyval.token = format_expand(ft, yyvsp[0].token);
 			format_free(ft);
 			free(yyvsp[0].token);
 		}
 break;
 case 14:
-#line 209 "cmd-parse.y"
+#line 242 "cmd-parse.y"
 {
 			struct cmd_parse_state	*ps = &parse_state;
 			int			 flags = ps->input->flags;
 
+			cmd_parse_uncacheable = 1;
 			if ((~flags & CMD_PARSE_PARSEONLY) &&
 			    (ps->scope == NULL || ps->scope->flag))
 				environ_put(global_environ, yyvsp[0].token, 0);
@@ -1665,11 +1925,12 @@ case 14:
 		}
 break;
 case 15:
-#line 220 "cmd-parse.y"
+#line 254 "cmd-parse.y"
 {
 			struct cmd_parse_state	*ps = &parse_state;
 			int			 flags = ps->input->flags;
 
+			cmd_parse_uncacheable = 1;
 			if ((~flags & CMD_PARSE_PARSEONLY) &&
 			    (ps->scope == NULL || ps->scope->flag))
 				environ_put(global_environ, yyvsp[0].token, ENVIRON_HIDDEN);
@@ -1677,7 +1938,7 @@ case 15:
 		}
 break;
 case 16:
-#line 231 "cmd-parse.y"
+#line 266 "cmd-parse.y"
 {
 			struct cmd_parse_state	*ps = &parse_state;
 			struct cmd_parse_scope	*scope;
@@ -1692,7 +1953,7 @@ case 16:
 		}
 break;
 case 17:
-#line 245 "cmd-parse.y"
+#line 280 "cmd-parse.y"
 {
 			struct cmd_parse_state	*ps = &parse_state;
 			struct cmd_parse_scope	*scope;
@@ -1705,7 +1966,7 @@ case 17:
 		}
 break;
 case 18:
-#line 257 "cmd-parse.y"
+#line 292 "cmd-parse.y"
 {
 			struct cmd_parse_state	*ps = &parse_state;
 			struct cmd_parse_scope	*scope;
@@ -1719,7 +1980,7 @@ case 18:
 		}
 break;
 case 19:
-#line 270 "cmd-parse.y"
+#line 305 "cmd-parse.y"
 {
 			struct cmd_parse_state	*ps = &parse_state;
 
@@ -1730,7 +1991,7 @@ case 19:
 		}
 break;
 case 20:
-#line 280 "cmd-parse.y"
+#line 315 "cmd-parse.y"
 {
 			if (yyvsp[-3].flag)
 				yyval.commands = yyvsp[-1].commands;
@@ -1741,7 +2002,7 @@ case 20:
 		}
 break;
 case 21:
-#line 289 "cmd-parse.y"
+#line 324 "cmd-parse.y"
 {
 			if (yyvsp[-6].flag) {
 				yyval.commands = yyvsp[-4].commands;
@@ -1753,7 +2014,7 @@ case 21:
 		}
 break;
 case 22:
-#line 299 "cmd-parse.y"
+#line 334 "cmd-parse.y"
 {
 			if (yyvsp[-4].flag) {
 				yyval.commands = yyvsp[-2].commands;
@@ -1769,7 +2030,7 @@ case 22:
 		}
 break;
 case 23:
-#line 313 "cmd-parse.y"
+#line 348 "cmd-parse.y"
 {
 			if (yyvsp[-7].flag) {
 				yyval.commands = yyvsp[-5].commands;
@@ -1787,7 +2048,7 @@ case 23:
 		}
 break;
 case 24:
-#line 330 "cmd-parse.y"
+#line 365 "cmd-parse.y"
 {
 			if (yyvsp[-2].flag) {
 				yyval.elif.flag = 1;
@@ -1800,7 +2061,7 @@ case 24:
 		}
 break;
 case 25:
-#line 341 "cmd-parse.y"
+#line 376 "cmd-parse.y"
 {
 			if (yyvsp[-3].flag) {
 				yyval.elif.flag = 1;
@@ -1819,7 +2080,7 @@ case 25:
 		}
 break;
 case 26:
-#line 359 "cmd-parse.y"
+#line 394 "cmd-parse.y"
 {
 			struct cmd_parse_state	*ps = &parse_state;
 
@@ -1832,13 +2093,13 @@ case 26:
 		}
 break;
 case 27:
-#line 370 "cmd-parse.y"
+#line 405 "cmd-parse.y"
 {
 			yyval.commands = yyvsp[-1].commands;
 		}
 break;
 case 28:
-#line 374 "cmd-parse.y"
+#line 409 "cmd-parse.y"
 {
 			yyval.commands = yyvsp[-2].commands;
 			TAILQ_CONCAT(yyval.commands, yyvsp[0].commands, entry);
@@ -1846,7 +2107,7 @@ case 28:
 		}
 break;
 case 29:
-#line 380 "cmd-parse.y"
+#line 415 "cmd-parse.y"
 {
 			struct cmd_parse_state	*ps = &parse_state;
 
@@ -1862,13 +2123,13 @@ case 29:
 		}
 break;
 case 30:
-#line 394 "cmd-parse.y"
+#line 429 "cmd-parse.y"
 {
 			yyval.commands = yyvsp[0].commands;
 		}
 break;
 case 31:
-#line 399 "cmd-parse.y"
+#line 434 "cmd-parse.y"
 {
 			struct cmd_parse_state	*ps = &parse_state;
 
@@ -1877,7 +2138,7 @@ case 31:
 		}
 break;
 case 32:
-#line 406 "cmd-parse.y"
+#line 441 "cmd-parse.y"
 {
 			struct cmd_parse_state	*ps = &parse_state;
 
@@ -1889,7 +2150,7 @@ case 32:
 		}
 break;
 case 33:
-#line 416 "cmd-parse.y"
+#line 451 "cmd-parse.y"
 {
 			struct cmd_parse_state	*ps = &parse_state;
 
@@ -1902,7 +2163,7 @@ case 33:
 		}
 break;
 case 34:
-#line 428 "cmd-parse.y"
+#line 463 "cmd-parse.y"
 {
 			if (yyvsp[-2].flag)
 				yyval.commands = yyvsp[-1].commands;
@@ -1913,7 +2174,7 @@ case 34:
 		}
 break;
 case 35:
-#line 437 "cmd-parse.y"
+#line 472 "cmd-parse.y"
 {
 			if (yyvsp[-4].flag) {
 				yyval.commands = yyvsp[-3].commands;
@@ -1925,7 +2186,7 @@ case 35:
 		}
 break;
 case 36:
-#line 447 "cmd-parse.y"
+#line 482 "cmd-parse.y"
 {
 			if (yyvsp[-3].flag) {
 				yyval.commands = yyvsp[-2].commands;
@@ -1941,7 +2202,7 @@ case 36:
 		}
 break;
 case 37:
-#line 461 "cmd-parse.y"
+#line 496 "cmd-parse.y"
 {
 			if (yyvsp[-5].flag) {
 				yyval.commands = yyvsp[-4].commands;
@@ -1959,7 +2220,7 @@ case 37:
 		}
 break;
 case 38:
-#line 478 "cmd-parse.y"
+#line 513 "cmd-parse.y"
 {
 			if (yyvsp[-1].flag) {
 				yyval.elif.flag = 1;
@@ -1972,7 +2233,7 @@ case 38:
 		}
 break;
 case 39:
-#line 489 "cmd-parse.y"
+#line 524 "cmd-parse.y"
 {
 			if (yyvsp[-2].flag) {
 				yyval.elif.flag = 1;
@@ -1991,7 +2252,7 @@ case 39:
 		}
 break;
 case 40:
-#line 507 "cmd-parse.y"
+#line 542 "cmd-parse.y"
 {
 			yyval.arguments.argc = 1;
 			yyval.arguments.argv = xreallocarray(NULL, 1, sizeof *yyval.arguments.argv);
@@ -2000,7 +2261,7 @@ case 40:
 		}
 break;
 case 41:
-#line 514 "cmd-parse.y"
+#line 549 "cmd-parse.y"
 {
 			cmd_prepend_argv(&yyvsp[0].arguments.argc, &yyvsp[0].arguments.argv, yyvsp[-1].token);
 			free(yyvsp[-1].token);
@@ -2008,39 +2269,39 @@ case 41:
 		}
 break;
 case 42:
-#line 521 "cmd-parse.y"
+#line 556 "cmd-parse.y"
 {
 			yyval.token = yyvsp[0].token;
 		}
 break;
 case 43:
-#line 525 "cmd-parse.y"
+#line 560 "cmd-parse.y"
 {
 			yyval.token = yyvsp[0].token;
 		}
 break;
 case 44:
-#line 529 "cmd-parse.y"
+#line 564 "cmd-parse.y"
 {
 			yyval.token = cmd_parse_commands_to_string(yyvsp[0].commands);
 			cmd_parse_free_commands(yyvsp[0].commands);
 		}
 break;
 case 45:
-#line 535 "cmd-parse.y"
+#line 570 "cmd-parse.y"
 {
 				yyval.commands = yyvsp[-1].commands;
 			}
 break;
 case 46:
-#line 539 "cmd-parse.y"
+#line 574 "cmd-parse.y"
 {
 				yyval.commands = yyvsp[-2].commands;
 				TAILQ_CONCAT(yyval.commands, yyvsp[-1].commands, entry);
 				free(yyvsp[-1].commands);
 			}
 break;
-#line 2036 "cmd-parse.c"
+#line 2297 "cmd-parse.c"
     }
     yyssp -= yym;
     yystate = *yyssp;
@@ -73,6 +73,38 @@ struct cmd_parse_state {
 };
 static struct cmd_parse_state parse_state;
 
+/*
+ * Command lists parsed from strings, kept so the same string does not need to
+ * be parsed again. Lists are never changed once parsed so may be shared, each
+ * user holding a reference. The least recently used are freed first.
+ */
+#define CMD_PARSE_CACHE_SIZE 256
+struct cmd_parse_cache {
+	char				*s;
+	int				 flags;
+	char				*file;
+	u_int				 line;
+
+	u_int				 end;
+	struct cmd_list			*cmdlist;
+
+	RB_ENTRY(cmd_parse_cache)	 entry;
+	TAILQ_ENTRY(cmd_parse_cache)	 lru_entry;
+};
+RB_HEAD(cmd_parse_caches, cmd_parse_cache);
+static struct cmd_parse_caches cmd_parse_caches =
+    RB_INITIALIZER(&cmd_parse_caches);
+static TAILQ_HEAD(cmd_parse_caches_lru, cmd_parse_cache) cmd_parse_caches_lru =
+    TAILQ_HEAD_INITIALIZER(cmd_parse_caches_lru);
+static u_int cmd_parse_caches_count;
+
+/*
+ * Set if parsing depended on anything but the string itself: environment
+ * variables, the home directory, formats or conditions. Assignments also
+ * cannot be skipped.
+ */
+static int cmd_parse_uncacheable;
+
 static char	*cmd_parse_get_error(const char *, u_int, const char *);
 static void	 cmd_parse_free_command(struct cmd_parse_command *);
 static struct cmd_parse_commands *cmd_parse_new_commands(void);
@@ -197,6 +229,7 @@ expanded	: format
 			ft = format_create(NULL, pi->item, FORMAT_NONE, flags);
 			format_defaults(ft, c, fsp->s, fsp->wl, fsp->wp);
 
+			cmd_parse_uncacheable = 1;
 			$$ = format_expand(ft, $1);
 			format_free(ft);
 			free($1);
@@ -210,6 +243,7 @@ assignment	: EQUALS
 			struct cmd_parse_state	*ps = &parse_state;
 			int			 flags = ps->input->flags;
 
+			cmd_parse_uncacheable = 1;
 			if ((~flags & CMD_PARSE_PARSEONLY) &&
 			    (ps->scope == NULL || ps->scope->flag))
 				environ_put(global_environ, $1, 0);
@@ -221,6 +255,7 @@ hidden_assignment : HIDDEN EQUALS
 			struct cmd_parse_state	*ps = &parse_state;
 			int			 flags = ps->input->flags;
 
+			cmd_parse_uncacheable = 1;
 			if ((~flags & CMD_PARSE_PARSEONLY) &&
 			    (ps->scope == NULL || ps->scope->flag))
 				environ_put(global_environ, $2, ENVIRON_HIDDEN);
@@ -781,9 +816,11 @@ cmd_parse_build_commands(struct cmd_parse_commands *cmds,
 		cmd_list_free(cmdlist);
 	}
 
-	s = cmd_list_print(result, 0);
-	log_debug("%s: %s", __func__, s);
-	free(s);
+	if (log_get_level() != 0) {
+		s = cmd_list_print(result, 0);
+		log_debug("%s: %s", __func__, s);
+		free(s);
+	}
 
 	pr.status = CMD_PARSE_SUCCESS;
 	pr.cmdlist = result;
@@ -796,11 +833,26 @@ out:
 
 struct cmd_parse_result *
 cmd_parse_from_file(FILE *f, struct cmd_parse_input *pi)
+{
+	return (cmd_parse_from_file_save(f, pi, NULL));
+}
+
+/*
+ * Parse a file and, if the commands depend only on the file itself, save them
+ * to a buffer which may be given to cmd_parse_from_saved to build them again
+ * without parsing.
+ */
+struct cmd_parse_result *
+cmd_parse_from_file_save(FILE *f, struct cmd_parse_input *pi,
+    struct evbuffer *saved)
 {
 	static struct cmd_parse_result	 pr;
 	struct cmd_parse_input		 input;
 	struct cmd_parse_commands	*cmds;
+	struct cmd_parse_command	*cmd;
 	char				*cause;
+	uint32_t			 n, size;
+	int				 i;
 
 	if (pi == NULL) {
 		memset(&input, 0, sizeof input);
@@ -808,19 +860,201 @@ cmd_parse_from_file(FILE *f, struct cmd_parse_input *pi)
 	}
 	memset(&pr, 0, sizeof pr);
 
+	cmd_parse_uncacheable = 0;
 	cmds = cmd_parse_do_file(f, pi, &cause);
 	if (cmds == NULL) {
 		pr.status = CMD_PARSE_ERROR;
 		pr.error = cause;
 		return (&pr);
 	}
+
+	if (saved != NULL && !cmd_parse_uncacheable) {
+		n = 0;
+		TAILQ_FOREACH(cmd, cmds, entry)
+			n++;
+		evbuffer_add(saved, &n, sizeof n);
+		TAILQ_FOREACH(cmd, cmds, entry) {
+			n = cmd->line;
+			evbuffer_add(saved, &n, sizeof n);
+			n = cmd->argc;
+			evbuffer_add(saved, &n, sizeof n);
+			for (i = 0; i < cmd->argc; i++) {
+				size = strlen(cmd->argv[i]);
+				evbuffer_add(saved, &size, sizeof size);
+				evbuffer_add(saved, cmd->argv[i], size);
+			}
+		}
+	}
 	return (cmd_parse_build_commands(cmds, pi));
 }
 
+static int
+cmd_parse_get_saved(const u_char **buf, size_t *len, uint32_t *n)
+{
+	if (*len < sizeof *n)
+		return (0);
+	memcpy(n, *buf, sizeof *n);
+	(*buf) += sizeof *n;
+	(*len) -= sizeof *n;
+	return (1);
+}
+
+/*
+ * Build commands saved by cmd_parse_from_file_save. Returns NULL if the saved
+ * commands are not valid.
+ */
+struct cmd_parse_result *
+cmd_parse_from_saved(const void *buf, size_t len, struct cmd_parse_input *pi)
+{
+	struct cmd_parse_input		 input;
+	struct cmd_parse_commands	*cmds;
+	struct cmd_parse_command	*cmd;
+	const u_char			*cp = buf;
+	uint32_t			 n, argc, size, i;
+
+	if (pi == NULL) {
+		memset(&input, 0, sizeof input);
+		pi = &input;
+	}
+
+	cmds = cmd_parse_new_commands();
+	if (!cmd_parse_get_saved(&cp, &len, &n))
+		goto fail;
+	for (; n != 0; n--) {
+		cmd = xcalloc(1, sizeof *cmd);
+		TAILQ_INSERT_TAIL(cmds, cmd, entry);
+
+		if (!cmd_parse_get_saved(&cp, &len, &size))
+			goto fail;
+		cmd->line = size;
+		if (!cmd_parse_get_saved(&cp, &len, &argc))
+			goto fail;
+		if (argc == 0 || argc > len / sizeof size)
+			goto fail;
+		cmd->argv = xcalloc(argc, sizeof *cmd->argv);
+		for (i = 0; i < argc; i++) {
+			if (!cmd_parse_get_saved(&cp, &len, &size))
+				goto fail;
+			if (size > len)
+				goto fail;
+			cmd->argv[i] = xmalloc(size + 1);
+			memcpy(cmd->argv[i], cp, size);
+			cmd->argv[i][size] = '\0';
+			cmd->argc++;
+			cp += size;
+			len -= size;
+		}
+	}
+	if (len != 0)
+		goto fail;
+	return (cmd_parse_build_commands(cmds, pi));
+
+fail:
+	cmd_parse_free_commands(cmds);
+	return (NULL);
+}
+
+static int
+cmd_parse_cache_cmp(struct cmd_parse_cache *cache1,
+    struct cmd_parse_cache *cache2)
+{
+	int	retval;
+
+	if ((retval = strcmp(cache1->s, cache2->s)) != 0)
+		return (retval);
+	if (cache1->flags != cache2->flags)
+		return (cache1->flags < cache2->flags ? -1 : 1);
+	if (cache1->line != cache2->line)
+		return (cache1->line < cache2->line ? -1 : 1);
+	if (cache1->file == NULL || cache2->file == NULL) {
+		if (cache1->file == cache2->file)
+			return (0);
+		return (cache1->file == NULL ? -1 : 1);
+	}
+	return (strcmp(cache1->file, cache2->file));
+}
+RB_GENERATE_STATIC(cmd_parse_caches, cmd_parse_cache, entry,
+    cmd_parse_cache_cmp);
+
+/* Remove a parsed string from the cache. */
+static void
+cmd_parse_remove_cache(struct cmd_parse_cache *cache)
+{
+	TAILQ_REMOVE(&cmd_parse_caches_lru, cache, lru_entry);
+	RB_REMOVE(cmd_parse_caches, &cmd_parse_caches, cache);
+	cmd_parse_caches_count--;
+
+	cmd_list_free(cache->cmdlist);
+	free(cache->s);
+	free(cache->file);
+	free(cache);
+}
+
+/* Free all parsed strings, for example when aliases change. */
+void
+cmd_parse_clear_cache(void)
+{
+	struct cmd_parse_cache	*cache, *cache1;
+
+	TAILQ_FOREACH_SAFE(cache, &cmd_parse_caches_lru, lru_entry, cache1)
+		cmd_parse_remove_cache(cache);
+}
+
+/* Look for a string that has already been parsed. */
+static struct cmd_parse_cache *
+cmd_parse_find_cache(const char *s, struct cmd_parse_input *pi)
+{
+	struct cmd_parse_cache	 find, *cache;
+
+	find.s = (char *)s;
+	find.flags = pi->flags;
+	find.file = (char *)pi->file;
+	find.line = pi->line;
+	cache = RB_FIND(cmd_parse_caches, &cmd_parse_caches, &find);
+	if (cache != NULL) {
+		TAILQ_REMOVE(&cmd_parse_caches_lru, cache, lru_entry);
+		TAILQ_INSERT_HEAD(&cmd_parse_caches_lru, cache, lru_entry);
+	}
+	return (cache);
+}
+
+/* Keep a parsed string, removing the least recently used if full. */
+static void
+cmd_parse_add_cache(const char *s, int flags, const char *file, u_int line,
+    u_int end, struct cmd_list *cmdlist)
+{
+	struct cmd_parse_cache	*cache;
+
+	if (cmd_parse_caches_count == CMD_PARSE_CACHE_SIZE) {
+		cache = TAILQ_LAST(&cmd_parse_caches_lru, cmd_parse_caches_lru);
+		cmd_parse_remove_cache(cache);
+	}
+
+	cache = xcalloc(1, sizeof *cache);
+	cache->s = xstrdup(s);
+	cache->flags = flags;
+	if (file != NULL)
+		cache->file = xstrdup(file);
+	cache->line = line;
+	cache->end = end;
+	cache->cmdlist = cmdlist;
+	cmdlist->references++;
+
+	if (RB_INSERT(cmd_parse_caches, &cmd_parse_caches, cache) != NULL)
+		fatalx("duplicate parsed string");
+	TAILQ_INSERT_HEAD(&cmd_parse_caches_lru, cache, lru_entry);
+	cmd_parse_caches_count++;
+}
+
 struct cmd_parse_result *
 cmd_parse_from_string(const char *s, struct cmd_parse_input *pi)
 {
-	struct cmd_parse_input	input;
+	static struct cmd_parse_result	 pr;
+	struct cmd_parse_input		 input;
+	struct cmd_parse_result		*result;
+	struct cmd_parse_cache		*cache;
+	int				 flags;
+	u_int				 line;
 
 	if (pi == NULL) {
 		memset(&input, 0, sizeof input);
@@ -833,7 +1067,31 @@ cmd_parse_from_string(const char *s, struct cmd_parse_input *pi)
 	 * given as an argument to another command.
 	 */
 	pi->flags |= CMD_PARSE_ONEGROUP;
-	return (cmd_parse_from_buffer(s, strlen(s), pi));
+
+	/* Verbose parsing prints the commands so cannot be skipped. */
+	if (pi->flags & CMD_PARSE_VERBOSE)
+		return (cmd_parse_from_buffer(s, strlen(s), pi));
+
+	if ((cache = cmd_parse_find_cache(s, pi)) != NULL) {
+		log_debug("%s: found %s", __func__, s);
+		pi->line = cache->end;
+		cache->cmdlist->references++;
+
+		memset(&pr, 0, sizeof pr);
+		pr.status = CMD_PARSE_SUCCESS;
+		pr.cmdlist = cache->cmdlist;
+		return (&pr);
+	}
+
+	flags = pi->flags;
+	line = pi->line;
+	cmd_parse_uncacheable = 0;
+	result = cmd_parse_from_buffer(s, strlen(s), pi);
+	if (result->status == CMD_PARSE_SUCCESS && !cmd_parse_uncacheable) {
+		cmd_parse_add_cache(s, flags, pi->file, line, pi->line,
+		    result->cmdlist);
+	}
+	return (result);
 }
 
 enum cmd_parse_status
@@ -1204,6 +1462,7 @@ yylex(void)
 			if (*cp == '\0')
 				return (TOKEN);
 			ps->condition = 1;
+			cmd_parse_uncacheable = 1;
 			if (strcmp(yylval.token, "%hidden") == 0) {
 				free(yylval.token);
 				return (HIDDEN);
@@ -1431,6 +1690,7 @@ yylex_token_variable(char **buf, size_t *len)
 	}
 	name[namelen] = '\0';
 
+	cmd_parse_uncacheable = 1;
 	envent = environ_find(global_environ, name);
 	if (envent != NULL && envent->value != NULL) {
 		value = envent->value;
@@ -1464,6 +1724,7 @@ yylex_token_tilde(char **buf, size_t *len)
 	}
 	name[namelen] = '\0';
 
+	cmd_parse_uncacheable = 1;
 	if (*name == '\0') {
 		envent = environ_find(global_environ, "HOME");
 		if (envent != NULL && *envent->value != '\0')
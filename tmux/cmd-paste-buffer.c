@@ -50,8 +50,7 @@ cmd_paste_buffer_exec(struct cmd *self, struct cmdq_item *item)
 	struct cmd_find_state	*target = cmdq_get_target(item);
 	struct window_pane	*wp = target->wp;
 	struct paste_buffer	*pb;
-	const char		*sepstr, *bufname, *bufdata, *bufend, *line;
-	size_t			 seplen, bufsize;
+	const char		*sepstr, *bufname;
 	int			 bracket = args_has(args, 'p');
 
 	bufname = NULL;
@@ -76,29 +75,8 @@ cmd_paste_buffer_exec(struct cmd *self, struct cmdq_item *item)
 			else
 				sepstr = "\r";
 		}
-		seplen = strlen(sepstr);
-
-		if (bracket && (wp->screen->mode & MODE_BRACKETPASTE))
-			bufferevent_write(wp->event, "\033[200~", 6);
-
-		bufdata = paste_buffer_data(pb, &bufsize);
-		bufend = bufdata + bufsize;
-
-		for (;;) {
-			line = memchr(bufdata, '\n', bufend - bufdata);
-			if (line == NULL)
-				break;
-
-			bufferevent_write(wp->event, bufdata, line - bufdata);
-			bufferevent_write(wp->event, sepstr, seplen);
-
-			bufdata = line + 1;
-		}
-		if (bufdata != bufend)
-			bufferevent_write(wp->event, bufdata, bufend - bufdata);
-
-		if (bracket && (wp->screen->mode & MODE_BRACKETPASTE))
-			bufferevent_write(wp->event, "\033[201~", 6);
+		bracket = (bracket && (wp->screen->mode & MODE_BRACKETPASTE));
+		paste_pane(wp, pb, sepstr, bracket);
 	}
 
 	if (pb != NULL && args_has(args, 'd'))
@@ -43,8 +43,8 @@ const struct cmd_entry cmd_pipe_pane_entry = {
 	.name = "pipe-pane",
 	.alias = "pipep",
 
-	.args = { "IOot:", 0, 1 },
-	.usage = "[-IOo] " CMD_TARGET_PANE_USAGE " [command]",
+	.args = { "IOost:", 0, 1 },
+	.usage = "[-IOos] " CMD_TARGET_PANE_USAGE " [command]",
 
 	.target = { 't', CMD_FIND_PANE, 0 },
 
@@ -70,6 +70,7 @@ cmd_pipe_pane_exec(struct cmd *self, struct cmdq_item *item)
 	/* Destroy the old pipe. */
 	old_fd = wp->pipe_fd;
 	if (wp->pipe_fd != -1) {
+		window_pane_splice_stop(wp);
 		bufferevent_free(wp->pipe_event);
 		close(wp->pipe_fd);
 		wp->pipe_fd = -1;
@@ -160,6 +161,7 @@ cmd_pipe_pane_exec(struct cmd *self, struct cmdq_item *item)
 
 		wp->pipe_fd = pipe_fd[0];
 		memcpy(wpo, &wp->offset, sizeof *wpo);
+		wp->flags &= ~PANE_PIPESTALLED;
 
 		setblocking(wp->pipe_fd, 0);
 		wp->pipe_event = bufferevent_new(wp->pipe_fd,
@@ -169,10 +171,16 @@ cmd_pipe_pane_exec(struct cmd *self, struct cmdq_item *item)
 		    wp);
 		if (wp->pipe_event == NULL)
 			fatalx("out of memory");
+		bufferevent_setwatermark(wp->pipe_event, EV_WRITE,
+		    PANE_PIPE_LOW, 0);
 		if (out)
 			bufferevent_enable(wp->pipe_event, EV_WRITE);
+		else
+			bufferevent_disable(wp->pipe_event, EV_WRITE);
 		if (in)
 			bufferevent_enable(wp->pipe_event, EV_READ);
+		if (out && args_has(args, 's'))
+			window_pane_splice_start(wp);
 
 		free(cmd);
 		return (CMD_RETURN_NORMAL);
@@ -201,7 +209,8 @@ cmd_pipe_pane_write_callback(__unused struct bufferevent *bufev, void *data)
 {
 	struct window_pane	*wp = data;
 
-	log_debug("%%%u pipe empty", wp->id);
+	log_debug("%%%u pipe below low watermark", wp->id);
+	window_pane_pipe_write(wp);
 
 	if (window_pane_destroy_ready(wp))
 		server_destroy_pane(wp, 1);
@@ -215,6 +224,7 @@ cmd_pipe_pane_error_callback(__unused struct bufferevent *bufev,
 
 	log_debug("%%%u pipe error", wp->id);
 
+	window_pane_splice_stop(wp);
 	bufferevent_free(wp->pipe_event);
 	close(wp->pipe_fd);
 	wp->pipe_fd = -1;
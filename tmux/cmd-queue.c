@@ -23,6 +23,7 @@
 #include <string.h>
 #include <time.h>
 
+#define XMALLOC_TAG XMALLOC_CMDQ
 #include "tmux.h"
 
 /* Command queue flags. */
@@ -37,7 +38,7 @@ enum cmdq_type {
 
 /* Command queue item. */
 struct cmdq_item {
-	char			*name;
+	const char		*name;
 	struct cmdq_list	*queue;
 	struct cmdq_item	*next;
 
@@ -89,6 +90,42 @@ struct cmdq_list {
 	struct cmdq_item_list	 list;
 };
 
+/*
+ * Spare items and states. Commands are often run one at a time (for example
+ * from key bindings), so keep a few to save allocating them for each command.
+ */
+#define CMDQ_SPARE 16
+static struct cmdq_item		*cmdq_spare_items[CMDQ_SPARE];
+static u_int			 cmdq_nspare_items;
+static struct cmdq_state	*cmdq_spare_states[CMDQ_SPARE];
+static u_int			 cmdq_nspare_states;
+
+/* Get a new item. */
+static struct cmdq_item *
+cmdq_new_item(const char *name, enum cmdq_type type)
+{
+	struct cmdq_item	*item;
+
+	if (cmdq_nspare_items != 0) {
+		item = cmdq_spare_items[--cmdq_nspare_items];
+		memset(item, 0, sizeof *item);
+	} else
+		item = xcalloc(1, sizeof *item);
+	item->name = name;
+	item->type = type;
+	return (item);
+}
+
+/* Free an item. */
+static void
+cmdq_free_item(struct cmdq_item *item)
+{
+	if (cmdq_nspare_items != CMDQ_SPARE)
+		cmdq_spare_items[cmdq_nspare_items++] = item;
+	else
+		free(item);
+}
+
 /* Get command queue name. */
 static const char *
 cmdq_name(struct client *c)
@@ -142,7 +179,10 @@ cmdq_free(struct cmdq_list *queue)
 const char *
 cmdq_get_name(struct cmdq_item *item)
 {
-	return (item->name);
+	static char	s[256];
+
+	xsnprintf(s, sizeof s, "[%s/%p]", item->name, item);
+	return (s);
 }
 
 /* Get item client. */
@@ -208,7 +248,11 @@ cmdq_new_state(struct cmd_find_state *current, struct key_event *event,
 {
 	struct cmdq_state	*state;
 
-	state = xcalloc(1, sizeof *state);
+	if (cmdq_nspare_states != 0) {
+		state = cmdq_spare_states[--cmdq_nspare_states];
+		memset(state, 0, sizeof *state);
+	} else
+		state = xcalloc(1, sizeof *state);
 	state->references = 1;
 	state->flags = flags;
 
@@ -248,7 +292,10 @@ cmdq_free_state(struct cmdq_state *state)
 
 	if (state->formats != NULL)
 		format_free(state->formats);
-	free(state);
+	if (cmdq_nspare_states != CMDQ_SPARE)
+		cmdq_spare_states[cmdq_nspare_states++] = state;
+	else
+		free(state);
 }
 
 /* Add a format to command queue. */
@@ -269,7 +316,17 @@ cmdq_add_format(struct cmdq_state *state, const char *key, const char *fmt, ...)
 	free(value);
 }
 
-/* Merge formats from item. */
+/* Get formats added to a state. */
+struct format_tree *
+cmdq_get_formats(struct cmdq_state *state)
+{
+	return (state->formats);
+}
+
+/*
+ * Add formats from item. The formats from the state are not copied, instead
+ * the tree keeps a reference to the state and looks them up there.
+ */
 void
 cmdq_merge_formats(struct cmdq_item *item, struct format_tree *ft)
 {
@@ -280,7 +337,7 @@ cmdq_merge_formats(struct cmdq_item *item, struct format_tree *ft)
 		format_add(ft, "command", "%s", entry->name);
 	}
 	if (item->state->formats != NULL)
-		format_merge(ft, item->state->formats);
+		format_set_state(ft, item->state);
 }
 
 /* Append an item. */
@@ -300,13 +357,21 @@ cmdq_append(struct client *c, struct cmdq_item *item)
 
 		item->queue = queue;
 		TAILQ_INSERT_TAIL(&queue->list, item, entry);
-		log_debug("%s %s: %s", __func__, cmdq_name(c), item->name);
+		log_debug("%s %s: [%s/%p]", __func__, cmdq_name(c), item->name,
+		    item);
 
 		item = next;
 	} while (item != NULL);
 	return (TAILQ_LAST(&queue->list, cmdq_item_list));
 }
 
+/* Get the last item on a queue. */
+struct cmdq_item *
+cmdq_last(struct client *c)
+{
+	return (TAILQ_LAST(&cmdq_get(c)->list, cmdq_item_list));
+}
+
 /* Insert an item. */
 struct cmdq_item *
 cmdq_insert_after(struct cmdq_item *after, struct cmdq_item *item)
@@ -326,8 +391,8 @@ cmdq_insert_after(struct cmdq_item *after, struct cmdq_item *item)
 
 		item->queue = queue;
 		TAILQ_INSERT_AFTER(&queue->list, after, item, entry);
-		log_debug("%s %s: %s after %s", __func__, cmdq_name(c),
-		    item->name, after->name);
+		log_debug("%s %s: [%s/%p] after [%s/%p]", __func__,
+		    cmdq_name(c), item->name, item, after->name, after);
 
 		after = item;
 		item = next;
@@ -347,7 +412,7 @@ cmdq_insert_hook(struct session *s, struct cmdq_item *item,
 	struct args_value		*valuep;
 	struct options			*oo;
 	va_list				 ap;
-	char				*name, tmp[32], flag, *arguments;
+	char				 name[128], tmp[32], flag, *arguments;
 	int				 i;
 	const char			*value;
 	struct cmdq_item		*new_item;
@@ -364,14 +429,14 @@ cmdq_insert_hook(struct session *s, struct cmdq_item *item,
 		oo = s->options;
 
 	va_start(ap, fmt);
-	xvasprintf(&name, fmt, ap);
+	xvsnprintf(name, sizeof name, fmt, ap);
 	va_end(ap);
 
+	if (!options_hook_may_be_set(name))
+		return;
 	o = options_get(oo, name);
-	if (o == NULL) {
-		free(name);
+	if (o == NULL)
 		return;
-	}
 	log_debug("running hook %s (parent %p)", name, item);
 
 	/*
@@ -426,7 +491,6 @@ cmdq_insert_hook(struct session *s, struct cmdq_item *item,
 	}
 
 	cmdq_free_state(new_state);
-	free(name);
 }
 
 /* Continue processing command queue. */
@@ -447,12 +511,15 @@ cmdq_remove(struct cmdq_item *item)
 	cmdq_free_state(item->state);
 
 	TAILQ_REMOVE(&item->queue->list, item, entry);
-
-	free(item->name);
-	free(item);
+	cmdq_free_item(item);
 }
 
-/* Remove all subsequent items that match this item's group. */
+/*
+ * Remove all subsequent items that match this item's group. The same command
+ * list may be queued more than once, so the items must also share a state.
+ * The items for a group are queued together, so once an item with the same
+ * state but another group is found there is nothing left to remove.
+ */
 static void
 cmdq_remove_group(struct cmdq_item *item)
 {
@@ -463,8 +530,11 @@ cmdq_remove_group(struct cmdq_item *item)
 	this = TAILQ_NEXT(item, entry);
 	while (this != NULL) {
 		next = TAILQ_NEXT(this, entry);
-		if (this->group == item->group)
+		if (this->state == item->state) {
+			if (this->group != item->group)
+				break;
 			cmdq_remove(this);
+		}
 		this = next;
 	}
 }
@@ -487,9 +557,7 @@ cmdq_get_command(struct cmd_list *cmdlist, struct cmdq_state *state)
 	while (cmd != NULL) {
 		entry = cmd_get_entry(cmd);
 
-		item = xcalloc(1, sizeof *item);
-		xasprintf(&item->name, "[%s/%p]", entry->name, item);
-		item->type = CMDQ_COMMAND;
+		item = cmdq_new_item(entry->name, CMDQ_COMMAND);
 
 		item->group = cmd_get_group(cmd);
 		item->state = cmdq_link_state(state);
@@ -498,7 +566,8 @@ cmdq_get_command(struct cmd_list *cmdlist, struct cmdq_state *state)
 		item->cmd = cmd;
 
 		cmdlist->references++;
-		log_debug("%s: %s group %u", __func__, item->name, item->group);
+		log_debug("%s: [%s/%p] group %u", __func__, item->name, item,
+		    item->group);
 
 		if (first == NULL)
 			first = item;
@@ -570,9 +639,12 @@ cmdq_fire_command(struct cmdq_item *item)
 	struct cmd_find_state	*fsp, fs;
 	int			 flags, quiet = 0;
 	char			*tmp;
+	uint64_t		 start = 0;
 
 	if (cfg_finished)
 		cmdq_add_message(item);
+	else
+		start = get_timer_usec();
 	if (log_get_level() > 1) {
 		tmp = cmd_print(cmd);
 		log_debug("%s %s: (%u) %s", __func__, name, item->group, tmp);
@@ -610,6 +682,7 @@ cmdq_fire_command(struct cmdq_item *item)
 	if (retval == CMD_RETURN_ERROR)
 		goto out;
 
+	cmd_add_executed(entry);
 	retval = entry->exec(cmd, item);
 	if (retval == CMD_RETURN_ERROR)
 		goto out;
@@ -632,6 +705,8 @@ out:
 		cmdq_guard(item, "error", flags);
 	else
 		cmdq_guard(item, "end", flags);
+	if (!cfg_finished)
+		cfg_add_command_timing(cmd, get_timer_usec() - start);
 	return (retval);
 }
 
@@ -641,9 +716,7 @@ cmdq_get_callback1(const char *name, cmdq_cb cb, void *data)
 {
 	struct cmdq_item	*item;
 
-	item = xcalloc(1, sizeof *item);
-	xasprintf(&item->name, "[%s/%p]", name, item);
-	item->type = CMDQ_CALLBACK;
+	item = cmdq_new_item(name, CMDQ_CALLBACK);
 
 	item->group = 0;
 	item->state = cmdq_new_state(NULL, NULL, 0);
@@ -705,8 +778,8 @@ cmdq_next(struct client *c)
 		item = queue->item = TAILQ_FIRST(&queue->list);
 		if (item == NULL)
 			break;
-		log_debug("%s %s: %s (%d), flags %x", __func__, name,
-		    item->name, item->type, item->flags);
+		log_debug("%s %s: [%s/%p] (%d), flags %x", __func__, name,
+		    item->name, item, item->type, item->flags);
 
 		/*
 		 * Any item with the waiting flag set waits until an external
@@ -775,6 +848,15 @@ cmdq_running(struct client *c)
     return (queue->item);
 }
 
+/* Check if the first item in a client's queue is waiting. */
+int
+cmdq_waiting(struct client *c)
+{
+	struct cmdq_item	*item = TAILQ_FIRST(&cmdq_get(c)->list);
+
+	return (item != NULL && (item->flags & CMDQ_WAITING));
+}
+
 /* Print a guard line. */
 void
 cmdq_guard(struct cmdq_item *item, const char *guard, int flags)
@@ -784,7 +866,7 @@ cmdq_guard(struct cmdq_item *item, const char *guard, int flags)
 	u_int		 number = item->number;
 
 	if (c != NULL && (c->flags & CLIENT_CONTROL))
-		control_write(c, "%%%s %ld %u %d", guard, t, number, flags);
+		control_guard(c, guard, t, number, flags);
 }
 
 /* Show message from command. */
@@ -18,6 +18,7 @@
 
 #include <sys/types.h>
 
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -45,9 +46,11 @@ const struct cmd_entry cmd_refresh_client_entry = {
 static void
 cmd_refresh_client_update_subscription(struct client *tc, const char *value)
 {
-	char			*copy, *split, *name, *what;
+	char			*copy, *split, *name, *what, *end;
 	enum control_sub_type	 subtype;
 	int			 subid = -1;
+	u_int			 interval = 1000;
+	unsigned long		 n;
 
 	copy = name = xstrdup(value);
 	if ((split = strchr(copy, ':')) == NULL) {
@@ -56,6 +59,22 @@ cmd_refresh_client_update_subscription(struct client *tc, const char *value)
 	}
 	*split++ = '\0';
 
+	if ((what = strchr(name, '/')) != NULL) {
+		*what++ = '\0';
+		errno = 0;
+		n = strtoul(what, &end, 10);
+		if (errno != 0 || end == what || n > UINT_MAX / 1000)
+			goto out;
+		if (strcmp(end, "ms") == 0)
+			interval = n;
+		else if (*end == '\0' || strcmp(end, "s") == 0)
+			interval = n * 1000;
+		else
+			goto out;
+		if (interval < CONTROL_SUB_MINIMUM)
+			interval = CONTROL_SUB_MINIMUM;
+	}
+
 	what = split;
 	if ((split = strchr(what, ':')) == NULL)
 		goto out;
@@ -71,18 +90,52 @@ cmd_refresh_client_update_subscription(struct client *tc, const char *value)
 		subtype = CONTROL_SUB_WINDOW;
 	else
 		subtype = CONTROL_SUB_SESSION;
-	control_add_sub(tc, name, subtype, subid, split);
+	control_add_sub(tc, name, subtype, subid, split, interval);
 
 out:
 	free(copy);
 }
 
+static int
+cmd_refresh_client_get_size(const char *value, size_t *size)
+{
+	unsigned long long	 n;
+	char			*end;
+
+	errno = 0;
+	n = strtoull(value, &end, 10);
+	if (errno != 0 || end == value)
+		return (-1);
+	switch (*end) {
+	case 'G':
+	case 'g':
+		n = (n > ULLONG_MAX >> 10) ? ULLONG_MAX : n << 10;
+		/* FALLTHROUGH */
+	case 'M':
+	case 'm':
+		n = (n > ULLONG_MAX >> 10) ? ULLONG_MAX : n << 10;
+		/* FALLTHROUGH */
+	case 'K':
+	case 'k':
+		n = (n > ULLONG_MAX >> 10) ? ULLONG_MAX : n << 10;
+		end++;
+		break;
+	}
+	if (*end != '\0')
+		return (-1);
+	if (n > SIZE_MAX)
+		n = SIZE_MAX;
+	*size = n;
+	return (0);
+}
+
 static void
 cmd_refresh_client_update_offset(struct client *tc, const char *value)
 {
 	struct window_pane	*wp;
 	char			*copy, *split;
 	u_int			 pane;
+	size_t			 size;
 
 	if (*value != '%')
 		return;
@@ -105,6 +158,18 @@ cmd_refresh_client_update_offset(struct client *tc, const char *value)
 		control_continue_pane(tc, wp);
 	else if (strcmp(split, "pause") == 0)
 		control_pause_pane(tc, wp);
+	else if (strcmp(split, "stats") == 0)
+		control_write_stats(tc, wp);
+	else if (strcmp(split, "lines=on") == 0)
+		control_set_pane_lines(tc, wp, 1);
+	else if (strcmp(split, "lines=off") == 0)
+		control_set_pane_lines(tc, wp, 0);
+	else if (strcmp(split, "credit=none") == 0)
+		control_clear_pane_credit(tc, wp);
+	else if (strncmp(split, "credit=", 7) == 0) {
+		if (cmd_refresh_client_get_size(split + 7, &size) == 0)
+			control_add_pane_credit(tc, wp, size);
+	}
 
 out:
 	free(copy);
@@ -225,6 +290,8 @@ cmd_refresh_client_exec(struct cmd *self, struct cmdq_item *item)
 		tc->flags |= CLIENT_STATUSFORCE;
 		server_status_client(tc);
 	} else {
+		/* Redraw everything in case the terminal has been garbled. */
+		tty_invalidate_shadow(&tc->tty);
 		tc->flags |= CLIENT_STATUSFORCE;
 		server_redraw_client(tc);
 	}
@@ -40,7 +40,7 @@ const struct cmd_entry cmd_respawn_pane_entry = {
 
 	.target = { 't', CMD_FIND_PANE, 0 },
 
-	.flags = 0,
+	.flags = CMD_CLIENTENV,
 	.exec = cmd_respawn_pane_exec
 };
 
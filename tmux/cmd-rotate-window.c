@@ -109,6 +109,8 @@ cmd_rotate_window_exec(struct cmd *self, struct cmdq_item *item)
 	window_set_active_pane(w, wp, 1);
 	cmd_find_from_winlink_pane(current, wl, wp, 0);
 	window_pop_zoom(w);
+	screen_redraw_free_borders(w);
+	w->layout_generation++;
 	server_redraw_window(w);
 
 	return (CMD_RETURN_NORMAL);
@@ -46,7 +46,7 @@ const struct cmd_entry cmd_run_shell_entry = {
 
 	.target = { 't', CMD_FIND_PANE, CMD_FIND_CANFAIL },
 
-	.flags = 0,
+	.flags = CMD_CLIENTENV,
 	.exec = cmd_run_shell_exec
 };
 
@@ -116,6 +116,7 @@ cmd_run_shell_exec(struct cmd *self, struct cmdq_item *item)
 		return (CMD_RETURN_NORMAL);
 
 	cdata = xcalloc(1, sizeof *cdata);
+	cdata->flags = JOB_LIMIT;
 	if (args->argc != 0)
 		cdata->cmd = format_single_from_target(item, args->argv[0]);
 
@@ -79,6 +79,7 @@ cmd_save_buffer_exec(struct cmd *self, struct cmdq_item *item)
 	const char		*bufname = args_get(args, 'b'), *bufdata;
 	size_t			 bufsize;
 	char			*path, *tmp;
+	struct evbuffer		*evb;
 
 	if (bufname == NULL) {
 		if ((pb = paste_get_top(NULL)) == NULL) {
@@ -109,8 +110,13 @@ cmd_save_buffer_exec(struct cmd *self, struct cmdq_item *item)
 		flags = O_APPEND;
 	else
 		flags = O_TRUNC;
-	file_write(cmdq_get_client(item), path, flags, bufdata, bufsize,
+	evb = evbuffer_new();
+	if (evb == NULL)
+		fatalx("out of memory");
+	paste_buffer_reference(pb, evb, 0, bufsize);
+	file_write(cmdq_get_client(item), path, flags, evb,
 	    cmd_save_buffer_done, item);
+	evbuffer_free(evb);
 	free(path);
 
 	return (CMD_RETURN_WAIT);
@@ -0,0 +1,122 @@
+/* $OpenBSD$ */
+
+/*
+ * Copyright (c) 2021 The tmux authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER
+ * IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tmux.h"
+
+/*
+ * Save sessions, windows and panes to a file and restore them.
+ */
+
+static enum cmd_retval	cmd_save_server_exec(struct cmd *,
+			    struct cmdq_item *);
+static enum cmd_retval	cmd_restore_server_exec(struct cmd *,
+			    struct cmdq_item *);
+
+const struct cmd_entry cmd_save_server_entry = {
+	.name = "save-server",
+	.alias = NULL,
+
+	.args = { "g", 1, 1 },
+	.usage = "[-g] path",
+
+	.flags = CMD_AFTERHOOK,
+	.exec = cmd_save_server_exec
+};
+
+const struct cmd_entry cmd_restore_server_entry = {
+	.name = "restore-server",
+	.alias = NULL,
+
+	.args = { "", 1, 1 },
+	.usage = "path",
+
+	.flags = CMD_AFTERHOOK,
+	.exec = cmd_restore_server_exec
+};
+
+static void
+cmd_save_server_done(__unused struct client *c, const char *path, int error,
+    int closed, __unused struct evbuffer *buffer, void *data)
+{
+	struct cmdq_item	*item = data;
+
+	if (!closed)
+		return;
+
+	if (error != 0)
+		cmdq_error(item, "%s: %s", path, strerror(error));
+	cmdq_continue(item);
+}
+
+static enum cmd_retval
+cmd_save_server_exec(struct cmd *self, struct cmdq_item *item)
+{
+	struct args	*args = cmd_get_args(self);
+	struct evbuffer	*evb;
+	char		*path;
+	int		 flags = 0;
+
+	if (args_has(args, 'g'))
+		flags |= SNAPSHOT_CONTENTS;
+	evb = snapshot_save(flags);
+
+	path = format_single_from_target(item, args->argv[0]);
+	file_write(cmdq_get_client(item), path, O_TRUNC, evb,
+	    cmd_save_server_done, item);
+	evbuffer_free(evb);
+	free(path);
+
+	return (CMD_RETURN_WAIT);
+}
+
+static void
+cmd_restore_server_done(__unused struct client *c, const char *path,
+    int error, int closed, struct evbuffer *buffer, void *data)
+{
+	struct cmdq_item	*item = data;
+
+	if (!closed)
+		return;
+
+	if (error != 0)
+		cmdq_error(item, "%s: %s", path, strerror(error));
+	else {
+		snapshot_restore(item, EVBUFFER_DATA(buffer),
+		    EVBUFFER_LENGTH(buffer), 0);
+	}
+	cmdq_continue(item);
+}
+
+static enum cmd_retval
+cmd_restore_server_exec(struct cmd *self, struct cmdq_item *item)
+{
+	struct args	*args = cmd_get_args(self);
+	char		*path;
+
+	path = format_single_from_target(item, args->argv[0]);
+	file_read(cmdq_get_client(item), path, cmd_restore_server_done, item);
+	free(path);
+
+	return (CMD_RETURN_WAIT);
+}
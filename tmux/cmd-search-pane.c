@@ -0,0 +1,386 @@
+/* $OpenBSD$ */
+
+/*
+ * Copyright (c) 2021 The tmux authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER
+ * IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tmux.h"
+
+/*
+ * Print the lines of a pane, or of many panes, containing a string.
+ */
+
+static enum cmd_retval	cmd_search_pane_exec(struct cmd *, struct cmdq_item *);
+static enum cmd_retval	cmd_find_text_exec(struct cmd *, struct cmdq_item *);
+
+const struct cmd_entry cmd_search_pane_entry = {
+	.name = "search-pane",
+	.alias = "searchp",
+
+	.args = { "it:", 1, 1 },
+	.usage = "[-i] " CMD_TARGET_PANE_USAGE " string",
+
+	.target = { 't', CMD_FIND_PANE, 0 },
+
+	.flags = CMD_AFTERHOOK,
+	.exec = cmd_search_pane_exec
+};
+
+const struct cmd_entry cmd_find_text_entry = {
+	.name = "find-text",
+	.alias = "findt",
+
+	.args = { "aC:it:", 1, 1 },
+	.usage = "[-ai] [-C lines] " CMD_TARGET_SESSION_USAGE " string",
+
+	.target = { 't', CMD_FIND_SESSION, 0 },
+
+	.flags = CMD_AFTERHOOK,
+	.exec = cmd_find_text_exec
+};
+
+/* Time spent searching before returning to the event loop. */
+#define FIND_TEXT_TIME 10
+
+struct cmd_find_text_data {
+	struct cmdq_item	*item;
+	struct event		 timer;
+
+	const char		*s;
+	int			 cis;
+	u_int			 context;
+	struct screen		 ss;
+
+	u_int			*panes;
+	u_int			 npanes;
+	u_int			 next;
+
+	u_int			 id;
+	struct grid		*gd;
+	struct grid_index_query	*q;
+	u_int			 yy;
+	u_int			 printed;
+};
+
+/* Get a line and any lines it wraps onto as one string. */
+static char *
+cmd_search_pane_line(struct grid *gd, u_int first, u_int last)
+{
+	char	*buf = NULL, *line;
+	size_t	 len = 0, n;
+	u_int	 yy;
+
+	for (yy = first; yy <= last; yy++) {
+		line = grid_string_cells(gd, 0, yy, gd->sx, NULL, 0, 0,
+		    yy == last);
+		n = strlen(line);
+		buf = xrealloc(buf, len + n + 1);
+		memcpy(buf + len, line, n + 1);
+		len += n;
+		free(line);
+	}
+	return (buf);
+}
+
+/*
+ * Check the line starting at yy and any lines it wraps onto for a string. The
+ * last line is returned in last and the text in line if it matches.
+ */
+static int
+cmd_search_pane_match(struct grid *gd, struct grid_index_query *q, u_int yy,
+    u_int *last, const char *s, int cis, char **line)
+{
+	const struct grid_line	*gl;
+	u_int			 end = gd->hsize + gd->sy;
+	int			 candidate = 0;
+	char			*found;
+
+	for (*last = yy; *last < end - 1; (*last)++) {
+		if (q == NULL || grid_index_check(q, *last))
+			candidate = 1;
+		gl = grid_peek_line_packed(gd, *last);
+		if (~gl->flags & GRID_LINE_WRAPPED)
+			break;
+	}
+	if (*last == end - 1)
+		candidate = 1;
+	if (!candidate)
+		return (0);
+
+	*line = cmd_search_pane_line(gd, yy, *last);
+	if (cis)
+		found = strcasestr(*line, s);
+	else
+		found = strstr(*line, s);
+	if (found == NULL) {
+		free(*line);
+		return (0);
+	}
+	return (1);
+}
+
+/* Make a one line screen holding a search string. */
+static void
+cmd_search_pane_string(struct screen *ss, const char *s)
+{
+	struct screen_write_ctx	ctx;
+
+	screen_init(ss, screen_write_strlen("%s", s), 1, 0);
+	screen_write_start(&ctx, ss);
+	screen_write_nputs(&ctx, -1, &grid_default_cell, "%s", s);
+	screen_write_stop(&ctx);
+}
+
+static enum cmd_retval
+cmd_search_pane_exec(struct cmd *self, struct cmdq_item *item)
+{
+	struct args		*args = cmd_get_args(self);
+	struct window_pane	*wp = cmdq_get_target(item)->wp;
+	struct grid		*gd = wp->base.grid;
+	const char		*s = args->argv[0];
+	struct screen		 ss;
+	struct grid_index_query	*q;
+	char			*line;
+	u_int			 yy, last, end;
+
+	if (*s == '\0') {
+		cmdq_error(item, "empty search string");
+		return (CMD_RETURN_ERROR);
+	}
+
+	/* The index can only be used once the history is all reflowed. */
+	grid_reflow_pending(gd, 1);
+
+	cmd_search_pane_string(&ss, s);
+	q = grid_index_start(gd, ss.grid);
+
+	end = gd->hsize + gd->sy;
+	for (yy = 0; yy < end; yy = last + 1) {
+		if (cmd_search_pane_match(gd, q, yy, &last, s,
+		    args_has(args, 'i'), &line)) {
+			cmdq_print(item, "%d: %s", (int)yy - (int)gd->hsize,
+			    line);
+			free(line);
+		}
+	}
+
+	grid_index_end(q);
+	grid_pack_history(gd);
+	screen_free(&ss);
+	return (CMD_RETURN_NORMAL);
+}
+
+/* Finish with the current pane. */
+static void
+cmd_find_text_end_pane(struct cmd_find_text_data *ft)
+{
+	if (ft->gd != NULL) {
+		grid_index_end(ft->q);
+		ft->q = NULL;
+		grid_destroy(ft->gd);
+		ft->gd = NULL;
+	}
+}
+
+/*
+ * Take a snapshot of the next pane which still exists. The snapshot shares
+ * the history with the pane, so it is cheap to take and is not changed by
+ * output to the pane while it is being searched.
+ */
+static int
+cmd_find_text_next_pane(struct cmd_find_text_data *ft)
+{
+	struct window_pane	*wp = NULL;
+	struct grid		*gd;
+	u_int			 ny;
+
+	while (ft->next < ft->npanes) {
+		ft->id = ft->panes[ft->next++];
+		if ((wp = window_pane_find_by_id(ft->id)) != NULL)
+			break;
+	}
+	if (wp == NULL)
+		return (0);
+	gd = wp->base.grid;
+
+	grid_reflow_pending(gd, 1);
+	ny = gd->hsize + gd->sy;
+	ft->gd = grid_create(gd->sx, gd->sy, 0);
+	grid_snapshot(ft->gd, gd, 0, ny);
+	ft->gd->sy = gd->sy;
+	ft->gd->hsize = gd->hsize;
+	grid_pack_history(gd);
+
+	ft->q = grid_index_start(ft->gd, ft->ss.grid);
+	ft->yy = 0;
+	ft->printed = 0;
+	return (1);
+}
+
+/* Print a matching line with any context around it. */
+static void
+cmd_find_text_print(struct cmd_find_text_data *ft, u_int first, u_int last,
+    const char *line)
+{
+	struct grid	*gd = ft->gd;
+	u_int		 yy, start, end;
+	char		*text;
+
+	start = ft->printed;
+	if (first > start + ft->context)
+		start = first - ft->context;
+	for (yy = start; yy < first; yy++) {
+		text = grid_string_cells(gd, 0, yy, gd->sx, NULL, 0, 0, 1);
+		cmdq_print(ft->item, "%%%u %d- %s", ft->id,
+		    (int)yy - (int)gd->hsize, text);
+		free(text);
+	}
+
+	cmdq_print(ft->item, "%%%u %d: %s", ft->id,
+	    (int)first - (int)gd->hsize, line);
+
+	end = last + 1 + ft->context;
+	if (end > gd->hsize + gd->sy)
+		end = gd->hsize + gd->sy;
+	for (yy = last + 1; yy < end; yy++) {
+		text = grid_string_cells(gd, 0, yy, gd->sx, NULL, 0, 0, 1);
+		cmdq_print(ft->item, "%%%u %d- %s", ft->id,
+		    (int)yy - (int)gd->hsize, text);
+		free(text);
+	}
+	ft->printed = end;
+}
+
+/* Search until finished or the time slice is used up. */
+static int
+cmd_find_text_search(struct cmd_find_text_data *ft)
+{
+	uint64_t	 stop = get_timer() + FIND_TEXT_TIME;
+	u_int		 last, n = 0;
+	char		*line;
+
+	for (;;) {
+		if (ft->gd == NULL && !cmd_find_text_next_pane(ft))
+			return (1);
+		while (ft->yy < ft->gd->hsize + ft->gd->sy) {
+			if (cmd_search_pane_match(ft->gd, ft->q, ft->yy, &last,
+			    ft->s, ft->cis, &line)) {
+				cmd_find_text_print(ft, ft->yy, last, line);
+				free(line);
+			}
+			ft->yy = last + 1;
+			if (++n % 64 == 0 && get_timer() > stop)
+				return (0);
+		}
+		cmd_find_text_end_pane(ft);
+	}
+}
+
+static void
+cmd_find_text_free(struct cmd_find_text_data *ft)
+{
+	if (event_initialized(&ft->timer))
+		evtimer_del(&ft->timer);
+	cmd_find_text_end_pane(ft);
+	screen_free(&ft->ss);
+	free(ft->panes);
+	free(ft);
+}
+
+static void
+cmd_find_text_timer(__unused int fd, __unused short events, void *arg)
+{
+	struct cmd_find_text_data	*ft = arg;
+	struct client			*c = cmdq_get_client(ft->item);
+	struct timeval			 tv = { .tv_usec = 0 };
+
+	if ((c == NULL || (~c->flags & CLIENT_DEAD)) &&
+	    !cmd_find_text_search(ft)) {
+		evtimer_add(&ft->timer, &tv);
+		return;
+	}
+	cmdq_continue(ft->item);
+	cmd_find_text_free(ft);
+}
+
+/*
+ * Search the panes in a session, or every pane, for a string. Each pane is
+ * searched in turn a slice at a time, so searching many large histories does
+ * not stop the server.
+ */
+static enum cmd_retval
+cmd_find_text_exec(struct cmd *self, struct cmdq_item *item)
+{
+	struct args			*args = cmd_get_args(self);
+	struct session			*s = cmdq_get_target(item)->s;
+	const char			*string = args->argv[0];
+	struct cmd_find_text_data	*ft;
+	struct winlink			*wl;
+	struct window			*w;
+	struct window_pane		*wp;
+	struct timeval			 tv = { .tv_usec = 0 };
+	char				*cause;
+
+	if (*string == '\0') {
+		cmdq_error(item, "empty search string");
+		return (CMD_RETURN_ERROR);
+	}
+
+	ft = xcalloc(1, sizeof *ft);
+	ft->item = item;
+	ft->s = string;
+	ft->cis = args_has(args, 'i');
+	if (args_has(args, 'C')) {
+		ft->context = args_strtonum(args, 'C', 0, INT_MAX, &cause);
+		if (cause != NULL) {
+			cmdq_error(item, "context %s", cause);
+			free(cause);
+			free(ft);
+			return (CMD_RETURN_ERROR);
+		}
+	}
+	cmd_search_pane_string(&ft->ss, string);
+
+	if (args_has(args, 'a')) {
+		RB_FOREACH(w, windows, &windows) {
+			TAILQ_FOREACH(wp, &w->panes, entry) {
+				ft->panes = xreallocarray(ft->panes,
+				    ft->npanes + 1, sizeof *ft->panes);
+				ft->panes[ft->npanes++] = wp->id;
+			}
+		}
+	} else {
+		RB_FOREACH(wl, winlinks, &s->windows) {
+			TAILQ_FOREACH(wp, &wl->window->panes, entry) {
+				ft->panes = xreallocarray(ft->panes,
+				    ft->npanes + 1, sizeof *ft->panes);
+				ft->panes[ft->npanes++] = wp->id;
+			}
+		}
+	}
+
+	if (cmd_find_text_search(ft)) {
+		cmd_find_text_free(ft);
+		return (CMD_RETURN_NORMAL);
+	}
+	evtimer_set(&ft->timer, cmd_find_text_timer, ft);
+	evtimer_add(&ft->timer, &tv);
+	return (CMD_RETURN_WAIT);
+}
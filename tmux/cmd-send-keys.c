@@ -91,6 +91,7 @@ cmd_send_keys_inject_string(struct cmdq_item *item, struct cmdq_item *after,
     struct args *args, int i)
 {
 	const char		*s = args->argv[i];
+	struct window_pane	*wp;
 	struct utf8_data	*ud, *loop;
 	utf8_char		 uc;
 	key_code		 key;
@@ -116,6 +117,12 @@ cmd_send_keys_inject_string(struct cmdq_item *item, struct cmdq_item *after,
 		literal = 1;
 	}
 	if (literal) {
+		wp = cmdq_get_target(item)->wp;
+		if (TAILQ_EMPTY(&wp->modes)) {
+			window_pane_key_literal(wp, s);
+			return (item);
+		}
+
 		ud = utf8_fromcstr(s);
 		for (loop = ud; loop->size != 0; loop++) {
 			if (loop->size == 1 && loop->data[0] <= 0x7f)
@@ -147,7 +154,7 @@ cmd_send_keys_exec(struct cmd *self, struct cmdq_item *item)
 	struct cmdq_item		*after = item;
 	int				 i;
 	key_code			 key;
-	u_int				 np = 1;
+	u_int				 np = 1, count;
 	char				*cause = NULL;
 
 	if (args_has(args, 'N')) {
@@ -174,6 +181,18 @@ cmd_send_keys_exec(struct cmd *self, struct cmdq_item *item)
 		if (!m->valid)
 			m = NULL;
 		wme->mode->command(wme, tc, s, wl, args, m);
+
+		/*
+		 * A mouse event may stand for several identical events, so
+		 * run the command again for each while the mode is the same.
+		 */
+		for (count = 1; m != NULL && count < event->count; count++) {
+			if (TAILQ_FIRST(&wp->modes) != wme)
+				break;
+			if (args_has(args, 'N'))
+				wme->prefix = np;
+			wme->mode->command(wme, tc, s, wl, args, m);
+		}
 		return (CMD_RETURN_NORMAL);
 	}
 
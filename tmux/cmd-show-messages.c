@@ -31,6 +31,11 @@
 #define SHOW_MESSAGES_TEMPLATE \
 	"#{t/p:message_time}: #{message_text}"
 
+#define SHOW_MESSAGES_MEMORY_TEMPLATE \
+	"Pane #{pane_id}: #{pane_memory} bytes (cells=#{pane_memory_cells}, " \
+	"extended=#{pane_memory_extended}, packed=#{pane_memory_packed}, " \
+	"styles=#{pane_memory_styles}, input=#{pane_memory_input})"
+
 static enum cmd_retval	cmd_show_messages_exec(struct cmd *,
 			    struct cmdq_item *);
 
@@ -38,8 +43,8 @@ const struct cmd_entry cmd_show_messages_entry = {
 	.name = "show-messages",
 	.alias = "showmsgs",
 
-	.args = { "JTt:", 0, 0 },
-	.usage = "[-JT] " CMD_TARGET_CLIENT_USAGE,
+	.args = { "CJMPRTt:", 0, 0 },
+	.usage = "[-CJMPRT] " CMD_TARGET_CLIENT_USAGE,
 
 	.flags = CMD_AFTERHOOK|CMD_CLIENT_TFLAG,
 	.exec = cmd_show_messages_exec
@@ -49,20 +54,23 @@ static int
 cmd_show_messages_terminals(struct cmd *self, struct cmdq_item *item, int blank)
 {
 	struct args	*args = cmd_get_args(self);
-	struct client	*tc = cmdq_get_target_client(item);
+	struct client	*tc = cmdq_get_target_client(item), *c;
 	struct tty_term	*term;
 	u_int		 i, n;
 
 	n = 0;
-	LIST_FOREACH(term, &tty_terms, entry) {
-		if (args_has(args, 't') && term != tc->tty.term)
+	TAILQ_FOREACH(c, &clients, entry) {
+		if (~c->tty.flags & TTY_OPENED)
+			continue;
+		if (args_has(args, 't') && c != tc)
 			continue;
+		term = c->tty.term;
 		if (blank) {
 			cmdq_print(item, "%s", "");
 			blank = 0;
 		}
 		cmdq_print(item, "Terminal %u: %s for %s, flags=0x%x:", n,
-		    term->name, term->tty->client->name, term->flags);
+		    term->name, c->name, term->flags);
 		n++;
 		for (i = 0; i < tty_term_ncodes(); i++)
 			cmdq_print(item, "%s", tty_term_describe(term, i));
@@ -70,6 +78,66 @@ cmd_show_messages_terminals(struct cmd *self, struct cmdq_item *item, int blank)
 	return (n != 0);
 }
 
+static int
+cmd_show_messages_memory(struct cmdq_item *item, int blank)
+{
+	struct window_pane		*wp;
+	struct window_pane_memory	 wpm;
+	struct format_tree		*ft;
+	size_t				 total = 0;
+	char				*s;
+
+	if (blank)
+		cmdq_print(item, "%s", "");
+	RB_FOREACH(wp, window_pane_tree, &all_window_panes) {
+		ft = format_create(NULL, item, FORMAT_NONE, 0);
+		format_defaults(ft, NULL, NULL, NULL, wp);
+		s = format_expand(ft, SHOW_MESSAGES_MEMORY_TEMPLATE);
+		cmdq_print(item, "%s", s);
+		free(s);
+		format_free(ft);
+
+		window_pane_memory(wp, &wpm);
+		total += wpm.total;
+	}
+	cmdq_print(item, "Total: %zu bytes in panes, %zu bytes in UTF-8 table",
+	    total, utf8_table_size());
+	return (1);
+}
+
+static int
+cmd_show_messages_timings(struct cmd *self, struct cmdq_item *item, int blank)
+{
+	struct args		*args = cmd_get_args(self);
+	struct client		*tc = cmdq_get_target_client(item);
+	struct client		*c;
+	struct client_timing	*ct;
+	u_int			 i, n = 0;
+
+	TAILQ_FOREACH(c, &clients, entry) {
+		if (c->session == NULL || (c->flags & CLIENT_CONTROL))
+			continue;
+		if (args_has(args, 't') && c != tc)
+			continue;
+		if (blank) {
+			cmdq_print(item, "%s", "");
+			blank = 0;
+		}
+		cmdq_print(item, "Client %s:", c->name);
+		for (i = 0; i < CLIENT_TIMING_TYPES; i++) {
+			ct = &c->timings[i];
+			cmdq_print(item, "  %s: %u samples, last %u us, "
+			    "p50 %u us, p90 %u us, p99 %u us",
+			    server_client_timing_name(i), ct->count, ct->last,
+			    server_client_get_timing(c, i, 50),
+			    server_client_get_timing(c, i, 90),
+			    server_client_get_timing(c, i, 99));
+		}
+		n++;
+	}
+	return (n != 0);
+}
+
 static enum cmd_retval
 cmd_show_messages_exec(struct cmd *self, struct cmdq_item *item)
 {
@@ -80,6 +148,10 @@ cmd_show_messages_exec(struct cmd *self, struct cmdq_item *item)
 	struct format_tree	*ft;
 
 	done = blank = 0;
+	if (args_has(args, 'C')) {
+		blank = cfg_print_timings(item, blank);
+		done = 1;
+	}
 	if (args_has(args, 'T')) {
 		blank = cmd_show_messages_terminals(self, item, blank);
 		done = 1;
@@ -88,6 +160,18 @@ cmd_show_messages_exec(struct cmd *self, struct cmdq_item *item)
 		job_print_summary(item, blank);
 		done = 1;
 	}
+	if (args_has(args, 'M')) {
+		blank = cmd_show_messages_memory(item, blank);
+		done = 1;
+	}
+	if (args_has(args, 'P')) {
+		blank = format_print_profile(item, blank);
+		done = 1;
+	}
+	if (args_has(args, 'R')) {
+		blank = cmd_show_messages_timings(self, item, blank);
+		done = 1;
+	}
 	if (done)
 		return (CMD_RETURN_NORMAL);
 
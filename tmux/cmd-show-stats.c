@@ -0,0 +1,178 @@
+/* $OpenBSD$ */
+
+/*
+ * Copyright (c) 2021 The tmux authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER
+ * IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tmux.h"
+
+/*
+ * Show server statistics as a single line of JSON.
+ */
+
+static enum cmd_retval	cmd_show_stats_exec(struct cmd *, struct cmdq_item *);
+
+const struct cmd_entry cmd_show_stats_entry = {
+	.name = "show-stats",
+	.alias = NULL,
+
+	.args = { "", 0, 0 },
+	.usage = "",
+
+	.flags = CMD_AFTERHOOK,
+	.exec = cmd_show_stats_exec
+};
+
+static void
+cmd_show_stats_string(struct evbuffer *evb, const char *s)
+{
+	evbuffer_add(evb, "\"", 1);
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			evbuffer_add_printf(evb, "\\%c", *s);
+		else if ((u_char)*s < 0x20)
+			evbuffer_add_printf(evb, "\\u%04x", (u_char)*s);
+		else
+			evbuffer_add(evb, s, 1);
+	}
+	evbuffer_add(evb, "\"", 1);
+}
+
+static void
+cmd_show_stats_server(struct evbuffer *evb)
+{
+	struct timeval	tv;
+	u_int		i;
+
+	gettimeofday(&tv, NULL);
+	timersub(&tv, &start_time, &tv);
+	evbuffer_add_printf(evb, "\"uptime\":%lld,", (long long)tv.tv_sec);
+
+	evbuffer_add_printf(evb, "\"loops\":%llu,\"loop_time\":%llu,",
+	    (unsigned long long)server_stats.loops,
+	    (unsigned long long)server_stats.loop_time);
+	evbuffer_add_printf(evb, "\"loop_buckets\":[");
+	for (i = 0; i < SERVER_STATS_BUCKETS; i++) {
+		evbuffer_add_printf(evb, "%s%llu", i == 0 ? "" : ",",
+		    (unsigned long long)server_stats.loop_buckets[i]);
+	}
+	evbuffer_add_printf(evb, "],");
+
+	evbuffer_add_printf(evb, "\"grid_lines\":%llu,\"formats\":%llu,"
+	    "\"jobs\":%llu,", (unsigned long long)server_stats.grid_lines,
+	    (unsigned long long)server_stats.formats,
+	    (unsigned long long)server_stats.jobs);
+}
+
+static void
+cmd_show_stats_allocations(struct evbuffer *evb)
+{
+	u_int	i;
+
+	evbuffer_add_printf(evb, "\"allocations\":{");
+	for (i = 0; i < XMALLOC_TAGS; i++) {
+		evbuffer_add_printf(evb, "%s\"%s\":{\"calls\":%lu,"
+		    "\"bytes\":%lu}", i == 0 ? "" : ",", xmalloc_tag_names[i],
+		    xmalloc_stats[i].calls, xmalloc_stats[i].bytes);
+	}
+	evbuffer_add_printf(evb, "},");
+}
+
+static void
+cmd_show_stats_commands(struct evbuffer *evb)
+{
+	const struct cmd_entry	**entryp;
+	uint64_t		  n;
+	int			  first = 1;
+
+	evbuffer_add_printf(evb, "\"commands\":{");
+	for (entryp = cmd_table; *entryp != NULL; entryp++) {
+		n = cmd_get_executed(*entryp);
+		if (n == 0)
+			continue;
+		evbuffer_add_printf(evb, "%s\"%s\":%llu", first ? "" : ",",
+		    (*entryp)->name, (unsigned long long)n);
+		first = 0;
+	}
+	evbuffer_add_printf(evb, "},");
+}
+
+static void
+cmd_show_stats_panes(struct evbuffer *evb)
+{
+	struct window_pane	*wp;
+	int			 first = 1;
+
+	evbuffer_add_printf(evb, "\"panes\":[");
+	RB_FOREACH(wp, window_pane_tree, &all_window_panes) {
+		evbuffer_add_printf(evb, "%s{\"id\":\"%%%u\",\"reads\":%zu,"
+		    "\"read_bytes\":%zu,\"parsed_bytes\":%zu,"
+		    "\"history_lines\":%u}", first ? "" : ",", wp->id,
+		    wp->reads, wp->read_bytes, wp->parsed_bytes,
+		    wp->base.grid->hsize);
+		first = 0;
+	}
+	evbuffer_add_printf(evb, "],");
+}
+
+static void
+cmd_show_stats_clients(struct evbuffer *evb)
+{
+	struct client	*c;
+	int		 first = 1;
+
+	evbuffer_add_printf(evb, "\"clients\":[");
+	TAILQ_FOREACH(c, &clients, entry) {
+		if (c->session == NULL)
+			continue;
+		evbuffer_add_printf(evb, "%s{\"name\":", first ? "" : ",");
+		cmd_show_stats_string(evb, c->name);
+		evbuffer_add_printf(evb, ",\"written\":%zu,\"discarded\":%zu,"
+		    "\"redraws\":%llu,\"dropped_frames\":%u}", c->written,
+		    c->discarded, (unsigned long long)c->redraws,
+		    c->dropped_frames);
+		first = 0;
+	}
+	evbuffer_add_printf(evb, "]");
+}
+
+static enum cmd_retval
+cmd_show_stats_exec(__unused struct cmd *self, struct cmdq_item *item)
+{
+	struct evbuffer	*evb;
+
+	evb = evbuffer_new();
+	if (evb == NULL)
+		fatalx("out of memory");
+
+	evbuffer_add(evb, "{", 1);
+	cmd_show_stats_server(evb);
+	cmd_show_stats_allocations(evb);
+	cmd_show_stats_commands(evb);
+	cmd_show_stats_panes(evb);
+	cmd_show_stats_clients(evb);
+	evbuffer_add(evb, "}", 1);
+
+	cmdq_print(item, "%.*s", (int)EVBUFFER_LENGTH(evb),
+	    (const char *)EVBUFFER_DATA(evb));
+	evbuffer_free(evb);
+	return (CMD_RETURN_NORMAL);
+}
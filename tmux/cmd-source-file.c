@@ -38,7 +38,7 @@ const struct cmd_entry cmd_source_file_entry = {
 	.args = { "Fnqv", 1, -1 },
 	.usage = "[-Fnqv] path ...",
 
-	.flags = 0,
+	.flags = CMD_CLIENTENV,
 	.exec = cmd_source_file_exec
 };
 
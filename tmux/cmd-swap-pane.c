@@ -112,6 +112,10 @@ cmd_swap_pane_exec(struct cmd *self, struct cmdq_item *item)
 	window_pane_resize(src_wp, dst_wp->sx, dst_wp->sy);
 	dst_wp->xoff = xoff; dst_wp->yoff = yoff;
 	window_pane_resize(dst_wp, sx, sy);
+	screen_redraw_free_borders(src_w);
+	screen_redraw_free_borders(dst_w);
+	src_w->layout_generation++;
+	dst_w->layout_generation++;
 
 	if (!args_has(args, 'd')) {
 		if (src_w != dst_w) {
@@ -76,6 +76,7 @@ cmd_swap_window_exec(struct cmd *self, struct cmdq_item *item)
 	TAILQ_INSERT_TAIL(&w_src->winlinks, wl_dst, wentry);
 	wl_src->window = w_dst;
 	TAILQ_INSERT_TAIL(&w_dst->winlinks, wl_src, wentry);
+	format_lists_changed();
 
 	if (args_has(args, 'd')) {
 		session_select(dst, wl_dst->idx);
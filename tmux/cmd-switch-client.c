@@ -40,7 +40,7 @@ const struct cmd_entry cmd_switch_client_entry = {
 
 	/* -t is special */
 
-	.flags = CMD_READONLY|CMD_CLIENT_CFLAG,
+	.flags = CMD_READONLY|CMD_CLIENT_CFLAG|CMD_CLIENTENV,
 	.exec = cmd_switch_client_exec
 };
 
@@ -0,0 +1,83 @@
+/* $OpenBSD$ */
+
+/*
+ * Copyright (c) 2021 The tmux authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER
+ * IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tmux.h"
+
+/*
+ * Start, stop or show the trace buffer.
+ */
+
+static enum cmd_retval	cmd_trace_exec(struct cmd *, struct cmdq_item *);
+
+const struct cmd_entry cmd_trace_entry = {
+	.name = "trace",
+	.alias = NULL,
+
+	.args = { "n:s:", 1, 1 },
+	.usage = "[-n records] [-s subsystems] start|stop|show",
+
+	.flags = CMD_AFTERHOOK,
+	.exec = cmd_trace_exec
+};
+
+static enum cmd_retval
+cmd_trace_exec(struct cmd *self, struct cmdq_item *item)
+{
+	struct args	*args = cmd_get_args(self);
+	const char	*action = args->argv[0];
+	u_int		 mask, size;
+	char		*cause;
+
+	if (strcmp(action, "start") == 0) {
+		if (args_has(args, 'n')) {
+			size = args_strtonum(args, 'n', 1024, 16777216,
+			    &cause);
+			if (cause != NULL) {
+				cmdq_error(item, "records %s", cause);
+				free(cause);
+				return (CMD_RETURN_ERROR);
+			}
+		} else
+			size = 65536;
+		if (!args_has(args, 's'))
+			mask = (1U << TRACE_SUBSYSTEMS) - 1;
+		else if (trace_parse_subsystems(args_get(args, 's'), &mask,
+		    &cause) != 0) {
+			cmdq_error(item, "%s", cause);
+			free(cause);
+			return (CMD_RETURN_ERROR);
+		}
+		trace_start(mask, size);
+		return (CMD_RETURN_NORMAL);
+	}
+	if (strcmp(action, "stop") == 0) {
+		trace_stop();
+		return (CMD_RETURN_NORMAL);
+	}
+	if (strcmp(action, "show") == 0) {
+		trace_print(item);
+		return (CMD_RETURN_NORMAL);
+	}
+	cmdq_error(item, "unknown action: %s", action);
+	return (CMD_RETURN_ERROR);
+}
@@ -25,6 +25,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#define XMALLOC_TAG XMALLOC_CMDQ
 #include "tmux.h"
 
 extern const struct cmd_entry cmd_attach_session_entry;
@@ -46,7 +47,9 @@ extern const struct cmd_entry cmd_display_menu_entry;
 extern const struct cmd_entry cmd_display_message_entry;
 extern const struct cmd_entry cmd_display_popup_entry;
 extern const struct cmd_entry cmd_display_panes_entry;
+extern const struct cmd_entry cmd_exec_server_entry;
 extern const struct cmd_entry cmd_down_pane_entry;
+extern const struct cmd_entry cmd_find_text_entry;
 extern const struct cmd_entry cmd_find_window_entry;
 extern const struct cmd_entry cmd_has_session_entry;
 extern const struct cmd_entry cmd_if_shell_entry;
@@ -60,6 +63,7 @@ extern const struct cmd_entry cmd_last_window_entry;
 extern const struct cmd_entry cmd_link_window_entry;
 extern const struct cmd_entry cmd_list_buffers_entry;
 extern const struct cmd_entry cmd_list_clients_entry;
+extern const struct cmd_entry cmd_list_jobs_entry;
 extern const struct cmd_entry cmd_list_commands_entry;
 extern const struct cmd_entry cmd_list_keys_entry;
 extern const struct cmd_entry cmd_list_panes_entry;
@@ -86,9 +90,12 @@ extern const struct cmd_entry cmd_resize_pane_entry;
 extern const struct cmd_entry cmd_resize_window_entry;
 extern const struct cmd_entry cmd_respawn_pane_entry;
 extern const struct cmd_entry cmd_respawn_window_entry;
+extern const struct cmd_entry cmd_restore_server_entry;
 extern const struct cmd_entry cmd_rotate_window_entry;
 extern const struct cmd_entry cmd_run_shell_entry;
 extern const struct cmd_entry cmd_save_buffer_entry;
+extern const struct cmd_entry cmd_save_server_entry;
+extern const struct cmd_entry cmd_search_pane_entry;
 extern const struct cmd_entry cmd_select_layout_entry;
 extern const struct cmd_entry cmd_select_pane_entry;
 extern const struct cmd_entry cmd_select_window_entry;
@@ -104,6 +111,7 @@ extern const struct cmd_entry cmd_show_environment_entry;
 extern const struct cmd_entry cmd_show_hooks_entry;
 extern const struct cmd_entry cmd_show_messages_entry;
 extern const struct cmd_entry cmd_show_options_entry;
+extern const struct cmd_entry cmd_show_stats_entry;
 extern const struct cmd_entry cmd_show_window_options_entry;
 extern const struct cmd_entry cmd_source_file_entry;
 extern const struct cmd_entry cmd_split_window_entry;
@@ -112,6 +120,7 @@ extern const struct cmd_entry cmd_suspend_client_entry;
 extern const struct cmd_entry cmd_swap_pane_entry;
 extern const struct cmd_entry cmd_swap_window_entry;
 extern const struct cmd_entry cmd_switch_client_entry;
+extern const struct cmd_entry cmd_trace_entry;
 extern const struct cmd_entry cmd_unbind_key_entry;
 extern const struct cmd_entry cmd_unlink_window_entry;
 extern const struct cmd_entry cmd_up_pane_entry;
@@ -137,6 +146,8 @@ const struct cmd_entry *cmd_table[] = {
 	&cmd_display_message_entry,
 	&cmd_display_popup_entry,
 	&cmd_display_panes_entry,
+	&cmd_exec_server_entry,
+	&cmd_find_text_entry,
 	&cmd_find_window_entry,
 	&cmd_has_session_entry,
 	&cmd_if_shell_entry,
@@ -150,6 +161,7 @@ const struct cmd_entry *cmd_table[] = {
 	&cmd_link_window_entry,
 	&cmd_list_buffers_entry,
 	&cmd_list_clients_entry,
+	&cmd_list_jobs_entry,
 	&cmd_list_commands_entry,
 	&cmd_list_keys_entry,
 	&cmd_list_panes_entry,
@@ -176,9 +188,12 @@ const struct cmd_entry *cmd_table[] = {
 	&cmd_resize_window_entry,
 	&cmd_respawn_pane_entry,
 	&cmd_respawn_window_entry,
+	&cmd_restore_server_entry,
 	&cmd_rotate_window_entry,
 	&cmd_run_shell_entry,
 	&cmd_save_buffer_entry,
+	&cmd_save_server_entry,
+	&cmd_search_pane_entry,
 	&cmd_select_layout_entry,
 	&cmd_select_pane_entry,
 	&cmd_select_window_entry,
@@ -194,6 +209,7 @@ const struct cmd_entry *cmd_table[] = {
 	&cmd_show_hooks_entry,
 	&cmd_show_messages_entry,
 	&cmd_show_options_entry,
+	&cmd_show_stats_entry,
 	&cmd_show_window_options_entry,
 	&cmd_source_file_entry,
 	&cmd_split_window_entry,
@@ -202,12 +218,16 @@ const struct cmd_entry *cmd_table[] = {
 	&cmd_swap_pane_entry,
 	&cmd_swap_window_entry,
 	&cmd_switch_client_entry,
+	&cmd_trace_entry,
 	&cmd_unbind_key_entry,
 	&cmd_unlink_window_entry,
 	&cmd_wait_for_entry,
 	NULL
 };
 
+/* Number of times each command in the table has been executed. */
+static uint64_t cmd_executed[nitems(cmd_table)];
+
 /* Instance of a command. */
 struct cmd {
 	const struct cmd_entry	 *entry;
@@ -388,6 +408,33 @@ cmd_get_entry(struct cmd *cmd)
 	return (cmd->entry);
 }
 
+/* Count a command being executed. */
+void
+cmd_add_executed(const struct cmd_entry *entry)
+{
+	u_int	i;
+
+	for (i = 0; cmd_table[i] != NULL; i++) {
+		if (cmd_table[i] == entry) {
+			cmd_executed[i]++;
+			break;
+		}
+	}
+}
+
+/* Get the number of times a command has been executed. */
+uint64_t
+cmd_get_executed(const struct cmd_entry *entry)
+{
+	u_int	i;
+
+	for (i = 0; cmd_table[i] != NULL; i++) {
+		if (cmd_table[i] == entry)
+			return (cmd_executed[i]);
+	}
+	return (0);
+}
+
 /* Get arguments for command. */
 struct args *
 cmd_get_args(struct cmd *cmd)
@@ -624,32 +671,38 @@ cmd_list_print(struct cmd_list *cmdlist, int escaped)
 {
 	struct cmd	*cmd, *next;
 	char		*buf, *this;
-	size_t		 len;
+	const char	*separator;
+	size_t		 len, off, thislen;
 
 	len = 1;
 	buf = xcalloc(1, len);
+	off = 0;
 
 	TAILQ_FOREACH(cmd, cmdlist->list, qentry) {
 		this = cmd_print(cmd);
+		thislen = strlen(this);
 
-		len += strlen(this) + 6;
+		len += thislen + 6;
 		buf = xrealloc(buf, len);
 
-		strlcat(buf, this, len);
+		/* Append at the end rather than rescanning the whole buffer. */
+		memcpy(buf + off, this, thislen + 1);
+		off += thislen;
 
 		next = TAILQ_NEXT(cmd, qentry);
 		if (next != NULL) {
 			if (cmd->group != next->group) {
 				if (escaped)
-					strlcat(buf, " \\;\\; ", len);
+					separator = " \\;\\; ";
 				else
-					strlcat(buf, " ;; ", len);
+					separator = " ;; ";
 			} else {
 				if (escaped)
-					strlcat(buf, " \\; ", len);
+					separator = " \\; ";
 				else
-					strlcat(buf, " ; ", len);
+					separator = " ; ";
 			}
+			off += strlcpy(buf + off, separator, len - off);
 		}
 
 		free(this);
@@ -26,6 +26,18 @@
 
 #include "tmux.h"
 
+/*
+ * Cache of colours converted by colour_find_rgb, indexed by a hash of the RGB
+ * colour. The same few colours are usually converted again for every cell
+ * drawn to any terminal without RGB support. An entry with a zero colour is
+ * empty.
+ */
+#define COLOUR_RGB_CACHE_SIZE 1024
+static struct {
+	int	rgb;
+	int	colour;
+} colour_rgb_cache[COLOUR_RGB_CACHE_SIZE];
+
 static int
 colour_dist_sq(int R, int G, int B, int r, int g, int b)
 {
@@ -54,8 +66,8 @@ colour_to_6cube(int v)
  * (95), 0x87 (135), 0xaf (175), 0xd7 (215) and 0xff (255). Greys are more
  * evenly spread (8, 18, 28 ... 238).
  */
-int
-colour_find_rgb(u_char r, u_char g, u_char b)
+static int
+colour_find_rgb1(u_char r, u_char g, u_char b)
 {
 	static const int	q2c[6] = { 0x00, 0x5f, 0x87, 0xaf, 0xd7, 0xff };
 	int			qr, qg, qb, cr, cg, cb, d, idx;
@@ -87,6 +99,22 @@ colour_find_rgb(u_char r, u_char g, u_char b)
 	return (idx | COLOUR_FLAG_256);
 }
 
+/* Convert an RGB triplet to the 256 colour palette, using the cache. */
+int
+colour_find_rgb(u_char r, u_char g, u_char b)
+{
+	int	rgb = (r << 16)|(g << 8)|b;
+	u_int	idx;
+
+	idx = (rgb ^ (rgb >> 10) ^ (rgb >> 20)) % COLOUR_RGB_CACHE_SIZE;
+	if (colour_rgb_cache[idx].colour == 0 ||
+	    colour_rgb_cache[idx].rgb != rgb) {
+		colour_rgb_cache[idx].rgb = rgb;
+		colour_rgb_cache[idx].colour = colour_find_rgb1(r, g, b);
+	}
+	return (colour_rgb_cache[idx].colour);
+}
+
 /* Join RGB into a colour. */
 int
 colour_join_rgb(u_char r, u_char g, u_char b)
@@ -453,7 +453,7 @@ int		 utf8proc_mbtowc(wchar_t *, const char *, size_t);
 int		 utf8proc_wctomb(char *, wchar_t);
 #endif
 
-#ifdef NEED_FUZZING
+#if defined(NEED_FUZZING) || defined(NEED_BENCH)
 /* tmux.c */
 #define main __weak main
 #endif
@@ -21,13 +21,88 @@
 
 #include <stdlib.h>
 
+#define XMALLOC_TAG XMALLOC_CONTROL
 #include "tmux.h"
 
 #define CONTROL_SHOULD_NOTIFY_CLIENT(c) \
-	((c) != NULL && ((c)->flags & CLIENT_CONTROL))
+	((c) != NULL && ((c)->flags & CLIENT_CONTROL) && \
+	 (~(c)->flags & CLIENT_CONTROL_PIPE))
 
-void
-control_notify_pane_mode_changed(int pane)
+/*
+ * Notifications which only report the current state of an object are not
+ * written straight away but collected until the command queue is empty, so a
+ * burst of changes to one object produces one line with its final state.
+ * They are written in the order each object and type was first seen.
+ */
+enum control_notify_type {
+	CONTROL_NOTIFY_PANE_MODE,
+	CONTROL_NOTIFY_WINDOW_LAYOUT,
+	CONTROL_NOTIFY_WINDOW_PANE,
+	CONTROL_NOTIFY_WINDOW_RENAMED,
+	CONTROL_NOTIFY_SESSION_RENAMED,
+	CONTROL_NOTIFY_SESSION_WINDOW
+};
+struct control_notify_pending {
+	enum control_notify_type		 type;
+	u_int					 id;
+
+	RB_ENTRY(control_notify_pending)	 entry;
+	TAILQ_ENTRY(control_notify_pending)	 qentry;
+};
+RB_HEAD(control_notify_tree, control_notify_pending);
+TAILQ_HEAD(control_notify_queue, control_notify_pending);
+
+static int
+control_notify_cmp(struct control_notify_pending *cnp1,
+    struct control_notify_pending *cnp2)
+{
+	if (cnp1->type < cnp2->type)
+		return (-1);
+	if (cnp1->type > cnp2->type)
+		return (1);
+	if (cnp1->id < cnp2->id)
+		return (-1);
+	if (cnp1->id > cnp2->id)
+		return (1);
+	return (0);
+}
+RB_GENERATE_STATIC(control_notify_tree, control_notify_pending, entry,
+    control_notify_cmp);
+
+static struct control_notify_tree control_notify_pending_tree =
+    RB_INITIALIZER(&control_notify_pending_tree);
+static struct control_notify_queue control_notify_pending_queue =
+    TAILQ_HEAD_INITIALIZER(control_notify_pending_queue);
+
+/* Add a notification to be written later unless it is already waiting. */
+static void
+control_notify_add(enum control_notify_type type, u_int id)
+{
+	struct control_notify_pending	 find, *cnp;
+	struct client			*c;
+
+	TAILQ_FOREACH(c, &clients, entry) {
+		if (CONTROL_SHOULD_NOTIFY_CLIENT(c))
+			break;
+	}
+	if (c == NULL)
+		return;
+
+	find.type = type;
+	find.id = id;
+	if (RB_FIND(control_notify_tree, &control_notify_pending_tree,
+	    &find) != NULL)
+		return;
+
+	cnp = xmalloc(sizeof *cnp);
+	cnp->type = type;
+	cnp->id = id;
+	RB_INSERT(control_notify_tree, &control_notify_pending_tree, cnp);
+	TAILQ_INSERT_TAIL(&control_notify_pending_queue, cnp, qentry);
+}
+
+static void
+control_notify_write_pane_mode_changed(u_int pane)
 {
 	struct client	*c;
 
@@ -39,8 +114,8 @@ control_notify_pane_mode_changed(int pane)
 	}
 }
 
-void
-control_notify_window_layout_changed(struct window *w)
+static void
+control_notify_write_window_layout_changed(struct window *w)
 {
 	struct client	*c;
 	struct session	*s;
@@ -76,8 +151,8 @@ control_notify_window_layout_changed(struct window *w)
 	}
 }
 
-void
-control_notify_window_pane_changed(struct window *w)
+static void
+control_notify_write_window_pane_changed(struct window *w)
 {
 	struct client	*c;
 
@@ -126,8 +201,8 @@ control_notify_window_linked(__unused struct session *s, struct window *w)
 	}
 }
 
-void
-control_notify_window_renamed(struct window *w)
+static void
+control_notify_write_window_renamed(struct window *w)
 {
 	struct client	*c;
 	struct session	*cs;
@@ -182,8 +257,8 @@ control_notify_client_detached(struct client *cc)
 	}
 }
 
-void
-control_notify_session_renamed(struct session *s)
+static void
+control_notify_write_session_renamed(struct session *s)
 {
 	struct client	*c;
 
@@ -221,8 +296,8 @@ control_notify_session_closed(__unused struct session *s)
 	}
 }
 
-void
-control_notify_session_window_changed(struct session *s)
+static void
+control_notify_write_session_window_changed(struct session *s)
 {
 	struct client	*c;
 
@@ -234,3 +309,85 @@ control_notify_session_window_changed(struct session *s)
 		    s->curw->window->id);
 	}
 }
+
+void
+control_notify_pane_mode_changed(int pane)
+{
+	control_notify_add(CONTROL_NOTIFY_PANE_MODE, pane);
+}
+
+void
+control_notify_window_layout_changed(struct window *w)
+{
+	control_notify_add(CONTROL_NOTIFY_WINDOW_LAYOUT, w->id);
+}
+
+void
+control_notify_window_pane_changed(struct window *w)
+{
+	control_notify_add(CONTROL_NOTIFY_WINDOW_PANE, w->id);
+}
+
+void
+control_notify_window_renamed(struct window *w)
+{
+	control_notify_add(CONTROL_NOTIFY_WINDOW_RENAMED, w->id);
+}
+
+void
+control_notify_session_renamed(struct session *s)
+{
+	control_notify_add(CONTROL_NOTIFY_SESSION_RENAMED, s->id);
+}
+
+void
+control_notify_session_window_changed(struct session *s)
+{
+	control_notify_add(CONTROL_NOTIFY_SESSION_WINDOW, s->id);
+}
+
+/*
+ * Write waiting notifications. Objects are looked up again by ID because they
+ * may have changed or gone away since the notification was added.
+ */
+void
+control_notify_flush(void)
+{
+	struct control_notify_pending	*cnp, *cnp1;
+	struct window			*w;
+	struct session			*s;
+
+	TAILQ_FOREACH_SAFE(cnp, &control_notify_pending_queue, qentry, cnp1) {
+		switch (cnp->type) {
+		case CONTROL_NOTIFY_PANE_MODE:
+			control_notify_write_pane_mode_changed(cnp->id);
+			break;
+		case CONTROL_NOTIFY_WINDOW_LAYOUT:
+			if ((w = window_find_by_id(cnp->id)) != NULL)
+				control_notify_write_window_layout_changed(w);
+			break;
+		case CONTROL_NOTIFY_WINDOW_PANE:
+			w = window_find_by_id(cnp->id);
+			if (w != NULL && w->active != NULL)
+				control_notify_write_window_pane_changed(w);
+			break;
+		case CONTROL_NOTIFY_WINDOW_RENAMED:
+			if ((w = window_find_by_id(cnp->id)) != NULL)
+				control_notify_write_window_renamed(w);
+			break;
+		case CONTROL_NOTIFY_SESSION_RENAMED:
+			if ((s = session_find_by_id(cnp->id)) != NULL)
+				control_notify_write_session_renamed(s);
+			break;
+		case CONTROL_NOTIFY_SESSION_WINDOW:
+			s = session_find_by_id(cnp->id);
+			if (s != NULL && s->curw != NULL)
+				control_notify_write_session_window_changed(s);
+			break;
+		}
+		RB_REMOVE(control_notify_tree, &control_notify_pending_tree,
+		    cnp);
+		TAILQ_REMOVE(&control_notify_pending_queue, cnp, qentry);
+		free(cnp);
+	}
+}
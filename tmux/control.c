@@ -23,7 +23,11 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
+#define XMALLOC_TAG XMALLOC_CONTROL
 #include "tmux.h"
 
 /*
@@ -50,6 +54,46 @@ struct control_block {
 	TAILQ_ENTRY(control_block)	 all_entry;
 };
 
+/*
+ * Escaped pane output shared by all text control clients. Each chunk holds
+ * the escaped form of size bytes of pane output starting at offset start.
+ * Chunks are kept until the pane has discarded the data they cover, so
+ * clients reading the same pane reuse them instead of each escaping it.
+ */
+struct control_chunk {
+	u_int				 pane;
+	size_t				 start;
+	size_t				 size;
+
+	char				*data;
+	size_t				 length;
+
+	RB_ENTRY(control_chunk)		 entry;
+};
+RB_HEAD(control_chunks, control_chunk);
+static struct control_chunks control_chunks =
+    RB_INITIALIZER(&control_chunks);
+
+/*
+ * Batch of commands sent between %batch and %endbatch. The commands are run
+ * as usual but share one %begin and one %end or %error.
+ */
+struct control_batch {
+	int				 started;
+	long				 t;
+	u_int				 number;
+	int				 error;
+
+	TAILQ_ENTRY(control_batch)	 entry;
+};
+
+/* Bytes in pane output which are escaped as \xxx. */
+static const u_char control_escape_table[256] = {
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	['\\'] = 1
+};
+
 /* Control client pane. */
 struct control_pane {
 	u_int				 pane;
@@ -65,10 +109,30 @@ struct control_pane {
 	int				 flags;
 #define CONTROL_PANE_OFF 0x1
 #define CONTROL_PANE_PAUSED 0x2
+#define CONTROL_PANE_CREDIT 0x4
+#define CONTROL_PANE_LINES 0x8
+
+	/* Bytes the client will accept if using credit. */
+	size_t				 credit;
+
+	/* Statistics. */
+	uint64_t			 written;
+	u_int				 pauses;
+
+	/* Lines and cursor last sent if sending line changes. */
+	char				**lines;
+	u_int				 nlines;
+	u_int				 cx;
+	u_int				 cy;
 
 	int				 pending_flag;
 	TAILQ_ENTRY(control_pane)	 pending_entry;
 
+	/* Position in the last chunk used, to avoid searching it again. */
+	size_t				 chunk_start;
+	size_t				 chunk_used;
+	size_t				 chunk_offset;
+
 	TAILQ_HEAD(, control_block)	 blocks;
 
 	RB_ENTRY(control_pane)		 entry;
@@ -80,6 +144,7 @@ struct control_sub_pane {
 	u_int				 pane;
 	u_int				 idx;
 	char				*last;
+	struct format_cache		*cache;
 
 	RB_ENTRY(control_sub_pane)	 entry;
 };
@@ -90,6 +155,7 @@ struct control_sub_window {
 	u_int				 window;
 	u_int				 idx;
 	char				*last;
+	struct format_cache		*cache;
 
 	RB_ENTRY(control_sub_window)	 entry;
 };
@@ -103,7 +169,11 @@ struct control_sub {
 	enum control_sub_type		 type;
 	u_int				 id;
 
+	u_int				 interval;
+	uint64_t			 next;
+
 	char				*last;
+	struct format_cache		*cache;
 	struct control_sub_panes	 panes;
 	struct control_sub_windows	 windows;
 
@@ -125,23 +195,65 @@ struct control_state {
 
 	struct control_subs		 subs;
 	struct event			 subs_timer;
+	int				 subs_batch;
+
+	TAILQ_HEAD(, control_batch)	 batches;
+	struct control_batch		*batch;
+	struct control_batch		*running_batch;
+
+	/* Statistics. */
+	uint64_t			 written;
+	u_int				 pauses;
+	uint64_t			 stall_start;
+	uint64_t			 stall_time;
+
+#ifdef HAVE_ZLIB
+	z_stream			*zstream;
+#endif
 };
 
 /* Low and high watermarks. */
 #define CONTROL_BUFFER_LOW 512
 #define CONTROL_BUFFER_HIGH 8192
 
+/* Maximum pane output in a shared chunk. */
+#define CONTROL_CHUNK_SIZE 16384
+
 /* Minimum to write to each client. */
 #define CONTROL_WRITE_MINIMUM 32
 
 /* Maximum age for clients that are not using pause mode. */
 #define CONTROL_MAXIMUM_AGE 300000
 
+/*
+ * Binary frame header: type, pane ID, age in milliseconds and payload length,
+ * each of the last three as four bytes in network byte order.
+ */
+#define CONTROL_FRAME_HEADER 13
+#define CONTROL_FRAME_LINE 'L'
+#define CONTROL_FRAME_OUTPUT 'O'
+
 /* Flags to ignore client. */
 #define CONTROL_IGNORE_FLAGS \
 	(CLIENT_CONTROL_NOOUTPUT| \
 	 CLIENT_UNATTACHEDFLAGS)
 
+/* Compare chunks. */
+static int
+control_chunk_cmp(struct control_chunk *cc1, struct control_chunk *cc2)
+{
+	if (cc1->pane < cc2->pane)
+		return (-1);
+	if (cc1->pane > cc2->pane)
+		return (1);
+	if (cc1->start < cc2->start)
+		return (-1);
+	if (cc1->start > cc2->start)
+		return (1);
+	return (0);
+}
+RB_GENERATE_STATIC(control_chunks, control_chunk, entry, control_chunk_cmp);
+
 /* Compare client panes. */
 static int
 control_pane_cmp(struct control_pane *cp1, struct control_pane *cp2)
@@ -207,12 +319,17 @@ control_free_sub(struct control_state *cs, struct control_sub *csub)
 
 	RB_FOREACH_SAFE(csp, control_sub_panes, &csub->panes, csp1) {
 		RB_REMOVE(control_sub_panes, &csub->panes, csp);
+		format_free_cache(csp->cache);
+		free(csp->last);
 		free(csp);
 	}
 	RB_FOREACH_SAFE(csw, control_sub_windows, &csub->windows, csw1) {
 		RB_REMOVE(control_sub_windows, &csub->windows, csw);
+		format_free_cache(csw->cache);
+		free(csw->last);
 		free(csw);
 	}
+	format_free_cache(csub->cache);
 	free(csub->last);
 
 	RB_REMOVE(control_subs, &cs->subs, csub);
@@ -258,6 +375,7 @@ control_add_pane(struct client *c, struct window_pane *wp)
 	memcpy(&cp->offset, &wp->offset, sizeof cp->offset);
 	memcpy(&cp->queued, &wp->offset, sizeof cp->queued);
 	TAILQ_INIT(&cp->blocks);
+	cp->cx = cp->cy = UINT_MAX;
 
 	return (cp);
 }
@@ -290,6 +408,20 @@ control_window_pane(struct client *c, u_int pane)
 	return (wp);
 }
 
+/* Free the lines last sent for a pane. */
+static void
+control_free_lines(struct control_pane *cp)
+{
+	u_int	i;
+
+	for (i = 0; i < cp->nlines; i++)
+		free(cp->lines[i]);
+	free(cp->lines);
+	cp->lines = NULL;
+	cp->nlines = 0;
+	cp->cx = cp->cy = UINT_MAX;
+}
+
 /* Reset control offsets. */
 void
 control_reset_offsets(struct client *c)
@@ -299,6 +431,7 @@ control_reset_offsets(struct client *c)
 
 	RB_FOREACH_SAFE(cp, control_panes, &cs->panes, cp1) {
 		RB_REMOVE(control_panes, &cs->panes, cp);
+		control_free_lines(cp);
 		free(cp);
 	}
 
@@ -328,6 +461,9 @@ control_pane_offset(struct client *c, struct window_pane *wp, int *off)
 		return (NULL);
 	}
 	*off = (EVBUFFER_LENGTH(cs->write_event->output) >= CONTROL_BUFFER_LOW);
+	if ((cp->flags & CONTROL_PANE_CREDIT) &&
+	    cp->queued.used - cp->offset.used >= cp->credit)
+		*off = 1;
 	return (&cp->offset);
 }
 
@@ -370,6 +506,223 @@ control_continue_pane(struct client *c, struct window_pane *wp)
 	}
 }
 
+/*
+ * Queue a single block for all output from a pane not yet written, so it is
+ * written once the pane has credit again.
+ */
+static void
+control_requeue_pane(struct client *c, struct control_pane *cp)
+{
+	struct control_state	*cs = c->control_state;
+	struct control_block	*cb;
+
+	control_discard_pane(c, cp);
+	if (cp->queued.used == cp->offset.used)
+		return;
+
+	cb = xcalloc(1, sizeof *cb);
+	cb->size = cp->queued.used - cp->offset.used;
+	TAILQ_INSERT_TAIL(&cs->all_blocks, cb, all_entry);
+	cb->t = get_timer();
+	TAILQ_INSERT_TAIL(&cp->blocks, cb, entry);
+
+	if (!cp->pending_flag) {
+		TAILQ_INSERT_TAIL(&cs->pending_list, cp, pending_entry);
+		cp->pending_flag = 1;
+		cs->pending_count++;
+	}
+	bufferevent_enable(cs->write_event, EV_WRITE);
+}
+
+/* Give a pane credit for more output. */
+void
+control_add_pane_credit(struct client *c, struct window_pane *wp, size_t size)
+{
+	struct control_pane	*cp;
+
+	cp = control_add_pane(c, wp);
+	if (cp->flags & CONTROL_PANE_CREDIT) {
+		if (cp->credit > SIZE_MAX - size)
+			cp->credit = SIZE_MAX;
+		else
+			cp->credit += size;
+	} else {
+		cp->flags |= CONTROL_PANE_CREDIT;
+		cp->credit = size;
+	}
+	control_requeue_pane(c, cp);
+}
+
+/* Stop using credit for a pane. */
+void
+control_clear_pane_credit(struct client *c, struct window_pane *wp)
+{
+	struct control_pane	*cp;
+
+	cp = control_get_pane(c, wp);
+	if (cp != NULL && (cp->flags & CONTROL_PANE_CREDIT)) {
+		cp->flags &= ~CONTROL_PANE_CREDIT;
+		control_requeue_pane(c, cp);
+	}
+}
+
+/* Encode a line of a screen with its styles in #[] form. */
+static char *
+control_encode_line(struct screen *s, u_int y)
+{
+	struct grid		*gd = s->grid;
+	struct grid_cell	 gc, last;
+	struct evbuffer		*evb;
+	char			*line;
+	u_int			 x, end = 0, sx = screen_size_x(s);
+
+	for (x = 0; x < sx; x++) {
+		grid_view_get_cell(gd, x, y, &gc);
+		if (gc.data.size != 1 || *gc.data.data != ' ' ||
+		    gc.fg != 8 || gc.bg != 8 || gc.attr != 0)
+			end = x + 1;
+	}
+
+	evb = evbuffer_new();
+	if (evb == NULL)
+		fatalx("out of memory");
+	memcpy(&last, &grid_default_cell, sizeof last);
+	for (x = 0; x < end; x++) {
+		grid_view_get_cell(gd, x, y, &gc);
+		if (gc.flags & GRID_FLAG_PADDING)
+			continue;
+		if (gc.fg != last.fg || gc.bg != last.bg ||
+		    gc.attr != last.attr) {
+			evbuffer_add_printf(evb, "#[fg=%s,", colour_tostring(gc.fg));
+			evbuffer_add_printf(evb, "bg=%s,%s]", colour_tostring(gc.bg),
+			    attributes_tostring(gc.attr));
+			memcpy(&last, &gc, sizeof last);
+		}
+		if (gc.data.size == 1 && *gc.data.data == '#')
+			evbuffer_add(evb, "##", 2);
+		else
+			evbuffer_add(evb, gc.data.data, gc.data.size);
+	}
+	line = xstrndup(EVBUFFER_DATA(evb), EVBUFFER_LENGTH(evb));
+	evbuffer_free(evb);
+	return (line);
+}
+
+/* Send lines and the cursor of a pane which have changed since last sent. */
+void
+control_write_lines(struct client *c, struct window_pane *wp)
+{
+	struct control_pane	*cp;
+	struct screen		*s = &wp->base;
+	u_int			 sy = screen_size_y(s), y;
+	char			*line;
+
+	cp = control_get_pane(c, wp);
+	if (cp == NULL || (~cp->flags & CONTROL_PANE_LINES))
+		return;
+
+	if (cp->nlines != sy) {
+		for (y = sy; y < cp->nlines; y++)
+			free(cp->lines[y]);
+		cp->lines = xreallocarray(cp->lines, sy, sizeof *cp->lines);
+		for (y = cp->nlines; y < sy; y++)
+			cp->lines[y] = NULL;
+		cp->nlines = sy;
+	}
+
+	for (y = 0; y < sy; y++) {
+		line = control_encode_line(s, y);
+		if (cp->lines[y] != NULL && strcmp(line, cp->lines[y]) == 0) {
+			free(line);
+			continue;
+		}
+		control_write(c, "%%line-changed %%%u %u : %s", wp->id, y,
+		    line);
+		free(cp->lines[y]);
+		cp->lines[y] = line;
+	}
+
+	if (s->cx != cp->cx || s->cy != cp->cy) {
+		control_write(c, "%%cursor-changed %%%u %u %u", wp->id, s->cx,
+		    s->cy);
+		cp->cx = s->cx;
+		cp->cy = s->cy;
+	}
+}
+
+/* Start or stop sending line changes for a pane. */
+void
+control_set_pane_lines(struct client *c, struct window_pane *wp, int on)
+{
+	struct control_pane	*cp;
+
+	cp = control_add_pane(c, wp);
+	control_free_lines(cp);
+	if (on) {
+		cp->flags |= CONTROL_PANE_LINES;
+		control_write_lines(c, wp);
+	} else
+		cp->flags &= ~CONTROL_PANE_LINES;
+}
+
+/* Get a statistic for a client, or for one pane if wp is not NULL. */
+uint64_t
+control_get_stat(struct client *c, struct window_pane *wp,
+    enum control_stat_type type)
+{
+	struct control_state	*cs = c->control_state;
+	struct control_pane	*cp = NULL;
+	struct control_block	*cb;
+	uint64_t		 n = 0, t = get_timer();
+
+	if (wp != NULL && (cp = control_get_pane(c, wp)) == NULL)
+		return (0);
+
+	switch (type) {
+	case CONTROL_STAT_BACKLOG:
+		if (cp != NULL) {
+			TAILQ_FOREACH(cb, &cp->blocks, entry)
+				n += cb->size;
+		} else {
+			TAILQ_FOREACH(cb, &cs->all_blocks, all_entry)
+				n += cb->size;
+		}
+		break;
+	case CONTROL_STAT_AGE:
+		if (cp != NULL)
+			cb = TAILQ_FIRST(&cp->blocks);
+		else
+			cb = TAILQ_FIRST(&cs->all_blocks);
+		if (cb != NULL && t > cb->t)
+			n = t - cb->t;
+		break;
+	case CONTROL_STAT_PAUSES:
+		n = (cp != NULL) ? cp->pauses : cs->pauses;
+		break;
+	case CONTROL_STAT_WRITTEN:
+		n = (cp != NULL) ? cp->written : cs->written;
+		break;
+	case CONTROL_STAT_STALL:
+		n = cs->stall_time;
+		if (cs->stall_start != 0 && t > cs->stall_start)
+			n += t - cs->stall_start;
+		break;
+	}
+	return (n);
+}
+
+/* Write statistics for a pane. */
+void
+control_write_stats(struct client *c, struct window_pane *wp)
+{
+	control_write(c, "%%stats %%%u %llu %llu %llu %llu %llu", wp->id,
+	    (unsigned long long)control_get_stat(c, wp, CONTROL_STAT_BACKLOG),
+	    (unsigned long long)control_get_stat(c, wp, CONTROL_STAT_AGE),
+	    (unsigned long long)control_get_stat(c, wp, CONTROL_STAT_PAUSES),
+	    (unsigned long long)control_get_stat(c, wp, CONTROL_STAT_WRITTEN),
+	    (unsigned long long)control_get_stat(c, wp, CONTROL_STAT_STALL));
+}
+
 /* Pause a pane. */
 void
 control_pause_pane(struct client *c, struct window_pane *wp)
@@ -379,11 +732,152 @@ control_pause_pane(struct client *c, struct window_pane *wp)
 	cp = control_add_pane(c, wp);
 	if (~cp->flags & CONTROL_PANE_PAUSED) {
 		cp->flags |= CONTROL_PANE_PAUSED;
+		cp->pauses++;
+		c->control_state->pauses++;
 		control_discard_pane(c, cp);
 		control_write(c, "%%pause %%%u", wp->id);
 	}
 }
 
+#ifdef HAVE_ZLIB
+/* Compress data into the output buffer. */
+static void
+control_deflate(struct client *c, const void *data, size_t size, int flush)
+{
+	struct control_state	*cs = c->control_state;
+	z_stream		*zs = cs->zstream;
+	u_char			 out[CONTROL_BUFFER_HIGH];
+	int			 status;
+
+	zs->next_in = (Bytef *)data;
+	zs->avail_in = size;
+	do {
+		zs->next_out = out;
+		zs->avail_out = sizeof out;
+		status = deflate(zs, flush);
+		if (status == Z_STREAM_ERROR)
+			fatalx("deflate failed");
+		bufferevent_write(cs->write_event, out,
+		    sizeof out - zs->avail_out);
+	} while (zs->avail_out == 0);
+}
+
+/*
+ * Start or finish the compressed stream if the compress flag has changed.
+ * Returns 1 if output is compressed.
+ */
+static int
+control_compressed(struct client *c)
+{
+	struct control_state	*cs = c->control_state;
+
+	if (c->flags & CLIENT_CONTROL_COMPRESS) {
+		if (cs->zstream == NULL) {
+			cs->zstream = xcalloc(1, sizeof *cs->zstream);
+			if (deflateInit(cs->zstream, Z_DEFAULT_COMPRESSION) !=
+			    Z_OK)
+				fatalx("deflateInit failed");
+		}
+		return (1);
+	}
+	if (cs->zstream != NULL) {
+		control_deflate(c, NULL, 0, Z_FINISH);
+		deflateEnd(cs->zstream);
+		free(cs->zstream);
+		cs->zstream = NULL;
+	}
+	return (0);
+}
+#endif
+
+/* Write data to the client, compressed if needed. */
+static void
+control_out(struct client *c, const void *data, size_t size)
+{
+	struct control_state	*cs = c->control_state;
+
+#ifdef HAVE_ZLIB
+	if (control_compressed(c)) {
+		control_deflate(c, data, size, Z_NO_FLUSH);
+		return;
+	}
+#endif
+	bufferevent_write(cs->write_event, data, size);
+}
+
+/* Write a buffer to the client, compressed if needed. */
+static void
+control_out_buffer(struct client *c, struct evbuffer *evb)
+{
+	struct control_state	*cs = c->control_state;
+
+#ifdef HAVE_ZLIB
+	if (control_compressed(c)) {
+		control_deflate(c, EVBUFFER_DATA(evb), EVBUFFER_LENGTH(evb),
+		    Z_NO_FLUSH);
+		evbuffer_drain(evb, EVBUFFER_LENGTH(evb));
+		return;
+	}
+#endif
+	bufferevent_write_buffer(cs->write_event, evb);
+}
+
+/*
+ * Flush compressed output so the client can decode everything written so
+ * far.
+ */
+static void
+control_out_flush(__unused struct client *c)
+{
+#ifdef HAVE_ZLIB
+	struct control_state	*cs = c->control_state;
+
+	if (cs->zstream != NULL)
+		control_deflate(c, NULL, 0, Z_SYNC_FLUSH);
+#endif
+}
+
+/* Put a four byte value into a frame header. */
+static void
+control_frame_put(u_char *hdr, uint64_t value)
+{
+	if (value > UINT32_MAX)
+		value = UINT32_MAX;
+	hdr[0] = (value >> 24) & 0xff;
+	hdr[1] = (value >> 16) & 0xff;
+	hdr[2] = (value >> 8) & 0xff;
+	hdr[3] = value & 0xff;
+}
+
+/* Write a binary frame header. */
+static void
+control_write_frame(struct client *c, u_char type, u_int pane, uint64_t age,
+    size_t size)
+{
+	u_char	hdr[CONTROL_FRAME_HEADER];
+
+	hdr[0] = type;
+	control_frame_put(hdr + 1, pane);
+	control_frame_put(hdr + 5, age);
+	control_frame_put(hdr + 9, size);
+	control_out(c, hdr, sizeof hdr);
+}
+
+/* Write a complete line, framed if the client wants binary output. */
+static void
+control_write_line(struct client *c, const char *line)
+{
+	size_t	size = strlen(line);
+
+	if (c->flags & CLIENT_CONTROL_BINARY) {
+		control_write_frame(c, CONTROL_FRAME_LINE, 0, 0, size);
+		control_out(c, line, size);
+	} else {
+		control_out(c, line, size);
+		control_out(c, "\n", 1);
+	}
+}
+
 /* Write a line. */
 static void
 control_vwrite(struct client *c, const char *fmt, va_list ap)
@@ -394,8 +888,9 @@ control_vwrite(struct client *c, const char *fmt, va_list ap)
 	xvasprintf(&s, fmt, ap);
 	log_debug("%s: %s: writing line: %s", __func__, c->name, s);
 
-	bufferevent_write(cs->write_event, s, strlen(s));
-	bufferevent_write(cs->write_event, "\n", 1);
+	control_write_line(c, s);
+	if (!cs->subs_batch)
+		control_out_flush(c);
 
 	bufferevent_enable(cs->write_event, EV_WRITE);
 	free(s);
@@ -436,6 +931,9 @@ control_check_age(struct client *c, struct window_pane *wp,
 	struct control_block	*cb;
 	uint64_t		 t, age;
 
+	if (cp->flags & CONTROL_PANE_CREDIT)
+		return (0);
+
 	cb = TAILQ_FIRST(&cp->blocks);
 	if (cb == NULL)
 		return (0);
@@ -451,6 +949,8 @@ control_check_age(struct client *c, struct window_pane *wp,
 		if (age < c->pause_age)
 			return (0);
 		cp->flags |= CONTROL_PANE_PAUSED;
+		cp->pauses++;
+		c->control_state->pauses++;
 		control_discard_pane(c, cp);
 		control_write(c, "%%pause %%%u", wp->id);
 	} else {
@@ -487,7 +987,7 @@ control_write_output(struct client *c, struct window_pane *wp)
 	if (control_check_age(c, wp, cp))
 		return;
 
-	window_pane_get_new_data(wp, &cp->queued, &new_size);
+	new_size = window_pane_get_new_size(wp, &cp->queued);
 	if (new_size == 0)
 		return;
 	window_pane_update_used_data(wp, &cp->queued, new_size);
@@ -532,6 +1032,101 @@ control_error(struct cmdq_item *item, void *data)
 	return (CMD_RETURN_NORMAL);
 }
 
+/* Parse a command line and add it to the queue. */
+static void
+control_append_line(struct client *c, const char *line)
+{
+	struct cmdq_state	*state;
+	enum cmd_parse_status	 status;
+	char			*error;
+
+	state = cmdq_new_state(NULL, NULL, CMDQ_STATE_CONTROL);
+	status = cmd_parse_and_append(line, NULL, c, state, &error);
+	if (status == CMD_PARSE_ERROR)
+		cmdq_append(c, cmdq_get_callback(control_error, error));
+	cmdq_free_state(state);
+}
+
+/* Start running a batch. */
+static enum cmd_retval
+control_begin_batch_callback(struct cmdq_item *item, void *data)
+{
+	struct client		*c = cmdq_get_client(item);
+	struct control_state	*cs = c->control_state;
+
+	cs->running_batch = data;
+	cmdq_guard(item, "begin", 1);
+	return (CMD_RETURN_NORMAL);
+}
+
+/* Finish running a batch. */
+static enum cmd_retval
+control_end_batch_callback(struct cmdq_item *item, void *data)
+{
+	struct client		*c = cmdq_get_client(item);
+	struct control_state	*cs = c->control_state;
+	struct control_batch	*cbatch = data;
+
+	cs->running_batch = NULL;
+	control_write(c, "%%%s %ld %u 1", cbatch->error ? "error" : "end",
+	    cbatch->t, cbatch->number);
+
+	TAILQ_REMOVE(&cs->batches, cbatch, entry);
+	free(cbatch);
+	return (CMD_RETURN_NORMAL);
+}
+
+/* Start reading a batch of commands. */
+static void
+control_start_batch(struct client *c)
+{
+	struct control_state	*cs = c->control_state;
+
+	if (cs->batch != NULL)
+		return;
+	cs->batch = xcalloc(1, sizeof *cs->batch);
+	TAILQ_INSERT_TAIL(&cs->batches, cs->batch, entry);
+	cmdq_append(c, cmdq_get_callback(control_begin_batch_callback,
+	    cs->batch));
+}
+
+/* Finish reading a batch of commands. */
+static void
+control_end_batch(struct client *c)
+{
+	struct control_state	*cs = c->control_state;
+
+	if (cs->batch == NULL)
+		return;
+	cmdq_append(c, cmdq_get_callback(control_end_batch_callback,
+	    cs->batch));
+	cs->batch = NULL;
+}
+
+/*
+ * Write a guard line around the output of a command. Inside a batch, only the
+ * batch's own %begin is written and an error is kept for its %end.
+ */
+void
+control_guard(struct client *c, const char *guard, long t, u_int number,
+    int flags)
+{
+	struct control_state	*cs = c->control_state;
+	struct control_batch	*cbatch = cs->running_batch;
+
+	if (cbatch != NULL) {
+		if (cbatch->started) {
+			if (strcmp(guard, "error") == 0)
+				cbatch->error = 1;
+			return;
+		}
+		cbatch->started = 1;
+		cbatch->t = t;
+		cbatch->number = number;
+	}
+	control_write(c, "%%%s %ld %u %d", guard, t, number, flags);
+}
+
 /* Control client error callback. */
 static void
 control_error_callback(__unused struct bufferevent *bufev,
@@ -549,9 +1144,7 @@ control_read_callback(__unused struct bufferevent *bufev, void *data)
 	struct client		*c = data;
 	struct control_state	*cs = c->control_state;
 	struct evbuffer		*buffer = cs->read_event->input;
-	char			*line, *error;
-	struct cmdq_state	*state;
-	enum cmd_parse_status	 status;
+	char			*line;
 
 	for (;;) {
 		line = evbuffer_readln(buffer, NULL, EVBUFFER_EOL_LF);
@@ -564,11 +1157,12 @@ control_read_callback(__unused struct bufferevent *bufev, void *data)
 			break;
 		}
 
-		state = cmdq_new_state(NULL, NULL, CMDQ_STATE_CONTROL);
-		status = cmd_parse_and_append(line, NULL, c, state, &error);
-		if (status == CMD_PARSE_ERROR)
-			cmdq_append(c, cmdq_get_callback(control_error, error));
-		cmdq_free_state(state);
+		if (strcmp(line, "%batch") == 0)
+			control_start_batch(c);
+		else if (strcmp(line, "%endbatch") == 0)
+			control_end_batch(c);
+		else
+			control_append_line(c, line);
 
 		free(line);
 	}
@@ -598,25 +1192,193 @@ control_flush_all_blocks(struct client *c)
 		log_debug("%s: %s: flushing line: %s", __func__, c->name,
 		    cb->line);
 
-		bufferevent_write(cs->write_event, cb->line, strlen(cb->line));
-		bufferevent_write(cs->write_event, "\n", 1);
+		control_write_line(c, cb->line);
 		control_free_block(cs, cb);
 	}
 }
 
+/* Free a chunk. */
+static void
+control_free_chunk(struct control_chunk *cc)
+{
+	RB_REMOVE(control_chunks, &control_chunks, cc);
+	free(cc->data);
+	free(cc);
+}
+
+/* Free chunks for a pane, or only those it has discarded if old is set. */
+static void
+control_free_chunks1(struct window_pane *wp, int old)
+{
+	struct control_chunk	 find = { .pane = wp->id }, *cc, *cc1;
+
+	cc = RB_NFIND(control_chunks, &control_chunks, &find);
+	while (cc != NULL && cc->pane == wp->id) {
+		cc1 = RB_NEXT(control_chunks, &control_chunks, cc);
+		if (!old || cc->start + cc->size <= wp->base_offset)
+			control_free_chunk(cc);
+		cc = cc1;
+	}
+}
+
+/* Free all chunks for a pane. */
+void
+control_free_chunks(struct window_pane *wp)
+{
+	control_free_chunks1(wp, 0);
+}
+
+/* Find the chunk containing pane output at an offset. */
+static struct control_chunk *
+control_find_chunk(struct window_pane *wp, size_t used)
+{
+	struct control_chunk	 find = { .pane = wp->id, .start = used };
+	struct control_chunk	*cc;
+
+	cc = RB_NFIND(control_chunks, &control_chunks, &find);
+	if (cc != NULL && cc->pane == wp->id && cc->start == used)
+		return (cc);
+	if (cc != NULL)
+		cc = RB_PREV(control_chunks, &control_chunks, cc);
+	else
+		cc = RB_MAX(control_chunks, &control_chunks);
+	if (cc == NULL || cc->pane != wp->id)
+		return (NULL);
+	if (used < cc->start || used >= cc->start + cc->size)
+		return (NULL);
+	return (cc);
+}
+
+/*
+ * Escape pane output into out, which must have space for four times size.
+ * Runs of bytes which do not need escaping are copied at once.
+ */
+static char *
+control_escape(char *out, const u_char *data, size_t size)
+{
+	size_t	i = 0, start;
+
+	for (;;) {
+		start = i;
+		while (i < size && !control_escape_table[data[i]])
+			i++;
+		if (i != start) {
+			memcpy(out, data + start, i - start);
+			out += i - start;
+		}
+		if (i == size)
+			return (out);
+
+		*out++ = '\\';
+		*out++ = '0' + ((data[i] >> 6) & 7);
+		*out++ = '0' + ((data[i] >> 3) & 7);
+		*out++ = '0' + (data[i] & 7);
+		i++;
+	}
+}
+
+/* Escape pane output at an offset into a new chunk. */
+static struct control_chunk *
+control_add_chunk(struct window_pane *wp, size_t used)
+{
+	struct control_chunk		*cc;
+	struct window_pane_offset	 wpo = { .used = used };
+	u_char				*new_data;
+	char				*out;
+	size_t				 size, n;
+
+	control_free_chunks1(wp, 1);
+
+	size = window_pane_get_new_size(wp, &wpo);
+	if (size > CONTROL_CHUNK_SIZE)
+		size = CONTROL_CHUNK_SIZE;
+
+	cc = xcalloc(1, sizeof *cc);
+	cc->pane = wp->id;
+	cc->start = used;
+	cc->size = size;
+	out = cc->data = xmalloc(size * 4 + 1);
+
+	while (size != 0) {
+		new_data = window_pane_peek_new_data(wp, &wpo, &n);
+		if (n > size)
+			n = size;
+		out = control_escape(out, new_data, n);
+		window_pane_update_used_data(wp, &wpo, n);
+		size -= n;
+	}
+	cc->length = out - cc->data;
+
+	RB_INSERT(control_chunks, &control_chunks, cc);
+	return (cc);
+}
+
+/* Skip over the escaped form of some bytes of pane output in a chunk. */
+static size_t
+control_skip_chunk(struct control_chunk *cc, size_t offset, size_t size)
+{
+	char	*cp;
+	size_t	 n;
+
+	while (size != 0) {
+		cp = memchr(cc->data + offset, '\\', size);
+		if (cp == NULL)
+			return (offset + size);
+		n = cp - (cc->data + offset);
+		offset += n + 4;
+		size -= n + 1;
+	}
+	return (offset);
+}
+
+/* Append escaped pane output from the shared chunks. */
+static void
+control_append_chunks(struct control_pane *cp, struct evbuffer *message,
+    struct window_pane *wp, size_t size)
+{
+	struct control_chunk	*cc;
+	size_t			 used, offset, end, n;
+
+	while (size != 0) {
+		used = cp->offset.used;
+		if ((cc = control_find_chunk(wp, used)) == NULL)
+			cc = control_add_chunk(wp, used);
+
+		if (cp->chunk_start == cc->start && cp->chunk_used == used)
+			offset = cp->chunk_offset;
+		else
+			offset = control_skip_chunk(cc, 0, used - cc->start);
+
+		n = cc->start + cc->size - used;
+		if (n > size)
+			n = size;
+		end = control_skip_chunk(cc, offset, n);
+		evbuffer_add(message, cc->data + offset, end - offset);
+
+		window_pane_update_used_data(wp, &cp->offset, n);
+		size -= n;
+
+		cp->chunk_start = cc->start;
+		cp->chunk_used = used + n;
+		cp->chunk_offset = end;
+	}
+}
+
 /* Append data to buffer. */
 static struct evbuffer *
 control_append_data(struct client *c, struct control_pane *cp, uint64_t age,
     struct evbuffer *message, struct window_pane *wp, size_t size)
 {
 	u_char	*new_data;
-	size_t	 new_size;
-	u_int	 i;
+	size_t	 new_size, n;
 
 	if (message == NULL) {
 		message = evbuffer_new();
 		if (message == NULL)
 			fatalx("out of memory");
+	}
+	if (EVBUFFER_LENGTH(message) == 0 &&
+	    (~c->flags & CLIENT_CONTROL_BINARY)) {
 		if (c->flags & CLIENT_CONTROL_PAUSEAFTER) {
 			evbuffer_add_printf(message,
 			    "%%extended-output %%%u %llu : ", wp->id,
@@ -625,30 +1387,38 @@ control_append_data(struct client *c, struct control_pane *cp, uint64_t age,
 			evbuffer_add_printf(message, "%%output %%%u ", wp->id);
 	}
 
-	new_data = window_pane_get_new_data(wp, &cp->offset, &new_size);
+	new_size = window_pane_get_new_size(wp, &cp->offset);
 	if (new_size < size)
 		fatalx("not enough data: %zu < %zu", new_size, size);
-	for (i = 0; i < size; i++) {
-		if (new_data[i] < ' ' || new_data[i] == '\\')
-			evbuffer_add_printf(message, "\\%03o", new_data[i]);
-		else
-			evbuffer_add_printf(message, "%c", new_data[i]);
+	if (~c->flags & CLIENT_CONTROL_BINARY) {
+		control_append_chunks(cp, message, wp, size);
+		return (message);
+	}
+	while (size != 0) {
+		new_data = window_pane_peek_new_data(wp, &cp->offset, &n);
+		if (n > size)
+			n = size;
+		evbuffer_add(message, new_data, n);
+		window_pane_update_used_data(wp, &cp->offset, n);
+		size -= n;
 	}
-	window_pane_update_used_data(wp, &cp->offset, size);
 	return (message);
 }
 
 /* Write buffer. */
 static void
-control_write_data(struct client *c, struct evbuffer *message)
+control_write_data(struct client *c, struct evbuffer *message, u_int pane,
+    uint64_t age)
 {
-	struct control_state	*cs = c->control_state;
-
 	log_debug("%s: %s: %.*s", __func__, c->name,
 	    (int)EVBUFFER_LENGTH(message), EVBUFFER_DATA(message));
 
-	evbuffer_add(message, "\n", 1);
-	bufferevent_write_buffer(cs->write_event, message);
+	if (c->flags & CLIENT_CONTROL_BINARY) {
+		control_write_frame(c, CONTROL_FRAME_OUTPUT, pane, age,
+		    EVBUFFER_LENGTH(message));
+	} else
+		evbuffer_add(message, "\n", 1);
+	control_out_buffer(c, message);
 	evbuffer_free(message);
 }
 
@@ -661,7 +1431,7 @@ control_write_pending(struct client *c, struct control_pane *cp, size_t limit)
 	struct evbuffer		*message = NULL;
 	size_t			 used = 0, size;
 	struct control_block	*cb, *cb1;
-	uint64_t		 age, t = get_timer();
+	uint64_t		 age, message_age = 0, t = get_timer();
 
 	wp = control_window_pane(c, cp->pane);
 	if (wp == NULL) {
@@ -673,6 +1443,20 @@ control_write_pending(struct client *c, struct control_pane *cp, size_t limit)
 		return (0);
 	}
 
+	if (cp->flags & CONTROL_PANE_CREDIT) {
+		if (cp->credit == 0) {
+			/*
+			 * Do not hold up other output while waiting for
+			 * credit, the blocks are queued again when it arrives.
+			 */
+			control_discard_pane(c, cp);
+			control_flush_all_blocks(c);
+			return (0);
+		}
+		if (limit > cp->credit)
+			limit = cp->credit;
+	}
+
 	while (used != limit && !TAILQ_EMPTY(&cp->blocks)) {
 		if (control_check_age(c, wp, cp)) {
 			if (message != NULL)
@@ -695,6 +1479,8 @@ control_write_pending(struct client *c, struct control_pane *cp, size_t limit)
 			size = limit - used;
 		used += size;
 
+		if (message == NULL)
+			message_age = age;
 		message = control_append_data(c, cp, age, message, wp, size);
 
 		cb->size -= size;
@@ -705,7 +1491,8 @@ control_write_pending(struct client *c, struct control_pane *cp, size_t limit)
 			cb = TAILQ_FIRST(&cs->all_blocks);
 			if (cb != NULL && cb->size == 0) {
 				if (wp != NULL && message != NULL) {
-					control_write_data(c, message);
+					control_write_data(c, message, cp->pane,
+					    message_age);
 					message = NULL;
 				}
 				control_flush_all_blocks(c);
@@ -713,7 +1500,11 @@ control_write_pending(struct client *c, struct control_pane *cp, size_t limit)
 		}
 	}
 	if (message != NULL)
-		control_write_data(c, message);
+		control_write_data(c, message, cp->pane, message_age);
+	if (cp->flags & CONTROL_PANE_CREDIT)
+		cp->credit -= used;
+	cp->written += used;
+	cs->written += used;
 	return (!TAILQ_EMPTY(&cp->blocks));
 }
 
@@ -726,6 +1517,16 @@ control_write_callback(__unused struct bufferevent *bufev, void *data)
 	struct control_pane	*cp, *cp1;
 	struct evbuffer		*evb = cs->write_event->output;
 	size_t			 space, limit;
+	uint64_t		 t;
+
+	/* Writing was stalled while the buffer was full. */
+	if (cs->stall_start != 0 &&
+	    EVBUFFER_LENGTH(evb) < CONTROL_BUFFER_HIGH) {
+		t = get_timer();
+		if (t > cs->stall_start)
+			cs->stall_time += t - cs->stall_start;
+		cs->stall_start = 0;
+	}
 
 	control_flush_all_blocks(c);
 
@@ -736,7 +1537,10 @@ control_write_callback(__unused struct bufferevent *bufev, void *data)
 		log_debug("%s: %s: %zu bytes available, %u panes", __func__,
 		    c->name, space, cs->pending_count);
 
-		limit = (space / cs->pending_count / 3); /* 3 bytes for \xxx */
+		if (c->flags & CLIENT_CONTROL_BINARY)
+			limit = space / cs->pending_count;
+		else
+			limit = (space / cs->pending_count / 3); /* \xxx */
 		if (limit < CONTROL_WRITE_MINIMUM)
 			limit = CONTROL_WRITE_MINIMUM;
 
@@ -750,8 +1554,11 @@ control_write_callback(__unused struct bufferevent *bufev, void *data)
 			cs->pending_count--;
 		}
 	}
+	control_out_flush(c);
 	if (EVBUFFER_LENGTH(evb) == 0)
 		bufferevent_disable(cs->write_event, EV_WRITE);
+	else if (cs->pending_count != 0 && cs->stall_start == 0)
+		cs->stall_start = get_timer();
 }
 
 /* Initialize for control mode. */
@@ -772,6 +1579,7 @@ control_start(struct client *c)
 	TAILQ_INIT(&cs->pending_list);
 	TAILQ_INIT(&cs->all_blocks);
 	RB_INIT(&cs->subs);
+	TAILQ_INIT(&cs->batches);
 
 	cs->read_event = bufferevent_new(c->fd, control_read_callback,
 	    control_write_callback, control_error_callback, c);
@@ -811,6 +1619,7 @@ control_stop(struct client *c)
 	struct control_state	*cs = c->control_state;
 	struct control_block	*cb, *cb1;
 	struct control_sub	*csub, *csub1;
+	struct control_batch	*cbatch, *cbatch1;
 
 	if (~c->flags & CLIENT_CONTROLCONTROL)
 		bufferevent_free(cs->write_event);
@@ -825,6 +1634,17 @@ control_stop(struct client *c)
 		control_free_block(cs, cb);
 	control_reset_offsets(c);
 
+	TAILQ_FOREACH_SAFE(cbatch, &cs->batches, entry, cbatch1) {
+		TAILQ_REMOVE(&cs->batches, cbatch, entry);
+		free(cbatch);
+	}
+
+#ifdef HAVE_ZLIB
+	if (cs->zstream != NULL) {
+		deflateEnd(cs->zstream);
+		free(cs->zstream);
+	}
+#endif
 	free(cs);
 }
 
@@ -837,7 +1657,7 @@ control_check_subs_session(struct client *c, struct control_sub *csub)
 	char			*value;
 
 	ft = format_create_defaults(NULL, c, s, NULL, NULL);
-	value = format_expand(ft, csub->format);
+	value = format_expand_cache(ft, csub->format, &csub->cache);
 	format_free(ft);
 
 	if (csub->last != NULL && strcmp(value, csub->last) == 0) {
@@ -872,10 +1692,6 @@ control_check_subs_pane(struct client *c, struct control_sub *csub)
 		if (wl->session != s)
 			continue;
 
-		ft = format_create_defaults(NULL, c, s, wl, wp);
-		value = format_expand(ft, csub->format);
-		format_free(ft);
-
 		find.pane = wp->id;
 		find.idx = wl->idx;
 
@@ -887,6 +1703,10 @@ control_check_subs_pane(struct client *c, struct control_sub *csub)
 			RB_INSERT(control_sub_panes, &csub->panes, csp);
 		}
 
+		ft = format_create_defaults(NULL, c, s, wl, wp);
+		value = format_expand_cache(ft, csub->format, &csp->cache);
+		format_free(ft);
+
 		if (csp->last != NULL && strcmp(value, csp->last) == 0) {
 			free(value);
 			continue;
@@ -911,13 +1731,10 @@ control_check_subs_all_panes(struct client *c, struct control_sub *csub)
 	char			*value;
 	struct control_sub_pane	*csp, find;
 
+	ft = format_create(NULL, NULL, FORMAT_NONE, 0);
 	RB_FOREACH(wl, winlinks, &s->windows) {
 		w = wl->window;
 		TAILQ_FOREACH(wp, &w->panes, entry) {
-			ft = format_create_defaults(NULL, c, s, wl, wp);
-			value = format_expand(ft, csub->format);
-			format_free(ft);
-
 			find.pane = wp->id;
 			find.idx = wl->idx;
 
@@ -929,6 +1746,11 @@ control_check_subs_all_panes(struct client *c, struct control_sub *csub)
 				RB_INSERT(control_sub_panes, &csub->panes, csp);
 			}
 
+			format_defaults(ft, c, s, wl, wp);
+			value = format_expand_cache(ft, csub->format,
+			    &csp->cache);
+			format_clear(ft);
+
 			if (csp->last != NULL &&
 			    strcmp(value, csp->last) == 0) {
 				free(value);
@@ -941,6 +1763,7 @@ control_check_subs_all_panes(struct client *c, struct control_sub *csub)
 			csp->last = value;
 		}
 	}
+	format_free(ft);
 }
 
 /* Check window subscription. */
@@ -962,10 +1785,6 @@ control_check_subs_window(struct client *c, struct control_sub *csub)
 		if (wl->session != s)
 			continue;
 
-		ft = format_create_defaults(NULL, c, s, wl, NULL);
-		value = format_expand(ft, csub->format);
-		format_free(ft);
-
 		find.window = w->id;
 		find.idx = wl->idx;
 
@@ -977,6 +1796,10 @@ control_check_subs_window(struct client *c, struct control_sub *csub)
 			RB_INSERT(control_sub_windows, &csub->windows, csw);
 		}
 
+		ft = format_create_defaults(NULL, c, s, wl, NULL);
+		value = format_expand_cache(ft, csub->format, &csw->cache);
+		format_free(ft);
+
 		if (csw->last != NULL && strcmp(value, csw->last) == 0) {
 			free(value);
 			continue;
@@ -1000,13 +1823,10 @@ control_check_subs_all_windows(struct client *c, struct control_sub *csub)
 	char				*value;
 	struct control_sub_window	*csw, find;
 
+	ft = format_create(NULL, NULL, FORMAT_NONE, 0);
 	RB_FOREACH(wl, winlinks, &s->windows) {
 		w = wl->window;
 
-		ft = format_create_defaults(NULL, c, s, wl, NULL);
-		value = format_expand(ft, csub->format);
-		format_free(ft);
-
 		find.window = w->id;
 		find.idx = wl->idx;
 
@@ -1018,6 +1838,10 @@ control_check_subs_all_windows(struct client *c, struct control_sub *csub)
 			RB_INSERT(control_sub_windows, &csub->windows, csw);
 		}
 
+		format_defaults(ft, c, s, wl, NULL);
+		value = format_expand_cache(ft, csub->format, &csw->cache);
+		format_clear(ft);
+
 		if (csw->last != NULL && strcmp(value, csw->last) == 0) {
 			free(value);
 			continue;
@@ -1028,6 +1852,31 @@ control_check_subs_all_windows(struct client *c, struct control_sub *csub)
 		free(csw->last);
 		csw->last = value;
 	}
+	format_free(ft);
+}
+
+/* Start the subscriptions timer for the next subscription due. */
+static void
+control_schedule_subs(struct client *c)
+{
+	struct control_state	*cs = c->control_state;
+	struct control_sub	*csub;
+	struct timeval		 tv;
+	uint64_t		 t = get_timer(), next = 0;
+
+	RB_FOREACH(csub, control_subs, &cs->subs) {
+		if (next == 0 || csub->next < next)
+			next = csub->next;
+	}
+	evtimer_del(&cs->subs_timer);
+	if (next == 0)
+		return;
+
+	if (next < t)
+		next = t;
+	tv.tv_sec = (next - t) / 1000;
+	tv.tv_usec = ((next - t) % 1000) * 1000;
+	evtimer_add(&cs->subs_timer, &tv);
 }
 
 /* Check subscriptions timer. */
@@ -1037,12 +1886,20 @@ control_check_subs_timer(__unused int fd, __unused short events, void *data)
 	struct client		*c = data;
 	struct control_state	*cs = c->control_state;
 	struct control_sub	*csub, *csub1;
-	struct timeval		 tv = { .tv_sec = 1 };
+	uint64_t		 t = get_timer();
 
 	log_debug("%s: timer fired", __func__);
-	evtimer_add(&cs->subs_timer, &tv);
 
+	/*
+	 * Changes from all the subscriptions due are written together and
+	 * flushed once.
+	 */
+	cs->subs_batch = 1;
 	RB_FOREACH_SAFE(csub, control_subs, &cs->subs, csub1) {
+		if (csub->next > t)
+			continue;
+		csub->next = t + csub->interval;
+
 		switch (csub->type) {
 		case CONTROL_SUB_SESSION:
 			control_check_subs_session(c, csub);
@@ -1061,16 +1918,19 @@ control_check_subs_timer(__unused int fd, __unused short events, void *data)
 			break;
 		}
 	}
+	cs->subs_batch = 0;
+	control_out_flush(c);
+
+	control_schedule_subs(c);
 }
 
 /* Add a subscription. */
 void
 control_add_sub(struct client *c, const char *name, enum control_sub_type type,
-    int id, const char *format)
+    int id, const char *format, u_int interval)
 {
 	struct control_state	*cs = c->control_state;
 	struct control_sub	*csub, find;
-	struct timeval		 tv = { .tv_sec = 1 };
 
 	find.name = (char *)name;
 	if ((csub = RB_FIND(control_subs, &cs->subs, &find)) != NULL)
@@ -1081,6 +1941,8 @@ control_add_sub(struct client *c, const char *name, enum control_sub_type type,
 	csub->type = type;
 	csub->id = id;
 	csub->format = xstrdup(format);
+	csub->interval = interval;
+	csub->next = get_timer() + interval;
 	RB_INSERT(control_subs, &cs->subs, csub);
 
 	RB_INIT(&csub->panes);
@@ -1088,8 +1950,7 @@ control_add_sub(struct client *c, const char *name, enum control_sub_type type,
 
 	if (!evtimer_initialized(&cs->subs_timer))
 		evtimer_set(&cs->subs_timer, control_check_subs_timer, c);
-	if (!evtimer_pending(&cs->subs_timer, NULL))
-		evtimer_add(&cs->subs_timer, &tv);
+	control_schedule_subs(c);
 }
 
 /* Remove a subscription. */
@@ -29,9 +29,31 @@
  * Environment - manipulate a set of environment variables.
  */
 
-RB_HEAD(environ, environ_entry);
+RB_HEAD(environ_tree, environ_entry);
 static int environ_cmp(struct environ_entry *, struct environ_entry *);
-RB_GENERATE_STATIC(environ, environ_entry, entry, environ_cmp);
+RB_GENERATE_STATIC(environ_tree, environ_entry, entry, environ_cmp);
+static struct environ *environ_for_session1(struct session *, int);
+
+struct environ {
+	struct environ_tree	  tree;
+	u_int			  generation;	/* changed on every update */
+
+	char			**envp;		/* flattened for pushing */
+	u_int			  envp_size;
+	u_int			  envp_generation;
+
+	/*
+	 * For a session environment, the environment for new panes built from
+	 * it and the global environment, and what it was built from.
+	 */
+	struct environ		 *merged;
+	u_int			  merged_global;
+	u_int			  merged_generation;
+	char			 *merged_term;
+};
+
+/* Last generation given to an environment. */
+static u_int	environ_generation;
 
 static int
 environ_cmp(struct environ_entry *envent1, struct environ_entry *envent2)
@@ -39,6 +61,62 @@ environ_cmp(struct environ_entry *envent1, struct environ_entry *envent2)
 	return (strcmp(envent1->name, envent2->name));
 }
 
+/* Free the flattened environment. */
+static void
+environ_free_envp(struct environ *env)
+{
+	u_int	i;
+
+	for (i = 0; i < env->envp_size; i++)
+		free(env->envp[i]);
+	free(env->envp);
+	env->envp = NULL;
+	env->envp_size = 0;
+}
+
+/*
+ * Build the flattened NAME=VALUE array of variables which are pushed into the
+ * real environment, if the environment has changed since it was last built.
+ */
+static char **
+environ_get_envp(struct environ *env)
+{
+	struct environ_entry	*envent;
+	u_int			 n = 0;
+
+	if (env->envp != NULL && env->envp_generation == env->generation)
+		return (env->envp);
+	environ_free_envp(env);
+
+	RB_FOREACH(envent, environ_tree, &env->tree) {
+		if (envent->value != NULL &&
+		    *envent->name != '\0' &&
+		    (~envent->flags & ENVIRON_HIDDEN))
+			n++;
+	}
+	env->envp = xcalloc(n + 1, sizeof *env->envp);
+	RB_FOREACH(envent, environ_tree, &env->tree) {
+		if (envent->value != NULL &&
+		    *envent->name != '\0' &&
+		    (~envent->flags & ENVIRON_HIDDEN)) {
+			xasprintf(&env->envp[env->envp_size++], "%s=%s",
+			    envent->name, envent->value);
+		}
+	}
+	env->envp_generation = env->generation;
+	return (env->envp);
+}
+
+/* Add a variable to an environment array if it should be set. */
+static void
+environ_exec_add(char **envp, u_int *n, struct environ_entry *envent)
+{
+	if (envent->value != NULL &&
+	    *envent->name != '\0' &&
+	    (~envent->flags & ENVIRON_HIDDEN))
+		xasprintf(&envp[(*n)++], "%s=%s", envent->name, envent->value);
+}
+
 /* Initialise the environment. */
 struct environ *
 environ_create(void)
@@ -46,7 +124,8 @@ environ_create(void)
 	struct environ	*env;
 
 	env = xcalloc(1, sizeof *env);
-	RB_INIT(env);
+	RB_INIT(&env->tree);
+	env->generation = ++environ_generation;
 
 	return (env);
 }
@@ -57,25 +136,29 @@ environ_free(struct environ *env)
 {
 	struct environ_entry	*envent, *envent1;
 
-	RB_FOREACH_SAFE(envent, environ, env, envent1) {
-		RB_REMOVE(environ, env, envent);
+	RB_FOREACH_SAFE(envent, environ_tree, &env->tree, envent1) {
+		RB_REMOVE(environ_tree, &env->tree, envent);
 		free(envent->name);
 		free(envent->value);
 		free(envent);
 	}
+	environ_free_envp(env);
+	if (env->merged != NULL)
+		environ_free(env->merged);
+	free(env->merged_term);
 	free(env);
 }
 
 struct environ_entry *
 environ_first(struct environ *env)
 {
-	return (RB_MIN(environ, env));
+	return (RB_MIN(environ_tree, &env->tree));
 }
 
 struct environ_entry *
 environ_next(struct environ_entry *envent)
 {
-	return (RB_NEXT(environ, env, envent));
+	return (RB_NEXT(environ_tree, &env->tree, envent));
 }
 
 /* Copy one environment into another. */
@@ -84,7 +167,7 @@ environ_copy(struct environ *srcenv, struct environ *dstenv)
 {
 	struct environ_entry	*envent;
 
-	RB_FOREACH(envent, environ, srcenv) {
+	RB_FOREACH(envent, environ_tree, &srcenv->tree) {
 		if (envent->value == NULL)
 			environ_clear(dstenv, envent->name);
 		else {
@@ -101,7 +184,7 @@ environ_find(struct environ *env, const char *name)
 	struct environ_entry	envent;
 
 	envent.name = (char *) name;
-	return (RB_FIND(environ, env, &envent));
+	return (RB_FIND(environ_tree, &env->tree, &envent));
 }
 
 /* Set an environment variable. */
@@ -122,9 +205,10 @@ environ_set(struct environ *env, const char *name, int flags, const char *fmt,
 		envent->name = xstrdup(name);
 		envent->flags = flags;
 		xvasprintf(&envent->value, fmt, ap);
-		RB_INSERT(environ, env, envent);
+		RB_INSERT(environ_tree, &env->tree, envent);
 	}
 	va_end(ap);
+	env->generation = ++environ_generation;
 }
 
 /* Clear an environment variable. */
@@ -141,8 +225,9 @@ environ_clear(struct environ *env, const char *name)
 		envent->name = xstrdup(name);
 		envent->flags = 0;
 		envent->value = NULL;
-		RB_INSERT(environ, env, envent);
+		RB_INSERT(environ_tree, &env->tree, envent);
 	}
+	env->generation = ++environ_generation;
 }
 
 /* Set an environment variable from a NAME=VALUE string. */
@@ -171,10 +256,11 @@ environ_unset(struct environ *env, const char *name)
 
 	if ((envent = environ_find(env, name)) == NULL)
 		return;
-	RB_REMOVE(environ, env, envent);
+	RB_REMOVE(environ_tree, &env->tree, envent);
 	free(envent->name);
 	free(envent->value);
 	free(envent);
+	env->generation = ++environ_generation;
 }
 
 /* Copy variables from a destination into a source environment. */
@@ -192,7 +278,7 @@ environ_update(struct options *oo, struct environ *src, struct environ *dst)
 	a = options_array_first(o);
 	while (a != NULL) {
 		ov = options_array_item_value(a);
-		RB_FOREACH(envent, environ, src) {
+		RB_FOREACH(envent, environ_tree, &src->tree) {
 			if (fnmatch(ov->string, envent->name, 0) == 0)
 				break;
 		}
@@ -204,19 +290,89 @@ environ_update(struct options *oo, struct environ *src, struct environ *dst)
 	}
 }
 
-/* Push environment into the real environment - use after fork(). */
+/*
+ * Push environment into the real environment - use after fork(). If a base
+ * environment is given, it is used as it is and the variables in env are set
+ * or unset on top of it; its flattened form should have been built before
+ * fork() with environ_session() so it is kept.
+ */
 void
-environ_push(struct environ *env)
+environ_push(struct environ *base, struct environ *env)
 {
 	struct environ_entry	*envent;
-
-	environ = xcalloc(1, sizeof *environ);
-	RB_FOREACH(envent, environ, env) {
-		if (envent->value != NULL &&
-		    *envent->name != '\0' &&
-		    (~envent->flags & ENVIRON_HIDDEN))
+	char			**envp;
+
+	if (base != NULL) {
+		envp = environ_get_envp(base);
+		environ = xcalloc(base->envp_size + 1, sizeof *environ);
+		memcpy(environ, envp, base->envp_size * sizeof *environ);
+	} else
+		environ = xcalloc(1, sizeof *environ);
+	RB_FOREACH(envent, environ_tree, &env->tree) {
+		if (*envent->name == '\0')
+			continue;
+		if (envent->value != NULL && (~envent->flags & ENVIRON_HIDDEN))
 			setenv(envent->name, envent->value, 1);
+		else if (base != NULL)
+			unsetenv(envent->name);
+	}
+}
+
+/*
+ * Build the environment array for a child from base (which may be NULL) with
+ * the variables in env set or unset on top of it, for children which cannot
+ * use environ_push. Free with environ_free_exec.
+ */
+char **
+environ_exec(struct environ *base, struct environ *env)
+{
+	struct environ_entry	*envent;
+	char			**envp, **cp = NULL;
+	u_int			  n = 0, size = 0;
+	size_t			  len;
+	int			  cmp;
+
+	if (base != NULL) {
+		cp = environ_get_envp(base);
+		size = base->envp_size;
 	}
+	RB_FOREACH(envent, environ_tree, &env->tree)
+		size++;
+	envp = xcalloc(size + 1, sizeof *envp);
+
+	/* Both are sorted by name so they can be merged. */
+	envent = RB_MIN(environ_tree, &env->tree);
+	for (; cp != NULL && *cp != NULL; cp++) {
+		len = strcspn(*cp, "=");
+		cmp = -1;
+		for (; envent != NULL; envent = environ_next(envent)) {
+			cmp = strncmp(envent->name, *cp, len);
+			if (cmp == 0 && envent->name[len] != '\0')
+				cmp = 1;
+			if (cmp >= 0)
+				break;
+			environ_exec_add(envp, &n, envent);
+		}
+		if (cmp == 0) {
+			environ_exec_add(envp, &n, envent);
+			envent = environ_next(envent);
+		} else
+			envp[n++] = xstrdup(*cp);
+	}
+	for (; envent != NULL; envent = environ_next(envent))
+		environ_exec_add(envp, &n, envent);
+	return (envp);
+}
+
+/* Free an environment array from environ_exec. */
+void
+environ_free_exec(char **envp)
+{
+	char	**cp;
+
+	for (cp = envp; *cp != NULL; cp++)
+		free(*cp);
+	free(envp);
 }
 
 /* Log the environment. */
@@ -231,7 +387,7 @@ environ_log(struct environ *env, const char *fmt, ...)
 	vasprintf(&prefix, fmt, ap);
 	va_end(ap);
 
-	RB_FOREACH(envent, environ, env) {
+	RB_FOREACH(envent, environ_tree, &env->tree) {
 		if (envent->value != NULL && *envent->name != '\0') {
 			log_debug("%s%s=%s", prefix, envent->name,
 			    envent->value);
@@ -241,9 +397,51 @@ environ_log(struct environ *env, const char *fmt, ...)
 	free(prefix);
 }
 
+/*
+ * Get the environment for new panes in a session. This is kept with the
+ * session environment and only built again when it, the global environment or
+ * the default-terminal option changes.
+ */
+struct environ *
+environ_session(struct session *s)
+{
+	struct environ	*senv = s->environ;
+	const char	*value;
+
+	value = options_get_string(global_options, "default-terminal");
+	if (senv->merged == NULL ||
+	    senv->merged_global != global_environ->generation ||
+	    senv->merged_generation != senv->generation ||
+	    strcmp(senv->merged_term, value) != 0) {
+		if (senv->merged != NULL)
+			environ_free(senv->merged);
+		senv->merged = environ_for_session1(s, 0);
+		senv->merged_global = global_environ->generation;
+		senv->merged_generation = senv->generation;
+		free(senv->merged_term);
+		senv->merged_term = xstrdup(value);
+		environ_log(senv->merged, "%s: $%u: ", __func__, s->id);
+	}
+	environ_get_envp(senv->merged);
+	return (senv->merged);
+}
+
 /* Create initial environment for new child. */
 struct environ *
 environ_for_session(struct session *s, int no_TERM)
+{
+	struct environ	*env;
+
+	if (s == NULL || no_TERM)
+		return (environ_for_session1(s, no_TERM));
+	env = environ_create();
+	environ_copy(environ_session(s), env);
+	return (env);
+}
+
+/* Build the initial environment for a new child. */
+static struct environ *
+environ_for_session1(struct session *s, int no_TERM)
 {
 	struct environ	*env;
 	const char	*value;
@@ -17,6 +17,8 @@
  */
 
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <errno.h>
 #include <fcntl.h>
@@ -31,7 +33,59 @@
  * IPC file handling. Both client and server use the same data structures
  * (client_file and client_files) to store list of active files. Most functions
  * are for use either in client or server but not both.
+ *
+ * Regular files opened by the client are passed to the server as a file
+ * descriptor which it reads or writes directly, other files and streams are
+ * sent in MSG_READ and MSG_WRITE messages.
+ */
+
+/*
+ * Most read from a file passed by the client each time round the event loop,
+ * so a large or slow file does not stop the server doing anything else.
+ */
+#define FILE_READ_SIZE (1024 * 1024)
+
+/*
+ * Most written to a file passed by the client each time round the event loop,
+ * so a slow file does not stop the server doing anything else.
+ */
+#define FILE_WRITE_SIZE (1024 * 1024)
+
+/*
+ * Most messages queued to a client at once; once there are this many, the
+ * rest waits in the file's buffer until the client has read some.
  */
+#define FILE_QUEUE_MAX 64
+static const struct timeval file_queue_wait = { 0, 1000 };
+
+/*
+ * Ring of shared memory used to send file data from the server to the client
+ * without copying it through the socket. The server writes data after the
+ * last position the client has read and sends MSG_WRITE_RING with the size,
+ * the client copies it out and updates its position in the header.
+ *
+ * Clients which can use a ring set CLIENT_RING when they identify. The ring is
+ * only created when the server first has more than FILE_RING_MIN to write: it
+ * sends MSG_RING_OPEN and holds the data until the client replies, with the
+ * ring or without if it could not be created. Small output always goes as
+ * MSG_WRITE.
+ *
+ * If the ring is full, the server sets the waiting flag and the client sends
+ * MSG_RING_READY once it has made space.
+ */
+#define FILE_RING_SIZE (1024 * 1024)
+#define FILE_RING_MIN (64 * 1024)
+struct file_ring_header {
+	volatile uint64_t	 tail;	/* read position, set by client */
+	volatile int		 waiting; /* set by server if ring is full */
+	char			 pad[52];
+};
+struct file_ring {
+	struct file_ring_header	*header;
+	u_char			*data;
+	size_t			 size;
+	uint64_t		 offset; /* server writes or client reads */
+};
 
 static int	file_next_stream = 3;
 
@@ -131,6 +185,8 @@ file_free(struct client_file *cf)
 	if (--cf->references != 0)
 		return;
 
+	if (event_initialized(&cf->timer))
+		evtimer_del(&cf->timer);
 	evbuffer_free(cf->buffer);
 	free(cf->path);
 
@@ -245,6 +301,24 @@ file_print_buffer(struct client *c, void *data, size_t size)
 	}
 }
 
+/*
+ * Get roughly how much printed data is waiting to be sent to the client, so
+ * large output can be written as the client takes it.
+ */
+size_t
+file_print_left(struct client *c)
+{
+	struct client_file	 find, *cf;
+	size_t			 left;
+
+	left = (size_t)proc_queued(c->peer) * MAX_IMSGSIZE;
+
+	find.stream = 1;
+	if ((cf = RB_FIND(client_files, &c->files, &find)) != NULL)
+		left += EVBUFFER_LENGTH(cf->buffer);
+	return (left);
+}
+
 /* Report an error to a file. */
 void
 file_error(struct client *c, const char *fmt, ...)
@@ -277,14 +351,17 @@ file_error(struct client *c, const char *fmt, ...)
 	va_end(ap);
 }
 
-/* Write data to a file. */
+/*
+ * Write data to a file. The data is moved out of the given buffer, so it may
+ * hold references rather than copies.
+ */
 void
-file_write(struct client *c, const char *path, int flags, const void *bdata,
-    size_t bsize, client_file_cb cb, void *cbdata)
+file_write(struct client *c, const char *path, int flags,
+    struct evbuffer *evb, client_file_cb cb, void *cbdata)
 {
 	struct client_file	*cf;
 	struct msg_write_open	*msg;
-	size_t			 msglen;
+	size_t			 msglen, bsize;
 	int			 fd = -1;
 	u_int			 stream = file_next_stream++;
 	FILE			*f;
@@ -317,7 +394,8 @@ file_write(struct client *c, const char *path, int flags, const void *bdata,
 			cf->error = errno;
 			goto done;
 		}
-		if (fwrite(bdata, 1, bsize, f) != bsize) {
+		bsize = EVBUFFER_LENGTH(evb);
+		if (fwrite(EVBUFFER_DATA(evb), 1, bsize, f) != bsize) {
 			fclose(f);
 			cf->error = EIO;
 			goto done;
@@ -327,7 +405,7 @@ file_write(struct client *c, const char *path, int flags, const void *bdata,
 	}
 
 skip:
-	evbuffer_add(cf->buffer, bdata, bsize);
+	evbuffer_add_buffer(cf->buffer, evb);
 
 	msglen = strlen(cf->path) + 1 + sizeof *msg;
 	if (msglen > MAX_IMSGSIZE - IMSG_HEADER_SIZE) {
@@ -426,6 +504,248 @@ done:
 	file_fire_done(cf);
 }
 
+/* Is this file descriptor a regular file? */
+static int
+file_is_regular(int fd)
+{
+	struct stat	sb;
+
+	return (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode));
+}
+
+/*
+ * Come back to a file passed by the client next time round the event loop.
+ * This uses a timer because event_once with no timeout runs the callback again
+ * straight away, before any other events.
+ */
+static void
+file_fd_again(void (*cb)(int, short, void *), struct client_file *cf)
+{
+	struct timeval	tv = { 0 };
+
+	evtimer_set(&cf->timer, cb, cf);
+	evtimer_add(&cf->timer, &tv);
+}
+
+/*
+ * Read some of a file passed by the client into the buffer, then come back for
+ * more next time round the loop. Once it is all read, fire the done callback.
+ */
+static void
+file_read_fd_cb(__unused int fd, __unused short events, void *arg)
+{
+	struct client_file	*cf = arg;
+	char			*buf;
+	ssize_t			 n;
+
+	if (cf->c != NULL && (cf->c->flags & CLIENT_DEAD)) {
+		close(cf->fd);
+		cf->fd = -1;
+		file_free(cf);
+		return;
+	}
+
+	buf = xmalloc(FILE_READ_SIZE);
+	n = read(cf->fd, buf, FILE_READ_SIZE);
+	if (n == -1 && errno != EINTR)
+		cf->error = errno;
+	else if (n > 0) {
+		log_debug("file %d read %zd bytes", cf->stream, n);
+		if (evbuffer_add(cf->buffer, buf, n) != 0)
+			cf->error = ENOMEM;
+	}
+	free(buf);
+	if (cf->error == 0 && n != 0) {
+		file_fd_again(file_read_fd_cb, cf);
+		return;
+	}
+
+	close(cf->fd);
+	cf->fd = -1;
+	file_fire_done(cf);
+	file_free(cf);
+}
+
+/*
+ * Write some of the buffer to a file passed by the client, then come back for
+ * more next time round the loop. Once it is all written, push the close to the
+ * client.
+ */
+static void
+file_write_fd_cb(__unused int fd, __unused short events, void *arg)
+{
+	struct client_file	*cf = arg;
+	size_t			 left = EVBUFFER_LENGTH(cf->buffer);
+	ssize_t			 n;
+
+	if (cf->c != NULL && (cf->c->flags & CLIENT_DEAD)) {
+		close(cf->fd);
+		cf->fd = -1;
+		file_free(cf);
+		return;
+	}
+
+	if (left != 0) {
+		n = evbuffer_write_atmost(cf->buffer, cf->fd, FILE_WRITE_SIZE);
+		if (n == -1 && (errno == EINTR || errno == EAGAIN))
+			n = 0;
+		else if (n <= 0) {
+			cf->error = (n == -1 ? errno : EIO);
+			evbuffer_drain(cf->buffer, left);
+		} else
+			log_debug("file %d wrote %zd bytes", cf->stream, n);
+		if (EVBUFFER_LENGTH(cf->buffer) != 0) {
+			file_fd_again(file_write_fd_cb, cf);
+			return;
+		}
+	}
+
+	close(cf->fd);
+	cf->fd = -1;
+	file_push(cf);
+	file_free(cf);
+}
+
+/* Map a ring. */
+static struct file_ring *
+file_ring_map(int fd)
+{
+	struct file_ring	*fr;
+	size_t			 total = sizeof *fr->header + FILE_RING_SIZE;
+	void			*base;
+
+	base = mmap(NULL, total, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		log_debug("%s: mmap failed: %s", __func__, strerror(errno));
+		return (NULL);
+	}
+
+	fr = xcalloc(1, sizeof *fr);
+	fr->header = base;
+	fr->data = (u_char *)base + sizeof *fr->header;
+	fr->size = FILE_RING_SIZE;
+	return (fr);
+}
+
+/*
+ * Create a ring (client), in the same directory as the socket, and reply to
+ * the server with it. The server is always replied to, even on failure.
+ */
+struct file_ring *
+file_ring_create(struct tmuxpeer *peer)
+{
+	struct file_ring	*fr = NULL;
+	char			 path[PATH_MAX];
+	const char		*cp;
+	int			 fd;
+
+	cp = strrchr(socket_path, '/');
+	if (cp == NULL)
+		xsnprintf(path, sizeof path, "ring-XXXXXX");
+	else {
+		xsnprintf(path, sizeof path, "%.*s/ring-XXXXXX",
+		    (int)(cp - socket_path), socket_path);
+	}
+	if ((fd = mkstemp(path)) != -1) {
+		unlink(path);
+		if (ftruncate(fd, sizeof *fr->header + FILE_RING_SIZE) == 0)
+			fr = file_ring_map(fd);
+		if (fr == NULL) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	proc_send(peer, MSG_RING_OPEN, fd, NULL, 0);
+	return (fr);
+}
+
+/* Open a ring passed by the client and push anything waiting (server). */
+void
+file_ring_open(struct client *c, int fd)
+{
+	struct stat	sb;
+
+	if (~c->flags & CLIENT_RINGWAIT) {
+		if (fd != -1)
+			close(fd);
+		return;
+	}
+	c->flags &= ~CLIENT_RINGWAIT;
+
+	if (fd != -1) {
+		if (fstat(fd, &sb) == 0 && sb.st_size == (off_t)
+		    (sizeof (struct file_ring_header) + FILE_RING_SIZE))
+			c->ring = file_ring_map(fd);
+		close(fd);
+	}
+	log_debug("client %p ring %s", c, c->ring == NULL ? "failed" : "open");
+	file_ring_ready(&c->files);
+}
+
+/* Free a ring. */
+void
+file_ring_free(struct file_ring *fr)
+{
+	if (fr != NULL) {
+		munmap(fr->header, sizeof *fr->header + fr->size);
+		free(fr);
+	}
+}
+
+/*
+ * Copy as much data as there is space for into a ring (server). The tail is
+ * set by the client, so returns -1 if it is not possible.
+ */
+static int
+file_ring_put(struct file_ring *fr, const void *data, size_t *sizep)
+{
+	size_t		size = *sizep, space, at, first;
+	uint64_t	tail = fr->header->tail;
+
+	if (tail > fr->offset || fr->offset - tail > fr->size)
+		return (-1);
+	space = fr->size - (fr->offset - tail);
+	if (size > space)
+		*sizep = size = space;
+
+	at = fr->offset % fr->size;
+	first = fr->size - at;
+	if (first > size)
+		first = size;
+	memcpy(fr->data + at, data, first);
+	memcpy(fr->data, (const u_char *)data + first, size - first);
+
+	fr->offset += size;
+	return (0);
+}
+
+/*
+ * Mark the server as waiting for space in a ring. Returns 0 if there is space
+ * after all.
+ */
+static int
+file_ring_wait(struct file_ring *fr)
+{
+	fr->header->waiting = 1;
+	__sync_synchronize();
+	if (fr->offset - fr->header->tail == fr->size)
+		return (1);
+	fr->header->waiting = 0;
+	return (0);
+}
+
+/* Handle a ring ready message, push any files waiting for it (server). */
+void
+file_ring_ready(struct client_files *files)
+{
+	struct client_file	*cf;
+
+	RB_FOREACH(cf, client_files, files) {
+		if (EVBUFFER_LENGTH(cf->buffer) != 0)
+			file_push(cf);
+	}
+}
+
 /* Push event, fired if there is more writing to be done. */
 static void
 file_push_cb(__unused int fd, __unused short events, void *arg)
@@ -444,10 +764,54 @@ file_push(struct client_file *cf)
 	struct msg_write_data	*msg;
 	size_t			 msglen, sent, left;
 	struct msg_write_close	 close;
+	struct msg_write_ring	 ring;
+	struct file_ring	*fr = NULL;
+	int			 waiting = 0, full = 0;
 
-	msg = xmalloc(sizeof *msg);
 	left = EVBUFFER_LENGTH(cf->buffer);
-	while (left != 0) {
+	if (cf->c != NULL) {
+		if (left >= FILE_RING_MIN && (cf->c->flags & CLIENT_RING)) {
+			proc_send(cf->peer, MSG_RING_OPEN, -1, NULL, 0);
+			cf->c->flags &= ~CLIENT_RING;
+			cf->c->flags |= CLIENT_RINGWAIT;
+		}
+		if (left != 0 && (cf->c->flags & CLIENT_RINGWAIT))
+			waiting = 1;
+		fr = cf->c->ring;
+	}
+
+	msg = xmalloc(sizeof *msg);
+	while (!waiting && left != 0) {
+		if (fr != NULL) {
+			sent = left;
+			if (file_ring_put(fr, EVBUFFER_DATA(cf->buffer),
+			    &sent) != 0) {
+				log_debug("client %p bad ring tail", cf->c);
+				file_ring_free(fr);
+				fr = cf->c->ring = NULL;
+				continue;
+			}
+			if (sent == 0) {
+				if (file_ring_wait(fr)) {
+					waiting = 1;
+					break;
+				}
+				continue;
+			}
+			ring.stream = cf->stream;
+			ring.size = sent;
+			if (proc_send(cf->peer, MSG_WRITE_RING, -1, &ring,
+			    sizeof ring) != 0)
+				break;
+			evbuffer_drain(cf->buffer, sent);
+			left = EVBUFFER_LENGTH(cf->buffer);
+			continue;
+		}
+
+		if (proc_queued(cf->peer) >= FILE_QUEUE_MAX) {
+			full = 1;
+			break;
+		}
 		sent = left;
 		if (sent > MAX_IMSGSIZE - IMSG_HEADER_SIZE - sizeof *msg)
 			sent = MAX_IMSGSIZE - IMSG_HEADER_SIZE - sizeof *msg;
@@ -463,9 +827,17 @@ file_push(struct client_file *cf)
 		left = EVBUFFER_LENGTH(cf->buffer);
 		log_debug("file %d sent %zu, left %zu", cf->stream, sent, left);
 	}
-	if (left != 0) {
+	if (waiting)
+		log_debug("file %d waiting for ring, left %zu", cf->stream,
+		    left);
+	else if (left != 0) {
+		if (full) {
+			log_debug("file %d queue full, left %zu", cf->stream,
+			    left);
+		}
 		cf->references++;
-		event_once(-1, EV_TIMEOUT, file_push_cb, cf, NULL);
+		event_once(-1, EV_TIMEOUT, file_push_cb, cf,
+		    full ? &file_queue_wait : NULL);
 	} else if (cf->stream > 2) {
 		close.stream = cf->stream;
 		proc_send(cf->peer, MSG_WRITE_CLOSE, -1, &close, sizeof close);
@@ -583,6 +955,22 @@ file_write_open(struct client_files *files, struct tmuxpeer *peer,
 		goto reply;
 	}
 
+	/*
+	 * If this is a regular file, pass it to the server to write directly
+	 * rather than have the data sent back a piece at a time. The stream
+	 * is kept without an fd so the close message is still expected.
+	 */
+	if (msg->fd == -1 && file_is_regular(cf->fd)) {
+		reply.stream = msg->stream;
+		reply.error = 0;
+		log_debug("pass write file %d fd %d", msg->stream, cf->fd);
+		if (proc_send(peer, MSG_WRITE_READY, cf->fd, &reply,
+		    sizeof reply) != 0)
+			close(cf->fd);
+		cf->fd = -1;
+		return;
+	}
+
 	cf->event = bufferevent_new(cf->fd, NULL, file_write_callback,
 	    file_write_error_callback, cf);
 	bufferevent_enable(cf->event, EV_WRITE);
@@ -614,6 +1002,45 @@ file_write_data(struct client_files *files, struct imsg *imsg)
 		bufferevent_write(cf->event, msg + 1, size);
 }
 
+/* Handle a file write ring message (client). */
+void
+file_write_ring(struct client_files *files, struct file_ring *fr,
+    struct imsg *imsg)
+{
+	struct msg_write_ring	*msg = imsg->data;
+	size_t			 msglen = imsg->hdr.len - IMSG_HEADER_SIZE;
+	struct client_file	 find, *cf;
+	size_t			 at, first;
+
+	if (msglen != sizeof *msg)
+		fatalx("bad MSG_WRITE_RING size");
+	if (fr == NULL || msg->size > fr->size)
+		fatalx("bad MSG_WRITE_RING");
+	find.stream = msg->stream;
+	if ((cf = RB_FIND(client_files, files, &find)) == NULL)
+		fatalx("unknown stream number");
+	log_debug("write %zu from ring to file %d", msg->size, cf->stream);
+
+	at = fr->offset % fr->size;
+	first = fr->size - at;
+	if (first > msg->size)
+		first = msg->size;
+	if (cf->event != NULL) {
+		bufferevent_write(cf->event, fr->data + at, first);
+		bufferevent_write(cf->event, fr->data, msg->size - first);
+	}
+	fr->offset += msg->size;
+
+	/* Make sure the data is copied before the server can reuse it. */
+	__sync_synchronize();
+	fr->header->tail = fr->offset;
+	__sync_synchronize();
+	if (fr->header->waiting) {
+		fr->header->waiting = 0;
+		proc_send(cf->peer, MSG_RING_READY, -1, NULL, 0);
+	}
+}
+
 /* Handle a file write close message (client). */
 void
 file_write_close(struct client_files *files, struct imsg *imsg)
@@ -742,6 +1169,18 @@ file_read_open(struct client_files *files, struct tmuxpeer *peer,
 		goto reply;
 	}
 
+	/* Pass regular files to the server to read directly. */
+	if (msg->fd == -1 && file_is_regular(cf->fd)) {
+		reply.stream = msg->stream;
+		reply.error = 0;
+		log_debug("pass read file %d fd %d", msg->stream, cf->fd);
+		if (proc_send(peer, MSG_READ_DONE, cf->fd, &reply,
+		    sizeof reply) != 0)
+			close(cf->fd);
+		file_free(cf);
+		return;
+	}
+
 	cf->event = bufferevent_new(cf->fd, file_read_callback, NULL,
 	    file_read_error_callback, cf);
 	bufferevent_enable(cf->event, EV_READ);
@@ -764,9 +1203,16 @@ file_write_ready(struct client_files *files, struct imsg *imsg)
 	if (msglen != sizeof *msg)
 		fatalx("bad MSG_WRITE_READY size");
 	find.stream = msg->stream;
-	if ((cf = RB_FIND(client_files, files, &find)) == NULL)
+	if ((cf = RB_FIND(client_files, files, &find)) == NULL) {
+		if (imsg->fd != -1)
+			close(imsg->fd);
 		return;
-	if (msg->error != 0) {
+	}
+	if (imsg->fd != -1) {
+		cf->fd = imsg->fd;
+		cf->references++;
+		file_write_fd_cb(-1, 0, cf);
+	} else if (msg->error != 0) {
 		cf->error = msg->error;
 		file_fire_done(cf);
 	} else
@@ -810,10 +1256,21 @@ file_read_done(struct client_files *files, struct imsg *imsg)
 	if (msglen != sizeof *msg)
 		fatalx("bad MSG_READ_DONE size");
 	find.stream = msg->stream;
-	if ((cf = RB_FIND(client_files, files, &find)) == NULL)
+	if ((cf = RB_FIND(client_files, files, &find)) == NULL) {
+		if (imsg->fd != -1)
+			close(imsg->fd);
 		return;
+	}
 
 	log_debug("file %d read done", cf->stream);
 	cf->error = msg->error;
+	if (imsg->fd != -1 && cf->error == 0) {
+		cf->fd = imsg->fd;
+		cf->references++;
+		file_read_fd_cb(-1, 0, cf);
+		return;
+	}
+	if (imsg->fd != -1)
+		close(imsg->fd);
 	file_fire_done(cf);
 }
@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define XMALLOC_TAG XMALLOC_FORMAT
 #include "tmux.h"
 
 /* Format range. */
@@ -644,6 +645,206 @@ format_draw_many(struct screen_write_ctx *ctx, struct style *sy, char ch,
 		screen_write_cell(ctx, &sy->gc);
 }
 
+/* Type of a token in an expanded format. */
+enum format_token_type {
+	FORMAT_TOKEN_CHARACTER,	/* single printable character */
+	FORMAT_TOKEN_HASHES,	/* sequence of # not followed by [ */
+	FORMAT_TOKEN_ESCAPED,	/* sequence of ## before [ */
+	FORMAT_TOKEN_STYLE	/* #[...] */
+};
+
+/* Token in an expanded format. */
+struct format_token {
+	enum format_token_type	 type;
+	u_int			 offset;
+	u_int			 size;
+	u_int			 width;
+};
+
+/*
+ * Expanded format split into tokens. This is kept for the last string so that
+ * measuring, trimming and drawing the same string only walk it once.
+ */
+struct format_tokens {
+	char			*expanded;
+	char			*styles; /* copy with styles terminated */
+
+	struct format_token	*list;
+	u_int			 n;
+
+	u_int			 width;
+	int			 invalid;	/* missing ] */
+};
+static struct format_tokens format_tokens;
+
+/* Add a token. */
+static void
+format_add_token(struct format_tokens *fts, enum format_token_type type,
+    u_int offset, u_int size, u_int width)
+{
+	struct format_token	*tok = &fts->list[fts->n++];
+
+	tok->type = type;
+	tok->offset = offset;
+	tok->size = size;
+	tok->width = width;
+
+	fts->width += width;
+}
+
+/* Split an expanded format into tokens, reusing the last if it is the same. */
+static struct format_tokens *
+format_get_tokens(const char *expanded)
+{
+	struct format_tokens	*fts = &format_tokens;
+	const char		*cp = expanded, *end;
+	size_t			 size;
+	u_int			 n, offset;
+	struct utf8_data	 ud;
+	enum utf8_state		 more;
+
+	if (fts->expanded != NULL && strcmp(fts->expanded, expanded) == 0)
+		return (fts);
+
+	free(fts->expanded);
+	fts->expanded = xstrdup(expanded);
+	free(fts->styles);
+	fts->styles = xstrdup(expanded);
+
+	size = strlen(expanded);
+	fts->list = xreallocarray(fts->list, size + 1, sizeof *fts->list);
+	fts->n = 0;
+	fts->width = 0;
+	fts->invalid = 0;
+
+	while (*cp != '\0') {
+		offset = cp - expanded;
+		if (*cp == '#') {
+			for (n = 1; cp[n] == '#'; n++)
+				/* nothing */;
+			if (cp[n] != '[') {
+				format_add_token(fts, FORMAT_TOKEN_HASHES,
+				    offset, n, n);
+				cp += n;
+				continue;
+			}
+
+			/*
+			 * An even number of #s means that all #s are escaped,
+			 * so not a style. Otherwise the last starts a style.
+			 */
+			if ((n % 2) == 0) {
+				format_add_token(fts, FORMAT_TOKEN_ESCAPED,
+				    offset, n + 1, (n / 2) + 1);
+				cp += (n + 1);
+				continue;
+			}
+			if (n != 1) {
+				format_add_token(fts, FORMAT_TOKEN_ESCAPED,
+				    offset, n - 1, n / 2);
+				cp += (n - 1);
+			}
+
+			end = format_skip(cp + 2, "]");
+			if (end == NULL) {
+				log_debug("%s: no terminating ] at '%s'",
+				    __func__, cp + 2);
+				fts->invalid = 1;
+				break;
+			}
+			fts->styles[end - expanded] = '\0';
+			format_add_token(fts, FORMAT_TOKEN_STYLE,
+			    cp - expanded, end + 1 - cp, 0);
+			cp = end + 1;
+		} else if ((more = utf8_open(&ud, *cp)) == UTF8_MORE) {
+			while (*++cp != '\0' && more == UTF8_MORE)
+				more = utf8_append(&ud, *cp);
+			if (more == UTF8_DONE) {
+				format_add_token(fts, FORMAT_TOKEN_CHARACTER,
+				    offset, ud.size, ud.width);
+			} else
+				cp = expanded + offset + 1;
+		} else {
+			/* Ignore nonprintable characters. */
+			if (*cp > 0x1f && *cp < 0x7f) {
+				format_add_token(fts, FORMAT_TOKEN_CHARACTER,
+				    offset, 1, 1);
+			}
+			cp++;
+		}
+	}
+	return (fts);
+}
+
+/* Draw a character token. */
+static void
+format_draw_token(struct screen_write_ctx *ctx, struct style *sy,
+    const char *expanded, struct format_token *tok)
+{
+	struct utf8_data	*ud = &sy->gc.data;
+
+	memset(ud, 0, sizeof *ud);
+	memcpy(ud->data, expanded + tok->offset, tok->size);
+	ud->have = ud->size = tok->size;
+	ud->width = tok->width;
+	screen_write_cell(ctx, &sy->gc);
+}
+
+/*
+ * Draw the remainder of a format once styles are ignored. There is no way to
+ * stop ignoring them, so this carries on to the end of the string.
+ */
+static u_int
+format_draw_ignored(struct screen_write_ctx *ctx, struct style *sy,
+    const char *cp)
+{
+	struct utf8_data	*ud = &sy->gc.data;
+	enum utf8_state		 more;
+	u_int			 n, width = 0;
+
+	while (*cp != '\0') {
+		/* Handle sequences of #. */
+		if (cp[0] == '#' && cp[1] != '[' && cp[1] != '\0') {
+			for (n = 1; cp[n] == '#'; n++)
+				 /* nothing */;
+			if (cp[n] != '[') {
+				cp += n;
+				n = (n + 1) / 2;
+				width += n;
+				format_draw_many(ctx, sy, '#', n);
+			} else if ((n % 2) == 0)
+				cp += (n + 1);
+			else
+				cp += (n - 1);
+			continue;
+		}
+
+		/* See if this is a UTF-8 character. */
+		if ((more = utf8_open(ud, *cp)) == UTF8_MORE) {
+			while (*++cp != '\0' && more == UTF8_MORE)
+				more = utf8_append(ud, *cp);
+			if (more != UTF8_DONE)
+				cp -= ud->have;
+		}
+
+		/* Not a UTF-8 character - ASCII or not valid. */
+		if (more != UTF8_DONE) {
+			if (*cp < 0x20 || *cp > 0x7e) {
+				/* Ignore nonprintable characters. */
+				cp++;
+				continue;
+			}
+			utf8_set(ud, *cp);
+			cp++;
+		}
+
+		/* Draw the cell to the current screen. */
+		screen_write_cell(ctx, &sy->gc);
+		width += ud->width;
+	}
+	return (width);
+}
+
 /* Draw a format to a screen. */
 void
 format_draw(struct screen_write_ctx *octx, const struct grid_cell *base,
@@ -669,20 +870,21 @@ format_draw(struct screen_write_ctx *octx, const struct grid_cell *base,
 	size_t			 size = strlen(expanded);
 	struct screen		*os = octx->s, s[TOTAL];
 	struct screen_write_ctx	 ctx[TOTAL];
-	u_int			 ocx = os->cx, ocy = os->cy, n, i, width[TOTAL];
+	u_int			 ocx = os->cx, ocy = os->cy, n, i, t;
+	u_int			 width[TOTAL];
 	u_int			 map[] = { LEFT,
 					   LEFT,
 					   CENTRE,
 					   RIGHT,
 					   ABSOLUTE_CENTRE };
 	int			 focus_start = -1, focus_end = -1;
-	int			 list_state = -1, fill = -1, even;
+	int			 list_state = -1, fill = -1;
 	enum style_align	 list_align = STYLE_ALIGN_DEFAULT;
 	struct grid_cell	 gc, current_default;
 	struct style		 sy, saved_sy;
 	struct utf8_data	*ud = &sy.gc.data;
-	const char		*cp, *end;
-	enum utf8_state		 more;
+	struct format_tokens	*fts;
+	struct format_token	*tok;
 	char			*tmp;
 	struct format_range	*fr = NULL, *fr1;
 	struct format_ranges	 frs;
@@ -706,89 +908,45 @@ format_draw(struct screen_write_ctx *octx, const struct grid_cell *base,
 	}
 
 	/*
-	 * Walk the string and add to the corresponding screens,
-	 * parsing styles as we go.
+	 * Walk the tokens and add to the corresponding screens, parsing styles
+	 * as we go.
 	 */
-	cp = expanded;
-	while (*cp != '\0') {
-		/* Handle sequences of #. */
-		if (cp[0] == '#' && cp[1] != '[' && cp[1] != '\0') {
-			for (n = 1; cp[n] == '#'; n++)
-				 /* nothing */;
-			even = ((n % 2) == 0);
-			if (cp[n] != '[') {
-				cp += n;
-				if (even)
-					n = (n / 2);
-				else
-					n = (n / 2) + 1;
-				width[current] += n;
-				format_draw_many(&ctx[current], &sy, '#', n);
-				continue;
-			}
-			if (even)
-				cp += (n + 1);
-			else
-				cp += (n - 1);
-			if (sy.ignore)
-				continue;
-			format_draw_many(&ctx[current], &sy, '#', n / 2);
-			width[current] += (n / 2);
-			if (even) {
+	fts = format_get_tokens(expanded);
+	for (t = 0; t < fts->n; t++) {
+		tok = &fts->list[t];
+		switch (tok->type) {
+		case FORMAT_TOKEN_CHARACTER:
+			format_draw_token(&ctx[current], &sy, expanded, tok);
+			width[current] += tok->width;
+			continue;
+		case FORMAT_TOKEN_HASHES:
+			n = (tok->size + 1) / 2;
+			format_draw_many(&ctx[current], &sy, '#', n);
+			width[current] += n;
+			continue;
+		case FORMAT_TOKEN_ESCAPED:
+			n = tok->size / 2;
+			format_draw_many(&ctx[current], &sy, '#', n);
+			width[current] += n;
+			if (tok->size % 2) {
 				utf8_set(ud, '[');
 				screen_write_cell(&ctx[current], &sy.gc);
 				width[current]++;
 			}
 			continue;
+		case FORMAT_TOKEN_STYLE:
+			break;
 		}
 
-		/* Is this not a style? */
-		if (cp[0] != '#' || cp[1] != '[' || sy.ignore) {
-			/* See if this is a UTF-8 character. */
-			if ((more = utf8_open(ud, *cp)) == UTF8_MORE) {
-				while (*++cp != '\0' && more == UTF8_MORE)
-					more = utf8_append(ud, *cp);
-				if (more != UTF8_DONE)
-					cp -= ud->have;
-			}
-
-			/* Not a UTF-8 character - ASCII or not valid. */
-			if (more != UTF8_DONE) {
-				if (*cp < 0x20 || *cp > 0x7e) {
-					/* Ignore nonprintable characters. */
-					cp++;
-					continue;
-				}
-				utf8_set(ud, *cp);
-				cp++;
-			}
-
-			/* Draw the cell to the current screen. */
-			screen_write_cell(&ctx[current], &sy.gc);
-			width[current] += ud->width;
-			continue;
-		}
-
-		/* This is a style. Work out where the end is and parse it. */
-		end = format_skip(cp + 2, "]");
-		if (end == NULL) {
-			log_debug("%s: no terminating ] at '%s'", __func__,
-			    cp + 2);
-			TAILQ_FOREACH_SAFE(fr, &frs, entry, fr1)
-			    format_free_range(&frs, fr);
-			goto out;
-		}
-		tmp = xstrndup(cp + 2, end - (cp + 2));
+		/* This is a style, parse it. */
+		tmp = fts->styles + tok->offset + 2;
 		style_copy(&saved_sy, &sy);
 		if (style_parse(&sy, &current_default, tmp) != 0) {
 			log_debug("%s: invalid style '%s'", __func__, tmp);
-			free(tmp);
-			cp = end + 1;
 			continue;
 		}
 		log_debug("%s: style '%s' -> '%s'", __func__, tmp,
 		    style_tostring(&sy));
-		free(tmp);
 
 		/* If this style has a fill colour, store it for later. */
 		if (sy.fill != 8)
@@ -910,9 +1068,19 @@ format_draw(struct screen_write_ctx *octx, const struct grid_cell *base,
 			}
 		}
 
-		cp = end + 1;
+		/* If styles are now ignored, draw the rest as it is. */
+		if (sy.ignore) {
+			width[current] += format_draw_ignored(&ctx[current],
+			    &sy, expanded + tok->offset + tok->size);
+			break;
+		}
 	}
 	free(fr);
+	if (fts->invalid && !sy.ignore) {
+		TAILQ_FOREACH_SAFE(fr, &frs, entry, fr1)
+		    format_free_range(&frs, fr);
+		goto out;
+	}
 
 	for (i = 0; i < TOTAL; i++) {
 		screen_write_stop(&ctx[i]);
@@ -1001,52 +1169,11 @@ out:
 u_int
 format_width(const char *expanded)
 {
-	const char		*cp, *end;
-	u_int			 n, width = 0;
-	struct utf8_data	 ud;
-	enum utf8_state		 more;
-
-	cp = expanded;
-	while (*cp != '\0') {
-		if (*cp == '#') {
-			for (n = 1; cp[n] == '#'; n++)
-				/* nothing */;
-			if (cp[n] != '[') {
-				width += n;
-				cp += n;
-				continue;
-			}
-			width += (n / 2); /* one for each ## */
+	struct format_tokens	*fts = format_get_tokens(expanded);
 
-			if ((n % 2) == 0) {
-				/*
-				 * An even number of #s means that all #s are
-				 * escaped, so not a style.
-				 */
-				width++; /* one for the [ */
-				cp += (n + 1);
-				continue;
-			}
-			cp += (n - 1); /* point to the [ */
-
-			end = format_skip(cp + 2, "]");
-			if (end == NULL)
-				return (0);
-			cp = end + 1;
-		} else if ((more = utf8_open(&ud, *cp)) == UTF8_MORE) {
-			while (*++cp != '\0' && more == UTF8_MORE)
-				more = utf8_append(&ud, *cp);
-			if (more == UTF8_DONE)
-				width += ud.width;
-			else
-				cp -= ud.have;
-		} else if (*cp > 0x1f && *cp < 0x7f) {
-			width++;
-			cp++;
-		} else
-			cp++;
-	}
-	return (width);
+	if (fts->invalid)
+		return (0);
+	return (fts->width);
 }
 
 /*
@@ -1057,75 +1184,61 @@ format_width(const char *expanded)
 char *
 format_trim_left(const char *expanded, u_int limit)
 {
+	struct format_tokens	*fts = format_get_tokens(expanded);
+	struct format_token	*tok;
 	char			*copy, *out;
-	const char		*cp = expanded, *end;
-	u_int			 even, n, width = 0;
-	struct utf8_data	 ud;
-	enum utf8_state		 more;
+	const char		*cp;
+	u_int			 t, n, width = 0;
 
 	out = copy = xcalloc(1, strlen(expanded) + 1);
-	while (*cp != '\0') {
+	for (t = 0; t < fts->n; t++) {
 		if (width >= limit)
 			break;
-		if (*cp == '#') {
-			for (end = cp + 1; *end == '#'; end++)
-				/* nothing */;
-			n = end - cp;
-			if (*end != '[') {
-				if (n > limit - width)
-					n = limit - width;
-				memcpy(out, cp, n);
-				out += n;
-				width += n;
-				cp = end;
-				continue;
+		tok = &fts->list[t];
+		cp = expanded + tok->offset;
+		switch (tok->type) {
+		case FORMAT_TOKEN_CHARACTER:
+			if (width + tok->width <= limit) {
+				memcpy(out, cp, tok->size);
+				out += tok->size;
 			}
-			even = ((n % 2) == 0);
-
-			n /= 2;
+			width += tok->width;
+			break;
+		case FORMAT_TOKEN_HASHES:
+			n = tok->size;
 			if (n > limit - width)
 				n = limit - width;
-			width += n;
-			n *= 2;
 			memcpy(out, cp, n);
 			out += n;
+			width += n;
+			break;
+		case FORMAT_TOKEN_ESCAPED:
+			n = tok->size / 2;
+			if (n > limit - width)
+				n = limit - width;
+			width += n;
+			memcpy(out, cp, n * 2);
+			out += (n * 2);
 
-			if (even) {
+			if (tok->size % 2) {
 				if (width + 1 <= limit) {
 					*out++ = '[';
 					width++;
 				}
-				cp = end + 1;
-				continue;
+				break;
 			}
-			cp = end - 1;
 
-			end = format_skip(cp + 2, "]");
-			if (end == NULL)
+			/* Keep the style these #s come before. */
+			if (t + 1 == fts->n)
 				break;
-			memcpy(out, cp, end + 1 - cp);
-			out += (end + 1 - cp);
-			cp = end + 1;
-		} else if ((more = utf8_open(&ud, *cp)) == UTF8_MORE) {
-			while (*++cp != '\0' && more == UTF8_MORE)
-				more = utf8_append(&ud, *cp);
-			if (more == UTF8_DONE) {
-				if (width + ud.width <= limit) {
-					memcpy(out, ud.data, ud.size);
-					out += ud.size;
-				}
-				width += ud.width;
-			} else {
-				cp -= ud.have;
-				cp++;
-			}
-		} else if (*cp > 0x1f && *cp < 0x7f) {
-			if (width + 1 <= limit)
-				*out++ = *cp;
-			width++;
-			cp++;
-		} else
-			cp++;
+			tok = &fts->list[++t];
+			cp = expanded + tok->offset;
+			/* FALLTHROUGH */
+		case FORMAT_TOKEN_STYLE:
+			memcpy(out, cp, tok->size);
+			out += tok->size;
+			break;
+		}
 	}
 	*out = '\0';
 	return (copy);
@@ -1135,11 +1248,11 @@ format_trim_left(const char *expanded, u_int limit)
 char *
 format_trim_right(const char *expanded, u_int limit)
 {
+	struct format_tokens	*fts = format_get_tokens(expanded);
+	struct format_token	*tok;
 	char			*copy, *out;
-	const char		*cp = expanded, *end;
-	u_int			 width = 0, total_width, skip, old_n, even, n;
-	struct utf8_data	 ud;
-	enum utf8_state		 more;
+	const char		*cp;
+	u_int			 t, width = 0, total_width, skip, n;
 
 	total_width = format_width(expanded);
 	if (total_width <= limit)
@@ -1147,86 +1260,55 @@ format_trim_right(const char *expanded, u_int limit)
 	skip = total_width - limit;
 
 	out = copy = xcalloc(1, strlen(expanded) + 1);
-	while (*cp != '\0') {
-		if (*cp == '#') {
-			for (end = cp + 1; *end == '#'; end++)
-				/* nothing */;
-			old_n = n = end - cp;
-			if (*end != '[') {
-				if (width <= skip) {
-					if (skip - width >= n)
-						n = 0;
-					else
-						n -= (skip - width);
-				}
-				if (n != 0) {
-					memcpy(out, cp, n);
-					out += n;
-				}
-
-				/*
-				 * The width always increases by the full
-				 * amount even if we can't copy anything yet.
-				 */
-				width += old_n;
-				cp = end;
-				continue;
+	for (t = 0; t < fts->n; t++) {
+		tok = &fts->list[t];
+		cp = expanded + tok->offset;
+		switch (tok->type) {
+		case FORMAT_TOKEN_CHARACTER:
+			if (width >= skip) {
+				memcpy(out, cp, tok->size);
+				out += tok->size;
 			}
-			even = ((n % 2) == 0);
-
-			n /= 2;
+			width += tok->width;
+			break;
+		case FORMAT_TOKEN_HASHES:
+		case FORMAT_TOKEN_ESCAPED:
+			if (tok->type == FORMAT_TOKEN_HASHES)
+				n = tok->size;
+			else
+				n = tok->size / 2;
 			if (width <= skip) {
 				if (skip - width >= n)
 					n = 0;
 				else
 					n -= (skip - width);
 			}
-			if (n != 0) {
-				/*
-				 * Copy the full amount because it hasn't been
-				 * escaped yet.
-				 */
-				memcpy(out, cp, old_n);
-				out += old_n;
+
+			/*
+			 * The width always increases by the full amount even
+			 * if we can't copy anything yet.
+			 */
+			if (tok->type == FORMAT_TOKEN_HASHES) {
+				memcpy(out, cp, n);
+				out += n;
+				width += tok->size;
+				break;
 			}
-			cp += old_n;
-			width += (old_n / 2) - even;
+			memcpy(out, cp, n * 2);
+			out += (n * 2);
+			width += (tok->size / 2);
 
-			if (even) {
-				if (width > skip)
+			if (tok->size % 2) {
+				if (width >= skip)
 					*out++ = '[';
 				width++;
-				continue;
-			}
-			cp = end - 1;
-
-			end = format_skip(cp + 2, "]");
-			if (end == NULL) {
-				break;
-			}
-			memcpy(out, cp, end + 1 - cp);
-			out += (end + 1 - cp);
-			cp = end + 1;
-		} else if ((more = utf8_open(&ud, *cp)) == UTF8_MORE) {
-			while (*++cp != '\0' && more == UTF8_MORE)
-				more = utf8_append(&ud, *cp);
-			if (more == UTF8_DONE) {
-				if (width >= skip) {
-					memcpy(out, ud.data, ud.size);
-					out += ud.size;
-				}
-				width += ud.width;
-			} else {
-				cp -= ud.have;
-				cp++;
 			}
-		} else if (*cp > 0x1f && *cp < 0x7f) {
-			if (width >= skip)
-				*out++ = *cp;
-			width++;
-			cp++;
-		} else
-			cp++;
+			break;
+		case FORMAT_TOKEN_STYLE:
+			memcpy(out, cp, tok->size);
+			out += tok->size;
+			break;
+		}
 	}
 	*out = '\0';
 	return (copy);
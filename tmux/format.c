@@ -31,6 +31,7 @@
 #include <time.h>
 #include <unistd.h>
 
+#define XMALLOC_TAG XMALLOC_FORMAT
 #include "tmux.h"
 
 /*
@@ -52,10 +53,10 @@ static void	 format_defaults_winlink(struct format_tree *,
 
 /* Entry in format job tree. */
 struct format_job {
-	struct client		*client;
-	u_int			 tag;
 	const char		*cmd;
 	const char		*expanded;
+	const char		*cwd;
+	u_int			 ttl;
 
 	time_t			 last;
 	char			*out;
@@ -67,20 +68,38 @@ struct format_job {
 	RB_ENTRY(format_job)	 entry;
 };
 
-/* Format job tree. */
+/*
+ * Format job tree. Jobs are shared by every client and format which runs the
+ * same command in the same directory as often.
+ */
 static int format_job_cmp(struct format_job *, struct format_job *);
 static RB_HEAD(format_job_tree, format_job) format_jobs = RB_INITIALIZER();
 RB_GENERATE_STATIC(format_job_tree, format_job, entry, format_job_cmp);
 
+/* Maximum number of format jobs running at once. */
+#define FORMAT_JOB_LIMIT 16
+
+/*
+ * Most output kept for a format job. Only the last line is used, so this only
+ * matters for a job writing a lot without a newline.
+ */
+#define FORMAT_JOB_OUTPUT 8192
+static u_int format_jobs_running;
+
 /* Format job tree comparison function. */
 static int
 format_job_cmp(struct format_job *fj1, struct format_job *fj2)
 {
-	if (fj1->tag < fj2->tag)
+	int	retval;
+
+	if (fj1->ttl < fj2->ttl)
 		return (-1);
-	if (fj1->tag > fj2->tag)
+	if (fj1->ttl > fj2->ttl)
 		return (1);
-	return (strcmp(fj1->cmd, fj2->cmd));
+	retval = strcmp(fj1->expanded, fj2->expanded);
+	if (retval != 0)
+		return (retval);
+	return (strcmp(fj1->cwd, fj2->cwd));
 }
 
 /* Format modifiers. */
@@ -108,6 +127,12 @@ format_job_cmp(struct format_job *fj1, struct format_job *fj2)
 /* Format expand flags. */
 #define FORMAT_EXPAND_TIME 0x1
 #define FORMAT_EXPAND_NOJOBS 0x2
+#define FORMAT_EXPAND_COMPILE 0x4
+#define FORMAT_EXPAND_DYNAMIC 0x8
+#define FORMAT_EXPAND_PROFILE 0x10
+
+/* Number of compiled formats kept. */
+#define FORMAT_COMPILED_LIMIT 1024
 
 /* Entry in format tree. */
 struct format_entry {
@@ -135,12 +160,19 @@ struct format_tree {
 	struct window		*w;
 	struct window_pane	*wp;
 	struct paste_buffer	*pb;
+	int			 mode;	/* mode formats not yet added */
 
 	struct cmdq_item	*item;
+	struct cmdq_state	*state;	/* formats not copied from item */
 	struct client		*client;
 	int			 flags;
 	u_int			 tag;
 
+	int			 uses;
+	time_t			 time_next;
+	struct format_cache	*record;
+	struct format_profile	*profile;
+
 	struct mouse_event	 m;
 
 	RB_HEAD(format_entry_tree, format_entry) tree;
@@ -148,6 +180,27 @@ struct format_tree {
 static int format_entry_cmp(struct format_entry *, struct format_entry *);
 RB_GENERATE_STATIC(format_entry_tree, format_entry, entry, format_entry_cmp);
 
+/* Variable looked up by an expansion. */
+struct format_lookup {
+	char			*key;
+	int			 modifiers;
+	char			*time_format;
+	char			*value;
+};
+
+/*
+ * Cached expansion and the variables it looked up. It may be used again while
+ * they all have the same values.
+ */
+struct format_cache {
+	char			*fmt;
+	int			 flags;
+	char			*expanded;
+
+	struct format_lookup	*lookups;
+	u_int			 nlookups;
+};
+
 /* Format expand state. */
 struct format_expand_state {
 	struct format_tree	*ft;
@@ -155,6 +208,26 @@ struct format_expand_state {
 	time_t			 time;
 	struct tm		 tm;
 	int			 flags;
+
+	struct format_arena	*arena;
+};
+
+/*
+ * Scratch space for the short-lived strings used while replacing one key,
+ * released in one go when the replacement is finished.
+ */
+#define FORMAT_ARENA_SIZE 1024
+struct format_arena_chunk {
+	struct format_arena_chunk	*prev;
+	size_t				 size;
+	size_t				 used;
+};
+struct format_arena {
+	struct format_arena_chunk	*chunk;
+};
+struct format_arena_mark {
+	struct format_arena_chunk	*chunk;
+	size_t				 used;
 };
 
 /* Format modifier. */
@@ -166,6 +239,122 @@ struct format_modifier {
 	int	  argc;
 };
 
+/* Piece of a compiled format. */
+enum format_piece_type {
+	FORMAT_PIECE_TEXT,
+	FORMAT_PIECE_JOB,
+	FORMAT_PIECE_REPLACE
+};
+struct format_piece {
+	enum format_piece_type	 type;
+
+	size_t			 offset;	/* text in format */
+	size_t			 size;
+
+	char			*key;		/* job or key */
+	const char		*copy;
+	struct format_modifier	*list;
+	u_int			 count;
+	int			 dynamic;
+};
+
+/*
+ * Compiled format. The format is split into pieces once, and the modifiers of
+ * each replacement are built once unless they need to be expanded each time.
+ */
+struct format_compiled {
+	char				*fmt;
+	struct format_piece		*pieces;
+	u_int				 npieces;
+	u_int				 references;
+
+	RB_ENTRY(format_compiled)	 entry;
+	TAILQ_ENTRY(format_compiled)	 lru;
+};
+static int format_compiled_cmp(struct format_compiled *,
+    struct format_compiled *);
+static RB_HEAD(format_compiled_tree, format_compiled) format_compiled =
+    RB_INITIALIZER(&format_compiled);
+RB_GENERATE_STATIC(format_compiled_tree, format_compiled, entry,
+    format_compiled_cmp);
+static TAILQ_HEAD(format_compiled_list, format_compiled) format_compiled_lru =
+    TAILQ_HEAD_INITIALIZER(format_compiled_lru);
+static u_int format_compiled_count;
+
+/* Compiled format tree comparison function. */
+static int
+format_compiled_cmp(struct format_compiled *fc1, struct format_compiled *fc2)
+{
+	return (strcmp(fc1->fmt, fc2->fmt));
+}
+
+/* Number of formats and of variables or modifiers profiled. */
+#define FORMAT_PROFILE_LIMIT 256
+
+/* Profile of the expansions of a format. */
+struct format_profile {
+	char				*fmt;
+
+	u_int				 expansions;
+	uint64_t			 time;
+	u_int				 lookups;
+	uint64_t			 lookup_time;
+	u_int				 callbacks;
+	uint64_t			 callback_time;
+	u_int				 modifiers;
+	uint64_t			 modifier_time;
+	u_int				 jobs;
+	u_int				 allocations;
+
+	RB_ENTRY(format_profile)	 entry;
+};
+static int format_profile_cmp(struct format_profile *,
+    struct format_profile *);
+static RB_HEAD(format_profile_tree, format_profile) format_profiles =
+    RB_INITIALIZER(&format_profiles);
+RB_GENERATE_STATIC(format_profile_tree, format_profile, entry,
+    format_profile_cmp);
+static u_int format_profile_count;
+
+/* Profile of a variable or a set of modifiers in any format. */
+struct format_profile_key {
+	char				*key;
+	int				 modifier;
+
+	u_int				 count;
+	uint64_t			 time;
+	u_int				 callbacks;
+
+	RB_ENTRY(format_profile_key)	 entry;
+};
+static int format_profile_key_cmp(struct format_profile_key *,
+    struct format_profile_key *);
+static RB_HEAD(format_profile_key_tree, format_profile_key)
+    format_profile_keys = RB_INITIALIZER(&format_profile_keys);
+RB_GENERATE_STATIC(format_profile_key_tree, format_profile_key, entry,
+    format_profile_key_cmp);
+static u_int format_profile_key_count;
+
+/* Whether expansions are being profiled. */
+static int format_profiling;
+
+/* Format profile tree comparison function. */
+static int
+format_profile_cmp(struct format_profile *fp1, struct format_profile *fp2)
+{
+	return (strcmp(fp1->fmt, fp2->fmt));
+}
+
+/* Format profile key tree comparison function. */
+static int
+format_profile_key_cmp(struct format_profile_key *fk1,
+    struct format_profile_key *fk2)
+{
+	if (fk1->modifier != fk2->modifier)
+		return (fk1->modifier - fk2->modifier);
+	return (strcmp(fk1->key, fk2->key));
+}
+
 /* Format entry tree comparison function. */
 static int
 format_entry_cmp(struct format_entry *fe1, struct format_entry *fe2)
@@ -233,6 +422,51 @@ static const char *format_lower[] = {
 	NULL		/* z */
 };
 
+/*
+ * Variables which only change together with something that redraws the status
+ * line, so a status line using them does not need to be regularly updated.
+ */
+static const char *format_stable[] = {
+	"client_height",
+	"client_key_table",
+	"client_prefix",
+	"client_width",
+	"host",
+	"host_short",
+	"pane_active",
+	"pane_height",
+	"pane_id",
+	"pane_index",
+	"pane_title",
+	"pane_width",
+	"pid",
+	"session_id",
+	"session_name",
+	"session_windows",
+	"socket_path",
+	"version",
+	"window_active",
+	"window_activity_flag",
+	"window_bell_flag",
+	"window_bigger",
+	"window_end_flag",
+	"window_flags",
+	"window_height",
+	"window_id",
+	"window_index",
+	"window_last_flag",
+	"window_marked_flag",
+	"window_name",
+	"window_offset_x",
+	"window_offset_y",
+	"window_panes",
+	"window_raw_flags",
+	"window_silence_flag",
+	"window_start_flag",
+	"window_width",
+	"window_zoomed_flag"
+};
+
 /* Is logging enabled? */
 static inline int
 format_logging(struct format_tree *ft)
@@ -265,6 +499,117 @@ format_log1(struct format_expand_state *es, const char *from, const char *fmt,
 }
 #define format_log(es, fmt, ...) format_log1(es, __func__, fmt, ##__VA_ARGS__)
 
+/* Record when the time used in a format will next change. */
+static void
+format_add_time(struct format_tree *ft, time_t next)
+{
+	if (next == 0)
+		return;
+	ft->uses |= FORMAT_USES_TIME;
+	if (ft->time_next == 0 || next < ft->time_next)
+		ft->time_next = next;
+}
+
+/* Add what was used by a format tree for a loop to its parent. */
+static void
+format_add_uses(struct format_tree *ft, struct format_tree *from)
+{
+	ft->uses |= (from->uses & ~FORMAT_USES_TIME);
+	if (from->uses & FORMAT_USES_TIME)
+		format_add_time(ft, from->time_next);
+}
+
+/*
+ * Work out when the result of passing a format through strftime(3) will next
+ * change, from the shortest period of any conversion it contains. Returns 0 if
+ * the result does not depend on the time.
+ */
+static time_t
+format_time_next(const char *fmt, time_t t, struct tm *tm)
+{
+	const char	*cp = fmt;
+	time_t		 period = 0, size, elapsed;
+
+	while ((cp = strchr(cp, '%')) != NULL) {
+		cp++;
+		if (*cp == 'E' || *cp == 'O')
+			cp++;
+		switch (*cp) {
+		case '\0':
+			continue;
+		case '%':
+		case 'n':
+		case 't':
+		case 'z':
+		case 'Z':
+			size = 0;
+			break;
+		case 'M':
+		case 'R':
+			size = 60;
+			break;
+		case 'H':
+		case 'I':
+		case 'k':
+		case 'l':
+		case 'p':
+		case 'P':
+			size = 3600;
+			break;
+		case 'a':
+		case 'A':
+		case 'b':
+		case 'B':
+		case 'C':
+		case 'd':
+		case 'D':
+		case 'e':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'h':
+		case 'j':
+		case 'm':
+		case 'u':
+		case 'U':
+		case 'V':
+		case 'w':
+		case 'W':
+		case 'x':
+		case 'y':
+		case 'Y':
+			size = 86400;
+			break;
+		default:
+			size = 1;
+			break;
+		}
+		if (size != 0 && (period == 0 || size < period))
+			period = size;
+		cp++;
+	}
+
+	switch (period) {
+	case 0:
+		return (0);
+	case 60:
+		elapsed = tm->tm_sec;
+		break;
+	case 3600:
+		elapsed = tm->tm_min * 60 + tm->tm_sec;
+		break;
+	case 86400:
+		elapsed = tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec;
+		break;
+	default:
+		elapsed = 0;
+		break;
+	}
+	if (elapsed >= period)
+		elapsed = period - 1;
+	return (t + period - elapsed);
+}
+
 /* Copy expand state. */
 static void
 format_copy_state(struct format_expand_state *to,
@@ -275,6 +620,269 @@ format_copy_state(struct format_expand_state *to,
 	to->time = from->time;
 	memcpy(&to->tm, &from->tm, sizeof to->tm);
 	to->flags = from->flags|flags;
+	to->arena = from->arena;
+}
+
+/* Copy a string into the expansion arena. */
+static char *
+format_arena_strndup(struct format_expand_state *es, const char *s, size_t n)
+{
+	struct format_arena		*fa = es->arena;
+	struct format_arena_chunk	*chunk = fa->chunk;
+	size_t				 size;
+	char				*cp;
+
+	if (chunk == NULL || chunk->size - chunk->used < n + 1) {
+		size = FORMAT_ARENA_SIZE;
+		if (size < n + 1)
+			size = n + 1;
+		chunk = xmalloc(sizeof *chunk + size);
+		chunk->prev = fa->chunk;
+		chunk->size = size;
+		chunk->used = 0;
+		fa->chunk = chunk;
+	}
+	cp = (char *)(chunk + 1) + chunk->used;
+	memcpy(cp, s, n);
+	cp[n] = '\0';
+	chunk->used += n + 1;
+	return (cp);
+}
+
+/* Remember the current position in the expansion arena. */
+static void
+format_arena_save(struct format_expand_state *es,
+    struct format_arena_mark *mark)
+{
+	mark->chunk = es->arena->chunk;
+	if (mark->chunk != NULL)
+		mark->used = mark->chunk->used;
+	else
+		mark->used = 0;
+}
+
+/* Release everything allocated from the arena since a mark. */
+static void
+format_arena_release(struct format_expand_state *es,
+    struct format_arena_mark *mark)
+{
+	struct format_arena		*fa = es->arena;
+	struct format_arena_chunk	*chunk;
+
+	while (fa->chunk != mark->chunk) {
+		chunk = fa->chunk->prev;
+		free(fa->chunk);
+		fa->chunk = chunk;
+	}
+	if (fa->chunk != NULL)
+		fa->chunk->used = mark->used;
+}
+
+/* Free all format profiles. */
+static void
+format_profile_free(void)
+{
+	struct format_profile		*fpr, *fpr1;
+	struct format_profile_key	*fk, *fk1;
+
+	RB_FOREACH_SAFE(fpr, format_profile_tree, &format_profiles, fpr1) {
+		RB_REMOVE(format_profile_tree, &format_profiles, fpr);
+		free(fpr->fmt);
+		free(fpr);
+	}
+	format_profile_count = 0;
+
+	RB_FOREACH_SAFE(fk, format_profile_key_tree, &format_profile_keys,
+	    fk1) {
+		RB_REMOVE(format_profile_key_tree, &format_profile_keys, fk);
+		free(fk->key);
+		free(fk);
+	}
+	format_profile_key_count = 0;
+}
+
+/* Turn profiling on or off. Turning it off discards what was recorded. */
+void
+format_set_profile(int on)
+{
+	if (!on)
+		format_profile_free();
+	format_profiling = on;
+}
+
+/* Get the profile of a format, creating it if there is room. */
+static struct format_profile *
+format_profile_get(const char *fmt)
+{
+	struct format_profile	*fpr, find;
+
+	find.fmt = (char *)fmt;
+	fpr = RB_FIND(format_profile_tree, &format_profiles, &find);
+	if (fpr != NULL)
+		return (fpr);
+	if (format_profile_count == FORMAT_PROFILE_LIMIT)
+		return (NULL);
+
+	fpr = xcalloc(1, sizeof *fpr);
+	fpr->fmt = xstrdup(fmt);
+	RB_INSERT(format_profile_tree, &format_profiles, fpr);
+	format_profile_count++;
+	return (fpr);
+}
+
+/* Get the profile of a variable or modifiers, creating it if there is room. */
+static struct format_profile_key *
+format_profile_get_key(const char *key, int modifier)
+{
+	struct format_profile_key	*fk, find;
+
+	find.key = (char *)key;
+	find.modifier = modifier;
+	fk = RB_FIND(format_profile_key_tree, &format_profile_keys, &find);
+	if (fk != NULL)
+		return (fk);
+	if (format_profile_key_count == FORMAT_PROFILE_LIMIT)
+		return (NULL);
+
+	fk = xcalloc(1, sizeof *fk);
+	fk->key = xstrdup(key);
+	fk->modifier = modifier;
+	RB_INSERT(format_profile_key_tree, &format_profile_keys, fk);
+	format_profile_key_count++;
+	return (fk);
+}
+
+/* Record a variable lookup. */
+static void
+format_profile_lookup(struct format_tree *ft, const char *key, uint64_t start)
+{
+	struct format_profile_key	*fk;
+	uint64_t			 t = get_timer_usec() - start;
+
+	ft->profile->lookups++;
+	ft->profile->lookup_time += t;
+	if ((fk = format_profile_get_key(key, 0)) != NULL) {
+		fk->count++;
+		fk->time += t;
+	}
+}
+
+/* Record a callback. */
+static void
+format_profile_callback(struct format_tree *ft, const char *key,
+    uint64_t start)
+{
+	struct format_profile_key	*fk;
+
+	ft->profile->callbacks++;
+	ft->profile->callback_time += get_timer_usec() - start;
+	if ((fk = format_profile_get_key(key, 0)) != NULL)
+		fk->callbacks++;
+}
+
+/* Record a replacement with modifiers. */
+static void
+format_profile_modifiers(struct format_tree *ft,
+    struct format_modifier *list, u_int count, uint64_t start)
+{
+	struct format_profile_key	*fk;
+	uint64_t			 t = get_timer_usec() - start;
+	char				 key[64];
+	u_int				 i;
+
+	ft->profile->modifiers++;
+	ft->profile->modifier_time += t;
+
+	*key = '\0';
+	for (i = 0; i < count; i++) {
+		if (i != 0)
+			strlcat(key, ";", sizeof key);
+		strlcat(key, list[i].modifier, sizeof key);
+	}
+	if ((fk = format_profile_get_key(key, 1)) != NULL) {
+		fk->count++;
+		fk->time += t;
+	}
+}
+
+/* Expand a format and record its profile. */
+static char *
+format_expand_profile(struct format_expand_state *es, const char *fmt)
+{
+	struct format_tree		*ft = es->ft;
+	struct format_profile		*saved = ft->profile, *fpr;
+	struct format_expand_state	 next;
+	uint64_t			 start;
+	char				*expanded;
+
+	if ((fpr = format_profile_get(fmt)) == NULL)
+		return (format_expand1(es, fmt));
+
+	ft->profile = fpr;
+	format_copy_state(&next, es, FORMAT_EXPAND_PROFILE);
+	start = get_timer_usec();
+	expanded = format_expand1(&next, fmt);
+	fpr->time += get_timer_usec() - start;
+	fpr->expansions++;
+	ft->profile = saved;
+	return (expanded);
+}
+
+/* Print format profiles. */
+int
+format_print_profile(struct cmdq_item *item, int blank)
+{
+	struct format_profile		*fpr;
+	struct format_profile_key	*fk;
+	const char			*type;
+
+	if (!format_profiling) {
+		if (blank)
+			cmdq_print(item, "%s", "");
+		cmdq_print(item, "Profiling is off (format-profile option)");
+		return (1);
+	}
+
+	RB_FOREACH(fpr, format_profile_tree, &format_profiles) {
+		if (blank) {
+			cmdq_print(item, "%s", "");
+			blank = 0;
+		}
+		cmdq_print(item, "Format: %s", fpr->fmt);
+		cmdq_print(item, "  %u expansions, %llu us (%llu us each)",
+		    fpr->expansions, (unsigned long long)fpr->time,
+		    (unsigned long long)(fpr->time / fpr->expansions));
+		cmdq_print(item, "  %u lookups, %llu us; %u callbacks, %llu us",
+		    fpr->lookups, (unsigned long long)fpr->lookup_time,
+		    fpr->callbacks, (unsigned long long)fpr->callback_time);
+		cmdq_print(item, "  %u modifiers, %llu us; %u jobs started; "
+		    "%u allocations", fpr->modifiers,
+		    (unsigned long long)fpr->modifier_time, fpr->jobs,
+		    fpr->allocations);
+	}
+	RB_FOREACH(fk, format_profile_key_tree, &format_profile_keys) {
+		if (blank) {
+			cmdq_print(item, "%s", "");
+			blank = 0;
+		}
+		type = (fk->modifier ? "Modifiers" : "Variable");
+		cmdq_print(item, "%s %s: %u times, %llu us, %u callbacks", type,
+		    fk->key, fk->count, (unsigned long long)fk->time,
+		    fk->callbacks);
+	}
+	return (1);
+}
+
+/* Redraw the status line of every client after a job has changed. */
+static void
+format_job_status(void)
+{
+	struct client	*c;
+
+	TAILQ_FOREACH(c, &clients, entry) {
+		if (c->session != NULL)
+			server_status_client(c);
+	}
 }
 
 /* Format job update callback. */
@@ -301,8 +909,7 @@ format_job_update(struct job *job)
 
 	t = time(NULL);
 	if (fj->status && fj->last != t) {
-		if (fj->client != NULL)
-			server_status_client(fj->client);
+		format_job_status();
 		fj->last = t;
 	}
 }
@@ -317,6 +924,7 @@ format_job_complete(struct job *job)
 	size_t			 len;
 
 	fj->job = NULL;
+	format_jobs_running--;
 
 	buf = NULL;
 	if ((line = evbuffer_readline(evb)) == NULL) {
@@ -337,71 +945,122 @@ format_job_complete(struct job *job)
 		free(buf);
 
 	if (fj->status) {
-		if (fj->client != NULL)
-			server_status_client(fj->client);
+		format_job_status();
 		fj->status = 0;
 	}
 }
 
+/* Stop a job if it is running. */
+static void
+format_job_stop(struct format_job *fj)
+{
+	if (fj->job != NULL) {
+		job_free(fj->job);
+		fj->job = NULL;
+		format_jobs_running--;
+	}
+}
+
+/*
+ * Get how long the result of a job may be used for from a prefix such as
+ * 30s: or 5m: in front of the command. Without one, a job is run again once a
+ * second.
+ */
+static u_int
+format_job_ttl(const char **cmd)
+{
+	const char	*cp = *cmd;
+	u_int		 ttl = 0;
+
+	if (*cp < '1' || *cp > '9')
+		return (1);
+	for (; *cp >= '0' && *cp <= '9'; cp++) {
+		ttl = (ttl * 10) + (*cp - '0');
+		if (ttl > 86400)
+			return (1);
+	}
+	switch (*cp++) {
+	case 'h':
+		ttl *= 60;
+		/* FALLTHROUGH */
+	case 'm':
+		ttl *= 60;
+		/* FALLTHROUGH */
+	case 's':
+		break;
+	default:
+		return (1);
+	}
+	if (*cp != ':')
+		return (1);
+	*cmd = cp + 1;
+	return (ttl);
+}
+
 /* Find a job. */
 static char *
 format_job_get(struct format_expand_state *es, const char *cmd)
 {
 	struct format_tree		*ft = es->ft;
-	struct format_job_tree		*jobs;
 	struct format_job		 fj0, *fj;
 	time_t				 t;
 	char				*expanded;
+	const char			*cwd;
+	u_int				 ttl;
 	int				 force;
 	struct format_expand_state	 next;
 
-	if (ft->client == NULL)
-		jobs = &format_jobs;
-	else if (ft->client->jobs != NULL)
-		jobs = ft->client->jobs;
-	else {
-		jobs = ft->client->jobs = xmalloc(sizeof *ft->client->jobs);
-		RB_INIT(jobs);
-	}
-
-	fj0.tag = ft->tag;
-	fj0.cmd = cmd;
-	if ((fj = RB_FIND(format_job_tree, jobs, &fj0)) == NULL) {
-		fj = xcalloc(1, sizeof *fj);
-		fj->client = ft->client;
-		fj->tag = ft->tag;
-		fj->cmd = xstrdup(cmd);
-		fj->expanded = NULL;
-
-		xasprintf(&fj->out, "<'%s' not ready>", fj->cmd);
-
-		RB_INSERT(format_job_tree, jobs, fj);
-	}
+	ttl = format_job_ttl(&cmd);
 
 	format_copy_state(&next, es, FORMAT_EXPAND_NOJOBS);
 	next.flags &= ~FORMAT_EXPAND_TIME;
 
 	expanded = format_expand1(&next, cmd);
-	if (fj->expanded == NULL || strcmp(expanded, fj->expanded) != 0) {
-		free((void *)fj->expanded);
+	cwd = server_client_get_cwd(ft->client, NULL);
+
+	fj0.ttl = ttl;
+	fj0.expanded = expanded;
+	fj0.cwd = cwd;
+	ft->uses |= (FORMAT_USES_STATE|FORMAT_USES_CLIENT|FORMAT_USES_UNKNOWN);
+	if ((fj = RB_FIND(format_job_tree, &format_jobs, &fj0)) == NULL) {
+		fj = xcalloc(1, sizeof *fj);
+		fj->ttl = ttl;
+		fj->cmd = xstrdup(cmd);
 		fj->expanded = xstrdup(expanded);
+		fj->cwd = xstrdup(cwd);
+
+		xasprintf(&fj->out, "<'%s' not ready>", fj->cmd);
+
+		RB_INSERT(format_job_tree, &format_jobs, fj);
 		force = 1;
 	} else
 		force = (ft->flags & FORMAT_FORCE);
 
 	t = time(NULL);
-	if (force && fj->job != NULL)
-	       job_free(fj->job);
-	if (force || (fj->job == NULL && fj->last != t)) {
-		fj->job = job_run(expanded, 0, NULL, NULL,
-		    server_client_get_cwd(ft->client, NULL), format_job_update,
-		    format_job_complete, NULL, fj, JOB_NOWAIT, -1, -1);
-		if (fj->job == NULL) {
-			free(fj->out);
-			xasprintf(&fj->out, "<'%s' didn't start>", fj->cmd);
+	if (force)
+		format_job_stop(fj);
+	if (fj->job == NULL &&
+	    (force || fj->last > t || t - fj->last >= fj->ttl)) {
+		if (format_jobs_running >= FORMAT_JOB_LIMIT) {
+			log_debug("%s: too many jobs, not starting: %s",
+			    __func__, expanded);
+		} else {
+			fj->job = job_run(expanded, 0, NULL, NULL, cwd,
+			    format_job_update, format_job_complete, NULL, fj,
+			    JOB_NOWAIT|JOB_LIMIT|JOB_LOWPRIORITY, -1, -1);
+			if (fj->job == NULL) {
+				free(fj->out);
+				xasprintf(&fj->out, "<'%s' didn't start>",
+				    fj->cmd);
+			} else {
+				job_set_limit(fj->job, FORMAT_JOB_OUTPUT);
+				format_jobs_running++;
+				if (ft->profile != NULL)
+					ft->profile->jobs++;
+			}
+			fj->last = t;
+			fj->updated = 0;
 		}
-		fj->last = t;
-		fj->updated = 0;
 	}
 	free(expanded);
 
@@ -411,24 +1070,24 @@ format_job_get(struct format_expand_state *es, const char *cmd)
 }
 
 /* Remove old jobs. */
-static void
-format_job_tidy(struct format_job_tree *jobs, int force)
+void
+format_tidy_jobs(void)
 {
 	struct format_job	*fj, *fj1;
 	time_t			 now;
 
 	now = time(NULL);
-	RB_FOREACH_SAFE(fj, format_job_tree, jobs, fj1) {
-		if (!force && (fj->last > now || now - fj->last < 3600))
+	RB_FOREACH_SAFE(fj, format_job_tree, &format_jobs, fj1) {
+		if (fj->last > now || now - fj->last < 3600 + fj->ttl)
 			continue;
-		RB_REMOVE(format_job_tree, jobs, fj);
+		RB_REMOVE(format_job_tree, &format_jobs, fj);
 
 		log_debug("%s: %s", __func__, fj->cmd);
 
-		if (fj->job != NULL)
-			job_free(fj->job);
+		format_job_stop(fj);
 
 		free((void *)fj->expanded);
+		free((void *)fj->cwd);
 		free((void *)fj->cmd);
 		free(fj->out);
 
@@ -436,28 +1095,6 @@ format_job_tidy(struct format_job_tree *jobs, int force)
 	}
 }
 
-/* Tidy old jobs for all clients. */
-void
-format_tidy_jobs(void)
-{
-	struct client	*c;
-
-	format_job_tidy(&format_jobs, 0);
-	TAILQ_FOREACH(c, &clients, entry) {
-		if (c->jobs != NULL)
-			format_job_tidy(c->jobs, 0);
-	}
-}
-
-/* Remove old jobs for client. */
-void
-format_lost_client(struct client *c)
-{
-	if (c->jobs != NULL)
-		format_job_tidy(c->jobs, 1);
-	free(c->jobs);
-}
-
 /* Wrapper for asprintf. */
 static char * printflike(1, 2)
 format_printf(const char *fmt, ...)
@@ -505,6 +1142,50 @@ format_cb_pid(__unused struct format_tree *ft)
 	return (value);
 }
 
+/* Generation of the lists kept for formats, zero is never current. */
+static u_int format_list_generation = 1;
+
+/* Sessions, windows or clients have changed, so lists must be built again. */
+void
+format_lists_changed(void)
+{
+	if (++format_list_generation == 0)
+		format_list_generation = 1;
+}
+
+/* Free a list kept for formats. */
+void
+format_free_list(struct format_list *fl)
+{
+	free(fl->value);
+}
+
+/* Get a copy of a kept list if it is still current. */
+static int
+format_get_list(struct format_list *fl, char **value)
+{
+	if (fl->generation != format_list_generation)
+		return (0);
+	*value = (fl->value == NULL ? NULL : xstrdup(fl->value));
+	return (1);
+}
+
+/* Keep a list built from an evbuffer and return a copy of it. */
+static char *
+format_set_list(struct format_list *fl, struct evbuffer *buffer)
+{
+	int	size;
+
+	free(fl->value);
+	fl->value = NULL;
+	if ((size = EVBUFFER_LENGTH(buffer)) != 0)
+		xasprintf(&fl->value, "%.*s", size, EVBUFFER_DATA(buffer));
+	evbuffer_free(buffer);
+	fl->generation = format_list_generation;
+
+	return (fl->value == NULL ? NULL : xstrdup(fl->value));
+}
+
 /* Callback for session_attached_list. */
 static void *
 format_cb_session_attached_list(struct format_tree *ft)
@@ -512,11 +1193,12 @@ format_cb_session_attached_list(struct format_tree *ft)
 	struct session	*s = ft->s;
 	struct client	*loop;
 	struct evbuffer	*buffer;
-	int		 size;
-	char		*value = NULL;
+	char		*value;
 
 	if (s == NULL)
 		return (NULL);
+	if (format_get_list(&s->attached_list, &value))
+		return (value);
 
 	buffer = evbuffer_new();
 	if (buffer == NULL)
@@ -530,10 +1212,7 @@ format_cb_session_attached_list(struct format_tree *ft)
 		}
 	}
 
-	if ((size = EVBUFFER_LENGTH(buffer)) != 0)
-		xasprintf(&value, "%.*s", size, EVBUFFER_DATA(buffer));
-	evbuffer_free(buffer);
-	return (value);
+	return (format_set_list(&s->attached_list, buffer));
 }
 
 /* Callback for session_alerts. */
@@ -620,12 +1299,13 @@ format_cb_window_linked_sessions_list(struct format_tree *ft)
 	struct window	*w;
 	struct winlink	*wl;
 	struct evbuffer	*buffer;
-	int		 size;
-	char		*value = NULL;
+	char		*value;
 
 	if (ft->wl == NULL)
 		return (NULL);
 	w = ft->wl->window;
+	if (format_get_list(&w->linked_sessions_list, &value))
+		return (value);
 
 	buffer = evbuffer_new();
 	if (buffer == NULL)
@@ -637,10 +1317,7 @@ format_cb_window_linked_sessions_list(struct format_tree *ft)
 		evbuffer_add_printf(buffer, "%s", wl->session->name);
 	}
 
-	if ((size = EVBUFFER_LENGTH(buffer)) != 0)
-		xasprintf(&value, "%.*s", size, EVBUFFER_DATA(buffer));
-	evbuffer_free(buffer);
-	return (value);
+	return (format_set_list(&w->linked_sessions_list, buffer));
 }
 
 /* Callback for window_active_sessions. */
@@ -672,12 +1349,13 @@ format_cb_window_active_sessions_list(struct format_tree *ft)
 	struct window	*w;
 	struct winlink	*wl;
 	struct evbuffer	*buffer;
-	int		 size;
-	char		*value = NULL;
+	char		*value;
 
 	if (ft->wl == NULL)
 		return (NULL);
 	w = ft->wl->window;
+	if (format_get_list(&w->active_sessions_list, &value))
+		return (value);
 
 	buffer = evbuffer_new();
 	if (buffer == NULL)
@@ -691,10 +1369,7 @@ format_cb_window_active_sessions_list(struct format_tree *ft)
 		}
 	}
 
-	if ((size = EVBUFFER_LENGTH(buffer)) != 0)
-		xasprintf(&value, "%.*s", size, EVBUFFER_DATA(buffer));
-	evbuffer_free(buffer);
-	return (value);
+	return (format_set_list(&w->active_sessions_list, buffer));
 }
 
 /* Callback for window_active_clients. */
@@ -732,12 +1407,13 @@ format_cb_window_active_clients_list(struct format_tree *ft)
 	struct client	*loop;
 	struct session	*client_session;
 	struct evbuffer	*buffer;
-	int		 size;
-	char		*value = NULL;
+	char		*value;
 
 	if (ft->wl == NULL)
 		return (NULL);
 	w = ft->wl->window;
+	if (format_get_list(&w->active_clients_list, &value))
+		return (value);
 
 	buffer = evbuffer_new();
 	if (buffer == NULL)
@@ -755,10 +1431,7 @@ format_cb_window_active_clients_list(struct format_tree *ft)
 		}
 	}
 
-	if ((size = EVBUFFER_LENGTH(buffer)) != 0)
-		xasprintf(&value, "%.*s", size, EVBUFFER_DATA(buffer));
-	evbuffer_free(buffer);
-	return (value);
+	return (format_set_list(&w->active_clients_list, buffer));
 }
 
 /* Callback for window_layout. */
@@ -770,9 +1443,7 @@ format_cb_window_layout(struct format_tree *ft)
 	if (w == NULL)
 		return (NULL);
 
-	if (w->saved_layout_root != NULL)
-		return (layout_dump(w->saved_layout_root));
-	return (layout_dump(w->layout_root));
+	return (layout_dump_window(w, 0));
 }
 
 /* Callback for window_visible_layout. */
@@ -784,7 +1455,7 @@ format_cb_window_visible_layout(struct format_tree *ft)
 	if (w == NULL)
 		return (NULL);
 
-	return (layout_dump(w->layout_root));
+	return (layout_dump_window(w, 1));
 }
 
 /* Callback for pane_start_command. */
@@ -804,14 +1475,16 @@ static void *
 format_cb_current_command(struct format_tree *ft)
 {
 	struct window_pane	*wp = ft->wp;
+	const char		*name;
 	char			*cmd, *value;
 
 	if (wp == NULL || wp->shell == NULL)
 		return (NULL);
 
-	cmd = osdep_get_name(wp->fd, wp->tty);
-	if (cmd == NULL || *cmd == '\0') {
-		free(cmd);
+	name = window_pane_get_proc_name(wp);
+	if (name != NULL && *name != '\0')
+		cmd = xstrdup(name);
+	else {
 		cmd = cmd_stringify_argv(wp->argc, wp->argv);
 		if (cmd == NULL || *cmd == '\0') {
 			free(cmd);
@@ -828,12 +1501,12 @@ static void *
 format_cb_current_path(struct format_tree *ft)
 {
 	struct window_pane	*wp = ft->wp;
-	char			*cwd;
+	const char		*cwd;
 
 	if (wp == NULL)
 		return (NULL);
 
-	cwd = osdep_get_cwd(wp->fd);
+	cwd = window_pane_get_proc_cwd(wp);
 	if (cwd == NULL)
 		return (NULL);
 	return (xstrdup(cwd));
@@ -845,21 +1518,15 @@ format_cb_history_bytes(struct format_tree *ft)
 {
 	struct window_pane	*wp = ft->wp;
 	struct grid		*gd;
-	struct grid_line	*gl;
-	size_t		         size = 0;
-	u_int			 i;
+	size_t		         size;
 	char			*value;
 
 	if (wp == NULL)
 		return (NULL);
 	gd = wp->base.grid;
 
-	for (i = 0; i < gd->hsize + gd->sy; i++) {
-		gl = grid_get_line(gd, i);
-		size += gl->cellsize * sizeof *gl->celldata;
-		size += gl->extdsize * sizeof *gl->extddata;
-	}
-	size += (gd->hsize + gd->sy) * sizeof *gl;
+	size = gd->cellbytes + gd->extdbytes + gd->packbytes;
+	size += (gd->hsize + gd->sy) * sizeof (struct grid_line);
 
 	xasprintf(&value, "%zu", size);
 	return (value);
@@ -871,7 +1538,7 @@ format_cb_history_all_bytes(struct format_tree *ft)
 {
 	struct window_pane	*wp = ft->wp;
 	struct grid		*gd;
-	struct grid_line	*gl;
+	const struct grid_line	*gl;
 	u_int			 i, lines, cells = 0, extended_cells = 0;
 	char			*value;
 
@@ -881,9 +1548,10 @@ format_cb_history_all_bytes(struct format_tree *ft)
 
 	lines = gd->hsize + gd->sy;
 	for (i = 0; i < lines; i++) {
-		gl = grid_get_line(gd, i);
+		gl = grid_peek_line_packed(gd, i);
 		cells += gl->cellsize;
-		extended_cells += gl->extdsize;
+		if (~gl->flags & GRID_LINE_PACKED)
+			extended_cells += gl->extdsize;
 	}
 
 	xasprintf(&value, "%u,%zu,%u,%zu,%u,%zu", lines,
@@ -1193,7 +1861,7 @@ static void *
 format_cb_buffer_sample(struct format_tree *ft)
 {
 	if (ft->pb != NULL)
-		return (paste_make_sample(ft->pb));
+		return (xstrdup(paste_buffer_sample(ft->pb)));
 	return (NULL);
 }
 
@@ -1201,12 +1869,8 @@ format_cb_buffer_sample(struct format_tree *ft)
 static void *
 format_cb_buffer_size(struct format_tree *ft)
 {
-	size_t	size;
-
-	if (ft->pb != NULL) {
-		paste_buffer_data(ft->pb, &size);
-		return (format_printf("%zu", size));
-	}
+	if (ft->pb != NULL)
+		return (format_printf("%zu", paste_buffer_size(ft->pb)));
 	return (NULL);
 }
 
@@ -1240,6 +1904,53 @@ format_cb_client_control_mode(struct format_tree *ft)
 	return (NULL);
 }
 
+/* Callback for client control statistics. */
+static void *
+format_cb_client_control_stat(struct format_tree *ft,
+    enum control_stat_type type)
+{
+	if (ft->c != NULL && (ft->c->flags & CLIENT_CONTROL)) {
+		return (format_printf("%llu",
+		    (unsigned long long)control_get_stat(ft->c, NULL, type)));
+	}
+	return (NULL);
+}
+
+/* Callback for client_control_age. */
+static void *
+format_cb_client_control_age(struct format_tree *ft)
+{
+	return (format_cb_client_control_stat(ft, CONTROL_STAT_AGE));
+}
+
+/* Callback for client_control_backlog. */
+static void *
+format_cb_client_control_backlog(struct format_tree *ft)
+{
+	return (format_cb_client_control_stat(ft, CONTROL_STAT_BACKLOG));
+}
+
+/* Callback for client_control_pauses. */
+static void *
+format_cb_client_control_pauses(struct format_tree *ft)
+{
+	return (format_cb_client_control_stat(ft, CONTROL_STAT_PAUSES));
+}
+
+/* Callback for client_control_stall. */
+static void *
+format_cb_client_control_stall(struct format_tree *ft)
+{
+	return (format_cb_client_control_stat(ft, CONTROL_STAT_STALL));
+}
+
+/* Callback for client_control_written. */
+static void *
+format_cb_client_control_written(struct format_tree *ft)
+{
+	return (format_cb_client_control_stat(ft, CONTROL_STAT_WRITTEN));
+}
+
 /* Callback for client_discarded. */
 static void *
 format_cb_client_discarded(struct format_tree *ft)
@@ -1249,6 +1960,15 @@ format_cb_client_discarded(struct format_tree *ft)
 	return (NULL);
 }
 
+/* Callback for client_dropped_frames. */
+static void *
+format_cb_client_dropped_frames(struct format_tree *ft)
+{
+	if (ft->c != NULL)
+		return (format_printf("%u", ft->c->dropped_frames));
+	return (NULL);
+}
+
 /* Callback for client_flags. */
 static void *
 format_cb_client_flags(struct format_tree *ft)
@@ -1296,6 +2016,37 @@ format_cb_client_name(struct format_tree *ft)
 	return (NULL);
 }
 
+/* Callback for client_output_latency. */
+static void *
+format_cb_client_output_latency(struct format_tree *ft)
+{
+	if (ft->c != NULL)
+		return (format_printf("%u", ft->c->latency));
+	return (NULL);
+}
+
+/* Callback for client_output_queue. */
+static void *
+format_cb_client_output_queue(struct format_tree *ft)
+{
+	if (ft->c != NULL && ft->c->tty.out != NULL)
+		return (format_printf("%zu", tty_pending(&ft->c->tty)));
+	return (NULL);
+}
+
+/* Callback for client_output_rate. */
+static void *
+format_cb_client_output_rate(struct format_tree *ft)
+{
+	if (ft->c == NULL)
+		return (NULL);
+
+	/* Nothing written for a couple of seconds, so the rate is stale. */
+	if (get_timer() - ft->c->rate_time > 2000)
+		return (xstrdup("0"));
+	return (format_printf("%zu", ft->c->rate));
+}
+
 /* Callback for client_pid. */
 static void *
 format_cb_client_pid(struct format_tree *ft)
@@ -1332,6 +2083,59 @@ format_cb_client_readonly(struct format_tree *ft)
 	return (NULL);
 }
 
+/* Get a percentile of a client timing in microseconds. */
+static void *
+format_cb_client_timing(struct format_tree *ft, enum client_timing_type type,
+    u_int percent)
+{
+	if (ft->c != NULL)
+		return (format_printf("%u",
+		    server_client_get_timing(ft->c, type, percent)));
+	return (NULL);
+}
+
+/* Callback for client_input_latency_p50. */
+static void *
+format_cb_client_input_latency_p50(struct format_tree *ft)
+{
+	return (format_cb_client_timing(ft, CLIENT_TIMING_INPUT, 50));
+}
+
+/* Callback for client_input_latency_p99. */
+static void *
+format_cb_client_input_latency_p99(struct format_tree *ft)
+{
+	return (format_cb_client_timing(ft, CLIENT_TIMING_INPUT, 99));
+}
+
+/* Callback for client_redraw_p50. */
+static void *
+format_cb_client_redraw_p50(struct format_tree *ft)
+{
+	return (format_cb_client_timing(ft, CLIENT_TIMING_REDRAW, 50));
+}
+
+/* Callback for client_redraw_p99. */
+static void *
+format_cb_client_redraw_p99(struct format_tree *ft)
+{
+	return (format_cb_client_timing(ft, CLIENT_TIMING_REDRAW, 99));
+}
+
+/* Callback for client_screen_p50. */
+static void *
+format_cb_client_screen_p50(struct format_tree *ft)
+{
+	return (format_cb_client_timing(ft, CLIENT_TIMING_SCREEN, 50));
+}
+
+/* Callback for client_screen_p99. */
+static void *
+format_cb_client_screen_p99(struct format_tree *ft)
+{
+	return (format_cb_client_timing(ft, CLIENT_TIMING_SCREEN, 99));
+}
+
 /* Callback for client_session. */
 static void *
 format_cb_client_session(struct format_tree *ft)
@@ -1341,6 +2145,20 @@ format_cb_client_session(struct format_tree *ft)
 	return (NULL);
 }
 
+/* Callback for client_status_p50. */
+static void *
+format_cb_client_status_p50(struct format_tree *ft)
+{
+	return (format_cb_client_timing(ft, CLIENT_TIMING_STATUS, 50));
+}
+
+/* Callback for client_status_p99. */
+static void *
+format_cb_client_status_p99(struct format_tree *ft)
+{
+	return (format_cb_client_timing(ft, CLIENT_TIMING_STATUS, 99));
+}
+
 /* Callback for client_termfeatures. */
 static void *
 format_cb_client_termfeatures(struct format_tree *ft)
@@ -1380,6 +2198,20 @@ format_cb_client_tty(struct format_tree *ft)
 	return (NULL);
 }
 
+/* Callback for client_update_p50. */
+static void *
+format_cb_client_update_p50(struct format_tree *ft)
+{
+	return (format_cb_client_timing(ft, CLIENT_TIMING_UPDATE, 50));
+}
+
+/* Callback for client_update_p99. */
+static void *
+format_cb_client_update_p99(struct format_tree *ft)
+{
+	return (format_cb_client_timing(ft, CLIENT_TIMING_UPDATE, 99));
+}
+
 /* Callback for client_utf8. */
 static void *
 format_cb_client_utf8(struct format_tree *ft)
@@ -1396,17 +2228,83 @@ format_cb_client_utf8(struct format_tree *ft)
 static void *
 format_cb_client_width(struct format_tree *ft)
 {
-	if (ft->c != NULL)
-		return (format_printf("%u", ft->c->tty.sx));
+	if (ft->c != NULL)
+		return (format_printf("%u", ft->c->tty.sx));
+	return (NULL);
+}
+
+/* Callback for client_write_p50. */
+static void *
+format_cb_client_write_p50(struct format_tree *ft)
+{
+	return (format_cb_client_timing(ft, CLIENT_TIMING_WRITE, 50));
+}
+
+/* Callback for client_write_p99. */
+static void *
+format_cb_client_write_p99(struct format_tree *ft)
+{
+	return (format_cb_client_timing(ft, CLIENT_TIMING_WRITE, 99));
+}
+
+/* Callback for client_written. */
+static void *
+format_cb_client_written(struct format_tree *ft)
+{
+	if (ft->c != NULL)
+		return (format_printf("%zu", ft->c->written));
+	return (NULL);
+}
+
+/* Callback for client_msg_sent. */
+static void *
+format_cb_client_msg_sent(struct format_tree *ft)
+{
+	struct proc_stats	ps;
+
+	if (ft->c != NULL && ft->c->peer != NULL) {
+		proc_get_stats(ft->c->peer, &ps);
+		return (format_printf("%lu", ps.sent));
+	}
+	return (NULL);
+}
+
+/* Callback for client_msg_writes. */
+static void *
+format_cb_client_msg_writes(struct format_tree *ft)
+{
+	struct proc_stats	ps;
+
+	if (ft->c != NULL && ft->c->peer != NULL) {
+		proc_get_stats(ft->c->peer, &ps);
+		return (format_printf("%lu", ps.writes));
+	}
+	return (NULL);
+}
+
+/* Callback for client_msg_received. */
+static void *
+format_cb_client_msg_received(struct format_tree *ft)
+{
+	struct proc_stats	ps;
+
+	if (ft->c != NULL && ft->c->peer != NULL) {
+		proc_get_stats(ft->c->peer, &ps);
+		return (format_printf("%lu", ps.received));
+	}
 	return (NULL);
 }
 
-/* Callback for client_written. */
+/* Callback for client_msg_reads. */
 static void *
-format_cb_client_written(struct format_tree *ft)
+format_cb_client_msg_reads(struct format_tree *ft)
 {
-	if (ft->c != NULL)
-		return (format_printf("%zu", ft->c->written));
+	struct proc_stats	ps;
+
+	if (ft->c != NULL && ft->c->peer != NULL) {
+		proc_get_stats(ft->c->peer, &ps);
+		return (format_printf("%lu", ps.reads));
+	}
 	return (NULL);
 }
 
@@ -1754,6 +2652,15 @@ format_cb_pane_index(struct format_tree *ft)
 	return (NULL);
 }
 
+/* Callback for pane_input_backlog. */
+static void *
+format_cb_pane_input_backlog(struct format_tree *ft)
+{
+	if (ft->wp != NULL)
+		return (format_printf("%zu", window_pane_input_backlog(ft->wp)));
+	return (NULL);
+}
+
 /* Callback for pane_input_off. */
 static void *
 format_cb_pane_input_off(struct format_tree *ft)
@@ -1811,6 +2718,84 @@ format_cb_pane_marked_set(struct format_tree *ft)
 	return (NULL);
 }
 
+/* Callback for pane_memory. */
+static void *
+format_cb_pane_memory(struct format_tree *ft)
+{
+	struct window_pane_memory	wpm;
+
+	if (ft->wp != NULL) {
+		window_pane_memory(ft->wp, &wpm);
+		return (format_printf("%zu", wpm.total));
+	}
+	return (NULL);
+}
+
+/* Callback for pane_memory_cells. */
+static void *
+format_cb_pane_memory_cells(struct format_tree *ft)
+{
+	struct window_pane_memory	wpm;
+
+	if (ft->wp != NULL) {
+		window_pane_memory(ft->wp, &wpm);
+		return (format_printf("%zu", wpm.cells));
+	}
+	return (NULL);
+}
+
+/* Callback for pane_memory_extended. */
+static void *
+format_cb_pane_memory_extended(struct format_tree *ft)
+{
+	struct window_pane_memory	wpm;
+
+	if (ft->wp != NULL) {
+		window_pane_memory(ft->wp, &wpm);
+		return (format_printf("%zu", wpm.extended));
+	}
+	return (NULL);
+}
+
+/* Callback for pane_memory_input. */
+static void *
+format_cb_pane_memory_input(struct format_tree *ft)
+{
+	struct window_pane_memory	wpm;
+
+	if (ft->wp != NULL) {
+		window_pane_memory(ft->wp, &wpm);
+		return (format_printf("%zu", wpm.input));
+	}
+	return (NULL);
+}
+
+/* Callback for pane_memory_packed. */
+static void *
+format_cb_pane_memory_packed(struct format_tree *ft)
+{
+	struct window_pane_memory	wpm;
+
+	if (ft->wp != NULL) {
+		window_pane_memory(ft->wp, &wpm);
+		return (format_printf("%zu", wpm.packed));
+	}
+	return (NULL);
+}
+
+/* Callback for pane_memory_styles. */
+static void *
+format_cb_pane_memory_styles(struct format_tree *ft)
+{
+	struct window_pane_memory	wpm;
+
+	if (ft->wp != NULL) {
+		window_pane_memory(ft->wp, &wpm);
+		return (format_printf("%zu", wpm.styles));
+	}
+	return (NULL);
+}
+
 /* Callback for pane_mode. */
 static void *
 format_cb_pane_mode(struct format_tree *ft)
@@ -1826,6 +2811,28 @@ format_cb_pane_mode(struct format_tree *ft)
 	return (NULL);
 }
 
+/* Callback for pane_paste_left. */
+static void *
+format_cb_pane_paste_left(struct format_tree *ft)
+{
+	if (ft->wp != NULL)
+		return (format_printf("%zu", paste_pane_left(ft->wp, NULL)));
+	return (NULL);
+}
+
+/* Callback for pane_paste_size. */
+static void *
+format_cb_pane_paste_size(struct format_tree *ft)
+{
+	size_t	size;
+
+	if (ft->wp != NULL) {
+		paste_pane_left(ft->wp, &size);
+		return (format_printf("%zu", size));
+	}
+	return (NULL);
+}
+
 /* Callback for pane_path. */
 static void *
 format_cb_pane_path(struct format_tree *ft)
@@ -1859,6 +2866,64 @@ format_cb_pane_pipe(struct format_tree *ft)
 	return (NULL);
 }
 
+/* Callback for pane_pipe_queued. */
+static void *
+format_cb_pane_pipe_queued(struct format_tree *ft)
+{
+	if (ft->wp != NULL)
+		return (format_printf("%zu", window_pane_pipe_queued(ft->wp)));
+	return (NULL);
+}
+
+/* Callback for pane_pipe_stalled. */
+static void *
+format_cb_pane_pipe_stalled(struct format_tree *ft)
+{
+	if (ft->wp != NULL) {
+		if (ft->wp->pipe_fd != -1 &&
+		    (ft->wp->flags & PANE_PIPESTALLED))
+			return (xstrdup("1"));
+		return (xstrdup("0"));
+	}
+	return (NULL);
+}
+
+/* Callback for pane_pipe_stalls. */
+static void *
+format_cb_pane_pipe_stalls(struct format_tree *ft)
+{
+	if (ft->wp != NULL)
+		return (format_printf("%u", ft->wp->pipe_stalls));
+	return (NULL);
+}
+
+/* Callback for pane_read_bytes. */
+static void *
+format_cb_pane_read_bytes(struct format_tree *ft)
+{
+	if (ft->wp != NULL)
+		return (format_printf("%zu", ft->wp->read_bytes));
+	return (NULL);
+}
+
+/* Callback for pane_reads. */
+static void *
+format_cb_pane_reads(struct format_tree *ft)
+{
+	if (ft->wp != NULL)
+		return (format_printf("%zu", ft->wp->reads));
+	return (NULL);
+}
+
+/* Callback for pane_pipe_written. */
+static void *
+format_cb_pane_pipe_written(struct format_tree *ft)
+{
+	if (ft->wp != NULL)
+		return (format_printf("%zu", ft->wp->pipe_written));
+	return (NULL);
+}
+
 /* Callback for pane_right. */
 static void *
 format_cb_pane_right(struct format_tree *ft)
@@ -1884,9 +2949,14 @@ format_cb_pane_search_string(struct format_tree *ft)
 static void *
 format_cb_pane_synchronized(struct format_tree *ft)
 {
+	const char	*group;
+
 	if (ft->wp != NULL) {
 		if (options_get_number(ft->wp->options, "synchronize-panes"))
 			return (xstrdup("1"));
+		group = options_get_string(ft->wp->options, "synchronize-group");
+		if (*group != '\0')
+			return (xstrdup("1"));
 		return (xstrdup("0"));
 	}
 	return (NULL);
@@ -2405,13 +3475,8 @@ format_cb_wrap_flag(struct format_tree *ft)
 static void *
 format_cb_buffer_created(struct format_tree *ft)
 {
-	static struct timeval	 tv;
-
-	if (ft->pb != NULL) {
-		timerclear(&tv);
-		tv.tv_sec = paste_buffer_created(ft->pb);
-		return (&tv);
-	}
+	if (ft->pb != NULL)
+		return (paste_buffer_created(ft->pb));
 	return (NULL);
 }
 
@@ -2552,21 +3617,45 @@ static const struct format_table_entry format_table[] = {
 	{ "client_cell_width", FORMAT_TABLE_STRING,
 	  format_cb_client_cell_width
 	},
+	{ "client_control_age", FORMAT_TABLE_STRING,
+	  format_cb_client_control_age
+	},
+	{ "client_control_backlog", FORMAT_TABLE_STRING,
+	  format_cb_client_control_backlog
+	},
 	{ "client_control_mode", FORMAT_TABLE_STRING,
 	  format_cb_client_control_mode
 	},
+	{ "client_control_pauses", FORMAT_TABLE_STRING,
+	  format_cb_client_control_pauses
+	},
+	{ "client_control_stall", FORMAT_TABLE_STRING,
+	  format_cb_client_control_stall
+	},
+	{ "client_control_written", FORMAT_TABLE_STRING,
+	  format_cb_client_control_written
+	},
 	{ "client_created", FORMAT_TABLE_TIME,
 	  format_cb_client_created
 	},
 	{ "client_discarded", FORMAT_TABLE_STRING,
 	  format_cb_client_discarded
 	},
+	{ "client_dropped_frames", FORMAT_TABLE_STRING,
+	  format_cb_client_dropped_frames
+	},
 	{ "client_flags", FORMAT_TABLE_STRING,
 	  format_cb_client_flags
 	},
 	{ "client_height", FORMAT_TABLE_STRING,
 	  format_cb_client_height
 	},
+	{ "client_input_latency_p50", FORMAT_TABLE_STRING,
+	  format_cb_client_input_latency_p50
+	},
+	{ "client_input_latency_p99", FORMAT_TABLE_STRING,
+	  format_cb_client_input_latency_p99
+	},
 	{ "client_key_table", FORMAT_TABLE_STRING,
 	  format_cb_client_key_table
 	},
@@ -2576,9 +3665,30 @@ static const struct format_table_entry format_table[] = {
 	{ "client_mode_format", FORMAT_TABLE_STRING,
 	  format_cb_client_mode_format
 	},
+	{ "client_msg_reads", FORMAT_TABLE_STRING,
+	  format_cb_client_msg_reads
+	},
+	{ "client_msg_received", FORMAT_TABLE_STRING,
+	  format_cb_client_msg_received
+	},
+	{ "client_msg_sent", FORMAT_TABLE_STRING,
+	  format_cb_client_msg_sent
+	},
+	{ "client_msg_writes", FORMAT_TABLE_STRING,
+	  format_cb_client_msg_writes
+	},
 	{ "client_name", FORMAT_TABLE_STRING,
 	  format_cb_client_name
 	},
+	{ "client_output_latency", FORMAT_TABLE_STRING,
+	  format_cb_client_output_latency
+	},
+	{ "client_output_queue", FORMAT_TABLE_STRING,
+	  format_cb_client_output_queue
+	},
+	{ "client_output_rate", FORMAT_TABLE_STRING,
+	  format_cb_client_output_rate
+	},
 	{ "client_pid", FORMAT_TABLE_STRING,
 	  format_cb_client_pid
 	},
@@ -2588,9 +3698,27 @@ static const struct format_table_entry format_table[] = {
 	{ "client_readonly", FORMAT_TABLE_STRING,
 	  format_cb_client_readonly
 	},
+	{ "client_redraw_p50", FORMAT_TABLE_STRING,
+	  format_cb_client_redraw_p50
+	},
+	{ "client_redraw_p99", FORMAT_TABLE_STRING,
+	  format_cb_client_redraw_p99
+	},
+	{ "client_screen_p50", FORMAT_TABLE_STRING,
+	  format_cb_client_screen_p50
+	},
+	{ "client_screen_p99", FORMAT_TABLE_STRING,
+	  format_cb_client_screen_p99
+	},
 	{ "client_session", FORMAT_TABLE_STRING,
 	  format_cb_client_session
 	},
+	{ "client_status_p50", FORMAT_TABLE_STRING,
+	  format_cb_client_status_p50
+	},
+	{ "client_status_p99", FORMAT_TABLE_STRING,
+	  format_cb_client_status_p99
+	},
 	{ "client_termfeatures", FORMAT_TABLE_STRING,
 	  format_cb_client_termfeatures
 	},
@@ -2603,12 +3731,24 @@ static const struct format_table_entry format_table[] = {
 	{ "client_tty", FORMAT_TABLE_STRING,
 	  format_cb_client_tty
 	},
+	{ "client_update_p50", FORMAT_TABLE_STRING,
+	  format_cb_client_update_p50
+	},
+	{ "client_update_p99", FORMAT_TABLE_STRING,
+	  format_cb_client_update_p99
+	},
 	{ "client_utf8", FORMAT_TABLE_STRING,
 	  format_cb_client_utf8
 	},
 	{ "client_width", FORMAT_TABLE_STRING,
 	  format_cb_client_width
 	},
+	{ "client_write_p50", FORMAT_TABLE_STRING,
+	  format_cb_client_write_p50
+	},
+	{ "client_write_p99", FORMAT_TABLE_STRING,
+	  format_cb_client_write_p99
+	},
 	{ "client_written", FORMAT_TABLE_STRING,
 	  format_cb_client_written
 	},
@@ -2744,6 +3884,9 @@ static const struct format_table_entry format_table[] = {
 	{ "pane_index", FORMAT_TABLE_STRING,
 	  format_cb_pane_index
 	},
+	{ "pane_input_backlog", FORMAT_TABLE_STRING,
+	  format_cb_pane_input_backlog
+	},
 	{ "pane_input_off", FORMAT_TABLE_STRING,
 	  format_cb_pane_input_off
 	},
@@ -2759,9 +3902,33 @@ static const struct format_table_entry format_table[] = {
 	{ "pane_marked_set", FORMAT_TABLE_STRING,
 	  format_cb_pane_marked_set
 	},
+	{ "pane_memory", FORMAT_TABLE_STRING,
+	  format_cb_pane_memory
+	},
+	{ "pane_memory_cells", FORMAT_TABLE_STRING,
+	  format_cb_pane_memory_cells
+	},
+	{ "pane_memory_extended", FORMAT_TABLE_STRING,
+	  format_cb_pane_memory_extended
+	},
+	{ "pane_memory_input", FORMAT_TABLE_STRING,
+	  format_cb_pane_memory_input
+	},
+	{ "pane_memory_packed", FORMAT_TABLE_STRING,
+	  format_cb_pane_memory_packed
+	},
+	{ "pane_memory_styles", FORMAT_TABLE_STRING,
+	  format_cb_pane_memory_styles
+	},
 	{ "pane_mode", FORMAT_TABLE_STRING,
 	  format_cb_pane_mode
 	},
+	{ "pane_paste_left", FORMAT_TABLE_STRING,
+	  format_cb_pane_paste_left
+	},
+	{ "pane_paste_size", FORMAT_TABLE_STRING,
+	  format_cb_pane_paste_size
+	},
 	{ "pane_path", FORMAT_TABLE_STRING,
 	  format_cb_pane_path
 	},
@@ -2771,6 +3938,24 @@ static const struct format_table_entry format_table[] = {
 	{ "pane_pipe", FORMAT_TABLE_STRING,
 	  format_cb_pane_pipe
 	},
+	{ "pane_pipe_queued", FORMAT_TABLE_STRING,
+	  format_cb_pane_pipe_queued
+	},
+	{ "pane_pipe_stalled", FORMAT_TABLE_STRING,
+	  format_cb_pane_pipe_stalled
+	},
+	{ "pane_pipe_stalls", FORMAT_TABLE_STRING,
+	  format_cb_pane_pipe_stalls
+	},
+	{ "pane_pipe_written", FORMAT_TABLE_STRING,
+	  format_cb_pane_pipe_written
+	},
+	{ "pane_read_bytes", FORMAT_TABLE_STRING,
+	  format_cb_pane_read_bytes
+	},
+	{ "pane_reads", FORMAT_TABLE_STRING,
+	  format_cb_pane_reads
+	},
 	{ "pane_right", FORMAT_TABLE_STRING,
 	  format_cb_pane_right
 	},
@@ -2989,22 +4174,91 @@ static const struct format_table_entry format_table[] = {
 	}
 };
 
-/* Compare format table entries. */
+/*
+ * Index of the format table by hash of the key, built the first time it is
+ * needed. Each slot is the table index plus one, or zero if empty; colliding
+ * keys go in the next free slot. The index is kept at least twice the size of
+ * the table so the search is short.
+ */
+#define FORMAT_TABLE_INDEX_SIZE 512
+static u_short format_table_index[FORMAT_TABLE_INDEX_SIZE];
+
+/* Hash a format table key. */
+static u_int
+format_table_hash(const char *key)
+{
+	u_int	hash = 2166136261U;
+
+	for (; *key != '\0'; key++) {
+		hash ^= (u_char)*key;
+		hash *= 16777619U;
+	}
+	return (hash & (FORMAT_TABLE_INDEX_SIZE - 1));
+}
+
+/* Build the format table index. */
+static void
+format_table_build(void)
+{
+	u_int	i, slot;
+
+	for (i = 0; i < nitems(format_table); i++) {
+		slot = format_table_hash(format_table[i].key);
+		while (format_table_index[slot] != 0)
+			slot = (slot + 1) & (FORMAT_TABLE_INDEX_SIZE - 1);
+		format_table_index[slot] = i + 1;
+	}
+}
+
+/* Compare a key with a stable variable name. */
 static int
-format_table_compare(const void *key0, const void *entry0)
+format_stable_compare(const void *key0, const void *entry0)
 {
-	const char			*key = key0;
-	const struct format_table_entry	*entry = entry0;
+	const char	*key = key0;
+	const char	*const *entry = entry0;
 
-	return (strcmp(key, entry->key));
+	return (strcmp(key, *entry));
 }
 
 /* Get a format callback. */
-static struct format_table_entry *
+static const struct format_table_entry *
 format_table_get(const char *key)
 {
-	return (bsearch(key, format_table, nitems(format_table),
-	    sizeof *format_table, format_table_compare));
+	static int			 built;
+	const struct format_table_entry	*fte;
+	u_int				 slot;
+
+	if (!built) {
+		format_table_build();
+		built = 1;
+	}
+
+	slot = format_table_hash(key);
+	while (format_table_index[slot] != 0) {
+		fte = &format_table[format_table_index[slot] - 1];
+		if (strcmp(fte->key, key) == 0)
+			return (fte);
+		slot = (slot + 1) & (FORMAT_TABLE_INDEX_SIZE - 1);
+	}
+	return (NULL);
+}
+
+/*
+ * Add the formats of the mode of the pane, if any. This is left until a
+ * variable is looked up in the tree, since most formats do not use them.
+ */
+static void
+format_add_mode(struct format_tree *ft)
+{
+	struct window_mode_entry	*wme;
+
+	if (!ft->mode)
+		return;
+	ft->mode = 0;
+
+	wme = TAILQ_FIRST(&ft->wp->modes);
+	if (wme != NULL && wme->mode->formats != NULL)
+		wme->mode->formats(wme, ft);
 }
 
 /* Merge one format tree into another. */
@@ -3013,12 +4267,45 @@ format_merge(struct format_tree *ft, struct format_tree *from)
 {
 	struct format_entry	*fe;
 
+	format_add_mode(from);
 	RB_FOREACH(fe, format_entry_tree, &from->tree) {
 		if (fe->value != NULL)
 			format_add(ft, fe->key, "%s", fe->value);
 	}
 }
 
+/*
+ * Look up formats in a command queue state rather than copying them. Entries
+ * in the tree itself take precedence.
+ */
+void
+format_set_state(struct format_tree *ft, struct cmdq_state *state)
+{
+	if (ft->state != NULL)
+		cmdq_free_state(ft->state);
+	ft->state = cmdq_link_state(state);
+}
+
+/* Find an entry in a tree or the state it uses. */
+static struct format_entry *
+format_find_entry(struct format_tree *ft, const char *key)
+{
+	struct format_entry	 fe_find, *fe;
+	struct format_tree	*from;
+
+	fe_find.key = (char *)key;
+	fe = RB_FIND(format_entry_tree, &ft->tree, &fe_find);
+	if (fe != NULL || ft->state == NULL)
+		return (fe);
+	from = cmdq_get_formats(ft->state);
+	if (from == NULL)
+		return (NULL);
+	fe = RB_FIND(format_entry_tree, &from->tree, &fe_find);
+	if (fe == NULL || fe->value == NULL)
+		return (NULL);
+	return (fe);
+}
+
 /* Get format pane. */
 struct window_pane *
 format_get_pane(struct format_tree *ft)
@@ -3061,9 +4348,9 @@ format_create(struct client *c, struct cmdq_item *item, int tag, int flags)
 	return (ft);
 }
 
-/* Free a tree. */
-void
-format_free(struct format_tree *ft)
+/* Free the entries in a tree. */
+static void
+format_free_entries(struct format_tree *ft)
 {
 	struct format_entry	*fe, *fe1;
 
@@ -3073,20 +4360,90 @@ format_free(struct format_tree *ft)
 		free(fe->key);
 		free(fe);
 	}
+}
+
+/* Free a tree. */
+void
+format_free(struct format_tree *ft)
+{
+	format_free_entries(ft);
+	if (ft->state != NULL)
+		cmdq_free_state(ft->state);
 
 	if (ft->client != NULL)
 		server_client_unref(ft->client);
 	free(ft);
 }
 
+/*
+ * Clear a tree so it can be used again for another set of objects, as if it
+ * had just been created.
+ */
+void
+format_clear(struct format_tree *ft)
+{
+	format_free_entries(ft);
+	if (ft->state != NULL) {
+		cmdq_free_state(ft->state);
+		ft->state = NULL;
+	}
+
+	ft->type = FORMAT_TYPE_UNKNOWN;
+	ft->c = NULL;
+	ft->s = NULL;
+	ft->wl = NULL;
+	ft->w = NULL;
+	ft->wp = NULL;
+	ft->pb = NULL;
+	ft->mode = 0;
+	ft->uses = 0;
+	ft->time_next = 0;
+
+	if (ft->item != NULL)
+		format_create_add_item(ft, ft->item);
+}
+
+/*
+ * Get what the expansions with a tree depended on and, if they used the time,
+ * when it will next change.
+ */
+int
+format_get_uses(struct format_tree *ft, time_t *next)
+{
+	*next = ft->time_next;
+	return (ft->uses);
+}
+
+/* Walk one entry for format_each. */
+static void
+format_each_entry(struct format_tree *ft, struct format_entry *fe,
+    void (*cb)(const char *, const char *, void *), void *arg)
+{
+	char	s[64];
+
+	if (fe->time != 0) {
+		xsnprintf(s, sizeof s, "%lld", (long long)fe->time);
+		cb(fe->key, s, arg);
+	} else {
+		if (fe->value == NULL && fe->cb != NULL) {
+			fe->value = fe->cb(ft);
+			if (fe->value == NULL)
+				fe->value = xstrdup("");
+		}
+		cb(fe->key, fe->value, arg);
+	}
+}
+
 /* Walk each format. */
 void
 format_each(struct format_tree *ft, void (*cb)(const char *, const char *,
     void *), void *arg)
 {
 	const struct format_table_entry	*fte;
-	struct format_entry		*fe;
+	struct format_entry		*fe, *fe1 = NULL;
+	struct format_tree		*from = NULL;
 	u_int				 i;
+	int				 cmp;
 	char				 s[64];
 	void				*value;
 	struct timeval			*tv;
@@ -3102,23 +4459,31 @@ format_each(struct format_tree *ft, void (*cb)(const char *, const char *,
 			xsnprintf(s, sizeof s, "%lld", (long long)tv->tv_sec);
 			cb(fte->key, s, arg);
 		} else {
-			cb(fte->key, value, arg);
-			free(value);
-		}
-	}
-	RB_FOREACH(fe, format_entry_tree, &ft->tree) {
-		if (fe->time != 0) {
-			xsnprintf(s, sizeof s, "%lld", (long long)fe->time);
-			cb(fe->key, s, arg);
-		} else {
-			if (fe->value == NULL && fe->cb != NULL) {
-				fe->value = fe->cb(ft);
-				if (fe->value == NULL)
-					fe->value = xstrdup("");
-			}
-			cb(fe->key, fe->value, arg);
+			cb(fte->key, value, arg);
+			free(value);
 		}
 	}
+	format_add_mode(ft);
+
+	/* Walk the tree and the state together to keep the keys in order. */
+	if (ft->state != NULL && (from = cmdq_get_formats(ft->state)) != NULL)
+		fe1 = RB_MIN(format_entry_tree, &from->tree);
+	fe = RB_MIN(format_entry_tree, &ft->tree);
+	while (fe != NULL || fe1 != NULL) {
+		if (fe1 == NULL)
+			cmp = -1;
+		else if (fe == NULL)
+			cmp = 1;
+		else
+			cmp = format_entry_cmp(fe, fe1);
+		if (cmp <= 0) {
+			format_each_entry(ft, fe, cb, arg);
+			fe = RB_NEXT(format_entry_tree, &ft->tree, fe);
+		} else if (fe1->value != NULL)
+			format_each_entry(ft, fe1, cb, arg);
+		if (cmp >= 0)
+			fe1 = RB_NEXT(format_entry_tree, &from->tree, fe1);
+	}
 }
 
 /* Add a key-value pair. */
@@ -3272,12 +4637,12 @@ format_pretty_time(time_t t)
 
 /* Find a format entry. */
 static char *
-format_find(struct format_tree *ft, const char *key, int modifiers,
+format_find1(struct format_tree *ft, const char *key, int modifiers,
     const char *time_format)
 {
-	struct format_table_entry	*fte;
+	const struct format_table_entry	*fte;
 	void				*value;
-	struct format_entry		*fe, fe_find;
+	struct format_entry		*fe;
 	struct environ_entry		*envent;
 	struct options_entry		*o;
 	int				 idx;
@@ -3285,6 +4650,7 @@ format_find(struct format_tree *ft, const char *key, int modifiers,
 	const char			*errstr;
 	time_t				 t = 0;
 	struct tm			 tm;
+	uint64_t			 start = 0;
 
 	o = options_parse_get(global_options, key, &idx, 0);
 	if (o == NULL && ft->wp != NULL)
@@ -3302,26 +4668,46 @@ format_find(struct format_tree *ft, const char *key, int modifiers,
 		goto found;
 	}
 
+	/*
+	 * Anything other than an option or a stable variable may change
+	 * without the status line being redrawn. Conditions are looked up
+	 * here before being expanded, so ignore anything that is a format.
+	 */
+	if (strstr(key, "#{") == NULL &&
+	    bsearch(key, format_stable, nitems(format_stable),
+	    sizeof *format_stable, format_stable_compare) == NULL)
+		ft->uses |= FORMAT_USES_STATE;
+	if (strncmp(key, "client_", 7) == 0)
+		ft->uses |= FORMAT_USES_CLIENT;
+
 	fte = format_table_get(key);
 	if (fte != NULL) {
+		if (ft->profile != NULL)
+			start = get_timer_usec();
 		value = fte->cb(ft);
+		if (ft->profile != NULL)
+			format_profile_callback(ft, key, start);
 		if (fte->type == FORMAT_TABLE_TIME)
 			t = ((struct timeval *)value)->tv_sec;
 		else
 			found = value;
 		goto found;
 	}
-	fe_find.key = (char *)key;
-	fe = RB_FIND(format_entry_tree, &ft->tree, &fe_find);
+	format_add_mode(ft);
+	fe = format_find_entry(ft, key);
 	if (fe != NULL) {
 		if (fe->time != 0) {
 			t = fe->time;
 			goto found;
 		}
 		if (fe->value == NULL && fe->cb != NULL) {
+			if (ft->profile != NULL)
+				start = get_timer_usec();
 			fe->value = fe->cb(ft);
 			if (fe->value == NULL)
 				fe->value = xstrdup("");
+			if (ft->profile != NULL)
+				format_profile_callback(ft, key, start);
 		}
 		found = xstrdup(fe->value);
 		goto found;
@@ -3382,17 +4768,137 @@ found:
 	}
 	if (modifiers & FORMAT_QUOTE_SHELL) {
 		saved = found;
-		found = xstrdup(format_quote_shell(saved));
+		found = format_quote_shell(saved);
 		free(saved);
 	}
 	if (modifiers & FORMAT_QUOTE_STYLE) {
 		saved = found;
-		found = xstrdup(format_quote_style(saved));
+		found = format_quote_style(saved);
 		free(saved);
 	}
 	return (found);
 }
 
+/* Record a variable looked up while expanding for a cache. */
+static void
+format_record(struct format_cache *fc, const char *key, int modifiers,
+    const char *time_format, const char *value)
+{
+	struct format_lookup	*fl;
+	u_int			 i;
+
+	for (i = 0; i < fc->nlookups; i++) {
+		fl = &fc->lookups[i];
+		if (strcmp(fl->key, key) != 0 || fl->modifiers != modifiers)
+			continue;
+		if (fl->time_format == NULL && time_format == NULL)
+			return;
+		if (fl->time_format != NULL &&
+		    time_format != NULL &&
+		    strcmp(fl->time_format, time_format) == 0)
+			return;
+	}
+
+	fc->lookups = xreallocarray(fc->lookups, fc->nlookups + 1,
+	    sizeof *fc->lookups);
+	fl = &fc->lookups[fc->nlookups++];
+	fl->key = xstrdup(key);
+	fl->modifiers = modifiers;
+	fl->time_format = (time_format == NULL ? NULL : xstrdup(time_format));
+	fl->value = (value == NULL ? NULL : xstrdup(value));
+}
+
+/* Find a format entry and record it if needed. */
+static char *
+format_find(struct format_tree *ft, const char *key, int modifiers,
+    const char *time_format)
+{
+	char		*found;
+	uint64_t	 start = 0;
+
+	if (ft->profile != NULL)
+		start = get_timer_usec();
+	found = format_find1(ft, key, modifiers, time_format);
+	if (ft->profile != NULL)
+		format_profile_lookup(ft, key, start);
+	if (ft->record != NULL)
+		format_record(ft->record, key, modifiers, time_format, found);
+	return (found);
+}
+
+/* Free a cached expansion. */
+void
+format_free_cache(struct format_cache *fc)
+{
+	u_int	i;
+
+	if (fc == NULL)
+		return;
+	for (i = 0; i < fc->nlookups; i++) {
+		free(fc->lookups[i].key);
+		free(fc->lookups[i].time_format);
+		free(fc->lookups[i].value);
+	}
+	free(fc->lookups);
+	free(fc->expanded);
+	free(fc->fmt);
+	free(fc);
+}
+
+/*
+ * Expand a format using a cached expansion if every variable it looked up
+ * still has the same value, otherwise expand it and replace the cache. Formats
+ * using the time or anything other than variables are not cached.
+ */
+static char *
+format_expand_cached(struct format_expand_state *es, struct format_cache **fcp,
+    const char *fmt)
+{
+	struct format_tree	*ft = es->ft;
+	struct format_cache	*fc = *fcp;
+	struct format_lookup	*fl;
+	char			*value, *expanded;
+	u_int			 i;
+	int			 same;
+
+	if (fc != NULL && fc->flags == es->flags && strcmp(fc->fmt, fmt) == 0) {
+		for (i = 0; i < fc->nlookups; i++) {
+			fl = &fc->lookups[i];
+			value = format_find1(ft, fl->key, fl->modifiers,
+			    fl->time_format);
+			if (value == NULL || fl->value == NULL)
+				same = (value == fl->value);
+			else
+				same = (strcmp(value, fl->value) == 0);
+			free(value);
+			if (!same)
+				break;
+		}
+		if (i == fc->nlookups) {
+			format_log(es, "using cached expansion: %s",
+			    fc->expanded);
+			return (xstrdup(fc->expanded));
+		}
+	}
+	format_free_cache(fc);
+	*fcp = NULL;
+
+	fc = xcalloc(1, sizeof *fc);
+	ft->record = fc;
+	expanded = format_expand1(es, fmt);
+	ft->record = NULL;
+
+	if (ft->uses & (FORMAT_USES_TIME|FORMAT_USES_UNKNOWN))
+		format_free_cache(fc);
+	else {
+		fc->fmt = xstrdup(fmt);
+		fc->flags = es->flags;
+		fc->expanded = xstrdup(expanded);
+		*fcp = fc;
+	}
+	return (expanded);
+}
+
 /* Remove escaped characters from string. */
 static char *
 format_strip(const char *s)
@@ -3440,7 +4946,10 @@ format_skip(const char *s, const char *end)
 	return (s);
 }
 
-/* Return left and right alternatives separated by commas. */
+/*
+ * Return left and right alternatives separated by commas. Unless expanded,
+ * they are allocated from the arena and should not be freed.
+ */
 static int
 format_choose(struct format_expand_state *es, const char *s, char **left,
     char **right, int expand)
@@ -3451,14 +4960,12 @@ format_choose(struct format_expand_state *es, const char *s, char **left,
 	cp = format_skip(s, ",");
 	if (cp == NULL)
 		return (-1);
-	left0 = xstrndup(s, cp - s);
-	right0 = xstrdup(cp + 1);
+	left0 = format_arena_strndup(es, s, cp - s);
+	right0 = format_arena_strndup(es, cp + 1, strlen(cp + 1));
 
 	if (expand) {
 		*left = format_expand1(es, left0);
-		free(left0);
 		*right = format_expand1(es, right0);
-		free(right0);
 	} else {
 		*left = left0;
 		*right = right0;
@@ -3511,6 +5018,20 @@ format_free_modifiers(struct format_modifier *list, u_int count)
 	free(list);
 }
 
+/*
+ * Expand a modifier argument. When compiling, an argument which would need to
+ * be expanded each time means the modifiers cannot be kept.
+ */
+static char *
+format_expand_argument(struct format_expand_state *es, const char *value)
+{
+	if (~es->flags & FORMAT_EXPAND_COMPILE)
+		return (format_expand1(es, value));
+	if (strpbrk(value, "#%") != NULL)
+		es->flags |= FORMAT_EXPAND_DYNAMIC;
+	return (xstrdup(value));
+}
+
 /* Build modifier list. */
 static struct format_modifier *
 format_build_modifiers(struct format_expand_state *es, const char **s,
@@ -3582,7 +5103,7 @@ format_build_modifiers(struct format_expand_state *es, const char **s,
 
 			argv = xcalloc(1, sizeof *argv);
 			value = xstrndup(cp + 1, end - (cp + 1));
-			argv[0] = format_expand1(es, value);
+			argv[0] = format_expand_argument(es, value);
 			free(value);
 			argc = 1;
 
@@ -3606,7 +5127,7 @@ format_build_modifiers(struct format_expand_state *es, const char **s,
 
 			argv = xreallocarray (argv, argc + 1, sizeof *argv);
 			value = xstrndup(cp, end - cp);
-			argv[argc++] = format_expand1(es, value);
+			argv[argc++] = format_expand_argument(es, value);
 			free(value);
 
 			cp = end;
@@ -3627,7 +5148,7 @@ static char *
 format_match(struct format_modifier *fm, const char *pattern, const char *text)
 {
 	const char	*s = "";
-	regex_t		 r;
+	const regex_t	*r;
 	int		 flags = 0;
 
 	if (fm->argc >= 1)
@@ -3641,13 +5162,10 @@ format_match(struct format_modifier *fm, const char *pattern, const char *text)
 		flags = REG_EXTENDED|REG_NOSUB;
 		if (strchr(s, 'i') != NULL)
 			flags |= REG_ICASE;
-		if (regcomp(&r, pattern, flags) != 0)
+		if ((r = regsub_compile(pattern, flags)) == NULL)
 			return (xstrdup("0"));
-		if (regexec(&r, text, 0, NULL, 0) != 0) {
-			regfree(&r);
+		if (regexec(r, text, 0, NULL, 0) != 0)
 			return (xstrdup("0"));
-		}
-		regfree(&r);
 	}
 	return (xstrdup("1"));
 }
@@ -3692,6 +5210,7 @@ format_session_name(struct format_expand_state *es, const char *fmt)
 	char		*name;
 	struct session	*s;
 
+	es->ft->uses |= FORMAT_USES_UNKNOWN;
 	name = format_expand1(es, fmt);
 	RB_FOREACH(s, sessions, &sessions) {
 		if (strcmp(s->name, name) == 0) {
@@ -3716,6 +5235,9 @@ format_loop_sessions(struct format_expand_state *es, const char *fmt)
 	size_t				 valuelen;
 	struct session			*s;
 
+	/* Sessions can be created without redrawing every status line. */
+	ft->uses |= (FORMAT_USES_STATE|FORMAT_USES_UNKNOWN);
+
 	value = xcalloc(1, 1);
 	valuelen = 1;
 
@@ -3746,6 +5268,7 @@ format_window_name(struct format_expand_state *es, const char *fmt)
 	char			*name;
 	struct winlink		*wl;
 
+	ft->uses |= FORMAT_USES_UNKNOWN;
 	if (ft->s == NULL) {
 		format_log(es, "window name but no session");
 		return (NULL);
@@ -3776,13 +5299,14 @@ format_loop_windows(struct format_expand_state *es, const char *fmt)
 	struct winlink			*wl;
 	struct window			*w;
 
+	ft->uses |= FORMAT_USES_UNKNOWN;
 	if (ft->s == NULL) {
 		format_log(es, "window loop but no session");
 		return (NULL);
 	}
 
 	if (format_choose(es, fmt, &all, &active, 0) != 0) {
-		all = xstrdup(fmt);
+		all = format_arena_strndup(es, fmt, strlen(fmt));
 		active = NULL;
 	}
 
@@ -3800,7 +5324,8 @@ format_loop_windows(struct format_expand_state *es, const char *fmt)
 		format_defaults(nft, ft->c, ft->s, wl, NULL);
 		format_copy_state(&next, es, 0);
 		next.ft = nft;
-		expanded = format_expand1(&next, use);
+		expanded = format_expand_cached(&next, &wl->format_cache, use);
+		format_add_uses(ft, nft);
 		format_free(nft);
 
 		valuelen += strlen(expanded);
@@ -3810,9 +5335,6 @@ format_loop_windows(struct format_expand_state *es, const char *fmt)
 		free(expanded);
 	}
 
-	free(active);
-	free(all);
-
 	return (value);
 }
 
@@ -3829,13 +5351,14 @@ format_loop_panes(struct format_expand_state *es, const char *fmt)
 	size_t				 valuelen;
 	struct window_pane		*wp;
 
+	ft->uses |= FORMAT_USES_UNKNOWN;
 	if (ft->w == NULL) {
 		format_log(es, "pane loop but no window");
 		return (NULL);
 	}
 
 	if (format_choose(es, fmt, &all, &active, 0) != 0) {
-		all = xstrdup(fmt);
+		all = format_arena_strndup(es, fmt, strlen(fmt));
 		active = NULL;
 	}
 
@@ -3853,6 +5376,7 @@ format_loop_panes(struct format_expand_state *es, const char *fmt)
 		format_copy_state(&next, es, 0);
 		next.ft = nft;
 		expanded = format_expand1(&next, use);
+		format_add_uses(ft, nft);
 		format_free(nft);
 
 		valuelen += strlen(expanded);
@@ -3862,9 +5386,6 @@ format_loop_panes(struct format_expand_state *es, const char *fmt)
 		free(expanded);
 	}
 
-	free(active);
-	free(all);
-
 	return (value);
 }
 
@@ -4010,30 +5531,36 @@ fail:
 	return (NULL);
 }
 
-/* Replace a key. */
+/*
+ * Replace a key using a built modifier list. The key is used only for logging
+ * and copy is what is left of it after the modifiers.
+ */
 static int
-format_replace(struct format_expand_state *es, const char *key, size_t keylen,
-    char **buf, size_t *len, size_t *off)
+format_replace1(struct format_expand_state *es, struct format_modifier *list,
+    u_int count, const char *copy, const char *key, char **buf, size_t *len,
+    size_t *off)
 {
 	struct format_tree		 *ft = es->ft;
 	struct window_pane		 *wp = ft->wp;
-	const char			 *errstr, *copy, *cp, *marker = NULL;
+	const char			 *errstr, *cp, *marker = NULL;
 	const char			 *time_format = NULL;
-	char				 *copy0, *condition, *found, *new;
+	char				 *condition, *found, *new;
 	char				 *value, *left, *right, c;
 	size_t				  valuelen;
 	int				  modifiers = 0, limit = 0, width = 0;
 	int				  j;
-	struct format_modifier		 *list, *cmp = NULL, *search = NULL;
+	struct format_modifier		 *cmp = NULL, *search = NULL;
 	struct format_modifier		**sub = NULL, *mexp = NULL, *fm;
-	u_int				  i, count, nsub = 0;
+	u_int				  i, nsub = 0;
 	struct format_expand_state	  next;
+	struct format_arena_mark	  mark;
+	uint64_t			  start = 0;
 
-	/* Make a copy of the key. */
-	copy = copy0 = xstrndup(key, keylen);
+	if (ft->profile != NULL)
+		start = get_timer_usec();
+	format_arena_save(es, &mark);
 
 	/* Process modifier list. */
-	list = format_build_modifiers(es, &copy, &count);
 	for (i = 0; i < count; i++) {
 		fm = &list[i];
 		if (format_logging(ft)) {
@@ -4200,6 +5727,7 @@ format_replace(struct format_expand_state *es, const char *key, size_t keylen,
 		} else {
 			format_log(es, "search '%s' pane %%%u", new, wp->id);
 			value = format_search(search, wp, new);
+			ft->uses |= (FORMAT_USES_STATE|FORMAT_USES_UNKNOWN);
 		}
 		free(new);
 	} else if (cmp != NULL) {
@@ -4264,7 +5792,8 @@ format_replace(struct format_expand_state *es, const char *key, size_t keylen,
 			format_log(es, "condition syntax error: %s", copy + 1);
 			goto fail;
 		}
-		condition = xstrndup(copy + 1, cp - (copy + 1));
+		condition = format_arena_strndup(es, copy + 1,
+		    cp - (copy + 1));
 		format_log(es, "condition is: %s", condition);
 
 		found = format_find(ft, condition, modifiers, time_format);
@@ -4301,10 +5830,6 @@ format_replace(struct format_expand_state *es, const char *key, size_t keylen,
 			format_log(es, "condition '%s' is false", condition);
 			value = format_expand1(es, right);
 		}
-		free(right);
-		free(left);
-
-		free(condition);
 		free(found);
 	} else if (mexp != NULL) {
 		value = format_replace_expression(mexp, es, copy);
@@ -4410,76 +5935,148 @@ done:
 	memcpy(*buf + *off, value, valuelen);
 	*off += valuelen;
 
-	format_log(es, "replaced '%s' with '%s'", copy0, value);
+	format_log(es, "replaced '%s' with '%s'", key, value);
 	free(value);
 
 	free(sub);
-	format_free_modifiers(list, count);
-	free(copy0);
+	format_arena_release(es, &mark);
+	if (ft->profile != NULL && count != 0)
+		format_profile_modifiers(ft, list, count, start);
 	return (0);
 
 fail:
-	format_log(es, "failed %s", copy0);
+	format_log(es, "failed %s", key);
 
 	free(sub);
-	format_free_modifiers(list, count);
-	free(copy0);
+	format_arena_release(es, &mark);
+	if (ft->profile != NULL && count != 0)
+		format_profile_modifiers(ft, list, count, start);
 	return (-1);
 }
 
-/* Expand keys in a template. */
-static char *
-format_expand1(struct format_expand_state *es, const char *fmt)
+/* Replace a key. */
+static int
+format_replace(struct format_expand_state *es, const char *key, size_t keylen,
+    char **buf, size_t *len, size_t *off)
 {
-	struct format_tree	*ft = es->ft;
-	char			*buf, *out, *name;
-	const char		*ptr, *s;
-	size_t			 off, len, n, outlen;
-	int     		 ch, brackets;
-	char			 expanded[8192];
+	struct format_modifier		*list;
+	struct format_arena_mark	 mark;
+	const char			*copy;
+	char				*copy0;
+	u_int				 count;
+	int				 retval;
 
-	if (fmt == NULL || *fmt == '\0')
-		return (xstrdup(""));
+	/* Make a copy of the key. */
+	format_arena_save(es, &mark);
+	copy = copy0 = format_arena_strndup(es, key, keylen);
 
-	if (es->loop == FORMAT_LOOP_LIMIT) {
-		format_log(es, "reached loop limit (%u)", FORMAT_LOOP_LIMIT);
-		return (xstrdup(""));
-	}
-	es->loop++;
+	list = format_build_modifiers(es, &copy, &count);
+	retval = format_replace1(es, list, count, copy, copy0, buf, len, off);
 
-	format_log(es, "expanding format: %s", fmt);
+	format_free_modifiers(list, count);
+	format_arena_release(es, &mark);
+	return (retval);
+}
 
-	if ((es->flags & FORMAT_EXPAND_TIME) && strchr(fmt, '%') != NULL) {
-		if (es->time == 0) {
-			es->time = time(NULL);
-			localtime_r(&es->time, &es->tm);
-		}
-		if (strftime(expanded, sizeof expanded, fmt, &es->tm) == 0) {
-			format_log(es, "format is too long");
-			return (xstrdup(""));
+/* Add a piece to a compiled format. */
+static struct format_piece *
+format_add_piece(struct format_compiled *fc, enum format_piece_type type,
+    const char *text, size_t size)
+{
+	struct format_piece	*fp;
+	size_t			 offset = text - fc->fmt;
+
+	if (type == FORMAT_PIECE_TEXT && fc->npieces != 0) {
+		fp = &fc->pieces[fc->npieces - 1];
+		if (fp->type == FORMAT_PIECE_TEXT &&
+		    fp->offset + fp->size == offset) {
+			fp->size += size;
+			return (fp);
 		}
-		if (format_logging(ft) && strcmp(expanded, fmt) != 0)
-			format_log(es, "after time expanded: %s", expanded);
-		fmt = expanded;
 	}
 
-	len = 64;
-	buf = xmalloc(len);
-	off = 0;
+	fc->pieces = xreallocarray(fc->pieces, fc->npieces + 1,
+	    sizeof *fc->pieces);
+	fp = &fc->pieces[fc->npieces++];
+	memset(fp, 0, sizeof *fp);
+	fp->type = type;
+	fp->offset = offset;
+	fp->size = size;
+	return (fp);
+}
+
+/*
+ * Add a replacement to a compiled format and build its modifiers, unless any
+ * of them need to be expanded.
+ */
+static void
+format_add_replace(struct format_expand_state *es, struct format_compiled *fc,
+    const char *key, size_t keylen)
+{
+	struct format_piece		*fp;
+	struct format_expand_state	 next;
+	const char			*copy;
+
+	fp = format_add_piece(fc, FORMAT_PIECE_REPLACE, fc->fmt, 0);
+	fp->key = xstrndup(key, keylen);
+
+	copy = fp->key;
+	format_copy_state(&next, es, FORMAT_EXPAND_COMPILE);
+	fp->list = format_build_modifiers(&next, &copy, &fp->count);
+	if (next.flags & FORMAT_EXPAND_DYNAMIC) {
+		format_free_modifiers(fp->list, fp->count);
+		fp->list = NULL;
+		fp->count = 0;
+		fp->dynamic = 1;
+	} else
+		fp->copy = copy;
+}
+
+/* Free a compiled format. */
+static void
+format_free_compiled(struct format_compiled *fc)
+{
+	struct format_piece	*fp;
+	u_int			 i;
+
+	for (i = 0; i < fc->npieces; i++) {
+		fp = &fc->pieces[i];
+		free(fp->key);
+		format_free_modifiers(fp->list, fp->count);
+	}
+	free(fc->pieces);
+	free(fc->fmt);
+	free(fc);
+}
+
+/*
+ * Split a format into pieces. What is left after anything which stops the
+ * expansion is not included.
+ */
+static void
+format_compile1(struct format_expand_state *es, struct format_compiled *fc)
+{
+	struct format_piece	*fp;
+	const char		*fmt = fc->fmt, *ptr, *start, *alias;
+	size_t			 n;
+	int			 ch, brackets;
 
 	while (*fmt != '\0') {
 		if (*fmt != '#') {
-			while (len - off < 2) {
-				buf = xreallocarray(buf, 2, len);
-				len *= 2;
-			}
-			buf[off++] = *fmt++;
+			start = fmt;
+			while (*fmt != '\0' && *fmt != '#')
+				fmt++;
+			format_add_piece(fc, FORMAT_PIECE_TEXT, start,
+			    fmt - start);
 			continue;
 		}
 		fmt++;
 
 		ch = (u_char)*fmt++;
 		switch (ch) {
+		case '\0':
+			format_add_piece(fc, FORMAT_PIECE_TEXT, fmt - 2, 1);
+			return;
 		case '(':
 			brackets = 1;
 			for (ptr = fmt; *ptr != '\0'; ptr++) {
@@ -4489,43 +6086,20 @@ format_expand1(struct format_expand_state *es, const char *fmt)
 					break;
 			}
 			if (*ptr != ')' || brackets != 0)
-				break;
+				return;
 			n = ptr - fmt;
 
-			name = xstrndup(fmt, n);
-			format_log(es, "found #(): %s", name);
-
-			if ((ft->flags & FORMAT_NOJOBS) ||
-			    (es->flags & FORMAT_EXPAND_NOJOBS)) {
-				out = xstrdup("");
-				format_log(es, "#() is disabled");
-			} else {
-				out = format_job_get(es, name);
-				format_log(es, "#() result: %s", out);
-			}
-			free(name);
-
-			outlen = strlen(out);
-			while (len - off < outlen + 1) {
-				buf = xreallocarray(buf, 2, len);
-				len *= 2;
-			}
-			memcpy(buf + off, out, outlen);
-			off += outlen;
-
-			free(out);
-
+			fp = format_add_piece(fc, FORMAT_PIECE_JOB, fc->fmt, 0);
+			fp->key = xstrndup(fmt, n);
 			fmt += n + 1;
 			continue;
 		case '{':
 			ptr = format_skip((char *)fmt - 2, "}");
 			if (ptr == NULL)
-				break;
+				return;
 			n = ptr - fmt;
 
-			format_log(es, "found #{}: %.*s", (int)n, fmt);
-			if (format_replace(es, fmt, n, &buf, &len, &off) != 0)
-				break;
+			format_add_replace(es, fc, fmt, n);
 			fmt += n + 1;
 			continue;
 		case '#':
@@ -4540,52 +6114,191 @@ format_expand1(struct format_expand_state *es, const char *fmt)
 				n++;
 			}
 			if (*ptr == '[') {
-				format_log(es, "found #*%zu[", n);
-				while (len - off < n + 2) {
-					buf = xreallocarray(buf, 2, len);
-					len *= 2;
-				}
-				memcpy(buf + off, fmt - 2, n + 1);
-				off += n + 1;
+				format_add_piece(fc, FORMAT_PIECE_TEXT, fmt - 2,
+				    n + 1);
 				fmt = ptr + 1;
 				continue;
 			}
 			/* FALLTHROUGH */
 		case '}':
 		case ',':
-			format_log(es, "found #%c", ch);
-			while (len - off < 2) {
-				buf = xreallocarray(buf, 2, len);
-				len *= 2;
-			}
-			buf[off++] = ch;
+			format_add_piece(fc, FORMAT_PIECE_TEXT, fmt - 1, 1);
 			continue;
 		default:
-			s = NULL;
+			alias = NULL;
 			if (ch >= 'A' && ch <= 'Z')
-				s = format_upper[ch - 'A'];
+				alias = format_upper[ch - 'A'];
 			else if (ch >= 'a' && ch <= 'z')
-				s = format_lower[ch - 'a'];
-			if (s == NULL) {
-				while (len - off < 3) {
-					buf = xreallocarray(buf, 2, len);
-					len *= 2;
-				}
-				buf[off++] = '#';
-				buf[off++] = ch;
+				alias = format_lower[ch - 'a'];
+			if (alias == NULL) {
+				format_add_piece(fc, FORMAT_PIECE_TEXT, fmt - 2,
+				    2);
 				continue;
 			}
-			n = strlen(s);
-			format_log(es, "found #%c: %s", ch, s);
-			if (format_replace(es, s, n, &buf, &len, &off) != 0)
-				break;
+			format_add_replace(es, fc, alias, strlen(alias));
 			continue;
 		}
+	}
+}
+
+/*
+ * Get a compiled format, compiling it if it is not already cached. The least
+ * recently used formats are freed once there are too many, unless they are
+ * being expanded.
+ */
+static struct format_compiled *
+format_compile(struct format_expand_state *es, const char *fmt)
+{
+	struct format_compiled	*fc, *fc1, *fc2, find;
+
+	find.fmt = (char *)fmt;
+	fc = RB_FIND(format_compiled_tree, &format_compiled, &find);
+	if (fc != NULL) {
+		TAILQ_REMOVE(&format_compiled_lru, fc, lru);
+		TAILQ_INSERT_TAIL(&format_compiled_lru, fc, lru);
+		return (fc);
+	}
+
+	fc = xcalloc(1, sizeof *fc);
+	fc->fmt = xstrdup(fmt);
+	format_compile1(es, fc);
+	format_log(es, "compiled format into %u pieces", fc->npieces);
+
+	RB_INSERT(format_compiled_tree, &format_compiled, fc);
+	TAILQ_INSERT_TAIL(&format_compiled_lru, fc, lru);
+	format_compiled_count++;
+
+	fc1 = TAILQ_FIRST(&format_compiled_lru);
+	while (format_compiled_count > FORMAT_COMPILED_LIMIT && fc1 != fc) {
+		fc2 = TAILQ_NEXT(fc1, lru);
+		if (fc1->references == 0) {
+			TAILQ_REMOVE(&format_compiled_lru, fc1, lru);
+			RB_REMOVE(format_compiled_tree, &format_compiled, fc1);
+			format_compiled_count--;
+			format_free_compiled(fc1);
+		}
+		fc1 = fc2;
+	}
+	return (fc);
+}
+
+/* Append to an expansion. */
+static void
+format_append(char **buf, size_t *len, size_t *off, const char *s, size_t n)
+{
+	while (*len - *off < n + 1) {
+		*buf = xreallocarray(*buf, 2, *len);
+		*len *= 2;
+	}
+	memcpy(*buf + *off, s, n);
+	*off += n;
+}
+
+/* Expand keys in a template. */
+static char *
+format_expand1(struct format_expand_state *es, const char *fmt)
+{
+	struct format_tree	*ft = es->ft;
+	struct format_compiled	*fc;
+	struct format_piece	*fp;
+	char			*buf, *out;
+	size_t			 off, len, size;
+	u_int			 i;
+	int			 retval;
+	char			 expanded[8192];
+
+	if (fmt == NULL || *fmt == '\0')
+		return (xstrdup(""));
+
+	if (format_profiling &&
+	    es->loop == 0 &&
+	    (~es->flags & FORMAT_EXPAND_PROFILE))
+		return (format_expand_profile(es, fmt));
+
+	if (es->loop == FORMAT_LOOP_LIMIT) {
+		format_log(es, "reached loop limit (%u)", FORMAT_LOOP_LIMIT);
+		return (xstrdup(""));
+	}
+	es->loop++;
+
+	format_log(es, "expanding format: %s", fmt);
+
+	if ((es->flags & FORMAT_EXPAND_TIME) && strchr(fmt, '%') != NULL) {
+		if (es->time == 0) {
+			es->time = time(NULL);
+			localtime_r(&es->time, &es->tm);
+		}
+		if (strftime(expanded, sizeof expanded, fmt, &es->tm) == 0) {
+			format_log(es, "format is too long");
+			return (xstrdup(""));
+		}
+		format_add_time(ft, format_time_next(fmt, es->time, &es->tm));
+		if (format_logging(ft) && strcmp(expanded, fmt) != 0)
+			format_log(es, "after time expanded: %s", expanded);
+		fmt = expanded;
+	}
+
+	if (strchr(fmt, '#') == NULL) {
+		buf = xstrdup(fmt);
+		goto out;
+	}
+
+	len = 64;
+	buf = xmalloc(len);
+	off = 0;
+
+	fc = format_compile(es, fmt);
+	fc->references++;
+	for (i = 0; i < fc->npieces; i++) {
+		fp = &fc->pieces[i];
+		switch (fp->type) {
+		case FORMAT_PIECE_TEXT:
+			format_append(&buf, &len, &off, fc->fmt + fp->offset,
+			    fp->size);
+			continue;
+		case FORMAT_PIECE_JOB:
+			format_log(es, "found #(): %s", fp->key);
+			if ((ft->flags & FORMAT_NOJOBS) ||
+			    (es->flags & FORMAT_EXPAND_NOJOBS)) {
+				out = xstrdup("");
+				format_log(es, "#() is disabled");
+			} else {
+				out = format_job_get(es, fp->key);
+				format_log(es, "#() result: %s", out);
+			}
+			format_append(&buf, &len, &off, out, strlen(out));
+			free(out);
+			continue;
+		case FORMAT_PIECE_REPLACE:
+			format_log(es, "found #{}: %s", fp->key);
 
+			/*
+			 * At the loop limit, the modifiers must be built again
+			 * so their arguments expand to nothing.
+			 */
+			if (fp->dynamic || es->loop == FORMAT_LOOP_LIMIT) {
+				retval = format_replace(es, fp->key,
+				    strlen(fp->key), &buf, &len, &off);
+			} else {
+				retval = format_replace1(es, fp->list,
+				    fp->count, fp->copy, fp->key, &buf, &len,
+				    &off);
+			}
+			if (retval != 0)
+				break;
+			continue;
+		}
 		break;
 	}
+	fc->references--;
 	buf[off] = '\0';
 
+	if (ft->profile != NULL) {
+		for (size = 64; size <= len; size *= 2)
+			ft->profile->allocations++;
+	}
+
+out:
 	format_log(es, "result is: %s", buf);
 	es->loop--;
 
@@ -4597,11 +6310,18 @@ char *
 format_expand_time(struct format_tree *ft, const char *fmt)
 {
 	struct format_expand_state	es;
+	struct format_arena		arena = { NULL };
+	struct format_arena_mark	mark = { NULL, 0 };
+	char				*expanded;
 
 	memset(&es, 0, sizeof es);
 	es.ft = ft;
 	es.flags = FORMAT_EXPAND_TIME;
-	return (format_expand1(&es, fmt));
+	es.arena = &arena;
+	expanded = format_expand1(&es, fmt);
+	format_arena_release(&es, &mark);
+	server_stats.formats++;
+	return (expanded);
 }
 
 /* Expand keys in a template. */
@@ -4609,11 +6329,41 @@ char *
 format_expand(struct format_tree *ft, const char *fmt)
 {
 	struct format_expand_state	es;
+	struct format_arena		arena = { NULL };
+	struct format_arena_mark	mark = { NULL, 0 };
+	char				*expanded;
+
+	memset(&es, 0, sizeof es);
+	es.ft = ft;
+	es.flags = 0;
+	es.arena = &arena;
+	expanded = format_expand1(&es, fmt);
+	format_arena_release(&es, &mark);
+	server_stats.formats++;
+	return (expanded);
+}
+
+/*
+ * Expand keys in a template, reusing the previous expansion in the cache if
+ * nothing it depended on has changed.
+ */
+char *
+format_expand_cache(struct format_tree *ft, const char *fmt,
+    struct format_cache **fcp)
+{
+	struct format_expand_state	es;
+	struct format_arena		arena = { NULL };
+	struct format_arena_mark	mark = { NULL, 0 };
+	char				*expanded;
 
 	memset(&es, 0, sizeof es);
 	es.ft = ft;
 	es.flags = 0;
-	return (format_expand1(&es, fmt));
+	es.arena = &arena;
+	expanded = format_expand_cached(&es, fcp, fmt);
+	format_arena_release(&es, &mark);
+	server_stats.formats++;
+	return (expanded);
 }
 
 /* Expand a single string. */
@@ -4772,15 +6522,10 @@ format_defaults_winlink(struct format_tree *ft, struct winlink *wl)
 void
 format_defaults_pane(struct format_tree *ft, struct window_pane *wp)
 {
-	struct window_mode_entry	*wme;
-
 	if (ft->w == NULL)
 		format_defaults_window(ft, wp->window);
 	ft->wp = wp;
-
-	wme = TAILQ_FIRST(&wp->modes);
-	if (wme != NULL && wme->mode->formats != NULL)
-		wme->mode->formats(wme, ft);
+	ft->mode = 1;
 }
 
 /* Set default format keys for paste buffer. */
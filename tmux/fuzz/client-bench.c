@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2021 The tmux authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER
+ * IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "compat.h"
+
+/*
+ * Startup latency benchmark for short lived clients. A server is started on
+ * its own socket and each command is run as a new client a number of times.
+ * Commands which only produce output use the short identify; source-file
+ * needs the full environment and terminal so is there for comparison.
+ */
+
+struct bench_command {
+	const char	*name;
+	const char	*argv[4];
+};
+
+static const struct bench_command bench_commands[] = {
+	{ "display-message", { "display-message", "-p", "#{pane_id}", NULL } },
+	{ "has-session", { "has-session", NULL } },
+	{ "show-options", { "show-options", "-g", "status", NULL } },
+	{ "source-file", { "source-file", "/dev/null", NULL } }
+};
+
+static const char	*bench_tmux;
+static char		 bench_label[64];
+static u_int		 bench_count = 200;
+
+static __dead void
+bench_usage(void)
+{
+	fprintf(stderr, "usage: client-bench [-e variables] [-n count] tmux\n");
+	exit(1);
+}
+
+static double
+bench_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1000000000.0);
+}
+
+/* Run tmux with a command and wait for it, failing if it does. */
+static void
+bench_exec(const char *const *cmd)
+{
+	const char	*argv[16];
+	u_int		 argc = 0;
+	pid_t		 pid;
+	int		 status, fd;
+
+	argv[argc++] = bench_tmux;
+	argv[argc++] = "-L";
+	argv[argc++] = bench_label;
+	argv[argc++] = "-f";
+	argv[argc++] = "/dev/null";
+	while (*cmd != NULL)
+		argv[argc++] = *cmd++;
+	argv[argc] = NULL;
+
+	switch (pid = fork()) {
+	case -1:
+		err(1, "fork");
+	case 0:
+		if ((fd = open("/dev/null", O_WRONLY)) != -1) {
+			dup2(fd, STDOUT_FILENO);
+			close(fd);
+		}
+		execv(bench_tmux, (char **)argv);
+		_exit(127);
+	}
+	if (waitpid(pid, &status, 0) == -1)
+		err(1, "waitpid");
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		errx(1, "%s %s failed", bench_tmux, argv[5]);
+}
+
+/* Run one command repeatedly and report the time for each client. */
+static void
+bench_run(const struct bench_command *bc)
+{
+	double	start, took, total = 0, best = 0;
+	u_int	i;
+
+	for (i = 0; i < bench_count; i++) {
+		start = bench_now();
+		bench_exec(bc->argv);
+		took = bench_now() - start;
+		total += took;
+		if (i == 0 || took < best)
+			best = took;
+	}
+	printf("%-24s %6u clients %9.1f us mean %9.1f us min\n", bc->name,
+	    bench_count, total * 1000000 / bench_count, best * 1000000);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const char	*new[] = { "new-session", "-d", NULL };
+	static const char	*kill[] = { "kill-server", NULL };
+	char			 name[32], value[128];
+	u_int			 i, variables = 0;
+	int			 opt;
+
+	while ((opt = getopt(argc, argv, "e:n:")) != -1) {
+		switch (opt) {
+		case 'e':
+			variables = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			bench_count = strtoul(optarg, NULL, 10);
+			if (bench_count == 0)
+				bench_usage();
+			break;
+		default:
+			bench_usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		bench_usage();
+	bench_tmux = argv[0];
+
+	/* Make the environment look more like a real shell if asked. */
+	for (i = 0; i < variables; i++) {
+		snprintf(name, sizeof name, "CLIENT_BENCH_%u", i);
+		snprintf(value, sizeof value, "%0*u", (int)sizeof value - 1, i);
+		setenv(name, value, 1);
+	}
+
+	snprintf(bench_label, sizeof bench_label, "client-bench-%ld",
+	    (long)getpid());
+	bench_exec(new);
+	for (i = 0; i < sizeof bench_commands / sizeof bench_commands[0]; i++)
+		bench_run(&bench_commands[i]);
+	bench_exec(kill);
+	return (0);
+}
@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2021 The tmux authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER
+ * IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tmux.h"
+
+/*
+ * Throughput benchmark for the input parser, screen writing and the grid. Pane
+ * output is replayed into a pane with no clients or tty and the speed and
+ * number of allocations are reported. Files given on the command line are
+ * used as the output, otherwise a few built in samples are generated.
+ *
+ * Before the benchmark, some short outputs are replayed and the text of the
+ * first line is checked, so a change which makes the grid faster but wrong
+ * fails here instead.
+ */
+
+#define BENCH_CHUNK 4096
+#define BENCH_SAMPLE 1048576
+
+struct bench_corpus {
+	const char	*name;
+	u_char		*data;
+	size_t		 size;
+};
+
+struct bench_check {
+	const char	*name;
+	const char	*output;
+	const char	*expected;
+};
+
+static const struct bench_check bench_checks[] = {
+	{ "plain", "hello\r\nworld", "hello" },
+	{ "wide", "\344\270\255\346\226\207X",
+	  "\344\270\255\346\226\207X" },
+
+	/* A wide character partly overwritten leaves a space in the rest. */
+	{ "wide overwrite", "\344\270\255\346\226\207X\r1",
+	  "1 \346\226\207X" },
+	{ "wide overwrite colour", "\033[31m\344\270\255\346\226\207X\r1",
+	  "1 \346\226\207X" }
+};
+
+static u_int	bench_width = 80;
+static u_int	bench_height = 24;
+static size_t	bench_total = 64 * 1048576;
+
+struct event_base *libevent;
+
+static __dead void
+bench_usage(void)
+{
+	fprintf(stderr,
+	    "usage: input-bench [-n megabytes] [-x width] [-y height] "
+	    "[file ...]\n");
+	exit(1);
+}
+
+static double
+bench_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1000000000.0);
+}
+
+/* Add to a generated sample. */
+static void printflike(2, 3)
+bench_add(struct evbuffer *evb, const char *fmt, ...)
+{
+	va_list	ap;
+
+	va_start(ap, fmt);
+	evbuffer_add_vprintf(evb, fmt, ap);
+	va_end(ap);
+}
+
+/* Plain log lines. */
+static void
+bench_generate_plain(struct evbuffer *evb, u_int n)
+{
+	bench_add(evb, "%08u INFO worker %u: request /api/v1/item/%u done in "
+	    "%u ms\r\n", n, n % 16, n * 7919, n % 1000);
+}
+
+/* Text with truecolor foreground and background on every word. */
+static void
+bench_generate_truecolor(struct evbuffer *evb, u_int n)
+{
+	u_int	i;
+
+	for (i = 0; i < 8; i++) {
+		bench_add(evb, "\033[38;2;%u;%u;%um\033[48;2;%u;%u;%umword%u ",
+		    (n + i) % 256, (n * 3) % 256, i * 32, n % 64, i * 8,
+		    (n + 7) % 64, i);
+	}
+	bench_add(evb, "\033[0m\r\n");
+}
+
+/* Double width CJK text mixed with ASCII. */
+static void
+bench_generate_cjk(struct evbuffer *evb, u_int n)
+{
+	static const char	*words[] = {
+		"\346\274\242\345\255\227", /* kanji */
+		"\343\201\262\343\202\211\343\201\214\343\201\252", /* kana */
+		"\355\225\234\352\270\200", /* hangul */
+		"\344\270\255\346\226\207\345\255\227\347\254\246", /* hanzi */
+	};
+	u_int			 i;
+
+	for (i = 0; i < 6; i++)
+		bench_add(evb, "%s %u ", words[(n + i) % nitems(words)], i);
+	bench_add(evb, "\r\n");
+}
+
+/*
+ * Full screen updates like vim or htop: cursor movement, clearing, reverse
+ * video and scrolling inside a region.
+ */
+static void
+bench_generate_screen(struct evbuffer *evb, u_int n)
+{
+	u_int	y, ny = bench_height;
+
+	if (n % ny == 0)
+		bench_add(evb, "\033[H\033[2J");
+	y = n % ny;
+	bench_add(evb, "\033[%u;1H\033[K\033[1m%5u\033[m %-20s \033[7m%5.1f%%"
+	    "\033[27m \033[32m%u\033[39m", y + 1, n, "process", (n % 1000) / 10.0,
+	    n * 13);
+	if (n % 8 == 0) {
+		bench_add(evb, "\033[2;%ur\033[%u;1H\n\033M\033[r", ny - 1,
+		    ny - 1);
+	}
+	bench_add(evb, "\033[%u;1H\033[7m-- INSERT --\033[m\033[K", ny);
+}
+
+/* Make a built in sample. */
+static void
+bench_generate(struct bench_corpus *bc, const char *name,
+    void (*cb)(struct evbuffer *, u_int))
+{
+	struct evbuffer	*evb;
+	u_int		 n = 0;
+
+	evb = evbuffer_new();
+	if (evb == NULL)
+		fatalx("out of memory");
+	while (EVBUFFER_LENGTH(evb) < BENCH_SAMPLE)
+		cb(evb, n++);
+
+	bc->name = name;
+	bc->size = EVBUFFER_LENGTH(evb);
+	bc->data = xmalloc(bc->size);
+	memcpy(bc->data, EVBUFFER_DATA(evb), bc->size);
+	evbuffer_free(evb);
+}
+
+/* Read a sample from a file. */
+static void
+bench_read(struct bench_corpus *bc, const char *path)
+{
+	FILE	*f;
+	size_t	 space = BENCH_CHUNK, used;
+
+	if ((f = fopen(path, "rb")) == NULL)
+		fatal("%s", path);
+	bc->name = path;
+	bc->data = xmalloc(space);
+	bc->size = 0;
+	for (;;) {
+		used = fread(bc->data + bc->size, 1, space - bc->size, f);
+		if (used == 0)
+			break;
+		bc->size += used;
+		if (bc->size == space) {
+			space *= 2;
+			bc->data = xrealloc(bc->data, space);
+		}
+	}
+	if (ferror(f))
+		fatal("%s", path);
+	fclose(f);
+	if (bc->size == 0)
+		fatalx("%s: empty", path);
+}
+
+/* Create a pane with no process to parse output into. */
+static struct window_pane *
+bench_pane_create(struct bufferevent **vpty)
+{
+	struct window		*w;
+	struct window_pane	*wp;
+
+	w = window_create(bench_width, bench_height, 0, 0);
+	wp = window_add_pane(w, NULL, options_get_number(global_s_options,
+	    "history-limit"), 0);
+	bufferevent_pair_new(libevent, BEV_OPT_CLOSE_ON_FREE, vpty);
+	wp->ictx = input_init(wp, vpty[0]);
+	window_add_ref(w, __func__);
+	return (wp);
+}
+
+/* Free a pane and its window. */
+static void
+bench_pane_free(struct window_pane *wp, struct bufferevent **vpty)
+{
+	while (cmdq_next(NULL) != 0)
+		;
+	event_base_loop(libevent, EVLOOP_NONBLOCK);
+	window_remove_ref(wp->window, __func__);
+
+	bufferevent_free(vpty[0]);
+	bufferevent_free(vpty[1]);
+}
+
+/* Replay the check outputs and compare the first line, exiting on failure. */
+static void
+bench_check(void)
+{
+	const struct bench_check	*bc;
+	struct bufferevent		*vpty[2];
+	struct window_pane		*wp;
+	struct grid			*gd;
+	char				*text;
+	size_t				 size;
+	u_int				 i, failed = 0;
+
+	for (i = 0; i < nitems(bench_checks); i++) {
+		bc = &bench_checks[i];
+		wp = bench_pane_create(vpty);
+		input_parse_buffer(wp, (u_char *)bc->output,
+		    strlen(bc->output));
+
+		gd = wp->base.grid;
+		size = grid_string_text(gd, 0, gd->hsize, gd->sx, NULL, 0);
+		text = xmalloc(size + 1);
+		grid_string_text(gd, 0, gd->hsize, gd->sx, text, 0);
+		while (size > 0 && text[size - 1] == ' ')
+			size--;
+		text[size] = '\0';
+		if (strcmp(text, bc->expected) != 0) {
+			fprintf(stderr, "check %s failed: \"%s\" should be "
+			    "\"%s\"\n", bc->name, text, bc->expected);
+			failed++;
+		}
+		free(text);
+		bench_pane_free(wp, vpty);
+	}
+	if (failed != 0)
+		exit(1);
+}
+
+/* Replay a sample into a new pane until enough has been parsed. */
+static void
+bench_run(struct bench_corpus *bc)
+{
+	struct bufferevent		*vpty[2];
+	struct window_pane		*wp;
+	struct window_pane_memory	 wpm;
+	size_t				 done = 0, off, size;
+	u_long				 allocs;
+	double				 start, took, mb;
+
+	wp = bench_pane_create(vpty);
+
+	allocs = xmalloc_count;
+	start = bench_now();
+	while (done < bench_total) {
+		for (off = 0; off < bc->size; off += size) {
+			size = bc->size - off;
+			if (size > BENCH_CHUNK)
+				size = BENCH_CHUNK;
+			input_parse_buffer(wp, bc->data + off, size);
+		}
+		done += bc->size;
+	}
+	took = bench_now() - start;
+	allocs = xmalloc_count - allocs;
+	window_pane_memory(wp, &wpm);
+
+	mb = done / 1048576.0;
+	printf("%-24s %8.1f MB %8.3f s %9.1f MB/s %10lu allocs %9.1f allocs/MB"
+	    " %8zu KB\n", bc->name, mb, took, mb / took, allocs, allocs / mb,
+	    wpm.total / 1024);
+
+	bench_pane_free(wp, vpty);
+}
+
+int
+main(int argc, char **argv)
+{
+	const struct options_table_entry	*oe;
+	struct bench_corpus			*bc;
+	struct rusage				 ru;
+	const char				*errstr;
+	u_int					 n, i;
+	int					 opt;
+
+	if (setlocale(LC_CTYPE, "en_US.UTF-8") == NULL &&
+	    setlocale(LC_CTYPE, "C.UTF-8") == NULL)
+		setlocale(LC_CTYPE, "");
+
+	while ((opt = getopt(argc, argv, "n:x:y:")) != -1) {
+		switch (opt) {
+		case 'n':
+			bench_total = strtonum(optarg, 1, 65536, &errstr);
+			if (errstr != NULL)
+				fatalx("megabytes %s", errstr);
+			bench_total *= 1048576;
+			break;
+		case 'x':
+			bench_width = strtonum(optarg, 1, 10000, &errstr);
+			if (errstr != NULL)
+				fatalx("width %s", errstr);
+			break;
+		case 'y':
+			bench_height = strtonum(optarg, 2, 10000, &errstr);
+			if (errstr != NULL)
+				fatalx("height %s", errstr);
+			break;
+		default:
+			bench_usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	global_environ = environ_create();
+	global_options = options_create(NULL);
+	global_s_options = options_create(NULL);
+	global_w_options = options_create(NULL);
+	for (oe = options_table; oe->name != NULL; oe++) {
+		if (oe->scope & OPTIONS_TABLE_SERVER)
+			options_default(global_options, oe);
+		if (oe->scope & OPTIONS_TABLE_SESSION)
+			options_default(global_s_options, oe);
+		if (oe->scope & OPTIONS_TABLE_WINDOW)
+			options_default(global_w_options, oe);
+	}
+	libevent = osdep_event_init();
+	bench_check();
+
+	if (argc != 0) {
+		n = argc;
+		bc = xcalloc(n, sizeof *bc);
+		for (i = 0; i < n; i++)
+			bench_read(&bc[i], argv[i]);
+	} else {
+		n = 4;
+		bc = xcalloc(n, sizeof *bc);
+		bench_generate(&bc[0], "plain", bench_generate_plain);
+		bench_generate(&bc[1], "truecolor", bench_generate_truecolor);
+		bench_generate(&bc[2], "cjk", bench_generate_cjk);
+		bench_generate(&bc[3], "screen", bench_generate_screen);
+	}
+
+	for (i = 0; i < n; i++) {
+		bench_run(&bc[i]);
+		free(bc[i].data);
+	}
+	free(bc);
+
+	if (getrusage(RUSAGE_SELF, &ru) == 0)
+		printf("maximum resident size %ld KB\n", (long)ru.ru_maxrss);
+	return (0);
+}
@@ -0,0 +1,730 @@
+/*
+ * Copyright (c) 2021 The tmux authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER
+ * IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "compat.h"
+
+/*
+ * Load benchmark. A server is started on its own socket with a number of
+ * sessions, each with several panes running output generators (this program
+ * run with -G), and clients are attached to them on ptys which are read but
+ * never answered. While the panes write, keys are typed into one more client
+ * whose pane echoes a numbered marker for each key, and the time until the
+ * marker reaches the client is measured. At the end the server CPU time and
+ * memory, the bytes written to each client and the echo latency percentiles
+ * are reported.
+ */
+
+#define BENCH_MAX_CLIENTS 64
+#define BENCH_MAX_SAMPLES 10000
+#define BENCH_KEY_INTERVAL 0.02
+#define BENCH_KEY_TIMEOUT 1.0
+
+static const char *bench_generators[] = { "plain", "tui", "truecolor", "cjk" };
+
+struct bench_client {
+	pid_t	 pid;
+	int	 fd;
+	char	 session[32];
+	size_t	 bytes;
+};
+
+static const char		*bench_tmux;
+static char			 bench_label[64];
+static char			 bench_self[PATH_MAX];
+static u_int			 bench_sx = 200;
+static u_int			 bench_sy = 50;
+
+static struct bench_client	 bench_clients[BENCH_MAX_CLIENTS + 1];
+static u_int			 bench_nclients;
+
+static double			 bench_samples[BENCH_MAX_SAMPLES];
+static u_int			 bench_nsamples;
+
+static __dead void
+bench_usage(void)
+{
+	fprintf(stderr, "usage: load-bench [-c clients] [-d seconds] "
+	    "[-p panes] [-s sessions] [-x width] [-y height] tmux\n");
+	exit(1);
+}
+
+static double
+bench_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1000000000.0);
+}
+
+/* Write a whole buffer to a file descriptor. */
+static void
+bench_write(int fd, const char *buf, size_t len)
+{
+	ssize_t	n;
+
+	while (len != 0) {
+		n = write(fd, buf, len);
+		if (n == -1) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			exit(0);
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+/* Get the size of the generator's terminal. */
+static void
+bench_size(u_int *sx, u_int *sy)
+{
+	struct winsize	ws;
+
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
+		*sx = 80;
+		*sy = 24;
+	} else {
+		*sx = ws.ws_col;
+		*sy = ws.ws_row;
+	}
+}
+
+/* Bursts of plain text lines. */
+static __dead void
+bench_generate_plain(void)
+{
+	char	buf[65536];
+	size_t	len;
+	u_int	n = 0, i;
+
+	for (;;) {
+		len = 0;
+		for (i = 0; i < 200; i++) {
+			len += snprintf(buf + len, sizeof buf - len,
+			    "line %u: the quick brown fox jumps over the lazy "
+			    "dog and keeps on running\r\n", n++);
+		}
+		bench_write(STDOUT_FILENO, buf, len);
+		usleep(10000);
+	}
+}
+
+/* Full screen frames with colours, like a busy TUI application. */
+static __dead void
+bench_generate_tui(void)
+{
+	static char	buf[262144];
+	size_t		len;
+	u_int		sx, sy, x, y, frame = 0;
+
+	for (;;) {
+		bench_size(&sx, &sy);
+		len = snprintf(buf, sizeof buf, "\033[H");
+		for (y = 0; y < sy && len < sizeof buf - 256; y++) {
+			len += snprintf(buf + len, sizeof buf - len,
+			    "\033[%u;1H\033[38;5;%u;48;5;%um", y + 1,
+			    (frame + y) % 256, (frame * 3 + y) % 16);
+			for (x = 0; x < sx - 1 && len < sizeof buf - 64; x++)
+				buf[len++] = 'a' + (frame + x + y) % 26;
+			len += snprintf(buf + len, sizeof buf - len, "\033[m");
+		}
+		bench_write(STDOUT_FILENO, buf, len);
+		frame++;
+		usleep(16000);
+	}
+}
+
+/* Lines where every character has a different RGB colour. */
+static __dead void
+bench_generate_truecolor(void)
+{
+	static char	buf[262144];
+	size_t		len;
+	u_int		n = 0, i, x;
+
+	for (;;) {
+		len = 0;
+		for (i = 0; i < 50; i++) {
+			for (x = 0; x < 80; x++) {
+				len += snprintf(buf + len, sizeof buf - len,
+				    "\033[38;2;%u;%u;%um%c", (n + x) % 256,
+				    (n * 7 + x) % 256, (x * 3) % 256,
+				    'A' + (x % 26));
+			}
+			len += snprintf(buf + len, sizeof buf - len,
+			    "\033[m\r\n");
+			n++;
+		}
+		bench_write(STDOUT_FILENO, buf, len);
+		usleep(10000);
+	}
+}
+
+/* Lines of wide characters. */
+static __dead void
+bench_generate_cjk(void)
+{
+	static const char	*chars[] = {
+		"\346\274\242", "\345\255\227", "\343\203\206", "\343\202\271",
+		"\343\203\210", "\344\270\255", "\346\226\207", "\347\254\246"
+	};
+	static char		 buf[65536];
+	size_t			 len;
+	u_int			 n = 0, i, x;
+
+	for (;;) {
+		len = 0;
+		for (i = 0; i < 100; i++) {
+			for (x = 0; x < 40; x++) {
+				memcpy(buf + len, chars[(n + x) % 8], 3);
+				len += 3;
+			}
+			memcpy(buf + len, "\r\n", 2);
+			len += 2;
+			n++;
+		}
+		bench_write(STDOUT_FILENO, buf, len);
+		usleep(10000);
+	}
+}
+
+/* Answer every byte read with a numbered marker on a new line. */
+static __dead void
+bench_generate_echo(void)
+{
+	struct termios	tio;
+	char		buf[256], out[64];
+	ssize_t		n, i;
+	u_int		count = 0;
+	size_t		len;
+
+	if (tcgetattr(STDIN_FILENO, &tio) == 0) {
+		cfmakeraw(&tio);
+		tcsetattr(STDIN_FILENO, TCSANOW, &tio);
+	}
+	for (;;) {
+		n = read(STDIN_FILENO, buf, sizeof buf);
+		if (n <= 0) {
+			if (n == -1 && errno == EINTR)
+				continue;
+			exit(0);
+		}
+		for (i = 0; i < n; i++) {
+			len = snprintf(out, sizeof out, "\r\n<%u>", ++count);
+			bench_write(STDOUT_FILENO, out, len);
+		}
+	}
+}
+
+static __dead void
+bench_generate(const char *name)
+{
+	signal(SIGPIPE, SIG_DFL);
+	if (strcmp(name, "plain") == 0)
+		bench_generate_plain();
+	if (strcmp(name, "tui") == 0)
+		bench_generate_tui();
+	if (strcmp(name, "truecolor") == 0)
+		bench_generate_truecolor();
+	if (strcmp(name, "cjk") == 0)
+		bench_generate_cjk();
+	if (strcmp(name, "echo") == 0)
+		bench_generate_echo();
+	errx(1, "unknown generator: %s", name);
+}
+
+/*
+ * Run tmux with a command and wait for it, failing if it does. If out is not
+ * NULL, the first line of output is stored there.
+ */
+static void
+bench_exec(const char *const *cmd, char *out, size_t outlen)
+{
+	const char	*argv[32];
+	u_int		 argc = 0;
+	pid_t		 pid;
+	int		 status, fd, pipefd[2];
+	ssize_t		 n;
+
+	argv[argc++] = bench_tmux;
+	argv[argc++] = "-L";
+	argv[argc++] = bench_label;
+	argv[argc++] = "-f";
+	argv[argc++] = "/dev/null";
+	while (*cmd != NULL && argc < (sizeof argv / sizeof argv[0]) - 1)
+		argv[argc++] = *cmd++;
+	argv[argc] = NULL;
+
+	if (pipe(pipefd) != 0)
+		err(1, "pipe");
+	switch (pid = fork()) {
+	case -1:
+		err(1, "fork");
+	case 0:
+		close(pipefd[0]);
+		dup2(pipefd[1], STDOUT_FILENO);
+		close(pipefd[1]);
+		if ((fd = open("/dev/null", O_RDWR)) != -1) {
+			dup2(fd, STDIN_FILENO);
+			close(fd);
+		}
+		execv(bench_tmux, (char **)argv);
+		_exit(127);
+	}
+	close(pipefd[1]);
+	if (out != NULL) {
+		n = read(pipefd[0], out, outlen - 1);
+		out[n > 0 ? n : 0] = '\0';
+		out[strcspn(out, "\n")] = '\0';
+	}
+	close(pipefd[0]);
+	if (waitpid(pid, &status, 0) == -1)
+		err(1, "waitpid");
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		errx(1, "%s %s failed", bench_tmux, argv[5]);
+}
+
+/* Make the shell command to run a generator in a pane. */
+static const char *
+bench_command(const char *generator)
+{
+	static char	cmd[PATH_MAX + 64];
+
+	snprintf(cmd, sizeof cmd, "exec '%s' -G %s", bench_self, generator);
+	return (cmd);
+}
+
+/* Attach a client to a session on a new pty. */
+static void
+bench_attach(const char *session)
+{
+	struct bench_client	*bc = &bench_clients[bench_nclients++];
+	struct winsize		 ws;
+	int			 flags;
+
+	memset(&ws, 0, sizeof ws);
+	ws.ws_col = bench_sx;
+	ws.ws_row = bench_sy;
+
+	strlcpy(bc->session, session, sizeof bc->session);
+	bc->bytes = 0;
+	switch (bc->pid = forkpty(&bc->fd, NULL, NULL, &ws)) {
+	case -1:
+		err(1, "forkpty");
+	case 0:
+		setenv("TERM", "xterm-256color", 1);
+		execl(bench_tmux, bench_tmux, "-L", bench_label,
+		    "attach-session", "-t", session, (char *)NULL);
+		_exit(127);
+	}
+	if ((flags = fcntl(bc->fd, F_GETFL)) != -1)
+		fcntl(bc->fd, F_SETFL, flags|O_NONBLOCK);
+}
+
+/* Get server CPU time in seconds and resident memory in kilobytes. */
+static int
+bench_usage_of(pid_t pid, double *cpu, u_long *rss)
+{
+	char		 path[64], buf[1024], *cp;
+	FILE		*f;
+	u_long		 utime, stime;
+	int		 found = 0;
+
+	snprintf(path, sizeof path, "/proc/%ld/stat", (long)pid);
+	if ((f = fopen(path, "r")) == NULL)
+		return (-1);
+	if (fgets(buf, sizeof buf, f) == NULL ||
+	    (cp = strrchr(buf, ')')) == NULL ||
+	    sscanf(cp + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+	    "%lu %lu",
+	    &utime, &stime) != 2) {
+		fclose(f);
+		return (-1);
+	}
+	fclose(f);
+	*cpu = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+
+	snprintf(path, sizeof path, "/proc/%ld/status", (long)pid);
+	if ((f = fopen(path, "r")) == NULL)
+		return (-1);
+	while (fgets(buf, sizeof buf, f) != NULL) {
+		if (sscanf(buf, "VmRSS: %lu", rss) == 1) {
+			found = 1;
+			break;
+		}
+	}
+	fclose(f);
+	return (found ? 0 : -1);
+}
+
+/* Read whatever is waiting from each client, returning the echo client's. */
+static size_t
+bench_read(int timeout, char *echo, size_t echolen)
+{
+	struct pollfd		 pfds[BENCH_MAX_CLIENTS + 1];
+	struct bench_client	*bc;
+	char			 buf[65536];
+	ssize_t			 n;
+	size_t			 used = 0;
+	u_int			 i;
+
+	for (i = 0; i < bench_nclients; i++) {
+		pfds[i].fd = bench_clients[i].fd;
+		pfds[i].events = POLLIN;
+	}
+	if (poll(pfds, bench_nclients, timeout) <= 0)
+		return (0);
+	for (i = 0; i < bench_nclients; i++) {
+		if (pfds[i].revents == 0)
+			continue;
+		bc = &bench_clients[i];
+		while ((n = read(bc->fd, buf, sizeof buf)) > 0) {
+			bc->bytes += n;
+			if (i != 0)
+				continue;
+			if ((size_t)n > echolen - used)
+				n = echolen - used;
+			memcpy(echo + used, buf, n);
+			used += n;
+		}
+		if (n == 0 || errno != EAGAIN) {
+			close(bc->fd);
+			bc->fd = -1;
+		}
+	}
+	return (used);
+}
+
+/*
+ * Keep reading until every client has gone, otherwise they can block writing
+ * to their terminal and the server never exits.
+ */
+static void
+bench_drain(void)
+{
+	char	buf[256];
+	double	start;
+	u_int	i, left;
+
+	start = bench_now();
+	do {
+		bench_read(100, buf, sizeof buf);
+		left = 0;
+		for (i = 0; i < bench_nclients; i++) {
+			if (bench_clients[i].fd != -1)
+				left++;
+		}
+	} while (left != 0 && bench_now() - start < 5);
+
+	for (i = 0; i < bench_nclients; i++) {
+		if (bench_clients[i].fd != -1) {
+			kill(bench_clients[i].pid, SIGTERM);
+			close(bench_clients[i].fd);
+		}
+		waitpid(bench_clients[i].pid, NULL, 0);
+	}
+}
+
+static int
+bench_compare(const void *a, const void *b)
+{
+	double	da = *(const double *)a, db = *(const double *)b;
+
+	if (da < db)
+		return (-1);
+	return (da > db);
+}
+
+static double
+bench_percentile(u_int p)
+{
+	u_int	idx;
+
+	idx = (bench_nsamples * p) / 100;
+	if (idx >= bench_nsamples)
+		idx = bench_nsamples - 1;
+	return (bench_samples[idx] * 1000);
+}
+
+/*
+ * Find the highest marker in some output from the echo client. Markers are
+ * numbered from the start of the echo pane so a key that was typed before the
+ * client attached or that came back late cannot be mistaken for a later one.
+ */
+static u_int
+bench_marker(const char *data, size_t n)
+{
+	const char	*cp, *end = data + n;
+	u_int		 value, found = 0;
+
+	while ((cp = memchr(data, '<', end - data)) != NULL) {
+		data = cp + 1;
+		value = 0;
+		while (data != end && *data >= '0' && *data <= '9')
+			value = value * 10 + (*data++ - '0');
+		if (data != end && *data == '>' && value > found)
+			found = value;
+	}
+	return (found);
+}
+
+/*
+ * Run the load for the given time, typing keys into the echo client and
+ * timing how long until a new marker comes back.
+ */
+static u_int
+bench_run(double duration)
+{
+	static u_int	seen;
+	char		buf[32 + 65536], tail[32], *data;
+	size_t		n, tlen = 0;
+	double		start, now, sent = 0, next;
+	u_int		lost = 0, marker;
+	int		waiting = 0, timeout;
+
+	start = next = bench_now();
+	for (;;) {
+		now = bench_now();
+		if (now - start >= duration)
+			break;
+
+		if (!waiting && now >= next) {
+			bench_write(bench_clients[0].fd, "x", 1);
+			sent = now;
+			waiting = 1;
+		} else if (waiting && now - sent > BENCH_KEY_TIMEOUT) {
+			lost++;
+			waiting = 0;
+			next = now + BENCH_KEY_INTERVAL;
+		}
+
+		if (waiting)
+			timeout = 1;
+		else
+			timeout = (next - now) * 1000 + 1;
+		data = buf + sizeof tail;
+		n = bench_read(timeout, data, sizeof buf - sizeof tail);
+		if (n == 0)
+			continue;
+
+		/* Put the end of the last read in front in case of a split. */
+		data = buf + sizeof tail - tlen;
+		memcpy(data, tail, tlen);
+		n += tlen;
+		tlen = (n < sizeof tail) ? n : sizeof tail;
+		memcpy(tail, data + n - tlen, tlen);
+
+		if ((marker = bench_marker(data, n)) <= seen)
+			continue;
+		seen = marker;
+		if (waiting) {
+			now = bench_now();
+			if (bench_nsamples < BENCH_MAX_SAMPLES)
+				bench_samples[bench_nsamples++] = now - sent;
+			waiting = 0;
+			next = now + BENCH_KEY_INTERVAL;
+		}
+	}
+	return (lost);
+}
+
+/* Create the echo session and the sessions with generators. */
+static pid_t
+bench_setup(u_int sessions, u_int panes)
+{
+	char		 session[32], width[16], height[16], pid[32];
+	const char	*cmd[16];
+	u_int		 i, j, g = 0;
+
+	snprintf(width, sizeof width, "%u", bench_sx);
+	snprintf(height, sizeof height, "%u", bench_sy);
+
+	for (i = 0; i <= sessions; i++) {
+		if (i == 0)
+			strlcpy(session, "echo", sizeof session);
+		else
+			snprintf(session, sizeof session, "load%u", i - 1);
+		cmd[0] = "new-session";
+		cmd[1] = "-d";
+		cmd[2] = "-s";
+		cmd[3] = session;
+		cmd[4] = "-x";
+		cmd[5] = width;
+		cmd[6] = "-y";
+		cmd[7] = height;
+		if (i == 0)
+			cmd[8] = bench_command("echo");
+		else
+			cmd[8] = bench_command(bench_generators[g++ % 4]);
+		cmd[9] = NULL;
+		bench_exec(cmd, NULL, 0);
+		if (i == 0)
+			continue;
+
+		for (j = 1; j < panes; j++) {
+			cmd[0] = "split-window";
+			cmd[1] = "-d";
+			cmd[2] = "-t";
+			cmd[3] = session;
+			cmd[4] = bench_command(bench_generators[g++ % 4]);
+			cmd[5] = NULL;
+			bench_exec(cmd, NULL, 0);
+
+			cmd[0] = "select-layout";
+			cmd[1] = "-t";
+			cmd[2] = session;
+			cmd[3] = "tiled";
+			cmd[4] = NULL;
+			bench_exec(cmd, NULL, 0);
+		}
+	}
+
+	cmd[0] = "display-message";
+	cmd[1] = "-p";
+	cmd[2] = "#{pid}";
+	cmd[3] = NULL;
+	bench_exec(cmd, pid, sizeof pid);
+	return (strtol(pid, NULL, 10));
+}
+
+int
+main(int argc, char **argv)
+{
+	static const char	*kill[] = { "kill-server", NULL };
+	const char		*self = argv[0];
+	char			 session[32];
+	u_int			 sessions = 2, panes = 4, clients = 4, i, lost;
+	double			 duration = 10, cpu0, cpu1, total = 0;
+	u_long			 rss = 0;
+	pid_t			 server;
+	int			 opt, have_usage;
+
+	while ((opt = getopt(argc, argv, "c:d:G:p:s:x:y:")) != -1) {
+		switch (opt) {
+		case 'c':
+			clients = strtoul(optarg, NULL, 10);
+			if (clients > BENCH_MAX_CLIENTS)
+				bench_usage();
+			break;
+		case 'd':
+			duration = strtod(optarg, NULL);
+			if (duration <= 0)
+				bench_usage();
+			break;
+		case 'G':
+			bench_generate(optarg);
+			/* NOTREACHED */
+		case 'p':
+			panes = strtoul(optarg, NULL, 10);
+			if (panes == 0)
+				bench_usage();
+			break;
+		case 's':
+			sessions = strtoul(optarg, NULL, 10);
+			if (sessions == 0)
+				bench_usage();
+			break;
+		case 'x':
+			bench_sx = strtoul(optarg, NULL, 10);
+			if (bench_sx < 10)
+				bench_usage();
+			break;
+		case 'y':
+			bench_sy = strtoul(optarg, NULL, 10);
+			if (bench_sy < 5)
+				bench_usage();
+			break;
+		default:
+			bench_usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1)
+		bench_usage();
+	bench_tmux = argv[0];
+	if (realpath(self, bench_self) == NULL)
+		err(1, "%s", self);
+	signal(SIGPIPE, SIG_IGN);
+
+	snprintf(bench_label, sizeof bench_label, "load-bench-%ld",
+	    (long)getpid());
+	server = bench_setup(sessions, panes);
+
+	/* Attach the echo client first, then the others. */
+	bench_attach("echo");
+	for (i = 0; i < clients; i++) {
+		snprintf(session, sizeof session, "load%u", i % sessions);
+		bench_attach(session);
+	}
+
+	/* Let the clients attach and draw, then start counting. */
+	bench_run(1);
+	for (i = 0; i < bench_nclients; i++)
+		bench_clients[i].bytes = 0;
+	bench_nsamples = 0;
+	have_usage = (bench_usage_of(server, &cpu0, &rss) == 0);
+	lost = bench_run(duration);
+	if (have_usage && bench_usage_of(server, &cpu1, &rss) != 0)
+		have_usage = 0;
+
+	bench_exec(kill, NULL, 0);
+	bench_drain();
+
+	printf("%u sessions, %u panes each, %u clients, %ux%u, %.1f seconds\n",
+	    sessions, panes, clients, bench_sx, bench_sy, duration);
+	if (have_usage) {
+		printf("server cpu %.2f s (%.1f%%), rss %lu KB\n", cpu1 - cpu0,
+		    (cpu1 - cpu0) * 100 / duration, rss);
+	} else
+		printf("server cpu and rss not available\n");
+	for (i = 1; i < bench_nclients; i++) {
+		total += bench_clients[i].bytes;
+		printf("client %-2u %-8s %12zu bytes %8.2f MB/s\n", i,
+		    bench_clients[i].session, bench_clients[i].bytes,
+		    bench_clients[i].bytes / duration / 1048576);
+	}
+	printf("all clients %18.0f bytes %8.2f MB/s\n", total,
+	    total / duration / 1048576);
+	if (bench_nsamples != 0) {
+		qsort(bench_samples, bench_nsamples, sizeof *bench_samples,
+		    bench_compare);
+		printf("echo latency %u keys (%u lost): p50 %.2f ms, "
+		    "p90 %.2f ms, p99 %.2f ms, max %.2f ms\n", bench_nsamples,
+		    lost, bench_percentile(50), bench_percentile(90),
+		    bench_percentile(99), bench_percentile(100));
+	} else
+		printf("echo latency: no keys echoed (%u lost)\n", lost);
+	return (0);
+}
@@ -0,0 +1,540 @@
+/*
+ * Copyright (c) 2021 The tmux authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER
+ * IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <fnmatch.h>
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tmux.h"
+
+/*
+ * Benchmarks for single server functions: format expansion, option lookup,
+ * command parsing, target resolution and key binding lookup. A tree of
+ * sessions, windows and panes with no processes or clients is built, always
+ * the same for the same arguments, and each function is called a fixed number
+ * of times. One line is printed for each benchmark with its name, the number
+ * of calls, the best time per call in nanoseconds and the allocations per
+ * call, separated by spaces so the output can be compared between builds.
+ */
+
+#define BENCH_TARGETS 64
+#define BENCH_KEYS 256
+#define BENCH_CONFIG_LINES 500
+
+struct bench {
+	const char	*name;
+	u_int		 iterations;
+	void		(*fn)(struct cmdq_item *, const void *, u_int);
+	const void	*data;
+};
+
+struct bench_key {
+	struct key_table	*table;
+	key_code		 key;
+};
+
+static u_int		 bench_sessions = 100;
+static u_int		 bench_windows = 10;
+static u_int		 bench_panes = 4;
+static u_int		 bench_scale = 1;
+static u_int		 bench_repeat = 3;
+static const char	*bench_filter;
+
+static struct session		*bench_s;
+static struct winlink		*bench_wl;
+static struct window_pane	*bench_wp;
+static struct format_tree	*bench_ft;
+static char			*bench_config;
+static char			 bench_targets[4][BENCH_TARGETS][64];
+static struct bench_key		 bench_keys[BENCH_KEYS];
+static u_int			 bench_nkeys;
+
+struct event_base *libevent;
+
+static __dead void
+bench_usage(void)
+{
+	fprintf(stderr,
+	    "usage: micro-bench [-f pattern] [-n scale] [-p panes] "
+	    "[-r repeat] [-s sessions] [-w windows]\n");
+	exit(1);
+}
+
+static double
+bench_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1000000000.0);
+}
+
+/* Get the first line of an option as a format. */
+static const char *
+bench_option_format(const char *name)
+{
+	struct options_entry		*o;
+	struct options_array_item	*a;
+
+	o = options_get(global_s_options, name);
+	if (o == NULL)
+		o = options_get(global_w_options, name);
+	if (o == NULL)
+		errx(1, "unknown option %s", name);
+	if (!options_is_array(o))
+		return (options_get_string(options_owner(o), name));
+	a = options_array_first(o);
+	if (a == NULL)
+		errx(1, "empty option %s", name);
+	return (options_array_item_value(a)->string);
+}
+
+/* Expand one of the status line or border formats. */
+static void
+bench_format(__unused struct cmdq_item *item, const void *data, u_int n)
+{
+	const char	*fmt = bench_option_format(data);
+	u_int		 i;
+
+	for (i = 0; i < n; i++)
+		free(format_expand_time(bench_ft, fmt));
+}
+
+/* Create a format tree with the defaults for a pane, as most commands do. */
+static void
+bench_format_defaults(struct cmdq_item *item, __unused const void *data,
+    u_int n)
+{
+	struct format_tree	*ft;
+	u_int			 i;
+
+	for (i = 0; i < n; i++) {
+		ft = format_create(NULL, item, FORMAT_NONE, 0);
+		format_defaults(ft, NULL, bench_s, bench_wl, bench_wp);
+		format_free(ft);
+	}
+}
+
+/* Look up pane and window options, most of which come from the globals. */
+static void
+bench_options_pane(__unused struct cmdq_item *item, __unused const void *data,
+    u_int n)
+{
+	static const char	*names[] = {
+		"remain-on-exit", "synchronize-panes", "allow-rename",
+		"mode-keys", "automatic-rename", "aggressive-resize",
+		"monitor-activity", "pane-base-index"
+	};
+	struct options		*oo = bench_wp->options;
+	u_int			 i;
+
+	for (i = 0; i < n; i++)
+		options_get_number(oo, names[i % nitems(names)]);
+}
+
+/* Look up session and server options. */
+static void
+bench_options_session(__unused struct cmdq_item *item,
+    __unused const void *data, u_int n)
+{
+	static const char	*names[] = {
+		"base-index", "status", "history-limit", "status-interval",
+		"renumber-windows", "display-time", "mouse", "repeat-time"
+	};
+	struct options		*oo = bench_s->options;
+	u_int			 i;
+
+	for (i = 0; i < n; i++)
+		options_get_number(oo, names[i % nitems(names)]);
+}
+
+/* Parse a configuration file. */
+static void
+bench_cmd_parse_config(__unused struct cmdq_item *item,
+    __unused const void *data, u_int n)
+{
+	struct cmd_parse_input	 pi;
+	struct cmd_parse_result	*pr;
+	size_t			 len = strlen(bench_config);
+	u_int			 i;
+
+	for (i = 0; i < n; i++) {
+		memset(&pi, 0, sizeof pi);
+		pi.flags = CMD_PARSE_QUIET;
+		pr = cmd_parse_from_buffer(bench_config, len, &pi);
+		if (pr->status != CMD_PARSE_SUCCESS)
+			errx(1, "config: %s", pr->error);
+		cmd_list_free(pr->cmdlist);
+	}
+}
+
+/* Parse a short command as a binding or hook would, which can be cached. */
+static void
+bench_cmd_parse_string(__unused struct cmdq_item *item,
+    __unused const void *data, u_int n)
+{
+	struct cmd_parse_result	*pr;
+	u_int			 i;
+
+	for (i = 0; i < n; i++) {
+		pr = cmd_parse_from_string("select-pane -t '{next}' ; "
+		    "display -d 500 '#{pane_index}'", NULL);
+		if (pr->status != CMD_PARSE_SUCCESS)
+			errx(1, "string: %s", pr->error);
+		cmd_list_free(pr->cmdlist);
+	}
+}
+
+/* Resolve one kind of target against the whole tree. */
+static void
+bench_cmd_find(struct cmdq_item *item, const void *data, u_int n)
+{
+	char			(*targets)[64] = (char (*)[64])data;
+	struct cmd_find_state	 fs;
+	u_int			 i;
+
+	for (i = 0; i < n; i++) {
+		if (cmd_find_target(&fs, item, targets[i % BENCH_TARGETS],
+		    CMD_FIND_PANE, 0) != 0)
+			errx(1, "no target %s", targets[i % BENCH_TARGETS]);
+	}
+}
+
+/* Look up keys, some bound and some not, in several tables. */
+static void
+bench_key_bindings(__unused struct cmdq_item *item, __unused const void *data,
+    u_int n)
+{
+	struct bench_key	*bk;
+	u_int			 i;
+
+	for (i = 0; i < n; i++) {
+		bk = &bench_keys[i % bench_nkeys];
+		key_bindings_get(bk->table, bk->key);
+	}
+}
+
+static const struct bench bench_table[] = {
+	{ "format-status", 2000, bench_format, "status-format" },
+	{ "format-status-left", 100000, bench_format, "status-left" },
+	{ "format-status-right", 100000, bench_format, "status-right" },
+	{ "format-window-status", 100000, bench_format,
+	  "window-status-current-format" },
+	{ "format-pane-border", 100000, bench_format, "pane-border-format" },
+	{ "format-defaults", 20000, bench_format_defaults, NULL },
+	{ "options-pane", 2000000, bench_options_pane, NULL },
+	{ "options-session", 2000000, bench_options_session, NULL },
+	{ "cmd-parse-config", 100, bench_cmd_parse_config, NULL },
+	{ "cmd-parse-string", 500000, bench_cmd_parse_string, NULL },
+	{ "cmd-find-index", 200000, bench_cmd_find, bench_targets[0] },
+	{ "cmd-find-name", 200000, bench_cmd_find, bench_targets[1] },
+	{ "cmd-find-exact", 200000, bench_cmd_find, bench_targets[2] },
+	{ "cmd-find-id", 200000, bench_cmd_find, bench_targets[3] },
+	{ "key-bindings-get", 2000000, bench_key_bindings, NULL },
+};
+
+/* Build the sessions, windows and panes. */
+static void
+bench_build_tree(void)
+{
+	struct session		*s;
+	struct window		*w;
+	struct window_pane	*wp;
+	struct winlink		*wl;
+	char			 name[32];
+	u_int			 i, j, k;
+
+	for (i = 0; i < bench_sessions; i++) {
+		snprintf(name, sizeof name, "bench%u", i);
+		s = session_create(NULL, name, "/", environ_create(),
+		    options_create(global_s_options), NULL);
+		for (j = 0; j < bench_windows; j++) {
+			w = window_create(80, 24, 0, 0);
+			snprintf(name, sizeof name, "win%u", j);
+			window_set_name(w, name);
+			wl = winlink_add(&s->windows, j);
+			wl->session = s;
+			winlink_set_window(wl, w);
+			if (s->curw == NULL)
+				s->curw = wl;
+			for (k = 0; k < bench_panes; k++) {
+				wp = window_add_pane(w, NULL, 2000, 0);
+				if (k == 0) {
+					layout_init(w, wp);
+					window_set_active_pane(w, wp, 0);
+				}
+			}
+			layout_set_select(w, layout_set_lookup("tiled"));
+		}
+	}
+
+	/* Use a session and pane in the middle for the current target. */
+	snprintf(name, sizeof name, "bench%u", bench_sessions / 2);
+	bench_s = session_find(name);
+	bench_wl = bench_s->curw;
+	bench_wp = bench_wl->window->active;
+}
+
+/* Make the targets, spread over the sessions, windows and panes. */
+static void
+bench_build_targets(void)
+{
+	struct session		*s;
+	struct winlink		*wl;
+	struct window_pane	*wp;
+	char			 name[32];
+	u_int			 i, j, k, p;
+
+	for (i = 0; i < BENCH_TARGETS; i++) {
+		j = (i * 37) % bench_sessions;
+		k = (i * 7) % bench_windows;
+		p = i % bench_panes;
+
+		snprintf(bench_targets[0][i], sizeof bench_targets[0][i],
+		    "bench%u:%u.%u", j, k, p);
+		snprintf(bench_targets[1][i], sizeof bench_targets[1][i],
+		    "bench%u:win%u.%u", j, k, p);
+		snprintf(bench_targets[2][i], sizeof bench_targets[2][i],
+		    "=bench%u:=win%u.%u", j, k, p);
+
+		snprintf(name, sizeof name, "bench%u", j);
+		s = session_find(name);
+		wl = winlink_find_by_index(&s->windows, k);
+		wp = window_pane_at_index(wl->window, p);
+		snprintf(bench_targets[3][i], sizeof bench_targets[3][i],
+		    "%%%u", wp->id);
+	}
+}
+
+/*
+ * Make a configuration file like a large one a user might have, with options,
+ * bindings and conditions.
+ */
+static void
+bench_build_config(void)
+{
+	struct evbuffer	*evb;
+	u_int		 n;
+
+	evb = evbuffer_new();
+	if (evb == NULL)
+		errx(1, "out of memory");
+	for (n = 0; n < BENCH_CONFIG_LINES; n++) {
+		switch (n % 8) {
+		case 0:
+			evbuffer_add_printf(evb, "set -g status-style "
+			    "'bg=colour%u,fg=white' # line %u\n", n % 256, n);
+			break;
+		case 1:
+			evbuffer_add_printf(evb, "setw -g "
+			    "window-status-current-format "
+			    "'#[bold]#I:#W#{?window_flags,#F,}'\n");
+			break;
+		case 2:
+			evbuffer_add_printf(evb, "bind -n M-%c select-window "
+			    "-t :=%u\n", 'a' + n % 26, n % 10);
+			break;
+		case 3:
+			evbuffer_add_printf(evb, "bind -T copy-mode-vi y send "
+			    "-X copy-pipe-and-cancel 'xclip -in -selection "
+			    "clipboard'\n");
+			break;
+		case 4:
+			evbuffer_add_printf(evb, "if -F "
+			    "'#{==:#{session_windows},%u}' {\n"
+			    "\tset status off\n"
+			    "} {\n"
+			    "\tset status on\n"
+			    "}\n", n % 5);
+			break;
+		case 5:
+			evbuffer_add_printf(evb, "set -g @plugin "
+			    "'tmux-plugins/plugin-%u'\n", n);
+			break;
+		case 6:
+			evbuffer_add_printf(evb, "bind %c split-window -h -c "
+			    "'#{pane_current_path}' \\; select-layout "
+			    "even-horizontal\n", 'A' + n % 26);
+			break;
+		case 7:
+			evbuffer_add_printf(evb, "set-hook -g "
+			    "after-new-window[%u] 'selectl tiled'\n", n);
+			break;
+		}
+	}
+	evbuffer_add(evb, "", 1);
+	bench_config = xstrdup(EVBUFFER_DATA(evb));
+	evbuffer_free(evb);
+}
+
+/* Pick keys from the default tables, every fourth one not bound. */
+static void
+bench_build_keys(void)
+{
+	static const char	*names[] = { "root", "prefix", "copy-mode-vi" };
+	struct key_table	*table;
+	struct key_binding	*bd;
+	u_int			 i;
+
+	for (i = 0; i < nitems(names); i++) {
+		table = key_bindings_get_table(names[i], 0);
+		if (table == NULL)
+			errx(1, "no %s table", names[i]);
+		bd = key_bindings_first(table);
+		while (bd != NULL && bench_nkeys < BENCH_KEYS) {
+			bench_keys[bench_nkeys].table = table;
+			if (bench_nkeys % 4 == 3)
+				bench_keys[bench_nkeys].key = bd->key|KEYC_META;
+			else
+				bench_keys[bench_nkeys].key = bd->key;
+			bench_nkeys++;
+			bd = key_bindings_next(table, bd);
+		}
+	}
+	if (bench_nkeys == 0)
+		errx(1, "no key bindings");
+}
+
+/* Run one benchmark and print the best time of the repeats. */
+static void
+bench_run(struct cmdq_item *item, const struct bench *b)
+{
+	u_int	n = b->iterations * bench_scale, i;
+	u_long	allocs = 0;
+	double	start, took, best = 0;
+
+	for (i = 0; i < bench_repeat; i++) {
+		allocs = xmalloc_count;
+		start = bench_now();
+		b->fn(item, b->data, n);
+		took = bench_now() - start;
+		allocs = xmalloc_count - allocs;
+		if (i == 0 || took < best)
+			best = took;
+	}
+	printf("%-24s %10u %12.1f %10.2f\n", b->name, n, best * 1e9 / n,
+	    (double)allocs / n);
+	fflush(stdout);
+}
+
+/* Run the benchmarks from the queue so they have an item to use. */
+static enum cmd_retval
+bench_callback(struct cmdq_item *item, __unused void *data)
+{
+	const struct bench	*b;
+	u_int			 i;
+
+	cmd_find_from_winlink_pane(cmdq_get_current(item), bench_wl, bench_wp,
+	    0);
+	bench_ft = format_create(NULL, item, FORMAT_NONE, 0);
+	format_defaults(bench_ft, NULL, bench_s, bench_wl, bench_wp);
+
+	printf("# name iterations nsec/call allocs/call\n");
+	for (i = 0; i < nitems(bench_table); i++) {
+		b = &bench_table[i];
+		if (bench_filter != NULL &&
+		    fnmatch(bench_filter, b->name, 0) != 0)
+			continue;
+		bench_run(item, b);
+	}
+
+	format_free(bench_ft);
+	return (CMD_RETURN_NORMAL);
+}
+
+int
+main(int argc, char **argv)
+{
+	const struct options_table_entry	*oe;
+	const char				*errstr;
+	int					 opt;
+
+	if (setlocale(LC_CTYPE, "en_US.UTF-8") == NULL &&
+	    setlocale(LC_CTYPE, "C.UTF-8") == NULL)
+		setlocale(LC_CTYPE, "");
+
+	while ((opt = getopt(argc, argv, "f:n:p:r:s:w:")) != -1) {
+		switch (opt) {
+		case 'f':
+			bench_filter = optarg;
+			break;
+		case 'n':
+			bench_scale = strtonum(optarg, 1, 1000, &errstr);
+			if (errstr != NULL)
+				errx(1, "scale %s", errstr);
+			break;
+		case 'p':
+			bench_panes = strtonum(optarg, 1, 100, &errstr);
+			if (errstr != NULL)
+				errx(1, "panes %s", errstr);
+			break;
+		case 'r':
+			bench_repeat = strtonum(optarg, 1, 100, &errstr);
+			if (errstr != NULL)
+				errx(1, "repeat %s", errstr);
+			break;
+		case 's':
+			bench_sessions = strtonum(optarg, 1, 10000, &errstr);
+			if (errstr != NULL)
+				errx(1, "sessions %s", errstr);
+			break;
+		case 'w':
+			bench_windows = strtonum(optarg, 1, 1000, &errstr);
+			if (errstr != NULL)
+				errx(1, "windows %s", errstr);
+			break;
+		default:
+			bench_usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 0)
+		bench_usage();
+
+	global_environ = environ_create();
+	global_options = options_create(NULL);
+	global_s_options = options_create(NULL);
+	global_w_options = options_create(NULL);
+	for (oe = options_table; oe->name != NULL; oe++) {
+		if (oe->scope & OPTIONS_TABLE_SERVER)
+			options_default(global_options, oe);
+		if (oe->scope & OPTIONS_TABLE_SESSION)
+			options_default(global_s_options, oe);
+		if (oe->scope & OPTIONS_TABLE_WINDOW)
+			options_default(global_w_options, oe);
+	}
+	libevent = osdep_event_init();
+
+	key_bindings_init();
+	while (cmdq_next(NULL) != 0)
+		;
+	bench_build_tree();
+	bench_build_targets();
+	bench_build_config();
+	bench_build_keys();
+
+	cmdq_append(NULL, cmdq_get_callback(bench_callback, NULL));
+	while (cmdq_next(NULL) != 0)
+		;
+	return (0);
+}
@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2021 The tmux authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER
+ * IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "compat.h"
+
+/*
+ * Check that a client with the client-render flag shows the same as a normal
+ * client. An inner server has two panes with pane status lines and its client
+ * is attached inside a pane of an outer server, first normally and then with
+ * client-render. For each step (a popup, a menu, the display-panes indicator
+ * and the screen after each is closed) the outer pane is captured and the two
+ * clients must match. The popup must also change what the client shows.
+ */
+
+#define CHECK_SIZE 65536
+#define CHECK_WAIT 5000
+
+enum check_step {
+	CHECK_BASE,
+	CHECK_POPUP,
+	CHECK_POPUP_CLOSED,
+	CHECK_MENU,
+	CHECK_MENU_CLOSED,
+	CHECK_PANES,
+	CHECK_PANES_CLOSED,
+	CHECK_STEPS
+};
+
+static const char *check_names[] = {
+	"base", "popup", "popup closed", "menu", "menu closed",
+	"display-panes", "display-panes closed"
+};
+
+static const char	*check_tmux;
+static char		 check_inner[64];
+static char		 check_outer[64];
+static char		 check_normal[CHECK_STEPS][CHECK_SIZE];
+static pid_t		 check_pids[16];
+static u_int		 check_npids;
+
+static __dead void
+check_usage(void)
+{
+	fprintf(stderr, "usage: render-check tmux\n");
+	exit(1);
+}
+
+/*
+ * Run tmux on one of the servers with a command. If wait is zero, the command
+ * is left running and reaped at the end. If out is not NULL, the output is
+ * stored there.
+ */
+static void
+check_exec(const char *label, const char *const *cmd, int wait, char *out,
+    size_t outlen)
+{
+	const char	*argv[32];
+	u_int		 argc = 0;
+	pid_t		 pid;
+	int		 status, fd, pipefd[2];
+	ssize_t		 n;
+	size_t		 used = 0;
+
+	argv[argc++] = check_tmux;
+	argv[argc++] = "-L";
+	argv[argc++] = label;
+	argv[argc++] = "-f";
+	argv[argc++] = "/dev/null";
+	while (*cmd != NULL && argc < (sizeof argv / sizeof argv[0]) - 1)
+		argv[argc++] = *cmd++;
+	argv[argc] = NULL;
+
+	if (pipe(pipefd) != 0)
+		err(1, "pipe");
+	switch (pid = fork()) {
+	case -1:
+		err(1, "fork");
+	case 0:
+		close(pipefd[0]);
+		dup2(pipefd[1], STDOUT_FILENO);
+		close(pipefd[1]);
+		if ((fd = open("/dev/null", O_RDWR)) != -1) {
+			dup2(fd, STDIN_FILENO);
+			close(fd);
+		}
+		execv(check_tmux, (char **)argv);
+		_exit(127);
+	}
+	close(pipefd[1]);
+	if (!wait) {
+		close(pipefd[0]);
+		check_pids[check_npids++] = pid;
+		return;
+	}
+	if (out != NULL) {
+		while (used < outlen - 1) {
+			n = read(pipefd[0], out + used, outlen - 1 - used);
+			if (n <= 0)
+				break;
+			used += n;
+		}
+		out[used] = '\0';
+	}
+	close(pipefd[0]);
+	if (waitpid(pid, &status, 0) == -1)
+		err(1, "waitpid");
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		errx(1, "%s %s failed", check_tmux, argv[5]);
+}
+
+/* Capture what the client shows in the outer pane. */
+static void
+check_capture(char *out, size_t outlen)
+{
+	static const char	*capture[] = { "capture-pane", "-p", "-e", "-t",
+				    "o", NULL };
+
+	check_exec(check_outer, capture, 1, out, outlen);
+}
+
+/*
+ * Capture a step. A normal client is given time to draw and then stored, a
+ * client-render client is captured until it matches the normal client or
+ * enough time has passed.
+ */
+static int
+check_step(int render, enum check_step step)
+{
+	static char	buf[CHECK_SIZE];
+	u_int		waited;
+
+	if (!render) {
+		usleep(1000000);
+		check_capture(check_normal[step], sizeof check_normal[step]);
+		return (0);
+	}
+	for (waited = 0; waited < CHECK_WAIT; waited += 100) {
+		usleep(100000);
+		check_capture(buf, sizeof buf);
+		if (strcmp(buf, check_normal[step]) == 0)
+			return (0);
+	}
+	printf("%s: client-render differs\n", check_names[step]);
+	printf("normal:\n%s\nclient-render:\n%s\n", check_normal[step], buf);
+	return (1);
+}
+
+/* Attach a client to the inner server and run through the steps. */
+static int
+check_run(int render)
+{
+	static const char	*select[] = { "select-pane", "-t", "i.1", NULL };
+	static const char	*list[] = { "list-clients", "-F",
+				    "#{client_name}", NULL };
+	static const char	*menu_close[] = { "send-keys", "-t", "o", "q",
+				    NULL };
+	static const char	*detach[] = { "detach-client", "-s", "i", NULL };
+	const char		*cmd[16];
+	char			 attach[PATH_MAX + 128], name[64];
+	int			 failed = 0;
+
+	check_exec(check_inner, select, 1, NULL, 0);
+	snprintf(attach, sizeof attach, "TERM=screen '%s' -L %s -f /dev/null "
+	    "attach-session -t i%s", check_tmux, check_inner,
+	    render ? " -f client-render" : "");
+	cmd[0] = "respawn-pane";
+	cmd[1] = "-k";
+	cmd[2] = "-t";
+	cmd[3] = "o";
+	cmd[4] = attach;
+	cmd[5] = NULL;
+	check_exec(check_outer, cmd, 1, NULL, 0);
+	usleep(500000);
+	check_exec(check_inner, list, 1, name, sizeof name);
+	name[strcspn(name, "\n")] = '\0';
+	if (*name == '\0')
+		errx(1, "client did not attach");
+	failed |= check_step(render, CHECK_BASE);
+
+	cmd[0] = "display-popup";
+	cmd[1] = "-c";
+	cmd[2] = name;
+	cmd[3] = "-w";
+	cmd[4] = "40";
+	cmd[5] = "-h";
+	cmd[6] = "10";
+	cmd[7] = "echo inside popup; exec cat";
+	cmd[8] = NULL;
+	check_exec(check_inner, cmd, 0, NULL, 0);
+	failed |= check_step(render, CHECK_POPUP);
+	cmd[1] = "-C";
+	cmd[2] = "-c";
+	cmd[3] = name;
+	cmd[4] = NULL;
+	check_exec(check_inner, cmd, 1, NULL, 0);
+	failed |= check_step(render, CHECK_POPUP_CLOSED);
+
+	cmd[0] = "display-menu";
+	cmd[1] = "-c";
+	cmd[2] = name;
+	cmd[3] = "-x";
+	cmd[4] = "5";
+	cmd[5] = "-y";
+	cmd[6] = "5";
+	cmd[7] = "one";
+	cmd[8] = "1";
+	cmd[9] = "";
+	cmd[10] = "two";
+	cmd[11] = "2";
+	cmd[12] = "";
+	cmd[13] = NULL;
+	check_exec(check_inner, cmd, 0, NULL, 0);
+	failed |= check_step(render, CHECK_MENU);
+	check_exec(check_outer, menu_close, 1, NULL, 0);
+	failed |= check_step(render, CHECK_MENU_CLOSED);
+
+	/* Pressing a pane number closes the indicator. */
+	cmd[0] = "display-panes";
+	cmd[1] = "-d";
+	cmd[2] = "0";
+	cmd[3] = "-t";
+	cmd[4] = name;
+	cmd[5] = NULL;
+	check_exec(check_inner, cmd, 0, NULL, 0);
+	failed |= check_step(render, CHECK_PANES);
+	cmd[0] = "send-keys";
+	cmd[1] = "-t";
+	cmd[2] = "o";
+	cmd[3] = "0";
+	cmd[4] = NULL;
+	check_exec(check_outer, cmd, 1, NULL, 0);
+	failed |= check_step(render, CHECK_PANES_CLOSED);
+
+	check_exec(check_inner, detach, 1, NULL, 0);
+	return (failed);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const char	*inner[] = { "new-session", "-d", "-s", "i",
+				    "-x", "80", "-y", "24",
+				    "printf 'left pane\\n'; exec cat", NULL };
+	static const char	*split[] = { "split-window", "-h", "-t", "i",
+				    "printf 'right pane\\n'; exec cat", NULL };
+	static const char	*status[] = { "set-option", "-g",
+				    "pane-border-status", "top", NULL };
+	static const char	*right[] = { "set-option", "-g", "status-right",
+				    "", NULL };
+	static const char	*outer[] = { "new-session", "-d", "-s", "o",
+				    "-x", "80", "-y", "24", NULL };
+	static const char	*remain[] = { "set-option", "-g",
+				    "remain-on-exit", "on", NULL };
+	static const char	*nostatus[] = { "set-option", "-g", "status",
+				    "off", NULL };
+	static const char	*kill[] = { "kill-server", NULL };
+	u_int			 i;
+	int			 failed;
+
+	if (argc != 2)
+		check_usage();
+	check_tmux = argv[1];
+
+	snprintf(check_inner, sizeof check_inner, "render-check-inner-%ld",
+	    (long)getpid());
+	snprintf(check_outer, sizeof check_outer, "render-check-outer-%ld",
+	    (long)getpid());
+	check_exec(check_inner, inner, 1, NULL, 0);
+	check_exec(check_inner, split, 1, NULL, 0);
+	check_exec(check_inner, status, 1, NULL, 0);
+	check_exec(check_inner, right, 1, NULL, 0);
+	check_exec(check_outer, outer, 1, NULL, 0);
+	check_exec(check_outer, remain, 1, NULL, 0);
+	check_exec(check_outer, nostatus, 1, NULL, 0);
+
+	failed = check_run(0);
+	if (strcmp(check_normal[CHECK_BASE], check_normal[CHECK_POPUP]) == 0) {
+		printf("popup: not shown by normal client\n");
+		failed = 1;
+	}
+	failed |= check_run(1);
+
+	check_exec(check_inner, kill, 1, NULL, 0);
+	check_exec(check_outer, kill, 1, NULL, 0);
+	for (i = 0; i < check_npids; i++)
+		waitpid(check_pids[i], NULL, 0);
+
+	if (failed)
+		return (1);
+	printf("client-render matches normal client for %u steps\n",
+	    CHECK_STEPS);
+	return (0);
+}
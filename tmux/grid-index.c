@@ -0,0 +1,420 @@
+/* $OpenBSD$ */
+
+/*
+ * Copyright (c) 2021 The tmux authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER
+ * IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define XMALLOC_TAG XMALLOC_GRID
+#include "tmux.h"
+
+/*
+ * Index of the text in the history of a grid, used to skip lines which cannot
+ * contain a match when searching.
+ *
+ * The history is divided into blocks of GRID_INDEX_LINES lines and each block
+ * has a bitmap with one bit set for each hash of three consecutive cells (a
+ * trigram) in its lines. A search for a string of three or more cells need
+ * only look at the blocks with the bits for all of its trigrams set. Cells are
+ * folded to lower case so the index may be used for searches with or without
+ * case.
+ *
+ * Lines are numbered from when the index was created rather than by their
+ * position in the grid, so trimming the oldest history only drops blocks from
+ * the front. A line is added when it moves into the history, together with
+ * the trigrams which run onto it from the end of the line before if that line
+ * wrapped; a match starting in one block can therefore run into the next
+ * block only if the last line of the block is wrapped, and then both bitmaps
+ * are used.
+ *
+ * Reflowing the history changes which line everything is on, so the index is
+ * built again once the whole history has been reflowed and cannot be used
+ * until then.
+ */
+
+/* Lines in each block and size of each block's bitmap. */
+#define GRID_INDEX_LINES 32
+#define GRID_INDEX_BITS 8192
+#define GRID_INDEX_SIZE (GRID_INDEX_BITS / 8)
+
+/* Index. */
+struct grid_index {
+	int		 valid;
+
+	u_int		 first; /* line number of first block */
+	u_int		 lines; /* line number of next line added */
+
+	u_char		*blocks;
+	u_int		 nblocks;
+
+	u_int		 tail[2]; /* last two cells of the last line added */
+};
+
+/* Search using an index. */
+struct grid_index_query {
+	struct grid		*gd;
+	struct grid_index	*gi;
+
+	u_int			*bits;
+	u_int			 nbits;
+
+	u_int			 block;
+	int			 result;
+};
+
+/* Get the value of a cell to use in the index. */
+static u_int
+grid_index_cell_value(struct grid *gd, u_int px, u_int py)
+{
+	struct grid_cell	gc;
+	u_int			value, i;
+
+	grid_get_cell(gd, px, py, &gc);
+	if (gc.data.size == 1)
+		return (tolower(gc.data.data[0]));
+	value = 0x100;
+	for (i = 0; i < gc.data.size; i++)
+		value = (value * 31) + gc.data.data[i];
+	return (value);
+}
+
+/* Get the bit for a trigram. */
+static u_int
+grid_index_bit(u_int a, u_int b, u_int c)
+{
+	uint32_t	h;
+
+	h = (a * 0x9e3779b1U) ^ (b * 0x85ebca6bU) ^ (c * 0xc2b2ae35U);
+	h ^= h >> 15;
+	h *= 0x2c1b3c6dU;
+	h ^= h >> 12;
+	return (h % GRID_INDEX_BITS);
+}
+
+/* Get the bitmap for a line. */
+static u_char *
+grid_index_block(struct grid_index *gi, u_int line)
+{
+	u_int	n = (line - gi->first) / GRID_INDEX_LINES;
+
+	if (n >= gi->nblocks) {
+		gi->blocks = xreallocarray(gi->blocks, n + 1, GRID_INDEX_SIZE);
+		memset(gi->blocks + (gi->nblocks * GRID_INDEX_SIZE), 0,
+		    (n + 1 - gi->nblocks) * GRID_INDEX_SIZE);
+		gi->nblocks = n + 1;
+	}
+	return (gi->blocks + (n * GRID_INDEX_SIZE));
+}
+
+/* Add a history line to the index. */
+static void
+grid_index_add_line(struct grid *gd, struct grid_index *gi, u_int py)
+{
+	const struct grid_line	*gl;
+	u_char			*block;
+	u_int			 a, b, c, px, end, bit;
+
+	block = grid_index_block(gi, gi->lines++);
+
+	/* A line of blanks, which is what follows the end of any line. */
+	bit = grid_index_bit(' ', ' ', ' ');
+	block[bit / 8] |= (1 << (bit % 8));
+
+	end = grid_peek_line(gd, py)->cellused + 2;
+	if (end > gd->sx)
+		end = gd->sx;
+
+	gl = (py == 0) ? NULL : grid_peek_line_packed(gd, py - 1);
+	if (gl != NULL && (gl->flags & GRID_LINE_WRAPPED)) {
+		a = gi->tail[0];
+		b = gi->tail[1];
+	} else
+		a = b = UINT_MAX;
+	for (px = 0; px < end; px++) {
+		c = grid_index_cell_value(gd, px, py);
+		if (a != UINT_MAX) {
+			bit = grid_index_bit(a, b, c);
+			block[bit / 8] |= (1 << (bit % 8));
+		}
+		a = b;
+		b = c;
+	}
+
+	gi->tail[0] = grid_index_cell_value(gd, gd->sx - 2, py);
+	gi->tail[1] = grid_index_cell_value(gd, gd->sx - 1, py);
+}
+
+/* Start indexing the history of a grid. */
+void
+grid_index_enable(struct grid *gd)
+{
+	if (gd->index != NULL || gd->sx < 2)
+		return;
+	gd->index = xcalloc(1, sizeof *gd->index);
+	grid_index_rebuild(gd);
+}
+
+/* Free an index. */
+void
+grid_index_free(struct grid_index *gi)
+{
+	if (gi != NULL) {
+		free(gi->blocks);
+		free(gi);
+	}
+}
+
+/* Copy an index for a snapshot of a grid. */
+struct grid_index *
+grid_index_copy(struct grid_index *gi)
+{
+	struct grid_index	*copy;
+
+	if (gi == NULL)
+		return (NULL);
+	copy = xmalloc(sizeof *copy);
+	memcpy(copy, gi, sizeof *copy);
+	if (gi->nblocks != 0) {
+		copy->blocks = xreallocarray(NULL, gi->nblocks,
+		    GRID_INDEX_SIZE);
+		memcpy(copy->blocks, gi->blocks,
+		    gi->nblocks * GRID_INDEX_SIZE);
+	}
+	return (copy);
+}
+
+/* Build the index again from all of the history. */
+void
+grid_index_rebuild(struct grid *gd)
+{
+	struct grid_index	*gi = gd->index;
+	u_int			 yy;
+
+	if (gi == NULL)
+		return;
+	free(gi->blocks);
+	gi->blocks = NULL;
+	gi->nblocks = 0;
+	gi->first = gi->lines = 0;
+
+	if (gd->hpending != 0) {
+		gi->valid = 0;
+		return;
+	}
+	for (yy = 0; yy < gd->hsize; yy++)
+		grid_index_add_line(gd, gi, yy);
+	gi->valid = 1;
+
+	/* Adding the lines may have unpacked them. */
+	grid_pack_history(gd);
+	log_debug("%s: %u lines, %u blocks", __func__, gi->lines, gi->nblocks);
+}
+
+/* Stop using the index until the history has been reflowed. */
+void
+grid_index_invalidate(struct grid *gd)
+{
+	struct grid_index	*gi = gd->index;
+
+	if (gi != NULL && gi->valid) {
+		free(gi->blocks);
+		gi->blocks = NULL;
+		gi->nblocks = 0;
+		gi->valid = 0;
+	}
+}
+
+/* Add lines which have just been added to the bottom of the history. */
+void
+grid_index_add(struct grid *gd, u_int ny)
+{
+	struct grid_index	*gi = gd->index;
+	u_int			 yy;
+
+	if (gi == NULL || !gi->valid || ny > gd->hsize)
+		return;
+	for (yy = gd->hsize - ny; yy < gd->hsize; yy++)
+		grid_index_add_line(gd, gi, yy);
+}
+
+/* Remove lines which have been taken from the bottom of the history. */
+void
+grid_index_remove(struct grid *gd, u_int ny)
+{
+	struct grid_index	*gi = gd->index;
+	u_int			 n;
+
+	if (gi == NULL || !gi->valid)
+		return;
+	if (ny > gi->lines - gi->first)
+		ny = gi->lines - gi->first;
+	gi->lines -= ny;
+
+	/* Find the end of what is now the last line again. */
+	if (gd->hsize != 0) {
+		gi->tail[0] = grid_index_cell_value(gd, gd->sx - 2,
+		    gd->hsize - 1);
+		gi->tail[1] = grid_index_cell_value(gd, gd->sx - 1,
+		    gd->hsize - 1);
+	}
+
+	/*
+	 * The bits for the removed lines are left in the last block; this can
+	 * only mean it is searched when it need not be.
+	 */
+	n = (gi->lines - gi->first + GRID_INDEX_LINES - 1) / GRID_INDEX_LINES;
+	if (n < gi->nblocks)
+		gi->nblocks = n;
+}
+
+/* Drop blocks whose lines have all been trimmed from the top of the history. */
+void
+grid_index_trim(struct grid *gd)
+{
+	struct grid_index	*gi = gd->index;
+	u_int			 oldest, n;
+
+	if (gi == NULL || !gi->valid)
+		return;
+	oldest = gi->lines - gd->hsize;
+	if (oldest <= gi->first)
+		return;
+
+	n = (oldest - gi->first) / GRID_INDEX_LINES;
+	if (n == 0)
+		return;
+	if (n > gi->nblocks)
+		n = gi->nblocks;
+	memmove(gi->blocks, gi->blocks + (n * GRID_INDEX_SIZE),
+	    (gi->nblocks - n) * GRID_INDEX_SIZE);
+	gi->nblocks -= n;
+	gi->first += n * GRID_INDEX_LINES;
+}
+
+/* Empty the index after the history is cleared. */
+void
+grid_index_clear(struct grid *gd)
+{
+	if (gd->index != NULL)
+		grid_index_rebuild(gd);
+}
+
+/*
+ * Start a search for the cells on the first line of another grid. Returns
+ * NULL if the index cannot help.
+ */
+struct grid_index_query *
+grid_index_start(struct grid *gd, struct grid *sgd)
+{
+	struct grid_index	*gi = gd->index;
+	struct grid_index_query	*q;
+	u_int			 a, b, c, px;
+
+	if (gi == NULL || !gi->valid || sgd->sx < 3)
+		return (NULL);
+	if (sgd->sx > GRID_INDEX_LINES * gd->sx)
+		return (NULL);
+
+	q = xcalloc(1, sizeof *q);
+	q->gd = gd;
+	q->gi = gi;
+	q->bits = xreallocarray(NULL, sgd->sx - 2, sizeof *q->bits);
+	q->block = UINT_MAX;
+
+	a = grid_index_cell_value(sgd, 0, 0);
+	b = grid_index_cell_value(sgd, 1, 0);
+	for (px = 2; px < sgd->sx; px++) {
+		c = grid_index_cell_value(sgd, px, 0);
+		q->bits[q->nbits++] = grid_index_bit(a, b, c);
+		a = b;
+		b = c;
+	}
+	return (q);
+}
+
+/* Check block for all bits, together with the following block if given. */
+static int
+grid_index_check_block(struct grid_index_query *q, u_char *block,
+    u_char *next)
+{
+	u_int	i, bit;
+	u_char	mask;
+
+	for (i = 0; i < q->nbits; i++) {
+		bit = q->bits[i];
+		mask = (1 << (bit % 8));
+		if (block[bit / 8] & mask)
+			continue;
+		if (next != NULL && (next[bit / 8] & mask))
+			continue;
+		return (0);
+	}
+	return (1);
+}
+
+/* Check if a match may start on a line. */
+int
+grid_index_check(struct grid_index_query *q, u_int py)
+{
+	struct grid		*gd = q->gd;
+	struct grid_index	*gi = q->gi;
+	u_int			 line, n, last;
+	u_char			*block, *next = NULL;
+
+	if (py >= gd->hsize)
+		return (1);
+	line = gi->lines - gd->hsize + py;
+	if (line < gi->first)
+		return (1);
+
+	n = (line - gi->first) / GRID_INDEX_LINES;
+	if (n == q->block)
+		return (q->result);
+	q->block = n;
+
+	/* Lines in the last block may run onto lines not yet indexed. */
+	if (n + 1 >= gi->nblocks) {
+		q->result = 1;
+		return (1);
+	}
+	block = gi->blocks + (n * GRID_INDEX_SIZE);
+
+	last = gi->first + ((n + 1) * GRID_INDEX_LINES) - 1;
+	last = last - (gi->lines - gd->hsize);
+	if (grid_peek_line_packed(gd, last)->flags & GRID_LINE_WRAPPED) {
+		if (n + 2 >= gi->nblocks) {
+			q->result = 1;
+			return (1);
+		}
+		next = block + GRID_INDEX_SIZE;
+	}
+	q->result = grid_index_check_block(q, block, next);
+	return (q->result);
+}
+
+/* Finish a search. */
+void
+grid_index_end(struct grid_index_query *q)
+{
+	if (q != NULL) {
+		free(q->bits);
+		free(q);
+	}
+}
@@ -16,9 +16,29 @@
  * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#define XMALLOC_TAG XMALLOC_GRID
 #include "tmux.h"
+#include <stdlib.h>
 #include <string.h>
 
+/*
+ * Word motions test the cells of a line against the same separators over and
+ * over, so whether each cell in the line under the cursor is a separator is
+ * worked out once and kept in a byte array. This is only valid while the
+ * grid is not changed, so it is thrown away when a reader is started.
+ */
+struct grid_reader_classes {
+	const char		*set;
+	struct utf8_data	*list;
+	u_char			 ascii[128];
+
+	u_int			 line;
+	u_char			*classes;
+	u_int			 size;
+	u_int			 used;
+};
+static struct grid_reader_classes grid_reader_classes;
+
 /* Initialise virtual cursor. */
 void
 grid_reader_start(struct grid_reader *gr, struct grid *gd, u_int cx, u_int cy)
@@ -26,6 +46,63 @@ grid_reader_start(struct grid_reader *gr, struct grid *gd, u_int cx, u_int cy)
 	gr->gd = gd;
 	gr->cx = cx;
 	gr->cy = cy;
+
+	grid_reader_classes.set = NULL;
+}
+
+/* Check if a cell is a separator. */
+static int
+grid_reader_is_separator(struct grid_reader_classes *grc,
+    const struct grid_cell *gc)
+{
+	struct utf8_data	*loop;
+
+	if (gc->flags & GRID_FLAG_PADDING)
+		return (0);
+	if (gc->data.size == 1 && *gc->data.data < sizeof grc->ascii)
+		return (grc->ascii[*gc->data.data]);
+	for (loop = grc->list; loop->size != 0; loop++) {
+		if (loop->size == gc->data.size &&
+		    memcmp(loop->data, gc->data.data, loop->size) == 0)
+			return (1);
+	}
+	return (0);
+}
+
+/* Work out which cells of the line under the cursor are separators. */
+static struct grid_reader_classes *
+grid_reader_get_classes(struct grid_reader *gr, const char *set)
+{
+	struct grid_reader_classes	*grc = &grid_reader_classes;
+	struct utf8_data		*loop;
+	struct grid_cell		 gc;
+	u_int				 px;
+
+	if (grc->set != set) {
+		free(grc->list);
+		grc->list = utf8_fromcstr(set);
+		memset(grc->ascii, 0, sizeof grc->ascii);
+		for (loop = grc->list; loop->size != 0; loop++) {
+			if (loop->size == 1 && *loop->data < sizeof grc->ascii)
+				grc->ascii[*loop->data] = 1;
+		}
+		grc->set = set;
+		grc->line = UINT_MAX;
+	}
+	if (grc->line == gr->cy)
+		return (grc);
+
+	grc->used = grid_peek_line(gr->gd, gr->cy)->cellsize;
+	if (grc->used > grc->size) {
+		grc->classes = xrealloc(grc->classes, grc->used);
+		grc->size = grc->used;
+	}
+	for (px = 0; px < grc->used; px++) {
+		grid_get_cell(gr->gd, px, gr->cy, &gc);
+		grc->classes[px] = grid_reader_is_separator(grc, &gc);
+	}
+	grc->line = gr->cy;
+	return (grc);
 }
 
 /* Get cursor position from reader. */
@@ -48,7 +125,7 @@ void
 grid_reader_cursor_right(struct grid_reader *gr, int wrap, int all)
 {
 	u_int			px;
-	struct grid_cell	gc;
+	struct grid_char	gch;
 
 	if (all)
 		px = gr->gd->sx;
@@ -61,8 +138,8 @@ grid_reader_cursor_right(struct grid_reader *gr, int wrap, int all)
 	} else if (gr->cx < px) {
 		gr->cx++;
 		while (gr->cx < px) {
-			grid_get_cell(gr->gd, gr->cx, gr->cy, &gc);
-			if (~gc.flags & GRID_FLAG_PADDING)
+			grid_get_char(gr->gd, gr->cx, gr->cy, &gch);
+			if (~gch.flags & GRID_FLAG_PADDING)
 				break;
 			gr->cx++;
 		}
@@ -73,17 +150,17 @@ grid_reader_cursor_right(struct grid_reader *gr, int wrap, int all)
 void
 grid_reader_cursor_left(struct grid_reader *gr, int wrap)
 {
-	struct grid_cell	gc;
+	struct grid_char	gch;
 
 	while (gr->cx > 0) {
-		grid_get_cell(gr->gd, gr->cx, gr->cy, &gc);
-		if (~gc.flags & GRID_FLAG_PADDING)
+		grid_get_char(gr->gd, gr->cx, gr->cy, &gch);
+		if (~gch.flags & GRID_FLAG_PADDING)
 			break;
 		gr->cx--;
 	}
 	if (gr->cx == 0 && gr->cy > 0 &&
 	    (wrap ||
-	     grid_get_line(gr->gd, gr->cy - 1)->flags & GRID_LINE_WRAPPED)) {
+	     grid_peek_line(gr->gd, gr->cy - 1)->flags & GRID_LINE_WRAPPED)) {
 		grid_reader_cursor_up(gr);
 		grid_reader_cursor_end_of_line(gr, 0, 0);
 	} else if (gr->cx > 0)
@@ -94,13 +171,13 @@ grid_reader_cursor_left(struct grid_reader *gr, int wrap)
 void
 grid_reader_cursor_down(struct grid_reader *gr)
 {
-	struct grid_cell	gc;
+	struct grid_char	gch;
 
 	if (gr->cy < gr->gd->hsize + gr->gd->sy - 1)
 		gr->cy++;
 	while (gr->cx > 0) {
-		grid_get_cell(gr->gd, gr->cx, gr->cy, &gc);
-		if (~gc.flags & GRID_FLAG_PADDING)
+		grid_get_char(gr->gd, gr->cx, gr->cy, &gch);
+		if (~gch.flags & GRID_FLAG_PADDING)
 			break;
 		gr->cx--;
 	}
@@ -110,13 +187,13 @@ grid_reader_cursor_down(struct grid_reader *gr)
 void
 grid_reader_cursor_up(struct grid_reader *gr)
 {
-	struct grid_cell	gc;
+	struct grid_char	gch;
 
 	if (gr->cy > 0)
 		gr->cy--;
 	while (gr->cx > 0) {
-		grid_get_cell(gr->gd, gr->cx, gr->cy, &gc);
-		if (~gc.flags & GRID_FLAG_PADDING)
+		grid_get_char(gr->gd, gr->cx, gr->cy, &gch);
+		if (~gch.flags & GRID_FLAG_PADDING)
 			break;
 		gr->cx--;
 	}
@@ -128,7 +205,7 @@ grid_reader_cursor_start_of_line(struct grid_reader *gr, int wrap)
 {
 	if (wrap) {
 		while (gr->cy > 0 &&
-		    grid_get_line(gr->gd, gr->cy - 1)->flags &
+		    grid_peek_line(gr->gd, gr->cy - 1)->flags &
 		        GRID_LINE_WRAPPED)
 			gr->cy--;
 	}
@@ -143,7 +220,7 @@ grid_reader_cursor_end_of_line(struct grid_reader *gr, int wrap, int all)
 
 	if (wrap) {
 		yy = gr->gd->hsize + gr->gd->sy - 1;
-		while (gr->cy < yy && grid_get_line(gr->gd, gr->cy)->flags &
+		while (gr->cy < yy && grid_peek_line(gr->gd, gr->cy)->flags &
 		    GRID_LINE_WRAPPED)
 			gr->cy++;
 	}
@@ -157,12 +234,12 @@ grid_reader_cursor_end_of_line(struct grid_reader *gr, int wrap, int all)
 int
 grid_reader_in_set(struct grid_reader *gr, const char *set)
 {
-	struct grid_cell	gc;
+	struct grid_reader_classes	*grc;
 
-	grid_get_cell(gr->gd, gr->cx, gr->cy, &gc);
-	if (gc.flags & GRID_FLAG_PADDING)
-		return (0);
-	return (utf8_cstrhas(set, &gc.data));
+	grc = grid_reader_get_classes(gr, set);
+	if (gr->cx < grc->used)
+		return (grc->classes[gr->cx]);
+	return (grc->ascii[' ']);
 }
 
 /* Move cursor to the start of the next word. */
@@ -173,7 +250,7 @@ grid_reader_cursor_next_word(struct grid_reader *gr, const char *separators)
 	int expected = 0;
 
 	/* Do not break up wrapped words. */
-	if (grid_get_line(gr->gd, gr->cy)->flags & GRID_LINE_WRAPPED)
+	if (grid_peek_line(gr->gd, gr->cy)->flags & GRID_LINE_WRAPPED)
 		xx = gr->gd->sx - 1;
 	else
 		xx = grid_reader_line_length(gr);
@@ -197,7 +274,7 @@ grid_reader_cursor_next_word(struct grid_reader *gr, const char *separators)
 				grid_reader_cursor_start_of_line(gr, 0);
 				grid_reader_cursor_down(gr);
 
-				if (grid_get_line(gr->gd, gr->cy)->flags &
+				if (grid_peek_line(gr->gd, gr->cy)->flags &
 				    GRID_LINE_WRAPPED)
 					xx = gr->gd->sx - 1;
 				else
@@ -217,7 +294,7 @@ grid_reader_cursor_next_word_end(struct grid_reader *gr, const char *separators)
 	int	expected = 1;
 
 	/* Do not break up wrapped words. */
-	if (grid_get_line(gr->gd, gr->cy)->flags & GRID_LINE_WRAPPED)
+	if (grid_peek_line(gr->gd, gr->cy)->flags & GRID_LINE_WRAPPED)
 		xx = gr->gd->sx - 1;
 	else
 		xx = grid_reader_line_length(gr);
@@ -241,7 +318,7 @@ grid_reader_cursor_next_word_end(struct grid_reader *gr, const char *separators)
 				grid_reader_cursor_start_of_line(gr, 0);
 				grid_reader_cursor_down(gr);
 
-				if (grid_get_line(gr->gd, gr->cy)->flags &
+				if (grid_peek_line(gr->gd, gr->cy)->flags &
 				    GRID_LINE_WRAPPED)
 					xx = gr->gd->sx - 1;
 				else
@@ -292,7 +369,7 @@ grid_reader_cursor_previous_word(struct grid_reader *gr, const char *separators,
 		oldy = gr->cy;
 		if (gr->cx == 0) {
 			if (gr->cy == 0 ||
-			  ~grid_get_line(gr->gd, gr->cy - 1)->flags &
+			  ~grid_peek_line(gr->gd, gr->cy - 1)->flags &
 			  GRID_LINE_WRAPPED)
 				break;
 			grid_reader_cursor_up(gr);
@@ -330,7 +407,7 @@ grid_reader_cursor_jump(struct grid_reader *gr, const struct utf8_data *jc)
 		}
 
 		if (py == yy ||
-		    !(grid_get_line(gr->gd, py)->flags & GRID_LINE_WRAPPED))
+		    !(grid_peek_line(gr->gd, py)->flags & GRID_LINE_WRAPPED))
 			return 0;
 		px = 0;
 	}
@@ -359,7 +436,7 @@ grid_reader_cursor_jump_back(struct grid_reader *gr, const struct utf8_data *jc)
 		}
 
 		if (py == 1 ||
-		    !(grid_get_line(gr->gd, py - 2)->flags & GRID_LINE_WRAPPED))
+		    !(grid_peek_line(gr->gd, py - 2)->flags & GRID_LINE_WRAPPED))
 			return 0;
 		xx = grid_line_length(gr->gd, py - 2);
 	}
@@ -370,7 +447,7 @@ grid_reader_cursor_jump_back(struct grid_reader *gr, const struct utf8_data *jc)
 void
 grid_reader_cursor_back_to_indentation(struct grid_reader *gr)
 {
-	struct grid_cell	gc;
+	struct grid_char	gch;
 	u_int			px, py, xx, yy, oldx, oldy;
 
 	yy = gr->gd->hsize + gr->gd->sy - 1;
@@ -381,14 +458,14 @@ grid_reader_cursor_back_to_indentation(struct grid_reader *gr)
 	for (py = gr->cy; py <= yy; py++) {
 		xx = grid_line_length(gr->gd, py);
 		for (px = 0; px < xx; px++) {
-			grid_get_cell(gr->gd, px, py, &gc);
-			if (gc.data.size != 1 || *gc.data.data != ' ') {
+			grid_get_char(gr->gd, px, py, &gch);
+			if (gch.data != utf8_build_one(' ')) {
 				gr->cx = px;
 				gr->cy = py;
 				return;
 			}
 		}
-		if (~grid_get_line(gr->gd, py)->flags & GRID_LINE_WRAPPED)
+		if (~grid_peek_line(gr->gd, py)->flags & GRID_LINE_WRAPPED)
 			break;
 	}
 	gr->cx = oldx;
@@ -20,6 +20,7 @@
 
 #include <string.h>
 
+#define XMALLOC_TAG XMALLOC_GRID
 #include "tmux.h"
 
 /*
@@ -37,6 +38,13 @@ grid_view_get_cell(struct grid *gd, u_int px, u_int py, struct grid_cell *gc)
 	grid_get_cell(gd, grid_view_x(gd, px), grid_view_y(gd, py), gc);
 }
 
+/* Get cell character and flags. */
+void
+grid_view_get_char(struct grid *gd, u_int px, u_int py, struct grid_char *gch)
+{
+	grid_get_char(gd, grid_view_x(gd, px), grid_view_y(gd, py), gch);
+}
+
 /* Set cell. */
 void
 grid_view_set_cell(struct grid *gd, u_int px, u_int py,
@@ -115,7 +123,9 @@ grid_view_scroll_region_up(struct grid *gd, u_int rupper, u_int rlower,
 			rlower = grid_view_y(gd, rlower);
 			grid_scroll_history_region(gd, rupper, rlower, bg);
 		}
-	} else {
+	} else if (rupper == 0 && rlower == gd->sy - 1 && gd->hsize == 0)
+		grid_scroll_screen(gd, bg);
+	else {
 		rupper = grid_view_y(gd, rupper);
 		rlower = grid_view_y(gd, rlower);
 		grid_move_lines(gd, rupper, rupper + 1, rlower - rupper, bg);
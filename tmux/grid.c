@@ -17,10 +17,16 @@
  */
 
 #include <sys/types.h>
+#include <sys/mman.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#define XMALLOC_TAG XMALLOC_GRID
 #include "tmux.h"
 
 /*
@@ -33,8 +39,66 @@
  * (hsize - 1); from hsize to hsize + (sy - 1) is the viewable data. All
  * functions in this file work on absolute coordinates, grid-view.c has
  * functions which work on the screen data.
+ *
+ * Lines are stored in fixed size chunks of GRID_CHUNK_LINES lines, so adding
+ * lines at the bottom or trimming history from the top only allocates or
+ * frees whole chunks rather than resizing and shifting one large array. When
+ * a line enters the history, its cell data is moved into an arena belonging
+ * to its chunk; arenas are reference counted by the lines using them and
+ * freed with the last one.
+ *
+ * If hcompress is set, lines more than hcompress lines above the bottom of the
+ * history are packed into a run-length encoded form (see grid_pack_line).
+ * grid_get_line unpacks a line when it is needed; grid_pack_history packs any
+ * of these again.
+ *
+ * If hmemlimit is set and the history in memory grows beyond it, the oldest
+ * chunks are packed and written to a spool file in the socket directory. The
+ * lines are left pointing into a mapping of the file, so they are read back
+ * by the kernel only when they are next used.
+ *
+ * Cell data in an arena is never changed in place: a line is moved out of its
+ * arena before it is written. This means grid_snapshot can give another grid
+ * the same history lines by taking a reference to each arena instead of
+ * copying the data. When it starts at the top of the grid, it goes further
+ * and shares whole chunks: both grids use the same line data until one of
+ * them changes a line, when grid_get_line1 gives that grid its own copy of
+ * the chunk (grid_peek_line1 is used where lines are only read). A grid
+ * which did not create a shared chunk leaves its lines out of its byte
+ * counts until it copies it.
+ *
+ * Extended cells keep only the character and an index into a table of styles
+ * (attributes and colours) for the grid, so a line in one colour stores that
+ * colour once. The table may be shared with grids used only as containers
+ * while reflowing; once it fills up, styles no longer used by any line are
+ * collected and their indexes reused.
  */
 
+/* Number of lines in each chunk. */
+#define GRID_CHUNK_LINES 256
+
+/* Lines of history freed each time round the event loop when destroying. */
+#define GRID_REAP_LINES 8192
+
+/* Size of each arena and the largest line which will be placed in one. */
+#define GRID_ARENA_SIZE 65536
+#define GRID_ARENA_LINE_LIMIT (GRID_ARENA_SIZE / 8)
+
+/* Types of run in a packed line. */
+#define GRID_PACK_CELLS 0
+#define GRID_PACK_REPEAT 1
+#define GRID_PACK_EXTENDED 2
+
+/* Number of history lines reflowed at once with GRID_LAZYREFLOW. */
+#define GRID_REFLOW_LINES 1000
+
+/* Number of lines checked each time grid_compact is called. */
+#define GRID_COMPACT_LINES 1000
+
+/* Initial style table size and size before unused styles are collected. */
+#define GRID_STYLE_MIN 64
+#define GRID_STYLE_COLLECT 1024
+
 /* Default grid cell data. */
 const struct grid_cell grid_default_cell = {
 	{ { ' ' }, 0, 1, 1 }, 0, 0, 8, 8, 0
@@ -56,154 +120,1382 @@ static const struct grid_cell_entry grid_cleared_entry = {
 	GRID_FLAG_CLEARED, { .data = { 0, 8, 8, ' ' } }
 };
 
-/* Store cell in entry. */
+/* Grid cell style. */
+struct grid_style {
+	u_int			 index;
+	int			 marked;
+
+	u_short			 attr;
+	u_char			 flags;
+	int			 fg;
+	int			 bg;
+	int			 us;
+
+	RB_ENTRY(grid_style)	 entry;
+};
+RB_HEAD(grid_style_tree, grid_style);
+
+/* Grid style table. */
+struct grid_styles {
+	u_int			  references;
+
+	struct grid_style	**list;
+	u_int			  size;
+	u_int			  used;
+	u_int			  next;
+
+	struct grid_style	 *last;
+	struct grid_style_tree	  tree;
+};
+
+/* ANSI code to change between two sets of attributes and colours. */
+struct grid_string_code {
+	int			 valid;
+	int			 escape_c0;
+
+	u_short			 lastattr;
+	int			 lastfg;
+	int			 lastbg;
+
+	u_short			 attr;
+	int			 fg;
+	int			 bg;
+
+	char			 code[128];
+	size_t			 len;
+};
+
+static const struct grid_line *grid_peek_line1(struct grid *, u_int);
+static struct grid_line *grid_get_line1(struct grid *, u_int);
+static void	grid_unshare_chunk(struct grid *, u_int);
+static void	grid_free_line(struct grid *, u_int);
+static void	grid_spill_history(struct grid *);
+static u_char	*grid_pack_next_style(u_char *, size_t, size_t *);
+static void	grid_trim_history(struct grid *, u_int);
+static void	grid_reap_schedule(void);
+
+/* Grids with a large history waiting to be freed. */
+static TAILQ_HEAD(, grid) grid_reap_list =
+    TAILQ_HEAD_INITIALIZER(grid_reap_list);
+static struct event grid_reap_timer;
+
+/* Codes used by grid_string_cells. */
+static struct grid_string_code grid_string_codes[256];
+
+static int
+grid_style_cmp(struct grid_style *gs1, struct grid_style *gs2)
+{
+	if (gs1->attr != gs2->attr)
+		return (gs1->attr < gs2->attr ? -1 : 1);
+	if (gs1->flags != gs2->flags)
+		return (gs1->flags < gs2->flags ? -1 : 1);
+	if (gs1->fg != gs2->fg)
+		return (gs1->fg < gs2->fg ? -1 : 1);
+	if (gs1->bg != gs2->bg)
+		return (gs1->bg < gs2->bg ? -1 : 1);
+	if (gs1->us != gs2->us)
+		return (gs1->us < gs2->us ? -1 : 1);
+	return (0);
+}
+RB_GENERATE_STATIC(grid_style_tree, grid_style, entry, grid_style_cmp);
+
+/* Create a new arena. */
+static struct grid_arena *
+grid_arena_create(void)
+{
+	struct grid_arena	*ga;
+
+	ga = xmalloc(sizeof *ga + GRID_ARENA_SIZE);
+	ga->references = 1;
+	ga->size = GRID_ARENA_SIZE;
+	ga->used = 0;
+	ga->data = (u_char *)(ga + 1);
+	ga->spool = NULL;
+	ga->offset = 0;
+	return (ga);
+}
+
+/* Release a reference to a spool file and close it if it was the last. */
+static void
+grid_spool_release(struct grid_spool *spool)
+{
+	if (--spool->references != 0)
+		return;
+	close(spool->fd);
+	free(spool);
+}
+
+/* Release a reference to an arena and free it if it was the last. */
+static void
+grid_arena_release(struct grid_arena *ga)
+{
+	struct grid_spool	*spool = ga->spool;
+
+	if (--ga->references != 0)
+		return;
+	if (spool == NULL) {
+		free(ga);
+		return;
+	}
+
+	munmap(ga->data, ga->size);
+#ifdef FALLOC_FL_PUNCH_HOLE
+	fallocate(spool->fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+	    ga->offset, ga->size);
+#endif
+	if (--spool->regions == 0) {
+		if (ftruncate(spool->fd, 0) == 0)
+			spool->size = 0;
+	}
+	grid_spool_release(spool);
+	free(ga);
+}
+
+/* Create the spool file for a grid, in the same directory as the socket. */
+static struct grid_spool *
+grid_spool_create(void)
+{
+	struct grid_spool	*spool;
+	char			 path[PATH_MAX];
+	const char		*cp;
+	int			 fd;
+
+	cp = strrchr(socket_path, '/');
+	if (cp == NULL)
+		xsnprintf(path, sizeof path, "spool-XXXXXX");
+	else {
+		xsnprintf(path, sizeof path, "%.*s/spool-XXXXXX",
+		    (int)(cp - socket_path), socket_path);
+	}
+	if ((fd = mkstemp(path)) == -1) {
+		log_debug("%s: %s: %s", __func__, path, strerror(errno));
+		return (NULL);
+	}
+	unlink(path);
+	log_debug("%s: %s is fd %d", __func__, path, fd);
+
+	spool = xcalloc(1, sizeof *spool);
+	spool->references = 1;
+	spool->fd = fd;
+	return (spool);
+}
+
+/* Create a style table. */
+static struct grid_styles *
+grid_styles_create(void)
+{
+	struct grid_styles	*gst;
+
+	gst = xcalloc(1, sizeof *gst);
+	gst->references = 1;
+	RB_INIT(&gst->tree);
+	return (gst);
+}
+
+/* Release a reference to a style table and free it if it was the last. */
+static void
+grid_styles_release(struct grid_styles *gst)
+{
+	struct grid_style	*gs, *gs1;
+
+	if (--gst->references != 0)
+		return;
+	RB_FOREACH_SAFE(gs, grid_style_tree, &gst->tree, gs1) {
+		RB_REMOVE(grid_style_tree, &gst->tree, gs);
+		free(gs);
+	}
+	free(gst->list);
+	free(gst);
+}
+
+/* Make a grid use the same style table as another. */
+static void
+grid_styles_share(struct grid *gd, struct grid *from)
+{
+	grid_styles_release(gd->styles);
+	gd->styles = from->styles;
+	gd->styles->references++;
+}
+
+/* Mark a style as in use. */
+static void
+grid_styles_mark(struct grid_styles *gst, u_int idx)
+{
+	if (idx < gst->size && gst->list[idx] != NULL)
+		gst->list[idx]->marked = 1;
+}
+
+/* Free any styles not used by any line in the grid. */
+static void
+grid_styles_collect(struct grid *gd)
+{
+	struct grid_styles	*gst = gd->styles;
+	const struct grid_line	*gl;
+	struct grid_style	*gs;
+	size_t			 off;
+	u_int			 yy, i, idx, before = gst->used;
+	u_char			*cp;
+
+	for (yy = 0; yy < gd->hsize + gd->sy; yy++) {
+		gl = grid_peek_line1(gd, yy);
+		if (gl->flags & GRID_LINE_PACKED) {
+			off = 0;
+			while ((cp = grid_pack_next_style(gl->packdata,
+			    gl->packsize, &off)) != NULL) {
+				memcpy(&idx, cp, sizeof idx);
+				grid_styles_mark(gst, idx);
+			}
+			continue;
+		}
+		for (i = 0; i < gl->extdsize; i++)
+			grid_styles_mark(gst, gl->extddata[i].style);
+	}
+
+	for (i = 0; i < gst->size; i++) {
+		if ((gs = gst->list[i]) == NULL)
+			continue;
+		if (gs->marked) {
+			gs->marked = 0;
+			continue;
+		}
+		RB_REMOVE(grid_style_tree, &gst->tree, gs);
+		free(gs);
+		gst->list[i] = NULL;
+		gst->used--;
+	}
+	gst->next = 0;
+	gst->last = NULL;
+	log_debug("%s: %u of %u styles in use", __func__, gst->used, before);
+}
+
+/* Find or add a style for a cell and return its index. */
+static u_int
+grid_style_add(struct grid *gd, const struct grid_cell *gc)
+{
+	struct grid_styles	*gst = gd->styles;
+	struct grid_style	 find, *gs;
+	u_int			 size;
+
+	find.attr = gc->attr;
+	find.flags = (gc->flags & ~GRID_FLAG_CLEARED);
+	find.fg = gc->fg;
+	find.bg = gc->bg;
+	find.us = gc->us;
+
+	gs = gst->last;
+	if (gs == NULL || grid_style_cmp(gs, &find) != 0)
+		gs = RB_FIND(grid_style_tree, &gst->tree, &find);
+	if (gs != NULL) {
+		gst->last = gs;
+		return (gs->index);
+	}
+
+	if (gst->used == gst->size) {
+		if (gst->size >= GRID_STYLE_COLLECT &&
+		    gst->size >= gd->hsize + gd->sy &&
+		    gst->references == 1)
+			grid_styles_collect(gd);
+		if (gst->used == gst->size || gst->used > gst->size / 2) {
+			size = gst->size * 2;
+			if (size < GRID_STYLE_MIN)
+				size = GRID_STYLE_MIN;
+			gst->list = xreallocarray(gst->list, size,
+			    sizeof *gst->list);
+			memset(gst->list + gst->size, 0,
+			    (size - gst->size) * sizeof *gst->list);
+			gst->size = size;
+		}
+	}
+	while (gst->list[gst->next] != NULL)
+		gst->next = (gst->next + 1) % gst->size;
+
+	gs = xmalloc(sizeof *gs);
+	memcpy(gs, &find, sizeof *gs);
+	gs->index = gst->next;
+	gs->marked = 0;
+	RB_INSERT(grid_style_tree, &gst->tree, gs);
+
+	gst->list[gs->index] = gs;
+	gst->used++;
+	gst->last = gs;
+	return (gs->index);
+}
+
+/* Get the size of the style table used by a grid. */
+size_t
+grid_styles_size(struct grid *gd)
+{
+	struct grid_styles	*gst = gd->styles;
+
+	return (gst->size * sizeof *gst->list + gst->used * sizeof **gst->list);
+}
+
+/* Get a style by index. */
+static const struct grid_style *
+grid_style_get(struct grid *gd, u_int idx)
+{
+	struct grid_styles	*gst = gd->styles;
+
+	if (idx >= gst->size)
+		return (NULL);
+	return (gst->list[idx]);
+}
+
+/* Copy a style from one grid's table to another. */
+static u_int
+grid_style_copy(struct grid *dst, struct grid *src, u_int idx)
+{
+	const struct grid_style	*gs;
+	struct grid_cell	 gc;
+
+	if ((gs = grid_style_get(src, idx)) == NULL)
+		return (0);
+	memcpy(&gc, &grid_default_cell, sizeof gc);
+	gc.attr = gs->attr;
+	gc.flags = gs->flags;
+	gc.fg = gs->fg;
+	gc.bg = gs->bg;
+	gc.us = gs->us;
+	return (grid_style_add(dst, &gc));
+}
+
+/* Move a line's cell data out of its arena so it can be resized. */
+static void
+grid_detach_line(struct grid_line *gl)
+{
+	struct grid_cell_entry	*celldata = gl->celldata;
+	struct grid_extd_entry	*extddata = gl->extddata;
+
+	if (gl->arena == NULL)
+		return;
+
+	if (gl->cellsize != 0) {
+		gl->celldata = xreallocarray(NULL, gl->cellsize,
+		    sizeof *gl->celldata);
+		memcpy(gl->celldata, celldata,
+		    gl->cellsize * sizeof *gl->celldata);
+	} else
+		gl->celldata = NULL;
+	if (gl->extdsize != 0) {
+		gl->extddata = xreallocarray(NULL, gl->extdsize,
+		    sizeof *gl->extddata);
+		memcpy(gl->extddata, extddata,
+		    gl->extdsize * sizeof *gl->extddata);
+	} else
+		gl->extddata = NULL;
+
+	grid_arena_release(gl->arena);
+	gl->arena = NULL;
+}
+
+/* Add the size of a line's data to the grid counts or remove it. */
+static void
+grid_count_line(struct grid *gd, const struct grid_line *gl, int add)
+{
+	size_t	cells = 0, extended = 0, packed = 0;
+
+	if (gl->flags & GRID_LINE_PACKED)
+		packed = gl->packsize;
+	else {
+		cells = gl->cellsize * sizeof *gl->celldata;
+		extended = gl->extdsize * sizeof *gl->extddata;
+	}
+	if (add) {
+		gd->cellbytes += cells;
+		gd->extdbytes += extended;
+		gd->packbytes += packed;
+	} else {
+		gd->cellbytes -= cells;
+		gd->extdbytes -= extended;
+		gd->packbytes -= packed;
+	}
+}
+
+/* Store cell in entry. */
+static void
+grid_store_cell(struct grid_cell_entry *gce, const struct grid_cell *gc,
+    u_char c)
+{
+	gce->flags = (gc->flags & ~GRID_FLAG_CLEARED);
+
+	gce->data.fg = gc->fg & 0xff;
+	if (gc->fg & COLOUR_FLAG_256)
+		gce->flags |= GRID_FLAG_FG256;
+
+	gce->data.bg = gc->bg & 0xff;
+	if (gc->bg & COLOUR_FLAG_256)
+		gce->flags |= GRID_FLAG_BG256;
+
+	gce->data.attr = gc->attr;
+	gce->data.data = c;
+}
+
+/* Check if a cell should be an extended cell. */
+static int
+grid_need_extended_cell(const struct grid_cell_entry *gce,
+    const struct grid_cell *gc)
+{
+	if (gce->flags & GRID_FLAG_EXTENDED)
+		return (1);
+	if (gc->attr > 0xff)
+		return (1);
+	if (gc->data.size != 1 || gc->data.width != 1)
+		return (1);
+	if ((gc->fg & COLOUR_FLAG_RGB) || (gc->bg & COLOUR_FLAG_RGB))
+		return (1);
+	if (gc->us != 0) /* only supports 256 or RGB */
+		return (1);
+	return (0);
+}
+
+/* Get an extended cell. */
+static void
+grid_get_extended_cell(struct grid *gd, struct grid_line *gl,
+    struct grid_cell_entry *gce, int flags)
+{
+	u_int at = gl->extdsize + 1;
+
+	grid_detach_line(gl);
+	gl->extddata = xreallocarray(gl->extddata, at, sizeof *gl->extddata);
+	gl->extdsize = at;
+	gd->extdbytes += sizeof *gl->extddata;
+
+	gce->offset = at - 1;
+	gce->flags = (flags | GRID_FLAG_EXTENDED);
+}
+
+/* Set cell as extended. */
+static struct grid_extd_entry *
+grid_extended_cell(struct grid *gd, struct grid_line *gl,
+    struct grid_cell_entry *gce, const struct grid_cell *gc)
+{
+	struct grid_extd_entry	*gee;
+	int			 flags = (gc->flags & ~GRID_FLAG_CLEARED);
+	utf8_char		 uc;
+	u_int			 style;
+
+	style = grid_style_add(gd, gc);
+	if (~gce->flags & GRID_FLAG_EXTENDED)
+		grid_get_extended_cell(gd, gl, gce, flags);
+	else if (gce->offset >= gl->extdsize)
+		fatalx("offset too big");
+	gl->flags |= GRID_LINE_EXTENDED;
+
+	utf8_from_data(&gc->data, &uc);
+
+	gee = &gl->extddata[gce->offset];
+	gee->data = uc;
+	gee->style = style;
+	return (gee);
+}
+
+/* Free up unused extended cells. */
+static void
+grid_compact_line(struct grid *gd, struct grid_line *gl)
+{
+	int			 new_extdsize = 0;
+	struct grid_extd_entry	*new_extddata;
+	struct grid_cell_entry	*gce;
+	struct grid_extd_entry	*gee;
+	u_int			 px, idx;
+
+	if (gl->extdsize == 0)
+		return;
+
+	for (px = 0; px < gl->cellsize; px++) {
+		gce = &gl->celldata[px];
+		if (gce->flags & GRID_FLAG_EXTENDED)
+			new_extdsize++;
+	}
+	if (new_extdsize == (int)gl->extdsize)
+		return;
+	grid_detach_line(gl);
+	gd->extdbytes -= (gl->extdsize - new_extdsize) * sizeof *gl->extddata;
+
+	if (new_extdsize == 0) {
+		free(gl->extddata);
+		gl->extddata = NULL;
+		gl->extdsize = 0;
+		return;
+	}
+	new_extddata = xreallocarray(NULL, new_extdsize, sizeof *gl->extddata);
+
+	idx = 0;
+	for (px = 0; px < gl->cellsize; px++) {
+		gce = &gl->celldata[px];
+		if (gce->flags & GRID_FLAG_EXTENDED) {
+			gee = &gl->extddata[gce->offset];
+			memcpy(&new_extddata[idx], gee, sizeof *gee);
+			gce->offset = idx++;
+		}
+	}
+
+	free(gl->extddata);
+	gl->extddata = new_extddata;
+	gl->extdsize = new_extdsize;
+}
+
+/*
+ * Allocate space from the arena for the chunk containing a line, taking a
+ * reference to the arena. Returns NULL if the size is too big for an arena.
+ */
+static u_char *
+grid_arena_alloc(struct grid *gd, u_int py, size_t size,
+    struct grid_arena **gap)
+{
+	struct grid_chunk	*gch;
+	struct grid_arena	*ga;
+	u_char			*data;
+
+	if (size == 0 || size > GRID_ARENA_LINE_LIMIT)
+		return (NULL);
+
+	gch = &gd->chunks[(gd->offset + py) / GRID_CHUNK_LINES];
+	ga = gch->arena;
+	if (ga == NULL || ga->size - ga->used < size) {
+		if (ga != NULL)
+			grid_arena_release(ga);
+		ga = gch->arena = grid_arena_create();
+	}
+	data = ga->data + ga->used;
+	ga->used += size;
+	ga->references++;
+
+	*gap = ga;
+	return (data);
+}
+
+/* Move a history line's cell data into the arena for its chunk. */
+static void
+grid_arena_line(struct grid *gd, u_int py)
+{
+	struct grid_line	*gl = grid_get_line1(gd, py);
+	struct grid_arena	*ga;
+	size_t			 csize, esize;
+	u_char			*data;
+
+	if (gl->arena != NULL || (gl->flags & GRID_LINE_PACKED))
+		return;
+	csize = gl->cellsize * sizeof *gl->celldata;
+	esize = gl->extdsize * sizeof *gl->extddata;
+	data = grid_arena_alloc(gd, py, csize + esize, &ga);
+	if (data == NULL)
+		return;
+
+	if (csize != 0) {
+		memcpy(data, gl->celldata, csize);
+		free(gl->celldata);
+		gl->celldata = (struct grid_cell_entry *)data;
+	}
+	if (esize != 0) {
+		memcpy(data + csize, gl->extddata, esize);
+		free(gl->extddata);
+		gl->extddata = (struct grid_extd_entry *)(data + csize);
+	}
+	gl->arena = ga;
+}
+
+/* Write a packed number. */
+static size_t
+grid_pack_number(u_char *buf, u_int n)
+{
+	size_t	size = 0;
+
+	while (n >= 0x80) {
+		buf[size++] = (n & 0x7f) | 0x80;
+		n >>= 7;
+	}
+	buf[size++] = n;
+	return (size);
+}
+
+/* Read a packed number. */
+static size_t
+grid_unpack_number(const u_char *buf, size_t len, u_int *n)
+{
+	size_t	size = 0;
+	u_int	shift = 0;
+
+	*n = 0;
+	do {
+		if (size == len || shift > 28)
+			fatalx("bad packed line");
+		*n |= (u_int)(buf[size] & 0x7f) << shift;
+		shift += 7;
+	} while (buf[size++] & 0x80);
+	return (size);
+}
+
+/*
+ * Pack a line. Cells are stored as runs sharing the same flags, attributes
+ * and colours; each run starts with a packed number holding the run length
+ * and type followed by the cell entry flags. Runs of ordinary cells then have
+ * the attributes and colours and each character (or only one if they are all
+ * the same); runs of extended cells have the style index and each character.
+ */
+static void
+grid_pack_line(struct grid *gd, u_int py)
+{
+	struct grid_line		*gl;
+	static u_char			*buf;
+	static size_t			 bufsize;
+	struct grid_cell_entry		*gce, *gce1;
+	struct grid_extd_entry		*gee, *gee1;
+	struct grid_arena		*ga = NULL;
+	size_t				 size, off = 0;
+	u_int				 px, xx, n, type;
+	u_char				*data;
+
+	if (grid_peek_line1(gd, py)->flags & (GRID_LINE_PACKED|GRID_LINE_DEAD))
+		return;
+	gl = grid_get_line1(gd, py);
+	if (gl->cellsize == 0)
+		return;
+
+	size = gl->cellsize * (sizeof gee->style + sizeof gee->data + 6);
+	if (size > bufsize) {
+		buf = xrealloc(buf, size);
+		bufsize = size;
+	}
+
+	for (px = 0; px < gl->cellsize; px += n) {
+		gce = &gl->celldata[px];
+		if (gce->flags & GRID_FLAG_EXTENDED) {
+			if (gce->offset >= gl->extdsize)
+				return;
+			gee = &gl->extddata[gce->offset];
+			for (xx = px + 1; xx < gl->cellsize; xx++) {
+				gce1 = &gl->celldata[xx];
+				if (gce1->flags != gce->flags ||
+				    gce1->offset >= gl->extdsize)
+					break;
+				gee1 = &gl->extddata[gce1->offset];
+				if (gee1->style != gee->style)
+					break;
+			}
+			n = xx - px;
+
+			off += grid_pack_number(buf + off,
+			    (n << 2)|GRID_PACK_EXTENDED);
+			buf[off++] = gce->flags;
+			memcpy(buf + off, &gee->style, sizeof gee->style);
+			off += sizeof gee->style;
+			for (xx = px; xx < px + n; xx++) {
+				gee1 = &gl->extddata[gl->celldata[xx].offset];
+				memcpy(buf + off, &gee1->data, sizeof gee1->data);
+				off += sizeof gee1->data;
+			}
+			continue;
+		}
+
+		type = GRID_PACK_REPEAT;
+		for (xx = px + 1; xx < gl->cellsize; xx++) {
+			gce1 = &gl->celldata[xx];
+			if (gce1->flags != gce->flags ||
+			    gce1->data.attr != gce->data.attr ||
+			    gce1->data.fg != gce->data.fg ||
+			    gce1->data.bg != gce->data.bg)
+				break;
+			if (gce1->data.data != gce->data.data)
+				type = GRID_PACK_CELLS;
+		}
+		n = xx - px;
+
+		off += grid_pack_number(buf + off, (n << 2)|type);
+		buf[off++] = gce->flags;
+		buf[off++] = gce->data.attr;
+		buf[off++] = gce->data.fg;
+		buf[off++] = gce->data.bg;
+		if (type == GRID_PACK_REPEAT)
+			buf[off++] = gce->data.data;
+		else {
+			for (xx = px; xx < px + n; xx++)
+				buf[off++] = gl->celldata[xx].data.data;
+		}
+	}
+
+	/* Leave the line alone if packing it doesn't make it smaller. */
+	size = gl->cellsize * sizeof *gl->celldata;
+	size += gl->extdsize * sizeof *gl->extddata;
+	if (off >= size)
+		return;
+
+	data = grid_arena_alloc(gd, py, off, &ga);
+	if (data == NULL)
+		data = xmalloc(off);
+	memcpy(data, buf, off);
+
+	grid_free_line(gd, py);
+	gl->packdata = data;
+	gl->packsize = off;
+	gl->arena = ga;
+	gl->flags |= GRID_LINE_PACKED;
+	grid_count_line(gd, gl, 1);
+}
+
+/* Unpack a packed line. */
+static void
+grid_unpack_line(struct grid_line *gl)
+{
+	const u_char		*data = gl->packdata;
+	size_t			 size = gl->packsize, off = 0;
+	struct grid_cell_entry	*celldata, *gce;
+	struct grid_extd_entry	*extddata = NULL, *gee;
+	u_int			 extdsize = 0, px = 0, xx, n, type, style;
+	u_char			 flags;
+
+	celldata = xreallocarray(NULL, gl->cellsize, sizeof *celldata);
+	while (off < size) {
+		off += grid_unpack_number(data + off, size - off, &n);
+		type = (n & 3);
+		n >>= 2;
+		if (n == 0 || n > gl->cellsize - px || off == size)
+			fatalx("bad packed line");
+		flags = data[off++];
+
+		if (type == GRID_PACK_EXTENDED) {
+			if (size - off < sizeof style + n * sizeof gee->data)
+				fatalx("bad packed line");
+			memcpy(&style, data + off, sizeof style);
+			off += sizeof style;
+
+			extddata = xreallocarray(extddata, extdsize + n,
+			    sizeof *extddata);
+			for (xx = px; xx < px + n; xx++) {
+				gee = &extddata[extdsize];
+				gee->style = style;
+				memcpy(&gee->data, data + off, sizeof gee->data);
+				off += sizeof gee->data;
+
+				gce = &celldata[xx];
+				gce->flags = flags;
+				gce->offset = extdsize++;
+			}
+			px += n;
+			continue;
+		}
+
+		if (size - off < 3 + (type == GRID_PACK_REPEAT ? 1 : n))
+			fatalx("bad packed line");
+		for (xx = px; xx < px + n; xx++) {
+			gce = &celldata[xx];
+			gce->flags = flags;
+			gce->data.attr = data[off];
+			gce->data.fg = data[off + 1];
+			gce->data.bg = data[off + 2];
+			if (type == GRID_PACK_REPEAT)
+				gce->data.data = data[off + 3];
+			else
+				gce->data.data = data[off + 3 + (xx - px)];
+		}
+		off += 3 + (type == GRID_PACK_REPEAT ? 1 : n);
+		px += n;
+	}
+	if (px != gl->cellsize)
+		fatalx("bad packed line");
+
+	if (gl->arena != NULL) {
+		grid_arena_release(gl->arena);
+		gl->arena = NULL;
+	} else
+		free(gl->packdata);
+	gl->celldata = celldata;
+	gl->extddata = extddata;
+	gl->extdsize = extdsize;
+	gl->flags &= ~GRID_LINE_PACKED;
+}
+
+/*
+ * Find the next style index in a packed line, starting at the given offset.
+ * The offset is moved past the run containing it.
+ */
+static u_char *
+grid_pack_next_style(u_char *data, size_t size, size_t *off)
+{
+	u_char	*cp;
+	u_int	 n, type;
+
+	while (*off < size) {
+		*off += grid_unpack_number(data + *off, size - *off, &n);
+		type = (n & 3);
+		n >>= 2;
+		(*off)++;
+
+		if (type == GRID_PACK_EXTENDED) {
+			cp = data + *off;
+			*off += sizeof (u_int) + n * sizeof (utf8_char);
+			if (*off > size)
+				fatalx("bad packed line");
+			return (cp);
+		}
+		*off += 3 + (type == GRID_PACK_REPEAT ? 1 : n);
+	}
+	return (NULL);
+}
+
+/* Get line data without unpacking it, for reading only. */
+static const struct grid_line *
+grid_peek_line1(struct grid *gd, u_int line)
+{
+	u_int	idx = gd->offset + line;
+
+	return (&gd->chunks[idx / GRID_CHUNK_LINES].linedata[idx % GRID_CHUNK_LINES]);
+}
+
+/* Get line data without unpacking it. */
+static struct grid_line *
+grid_get_line1(struct grid *gd, u_int line)
+{
+	u_int	idx = gd->offset + line;
+
+	if (gd->chunks[idx / GRID_CHUNK_LINES].shared != NULL)
+		grid_unshare_chunk(gd, idx / GRID_CHUNK_LINES);
+	return (&gd->chunks[idx / GRID_CHUNK_LINES].linedata[idx % GRID_CHUNK_LINES]);
+}
+
+/* Get line data. */
+struct grid_line *
+grid_get_line(struct grid *gd, u_int line)
+{
+	struct grid_line	*gl = grid_get_line1(gd, line);
+
+	if (gl->flags & GRID_LINE_PACKED) {
+		grid_count_line(gd, gl, 0);
+		grid_unpack_line(gl);
+		grid_count_line(gd, gl, 1);
+		gd->hunpacked++;
+	}
+	return (gl);
+}
+
+/* Pack any lines in the history which have been unpacked. */
+void
+grid_pack_history(struct grid *gd)
+{
+	u_int	yy, i;
+
+	if (gd->hunpacked == 0)
+		return;
+	if (gd->hcompress != 0) {
+		for (yy = 0; yy + gd->hcompress < gd->hsize; yy++)
+			grid_pack_line(gd, yy);
+	}
+	gd->hunpacked = 0;
+
+	/* Lines may have been unpacked from the spool, so check it again. */
+	for (i = 0; i < gd->nchunks; i++)
+		gd->chunks[i].spilled = 0;
+	grid_spill_history(gd);
+}
+
+/*
+ * Remove cleared cells from the end of a line past the last used cell (or the
+ * grid width for lines on the screen).
+ */
+static void
+grid_trim_line(struct grid *gd, u_int py)
+{
+	struct grid_line	*gl = grid_get_line1(gd, py);
+	u_int			 limit = gl->cellused, px;
+
+	if (py >= gd->hsize && limit < gd->sx)
+		limit = gd->sx;
+	if (gl->cellsize <= limit)
+		return;
+
+	for (px = gl->cellsize; px > limit; px--) {
+		if (memcmp(&gl->celldata[px - 1], &grid_cleared_entry,
+		    sizeof grid_cleared_entry) != 0)
+			break;
+	}
+	if (px == gl->cellsize)
+		return;
+
+	grid_detach_line(gl);
+	if (px == 0) {
+		free(gl->celldata);
+		gl->celldata = NULL;
+	} else {
+		gl->celldata = xreallocarray(gl->celldata, px,
+		    sizeof *gl->celldata);
+	}
+	gd->cellbytes -= (gl->cellsize - px) * sizeof *gl->celldata;
+	gl->cellsize = px;
+}
+
+/*
+ * Compact the next batch of lines which are not packed or in an arena by
+ * trimming them and removing unused extended cells. The number of bytes
+ * freed is added to freed. Returns 1 if there are more lines to check or 0
+ * if the end of the grid was reached.
+ */
+int
+grid_compact(struct grid *gd, size_t *freed)
+{
+	struct grid_line	*gl;
+	size_t			 size;
+	u_int			 yy, total = gd->hsize + gd->sy, last;
+
+	if (gd->compactnext >= total)
+		gd->compactnext = 0;
+	last = gd->compactnext + GRID_COMPACT_LINES;
+	if (last > total)
+		last = total;
+
+	for (yy = gd->compactnext; yy < last; yy++) {
+		if (grid_peek_line1(gd, yy)->arena != NULL ||
+		    (grid_peek_line1(gd, yy)->flags & GRID_LINE_PACKED))
+			continue;
+		gl = grid_get_line1(gd, yy);
+		size = gl->cellsize * sizeof *gl->celldata;
+		size += gl->extdsize * sizeof *gl->extddata;
+
+		grid_trim_line(gd, yy);
+		grid_compact_line(gd, gl);
+
+		size -= gl->cellsize * sizeof *gl->celldata;
+		size -= gl->extdsize * sizeof *gl->extddata;
+		*freed += size;
+	}
+
+	if (last == total) {
+		gd->compactnext = 0;
+		return (0);
+	}
+	gd->compactnext = last;
+	return (1);
+}
+
+/* Check if a line has been written to the spool. */
+static int
+grid_line_spilled(const struct grid_line *gl)
+{
+	return (gl->arena != NULL && gl->arena->spool != NULL);
+}
+
+/* Work out the memory used by the history lines in a chunk. */
+static size_t
+grid_chunk_memory(struct grid *gd, u_int idx, u_int *first, u_int *last)
+{
+	const struct grid_line	*gl;
+	size_t			 size = 0;
+	u_int			 yy;
+
+	if (idx * GRID_CHUNK_LINES < gd->offset)
+		*first = 0;
+	else
+		*first = idx * GRID_CHUNK_LINES - gd->offset;
+	*last = (idx + 1) * GRID_CHUNK_LINES - gd->offset;
+	if (*last > gd->hsize)
+		*last = gd->hsize;
+
+	for (yy = *first; yy < *last; yy++) {
+		gl = grid_peek_line1(gd, yy);
+		if (grid_line_spilled(gl))
+			continue;
+		if (gl->flags & GRID_LINE_PACKED)
+			size += gl->packsize;
+		else {
+			size += gl->cellsize * sizeof *gl->celldata;
+			size += gl->extdsize * sizeof *gl->extddata;
+		}
+	}
+	return (size);
+}
+
+/* Write the history lines in a chunk to the spool file. */
+static int
+grid_spill_chunk(struct grid *gd, u_int idx)
+{
+	struct grid_chunk	*gch = &gd->chunks[idx];
+	struct grid_line	*gl;
+	struct grid_arena	*ga;
+	struct grid_spool	*spool;
+	size_t			 total = 0, off;
+	off_t			 at, page;
+	ssize_t			 n;
+	u_int			 first, last, yy;
+	u_char			*buf, *base;
+
+	grid_chunk_memory(gd, idx, &first, &last);
+	for (yy = first; yy < last; yy++) {
+		gl = grid_get_line1(gd, yy);
+		if (grid_line_spilled(gl))
+			continue;
+		grid_pack_line(gd, yy);
+		if (gl->flags & GRID_LINE_PACKED)
+			total += gl->packsize;
+	}
+	gch->spilled = 1;
+	if (total == 0)
+		return (0);
+
+	if (gd->spool == NULL && (gd->spool = grid_spool_create()) == NULL)
+		return (-1);
+	spool = gd->spool;
+
+	buf = xmalloc(total);
+	off = 0;
+	for (yy = first; yy < last; yy++) {
+		gl = grid_get_line1(gd, yy);
+		if (grid_line_spilled(gl) || (~gl->flags & GRID_LINE_PACKED))
+			continue;
+		memcpy(buf + off, gl->packdata, gl->packsize);
+		off += gl->packsize;
+	}
+
+	page = sysconf(_SC_PAGESIZE);
+	at = ((spool->size + page - 1) / page) * page;
+	for (off = 0; off < total; off += n) {
+		n = pwrite(spool->fd, buf + off, total - off, at + off);
+		if (n == -1 && errno == EINTR)
+			n = 0;
+		else if (n <= 0) {
+			log_debug("%s: write failed: %s", __func__,
+			    strerror(errno));
+			free(buf);
+			return (-1);
+		}
+	}
+	free(buf);
+
+	base = mmap(NULL, total, PROT_READ, MAP_SHARED, spool->fd, at);
+	if (base == MAP_FAILED) {
+		log_debug("%s: mmap failed: %s", __func__, strerror(errno));
+		return (-1);
+	}
+	spool->size = at + total;
+	spool->regions++;
+	spool->references++;
+
+	ga = xcalloc(1, sizeof *ga);
+	ga->size = ga->used = total;
+	ga->data = base;
+	ga->spool = spool;
+	ga->offset = at;
+
+	off = 0;
+	for (yy = first; yy < last; yy++) {
+		gl = grid_get_line1(gd, yy);
+		if (grid_line_spilled(gl) || (~gl->flags & GRID_LINE_PACKED))
+			continue;
+		if (gl->arena != NULL)
+			grid_arena_release(gl->arena);
+		else
+			free(gl->packdata);
+		gl->packdata = base + off;
+		gl->arena = ga;
+		ga->references++;
+		off += gl->packsize;
+	}
+	log_debug("%s: chunk %u, %zu bytes at %lld", __func__, idx, total,
+	    (long long)at);
+	return (0);
+}
+
+/*
+ * Spill the oldest history to the spool file if the memory used by the rest
+ * is over the limit. This only looks at chunks which are entirely history and
+ * not yet spilled.
+ */
+static void
+grid_spill_history(struct grid *gd)
+{
+	size_t	memory = 0;
+	u_int	i, first, last;
+
+	if (gd->hmemlimit == 0)
+		return;
+
+	for (i = (gd->offset + gd->hsize) / GRID_CHUNK_LINES; i > 0; i--) {
+		if (gd->chunks[i - 1].spilled)
+			return;
+		memory += grid_chunk_memory(gd, i - 1, &first, &last);
+		if (memory > gd->hmemlimit)
+			break;
+	}
+	for (; i > 0; i--) {
+		if (gd->chunks[i - 1].spilled)
+			break;
+		if (grid_spill_chunk(gd, i - 1) != 0)
+			break;
+	}
+}
+
+/* Free a chunk. Any lines in it must already have been freed or moved. */
+static void
+grid_free_chunk(struct grid_chunk *gch)
+{
+	if (gch->arena != NULL)
+		grid_arena_release(gch->arena);
+	if (gch->shared != NULL && --*gch->shared != 0)
+		return;
+	free(gch->shared);
+	free(gch->linedata);
+}
+
+/* Work out the lines of the grid in a chunk. */
 static void
-grid_store_cell(struct grid_cell_entry *gce, const struct grid_cell *gc,
-    u_char c)
+grid_chunk_lines(struct grid *gd, u_int idx, u_int *first, u_int *last)
 {
-	gce->flags = (gc->flags & ~GRID_FLAG_CLEARED);
-
-	gce->data.fg = gc->fg & 0xff;
-	if (gc->fg & COLOUR_FLAG_256)
-		gce->flags |= GRID_FLAG_FG256;
-
-	gce->data.bg = gc->bg & 0xff;
-	if (gc->bg & COLOUR_FLAG_256)
-		gce->flags |= GRID_FLAG_BG256;
-
-	gce->data.attr = gc->attr;
-	gce->data.data = c;
+	if (idx * GRID_CHUNK_LINES < gd->offset)
+		*first = 0;
+	else
+		*first = idx * GRID_CHUNK_LINES - gd->offset;
+	*last = (idx + 1) * GRID_CHUNK_LINES - gd->offset;
+	if (*last > gd->hsize + gd->sy)
+		*last = gd->hsize + gd->sy;
 }
 
-/* Check if a cell should be an extended cell. */
-static int
-grid_need_extended_cell(const struct grid_cell_entry *gce,
-    const struct grid_cell *gc)
+/* Add or remove the lines in a chunk from the byte counts. */
+static void
+grid_count_chunk(struct grid *gd, u_int idx, int add)
 {
-	if (gce->flags & GRID_FLAG_EXTENDED)
-		return (1);
-	if (gc->attr > 0xff)
-		return (1);
-	if (gc->data.size != 1 || gc->data.width != 1)
-		return (1);
-	if ((gc->fg & COLOUR_FLAG_RGB) || (gc->bg & COLOUR_FLAG_RGB))
-		return (1);
-	if (gc->us != 0) /* only supports 256 or RGB */
-		return (1);
-	return (0);
+	u_int	first, last, yy;
+
+	grid_chunk_lines(gd, idx, &first, &last);
+	for (yy = first; yy < last; yy++)
+		grid_count_line(gd, grid_peek_line1(gd, yy), add);
 }
 
-/* Get an extended cell. */
+/*
+ * Give a grid its own copy of a chunk shared with other grids, taking another
+ * reference to the arena of each line or copying the data of lines not in one.
+ * If no other grid is using the chunk any longer, it can just be kept.
+ */
 static void
-grid_get_extended_cell(struct grid_line *gl, struct grid_cell_entry *gce,
-    int flags)
+grid_unshare_chunk(struct grid *gd, u_int idx)
 {
-	u_int at = gl->extdsize + 1;
+	struct grid_chunk	*gch = &gd->chunks[idx];
+	struct grid_line	*linedata, *gl;
+	u_int			 i;
+	void			*data;
 
-	gl->extddata = xreallocarray(gl->extddata, at, sizeof *gl->extddata);
-	gl->extdsize = at;
+	if (--*gch->shared == 0)
+		free(gch->shared);
+	else {
+		linedata = xreallocarray(NULL, gch->size, sizeof *linedata);
+		memcpy(linedata, gch->linedata, gch->size * sizeof *linedata);
+		for (i = 0; i < gch->size; i++) {
+			gl = &linedata[i];
+			if (gl->arena != NULL) {
+				gl->arena->references++;
+				continue;
+			}
+			if (gl->flags & GRID_LINE_PACKED) {
+				data = xmalloc(gl->packsize);
+				memcpy(data, gl->packdata, gl->packsize);
+				gl->packdata = data;
+				continue;
+			}
+			if (gl->celldata != NULL && gl->cellsize != 0) {
+				data = xreallocarray(NULL, gl->cellsize,
+				    sizeof *gl->celldata);
+				memcpy(data, gl->celldata,
+				    gl->cellsize * sizeof *gl->celldata);
+				gl->celldata = data;
+			} else
+				gl->celldata = NULL;
+			if (gl->extddata != NULL && gl->extdsize != 0) {
+				data = xreallocarray(NULL, gl->extdsize,
+				    sizeof *gl->extddata);
+				memcpy(data, gl->extddata,
+				    gl->extdsize * sizeof *gl->extddata);
+				gl->extddata = data;
+			} else
+				gl->extddata = NULL;
+		}
+		gch->linedata = linedata;
+	}
+	gch->shared = NULL;
 
-	gce->offset = at - 1;
-	gce->flags = (flags | GRID_FLAG_EXTENDED);
+	if (gch->uncounted) {
+		grid_count_chunk(gd, idx, 1);
+		gch->uncounted = 0;
+	}
 }
 
-/* Set cell as extended. */
-static struct grid_extd_entry *
-grid_extended_cell(struct grid_line *gl, struct grid_cell_entry *gce,
-    const struct grid_cell *gc)
+/*
+ * Give dst, which must have no lines in use, ny lines and share the chunks
+ * entirely within the first ny lines of src with it. Returns the number of
+ * lines shared.
+ */
+static u_int
+grid_share_chunks(struct grid *dst, struct grid *src, u_int ny)
 {
-	struct grid_extd_entry	*gee;
-	int			 flags = (gc->flags & ~GRID_FLAG_CLEARED);
-	utf8_char		 uc;
+	struct grid_chunk	*sgch, *dgch;
+	u_int			 n, i;
 
-	if (~gce->flags & GRID_FLAG_EXTENDED)
-		grid_get_extended_cell(gl, gce, flags);
-	else if (gce->offset >= gl->extdsize)
-		fatalx("offset too big");
-	gl->flags |= GRID_LINE_EXTENDED;
+	n = (src->offset + ny) / GRID_CHUNK_LINES;
+	if (n == 0) {
+		grid_adjust_lines(dst, ny);
+		return (0);
+	}
 
-	utf8_from_data(&gc->data, &uc);
+	grid_adjust_lines(dst, 0);
+	dst->offset = src->offset;
+	dst->chunks = xcalloc(n, sizeof *dst->chunks);
+	dst->nchunks = n;
+	for (i = 0; i < n; i++) {
+		sgch = &src->chunks[i];
+		dgch = &dst->chunks[i];
+
+		if (sgch->shared == NULL) {
+			sgch->shared = xmalloc(sizeof *sgch->shared);
+			*sgch->shared = 1;
+		}
+		(*sgch->shared)++;
 
-	gee = &gl->extddata[gce->offset];
-	gee->data = uc;
-	gee->attr = gc->attr;
-	gee->flags = flags;
-	gee->fg = gc->fg;
-	gee->bg = gc->bg;
-	gee->us = gc->us;
-	return (gee);
+		dgch->linedata = sgch->linedata;
+		dgch->size = sgch->size;
+		dgch->spilled = sgch->spilled;
+		dgch->shared = sgch->shared;
+		dgch->uncounted = 1;
+	}
+	grid_adjust_lines(dst, ny);
+	return (n * GRID_CHUNK_LINES - dst->offset);
 }
 
-/* Free up unused extended cells. */
-static void
-grid_compact_line(struct grid_line *gl)
+/* Number of lines to allocate for a chunk holding n lines. */
+static u_int
+grid_chunk_size(u_int n)
 {
-	int			 new_extdsize = 0;
-	struct grid_extd_entry	*new_extddata;
-	struct grid_cell_entry	*gce;
-	struct grid_extd_entry	*gee;
-	u_int			 px, idx;
-
-	if (gl->extdsize == 0)
-		return;
+	u_int	size;
 
-	for (px = 0; px < gl->cellsize; px++) {
-		gce = &gl->celldata[px];
-		if (gce->flags & GRID_FLAG_EXTENDED)
-			new_extdsize++;
-	}
+	if (n >= GRID_CHUNK_LINES)
+		return (GRID_CHUNK_LINES);
+	for (size = 8; size < n; size *= 2)
+		/* nothing */;
+	return (size);
+}
 
-	if (new_extdsize == 0) {
-		free(gl->extddata);
-		gl->extddata = NULL;
-		gl->extdsize = 0;
+/*
+ * Adjust number of lines. Any lines being removed must already have been
+ * freed, new lines are empty.
+ */
+void
+grid_adjust_lines(struct grid *gd, u_int lines)
+{
+	struct grid_chunk	*gch;
+	u_int			 total, nchunks, i, size, used;
+
+	if (lines == 0) {
+		for (i = 0; i < gd->nchunks; i++)
+			grid_free_chunk(&gd->chunks[i]);
+		free(gd->chunks);
+		gd->chunks = NULL;
+		gd->nchunks = 0;
+		gd->offset = 0;
 		return;
 	}
-	new_extddata = xreallocarray(NULL, new_extdsize, sizeof *gl->extddata);
+	total = gd->offset + lines;
+	nchunks = (total + GRID_CHUNK_LINES - 1) / GRID_CHUNK_LINES;
+
+	for (i = nchunks; i < gd->nchunks; i++)
+		grid_free_chunk(&gd->chunks[i]);
+	if (nchunks != gd->nchunks) {
+		gd->chunks = xrecallocarray(gd->chunks, gd->nchunks, nchunks,
+		    sizeof *gd->chunks);
+	}
+	gd->nchunks = nchunks;
 
-	idx = 0;
-	for (px = 0; px < gl->cellsize; px++) {
-		gce = &gl->celldata[px];
-		if (gce->flags & GRID_FLAG_EXTENDED) {
-			gee = &gl->extddata[gce->offset];
-			memcpy(&new_extddata[idx], gee, sizeof *gee);
-			gce->offset = idx++;
+	for (i = 0; i < nchunks; i++) {
+		gch = &gd->chunks[i];
+		if (i == nchunks - 1)
+			used = total - i * GRID_CHUNK_LINES;
+		else
+			used = GRID_CHUNK_LINES;
+		size = grid_chunk_size(used);
+		if (gch->shared != NULL && used != gch->size)
+			grid_unshare_chunk(gd, i);
+		if (size != gch->size) {
+			if (size > gch->size)
+				server_stats.grid_lines += size - gch->size;
+			gch->linedata = xrecallocarray(gch->linedata, gch->size, size,
+			    sizeof *gch->linedata);
+			gch->size = size;
+		}
+		if (used < size) {
+			memset(&gch->linedata[used], 0,
+			    (size - used) * sizeof *gch->linedata);
 		}
 	}
-
-	free(gl->extddata);
-	gl->extddata = new_extddata;
-	gl->extdsize = new_extdsize;
 }
 
-/* Get line data. */
-struct grid_line *
-grid_get_line(struct grid *gd, u_int line)
+/*
+ * Add one empty line at the end of the grid. This happens for every line
+ * scrolled, so only the last chunk is changed, or a new chunk added if it is
+ * full. Lines after the last are always kept empty so the new line already
+ * is.
+ */
+static void
+grid_add_line(struct grid *gd)
 {
-	return (&gd->linedata[line]);
+	struct grid_chunk	*gch;
+	u_int			 total, idx, size, used;
+
+	total = gd->offset + gd->hsize + gd->sy + 1;
+	idx = (total - 1) / GRID_CHUNK_LINES;
+	if (idx == gd->nchunks) {
+		gd->chunks = xrecallocarray(gd->chunks, gd->nchunks, idx + 1,
+		    sizeof *gd->chunks);
+		gd->nchunks = idx + 1;
+	}
+
+	gch = &gd->chunks[idx];
+	used = total - idx * GRID_CHUNK_LINES;
+	if (gch->shared != NULL && used != gch->size)
+		grid_unshare_chunk(gd, idx);
+	size = grid_chunk_size(used);
+	if (size > gch->size) {
+		server_stats.grid_lines += size - gch->size;
+		gch->linedata = xrecallocarray(gch->linedata, gch->size, size,
+		    sizeof *gch->linedata);
+		gch->size = size;
+	}
 }
 
-/* Adjust number of lines. */
-void
-grid_adjust_lines(struct grid *gd, u_int lines)
+/*
+ * Move line data within the grid, overwriting the destination lines without
+ * freeing them.
+ */
+static void
+grid_move_line_data(struct grid *gd, u_int dy, u_int py, u_int ny)
 {
-	gd->linedata = xreallocarray(gd->linedata, lines, sizeof *gd->linedata);
+	u_int	yy;
+
+	if (dy < py) {
+		for (yy = 0; yy < ny; yy++) {
+			memcpy(grid_get_line1(gd, dy + yy),
+			    grid_get_line1(gd, py + yy),
+			    sizeof (struct grid_line));
+		}
+	} else if (dy > py) {
+		for (yy = ny; yy > 0; yy--) {
+			memcpy(grid_get_line1(gd, dy + yy - 1),
+			    grid_get_line1(gd, py + yy - 1),
+			    sizeof (struct grid_line));
+		}
+	}
 }
 
 /* Copy default into a cell. */
 static void
 grid_clear_cell(struct grid *gd, u_int px, u_int py, u_int bg)
 {
-	struct grid_line	*gl = &gd->linedata[py];
-	struct grid_cell_entry	*gce = &gl->celldata[px];
-	struct grid_extd_entry	*gee;
+	struct grid_line	*gl = grid_get_line(gd, py);
+	struct grid_cell_entry	*gce;
+	struct grid_cell	 gc;
 
+	grid_detach_line(gl);
+	gce = &gl->celldata[px];
 	memcpy(gce, &grid_cleared_entry, sizeof *gce);
 	if (bg != 8) {
 		if (bg & COLOUR_FLAG_RGB) {
-			grid_get_extended_cell(gl, gce, gce->flags);
-			gee = grid_extended_cell(gl, gce, &grid_cleared_cell);
-			gee->bg = bg;
+			memcpy(&gc, &grid_cleared_cell, sizeof gc);
+			gc.bg = bg;
+			grid_extended_cell(gd, gl, gce, &gc);
+			gce->flags |= GRID_FLAG_CLEARED;
 		} else {
 			if (bg & COLOUR_FLAG_256)
 				gce->flags |= GRID_FLAG_BG256;
@@ -251,10 +1543,22 @@ grid_cells_equal(const struct grid_cell *gc1, const struct grid_cell *gc2)
 static void
 grid_free_line(struct grid *gd, u_int py)
 {
-	free(gd->linedata[py].celldata);
-	gd->linedata[py].celldata = NULL;
-	free(gd->linedata[py].extddata);
-	gd->linedata[py].extddata = NULL;
+	struct grid_line	*gl = grid_get_line1(gd, py);
+
+	grid_count_line(gd, gl, 0);
+	if (gl->arena != NULL) {
+		grid_arena_release(gl->arena);
+		gl->arena = NULL;
+	} else if (gl->flags & GRID_LINE_PACKED)
+		free(gl->packdata);
+	else {
+		free(gl->celldata);
+		free(gl->extddata);
+	}
+	gl->flags &= ~GRID_LINE_PACKED;
+	gl->celldata = NULL;
+	gl->extddata = NULL;
+	gl->extdsize = 0;
 }
 
 /* Free several lines. */
@@ -267,6 +1571,34 @@ grid_free_lines(struct grid *gd, u_int py, u_int ny)
 		grid_free_line(gd, yy);
 }
 
+/*
+ * Free lines whose chunks are about to be freed. A chunk shared with another
+ * grid is left alone if all its lines are included, so grid_free_chunk just
+ * gives it up rather than it being copied first.
+ */
+static void
+grid_discard_lines(struct grid *gd, u_int py, u_int ny)
+{
+	struct grid_chunk	*gch;
+	u_int			 yy, idx, first, last;
+
+	for (yy = py; yy < py + ny; yy++) {
+		idx = (gd->offset + yy) / GRID_CHUNK_LINES;
+		gch = &gd->chunks[idx];
+		if (gch->shared != NULL && *gch->shared != 1) {
+			grid_chunk_lines(gd, idx, &first, &last);
+			if (yy == first && last <= py + ny) {
+				if (!gch->uncounted)
+					grid_count_chunk(gd, idx, 0);
+				gch->uncounted = 1;
+				yy = last - 1;
+				continue;
+			}
+		}
+		grid_free_line(gd, yy);
+	}
+}
+
 /* Create a new grid. */
 struct grid *
 grid_create(u_int sx, u_int sy, u_int hlimit)
@@ -286,23 +1618,100 @@ grid_create(u_int sx, u_int sy, u_int hlimit)
 	gd->hsize = 0;
 	gd->hlimit = hlimit;
 
-	if (gd->sy != 0)
-		gd->linedata = xcalloc(gd->sy, sizeof *gd->linedata);
-	else
-		gd->linedata = NULL;
+	gd->hcompress = 0;
+	gd->hunpacked = 0;
+
+	gd->hmemlimit = 0;
+	gd->spool = NULL;
+
+	gd->hpending = 0;
+
+	gd->styles = grid_styles_create();
+
+	gd->compactnext = 0;
+
+	gd->cellbytes = 0;
+	gd->extdbytes = 0;
+	gd->packbytes = 0;
+
+	gd->chunks = NULL;
+	gd->nchunks = 0;
+	gd->offset = 0;
+	grid_adjust_lines(gd, gd->sy);
+
+	gd->index = NULL;
 
 	return (gd);
 }
 
-/* Destroy grid. */
+/* Free a grid. */
+static void
+grid_destroy1(struct grid *gd)
+{
+	grid_discard_lines(gd, 0, gd->hsize + gd->sy);
+	grid_adjust_lines(gd, 0);
+
+	if (gd->spool != NULL)
+		grid_spool_release(gd->spool);
+	grid_styles_release(gd->styles);
+	grid_index_free(gd->index);
+
+	free(gd);
+}
+
+/* Free some of the history of grids waiting to be destroyed. */
+static void
+grid_reap_callback(__unused int fd, __unused short events, __unused void *arg)
+{
+	struct grid	*gd;
+	u_int		 left = GRID_REAP_LINES, ny;
+
+	while (left != 0 && (gd = TAILQ_FIRST(&grid_reap_list)) != NULL) {
+		ny = gd->hsize;
+		if (ny > left)
+			ny = left;
+		grid_trim_history(gd, ny);
+		gd->hsize -= ny;
+		left -= ny;
+
+		if (gd->hsize == 0) {
+			TAILQ_REMOVE(&grid_reap_list, gd, reap_entry);
+			grid_destroy1(gd);
+		}
+	}
+	if (!TAILQ_EMPTY(&grid_reap_list))
+		grid_reap_schedule();
+}
+
+/* Start freeing waiting grids from the event loop. */
+static void
+grid_reap_schedule(void)
+{
+	struct timeval	tv = { 0 };
+
+	if (!event_initialized(&grid_reap_timer))
+		evtimer_set(&grid_reap_timer, grid_reap_callback, NULL);
+	evtimer_add(&grid_reap_timer, &tv);
+}
+
+/*
+ * Destroy grid. A grid with a large history may take a long time to free, so
+ * it is freed from the event loop a part at a time instead.
+ */
 void
 grid_destroy(struct grid *gd)
 {
-	grid_free_lines(gd, 0, gd->hsize + gd->sy);
+	if (gd->hsize <= GRID_REAP_LINES) {
+		grid_destroy1(gd);
+		return;
+	}
+	log_debug("%s: %u lines freed later", __func__, gd->hsize);
 
-	free(gd->linedata);
+	grid_index_free(gd->index);
+	gd->index = NULL;
 
-	free(gd);
+	TAILQ_INSERT_TAIL(&grid_reap_list, gd, reap_entry);
+	grid_reap_schedule();
 }
 
 /* Compare grids. */
@@ -317,8 +1726,8 @@ grid_compare(struct grid *ga, struct grid *gb)
 		return (1);
 
 	for (yy = 0; yy < ga->sy; yy++) {
-		gla = &ga->linedata[yy];
-		glb = &gb->linedata[yy];
+		gla = grid_get_line(ga, yy);
+		glb = grid_get_line(gb, yy);
 		if (gla->cellsize != glb->cellsize)
 			return (1);
 		for (xx = 0; xx < gla->cellsize; xx++) {
@@ -332,13 +1741,27 @@ grid_compare(struct grid *ga, struct grid *gb)
 	return (0);
 }
 
-/* Trim lines from the history. */
+/*
+ * Trim lines from the history. This only moves the offset into the first
+ * chunk and frees any chunks which are now unused.
+ */
 static void
 grid_trim_history(struct grid *gd, u_int ny)
 {
-	grid_free_lines(gd, 0, ny);
-	memmove(&gd->linedata[0], &gd->linedata[ny],
-	    (gd->hsize + gd->sy - ny) * (sizeof *gd->linedata));
+	u_int	n, i;
+
+	grid_discard_lines(gd, 0, ny);
+	gd->offset += ny;
+
+	n = gd->offset / GRID_CHUNK_LINES;
+	if (n == 0)
+		return;
+	for (i = 0; i < n; i++)
+		grid_free_chunk(&gd->chunks[i]);
+	memmove(&gd->chunks[0], &gd->chunks[n],
+	    (gd->nchunks - n) * sizeof *gd->chunks);
+	gd->nchunks -= n;
+	gd->offset -= n * GRID_CHUNK_LINES;
 }
 
 /*
@@ -359,15 +1782,17 @@ grid_collect_history(struct grid *gd)
 	if (ny > gd->hsize)
 		ny = gd->hsize;
 
-	/*
-	 * Free the lines from 0 to ny then move the remaining lines over
-	 * them.
-	 */
+	/* Free the lines from 0 to ny and any chunks they leave empty. */
 	grid_trim_history(gd, ny);
 
 	gd->hsize -= ny;
 	if (gd->hscrolled > gd->hsize)
 		gd->hscrolled = gd->hsize;
+	if (gd->hpending > ny)
+		gd->hpending -= ny;
+	else
+		gd->hpending = 0;
+	grid_index_trim(gd);
 }
 
 /* Remove lines from the bottom of the history. */
@@ -381,6 +1806,28 @@ grid_remove_history(struct grid *gd, u_int ny)
 	for (yy = 0; yy < ny; yy++)
 		grid_free_line(gd, gd->hsize + gd->sy - 1 - yy);
 	gd->hsize -= ny;
+	if (gd->hpending > gd->hsize)
+		gd->hpending = gd->hsize;
+	grid_index_remove(gd, ny);
+}
+
+/*
+ * Scroll the entire screen of a grid with no history, losing the top line.
+ * Lines are stored from an offset into the chunks, so rather than moving
+ * every line up, allocate a new line at the bottom and move the offset over
+ * the top line.
+ */
+void
+grid_scroll_screen(struct grid *gd, u_int bg)
+{
+	u_int	yy = gd->sy;
+
+	if (gd->hsize != 0)
+		fatalx("%s: grid has history", __func__);
+
+	grid_add_line(gd);
+	grid_empty_line(gd, yy, bg);
+	grid_trim_history(gd, 1);
 }
 
 /*
@@ -393,13 +1840,18 @@ grid_scroll_history(struct grid *gd, u_int bg)
 	u_int	yy;
 
 	yy = gd->hsize + gd->sy;
-	gd->linedata = xreallocarray(gd->linedata, yy + 1,
-	    sizeof *gd->linedata);
+	grid_add_line(gd);
 	grid_empty_line(gd, yy, bg);
 
 	gd->hscrolled++;
-	grid_compact_line(&gd->linedata[gd->hsize]);
+	grid_compact_line(gd, grid_get_line(gd, gd->hsize));
+	grid_arena_line(gd, gd->hsize);
 	gd->hsize++;
+	grid_index_add(gd, 1);
+	if (gd->hcompress != 0 && gd->hsize > gd->hcompress)
+		grid_pack_line(gd, gd->hsize - gd->hcompress - 1);
+	if ((gd->offset + gd->hsize) % GRID_CHUNK_LINES == 0)
+		grid_spill_history(gd);
 }
 
 /* Clear the history. */
@@ -410,42 +1862,44 @@ grid_clear_history(struct grid *gd)
 
 	gd->hscrolled = 0;
 	gd->hsize = 0;
+	gd->hunpacked = 0;
+	gd->hpending = 0;
 
-	gd->linedata = xreallocarray(gd->linedata, gd->sy,
-	    sizeof *gd->linedata);
+	grid_adjust_lines(gd, gd->sy);
+	grid_index_clear(gd);
 }
 
 /* Scroll a region up, moving the top line into the history. */
 void
 grid_scroll_history_region(struct grid *gd, u_int upper, u_int lower, u_int bg)
 {
-	struct grid_line	*gl_history, *gl_upper;
-	u_int			 yy;
-
 	/* Create a space for a new line. */
-	yy = gd->hsize + gd->sy;
-	gd->linedata = xreallocarray(gd->linedata, yy + 1,
-	    sizeof *gd->linedata);
+	grid_add_line(gd);
 
 	/* Move the entire screen down to free a space for this line. */
-	gl_history = &gd->linedata[gd->hsize];
-	memmove(gl_history + 1, gl_history, gd->sy * sizeof *gl_history);
+	grid_move_line_data(gd, gd->hsize + 1, gd->hsize, gd->sy);
 
 	/* Adjust the region and find its start and end. */
 	upper++;
-	gl_upper = &gd->linedata[upper];
 	lower++;
 
 	/* Move the line into the history. */
-	memcpy(gl_history, gl_upper, sizeof *gl_history);
+	memcpy(grid_get_line(gd, gd->hsize), grid_get_line(gd, upper),
+	    sizeof (struct grid_line));
+	grid_arena_line(gd, gd->hsize);
 
 	/* Then move the region up and clear the bottom line. */
-	memmove(gl_upper, gl_upper + 1, (lower - upper) * sizeof *gl_upper);
+	grid_move_line_data(gd, upper, upper + 1, lower - upper);
 	grid_empty_line(gd, lower, bg);
 
 	/* Move the history offset down over the line. */
 	gd->hscrolled++;
 	gd->hsize++;
+	grid_index_add(gd, 1);
+	if (gd->hcompress != 0 && gd->hsize > gd->hcompress)
+		grid_pack_line(gd, gd->hsize - gd->hcompress - 1);
+	if ((gd->offset + gd->hsize) % GRID_CHUNK_LINES == 0)
+		grid_spill_history(gd);
 }
 
 /* Expand line to fit to cell. */
@@ -455,9 +1909,10 @@ grid_expand_line(struct grid *gd, u_int py, u_int sx, u_int bg)
 	struct grid_line	*gl;
 	u_int			 xx;
 
-	gl = &gd->linedata[py];
+	gl = grid_get_line(gd, py);
 	if (sx <= gl->cellsize)
 		return;
+	grid_detach_line(gl);
 
 	if (sx < gd->sx / 4)
 		sx = gd->sx / 4;
@@ -467,6 +1922,7 @@ grid_expand_line(struct grid *gd, u_int py, u_int sx, u_int bg)
 		sx = gd->sx;
 
 	gl->celldata = xreallocarray(gl->celldata, sx, sizeof *gl->celldata);
+	gd->cellbytes += (sx - gl->cellsize) * sizeof *gl->celldata;
 	for (xx = gl->cellsize; xx < sx; xx++)
 		grid_clear_cell(gd, xx, py, bg);
 	gl->cellsize = sx;
@@ -476,7 +1932,7 @@ grid_expand_line(struct grid *gd, u_int py, u_int sx, u_int bg)
 void
 grid_empty_line(struct grid *gd, u_int py, u_int bg)
 {
-	memset(&gd->linedata[py], 0, sizeof gd->linedata[py]);
+	memset(grid_get_line1(gd, py), 0, sizeof (struct grid_line));
 	if (!COLOUR_DEFAULT(bg))
 		grid_expand_line(gd, py, gd->sx, bg);
 }
@@ -484,29 +1940,49 @@ grid_empty_line(struct grid *gd, u_int py, u_int bg)
 /* Peek at grid line. */
 const struct grid_line *
 grid_peek_line(struct grid *gd, u_int py)
+{
+	const struct grid_line	*gl;
+
+	if (grid_check_y(gd, __func__, py) != 0)
+		return (NULL);
+	gl = grid_peek_line1(gd, py);
+	if (gl->flags & GRID_LINE_PACKED)
+		return (grid_get_line(gd, py));
+	return (gl);
+}
+
+/* Peek at grid line without unpacking it. */
+const struct grid_line *
+grid_peek_line_packed(struct grid *gd, u_int py)
 {
 	if (grid_check_y(gd, __func__, py) != 0)
 		return (NULL);
-	return (&gd->linedata[py]);
+	return (grid_peek_line1(gd, py));
 }
 
 /* Get cell from line. */
 static void
-grid_get_cell1(struct grid_line *gl, u_int px, struct grid_cell *gc)
+grid_get_cell1(struct grid *gd, const struct grid_line *gl, u_int px,
+    struct grid_cell *gc)
 {
-	struct grid_cell_entry	*gce = &gl->celldata[px];
-	struct grid_extd_entry	*gee;
+	const struct grid_cell_entry	*gce = &gl->celldata[px];
+	const struct grid_extd_entry	*gee;
+	const struct grid_style	*gs;
 
 	if (gce->flags & GRID_FLAG_EXTENDED) {
 		if (gce->offset >= gl->extdsize)
 			memcpy(gc, &grid_default_cell, sizeof *gc);
 		else {
 			gee = &gl->extddata[gce->offset];
-			gc->flags = gee->flags;
-			gc->attr = gee->attr;
-			gc->fg = gee->fg;
-			gc->bg = gee->bg;
-			gc->us = gee->us;
+			if ((gs = grid_style_get(gd, gee->style)) == NULL)
+				memcpy(gc, &grid_default_cell, sizeof *gc);
+			else {
+				gc->flags = gs->flags;
+				gc->attr = gs->attr;
+				gc->fg = gs->fg;
+				gc->bg = gs->bg;
+				gc->us = gs->us;
+			}
 			utf8_to_data(gee->data, &gc->data);
 		}
 		return;
@@ -524,15 +2000,139 @@ grid_get_cell1(struct grid_line *gl, u_int px, struct grid_cell *gc)
 	utf8_set(&gc->data, gce->data.data);
 }
 
-/* Get cell for reading. */
-void
-grid_get_cell(struct grid *gd, u_int px, u_int py, struct grid_cell *gc)
+/* Get cell for reading. */
+void
+grid_get_cell(struct grid *gd, u_int px, u_int py, struct grid_cell *gc)
+{
+	const struct grid_line	*gl;
+
+	if (grid_check_y(gd, __func__, py) != 0)
+		gl = NULL;
+	else
+		gl = grid_peek_line(gd, py);
+	if (gl == NULL || px >= gl->cellsize)
+		memcpy(gc, &grid_default_cell, sizeof *gc);
+	else
+		grid_get_cell1(gd, gl, px, gc);
+}
+
+/*
+ * Get only the character and flags of a cell. This is cheaper than
+ * grid_get_cell because the style is not looked up for most cells and the
+ * character is left as a utf8_char.
+ */
+void
+grid_get_char(struct grid *gd, u_int px, u_int py, struct grid_char *gch)
+{
+	const struct grid_line		*gl;
+	const struct grid_cell_entry	*gce;
+	const struct grid_extd_entry	*gee;
+	const struct grid_style		*gs;
+
+	if (grid_check_y(gd, __func__, py) != 0)
+		gl = NULL;
+	else
+		gl = grid_peek_line(gd, py);
+	if (gl == NULL || px >= gl->cellsize)
+		goto empty;
+
+	gce = &gl->celldata[px];
+	if (~gce->flags & GRID_FLAG_EXTENDED) {
+		gch->data = utf8_build_one(gce->data.data);
+		gch->flags = gce->flags & ~(GRID_FLAG_FG256|GRID_FLAG_BG256);
+		return;
+	}
+	if (gce->offset >= gl->extdsize)
+		goto empty;
+	gee = &gl->extddata[gce->offset];
+	gch->data = gee->data;
+	if ((gs = grid_style_get(gd, gee->style)) == NULL)
+		gch->flags = grid_default_cell.flags;
+	else
+		gch->flags = gs->flags;
+	return;
+
+empty:
+	gch->data = utf8_build_one(' ');
+	gch->flags = grid_default_cell.flags;
+}
+
+/*
+ * Count the cells following px on a line which have the same attributes as
+ * the cell at px and hold a single printable ASCII character, up to nx. The
+ * flags, attributes and colours are the first bytes of the cell entry so can
+ * be compared together.
+ */
+u_int
+grid_line_run(const struct grid_line *gl, u_int px, u_int nx)
+{
+	const struct grid_cell_entry	*first, *gce;
+	u_int				 n;
+
+	if (px >= gl->cellsize)
+		return (0);
+	first = &gl->celldata[px];
+	if (first->flags & GRID_FLAG_EXTENDED)
+		return (0);
+	if (nx > gl->cellsize - px - 1)
+		nx = gl->cellsize - px - 1;
+
+	for (n = 0; n < nx; n++) {
+		gce = &first[n + 1];
+		if (memcmp(gce, first, offsetof(struct grid_cell_entry,
+		    data.data)) != 0)
+			break;
+		if (gce->data.data < 0x20 || gce->data.data > 0x7e)
+			break;
+	}
+	return (n);
+}
+
+/* Add bytes to a line hash. */
+static uint64_t
+grid_hash_add(uint64_t hash, const void *buf, size_t len)
 {
-	if (grid_check_y(gd, __func__, py) != 0 ||
-	    px >= gd->linedata[py].cellsize)
-		memcpy(gc, &grid_default_cell, sizeof *gc);
-	else
-		grid_get_cell1(&gd->linedata[py], px, gc);
+	const u_char	*cp = buf;
+	size_t		 i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= cp[i];
+		hash *= 1099511628211ULL;
+	}
+	return (hash);
+}
+
+/*
+ * Hash the cells of a line, so it can be checked against the same line drawn
+ * earlier without keeping a copy. The hash is never zero.
+ */
+uint64_t
+grid_hash_line(struct grid *gd, u_int py)
+{
+	struct grid_line	*gl;
+	struct grid_cell	 gc;
+	uint64_t		 hash = 14695981039346656037ULL;
+	u_int			 px;
+
+	if (grid_check_y(gd, __func__, py) != 0)
+		return (1);
+	gl = grid_get_line(gd, py);
+
+	hash = grid_hash_add(hash, &gl->cellsize, sizeof gl->cellsize);
+	for (px = 0; px < gl->cellsize; px++) {
+		grid_get_cell1(gd, gl, px, &gc);
+		hash = grid_hash_add(hash, &gc.flags, sizeof gc.flags);
+		hash = grid_hash_add(hash, &gc.attr, sizeof gc.attr);
+		hash = grid_hash_add(hash, &gc.fg, sizeof gc.fg);
+		hash = grid_hash_add(hash, &gc.bg, sizeof gc.bg);
+		hash = grid_hash_add(hash, &gc.us, sizeof gc.us);
+		hash = grid_hash_add(hash, &gc.data.width,
+		    sizeof gc.data.width);
+		hash = grid_hash_add(hash, gc.data.data, gc.data.size);
+	}
+	if (hash == 0)
+		hash = 1;
+	return (hash);
 }
 
 /* Set cell at position. */
@@ -547,13 +2147,14 @@ grid_set_cell(struct grid *gd, u_int px, u_int py, const struct grid_cell *gc)
 
 	grid_expand_line(gd, py, px + 1, 8);
 
-	gl = &gd->linedata[py];
+	gl = grid_get_line(gd, py);
+	grid_detach_line(gl);
 	if (px + 1 > gl->cellused)
 		gl->cellused = px + 1;
 
 	gce = &gl->celldata[px];
 	if (grid_need_extended_cell(gce, gc))
-		grid_extended_cell(gl, gce, gc);
+		grid_extended_cell(gd, gl, gce, gc);
 	else
 		grid_store_cell(gce, gc, gc->data.data[0]);
 }
@@ -580,14 +2181,15 @@ grid_set_cells(struct grid *gd, u_int px, u_int py, const struct grid_cell *gc,
 
 	grid_expand_line(gd, py, px + slen, 8);
 
-	gl = &gd->linedata[py];
+	gl = grid_get_line(gd, py);
+	grid_detach_line(gl);
 	if (px + slen > gl->cellused)
 		gl->cellused = px + slen;
 
 	for (i = 0; i < slen; i++) {
 		gce = &gl->celldata[px + i];
 		if (grid_need_extended_cell(gce, gc)) {
-			gee = grid_extended_cell(gl, gce, gc);
+			gee = grid_extended_cell(gd, gl, gce, gc);
 			gee->data = utf8_build_one(s[i]);
 		} else
 			grid_store_cell(gce, gc, s[i]);
@@ -615,7 +2217,7 @@ grid_clear(struct grid *gd, u_int px, u_int py, u_int nx, u_int ny, u_int bg)
 		return;
 
 	for (yy = py; yy < py + ny; yy++) {
-		gl = &gd->linedata[yy];
+		gl = grid_get_line(gd, yy);
 
 		sx = gd->sx;
 		if (sx > gl->cellsize)
@@ -653,7 +2255,7 @@ grid_clear_lines(struct grid *gd, u_int py, u_int ny, u_int bg)
 		grid_empty_line(gd, yy, bg);
 	}
 	if (py != 0)
-		gd->linedata[py - 1].flags &= ~GRID_LINE_WRAPPED;
+		grid_get_line1(gd, py - 1)->flags &= ~GRID_LINE_WRAPPED;
 }
 
 /* Move a group of lines. */
@@ -681,10 +2283,9 @@ grid_move_lines(struct grid *gd, u_int dy, u_int py, u_int ny, u_int bg)
 		grid_free_line(gd, yy);
 	}
 	if (dy != 0)
-		gd->linedata[dy - 1].flags &= ~GRID_LINE_WRAPPED;
+		grid_get_line1(gd, dy - 1)->flags &= ~GRID_LINE_WRAPPED;
 
-	memmove(&gd->linedata[dy], &gd->linedata[py],
-	    ny * (sizeof *gd->linedata));
+	grid_move_line_data(gd, dy, py, ny);
 
 	/*
 	 * Wipe any lines that have been moved (without freeing them - they are
@@ -695,7 +2296,7 @@ grid_move_lines(struct grid *gd, u_int dy, u_int py, u_int ny, u_int bg)
 			grid_empty_line(gd, yy, bg);
 	}
 	if (py != 0 && (py < dy || py >= dy + ny))
-		gd->linedata[py - 1].flags &= ~GRID_LINE_WRAPPED;
+		grid_get_line1(gd, py - 1)->flags &= ~GRID_LINE_WRAPPED;
 }
 
 /* Move a group of cells. */
@@ -711,10 +2312,11 @@ grid_move_cells(struct grid *gd, u_int dx, u_int px, u_int py, u_int nx,
 
 	if (grid_check_y(gd, __func__, py) != 0)
 		return;
-	gl = &gd->linedata[py];
+	gl = grid_get_line(gd, py);
 
 	grid_expand_line(gd, py, px + nx, 8);
 	grid_expand_line(gd, py, dx + nx, 8);
+	grid_detach_line(gl);
 	memmove(&gl->celldata[dx], &gl->celldata[px],
 	    nx * sizeof *gl->celldata);
 	if (dx + nx > gl->cellused)
@@ -826,18 +2428,69 @@ grid_string_cells_bg(const struct grid_cell *gc, int *values)
 	return (n);
 }
 
+/* Append to an ANSI code being built. */
+static void
+grid_string_cells_append(char *buf, size_t len, size_t *off, const char *s,
+    size_t n)
+{
+	if (*off + n >= len)
+		return;
+	memcpy(buf + *off, s, n);
+	*off += n;
+	buf[*off] = '\0';
+}
+
+/* Append a number to an ANSI code being built. */
+static void
+grid_string_cells_append_number(char *buf, size_t len, size_t *off, u_int n)
+{
+	char	tmp[16];
+	size_t	i = sizeof tmp;
+
+	do
+		tmp[--i] = '0' + (n % 10);
+	while ((n /= 10) != 0);
+	grid_string_cells_append(buf, len, off, tmp + i, (sizeof tmp) - i);
+}
+
+/* Append the start of an ANSI code. */
+static void
+grid_string_cells_append_csi(char *buf, size_t len, size_t *off,
+    int escape_c0)
+{
+	if (escape_c0)
+		grid_string_cells_append(buf, len, off, "\\033[", 5);
+	else
+		grid_string_cells_append(buf, len, off, "\033[", 2);
+}
+
+/* Append colour parameters to an ANSI code. */
+static void
+grid_string_cells_append_colour(char *buf, size_t len, size_t *off,
+    const int *values, size_t n, int escape_c0)
+{
+	size_t	i;
+
+	grid_string_cells_append_csi(buf, len, off, escape_c0);
+	for (i = 0; i < n; i++) {
+		grid_string_cells_append_number(buf, len, off, values[i]);
+		if (i + 1 < n)
+			grid_string_cells_append(buf, len, off, ";", 1);
+	}
+	grid_string_cells_append(buf, len, off, "m", 1);
+}
+
 /*
  * Returns ANSI code to set particular attributes (colour, bold and so on)
  * given a current state.
  */
-static void
+static size_t
 grid_string_cells_code(const struct grid_cell *lastgc,
     const struct grid_cell *gc, char *buf, size_t len, int escape_c0)
 {
 	int	oldc[64], newc[64], s[128];
-	size_t	noldc, nnewc, n, i;
+	size_t	noldc, nnewc, n, i, off = 0;
 	u_int	attr = gc->attr, lastattr = lastgc->attr;
-	char	tmp[64];
 
 	struct {
 		u_int	mask;
@@ -876,22 +2529,24 @@ grid_string_cells_code(const struct grid_cell *lastgc,
 	/* Write the attributes. */
 	*buf = '\0';
 	if (n > 0) {
-		if (escape_c0)
-			strlcat(buf, "\\033[", len);
-		else
-			strlcat(buf, "\033[", len);
+		grid_string_cells_append_csi(buf, len, &off, escape_c0);
 		for (i = 0; i < n; i++) {
-			if (s[i] < 10)
-				xsnprintf(tmp, sizeof tmp, "%d", s[i]);
-			else {
-				xsnprintf(tmp, sizeof tmp, "%d:%d", s[i] / 10,
+			if (s[i] < 10) {
+				grid_string_cells_append_number(buf, len, &off,
+				    s[i]);
+			} else {
+				grid_string_cells_append_number(buf, len, &off,
+				    s[i] / 10);
+				grid_string_cells_append(buf, len, &off, ":",
+				    1);
+				grid_string_cells_append_number(buf, len, &off,
 				    s[i] % 10);
 			}
-			strlcat(buf, tmp, len);
 			if (i + 1 < n)
-				strlcat(buf, ";", len);
+				grid_string_cells_append(buf, len, &off, ";",
+				    1);
 		}
-		strlcat(buf, "m", len);
+		grid_string_cells_append(buf, len, &off, "m", 1);
 	}
 
 	/* If the foreground colour changed, write its parameters. */
@@ -900,18 +2555,8 @@ grid_string_cells_code(const struct grid_cell *lastgc,
 	if (nnewc != noldc ||
 	    memcmp(newc, oldc, nnewc * sizeof newc[0]) != 0 ||
 	    (n != 0 && s[0] == 0)) {
-		if (escape_c0)
-			strlcat(buf, "\\033[", len);
-		else
-			strlcat(buf, "\033[", len);
-		for (i = 0; i < nnewc; i++) {
-			if (i + 1 < nnewc)
-				xsnprintf(tmp, sizeof tmp, "%d;", newc[i]);
-			else
-				xsnprintf(tmp, sizeof tmp, "%d", newc[i]);
-			strlcat(buf, tmp, len);
-		}
-		strlcat(buf, "m", len);
+		grid_string_cells_append_colour(buf, len, &off, newc, nnewc,
+		    escape_c0);
 	}
 
 	/* If the background colour changed, append its parameters. */
@@ -920,33 +2565,90 @@ grid_string_cells_code(const struct grid_cell *lastgc,
 	if (nnewc != noldc ||
 	    memcmp(newc, oldc, nnewc * sizeof newc[0]) != 0 ||
 	    (n != 0 && s[0] == 0)) {
-		if (escape_c0)
-			strlcat(buf, "\\033[", len);
-		else
-			strlcat(buf, "\033[", len);
-		for (i = 0; i < nnewc; i++) {
-			if (i + 1 < nnewc)
-				xsnprintf(tmp, sizeof tmp, "%d;", newc[i]);
-			else
-				xsnprintf(tmp, sizeof tmp, "%d", newc[i]);
-			strlcat(buf, tmp, len);
-		}
-		strlcat(buf, "m", len);
+		grid_string_cells_append_colour(buf, len, &off, newc, nnewc,
+		    escape_c0);
 	}
 
 	/* Append shift in/shift out if needed. */
 	if ((attr & GRID_ATTR_CHARSET) && !(lastattr & GRID_ATTR_CHARSET)) {
-		if (escape_c0)
-			strlcat(buf, "\\016", len); /* SO */
+		if (escape_c0) /* SO */
+			grid_string_cells_append(buf, len, &off, "\\016", 4);
 		else
-			strlcat(buf, "\016", len);  /* SO */
+			grid_string_cells_append(buf, len, &off, "\016", 1);
 	}
 	if (!(attr & GRID_ATTR_CHARSET) && (lastattr & GRID_ATTR_CHARSET)) {
-		if (escape_c0)
-			strlcat(buf, "\\017", len); /* SI */
+		if (escape_c0) /* SI */
+			grid_string_cells_append(buf, len, &off, "\\017", 4);
 		else
-			strlcat(buf, "\017", len);  /* SI */
+			grid_string_cells_append(buf, len, &off, "\017", 1);
+	}
+	return (off);
+}
+
+/*
+ * Get the ANSI code to change from one set of attributes and colours to
+ * another. Captures with codes tend to move between the same few styles, so
+ * the codes are kept in a small cache rather than being built each time.
+ */
+static const char *
+grid_string_cells_get_code(const struct grid_cell *lastgc,
+    const struct grid_cell *gc, int escape_c0, size_t *codelen)
+{
+	struct grid_string_code	*gsc;
+	u_int			 hash;
+
+	if (gc->attr == lastgc->attr &&
+	    gc->fg == lastgc->fg &&
+	    gc->bg == lastgc->bg) {
+		*codelen = 0;
+		return ("");
+	}
+
+	hash = (gc->attr * 31 + lastgc->attr) * 31;
+	hash = (hash + (u_int)gc->fg * 7 + (u_int)gc->bg) * 31;
+	hash += (u_int)lastgc->fg * 7 + (u_int)lastgc->bg + escape_c0;
+	gsc = &grid_string_codes[hash % nitems(grid_string_codes)];
+
+	if (!gsc->valid ||
+	    gsc->escape_c0 != escape_c0 ||
+	    gsc->attr != gc->attr ||
+	    gsc->fg != gc->fg ||
+	    gsc->bg != gc->bg ||
+	    gsc->lastattr != lastgc->attr ||
+	    gsc->lastfg != lastgc->fg ||
+	    gsc->lastbg != lastgc->bg) {
+		gsc->valid = 1;
+		gsc->escape_c0 = escape_c0;
+		gsc->attr = gc->attr;
+		gsc->fg = gc->fg;
+		gsc->bg = gc->bg;
+		gsc->lastattr = lastgc->attr;
+		gsc->lastfg = lastgc->fg;
+		gsc->lastbg = lastgc->bg;
+		gsc->len = grid_string_cells_code(lastgc, gc, gsc->code,
+		    sizeof gsc->code, escape_c0);
 	}
+	*codelen = gsc->len;
+	return (gsc->code);
+}
+
+/*
+ * Check if a cell can be copied straight into a string after another without
+ * any escape codes: it must be a single byte and, if codes are needed, have
+ * the same attributes and colours.
+ */
+static int
+grid_string_cells_same(const struct grid_cell_entry *gce,
+    const struct grid_cell_entry *next, int with_codes)
+{
+	if (next->flags & (GRID_FLAG_EXTENDED|GRID_FLAG_PADDING))
+		return (0);
+	if (!with_codes)
+		return (1);
+	return (next->flags == gce->flags &&
+	    next->data.attr == gce->data.attr &&
+	    next->data.fg == gce->data.fg &&
+	    next->data.bg == gce->data.bg);
 }
 
 /* Convert cells into a string. */
@@ -956,11 +2658,12 @@ grid_string_cells(struct grid *gd, u_int px, u_int py, u_int nx,
 {
 	struct grid_cell	 gc;
 	static struct grid_cell	 lastgc1;
-	const char		*data;
-	char			*buf, code[128];
+	const char		*data, *code;
+	char			*buf;
 	size_t			 len, off, size, codelen;
-	u_int			 xx;
+	u_int			 xx, end;
 	const struct grid_line	*gl;
+	const struct grid_cell_entry *gce, *next;
 
 	if (lastgc != NULL && *lastgc == NULL) {
 		memcpy(&lastgc1, &grid_default_cell, sizeof lastgc1);
@@ -975,17 +2678,18 @@ grid_string_cells(struct grid *gd, u_int px, u_int py, u_int nx,
 	for (xx = px; xx < px + nx; xx++) {
 		if (gl == NULL || xx >= gl->cellsize)
 			break;
-		grid_get_cell(gd, xx, py, &gc);
+		grid_get_cell1(gd, gl, xx, &gc);
 		if (gc.flags & GRID_FLAG_PADDING)
 			continue;
 
 		if (with_codes) {
-			grid_string_cells_code(*lastgc, &gc, code, sizeof code,
-			    escape_c0);
-			codelen = strlen(code);
+			code = grid_string_cells_get_code(*lastgc, &gc,
+			    escape_c0, &codelen);
 			memcpy(*lastgc, &gc, sizeof **lastgc);
-		} else
+		} else {
+			code = NULL;
 			codelen = 0;
+		}
 
 		data = gc.data.data;
 		size = gc.data.size;
@@ -1005,6 +2709,37 @@ grid_string_cells(struct grid *gd, u_int px, u_int py, u_int nx,
 		}
 		memcpy(buf + off, data, size);
 		off += size;
+
+		/*
+		 * Copy the run of following cells which need no codes
+		 * directly from the cell data.
+		 */
+		gce = &gl->celldata[xx];
+		if (gce->flags & GRID_FLAG_EXTENDED)
+			continue;
+		end = xx + 1;
+		while (end < px + nx && end < gl->cellsize) {
+			next = &gl->celldata[end];
+			if (!grid_string_cells_same(gce, next, with_codes))
+				break;
+			end++;
+		}
+		if (end == xx + 1)
+			continue;
+
+		while (len < off + 2 * (end - xx - 1) + 1) {
+			buf = xreallocarray(buf, 2, len);
+			len *= 2;
+		}
+		for (xx++; xx < end; xx++) {
+			next = &gl->celldata[xx];
+			if (escape_c0 && next->data.data == '\\')
+				buf[off++] = '\\';
+			buf[off++] = next->data.data;
+		}
+		xx--;
+		if (with_codes)
+			utf8_set(&(*lastgc)->data, gl->celldata[xx].data.data);
 	}
 
 	if (trim) {
@@ -1016,15 +2751,103 @@ grid_string_cells(struct grid *gd, u_int px, u_int py, u_int nx,
 	return (buf);
 }
 
+/*
+ * Copy the text of up to nx cells of a line starting at px into buf, or just
+ * work out how many bytes are needed if buf is NULL. There are no attributes
+ * or trailing NUL and padding is skipped. If acs is set, line drawing
+ * characters are converted to UTF-8. Returns the number of bytes.
+ */
+size_t
+grid_string_text(struct grid *gd, u_int px, u_int py, u_int nx, char *buf,
+    int acs)
+{
+	const struct grid_line		*gl;
+	const struct grid_cell_entry	*gce;
+	struct grid_cell		 gc;
+	const char			*data;
+	size_t				 off = 0, size;
+	u_int				 xx, end;
+
+	if ((gl = grid_peek_line(gd, py)) == NULL || px >= gl->cellsize)
+		return (0);
+	end = px + nx;
+	if (end > gl->cellsize)
+		end = gl->cellsize;
+
+	for (xx = px; xx < end; xx++) {
+		gce = &gl->celldata[xx];
+
+		/*
+		 * Most cells are a single byte which can be copied directly.
+		 * The flags of an extended cell are in the extended data, so
+		 * it must be fetched before checking for padding.
+		 */
+		if (~gce->flags & GRID_FLAG_EXTENDED) {
+			if (gce->flags & GRID_FLAG_PADDING)
+				continue;
+			if (!acs || (~gce->data.attr & GRID_ATTR_CHARSET)) {
+				if (buf != NULL)
+					buf[off] = gce->data.data;
+				off++;
+				continue;
+			}
+		}
+
+		grid_get_cell1(gd, gl, xx, &gc);
+		if (gc.flags & GRID_FLAG_PADDING)
+			continue;
+		data = gc.data.data;
+		size = gc.data.size;
+		if (acs && size == 1 && (gc.attr & GRID_ATTR_CHARSET)) {
+			data = tty_acs_get(NULL, gc.data.data[0]);
+			if (data != NULL && strlen(data) <= sizeof gc.data.data)
+				size = strlen(data);
+			else
+				data = gc.data.data;
+		}
+		if (buf != NULL)
+			memcpy(buf + off, data, size);
+		off += size;
+	}
+	return (off);
+}
+
+/* Change the styles in a line copied from another grid to the new grid. */
+static void
+grid_duplicate_styles(struct grid *dst, struct grid *src, struct grid_line *gl)
+{
+	size_t	 off = 0;
+	u_int	 i, idx;
+	u_char	*cp;
+
+	if (dst->styles == src->styles)
+		return;
+	if (gl->flags & GRID_LINE_PACKED) {
+		while ((cp = grid_pack_next_style(gl->packdata, gl->packsize,
+		    &off)) != NULL) {
+			memcpy(&idx, cp, sizeof idx);
+			idx = grid_style_copy(dst, src, idx);
+			memcpy(cp, &idx, sizeof idx);
+		}
+		return;
+	}
+	for (i = 0; i < gl->extdsize; i++) {
+		idx = gl->extddata[i].style;
+		gl->extddata[i].style = grid_style_copy(dst, src, idx);
+	}
+}
+
 /*
  * Duplicate a set of lines between two grids. Both source and destination
- * should be big enough.
+ * should be big enough. If the grids share a style table, lines in arenas are
+ * shared rather than copied.
  */
 void
 grid_duplicate_lines(struct grid *dst, u_int dy, struct grid *src, u_int sy,
     u_int ny)
 {
-	struct grid_line	*dstl, *srcl;
+	struct grid_line	*dstl;
+	const struct grid_line	*srcl;
 	u_int			 yy;
 
 	if (dy + ny > dst->hsize + dst->sy)
@@ -1034,10 +2857,26 @@ grid_duplicate_lines(struct grid *dst, u_int dy, struct grid *src, u_int sy,
 	grid_free_lines(dst, dy, ny);
 
 	for (yy = 0; yy < ny; yy++) {
-		srcl = &src->linedata[sy];
-		dstl = &dst->linedata[dy];
+		srcl = grid_peek_line1(src, sy);
+		dstl = grid_get_line1(dst, dy);
 
 		memcpy(dstl, srcl, sizeof *dstl);
+		grid_count_line(dst, dstl, 1);
+		if (srcl->arena != NULL && dst->styles == src->styles) {
+			srcl->arena->references++;
+			sy++;
+			dy++;
+			continue;
+		}
+		dstl->arena = NULL;
+		if (srcl->flags & GRID_LINE_PACKED) {
+			dstl->packdata = xmalloc(srcl->packsize);
+			memcpy(dstl->packdata, srcl->packdata, srcl->packsize);
+			grid_duplicate_styles(dst, src, dstl);
+			sy++;
+			dy++;
+			continue;
+		}
 		if (srcl->cellsize != 0) {
 			dstl->celldata = xreallocarray(NULL,
 			    srcl->cellsize, sizeof *dstl->celldata);
@@ -1053,12 +2892,80 @@ grid_duplicate_lines(struct grid *dst, u_int dy, struct grid *src, u_int sy,
 			    sizeof *dstl->extddata);
 		} else
 			dstl->extddata = NULL;
+		grid_duplicate_styles(dst, src, dstl);
 
 		sy++;
 		dy++;
 	}
 }
 
+/*
+ * Move a set of lines from one grid to another, leaving them empty in the
+ * source. If the destination has not used its style table, it is given the
+ * source's, so the lines can be moved without copying any cell data. Otherwise
+ * they are duplicated and then cleared.
+ */
+void
+grid_transfer_lines(struct grid *dst, u_int dy, struct grid *src, u_int sy,
+    u_int ny)
+{
+	struct grid_line	*dstl, *srcl;
+	u_int			 yy;
+
+	if (dy + ny > dst->hsize + dst->sy)
+		ny = dst->hsize + dst->sy - dy;
+	if (sy + ny > src->hsize + src->sy)
+		ny = src->hsize + src->sy - sy;
+	if (ny == 0)
+		return;
+
+	if (dst->styles != src->styles &&
+	    dst->styles->used == 0 &&
+	    dst->styles->references == 1)
+		grid_styles_share(dst, src);
+	if (dst->styles != src->styles) {
+		grid_duplicate_lines(dst, dy, src, sy, ny);
+		grid_clear_lines(src, sy, ny, 8);
+		return;
+	}
+
+	grid_free_lines(dst, dy, ny);
+	for (yy = 0; yy < ny; yy++) {
+		srcl = grid_get_line1(src, sy + yy);
+		dstl = grid_get_line1(dst, dy + yy);
+
+		grid_count_line(src, srcl, 0);
+		memcpy(dstl, srcl, sizeof *dstl);
+		grid_count_line(dst, dstl, 1);
+		memset(srcl, 0, sizeof *srcl);
+	}
+}
+
+/*
+ * Make a newly created grid a snapshot of ny lines of another starting at py,
+ * all left on its screen. The snapshot shares the style table and history
+ * held in arenas. From the top of the grid, whole chunks are shared as well,
+ * so taking it copies only the last partial chunk and does not depend on the
+ * size of the history.
+ */
+void
+grid_snapshot(struct grid *dst, struct grid *src, u_int py, u_int ny)
+{
+	u_int	n = 0;
+
+	grid_styles_share(dst, src);
+	if (py == 0)
+		n = grid_share_chunks(dst, src, ny);
+	else
+		grid_adjust_lines(dst, ny);
+	dst->hsize = 0;
+	dst->sy = ny;
+	if (n < ny)
+		grid_duplicate_lines(dst, n, src, py + n, ny - n);
+	if (py == 0)
+		dst->index = grid_index_copy(src->index);
+}
+
 /* Mark line as dead. */
 static void
 grid_reflow_dead(struct grid_line *gl)
@@ -1071,14 +2978,14 @@ grid_reflow_dead(struct grid_line *gl)
 static struct grid_line *
 grid_reflow_add(struct grid *gd, u_int n)
 {
-	struct grid_line	*gl;
-	u_int			 sy = gd->sy + n;
+	u_int	sy = gd->sy + n, yy;
 
-	gd->linedata = xreallocarray(gd->linedata, sy, sizeof *gd->linedata);
-	gl = &gd->linedata[gd->sy];
-	memset(gl, 0, n * (sizeof *gl));
+	grid_adjust_lines(gd, sy);
+	for (yy = gd->sy; yy < sy; yy++)
+		memset(grid_get_line1(gd, yy), 0, sizeof (struct grid_line));
+	yy = gd->sy;
 	gd->sy = sy;
-	return (gl);
+	return (grid_get_line1(gd, yy));
 }
 
 /* Move a line across. */
@@ -1109,10 +3016,10 @@ grid_reflow_join(struct grid *target, struct grid *gd, u_int sx, u_int yy,
 	 */
 	if (!already) {
 		to = target->sy;
-		gl = grid_reflow_move(target, &gd->linedata[yy]);
+		gl = grid_reflow_move(target, grid_get_line1(gd, yy));
 	} else {
 		to = target->sy - 1;
-		gl = &target->linedata[to];
+		gl = grid_get_line1(target, to);
 	}
 	at = gl->cellused;
 
@@ -1130,9 +3037,9 @@ grid_reflow_join(struct grid *target, struct grid *gd, u_int sx, u_int yy,
 		line = yy + 1 + lines;
 
 		/* If the next line is empty, skip it. */
-		if (~gd->linedata[line].flags & GRID_LINE_WRAPPED)
+		if (~grid_get_line1(gd, line)->flags & GRID_LINE_WRAPPED)
 			wrapped = 0;
-		if (gd->linedata[line].cellused == 0) {
+		if (grid_get_line1(gd, line)->cellused == 0) {
 			if (!wrapped)
 				break;
 			lines++;
@@ -1144,7 +3051,7 @@ grid_reflow_join(struct grid *target, struct grid *gd, u_int sx, u_int yy,
 		 * separately because we need to leave "from" set to the last
 		 * line if this line is full.
 		 */
-		grid_get_cell1(&gd->linedata[line], 0, &gc);
+		grid_get_cell1(gd, grid_get_line(gd, line), 0, &gc);
 		if (width + gc.data.width > sx)
 			break;
 		width += gc.data.width;
@@ -1152,9 +3059,9 @@ grid_reflow_join(struct grid *target, struct grid *gd, u_int sx, u_int yy,
 		at++;
 
 		/* Join as much more as possible onto the current line. */
-		from = &gd->linedata[line];
+		from = grid_get_line(gd, line);
 		for (want = 1; want < from->cellused; want++) {
-			grid_get_cell1(from, want, &gc);
+			grid_get_cell1(gd, from, want, &gc);
 			if (width + gc.data.width > sx)
 				break;
 			width += gc.data.width;
@@ -1182,16 +3089,17 @@ grid_reflow_join(struct grid *target, struct grid *gd, u_int sx, u_int yy,
 	left = from->cellused - want;
 	if (left != 0) {
 		grid_move_cells(gd, 0, want, yy + lines, left, 8);
+		grid_count_line(gd, from, 0);
 		from->cellsize = from->cellused = left;
+		grid_count_line(gd, from, 1);
 		lines--;
 	} else if (!wrapped)
 		gl->flags &= ~GRID_LINE_WRAPPED;
 
 	/* Remove the lines that were completely consumed. */
 	for (i = yy + 1; i < yy + 1 + lines; i++) {
-		free(gd->linedata[i].celldata);
-		free(gd->linedata[i].extddata);
-		grid_reflow_dead(&gd->linedata[i]);
+		grid_free_line(gd, i);
+		grid_reflow_dead(grid_get_line1(gd, i));
 	}
 
 	/* Adjust scroll position. */
@@ -1206,7 +3114,7 @@ static void
 grid_reflow_split(struct grid *target, struct grid *gd, u_int sx, u_int yy,
     u_int at)
 {
-	struct grid_line	*gl = &gd->linedata[yy], *first;
+	struct grid_line	*gl = grid_get_line(gd, yy), *first;
 	struct grid_cell	 gc;
 	u_int			 line, lines, width, i, xx;
 	u_int			 used = gl->cellused;
@@ -1219,7 +3127,7 @@ grid_reflow_split(struct grid *target, struct grid *gd, u_int sx, u_int yy,
 		lines = 2;
 		width = 0;
 		for (i = at; i < used; i++) {
-			grid_get_cell1(gl, i, &gc);
+			grid_get_cell1(gd, gl, i, &gc);
 			if (width + gc.data.width > sx) {
 				lines++;
 				width = 0;
@@ -1236,9 +3144,9 @@ grid_reflow_split(struct grid *target, struct grid *gd, u_int sx, u_int yy,
 	width = 0;
 	xx = 0;
 	for (i = at; i < used; i++) {
-		grid_get_cell1(gl, i, &gc);
+		grid_get_cell1(gd, gl, i, &gc);
 		if (width + gc.data.width > sx) {
-			target->linedata[line].flags |= GRID_LINE_WRAPPED;
+			grid_get_line1(target, line)->flags |= GRID_LINE_WRAPPED;
 
 			line++;
 			width = 0;
@@ -1249,12 +3157,14 @@ grid_reflow_split(struct grid *target, struct grid *gd, u_int sx, u_int yy,
 		xx++;
 	}
 	if (flags & GRID_LINE_WRAPPED)
-		target->linedata[line].flags |= GRID_LINE_WRAPPED;
+		grid_get_line1(target, line)->flags |= GRID_LINE_WRAPPED;
 
 	/* Move the remainder of the original line. */
+	grid_count_line(gd, gl, 0);
 	gl->cellsize = gl->cellused = at;
 	gl->flags |= GRID_LINE_WRAPPED;
 	memcpy(first, gl, sizeof *first);
+	grid_count_line(target, first, 1);
 	grid_reflow_dead(gl);
 
 	/* Adjust the scroll position. */
@@ -1269,78 +3179,203 @@ grid_reflow_split(struct grid *target, struct grid *gd, u_int sx, u_int yy,
 		grid_reflow_join(target, gd, sx, yy, width, 1);
 }
 
-/* Reflow lines on grid to new width. */
-void
-grid_reflow(struct grid *gd, u_int sx)
+/* Reflow one line onto the target grid. */
+static void
+grid_reflow_line(struct grid *target, struct grid *gd, u_int sx, u_int yy)
 {
-	struct grid		*target;
 	struct grid_line	*gl;
 	struct grid_cell	 gc;
-	u_int			 yy, width, i, at;
+	u_int			 width, i, at;
+
+	gl = grid_get_line1(gd, yy);
+	if (gl->flags & GRID_LINE_DEAD)
+		return;
 
 	/*
-	 * Create a destination grid. This is just used as a container for the
-	 * line data and may not be fully valid.
+	 * Work out the width of this line. at is the point at which the
+	 * available width is hit, and width is the full line width.
+	 */
+	at = width = 0;
+	if (~gl->flags & GRID_LINE_EXTENDED) {
+		width = gl->cellused;
+		if (width > sx)
+			at = sx;
+		else
+			at = width;
+	} else {
+		gl = grid_get_line(gd, yy);
+		for (i = 0; i < gl->cellused; i++) {
+			grid_get_cell1(gd, gl, i, &gc);
+			if (at == 0 && width + gc.data.width > sx)
+				at = i;
+			width += gc.data.width;
+		}
+	}
+
+	/* If the line is exactly right, just move it across unchanged. */
+	if (width == sx) {
+		grid_reflow_move(target, gl);
+		return;
+	}
+
+	/*
+	 * If the line is too big, it needs to be split, whether or not it was
+	 * previously wrapped.
 	 */
+	if (width > sx) {
+		grid_reflow_split(target, gd, sx, yy, at);
+		return;
+	}
+
+	/*
+	 * If the line was previously wrapped, join as much as possible of the
+	 * next line.
+	 */
+	if (gl->flags & GRID_LINE_WRAPPED)
+		grid_reflow_join(target, gd, sx, yy, width, 0);
+	else
+		grid_reflow_move(target, gl);
+}
+
+/*
+ * Reflow a range of lines in place, where total is the number of lines in the
+ * grid. The range must start and end on a line which is not wrapped. Returns
+ * the new number of lines in the range. The scroll position is restored
+ * afterwards and must be fixed by the caller.
+ */
+static u_int
+grid_reflow_lines(struct grid *gd, u_int sx, u_int first, u_int last,
+    u_int total)
+{
+	struct grid	*target;
+	u_int		 yy, n, old = last - first, hscrolled, i;
+
+	hscrolled = gd->hscrolled;
 	target = grid_create(gd->sx, 0, 0);
+	grid_styles_share(target, gd);
+	for (yy = first; yy < last; yy++)
+		grid_reflow_line(target, gd, sx, yy);
+	gd->hscrolled = hscrolled;
 
 	/*
-	 * Loop over each source line.
+	 * The old lines are all now dead, so move anything after the range
+	 * to make space for the new lines and copy them in.
 	 */
-	for (yy = 0; yy < gd->hsize + gd->sy; yy++) {
-		gl = &gd->linedata[yy];
-		if (gl->flags & GRID_LINE_DEAD)
-			continue;
+	n = target->sy;
+	if (n > old) {
+		grid_adjust_lines(gd, total + n - old);
+		grid_move_line_data(gd, last + n - old, last, total - last);
+	} else if (n < old) {
+		grid_move_line_data(gd, first + n, last, total - last);
+		grid_adjust_lines(gd, total + n - old);
+	}
+	for (yy = 0; yy < n; yy++) {
+		memcpy(grid_get_line1(gd, first + yy),
+		    grid_get_line1(target, yy), sizeof (struct grid_line));
+	}
 
-		/*
-		 * Work out the width of this line. at is the point at which
-		 * the available width is hit, and width is the full line
-		 * width.
-		 */
-		at = width = 0;
-		if (~gl->flags & GRID_LINE_EXTENDED) {
-			width = gl->cellused;
-			if (width > sx)
-				at = sx;
-			else
-				at = width;
-		} else {
-			for (i = 0; i < gl->cellused; i++) {
-				grid_get_cell1(gl, i, &gc);
-				if (at == 0 && width + gc.data.width > sx)
-					at = i;
-				width += gc.data.width;
-			}
-		}
+	for (i = 0; i < target->nchunks; i++)
+		grid_free_chunk(&target->chunks[i]);
+	free(target->chunks);
+	gd->cellbytes += target->cellbytes;
+	gd->extdbytes += target->extdbytes;
+	gd->packbytes += target->packbytes;
+	grid_styles_release(target->styles);
+	free(target);
 
-		/*
-		 * If the line is exactly right, just move it across
-		 * unchanged.
-		 */
-		if (width == sx) {
-			grid_reflow_move(target, gl);
-			continue;
-		}
+	return (n);
+}
 
-		/*
-		 * If the line is too big, it needs to be split, whether or not
-		 * it was previously wrapped.
-		 */
-		if (width > sx) {
-			grid_reflow_split(target, gd, sx, yy, at);
-			continue;
-		}
+/* Adjust scroll position after some history lines have been reflowed. */
+static void
+grid_reflow_scrolled(struct grid *gd, u_int hscrolled, u_int hsize)
+{
+	if (gd->hsize >= hsize)
+		hscrolled += gd->hsize - hsize;
+	else if (hscrolled > hsize - gd->hsize)
+		hscrolled -= hsize - gd->hsize;
+	else
+		hscrolled = 0;
+	if (hscrolled > gd->hsize)
+		hscrolled = gd->hsize;
+	gd->hscrolled = hscrolled;
+}
+
+/* Find where to start reflowing so that a wrapped line is not split. */
+static u_int
+grid_reflow_start(struct grid *gd, u_int last, u_int lines)
+{
+	u_int	first;
+
+	if (last <= lines)
+		return (0);
+	first = last - lines;
+	while (first > 0 &&
+	    (grid_get_line1(gd, first - 1)->flags & GRID_LINE_WRAPPED))
+		first--;
+	return (first);
+}
+
+/*
+ * Reflow lines on grid to new width. If the grid has GRID_LAZYREFLOW, only
+ * the screen and one screen of history above it are reflowed now and the
+ * rest is left for grid_reflow_pending. Resizing a window resizes each of its
+ * panes, so this keeps the work done at once small however much history each
+ * pane has.
+ */
+void
+grid_reflow(struct grid *gd, u_int sx)
+{
+	struct grid	*target;
+	u_int		 yy, i, first, last, total, n, hscrolled, hsize;
+
+	total = gd->hsize + gd->sy;
+	if ((gd->flags & GRID_LAZYREFLOW) && gd->hsize > GRID_REFLOW_LINES) {
+		hscrolled = gd->hscrolled;
+		hsize = gd->hsize;
+
+		first = grid_reflow_start(gd, gd->hsize, gd->sy);
+		n = grid_reflow_lines(gd, sx, first, total, total);
 
 		/*
-		 * If the line was previously wrapped, join as much as possible
-		 * of the next line.
+		 * If there are not enough lines to fill the screen, reflow
+		 * more history a batch at a time until there are.
 		 */
-		if (gl->flags & GRID_LINE_WRAPPED)
-			grid_reflow_join(target, gd, sx, yy, width, 0);
-		else
-			grid_reflow_move(target, gl);
+		while (n < gd->sy && first != 0) {
+			last = first;
+			first = grid_reflow_start(gd, last, GRID_REFLOW_LINES);
+			n += grid_reflow_lines(gd, sx, first, last, last + n);
+		}
+		if (first + n < gd->sy) {
+			grid_adjust_lines(gd, gd->sy);
+			for (yy = first + n; yy < gd->sy; yy++)
+				grid_empty_line(gd, yy, 8);
+			n = gd->sy - first;
+		}
+		gd->hsize = first + n - gd->sy;
+		gd->hpending = first;
+		grid_reflow_scrolled(gd, hscrolled, hsize);
+
+		log_debug("%s: %u lines reflowed, %u pending", __func__, n,
+		    first);
+		grid_pack_history(gd);
+		grid_index_rebuild(gd);
+		return;
 	}
 
+	/*
+	 * Create a destination grid. This is just used as a container for the
+	 * line data and may not be fully valid.
+	 */
+	target = grid_create(gd->sx, 0, 0);
+	grid_styles_share(target, gd);
+
+	/*
+	 * Loop over each source line.
+	 */
+	for (yy = 0; yy < total; yy++)
+		grid_reflow_line(target, gd, sx, yy);
+
 	/*
 	 * Replace the old grid with the new.
 	 */
@@ -1349,26 +3384,73 @@ grid_reflow(struct grid *gd, u_int sx)
 	gd->hsize = target->sy - gd->sy;
 	if (gd->hscrolled > gd->hsize)
 		gd->hscrolled = gd->hsize;
-	free(gd->linedata);
-	gd->linedata = target->linedata;
+	gd->hpending = 0;
+	for (i = 0; i < gd->nchunks; i++)
+		grid_free_chunk(&gd->chunks[i]);
+	free(gd->chunks);
+	gd->chunks = target->chunks;
+	gd->nchunks = target->nchunks;
+	gd->offset = target->offset;
+	gd->cellbytes += target->cellbytes;
+	gd->extdbytes += target->extdbytes;
+	gd->packbytes += target->packbytes;
+	grid_styles_release(target->styles);
 	free(target);
+
+	/* Pack again any lines which needed to be split or joined. */
+	grid_pack_history(gd);
+	grid_index_rebuild(gd);
+}
+
+/*
+ * Reflow history left by grid_reflow to the current width, either one batch
+ * of lines working up from the bottom or all of it. Returns the number of
+ * lines still waiting to be reflowed.
+ */
+u_int
+grid_reflow_pending(struct grid *gd, int all)
+{
+	u_int	first, n, hscrolled, hsize;
+
+	if (gd->hpending == 0)
+		return (0);
+	hscrolled = gd->hscrolled;
+	hsize = gd->hsize;
+
+	if (all)
+		first = 0;
+	else
+		first = grid_reflow_start(gd, gd->hpending, GRID_REFLOW_LINES);
+	n = grid_reflow_lines(gd, gd->sx, first, gd->hpending,
+	    gd->hsize + gd->sy);
+	gd->hsize = gd->hsize + n - (gd->hpending - first);
+	gd->hpending = first;
+	grid_reflow_scrolled(gd, hscrolled, hsize);
+
+	log_debug("%s: %u lines reflowed, %u pending", __func__, n, first);
+	grid_pack_history(gd);
+	if (gd->hpending == 0)
+		grid_index_rebuild(gd);
+	return (gd->hpending);
 }
 
 /* Convert to position based on wrapped lines. */
 void
 grid_wrap_position(struct grid *gd, u_int px, u_int py, u_int *wx, u_int *wy)
 {
-	u_int	ax = 0, ay = 0, yy;
+	const struct grid_line	*gl;
+	u_int			 ax = 0, ay = 0, yy;
 
 	for (yy = 0; yy < py; yy++) {
-		if (gd->linedata[yy].flags & GRID_LINE_WRAPPED)
-			ax += gd->linedata[yy].cellused;
+		gl = grid_peek_line1(gd, yy);
+		if (gl->flags & GRID_LINE_WRAPPED)
+			ax += gl->cellused;
 		else {
 			ax = 0;
 			ay++;
 		}
 	}
-	if (px >= gd->linedata[yy].cellused)
+	if (px >= grid_peek_line1(gd, yy)->cellused)
 		ax = UINT_MAX;
 	else
 		ax += px;
@@ -1380,12 +3462,13 @@ grid_wrap_position(struct grid *gd, u_int px, u_int py, u_int *wx, u_int *wy)
 void
 grid_unwrap_position(struct grid *gd, u_int *px, u_int *py, u_int wx, u_int wy)
 {
-	u_int	yy, ay = 0;
+	const struct grid_line	*gl;
+	u_int			 yy, ay = 0;
 
 	for (yy = 0; yy < gd->hsize + gd->sy - 1; yy++) {
 		if (ay == wy)
 			break;
-		if (~gd->linedata[yy].flags & GRID_LINE_WRAPPED)
+		if (~grid_peek_line1(gd, yy)->flags & GRID_LINE_WRAPPED)
 			ay++;
 	}
 
@@ -1394,14 +3477,15 @@ grid_unwrap_position(struct grid *gd, u_int *px, u_int *py, u_int wx, u_int wy)
 	 * until we find the end or the line now containing wx.
 	 */
 	if (wx == UINT_MAX) {
-		while (gd->linedata[yy].flags & GRID_LINE_WRAPPED)
+		while (grid_peek_line1(gd, yy)->flags & GRID_LINE_WRAPPED)
 			yy++;
-		wx = gd->linedata[yy].cellused;
+		wx = grid_peek_line1(gd, yy)->cellused;
 	} else {
-		while (gd->linedata[yy].flags & GRID_LINE_WRAPPED) {
-			if (wx < gd->linedata[yy].cellused)
+		while (grid_peek_line1(gd, yy)->flags & GRID_LINE_WRAPPED) {
+			gl = grid_peek_line1(gd, yy);
+			if (wx < gl->cellused)
 				break;
-			wx -= gd->linedata[yy].cellused;
+			wx -= gl->cellused;
 			yy++;
 		}
 	}
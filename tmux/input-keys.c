@@ -31,6 +31,7 @@
  */
 
 static void	 input_key_mouse(struct window_pane *, struct mouse_event *);
+static int	 input_key_translate1(int, key_code, char *, size_t *);
 
 /* Entry in the key tree. */
 struct input_key_entry {
@@ -47,6 +48,20 @@ static int	input_key_cmp(struct input_key_entry *,
 RB_GENERATE_STATIC(input_key_tree, input_key_entry, entry, input_key_cmp);
 struct input_key_tree input_key_tree = RB_INITIALIZER(&input_key_tree);
 
+/*
+ * Cache of translated keys which need the tree or an extended key sequence,
+ * indexed by a hash of the key and the key modes. An entry with zero length is
+ * empty.
+ */
+#define INPUT_KEY_CACHE_SIZE 64
+struct input_key_cache_entry {
+	key_code	key;
+	int		mode;
+	char		data[INPUT_KEY_SIZE];
+	size_t		len;
+};
+static struct input_key_cache_entry input_key_cache[INPUT_KEY_CACHE_SIZE];
+
 /* List of default keys, the tree is built from this. */
 static struct input_key_entry input_key_defaults[] = {
 	/* Paste keys. */
@@ -404,23 +419,81 @@ input_key_pane(struct window_pane *wp, key_code key, struct mouse_event *m)
 	return (input_key(wp->screen, wp->event, key));
 }
 
+/* Append to a translated key sequence. */
 static void
-input_key_write(const char *from, struct bufferevent *bev, const char *data,
-    size_t size)
+input_key_add(char *buf, size_t *len, const char *data, size_t size)
 {
-	log_debug("%s: %.*s", from, (int)size, data);
-	bufferevent_write(bev, data, size);
+	if (*len + size > INPUT_KEY_SIZE)
+		fatalx("key sequence too long");
+	memcpy(buf + *len, data, size);
+	*len += size;
 }
 
-/* Translate a key code into an output key sequence. */
+/* Clear the translation cache, when an option used to translate changes. */
+void
+input_key_clear_cache(void)
+{
+	memset(input_key_cache, 0, sizeof input_key_cache);
+}
+
+/*
+ * Translate a key code into an output key sequence for a screen with the given
+ * mode. Only the KEY_MODES bits of the mode make a difference, so the result
+ * may be reused for any screen where they are the same. Keys which are not
+ * sent as themselves are looked up in the cache first.
+ */
 int
-input_key(struct screen *s, struct bufferevent *bev, key_code key)
+input_key_translate(int mode, key_code key, char *buf, size_t *len)
+{
+	struct input_key_cache_entry	*ice;
+	key_code			 justkey;
+	u_int				 hash;
+
+	mode &= KEY_MODES;
+
+	justkey = (key & ~(KEYC_META|KEYC_IMPLIED_META));
+	if (KEYC_IS_MOUSE(key) ||
+	    (key & KEYC_LITERAL) ||
+	    justkey <= 0x7f ||
+	    KEYC_IS_UNICODE(justkey))
+		return (input_key_translate1(mode, key, buf, len));
+
+	/* Mix the modifiers and modes into the low bits of the key. */
+	hash = (u_int)(key & KEYC_MASK_KEY) ^ (u_int)(key >> 40);
+	if (mode & MODE_KCURSOR)
+		hash ^= 0x15;
+	if (mode & MODE_KKEYPAD)
+		hash ^= 0x2a;
+	if (mode & MODE_KEXTENDED)
+		hash ^= 0x33;
+	ice = &input_key_cache[hash % INPUT_KEY_CACHE_SIZE];
+	if (ice->len != 0 && ice->key == key && ice->mode == mode) {
+		memcpy(buf, ice->data, ice->len);
+		*len = ice->len;
+		return (0);
+	}
+
+	if (input_key_translate1(mode, key, buf, len) != 0)
+		return (-1);
+	if (*len != 0) {
+		ice->key = key;
+		ice->mode = mode;
+		memcpy(ice->data, buf, *len);
+		ice->len = *len;
+	}
+	return (0);
+}
+
+static int
+input_key_translate1(int mode, key_code key, char *buf, size_t *len)
 {
 	struct input_key_entry	*ike;
 	key_code		 justkey, newkey, outkey;
 	struct utf8_data	 ud;
 	char			 tmp[64], modifier;
 
+	*len = 0;
+
 	/* Mouse keys need a pane. */
 	if (KEYC_IS_MOUSE(key))
 		return (0);
@@ -428,7 +501,7 @@ input_key(struct screen *s, struct bufferevent *bev, key_code key)
 	/* Literal keys go as themselves (can't be more than eight bits). */
 	if (key & KEYC_LITERAL) {
 		ud.data[0] = (u_char)key;
-		input_key_write(__func__, bev, &ud.data[0], 1);
+		input_key_add(buf, len, &ud.data[0], 1);
 		return (0);
 	}
 
@@ -447,16 +520,16 @@ input_key(struct screen *s, struct bufferevent *bev, key_code key)
 	justkey = (key & ~(KEYC_META|KEYC_IMPLIED_META));
 	if (justkey <= 0x7f) {
 		if (key & KEYC_META)
-			input_key_write(__func__, bev, "\033", 1);
+			input_key_add(buf, len, "\033", 1);
 		ud.data[0] = justkey;
-		input_key_write(__func__, bev, &ud.data[0], 1);
+		input_key_add(buf, len, &ud.data[0], 1);
 		return (0);
 	}
 	if (KEYC_IS_UNICODE(justkey)) {
 		if (key & KEYC_META)
-			input_key_write(__func__, bev, "\033", 1);
+			input_key_add(buf, len, "\033", 1);
 		utf8_to_data(justkey, &ud);
-		input_key_write(__func__, bev, ud.data, ud.size);
+		input_key_add(buf, len, ud.data, ud.size);
 		return (0);
 	}
 
@@ -464,9 +537,9 @@ input_key(struct screen *s, struct bufferevent *bev, key_code key)
 	 * Look up in the tree. If not in application keypad or cursor mode,
 	 * remove the flags from the key.
 	 */
-	if (~s->mode & MODE_KKEYPAD)
+	if (~mode & MODE_KKEYPAD)
 		key &= ~KEYC_KEYPAD;
-	if (~s->mode & MODE_KCURSOR)
+	if (~mode & MODE_KCURSOR)
 		key &= ~KEYC_CURSOR;
 	ike = input_key_get(key);
 	if (ike == NULL && (key & KEYC_META) && (~key & KEYC_IMPLIED_META))
@@ -478,13 +551,13 @@ input_key(struct screen *s, struct bufferevent *bev, key_code key)
 	if (ike != NULL) {
 		log_debug("found key 0x%llx: \"%s\"", key, ike->data);
 		if ((key & KEYC_META) && (~key & KEYC_IMPLIED_META))
-			input_key_write(__func__, bev, "\033", 1);
-		input_key_write(__func__, bev, ike->data, strlen(ike->data));
+			input_key_add(buf, len, "\033", 1);
+		input_key_add(buf, len, ike->data, strlen(ike->data));
 		return (0);
 	}
 
 	/* No builtin key sequence; construct an extended key sequence. */
-	if (~s->mode & MODE_KEXTENDED) {
+	if (~mode & MODE_KEXTENDED) {
 		if ((key & KEYC_MASK_MODIFIERS) != KEYC_CTRL)
 			goto missing;
 		justkey = (key & KEYC_MASK_KEY);
@@ -515,7 +588,7 @@ input_key(struct screen *s, struct bufferevent *bev, key_code key)
 				return (0);
 			break;
 		}
-		return (input_key(s, bev, key & ~KEYC_CTRL));
+		return (input_key_translate1(mode, key & ~KEYC_CTRL, buf, len));
 	}
 	outkey = (key & KEYC_MASK_KEY);
 	switch (key & KEYC_MASK_MODIFIERS) {
@@ -544,7 +617,7 @@ input_key(struct screen *s, struct bufferevent *bev, key_code key)
 		goto missing;
 	}
 	xsnprintf(tmp, sizeof tmp, "\033[%llu;%cu", outkey, modifier);
-	input_key_write(__func__, bev, tmp, strlen(tmp));
+	input_key_add(buf, len, tmp, strlen(tmp));
 	return (0);
 
 missing:
@@ -552,6 +625,22 @@ missing:
 	return (-1);
 }
 
+/* Translate a key code into an output key sequence. */
+int
+input_key(struct screen *s, struct bufferevent *bev, key_code key)
+{
+	char	buf[INPUT_KEY_SIZE];
+	size_t	len;
+
+	if (input_key_translate(s->mode, key, buf, &len) != 0)
+		return (-1);
+	if (len != 0) {
+		log_debug("%s: %.*s", __func__, (int)len, buf);
+		bufferevent_write(bev, buf, len);
+	}
+	return (0);
+}
+
 /* Get mouse event string. */
 int
 input_key_get_mouse(struct screen *s, struct mouse_event *m, u_int x, u_int y,
@@ -640,5 +729,5 @@ input_key_mouse(struct window_pane *wp, struct mouse_event *m)
 	if (!input_key_get_mouse(s, m, x, y, &buf, &len))
 		return;
 	log_debug("writing mouse %.*s to %%%u", (int)len, buf, wp->id);
-	input_key_write(__func__, wp->event, buf, len);
+	bufferevent_write(wp->event, buf, len);
 }
@@ -72,6 +72,38 @@ struct input_param {
 	};
 };
 
+/*
+ * Size of each piece of pane input parsed, and the most parsed (in bytes or
+ * milliseconds) before letting other panes have a turn.
+ */
+#define INPUT_PARSE_CHUNK 4096
+#define INPUT_PARSE_BUDGET 65536
+#define INPUT_PARSE_TIME 10
+
+/*
+ * Cached effect of an SGR sequence. Applications tend to send the same few
+ * sequences over and over, so the change each makes to the cell is worked out
+ * once and kept keyed by the raw parameter bytes.
+ */
+#define INPUT_SGR_CACHE 16
+struct input_sgr {
+	u_char			param_buf[64];
+	size_t			param_len;
+	int			valid;
+
+	int			reset;
+	u_short			attr_mask;
+	u_short			attr_set;
+
+	int			flags;
+#define INPUT_SGR_FG 0x1
+#define INPUT_SGR_BG 0x2
+#define INPUT_SGR_US 0x4
+	int			fg;
+	int			bg;
+	int			us;
+};
+
 /* Input parser context. */
 struct input_ctx {
 	struct window_pane     *wp;
@@ -115,6 +147,8 @@ struct input_ctx {
 
 	const struct input_state *state;
 
+	struct input_sgr	sgr_cache[INPUT_SGR_CACHE];
+
 	struct event		timer;
 
 	/*
@@ -154,9 +188,11 @@ static void	input_exit_rename(struct input_ctx *);
 
 /* Input state handlers. */
 static int	input_print(struct input_ctx *);
+static void	input_print_string(struct input_ctx *, const u_char *, size_t);
 static int	input_intermediate(struct input_ctx *);
 static int	input_parameter(struct input_ctx *);
 static int	input_input(struct input_ctx *);
+static void	input_input_string(struct input_ctx *, const u_char *, size_t);
 static int	input_c0_dispatch(struct input_ctx *);
 static int	input_esc_dispatch(struct input_ctx *);
 static int	input_csi_dispatch(struct input_ctx *);
@@ -168,6 +204,9 @@ static void	input_csi_dispatch_winops(struct input_ctx *);
 static void	input_csi_dispatch_sgr_256(struct input_ctx *, int, u_int *);
 static void	input_csi_dispatch_sgr_rgb(struct input_ctx *, int, u_int *);
 static void	input_csi_dispatch_sgr(struct input_ctx *);
+static struct input_sgr *input_csi_dispatch_sgr_find(struct input_ctx *);
+static void	input_csi_dispatch_sgr_save(struct input_ctx *,
+		    struct input_sgr *);
 static int	input_dcs_dispatch(struct input_ctx *);
 static int	input_top_bit_set(struct input_ctx *);
 static int	input_end_bel(struct input_ctx *);
@@ -319,6 +358,7 @@ struct input_state {
 	void				(*enter)(struct input_ctx *);
 	void				(*exit)(struct input_ctx *);
 	const struct input_transition	*transitions;
+	const struct input_transition	**dispatch;
 };
 
 /* State transitions available from all states. */
@@ -346,123 +386,159 @@ static const struct input_transition input_state_apc_string_table[];
 static const struct input_transition input_state_rename_string_table[];
 static const struct input_transition input_state_consume_st_table[];
 
+/* Transition for each byte in each state, built from the tables. */
+static const struct input_transition *input_state_ground_dispatch[256];
+static const struct input_transition *input_state_esc_enter_dispatch[256];
+static const struct input_transition *input_state_esc_intermediate_dispatch[256];
+static const struct input_transition *input_state_csi_enter_dispatch[256];
+static const struct input_transition *input_state_csi_parameter_dispatch[256];
+static const struct input_transition *input_state_csi_intermediate_dispatch[256];
+static const struct input_transition *input_state_csi_ignore_dispatch[256];
+static const struct input_transition *input_state_dcs_enter_dispatch[256];
+static const struct input_transition *input_state_dcs_parameter_dispatch[256];
+static const struct input_transition *input_state_dcs_intermediate_dispatch[256];
+static const struct input_transition *input_state_dcs_handler_dispatch[256];
+static const struct input_transition *input_state_dcs_escape_dispatch[256];
+static const struct input_transition *input_state_dcs_ignore_dispatch[256];
+static const struct input_transition *input_state_osc_string_dispatch[256];
+static const struct input_transition *input_state_apc_string_dispatch[256];
+static const struct input_transition *input_state_rename_string_dispatch[256];
+static const struct input_transition *input_state_consume_st_dispatch[256];
+
 /* ground state definition. */
 static const struct input_state input_state_ground = {
 	"ground",
 	input_ground, NULL,
-	input_state_ground_table
+	input_state_ground_table,
+	input_state_ground_dispatch
 };
 
 /* esc_enter state definition. */
 static const struct input_state input_state_esc_enter = {
 	"esc_enter",
 	input_clear, NULL,
-	input_state_esc_enter_table
+	input_state_esc_enter_table,
+	input_state_esc_enter_dispatch
 };
 
 /* esc_intermediate state definition. */
 static const struct input_state input_state_esc_intermediate = {
 	"esc_intermediate",
 	NULL, NULL,
-	input_state_esc_intermediate_table
+	input_state_esc_intermediate_table,
+	input_state_esc_intermediate_dispatch
 };
 
 /* csi_enter state definition. */
 static const struct input_state input_state_csi_enter = {
 	"csi_enter",
 	input_clear, NULL,
-	input_state_csi_enter_table
+	input_state_csi_enter_table,
+	input_state_csi_enter_dispatch
 };
 
 /* csi_parameter state definition. */
 static const struct input_state input_state_csi_parameter = {
 	"csi_parameter",
 	NULL, NULL,
-	input_state_csi_parameter_table
+	input_state_csi_parameter_table,
+	input_state_csi_parameter_dispatch
 };
 
 /* csi_intermediate state definition. */
 static const struct input_state input_state_csi_intermediate = {
 	"csi_intermediate",
 	NULL, NULL,
-	input_state_csi_intermediate_table
+	input_state_csi_intermediate_table,
+	input_state_csi_intermediate_dispatch
 };
 
 /* csi_ignore state definition. */
 static const struct input_state input_state_csi_ignore = {
 	"csi_ignore",
 	NULL, NULL,
-	input_state_csi_ignore_table
+	input_state_csi_ignore_table,
+	input_state_csi_ignore_dispatch
 };
 
 /* dcs_enter state definition. */
 static const struct input_state input_state_dcs_enter = {
 	"dcs_enter",
 	input_enter_dcs, NULL,
-	input_state_dcs_enter_table
+	input_state_dcs_enter_table,
+	input_state_dcs_enter_dispatch
 };
 
 /* dcs_parameter state definition. */
 static const struct input_state input_state_dcs_parameter = {
 	"dcs_parameter",
 	NULL, NULL,
-	input_state_dcs_parameter_table
+	input_state_dcs_parameter_table,
+	input_state_dcs_parameter_dispatch
 };
 
 /* dcs_intermediate state definition. */
 static const struct input_state input_state_dcs_intermediate = {
 	"dcs_intermediate",
 	NULL, NULL,
-	input_state_dcs_intermediate_table
+	input_state_dcs_intermediate_table,
+	input_state_dcs_intermediate_dispatch
 };
 
 /* dcs_handler state definition. */
 static const struct input_state input_state_dcs_handler = {
 	"dcs_handler",
 	NULL, NULL,
-	input_state_dcs_handler_table
+	input_state_dcs_handler_table,
+	input_state_dcs_handler_dispatch
 };
 
 /* dcs_escape state definition. */
 static const struct input_state input_state_dcs_escape = {
 	"dcs_escape",
 	NULL, NULL,
-	input_state_dcs_escape_table
+	input_state_dcs_escape_table,
+	input_state_dcs_escape_dispatch
 };
 
 /* dcs_ignore state definition. */
 static const struct input_state input_state_dcs_ignore = {
 	"dcs_ignore",
 	NULL, NULL,
-	input_state_dcs_ignore_table
+	input_state_dcs_ignore_table,
+	input_state_dcs_ignore_dispatch
 };
 
 /* osc_string state definition. */
 static const struct input_state input_state_osc_string = {
 	"osc_string",
 	input_enter_osc, input_exit_osc,
-	input_state_osc_string_table
+	input_state_osc_string_table,
+	input_state_osc_string_dispatch
 };
 
 /* apc_string state definition. */
 static const struct input_state input_state_apc_string = {
 	"apc_string",
 	input_enter_apc, input_exit_apc,
-	input_state_apc_string_table
+	input_state_apc_string_table,
+	input_state_apc_string_dispatch
 };
 
 /* rename_string state definition. */
 static const struct input_state input_state_rename_string = {
 	"rename_string",
 	input_enter_rename, input_exit_rename,
-	input_state_rename_string_table
+	input_state_rename_string_table,
+	input_state_rename_string_dispatch
 };
 
 /* consume_st state definition. */
 static const struct input_state input_state_consume_st = {
 	"consume_st",
 	input_enter_rename, NULL, /* rename also waits for ST */
-	input_state_consume_st_table
+	input_state_consume_st_table,
+	input_state_consume_st_dispatch
 };
 
 /* ground state table. */
@@ -720,6 +796,56 @@ static const struct input_transition input_state_consume_st_table[] = {
 	{ -1, -1, NULL, NULL }
 };
 
+/* All states, for building the dispatch tables. */
+static const struct input_state *input_states[] = {
+	&input_state_ground,
+	&input_state_esc_enter,
+	&input_state_esc_intermediate,
+	&input_state_csi_enter,
+	&input_state_csi_parameter,
+	&input_state_csi_intermediate,
+	&input_state_csi_ignore,
+	&input_state_dcs_enter,
+	&input_state_dcs_parameter,
+	&input_state_dcs_intermediate,
+	&input_state_dcs_handler,
+	&input_state_dcs_escape,
+	&input_state_dcs_ignore,
+	&input_state_osc_string,
+	&input_state_apc_string,
+	&input_state_rename_string,
+	&input_state_consume_st,
+};
+
+/* Build the dispatch table for each state. */
+static void
+input_build_dispatch(void)
+{
+	static int			 built;
+	const struct input_state	*state;
+	const struct input_transition	*itr;
+	u_int				 i, ch;
+
+	if (built)
+		return;
+	built = 1;
+
+	for (i = 0; i < nitems(input_states); i++) {
+		state = input_states[i];
+		for (ch = 0; ch < 256; ch++) {
+			itr = state->transitions;
+			while (itr->first != -1 && itr->last != -1) {
+				if ((int)ch >= itr->first &&
+				    (int)ch <= itr->last)
+					break;
+				itr++;
+			}
+			if (itr->first != -1 && itr->last != -1)
+				state->dispatch[ch] = itr;
+		}
+	}
+}
+
 /* Input table compare. */
 static int
 input_table_compare(const void *key, const void *value)
@@ -801,6 +927,8 @@ input_init(struct window_pane *wp, struct bufferevent *bev)
 {
 	struct input_ctx	*ictx;
 
+	input_build_dispatch();
+
 	ictx = xcalloc(1, sizeof *ictx);
 	ictx->wp = wp;
 	ictx->event = bev;
@@ -886,32 +1014,19 @@ static void
 input_parse(struct input_ctx *ictx, u_char *buf, size_t len)
 {
 	struct screen_write_ctx		*sctx = &ictx->ctx;
-	const struct input_state	*state = NULL;
-	const struct input_transition	*itr = NULL;
-	size_t				 off = 0;
+	const struct input_transition	*itr = NULL, *next;
+	size_t				 off = 0, end;
 
 	/* Parse the input. */
 	while (off < len) {
 		ictx->ch = buf[off++];
 
 		/* Find the transition. */
-		if (ictx->state != state ||
-		    itr == NULL ||
-		    ictx->ch < itr->first ||
-		    ictx->ch > itr->last) {
-			itr = ictx->state->transitions;
-			while (itr->first != -1 && itr->last != -1) {
-				if (ictx->ch >= itr->first &&
-				    ictx->ch <= itr->last)
-					break;
-				itr++;
-			}
-			if (itr->first == -1 || itr->last == -1) {
-				/* No transition? Eh? */
-				fatalx("no transition from state");
-			}
+		itr = ictx->state->dispatch[ictx->ch];
+		if (itr == NULL) {
+			/* No transition? Eh? */
+			fatalx("no transition from state");
 		}
-		state = ictx->state;
 
 		/*
 		 * Any state except print stops the current collection. This is
@@ -922,6 +1037,44 @@ input_parse(struct input_ctx *ictx, u_char *buf, size_t len)
 		 */
 		if (itr->handler != input_print)
 			screen_write_collect_end(sctx);
+		else {
+			/*
+			 * Write the whole run of printable ASCII characters
+			 * together, they cannot change state.
+			 */
+			end = off;
+			while (end < len && buf[end] >= 0x20 && buf[end] <= 0x7e)
+				end++;
+			if (end != off) {
+				input_print_string(ictx, buf + off - 1,
+				    end - off + 1);
+				ictx->ch = buf[end - 1];
+				off = end;
+				continue;
+			}
+		}
+
+		/*
+		 * Inside a string (OSC, DCS, APC), collect everything up to
+		 * the next byte which would do something else in one go -
+		 * strings such as OSC 52 can be very large.
+		 */
+		if (itr->handler == input_input && itr->state == NULL) {
+			end = off;
+			while (end < len) {
+				next = ictx->state->dispatch[buf[end]];
+				if (next->handler != input_input ||
+				    next->state != NULL)
+					break;
+				end++;
+			}
+			input_input_string(ictx, buf + off - 1, end - off + 1);
+			evbuffer_add(ictx->since_ground, buf + off - 1,
+			    end - off + 1);
+			ictx->ch = buf[end - 1];
+			off = end;
+			continue;
+		}
 
 		/*
 		 * Execute the handler, if any. Don't switch state if it
@@ -940,16 +1093,35 @@ input_parse(struct input_ctx *ictx, u_char *buf, size_t len)
 	}
 }
 
-/* Parse input from pane. */
-void
+/*
+ * Parse input from pane. This stops after a while so one busy pane cannot hold
+ * up the server, and returns the number of bytes left to be parsed later.
+ */
+size_t
 input_parse_pane(struct window_pane *wp)
 {
-	void	*new_data;
-	size_t	 new_size;
+	void		*new_data;
+	size_t		 new_size, size, done = 0;
+	uint64_t	 t = get_timer();
+
+	while ((new_data = window_pane_peek_new_data(wp, &wp->offset,
+	    &size)) != NULL) {
+		if (size > INPUT_PARSE_CHUNK)
+			size = INPUT_PARSE_CHUNK;
+		input_parse_buffer(wp, new_data, size);
+		window_pane_update_used_data(wp, &wp->offset, size);
 
-	new_data = window_pane_get_new_data(wp, &wp->offset, &new_size);
-	input_parse_buffer(wp, new_data, new_size);
-	window_pane_update_used_data(wp, &wp->offset, new_size);
+		done += size;
+		if (done >= INPUT_PARSE_BUDGET ||
+		    get_timer() - t >= INPUT_PARSE_TIME)
+			break;
+	}
+	new_size = window_pane_get_new_size(wp, &wp->offset);
+	if (new_size != 0) {
+		log_debug("%s: %%%u has %zu bytes left", __func__, wp->id,
+		    new_size);
+	}
+	return (new_size);
 }
 
 /* Parse given input. */
@@ -964,6 +1136,7 @@ input_parse_buffer(struct window_pane *wp, u_char *buf, size_t len)
 
 	window_update_activity(wp->window);
 	wp->flags |= PANE_CHANGED;
+	window_queue_check(wp->window);
 
 	/* NULL wp if there is a mode set as don't want to update the tty. */
 	if (TAILQ_EMPTY(&wp->modes))
@@ -971,8 +1144,10 @@ input_parse_buffer(struct window_pane *wp, u_char *buf, size_t len)
 	else
 		screen_write_start(sctx, &wp->base);
 
-	log_debug("%s: %%%u %s, %zu bytes: %.*s", __func__, wp->id,
-	    ictx->state->name, len, (int)len, buf);
+	trace_event(TRACE_INPUT_PARSE, wp->id, len, 0);
+	wp->parsed_bytes += len;
+	if (wp->flags & PANE_INPUTWAIT)
+		server_client_input_echoed(wp);
 
 	input_parse(ictx, buf, len);
 	screen_write_stop(sctx);
@@ -1138,6 +1313,27 @@ input_print(struct input_ctx *ictx)
 	return (0);
 }
 
+/* Output a run of printable ASCII characters. */
+static void
+input_print_string(struct input_ctx *ictx, const u_char *data, size_t len)
+{
+	struct screen_write_ctx	*sctx = &ictx->ctx;
+	int			 set;
+
+	ictx->utf8started = 0; /* can't be valid UTF-8 */
+
+	set = ictx->cell.set == 0 ? ictx->cell.g0set : ictx->cell.g1set;
+	if (set == 1)
+		ictx->cell.cell.attr |= GRID_ATTR_CHARSET;
+	else
+		ictx->cell.cell.attr &= ~GRID_ATTR_CHARSET;
+
+	screen_write_collect_add_string(sctx, &ictx->cell.cell, data, len);
+	ictx->last = data[len - 1];
+
+	ictx->cell.cell.attr &= ~GRID_ATTR_CHARSET;
+}
+
 /* Collect intermediate string. */
 static int
 input_intermediate(struct input_ctx *ictx)
@@ -1170,22 +1366,36 @@ input_parameter(struct input_ctx *ictx)
 static int
 input_input(struct input_ctx *ictx)
 {
-	size_t available;
+	u_char	ch = ictx->ch;
+
+	input_input_string(ictx, &ch, 1);
+	return (0);
+}
+
+/* Collect a run of input string. */
+static void
+input_input_string(struct input_ctx *ictx, const u_char *data, size_t len)
+{
+	size_t	available;
+
+	if (ictx->flags & INPUT_DISCARD)
+		return;
 
 	available = ictx->input_space;
-	while (ictx->input_len + 1 >= available) {
+	while (ictx->input_len + len >= available) {
 		available *= 2;
 		if (available > INPUT_BUF_LIMIT) {
 			ictx->flags |= INPUT_DISCARD;
-			return (0);
+			return;
 		}
+	}
+	if (available != ictx->input_space) {
 		ictx->input_buf = xrealloc(ictx->input_buf, available);
 		ictx->input_space = available;
 	}
-	ictx->input_buf[ictx->input_len++] = ictx->ch;
+	memcpy(ictx->input_buf + ictx->input_len, data, len);
+	ictx->input_len += len;
 	ictx->input_buf[ictx->input_len] = '\0';
-
-	return (0);
 }
 
 /* Execute C0 control sequence. */
@@ -1331,6 +1541,7 @@ input_csi_dispatch(struct input_ctx *ictx)
 	struct screen_write_ctx	       *sctx = &ictx->ctx;
 	struct screen		       *s = sctx->s;
 	struct input_table_entry       *entry;
+	struct input_sgr	       *sgr = NULL;
 	int				i, n, m;
 	u_int				cx, bg = ictx->cell.cell.bg;
 
@@ -1340,6 +1551,14 @@ input_csi_dispatch(struct input_ctx *ictx)
 	log_debug("%s: '%c' \"%s\" \"%s\"",
 	    __func__, ictx->ch, ictx->interm_buf, ictx->param_buf);
 
+	if (ictx->ch == 'm' && ictx->interm_len == 0) {
+		sgr = input_csi_dispatch_sgr_find(ictx);
+		if (sgr == NULL) {
+			ictx->last = -1;
+			return (0);
+		}
+	}
+
 	if (input_split(ictx) != 0)
 		return (0);
 
@@ -1573,7 +1792,10 @@ input_csi_dispatch(struct input_ctx *ictx)
 		input_save_state(ictx);
 		break;
 	case INPUT_CSI_SGR:
-		input_csi_dispatch_sgr(ictx);
+		if (sgr != NULL)
+			input_csi_dispatch_sgr_save(ictx, sgr);
+		else
+			input_csi_dispatch_sgr(ictx);
 		break;
 	case INPUT_CSI_SM:
 		input_csi_dispatch_sm(ictx);
@@ -1790,8 +2012,10 @@ input_csi_dispatch_sm_private(struct input_ctx *ictx)
 			if (sctx->s->mode & MODE_FOCUSON)
 				break;
 			screen_write_mode_set(sctx, MODE_FOCUSON);
-			if (wp != NULL)
+			if (wp != NULL) {
 				wp->flags |= PANE_FOCUSPUSH; /* force update */
+				window_pane_queue_check(wp);
+			}
 			break;
 		case 1005:
 			screen_write_mode_set(sctx, MODE_MOUSE_UTF8);
@@ -2199,6 +2423,92 @@ input_csi_dispatch_sgr(struct input_ctx *ictx)
 	}
 }
 
+/*
+ * Look for an SGR sequence in the cache and apply it if found (returning NULL),
+ * otherwise return the entry to fill in once it has been parsed.
+ */
+static struct input_sgr *
+input_csi_dispatch_sgr_find(struct input_ctx *ictx)
+{
+	struct grid_cell	*gc = &ictx->cell.cell;
+	struct input_sgr	*sgr;
+	u_int			 hash = 0;
+	size_t			 i;
+
+	for (i = 0; i < ictx->param_len; i++)
+		hash = hash * 31 + ictx->param_buf[i];
+	sgr = &ictx->sgr_cache[hash % INPUT_SGR_CACHE];
+
+	if (!sgr->valid ||
+	    sgr->param_len != ictx->param_len ||
+	    memcmp(sgr->param_buf, ictx->param_buf, ictx->param_len) != 0) {
+		memcpy(sgr->param_buf, ictx->param_buf, ictx->param_len);
+		sgr->param_len = ictx->param_len;
+		sgr->valid = 0;
+		return (sgr);
+	}
+
+	if (sgr->reset)
+		memcpy(gc, &grid_default_cell, sizeof *gc);
+	gc->attr = (gc->attr & sgr->attr_mask) | sgr->attr_set;
+	if (sgr->flags & INPUT_SGR_FG)
+		gc->fg = sgr->fg;
+	if (sgr->flags & INPUT_SGR_BG)
+		gc->bg = sgr->bg;
+	if (sgr->flags & INPUT_SGR_US)
+		gc->us = sgr->us;
+	return (NULL);
+}
+
+/*
+ * Parse an SGR sequence and save its effect in the cache. It is run on a cell
+ * with everything cleared and then on one with everything set, to find which
+ * attribute bits are kept and which are set and which colours are replaced.
+ */
+static void
+input_csi_dispatch_sgr_save(struct input_ctx *ictx, struct input_sgr *sgr)
+{
+	struct grid_cell	*gc = &ictx->cell.cell, saved, first;
+
+	memcpy(&saved, gc, sizeof saved);
+
+	gc->attr = 0;
+	gc->flags = 0xff;
+	gc->fg = gc->bg = gc->us = -2;
+	input_csi_dispatch_sgr(ictx);
+	memcpy(&first, gc, sizeof first);
+
+	memcpy(gc, &saved, sizeof *gc);
+	gc->attr = 0xffff;
+	gc->flags = 0xff;
+	gc->fg = gc->bg = gc->us = -3;
+	input_csi_dispatch_sgr(ictx);
+
+	/* Only a reset touches the flags. */
+	sgr->reset = (first.flags != 0xff || gc->flags != 0xff);
+	sgr->attr_set = first.attr;
+	sgr->attr_mask = ~first.attr & gc->attr;
+
+	sgr->flags = 0;
+	if (first.fg != -2 || gc->fg != -3) {
+		sgr->flags |= INPUT_SGR_FG;
+		sgr->fg = first.fg;
+	}
+	if (first.bg != -2 || gc->bg != -3) {
+		sgr->flags |= INPUT_SGR_BG;
+		sgr->bg = first.bg;
+	}
+	if (first.us != -2 || gc->us != -3) {
+		sgr->flags |= INPUT_SGR_US;
+		sgr->us = first.us;
+	}
+	sgr->valid = 1;
+
+	/* Now apply it to the real cell. */
+	memcpy(gc, &saved, sizeof *gc);
+	input_csi_dispatch_sgr(ictx);
+}
+
 /* End of input with BEL. */
 static int
 input_end_bel(struct input_ctx *ictx)
@@ -2627,7 +2937,7 @@ input_osc_52(struct input_ctx *ictx, const char *p)
 	struct window_pane	*wp = ictx->wp;
 	char			*end;
 	const char		*buf;
-	size_t			 len;
+	size_t			 len, elen;
 	u_char			*out;
 	int			 outlen, state;
 	struct screen_write_ctx	 ctx;
@@ -2670,7 +2980,8 @@ input_osc_52(struct input_ctx *ictx, const char *p)
 		return;
 	}
 
-	len = (strlen(end) / 4) * 3;
+	elen = strlen(end);
+	len = (elen / 4) * 3;
 	if (len == 0)
 		return;
 
@@ -2680,8 +2991,16 @@ input_osc_52(struct input_ctx *ictx, const char *p)
 		return;
 	}
 
+	/*
+	 * If the string is exactly what encoding the data would produce (no
+	 * whitespace or anything else b64_pton skips), pass it on to the
+	 * terminals unchanged instead of encoding it again.
+	 */
 	screen_write_start_pane(&ctx, wp, NULL);
-	screen_write_setselection(&ctx, out, outlen);
+	if (elen == 4 * (((size_t)outlen + 2) / 3))
+		screen_write_setselection_encoded(&ctx, end);
+	else
+		screen_write_setselection(&ctx, out, outlen);
 	screen_write_stop(&ctx);
 	notify_pane("pane-set-clipboard", wp);
 
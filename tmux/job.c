@@ -41,12 +41,16 @@ static void	job_error_callback(struct bufferevent *, short, void *);
 /* A single job. */
 struct job {
 	enum {
+		JOB_QUEUED,
 		JOB_RUNNING,
 		JOB_DEAD,
 		JOB_CLOSED
 	} state;
 
 	int			 flags;
+	u_int			 id;
+	time_t			 created;
+	int			 counted;
 
 	char			*cmd;
 	pid_t			 pid;
@@ -54,17 +58,120 @@ struct job {
 
 	int			 fd;
 	struct bufferevent	*event;
+	size_t			 limit;
 
 	job_update_cb		 updatecb;
 	job_complete_cb		 completecb;
 	job_free_cb		 freecb;
 	void			*data;
 
+	/* Saved to start the job when it leaves the queue. */
+	int			 argc;
+	char			**argv;
+	char			*cwd;
+	struct environ		*env;
+	int			 sx;
+	int			 sy;
+
 	LIST_ENTRY(job)		 entry;
+	TAILQ_ENTRY(job)	 qentry;
 };
+TAILQ_HEAD(job_queue, job);
 
 /* All jobs list. */
 static LIST_HEAD(joblist, job) all_jobs = LIST_HEAD_INITIALIZER(all_jobs);
+static u_int job_next_id;
+
+/*
+ * Jobs waiting for one of the running jobs counted against job-limit to
+ * finish. There is one queue for each priority; low priority jobs (from
+ * formats) are only started when no others are waiting.
+ */
+static struct job_queue job_queues[2] = {
+	TAILQ_HEAD_INITIALIZER(job_queues[0]),
+	TAILQ_HEAD_INITIALIZER(job_queues[1])
+};
+static u_int job_running;
+static int job_start_pending;
+
+static int	job_start(struct job *);
+static void	job_start_queued(int, short, void *);
+
+/* Which queue a job goes in. */
+static struct job_queue *
+job_get_queue(struct job *job)
+{
+	if (job->flags & JOB_LOWPRIORITY)
+		return (&job_queues[1]);
+	return (&job_queues[0]);
+}
+
+/* Is there space to start another job? */
+static int
+job_can_start(void)
+{
+	u_int	limit;
+
+	limit = options_get_number(global_options, "job-limit");
+	return (limit == 0 || job_running < limit);
+}
+
+/* Stop counting a job against the limit and start any that are waiting. */
+static void
+job_uncount(struct job *job)
+{
+	if (!job->counted)
+		return;
+	job->counted = 0;
+	job_running--;
+
+	if (job_start_pending)
+		return;
+	if (TAILQ_EMPTY(&job_queues[0]) && TAILQ_EMPTY(&job_queues[1]))
+		return;
+	job_start_pending = 1;
+	event_once(-1, EV_TIMEOUT, job_start_queued, NULL, NULL);
+}
+
+/*
+ * Start jobs from the queues while there is space. This happens from the event
+ * loop rather than when a job finishes so callbacks are never run inside
+ * another job's callbacks.
+ */
+static void
+job_start_queued(__unused int fd, __unused short events, __unused void *arg)
+{
+	struct job	*job;
+	u_int		 i;
+
+	job_start_pending = 0;
+	for (i = 0; i < nitems(job_queues); i++) {
+		while (job_can_start()) {
+			job = TAILQ_FIRST(&job_queues[i]);
+			if (job == NULL)
+				break;
+			TAILQ_REMOVE(&job_queues[i], job, qentry);
+
+			log_debug("start queued job %p: %s", job, job->cmd);
+			if (job_start(job) != 0) {
+				/*
+				 * Nobody is waiting for a return value now, so
+				 * finish the job as if it had failed. It is no
+				 * longer in the queue.
+				 */
+				job->state = JOB_DEAD;
+				job->status = 127 << 8;
+				job->event = bufferevent_new(-1, NULL, NULL,
+				    NULL, NULL);
+				if (job->event == NULL)
+					fatalx("out of memory");
+				if (job->completecb != NULL)
+					job->completecb(job);
+				job_free(job);
+			}
+		}
+	}
+}
 
 /* Start a job running. */
 struct job *
@@ -72,45 +179,157 @@ job_run(const char *cmd, int argc, char **argv, struct session *s,
     const char *cwd, job_update_cb updatecb, job_complete_cb completecb,
     job_free_cb freecb, void *data, int flags, int sx, int sy)
 {
-	struct job	 *job;
-	struct environ	 *env;
-	pid_t		  pid;
-	int		  nullfd, out[2], master;
-	const char	 *home;
-	sigset_t	  set, oldset;
-	struct winsize	  ws;
-	char		**argvp;
+	struct job	*job;
+
+	job = xcalloc(1, sizeof *job);
+	job->state = JOB_QUEUED;
+	job->flags = flags;
+	job->id = job_next_id++;
+	job->created = time(NULL);
+
+	if (cmd != NULL)
+		job->cmd = xstrdup(cmd);
+	else {
+		job->cmd = cmd_stringify_argv(argc, argv);
+		job->argc = argc;
+		job->argv = cmd_copy_argv(argc, argv);
+	}
+	job->pid = -1;
+	job->fd = -1;
+
+	job->updatecb = updatecb;
+	job->completecb = completecb;
+	job->freecb = freecb;
+	job->data = data;
 
 	/*
 	 * Do not set TERM during .tmux.conf, it is nice to be able to use
 	 * if-shell to decide on default-terminal based on outside TERM.
 	 */
-	env = environ_for_session(s, !cfg_finished);
+	job->env = environ_for_session(s, !cfg_finished);
+	if (cwd != NULL)
+		job->cwd = xstrdup(cwd);
+	job->sx = sx;
+	job->sy = sy;
+
+	LIST_INSERT_HEAD(&all_jobs, job, entry);
+	if ((flags & JOB_LIMIT) && !job_can_start()) {
+		TAILQ_INSERT_TAIL(job_get_queue(job), job, qentry);
+		log_debug("queue job %p: %s", job, job->cmd);
+		return (job);
+	}
+	if (job_start(job) != 0) {
+		LIST_REMOVE(job, entry);
+		environ_free(job->env);
+		cmd_free_argv(job->argc, job->argv);
+		free(job->cwd);
+		free(job->cmd);
+		free(job);
+		return (NULL);
+	}
+	return (job);
+}
+
+#ifdef PROC_SPAWN
+/*
+ * Start a shell command job without copying the server. On success, the pid is
+ * set and either master or out[0] and out[1] are open.
+ */
+static int
+job_spawn(struct job *job, int *master, int *out, sigset_t *oldset)
+{
+	struct winsize	  ws;
+	char		**envp, *argv[] = { "sh", "-c", job->cmd, NULL };
+	int		  slave, nullfd;
+	pid_t		  pid;
+
+	if (job->flags & JOB_PTY) {
+		memset(&ws, 0, sizeof ws);
+		ws.ws_col = job->sx;
+		ws.ws_row = job->sy;
+		if (openpty(master, &slave, NULL, NULL, &ws) != 0)
+			return (-1);
+		out[1] = nullfd = slave;
+	} else {
+		if (socketpair(AF_UNIX, SOCK_STREAM, PF_UNSPEC, out) != 0)
+			return (-1);
+		nullfd = open(_PATH_DEVNULL, O_RDWR, 0);
+		if (nullfd == -1) {
+			close(out[0]);
+			close(out[1]);
+			return (-1);
+		}
+	}
+	log_debug("%s: cmd=%s, cwd=%s", __func__, job->cmd,
+	    job->cwd == NULL ? "" : job->cwd);
+
+	envp = environ_exec(NULL, job->env);
+	pid = proc_spawn(_PATH_BSHELL, argv, envp, job->cwd, out[1], out[1],
+	    nullfd, job->flags & JOB_PTY, oldset);
+	environ_free_exec(envp);
+
+	if (job->flags & JOB_PTY) {
+		close(slave);
+		if (pid == -1)
+			close(*master);
+	} else {
+		close(nullfd);
+		if (pid == -1) {
+			close(out[0]);
+			close(out[1]);
+		}
+	}
+	if (pid == -1)
+		return (-1);
+	job->pid = pid;
+	return (0);
+}
+#endif
+
+/* Fork a job. */
+static int
+job_start(struct job *job)
+{
+	pid_t		  pid;
+	int		  nullfd, out[2], master;
+	const char	 *home, *cwd = job->cwd;
+	sigset_t	  set, oldset;
+	struct winsize	  ws;
+	char		**argvp;
 
 	sigfillset(&set);
 	sigprocmask(SIG_BLOCK, &set, &oldset);
 
-	if (flags & JOB_PTY) {
+#ifdef PROC_SPAWN
+	if (job->argv == NULL) {
+		if (job_spawn(job, &master, out, &oldset) != 0)
+			goto fail;
+		pid = job->pid;
+		goto started;
+	}
+#endif
+
+	if (job->flags & JOB_PTY) {
 		memset(&ws, 0, sizeof ws);
-		ws.ws_col = sx;
-		ws.ws_row = sy;
+		ws.ws_col = job->sx;
+		ws.ws_row = job->sy;
 		pid = fdforkpty(ptm_fd, &master, NULL, NULL, &ws);
 	} else {
 		if (socketpair(AF_UNIX, SOCK_STREAM, PF_UNSPEC, out) != 0)
 			goto fail;
 		pid = fork();
 	}
-	if (cmd == NULL) {
-		cmd_log_argv(argc, argv, "%s:", __func__);
+	if (job->argv != NULL) {
+		cmd_log_argv(job->argc, job->argv, "%s:", __func__);
 		log_debug("%s: cwd=%s", __func__, cwd == NULL ? "" : cwd);
 	} else {
-		log_debug("%s: cmd=%s, cwd=%s", __func__, cmd,
+		log_debug("%s: cmd=%s, cwd=%s", __func__, job->cmd,
 		    cwd == NULL ? "" : cwd);
 	}
 
 	switch (pid) {
 	case -1:
-		if (~flags & JOB_PTY) {
+		if (~job->flags & JOB_PTY) {
 			close(out[0]);
 			close(out[1]);
 		}
@@ -124,10 +343,10 @@ job_run(const char *cmd, int argc, char **argv, struct session *s,
 		    chdir("/") != 0)
 			fatal("chdir failed");
 
-		environ_push(env);
-		environ_free(env);
+		environ_push(NULL, job->env);
+		environ_free(job->env);
 
-		if (~flags & JOB_PTY) {
+		if (~job->flags & JOB_PTY) {
 			if (dup2(out[1], STDIN_FILENO) == -1)
 				fatal("dup2 failed");
 			if (dup2(out[1], STDOUT_FILENO) == -1)
@@ -146,38 +365,33 @@ job_run(const char *cmd, int argc, char **argv, struct session *s,
 		}
 		closefrom(STDERR_FILENO + 1);
 
-		if (cmd != NULL) {
-			execl(_PATH_BSHELL, "sh", "-c", cmd, (char *) NULL);
+		if (job->argv == NULL) {
+			execl(_PATH_BSHELL, "sh", "-c", job->cmd, (char *) NULL);
 			fatal("execl failed");
 		} else {
-			argvp = cmd_copy_argv(argc, argv);
+			argvp = cmd_copy_argv(job->argc, job->argv);
 			execvp(argvp[0], argvp);
 			fatal("execvp failed");
 		}
 	}
 
+#ifdef PROC_SPAWN
+started:
+#endif
 	sigprocmask(SIG_SETMASK, &oldset, NULL);
-	environ_free(env);
+	environ_free(job->env);
+	job->env = NULL;
 
-	job = xmalloc(sizeof *job);
 	job->state = JOB_RUNNING;
-	job->flags = flags;
-
-	if (cmd != NULL)
-		job->cmd = xstrdup(cmd);
-	else
-		job->cmd = cmd_stringify_argv(argc, argv);
 	job->pid = pid;
 	job->status = 0;
+	server_stats.jobs++;
+	if (job->flags & JOB_LIMIT) {
+		job->counted = 1;
+		job_running++;
+	}
 
-	LIST_INSERT_HEAD(&all_jobs, job, entry);
-
-	job->updatecb = updatecb;
-	job->completecb = completecb;
-	job->freecb = freecb;
-	job->data = data;
-
-	if (~flags & JOB_PTY) {
+	if (~job->flags & JOB_PTY) {
 		close(out[1]);
 		job->fd = out[0];
 	} else
@@ -191,12 +405,11 @@ job_run(const char *cmd, int argc, char **argv, struct session *s,
 	bufferevent_enable(job->event, EV_READ|EV_WRITE);
 
 	log_debug("run job %p: %s, pid %ld", job, job->cmd, (long) job->pid);
-	return (job);
+	return (0);
 
 fail:
 	sigprocmask(SIG_SETMASK, &oldset, NULL);
-	environ_free(env);
-	return (NULL);
+	return (-1);
 }
 
 /* Kill and free an individual job. */
@@ -206,7 +419,14 @@ job_free(struct job *job)
 	log_debug("free job %p: %s", job, job->cmd);
 
 	LIST_REMOVE(job, entry);
+	if (job->state == JOB_QUEUED)
+		TAILQ_REMOVE(job_get_queue(job), job, qentry);
+	job_uncount(job);
 	free(job->cmd);
+	cmd_free_argv(job->argc, job->argv);
+	free(job->cwd);
+	if (job->env != NULL)
+		environ_free(job->env);
 
 	if (job->freecb != NULL && job->data != NULL)
 		job->freecb(job->data);
@@ -227,8 +447,13 @@ job_resize(struct job *job, u_int sx, u_int sy)
 {
 	struct winsize	 ws;
 
-	if (job->fd == -1 || (~job->flags & JOB_PTY))
+	if (~job->flags & JOB_PTY)
 		return;
+	if (job->fd == -1) {
+		job->sx = sx;
+		job->sy = sy;
+		return;
+	}
 
 	log_debug("resize job %p: %ux%u", job, sx, sy);
 
@@ -239,14 +464,29 @@ job_resize(struct job *job, u_int sx, u_int sy)
 		fatal("ioctl failed");
 }
 
-/* Job buffer read callback. */
+/*
+ * Job buffer read callback. If the update callback leaves more than the limit
+ * in the buffer, the oldest output is thrown away.
+ */
 static void
 job_read_callback(__unused struct bufferevent *bufev, void *data)
 {
 	struct job	*job = data;
+	struct evbuffer	*evb;
+	size_t		 len;
 
 	if (job->updatecb != NULL)
 		job->updatecb(job);
+
+	if (job->limit != 0 && job->event != NULL) {
+		evb = job->event->input;
+		len = EVBUFFER_LENGTH(evb);
+		if (len > job->limit) {
+			log_debug("job %p: %s, dropping %zu bytes", job,
+			    job->cmd, len - job->limit);
+			evbuffer_drain(evb, len - job->limit);
+		}
+	}
 }
 
 /*
@@ -309,6 +549,7 @@ job_check_died(pid_t pid, int status)
 	log_debug("job died %p: %s, pid %ld", job, job->cmd, (long) job->pid);
 
 	job->status = status;
+	job_uncount(job);
 
 	if (job->state == JOB_CLOSED) {
 		if (job->completecb != NULL)
@@ -341,14 +582,23 @@ job_get_event(struct job *job)
 	return (job->event);
 }
 
-/* Kill all jobs. */
+/* Set the most output kept for a job, zero for no limit. */
+void
+job_set_limit(struct job *job, size_t limit)
+{
+	job->limit = limit;
+}
+
+/* Kill all jobs. Any that have not started yet are thrown away. */
 void
 job_kill_all(void)
 {
-	struct job	*job;
+	struct job	*job, *job1;
 
-	LIST_FOREACH(job, &all_jobs, entry) {
-		if (job->pid != -1)
+	LIST_FOREACH_SAFE(job, &all_jobs, entry, job1) {
+		if (job->state == JOB_QUEUED)
+			job_free(job);
+		else if (job->pid != -1)
 			kill(job->pid, SIGTERM);
 	}
 }
@@ -360,7 +610,9 @@ job_still_running(void)
 	struct job	*job;
 
 	LIST_FOREACH(job, &all_jobs, entry) {
-		if ((~job->flags & JOB_NOWAIT) && job->state == JOB_RUNNING)
+		if (job->flags & JOB_NOWAIT)
+			continue;
+		if (job->state == JOB_RUNNING || job->state == JOB_QUEUED)
 			return (1);
 	}
 	return (0);
@@ -383,3 +635,45 @@ job_print_summary(struct cmdq_item *item, int blank)
 		n++;
 	}
 }
+
+/* Walk jobs, most recently created first. */
+struct job *
+job_walk(struct job *job)
+{
+	if (job == NULL)
+		return (LIST_FIRST(&all_jobs));
+	return (LIST_NEXT(job, entry));
+}
+
+/* Add job formats. */
+void
+job_add_formats(struct job *job, struct format_tree *ft)
+{
+	const char	*state;
+	struct timeval	 tv;
+
+	switch (job->state) {
+	case JOB_QUEUED:
+		state = "queued";
+		break;
+	case JOB_RUNNING:
+		state = "running";
+		break;
+	case JOB_DEAD:
+	case JOB_CLOSED:
+	default:
+		state = "finishing";
+		break;
+	}
+
+	format_add(ft, "job_id", "%u", job->id);
+	format_add(ft, "job_command", "%s", job->cmd);
+	format_add(ft, "job_state", "%s", state);
+	format_add(ft, "job_low_priority", "%d",
+	    !!(job->flags & JOB_LOWPRIORITY));
+	tv.tv_sec = job->created;
+	tv.tv_usec = 0;
+	format_add_tv(ft, "job_created", &tv);
+	if (job->pid != -1)
+		format_add(ft, "job_pid", "%ld", (long)job->pid);
+}
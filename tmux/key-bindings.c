@@ -88,6 +88,48 @@ key_bindings_cmp(struct key_binding *bd1, struct key_binding *bd2)
 	return (0);
 }
 
+/* Hash a key into a table index of the given size (a power of two). */
+static u_int
+key_bindings_hash(key_code key, u_int size)
+{
+	return ((u_int)((key * 0x9e3779b97f4a7c15ULL) >> 32) & (size - 1));
+}
+
+/*
+ * Build the index of bindings in a table. This is done on first lookup after
+ * a change, so loading a large number of bindings does not rebuild it every
+ * time.
+ */
+static void
+key_bindings_build_index(struct key_table *table)
+{
+	struct key_binding	*bd;
+	u_int			 n = 0, size = 16, i;
+
+	RB_FOREACH(bd, key_bindings, &table->key_bindings)
+		n++;
+	while (size < n * 2)
+		size *= 2;
+
+	table->index = xcalloc(size, sizeof *table->index);
+	table->index_size = size;
+	RB_FOREACH(bd, key_bindings, &table->key_bindings) {
+		i = key_bindings_hash(bd->key, size);
+		while (table->index[i] != NULL)
+			i = (i + 1) & (size - 1);
+		table->index[i] = bd;
+	}
+}
+
+/* Discard the index of bindings in a table when they change. */
+static void
+key_bindings_invalidate_index(struct key_table *table)
+{
+	free(table->index);
+	table->index = NULL;
+	table->index_size = 0;
+}
+
 static void
 key_bindings_free(struct key_binding *bd)
 {
@@ -106,7 +148,7 @@ key_bindings_get_table(const char *name, int create)
 	if (table != NULL || !create)
 		return (table);
 
-	table = xmalloc(sizeof *table);
+	table = xcalloc(1, sizeof *table);
 	table->name = xstrdup(name);
 	RB_INIT(&table->key_bindings);
 	RB_INIT(&table->default_key_bindings);
@@ -147,6 +189,7 @@ key_bindings_unref_table(struct key_table *table)
 		key_bindings_free(bd);
 	}
 
+	free(table->index);
 	free((void *)table->name);
 	free(table);
 }
@@ -154,10 +197,21 @@ key_bindings_unref_table(struct key_table *table)
 struct key_binding *
 key_bindings_get(struct key_table *table, key_code key)
 {
-	struct key_binding	bd;
+	struct key_binding	*bd;
+	u_int			 i;
 
-	bd.key = key;
-	return (RB_FIND(key_bindings, &table->key_bindings, &bd));
+	if (RB_EMPTY(&table->key_bindings))
+		return (NULL);
+	if (table->index == NULL)
+		key_bindings_build_index(table);
+
+	i = key_bindings_hash(key, table->index_size);
+	while ((bd = table->index[i]) != NULL) {
+		if (bd->key == key)
+			return (bd);
+		i = (i + 1) & (table->index_size - 1);
+	}
+	return (NULL);
 }
 
 struct key_binding *
@@ -187,6 +241,7 @@ key_bindings_add(const char *name, key_code key, const char *note, int repeat,
 {
 	struct key_table	*table;
 	struct key_binding	*bd;
+	char			*s;
 
 	table = key_bindings_get_table(name, 1);
 
@@ -205,6 +260,7 @@ key_bindings_add(const char *name, key_code key, const char *note, int repeat,
 		RB_REMOVE(key_bindings, &table->key_bindings, bd);
 		key_bindings_free(bd);
 	}
+	key_bindings_invalidate_index(table);
 
 	bd = xcalloc(1, sizeof *bd);
 	bd->key = (key & ~KEYC_MASK_FLAGS);
@@ -216,8 +272,12 @@ key_bindings_add(const char *name, key_code key, const char *note, int repeat,
 		bd->flags |= KEY_BINDING_REPEAT;
 	bd->cmdlist = cmdlist;
 
-	log_debug("%s: %#llx %s = %s", __func__, bd->key,
-	    key_string_lookup_key(bd->key, 1), cmd_list_print(bd->cmdlist, 0));
+	if (log_get_level() != 0) {
+		s = cmd_list_print(bd->cmdlist, 0);
+		log_debug("%s: %#llx %s = %s", __func__, bd->key,
+		    key_string_lookup_key(bd->key, 1), s);
+		free(s);
+	}
 }
 
 void
@@ -239,6 +299,7 @@ key_bindings_remove(const char *name, key_code key)
 
 	RB_REMOVE(key_bindings, &table->key_bindings, bd);
 	key_bindings_free(bd);
+	key_bindings_invalidate_index(table);
 
 	if (RB_EMPTY(&table->key_bindings) &&
 	    RB_EMPTY(&table->default_key_bindings)) {
@@ -639,6 +700,37 @@ key_bindings_init(void)
 	cmdq_append(NULL, cmdq_get_callback(key_bindings_init_done, NULL));
 }
 
+/*
+ * Check if a binding can be run once for a mouse event that stands for several
+ * identical events. This is true if it contains only send-keys -X, which runs
+ * the mode command as many times as needed, and select-pane without arguments,
+ * which does the same each time.
+ */
+int
+key_bindings_can_repeat(struct key_binding *bd)
+{
+	struct cmd		*cmd;
+	const struct cmd_entry	*entry;
+	struct args		*args;
+	struct args_entry	*ae;
+
+	cmd = cmd_list_first(bd->cmdlist);
+	while (cmd != NULL) {
+		entry = cmd_get_entry(cmd);
+		args = cmd_get_args(cmd);
+		if (strcmp(entry->name, "send-keys") == 0) {
+			if (!args_has(args, 'X'))
+				return (0);
+		} else if (strcmp(entry->name, "select-pane") == 0) {
+			if (args->argc != 0 || args_first(args, &ae) != 0)
+				return (0);
+		} else
+			return (0);
+		cmd = cmd_list_next(cmd);
+	}
+	return (1);
+}
+
 static enum cmd_retval
 key_bindings_read_only(struct cmdq_item *item, __unused void *data)
 {
@@ -18,6 +18,7 @@
 
 #include <sys/types.h>
 
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 #include <wchar.h>
@@ -113,15 +114,58 @@ static const struct {
 	KEYC_MOUSE_STRING(TRIPLECLICK3, TripleClick3),
 };
 
+/*
+ * Index of the key string table by hash of the lowercase name, built the
+ * first time it is needed. Each slot is the table index plus one, or zero if
+ * empty; colliding names go in the next free slot.
+ */
+#define KEY_STRING_INDEX_SIZE 512
+static u_short key_string_index[KEY_STRING_INDEX_SIZE];
+
+/* Hash a key name ignoring case. */
+static u_int
+key_string_hash(const char *string)
+{
+	u_int	hash = 2166136261U;
+
+	for (; *string != '\0'; string++) {
+		hash ^= (u_char)tolower((u_char)*string);
+		hash *= 16777619U;
+	}
+	return (hash & (KEY_STRING_INDEX_SIZE - 1));
+}
+
+/* Build the key string table index. */
+static void
+key_string_build_index(void)
+{
+	u_int	i, slot;
+
+	for (i = 0; i < nitems(key_string_table); i++) {
+		slot = key_string_hash(key_string_table[i].string);
+		while (key_string_index[slot] != 0)
+			slot = (slot + 1) & (KEY_STRING_INDEX_SIZE - 1);
+		key_string_index[slot] = i + 1;
+	}
+}
+
 /* Find key string in table. */
 static key_code
 key_string_search_table(const char *string)
 {
-	u_int	i, user;
+	static int	built;
+	u_int		i, slot, user;
 
-	for (i = 0; i < nitems(key_string_table); i++) {
-		if (strcasecmp(string, key_string_table[i].string) == 0)
-			return (key_string_table[i].key);
+	if (!built) {
+		key_string_build_index();
+		built = 1;
+	}
+
+	slot = key_string_hash(string);
+	while ((i = key_string_index[slot]) != 0) {
+		if (strcasecmp(string, key_string_table[i - 1].string) == 0)
+			return (key_string_table[i - 1].key);
+		slot = (slot + 1) & (KEY_STRING_INDEX_SIZE - 1);
 	}
 
 	if (sscanf(string, "User%u", &user) == 1 && user < KEYC_NUSER)
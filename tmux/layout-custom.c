@@ -70,6 +70,36 @@ layout_dump(struct layout_cell *root)
 	return (out);
 }
 
+/*
+ * Dump the layout of a window, either the visible one or the one saved when
+ * zoomed. The string for each is kept until the layout generation changes so
+ * formats expanded many times for the same layout do not walk it again.
+ */
+char *
+layout_dump_window(struct window *w, int visible)
+{
+	struct layout_cell	*root = w->layout_root;
+	struct layout_dump	*ld;
+
+	if (!visible && w->saved_layout_root != NULL)
+		root = w->saved_layout_root;
+	if (root == NULL)
+		return (NULL);
+
+	ld = &w->layout_dumps[root == w->saved_layout_root];
+	if (ld->dump == NULL ||
+	    ld->root != root ||
+	    ld->generation != w->layout_generation) {
+		free(ld->dump);
+		ld->dump = layout_dump(root);
+		ld->root = root;
+		ld->generation = w->layout_generation;
+		if (ld->dump == NULL)
+			return (NULL);
+	}
+	return (xstrdup(ld->dump));
+}
+
 /* Append information for a single cell. */
 static int
 layout_append(struct layout_cell *lc, char *buf, size_t len)
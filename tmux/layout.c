@@ -35,10 +35,12 @@
 
 static u_int	layout_resize_check(struct window *, struct layout_cell *,
 		    enum layout_type);
+static u_int	layout_resize_check1(struct window *, struct layout_cell *,
+		    enum layout_type, int);
 static int	layout_resize_pane_grow(struct window *, struct layout_cell *,
-		    enum layout_type, int, int);
+		    enum layout_type, int, int, int);
 static int	layout_resize_pane_shrink(struct window *, struct layout_cell *,
-		    enum layout_type, int);
+		    enum layout_type, int, int);
 static u_int	layout_new_pane_size(struct window *, u_int,
 		    struct layout_cell *, enum layout_type, u_int, u_int,
 		    u_int);
@@ -236,6 +238,7 @@ layout_fix_offsets(struct window *w)
 	lc->yoff = 0;
 
 	layout_fix_offsets1(lc);
+	w->layout_generation++;
 }
 
 /* Is this a top cell? */
@@ -284,29 +287,53 @@ layout_add_border(struct window *w, struct layout_cell *lc, int status)
 	return (0);
 }
 
+/* Update a pane's offsets and size from its cell. */
+static void
+layout_fix_pane(struct window *w, struct window_pane *wp, int status)
+{
+	struct layout_cell	*lc = wp->layout_cell;
+
+	wp->xoff = lc->xoff;
+	wp->yoff = lc->yoff;
+
+	if (layout_add_border(w, lc, status)) {
+		if (status == PANE_STATUS_TOP)
+			wp->yoff++;
+		window_pane_resize(wp, lc->sx, lc->sy - 1);
+	} else
+		window_pane_resize(wp, lc->sx, lc->sy);
+}
+
 /* Update pane offsets and sizes based on their cells. */
 void
 layout_fix_panes(struct window *w, struct window_pane *skip)
 {
 	struct window_pane	*wp;
-	struct layout_cell	*lc;
 	int			 status;
 
+	screen_redraw_free_borders(w);
+	w->layout_generation++;
+
 	status = options_get_number(w->options, "pane-border-status");
 	TAILQ_FOREACH(wp, &w->panes, entry) {
-		if ((lc = wp->layout_cell) == NULL || wp == skip)
-			continue;
+		if (wp->layout_cell != NULL && wp != skip)
+			layout_fix_pane(w, wp, status);
+	}
+}
 
-		wp->xoff = lc->xoff;
-		wp->yoff = lc->yoff;
+/* Update pane offsets and sizes for panes below a cell only. */
+static void
+layout_fix_panes_cell(struct window *w, struct layout_cell *lc, int status)
+{
+	struct layout_cell	*lcchild;
 
-		if (layout_add_border(w, lc, status)) {
-			if (status == PANE_STATUS_TOP)
-				wp->yoff++;
-			window_pane_resize(wp, lc->sx, lc->sy - 1);
-		} else
-			window_pane_resize(wp, lc->sx, lc->sy);
+	if (lc->type == LAYOUT_WINDOWPANE) {
+		if (lc->wp != NULL)
+			layout_fix_pane(w, lc->wp, status);
+		return;
 	}
+	TAILQ_FOREACH(lcchild, &lc->cells, entry)
+		layout_fix_panes_cell(w, lcchild, status);
 }
 
 /* Count the number of available cells in a layout. */
@@ -334,12 +361,21 @@ layout_count_cells(struct layout_cell *lc)
 static u_int
 layout_resize_check(struct window *w, struct layout_cell *lc,
     enum layout_type type)
+{
+	int	status;
+
+	status = options_get_number(w->options, "pane-border-status");
+	return (layout_resize_check1(w, lc, type, status));
+}
+
+/* Get available space with the pane-border-status option already looked up. */
+static u_int
+layout_resize_check1(struct window *w, struct layout_cell *lc,
+    enum layout_type type, int status)
 {
 	struct layout_cell	*lcchild;
 	u_int			 available, minimum;
-	int			 status;
 
-	status = options_get_number(w->options, "pane-border-status");
 	if (lc->type == LAYOUT_WINDOWPANE) {
 		/* Space available in this cell only. */
 		if (type == LAYOUT_LEFTRIGHT) {
@@ -360,12 +396,14 @@ layout_resize_check(struct window *w, struct layout_cell *lc,
 		/* Same type: total of available space in all child cells. */
 		available = 0;
 		TAILQ_FOREACH(lcchild, &lc->cells, entry)
-			available += layout_resize_check(w, lcchild, type);
+			available += layout_resize_check1(w, lcchild, type,
+			    status);
 	} else {
 		/* Different type: minimum of available space in child cells. */
 		minimum = UINT_MAX;
 		TAILQ_FOREACH(lcchild, &lc->cells, entry) {
-			available = layout_resize_check(w, lcchild, type);
+			available = layout_resize_check1(w, lcchild, type,
+			    status);
 			if (available < minimum)
 				minimum = available;
 		}
@@ -489,6 +527,7 @@ void
 layout_free(struct window *w)
 {
 	layout_free_cell(w->layout_root);
+	w->layout_generation++;
 }
 
 /* Resize the entire layout after window resize. */
@@ -580,17 +619,21 @@ void
 layout_resize_layout(struct window *w, struct layout_cell *lc,
     enum layout_type type, int change, int opposite)
 {
-	int	needed, size;
+	struct layout_cell	*lcparent = lc->parent;
+	int			 needed, size, status;
+
+	status = options_get_number(w->options, "pane-border-status");
 
 	/* Grow or shrink the cell. */
 	needed = change;
 	while (needed != 0) {
 		if (change > 0) {
 			size = layout_resize_pane_grow(w, lc, type, needed,
-			    opposite);
+			    opposite, status);
 			needed -= size;
 		} else {
-			size = layout_resize_pane_shrink(w, lc, type, needed);
+			size = layout_resize_pane_shrink(w, lc, type, needed,
+			    status);
 			needed += size;
 		}
 
@@ -598,9 +641,15 @@ layout_resize_layout(struct window *w, struct layout_cell *lc,
 			break;
 	}
 
-	/* Fix cell offsets. */
-	layout_fix_offsets(w);
-	layout_fix_panes(w, NULL);
+	/*
+	 * Only the cell and its siblings can have changed size and the parent
+	 * is the same size as before, so only the cells and panes below the
+	 * parent need their offsets and sizes fixed.
+	 */
+	layout_fix_offsets1(lcparent);
+	screen_redraw_free_borders(w);
+	w->layout_generation++;
+	layout_fix_panes_cell(w, lcparent, status);
 	notify_window("window-layout-changed", w);
 }
 
@@ -632,7 +681,7 @@ layout_resize_pane(struct window_pane *wp, enum layout_type type, int change,
 /* Helper function to grow pane. */
 static int
 layout_resize_pane_grow(struct window *w, struct layout_cell *lc,
-    enum layout_type type, int needed, int opposite)
+    enum layout_type type, int needed, int opposite, int status)
 {
 	struct layout_cell	*lcadd, *lcremove;
 	u_int			 size = 0;
@@ -643,7 +692,7 @@ layout_resize_pane_grow(struct window *w, struct layout_cell *lc,
 	/* Look towards the tail for a suitable cell for reduction. */
 	lcremove = TAILQ_NEXT(lc, entry);
 	while (lcremove != NULL) {
-		size = layout_resize_check(w, lcremove, type);
+		size = layout_resize_check1(w, lcremove, type, status);
 		if (size > 0)
 			break;
 		lcremove = TAILQ_NEXT(lcremove, entry);
@@ -653,7 +702,8 @@ layout_resize_pane_grow(struct window *w, struct layout_cell *lc,
 	if (opposite && lcremove == NULL) {
 		lcremove = TAILQ_PREV(lc, layout_cells, entry);
 		while (lcremove != NULL) {
-			size = layout_resize_check(w, lcremove, type);
+			size = layout_resize_check1(w, lcremove, type,
+			    status);
 			if (size > 0)
 				break;
 			lcremove = TAILQ_PREV(lcremove, layout_cells, entry);
@@ -673,7 +723,7 @@ layout_resize_pane_grow(struct window *w, struct layout_cell *lc,
 /* Helper function to shrink pane. */
 static int
 layout_resize_pane_shrink(struct window *w, struct layout_cell *lc,
-    enum layout_type type, int needed)
+    enum layout_type type, int needed, int status)
 {
 	struct layout_cell	*lcadd, *lcremove;
 	u_int			 size;
@@ -681,7 +731,7 @@ layout_resize_pane_shrink(struct window *w, struct layout_cell *lc,
 	/* Shrinking. Find cell to remove from by walking towards head. */
 	lcremove = lc;
 	do {
-		size = layout_resize_check(w, lcremove, type);
+		size = layout_resize_check1(w, lcremove, type, status);
 		if (size != 0)
 			break;
 		lcremove = TAILQ_PREV(lcremove, layout_cells, entry);
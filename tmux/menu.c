@@ -391,5 +391,7 @@ menu_display(struct menu *menu, int flags, struct cmdq_item *item, u_int px,
 
 	server_client_set_overlay(c, 0, NULL, menu_mode_cb, menu_draw_cb,
 	    menu_key_cb, menu_free_cb, md);
+	server_client_set_overlay_area(c, px, py, menu->width + 4,
+	    menu->count + 2);
 	return (0);
 }
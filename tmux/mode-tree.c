@@ -25,6 +25,13 @@
 
 #include "tmux.h"
 
+/*
+ * Minimum time between drawing previews. Previews can be expensive so if they
+ * are asked for more often (for example when a key is held down), the old
+ * preview is left and the new one drawn from a timer.
+ */
+#define MODE_TREE_PREVIEW_INTERVAL 100
+
 struct mode_tree_item;
 TAILQ_HEAD(mode_tree_list, mode_tree_item);
 
@@ -47,9 +54,12 @@ struct mode_tree_data {
 	mode_tree_menu_cb         menucb;
 	mode_tree_height_cb       heightcb;
 	mode_tree_key_cb	  keycb;
+	mode_tree_text_cb	  textcb;
 
 	struct mode_tree_list	  children;
 	struct mode_tree_list	  saved;
+	struct mode_tree_item	**saved_list;
+	u_int			  saved_size;
 
 	struct mode_tree_line	 *line_list;
 	u_int			  line_size;
@@ -65,9 +75,15 @@ struct mode_tree_data {
 	struct screen		  screen;
 
 	int			  preview;
+	struct event		  preview_timer;
+	uint64_t		  preview_last;
+	u_int			  preview_width;
+	u_int			  preview_height;
+
 	char			 *search;
 	char			 *filter;
 	int			  no_matches;
+	int			  build_all;
 };
 
 struct mode_tree_item {
@@ -82,12 +98,14 @@ struct mode_tree_item {
 	uint64_t			 tag;
 	const char			*name;
 	const char			*text;
+	int				 text_pending;
 
 	int				 expanded;
 	int				 tagged;
 
 	int				 draw_as_parent;
 	int				 no_tag;
+	int				 deferred;
 
 	struct mode_tree_list		 children;
 	TAILQ_ENTRY(mode_tree_item)	 entry;
@@ -108,6 +126,7 @@ struct mode_tree_menu {
 };
 
 static void mode_tree_free_items(struct mode_tree_list *);
+static void mode_tree_preview_callback(int, short, void *);
 
 static const struct menu_item mode_tree_menu_items[] = {
 	{ "Scroll Left", '<', NULL },
@@ -118,19 +137,57 @@ static const struct menu_item mode_tree_menu_items[] = {
 	{ NULL, KEYC_NONE, NULL }
 };
 
-static struct mode_tree_item *
-mode_tree_find_item(struct mode_tree_list *mtl, uint64_t tag)
+static int
+mode_tree_cmp_saved(const void *a0, const void *b0)
+{
+	const struct mode_tree_item *const	*a = a0;
+	const struct mode_tree_item *const	*b = b0;
+
+	if ((*a)->tag < (*b)->tag)
+		return (-1);
+	if ((*a)->tag > (*b)->tag)
+		return (1);
+	return (0);
+}
+
+static void
+mode_tree_add_saved(struct mode_tree_data *mtd, struct mode_tree_list *mtl)
 {
-	struct mode_tree_item	*mti, *child;
+	struct mode_tree_item	*mti;
 
 	TAILQ_FOREACH(mti, mtl, entry) {
-		if (mti->tag == tag)
-			return (mti);
-		child = mode_tree_find_item(&mti->children, tag);
-		if (child != NULL)
-			return (child);
+		mtd->saved_list = xreallocarray(mtd->saved_list,
+		    mtd->saved_size + 1, sizeof *mtd->saved_list);
+		mtd->saved_list[mtd->saved_size++] = mti;
+		mode_tree_add_saved(mtd, &mti->children);
 	}
-	return (NULL);
+}
+
+/*
+ * Sort the saved items by tag so each new item can find its old state without
+ * walking the whole tree.
+ */
+static void
+mode_tree_index_saved(struct mode_tree_data *mtd)
+{
+	mode_tree_add_saved(mtd, &mtd->saved);
+	qsort(mtd->saved_list, mtd->saved_size, sizeof *mtd->saved_list,
+	    mode_tree_cmp_saved);
+}
+
+static struct mode_tree_item *
+mode_tree_find_saved(struct mode_tree_data *mtd, uint64_t tag)
+{
+	struct mode_tree_item	 find, *findp = &find, **found;
+
+	if (mtd->saved_size == 0)
+		return (NULL);
+	find.tag = tag;
+	found = bsearch(&findp, mtd->saved_list, mtd->saved_size,
+	    sizeof *mtd->saved_list, mode_tree_cmp_saved);
+	if (found == NULL)
+		return (NULL);
+	return (*found);
 }
 
 static void
@@ -181,7 +238,6 @@ mode_tree_build_lines(struct mode_tree_data *mtd,
 {
 	struct mode_tree_item	*mti;
 	struct mode_tree_line	*line;
-	u_int			 i;
 	int			 flat = 1;
 
 	mtd->depth = depth;
@@ -195,7 +251,7 @@ mode_tree_build_lines(struct mode_tree_data *mtd,
 		line->last = (mti == TAILQ_LAST(mtl, mode_tree_list));
 
 		mti->line = (mtd->line_size - 1);
-		if (!TAILQ_EMPTY(&mti->children))
+		if (!TAILQ_EMPTY(&mti->children) || mti->deferred)
 			flat = 0;
 		if (mti->expanded)
 			mode_tree_build_lines(mtd, &mti->children, depth + 1);
@@ -220,13 +276,8 @@ mode_tree_build_lines(struct mode_tree_data *mtd,
 			mti->keylen = 0;
 		}
 	}
-	TAILQ_FOREACH(mti, mtl, entry) {
-		for (i = 0; i < mtd->line_size; i++) {
-			line = &mtd->line_list[i];
-			if (line->item == mti)
-				line->flat = flat;
-		}
-	}
+	TAILQ_FOREACH(mti, mtl, entry)
+		mtd->line_list[mti->line].flat = flat;
 }
 
 static void
@@ -389,9 +440,9 @@ struct mode_tree_data *
 mode_tree_start(struct window_pane *wp, struct args *args,
     mode_tree_build_cb buildcb, mode_tree_draw_cb drawcb,
     mode_tree_search_cb searchcb, mode_tree_menu_cb menucb,
-    mode_tree_height_cb heightcb, mode_tree_key_cb keycb, void *modedata,
-    const struct menu_item *menu, const char **sort_list, u_int sort_size,
-    struct screen **s)
+    mode_tree_height_cb heightcb, mode_tree_key_cb keycb,
+    mode_tree_text_cb textcb, void *modedata, const struct menu_item *menu,
+    const char **sort_list, u_int sort_size, struct screen **s)
 {
 	struct mode_tree_data	*mtd;
 	const char		*sort;
@@ -429,8 +480,10 @@ mode_tree_start(struct window_pane *wp, struct args *args,
 	mtd->menucb = menucb;
 	mtd->heightcb = heightcb;
 	mtd->keycb = keycb;
+	mtd->textcb = textcb;
 
 	TAILQ_INIT(&mtd->children);
+	evtimer_set(&mtd->preview_timer, mode_tree_preview_callback, mtd);
 
 	*s = &mtd->screen;
 	screen_init(*s, screen_size_x(&wp->base), screen_size_y(&wp->base), 0);
@@ -486,6 +539,7 @@ mode_tree_build(struct mode_tree_data *mtd)
 
 	TAILQ_CONCAT(&mtd->saved, &mtd->children, entry);
 	TAILQ_INIT(&mtd->children);
+	mode_tree_index_saved(mtd);
 
 	mtd->buildcb(mtd->modedata, &mtd->sort_crit, &tag, mtd->filter);
 	mtd->no_matches = TAILQ_EMPTY(&mtd->children);
@@ -494,6 +548,9 @@ mode_tree_build(struct mode_tree_data *mtd)
 
 	mode_tree_free_items(&mtd->saved);
 	TAILQ_INIT(&mtd->saved);
+	free(mtd->saved_list);
+	mtd->saved_list = NULL;
+	mtd->saved_size = 0;
 
 	mode_tree_clear_lines(mtd);
 	mode_tree_build_lines(mtd, &mtd->children, 0);
@@ -525,6 +582,8 @@ mode_tree_free(struct mode_tree_data *mtd)
 	if (mtd->zoomed == 0)
 		server_unzoom_window(wp->window);
 
+	evtimer_del(&mtd->preview_timer);
+
 	mode_tree_free_items(&mtd->children);
 	mode_tree_clear_lines(mtd);
 	screen_free(&mtd->screen);
@@ -542,6 +601,7 @@ mode_tree_resize(struct mode_tree_data *mtd, u_int sx, u_int sy)
 	struct screen	*s = &mtd->screen;
 
 	screen_resize(s, sx, sy, 0);
+	mtd->preview_width = 0;
 
 	mode_tree_build(mtd);
 	mode_tree_draw(mtd);
@@ -567,8 +627,10 @@ mode_tree_add(struct mode_tree_data *mtd, struct mode_tree_item *parent,
 	mti->name = xstrdup(name);
 	if (text != NULL)
 		mti->text = xstrdup(text);
+	else if (mtd->textcb != NULL)
+		mti->text_pending = 1;
 
-	saved = mode_tree_find_item(&mtd->saved, tag);
+	saved = mode_tree_find_saved(mtd, tag);
 	if (saved != NULL) {
 		if (parent == NULL || parent->expanded)
 			mti->tagged = saved->tagged;
@@ -600,6 +662,22 @@ mode_tree_no_tag(struct mode_tree_item *mti)
 	mti->no_tag = 1;
 }
 
+/*
+ * Check if the children of an item may be left unbuilt because it is
+ * collapsed. The item is still drawn as having children and expanding it
+ * rebuilds the tree. Everything is built when filtering or searching so that
+ * items in collapsed parents can be found.
+ */
+int
+mode_tree_defer_children(struct mode_tree_data *mtd,
+    struct mode_tree_item *mti)
+{
+	if (mti->expanded || mtd->build_all || mtd->filter != NULL)
+		return (0);
+	mti->deferred = 1;
+	return (1);
+}
+
 void
 mode_tree_remove(struct mode_tree_data *mtd, struct mode_tree_item *mti)
 {
@@ -612,6 +690,60 @@ mode_tree_remove(struct mode_tree_data *mtd, struct mode_tree_item *mti)
 	mode_tree_free_item(mti);
 }
 
+/*
+ * Get the text for an item. If the mode has a text callback, this is only
+ * done for items as they are drawn and is kept until the tree is next built.
+ */
+static const char *
+mode_tree_get_text(struct mode_tree_data *mtd, struct mode_tree_item *mti)
+{
+	if (mti->text_pending) {
+		mti->text = mtd->textcb(mtd->modedata, mti->itemdata);
+		mti->text_pending = 0;
+	}
+	return (mti->text);
+}
+
+static void
+mode_tree_preview_callback(__unused int fd, __unused short events, void *arg)
+{
+	struct mode_tree_data	*mtd = arg;
+
+	mode_tree_draw(mtd);
+	mtd->wp->flags |= PANE_REDRAW;
+}
+
+/*
+ * Work out if the preview can be drawn now. If not, the last preview is left
+ * in place and the timer started to draw it later.
+ */
+static int
+mode_tree_draw_preview(struct mode_tree_data *mtd, u_int w, u_int h)
+{
+	struct timeval	tv;
+	uint64_t	now, wait;
+
+	now = get_timer();
+	if (w == mtd->preview_width &&
+	    h == mtd->preview_height &&
+	    now < mtd->preview_last + MODE_TREE_PREVIEW_INTERVAL) {
+		if (!evtimer_pending(&mtd->preview_timer, NULL)) {
+			wait = mtd->preview_last + MODE_TREE_PREVIEW_INTERVAL -
+			    now;
+			tv.tv_sec = wait / 1000;
+			tv.tv_usec = (wait % 1000) * 1000L;
+			evtimer_add(&mtd->preview_timer, &tv);
+		}
+		return (0);
+	}
+	evtimer_del(&mtd->preview_timer);
+
+	mtd->preview_last = now;
+	mtd->preview_width = w;
+	mtd->preview_height = h;
+	return (1);
+}
+
 void
 mode_tree_draw(struct mode_tree_data *mtd)
 {
@@ -624,9 +756,9 @@ mode_tree_draw(struct mode_tree_data *mtd)
 	struct grid_cell	 gc0, gc;
 	u_int			 w, h, i, j, sy, box_x, box_y, width;
 	char			*text, *start, *key;
-	const char		*tag, *symbol;
+	const char		*tag, *symbol, *itemtext;
 	size_t			 size, n;
-	int			 keylen, pad;
+	int			 keylen, pad, preview;
 
 	if (mtd->line_size == 0)
 		return;
@@ -637,9 +769,23 @@ mode_tree_draw(struct mode_tree_data *mtd)
 
 	w = mtd->width;
 	h = mtd->height;
+	sy = screen_size_y(s);
+
+	if (!mtd->preview || sy <= 4 || h <= 4 || sy - h <= 4 || w <= 4) {
+		mtd->preview_width = 0;
+		preview = -1;
+	} else
+		preview = mode_tree_draw_preview(mtd, w, h);
 
 	screen_write_start(&ctx, s);
-	screen_write_clearscreen(&ctx, 8);
+	if (preview != 0)
+		screen_write_clearscreen(&ctx, 8);
+	else {
+		for (i = 0; i < h; i++) {
+			screen_write_cursormove(&ctx, 0, i, 0);
+			screen_write_clearline(&ctx, 8);
+		}
+	}
 
 	keylen = 0;
 	for (i = 0; i < mtd->line_size; i++) {
@@ -657,6 +803,7 @@ mode_tree_draw(struct mode_tree_data *mtd)
 			break;
 		line = &mtd->line_list[i];
 		mti = line->item;
+		itemtext = mode_tree_get_text(mtd, mti);
 
 		screen_write_cursormove(&ctx, 0, i - mtd->offset, 0);
 
@@ -668,7 +815,7 @@ mode_tree_draw(struct mode_tree_data *mtd)
 
 		if (line->flat)
 			symbol = "";
-		else if (TAILQ_EMPTY(&mti->children))
+		else if (TAILQ_EMPTY(&mti->children) && !mti->deferred)
 			symbol = "  ";
 		else if (mti->expanded)
 			symbol = "- ";
@@ -700,7 +847,7 @@ mode_tree_draw(struct mode_tree_data *mtd)
 		else
 			tag = "";
 		xasprintf(&text, "%-*s%s%s%s%s", keylen, key, start, mti->name,
-		    tag, (mti->text != NULL) ? ": " : "" );
+		    tag, (itemtext != NULL) ? ": " : "" );
 		width = utf8_cstrwidth(text);
 		if (width > w)
 			width = w;
@@ -714,15 +861,15 @@ mode_tree_draw(struct mode_tree_data *mtd)
 		if (i != mtd->current) {
 			screen_write_clearendofline(&ctx, 8);
 			screen_write_nputs(&ctx, w, &gc0, "%s", text);
-			if (mti->text != NULL) {
-				format_draw(&ctx, &gc0, w - width, mti->text,
+			if (itemtext != NULL) {
+				format_draw(&ctx, &gc0, w - width, itemtext,
 				    NULL);
 			}
 		} else {
 			screen_write_clearendofline(&ctx, gc.bg);
 			screen_write_nputs(&ctx, w, &gc, "%s", text);
-			if (mti->text != NULL) {
-				format_draw(&ctx, &gc, w - width, mti->text,
+			if (itemtext != NULL) {
+				format_draw(&ctx, &gc, w - width, itemtext,
 				    NULL);
 			}
 		}
@@ -735,8 +882,7 @@ mode_tree_draw(struct mode_tree_data *mtd)
 		}
 	}
 
-	sy = screen_size_y(s);
-	if (!mtd->preview || sy <= 4 || h <= 4 || sy - h <= 4 || w <= 4) {
+	if (preview == -1) {
 		screen_write_stop(&ctx);
 		return;
 	}
@@ -778,7 +924,7 @@ mode_tree_draw(struct mode_tree_data *mtd)
 	box_x = w - 4;
 	box_y = sy - h - 2;
 
-	if (box_x != 0 && box_y != 0) {
+	if (preview && box_x != 0 && box_y != 0) {
 		screen_write_cursormove(&ctx, 2, h + 1, 0);
 		mtd->drawcb(mtd->modedata, mti->itemdata, &ctx, box_x, box_y);
 	}
@@ -833,9 +979,15 @@ mode_tree_search_set(struct mode_tree_data *mtd)
 	struct mode_tree_item	*mti, *loop;
 	uint64_t		 tag;
 
+	mtd->build_all = 1;
+	mode_tree_build(mtd);
+	mtd->build_all = 0;
+
 	mti = mode_tree_search_for(mtd);
-	if (mti == NULL)
+	if (mti == NULL) {
+		mode_tree_build(mtd);
 		return;
+	}
 	tag = mti->tag;
 
 	loop = mti->parent;
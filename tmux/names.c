@@ -30,13 +30,163 @@ static int	 name_time_expired(struct window *, struct timeval *);
 
 static char	*format_window_name(struct window *);
 
+/*
+ * Windows waiting until they may be renamed again, in the order they are due.
+ * A single timer is used for all of them.
+ */
+static TAILQ_HEAD(name_windows, window) name_queue =
+    TAILQ_HEAD_INITIALIZER(name_queue);
+static struct event name_timer;
+
+/* Variables an automatic-rename-format may use to be checked by key. */
+static const char *name_key_variables[] = {
+	"pane_current_command",
+	"pane_dead",
+	"pane_in_mode"
+};
+
+static void
+name_time_due(struct window *w, struct timeval *tv)
+{
+	struct timeval	interval = { .tv_usec = NAME_INTERVAL };
+
+	timeradd(&w->name_time, &interval, tv);
+}
+
+static void
+name_time_schedule(void)
+{
+	struct window	*w;
+	struct timeval	 tv, now;
+
+	if (event_initialized(&name_timer))
+		evtimer_del(&name_timer);
+	else
+		evtimer_set(&name_timer, name_time_callback, NULL);
+	if ((w = TAILQ_FIRST(&name_queue)) == NULL)
+		return;
+
+	gettimeofday(&now, NULL);
+	name_time_due(w, &tv);
+	if (timercmp(&tv, &now, <))
+		timerclear(&tv);
+	else
+		timersub(&tv, &now, &tv);
+	evtimer_add(&name_timer, &tv);
+}
+
+static void
+name_time_queue(struct window *w)
+{
+	struct window	*loop;
+	struct timeval	 tv, due;
+
+	if (w->name_queued)
+		return;
+	w->name_queued = 1;
+
+	/* Most windows are due after those already waiting. */
+	name_time_due(w, &due);
+	TAILQ_FOREACH_REVERSE(loop, &name_queue, name_windows, name_entry) {
+		name_time_due(loop, &tv);
+		if (!timercmp(&tv, &due, >))
+			break;
+	}
+	if (loop == NULL) {
+		TAILQ_INSERT_HEAD(&name_queue, w, name_entry);
+		name_time_schedule();
+	} else
+		TAILQ_INSERT_AFTER(&name_queue, loop, w, name_entry);
+}
+
+void
+cancel_window_name(struct window *w)
+{
+	int	first;
+
+	if (!w->name_queued)
+		return;
+	first = (w == TAILQ_FIRST(&name_queue));
+	TAILQ_REMOVE(&name_queue, w, name_entry);
+	w->name_queued = 0;
+	if (first)
+		name_time_schedule();
+}
+
 static void
-name_time_callback(__unused int fd, __unused short events, void *arg)
+name_time_callback(__unused int fd, __unused short events,
+    __unused void *arg)
 {
-	struct window	*w = arg;
+	struct window	*w, *w1;
+	struct timeval	 tv, now;
 
 	/* The event loop will call check_window_name for us on the way out. */
-	log_debug("@%u name timer expired", w->id);
+	gettimeofday(&now, NULL);
+	TAILQ_FOREACH_SAFE(w, &name_queue, name_entry, w1) {
+		name_time_due(w, &tv);
+		if (timercmp(&tv, &now, >))
+			break;
+		log_debug("@%u name timer expired", w->id);
+		TAILQ_REMOVE(&name_queue, w, name_entry);
+		w->name_queued = 0;
+		window_queue_check(w);
+	}
+	name_time_schedule();
+}
+
+/*
+ * Check if a format only uses variables which are part of the key, so the
+ * name cannot change unless the key does.
+ */
+static int
+name_format_keyed(const char *fmt)
+{
+	const char	*cp = fmt;
+	size_t		 n;
+	u_int		 i;
+
+	while ((cp = strchr(cp, '#')) != NULL) {
+		cp++;
+		if (*cp == '#' || *cp == ',' || *cp == '}') {
+			cp++;
+			continue;
+		}
+		if (*cp != '{')
+			return (0);
+		cp++;
+		if (*cp == '?')
+			cp++;
+		n = strspn(cp, "abcdefghijklmnopqrstuvwxyz_");
+		if (cp[n] != ',' && cp[n] != '}')
+			return (0);
+		for (i = 0; i < nitems(name_key_variables); i++) {
+			if (strlen(name_key_variables[i]) == n &&
+			    strncmp(cp, name_key_variables[i], n) == 0)
+				break;
+		}
+		if (i == nitems(name_key_variables))
+			return (0);
+		cp += n;
+	}
+	return (1);
+}
+
+/* Build the key for a window name: the active pane and what it is running. */
+static char *
+name_make_key(struct window *w, const char *fmt)
+{
+	struct window_pane		*wp = w->active;
+	struct window_mode_entry	*wme;
+	const char			*proc;
+	u_int				 modes = 0;
+	char				*key;
+
+	TAILQ_FOREACH(wme, &wp->modes, entry)
+		modes++;
+	proc = window_pane_get_proc_name(wp);
+	xasprintf(&key, "%%%u %u %d\n%s\n%s\n%s", wp->id, modes, wp->fd == -1,
+	    proc == NULL ? "" : proc, fmt, w->name);
+	return (key);
 }
 
 static int
@@ -53,8 +203,9 @@ name_time_expired(struct window *w, struct timeval *tv)
 void
 check_window_name(struct window *w)
 {
-	struct timeval	 tv, next;
-	char		*name;
+	struct timeval	 tv;
+	const char	*fmt;
+	char		*name, *key = NULL;
 	int		 left;
 
 	if (w->active == NULL)
@@ -72,26 +223,37 @@ check_window_name(struct window *w)
 	gettimeofday(&tv, NULL);
 	left = name_time_expired(w, &tv);
 	if (left != 0) {
-		if (!event_initialized(&w->name_event))
-			evtimer_set(&w->name_event, name_time_callback, w);
-		if (!evtimer_pending(&w->name_event, NULL)) {
+		if (!w->name_queued) {
 			log_debug("@%u name timer queued (%d left)", w->id,
 			    left);
-			timerclear(&next);
-			next.tv_usec = left;
-			event_add(&w->name_event, &next);
+			name_time_queue(w);
 		} else {
 			log_debug("@%u name timer already queued (%d left)",
 			    w->id, left);
 		}
 		return;
 	}
+	cancel_window_name(w);
 	memcpy(&w->name_time, &tv, sizeof w->name_time);
-	if (event_initialized(&w->name_event))
-		evtimer_del(&w->name_event);
 
 	w->active->flags &= ~PANE_CHANGED;
 
+	/*
+	 * If the format only depends on what the active pane is running, and
+	 * that has not changed, there is no need to expand it again.
+	 */
+	fmt = options_get_string(w->options, "automatic-rename-format");
+	if (name_format_keyed(fmt)) {
+		key = name_make_key(w, fmt);
+		if (w->name_key != NULL && strcmp(key, w->name_key) == 0) {
+			log_debug("@%u name not changed (key)", w->id);
+			free(key);
+			goto out;
+		}
+	}
+	free(w->name_key);
+	w->name_key = key;
+
 	name = format_window_name(w);
 	if (strcmp(name, w->name) != 0) {
 		log_debug("@%u new name %s (was %s)", w->id, name, w->name);
@@ -100,8 +262,17 @@ check_window_name(struct window *w)
 		server_status_window(w);
 	} else
 		log_debug("@%u name not changed (still %s)", w->id, w->name);
-
 	free(name);
+
+out:
+	/*
+	 * A new foreground process may not have called exec yet, so look again
+	 * once it has been there for a while.
+	 */
+	if (!window_pane_proc_settled(w->active)) {
+		w->active->flags |= PANE_CHANGED;
+		name_time_queue(w);
+	}
 }
 
 char *
@@ -65,6 +65,9 @@ notify_insert_hook(struct cmdq_item *item, struct notify_entry *ne)
 
 	log_debug("%s: %s", __func__, ne->name);
 
+	if (!options_hook_may_be_set(ne->name))
+		return;
+
 	cmd_find_clear_state(&fs, 0);
 	if (cmd_find_empty_state(&ne->fs) || !cmd_find_valid_state(&ne->fs))
 		cmd_find_from_nothing(&fs, 0);
@@ -161,6 +164,9 @@ notify_add(const char *name, struct cmd_find_state *fs, struct client *c,
 	struct notify_entry	*ne;
 	struct cmdq_item	*item;
 
+	/* Anything notified may change the lists kept for formats. */
+	format_lists_changed();
+
 	item = cmdq_running(NULL);
 	if (item != NULL && (cmdq_get_flags(item) & CMDQ_STATE_NOHOOKS))
 		return;
@@ -56,6 +56,7 @@ struct options_entry {
 
 	int					 cached;
 	struct style				 style;
+	char					*expanded;
 
 	RB_ENTRY(options_entry)			 entry;
 };
@@ -63,7 +64,38 @@ struct options_entry {
 struct options {
 	RB_HEAD(options_tree, options_entry)	 tree;
 	struct options				*parent;
+
+	struct options_entry			**cache;
+	u_int					 cache_generation;
+};
+
+/*
+ * Options from the table are found by their index in the table through a hash
+ * of their names (and the other names that map to them). The indexes are also
+ * kept sorted by name so an abbreviation can be matched with a binary search.
+ * Each options keeps an array by index of the entry each option resolved to,
+ * including from its parents. Because values are changed in place, the cached
+ * entries only become stale when an entry is added or removed or a parent
+ * changes. Any of these increments the generation, which empties every cache
+ * the next time it is used.
+ */
+#define OPTIONS_INDEX_SIZE 1024
+struct options_index_entry {
+	const char	*name;
+	u_int		 index;
 };
+static struct options_index_entry	 options_index[OPTIONS_INDEX_SIZE];
+static u_int				 options_index_count;
+static u_int				*options_sorted;
+static u_int				 options_generation = 1;
+
+/*
+ * Number of hook commands set in any options for each bucket of hook names.
+ * Hooks are looked up for every command and notification, so this lets those
+ * which are not set anywhere be skipped without building their state.
+ */
+#define OPTIONS_HOOK_BUCKETS 128
+static u_int	options_hooks[OPTIONS_HOOK_BUCKETS];
 
 static struct options_entry	*options_add(struct options *, const char *);
 static void			 options_remove(struct options_entry *);
@@ -185,6 +217,7 @@ options_free(struct options *oo)
 
 	RB_FOREACH_SAFE(o, options_tree, &oo->tree, tmp)
 		options_remove(o);
+	free(oo->cache);
 	free(oo);
 }
 
@@ -198,6 +231,7 @@ void
 options_set_parent(struct options *oo, struct options *parent)
 {
 	oo->parent = parent;
+	options_generation++;
 }
 
 struct options_entry *
@@ -225,10 +259,101 @@ options_get_only(struct options *oo, const char *name)
 	return (found);
 }
 
+static u_int
+options_hash(const char *name)
+{
+	u_int	hash = 5381;
+
+	for (; *name != '\0'; name++)
+		hash = hash * 33 + (u_char)*name;
+	return (hash);
+}
+
+static void
+options_index_add(const char *name, u_int idx)
+{
+	u_int	slot = options_hash(name) % OPTIONS_INDEX_SIZE;
+
+	while (options_index[slot].name != NULL)
+		slot = (slot + 1) % OPTIONS_INDEX_SIZE;
+	options_index[slot].name = name;
+	options_index[slot].index = idx;
+}
+
+static int
+options_sorted_cmp(const void *a, const void *b)
+{
+	const u_int	*ia = a, *ib = b;
+
+	return (strcmp(options_table[*ia].name, options_table[*ib].name));
+}
+
+/* Build the hash and sorted indexes of the table. */
+static void
+options_build_index(void)
+{
+	const struct options_table_entry	*oe;
+	const struct options_name_map		*map;
+	u_int					 i;
+
+	for (oe = options_table; oe->name != NULL; oe++)
+		options_index_add(oe->name, options_index_count++);
+	for (map = options_other_names; map->from != NULL; map++) {
+		for (oe = options_table; oe->name != NULL; oe++) {
+			if (strcmp(oe->name, map->to) == 0)
+				break;
+		}
+		if (oe->name != NULL)
+			options_index_add(map->from, oe - options_table);
+	}
+
+	options_sorted = xreallocarray(NULL, options_index_count,
+	    sizeof *options_sorted);
+	for (i = 0; i < options_index_count; i++)
+		options_sorted[i] = i;
+	qsort(options_sorted, options_index_count, sizeof *options_sorted,
+	    options_sorted_cmp);
+}
+
+/* Find the index of a table option, or return -1. */
+static int
+options_find_index(const char *name)
+{
+	u_int	slot;
+
+	if (options_index_count == 0)
+		options_build_index();
+
+	slot = options_hash(name) % OPTIONS_INDEX_SIZE;
+	while (options_index[slot].name != NULL) {
+		if (strcmp(options_index[slot].name, name) == 0)
+			return (options_index[slot].index);
+		slot = (slot + 1) % OPTIONS_INDEX_SIZE;
+	}
+	return (-1);
+}
+
 struct options_entry *
 options_get(struct options *oo, const char *name)
 {
 	struct options_entry	*o;
+	struct options		*start = oo;
+	int			 idx;
+
+	idx = options_find_index(name);
+	if (idx != -1) {
+		if (oo->cache == NULL) {
+			oo->cache = xcalloc(options_index_count,
+			    sizeof *oo->cache);
+			oo->cache_generation = options_generation;
+		} else if (oo->cache_generation != options_generation) {
+			memset(oo->cache, 0,
+			    options_index_count * sizeof *oo->cache);
+			oo->cache_generation = options_generation;
+		}
+		if (oo->cache[idx] != NULL)
+			return (oo->cache[idx]);
+	}
 
 	o = options_get_only(oo, name);
 	while (o == NULL) {
@@ -237,6 +362,8 @@ options_get(struct options *oo, const char *name)
 			break;
 		o = options_get_only(oo, name);
 	}
+	if (o != NULL && idx != -1)
+		start->cache[idx] = o;
 	return (o);
 }
 
@@ -330,6 +457,7 @@ options_add(struct options *oo, const char *name)
 	o->name = xstrdup(name);
 
 	RB_INSERT(options_tree, &oo->tree, o);
+	options_generation++;
 	return (o);
 }
 
@@ -343,6 +471,8 @@ options_remove(struct options_entry *o)
 	else
 		options_value_free(o, &o->value);
 	RB_REMOVE(options_tree, &oo->tree, o);
+	options_generation++;
+	free(o->expanded);
 	free((void *)o->name);
 	free(o);
 }
@@ -382,12 +512,18 @@ options_array_new(struct options_entry *o, u_int idx)
 	a = xcalloc(1, sizeof *a);
 	a->index = idx;
 	RB_INSERT(options_array, &o->value.array, a);
+
+	if (o->tableentry->flags & OPTIONS_TABLE_IS_HOOK)
+		options_hooks[options_hash(o->name) % OPTIONS_HOOK_BUCKETS]++;
 	return (a);
 }
 
 static void
 options_array_free(struct options_entry *o, struct options_array_item *a)
 {
+	if (o->tableentry->flags & OPTIONS_TABLE_IS_HOOK)
+		options_hooks[options_hash(o->name) % OPTIONS_HOOK_BUCKETS]--;
+
 	options_value_free(o, &a->value);
 	RB_REMOVE(options_array, &o->value.array, a);
 	free(a);
@@ -405,6 +541,16 @@ options_array_clear(struct options_entry *o)
 	    options_array_free(o, a);
 }
 
+/*
+ * Could a hook be set in any options? If not it does not need to be looked up;
+ * if so it may still be empty where it is used.
+ */
+int
+options_hook_may_be_set(const char *name)
+{
+	return (options_hooks[options_hash(name) % OPTIONS_HOOK_BUCKETS] != 0);
+}
+
 union options_value *
 options_array_get(struct options_entry *o, u_int idx)
 {
@@ -628,6 +774,8 @@ options_match(const char *s, int *idx, int *ambiguous)
 	char					*parsed;
 	const char				*name;
 	size_t					 namelen;
+	u_int					 lo, hi, mid;
+	int					 i;
 
 	parsed = options_parse(s, idx);
 	if (parsed == NULL)
@@ -640,19 +788,38 @@ options_match(const char *s, int *idx, int *ambiguous)
 	name = options_map_name(parsed);
 	namelen = strlen(name);
 
+	/* An exact name always matches. */
+	if ((i = options_find_index(name)) != -1) {
+		free(parsed);
+		return (xstrdup(options_table[i].name));
+	}
+
+	/*
+	 * Otherwise find the first name after it in order. It is an
+	 * abbreviation if that name starts with it and the next does not.
+	 */
+	lo = 0;
+	hi = options_index_count;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (strcmp(options_table[options_sorted[mid]].name, name) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
 	found = NULL;
-	for (oe = options_table; oe->name != NULL; oe++) {
-		if (strcmp(oe->name, name) == 0) {
+	if (lo < options_index_count) {
+		oe = &options_table[options_sorted[lo]];
+		if (strncmp(oe->name, name, namelen) == 0)
 			found = oe;
-			break;
-		}
+	}
+	if (found != NULL && lo + 1 < options_index_count) {
+		oe = &options_table[options_sorted[lo + 1]];
 		if (strncmp(oe->name, name, namelen) == 0) {
-			if (found != NULL) {
-				*ambiguous = 1;
-				free(parsed);
-				return (NULL);
-			}
-			found = oe;
+			*ambiguous = 1;
+			free(parsed);
+			return (NULL);
 		}
 	}
 	free(parsed);
@@ -745,6 +912,8 @@ options_set_string(struct options *oo, const char *name, int append,
 	free(o->value.string);
 	o->value.string = value;
 	o->cached = 0;
+	free(o->expanded);
+	o->expanded = NULL;
 	return (o);
 }
 
@@ -779,19 +948,17 @@ options_scope_from_name(struct args *args, int window,
 	struct window_pane			*wp = fs->wp;
 	const char				*target = args_get(args, 't');
 	const struct options_table_entry	*oe;
-	int					 scope = OPTIONS_TABLE_NONE;
+	int					 scope = OPTIONS_TABLE_NONE, idx;
 
 	if (*name == '@')
 		return (options_scope_from_flags(args, window, fs, oo, cause));
 
-	for (oe = options_table; oe->name != NULL; oe++) {
-		if (strcmp(oe->name, name) == 0)
-			break;
-	}
-	if (oe->name == NULL) {
+	idx = options_find_index(name);
+	if (idx == -1 || strcmp(options_table[idx].name, name) != 0) {
 		xasprintf(cause, "unknown option: %s", name);
 		return (OPTIONS_TABLE_NONE);
 	}
+	oe = &options_table[idx];
 	switch (oe->scope) {
 	case OPTIONS_TABLE_SERVER:
 		*oo = global_options;
@@ -910,19 +1077,33 @@ options_string_to_style(struct options *oo, const char *name,
 	if (o->cached)
 		return (&o->style);
 	s = o->value.string;
-	log_debug("%s: %s is '%s'", __func__, name, s);
-
-	style_set(&o->style, &grid_default_cell);
 	o->cached = (strstr(s, "#{") == NULL);
 
+	/*
+	 * A style with formats must be expanded each time, but it only needs
+	 * to be parsed again if the expanded string has changed.
+	 */
 	if (ft != NULL && !o->cached) {
 		expanded = format_expand(ft, s);
+		if (o->expanded != NULL && strcmp(expanded, o->expanded) == 0) {
+			free(expanded);
+			return (&o->style);
+		}
+		log_debug("%s: %s is '%s'", __func__, name, expanded);
+
+		free(o->expanded);
+		o->expanded = NULL;
+		style_set(&o->style, &grid_default_cell);
 		if (style_parse(&o->style, &grid_default_cell, expanded) != 0) {
 			free(expanded);
 			return (NULL);
 		}
-		free(expanded);
+		o->expanded = expanded;
 	} else {
+		log_debug("%s: %s is '%s'", __func__, name, s);
+		free(o->expanded);
+		o->expanded = NULL;
+		style_set(&o->style, &grid_default_cell);
 		if (style_parse(&o->style, &grid_default_cell, s) != 0)
 			return (NULL);
 	}
@@ -1089,10 +1270,21 @@ options_push_changes(const char *name)
 		RB_FOREACH(w, windows, &windows) {
 			if (w->active == NULL)
 				continue;
-			if (options_get_number(w->options, "automatic-rename"))
+			if (options_get_number(w->options, "automatic-rename")) {
 				w->active->flags |= PANE_CHANGED;
+				window_queue_check(w);
+			}
 		}
 	}
+	if (strcmp(name, "backspace") == 0)
+		input_key_clear_cache();
+	if (strcmp(name, "command-alias") == 0)
+		cmd_parse_clear_cache();
+	if (strcmp(name, "format-profile") == 0)
+		format_set_profile(options_get_number(global_options, name));
+	if (strcmp(name, "terminal-features") == 0 ||
+	    strcmp(name, "terminal-overrides") == 0)
+		tty_term_options_changed();
 	if (strcmp(name, "key-table") == 0) {
 		TAILQ_FOREACH(loop, &clients, entry)
 			server_client_set_key_table(loop, NULL);
@@ -21,20 +21,76 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "tmux.h"
 
 /*
  * Set of paste buffers. Note that paste buffer data is not necessarily a C
  * string!
+ *
+ * The data is never changed once set and is reference counted, so large
+ * buffers may be added to a pane or file output buffer without copying and
+ * the buffer freed or replaced before they are written. If zlib is available,
+ * large buffers which have not been used for a while are compressed and
+ * uncompressed again when they are next needed.
  */
 
-struct paste_buffer {
-	char		*data;
+/* Smallest piece of a buffer worth adding to an evbuffer by reference. */
+#define PASTE_REFERENCE_MIN 4096
+
+/* Largest piece of a paste written into a pane each time its output drains. */
+#define PASTE_PANE_CHUNK (64 * 1024)
+
+/* Smallest buffer worth compressing and how long it must be unused. */
+#define PASTE_COMPRESS_MIN (64 * 1024)
+#define PASTE_COMPRESS_IDLE 60
+
+/* Width of the sample and most lines and bytes per line in the preview. */
+#define PASTE_SAMPLE_WIDTH 200
+#define PASTE_PREVIEW_LINES 200
+#define PASTE_PREVIEW_WIDTH 1024
+
+/*
+ * Data for a paste buffer. The sample is made when the data is set and the
+ * preview the first time it is needed; neither changes after that.
+ */
+struct paste_data {
+	char		*data;	/* NULL if compressed */
 	size_t		 size;
+	u_int		 references;
+
+	char		*sample;
+	char		**preview;
+	u_int		 npreview;
+
+	time_t		 used;
+#ifdef HAVE_ZLIB
+	u_char		*zdata;
+	size_t		 zsize;
+#endif
+};
+
+/* Paste being written into a pane. */
+struct window_pane_paste {
+	struct paste_data		*pd;
+	size_t				 offset;
+
+	char				*sep;
+	size_t				 seplen;
+	int				 bracket;
+	int				 started;
+
+	TAILQ_ENTRY(window_pane_paste)	 entry;
+};
+
+struct paste_buffer {
+	struct paste_data *pd;
 
 	char		*name;
-	time_t		 created;
+	struct timeval	 created;
 	int		 automatic;
 	u_int		 order;
 
@@ -47,6 +103,12 @@ static u_int	paste_next_order;
 static u_int	paste_num_automatic;
 static RB_HEAD(paste_name_tree, paste_buffer) paste_by_name;
 static RB_HEAD(paste_time_tree, paste_buffer) paste_by_time;
+#ifdef HAVE_ZLIB
+static struct event	paste_compress_timer;
+#endif
+
+static void	paste_compress_start(void);
+static char	*paste_make_sample(const char *, size_t);
 
 static int	paste_cmp_names(const struct paste_buffer *,
 		    const struct paste_buffer *);
@@ -86,11 +148,138 @@ paste_buffer_order(struct paste_buffer *pb)
 	return (pb->order);
 }
 
+/* Get if paste buffer is automatic. */
+int
+paste_buffer_automatic(struct paste_buffer *pb)
+{
+	return (pb->automatic);
+}
+
 /* Get paste buffer created. */
-time_t
+struct timeval *
 paste_buffer_created(struct paste_buffer *pb)
 {
-	return (pb->created);
+	return (&pb->created);
+}
+
+#ifdef HAVE_ZLIB
+/*
+ * Uncompress the start of compressed paste data into a buffer. Returns the
+ * number of bytes written.
+ */
+static size_t
+paste_data_inflate(struct paste_data *pd, char *buf, size_t size)
+{
+	z_stream	zs;
+	int		status;
+
+	memset(&zs, 0, sizeof zs);
+	if (inflateInit(&zs) != Z_OK)
+		fatalx("inflateInit failed");
+	zs.next_in = pd->zdata;
+	zs.avail_in = pd->zsize;
+	zs.next_out = (Bytef *)buf;
+	zs.avail_out = size;
+	status = inflate(&zs, Z_FINISH);
+	if (status == Z_BUF_ERROR && zs.avail_out == 0)
+		status = Z_STREAM_END; /* only wanted the start */
+	if (status != Z_STREAM_END)
+		fatalx("inflate failed");
+	inflateEnd(&zs);
+	return (size - zs.avail_out);
+}
+
+/* Compress paste data if it is large and unused and has no other users. */
+static int
+paste_data_compress(struct paste_data *pd, time_t now)
+{
+	z_stream	 zs;
+	u_char		*zdata;
+	size_t		 zsize;
+
+	if (pd->data == NULL || pd->size < PASTE_COMPRESS_MIN)
+		return (0);
+	if (pd->references != 1 || now - pd->used < PASTE_COMPRESS_IDLE)
+		return (1);
+
+	memset(&zs, 0, sizeof zs);
+	if (deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK)
+		fatalx("deflateInit failed");
+	zsize = deflateBound(&zs, pd->size);
+	zdata = xmalloc(zsize);
+	zs.next_in = (Bytef *)pd->data;
+	zs.avail_in = pd->size;
+	zs.next_out = zdata;
+	zs.avail_out = zsize;
+	if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+		fatalx("deflate failed");
+	zsize -= zs.avail_out;
+	deflateEnd(&zs);
+
+	if (zsize >= pd->size / 2) {
+		/* Not worth it, leave it uncompressed. */
+		free(zdata);
+		return (0);
+	}
+	log_debug("%s: %zu bytes to %zu", __func__, pd->size, zsize);
+
+	pd->zdata = xrealloc(zdata, zsize);
+	pd->zsize = zsize;
+	free(pd->data);
+	pd->data = NULL;
+	return (0);
+}
+
+/* Timer to compress paste buffers which have been unused for a while. */
+static void
+paste_compress_callback(__unused int fd, __unused short events,
+    __unused void *arg)
+{
+	struct paste_buffer	*pb;
+	time_t			 now = time(NULL);
+	int			 waiting = 0;
+
+	RB_FOREACH(pb, paste_time_tree, &paste_by_time) {
+		if (paste_data_compress(pb->pd, now))
+			waiting = 1;
+	}
+	if (waiting)
+		paste_compress_start();
+}
+#endif
+
+/* Start the timer to compress unused paste buffers. */
+static void
+paste_compress_start(void)
+{
+#ifdef HAVE_ZLIB
+	struct timeval	tv = { .tv_sec = PASTE_COMPRESS_IDLE };
+
+	if (!event_initialized(&paste_compress_timer)) {
+		evtimer_set(&paste_compress_timer, paste_compress_callback,
+		    NULL);
+	}
+	if (!evtimer_pending(&paste_compress_timer, NULL))
+		evtimer_add(&paste_compress_timer, &tv);
+#endif
+}
+
+/* Get paste data, uncompressing it if needed. */
+static const char *
+paste_data_get(struct paste_data *pd)
+{
+	pd->used = time(NULL);
+	if (pd->data != NULL)
+		return (pd->data);
+#ifdef HAVE_ZLIB
+	pd->data = xmalloc(pd->size);
+	if (paste_data_inflate(pd, pd->data, pd->size) != pd->size)
+		fatalx("bad compressed paste buffer");
+	free(pd->zdata);
+	pd->zdata = NULL;
+	paste_compress_start();
+#endif
+	return (pd->data);
 }
 
 /* Get paste buffer data. */
@@ -98,8 +287,86 @@ const char *
 paste_buffer_data(struct paste_buffer *pb, size_t *size)
 {
 	if (size != NULL)
-		*size = pb->size;
-	return (pb->data);
+		*size = pb->pd->size;
+	return (paste_data_get(pb->pd));
+}
+
+/* Get paste buffer size. */
+size_t
+paste_buffer_size(struct paste_buffer *pb)
+{
+	return (pb->pd->size);
+}
+
+/* Drop a reference to paste data. */
+static void
+paste_data_free(struct paste_data *pd)
+{
+	u_int	i;
+
+	if (--pd->references != 0)
+		return;
+	free(pd->data);
+	free(pd->sample);
+	for (i = 0; i < pd->npreview; i++)
+		free(pd->preview[i]);
+	free(pd->preview);
+#ifdef HAVE_ZLIB
+	free(pd->zdata);
+#endif
+	free(pd);
+}
+
+/* Evbuffer cleanup callback for data added by reference. */
+static void
+paste_data_cleanup(__unused const void *data, __unused size_t datalen,
+    void *arg)
+{
+	paste_data_free(arg);
+}
+
+/* Set paste buffer data, the buffer takes ownership. */
+static void
+paste_set_data(struct paste_buffer *pb, char *data, size_t size)
+{
+	pb->pd = xcalloc(1, sizeof *pb->pd);
+	pb->pd->data = data;
+	pb->pd->size = size;
+	pb->pd->references = 1;
+	pb->pd->used = time(NULL);
+	pb->pd->sample = paste_make_sample(data, size);
+
+	if (size >= PASTE_COMPRESS_MIN)
+		paste_compress_start();
+}
+
+/*
+ * Add part of paste data to an evbuffer. Large pieces are added by reference
+ * so the data is only copied when it is written.
+ */
+static void
+paste_data_add(struct paste_data *pd, struct evbuffer *evb, size_t offset,
+    size_t size)
+{
+	if (offset > pd->size || size > pd->size - offset)
+		fatalx("bad paste buffer reference");
+	paste_data_get(pd);
+	if (size < PASTE_REFERENCE_MIN) {
+		evbuffer_add(evb, pd->data + offset, size);
+		return;
+	}
+	pd->references++;
+	if (evbuffer_add_reference(evb, pd->data + offset, size,
+	    paste_data_cleanup, pd) != 0)
+		fatalx("out of memory");
+}
+
+/* Add part of a paste buffer to an evbuffer. */
+void
+paste_buffer_reference(struct paste_buffer *pb, struct evbuffer *evb,
+    size_t offset, size_t size)
+{
+	paste_data_add(pb->pd, evb, offset, size);
 }
 
 /* Walk paste buffers by time. */
@@ -147,11 +414,41 @@ paste_free(struct paste_buffer *pb)
 	if (pb->automatic)
 		paste_num_automatic--;
 
-	free(pb->data);
+	paste_data_free(pb->pd);
 	free(pb->name);
 	free(pb);
 }
 
+/*
+ * Free the oldest automatic buffers until they fit in the memory limit,
+ * keeping the given buffer.
+ */
+static void
+paste_trim(struct paste_buffer *keep)
+{
+	struct paste_buffer	*pb, *pb1;
+	size_t			 limit, total = 0;
+
+	limit = options_get_number(global_options, "buffer-memory-limit");
+	if (limit == 0)
+		return;
+
+	RB_FOREACH(pb, paste_time_tree, &paste_by_time) {
+		if (pb->automatic)
+			total += pb->pd->size;
+	}
+	RB_FOREACH_REVERSE_SAFE(pb, paste_time_tree, &paste_by_time, pb1) {
+		if (total <= limit)
+			break;
+		if (pb->automatic && pb != keep) {
+			log_debug("%s: freeing %s (%zu bytes)", __func__,
+			    pb->name, pb->pd->size);
+			total -= pb->pd->size;
+			paste_free(pb);
+		}
+	}
+}
+
 /*
  * Add an automatic buffer, freeing the oldest automatic item if at limit. Note
  * that the caller is responsible for allocating data.
@@ -187,17 +484,19 @@ paste_add(const char *prefix, char *data, size_t size)
 		paste_next_index++;
 	} while (paste_get_name(pb->name) != NULL);
 
-	pb->data = data;
-	pb->size = size;
+	paste_set_data(pb, data, size);
 
 	pb->automatic = 1;
 	paste_num_automatic++;
 
-	pb->created = time(NULL);
+	timerclear(&pb->created);
+	pb->created.tv_sec = time(NULL);
 
 	pb->order = paste_next_order++;
 	RB_INSERT(paste_name_tree, &paste_by_name, pb);
 	RB_INSERT(paste_time_tree, &paste_by_time, pb);
+
+	paste_trim(pb);
 }
 
 /* Rename a paste buffer. */
@@ -279,13 +578,13 @@ paste_set(char *data, size_t size, const char *name, char **cause)
 
 	pb->name = xstrdup(name);
 
-	pb->data = data;
-	pb->size = size;
+	paste_set_data(pb, data, size);
 
 	pb->automatic = 0;
 	pb->order = paste_next_order++;
 
-	pb->created = time(NULL);
+	timerclear(&pb->created);
+	pb->created.tv_sec = time(NULL);
 
 	if ((old = paste_get_name(name)) != NULL)
 		paste_free(old);
@@ -300,27 +599,217 @@ paste_set(char *data, size_t size, const char *name, char **cause)
 void
 paste_replace(struct paste_buffer *pb, char *data, size_t size)
 {
-	free(pb->data);
-	pb->data = data;
-	pb->size = size;
+	paste_data_free(pb->pd);
+	paste_set_data(pb, data, size);
 }
 
-/* Convert start of buffer into a nice string. */
-char *
-paste_make_sample(struct paste_buffer *pb)
+/* Convert start of buffer data into a nice string. */
+static char *
+paste_make_sample(const char *data, size_t size)
 {
 	char		*buf;
 	size_t		 len, used;
 	const int	 flags = VIS_OCTAL|VIS_CSTYLE|VIS_TAB|VIS_NL;
-	const size_t	 width = 200;
+	const size_t	 width = PASTE_SAMPLE_WIDTH;
 
-	len = pb->size;
+	len = size;
 	if (len > width)
 		len = width;
 	buf = xreallocarray(NULL, len, 4 + 4);
 
-	used = utf8_strvis(buf, pb->data, len, flags);
-	if (pb->size > width || used > width)
+	used = utf8_strvis(buf, data, len, flags);
+	if (size > width || used > width)
 		strlcpy(buf + width, "...", 4);
 	return (buf);
 }
+
+/* Get the sample of a paste buffer. */
+const char *
+paste_buffer_sample(struct paste_buffer *pb)
+{
+	return (pb->pd->sample);
+}
+
+/*
+ * Get the first lines of a paste buffer as nice strings for a preview. Only
+ * the start of long lines is kept, enough to fill the width of any likely
+ * terminal.
+ */
+char **
+paste_buffer_preview(struct paste_buffer *pb, u_int *n)
+{
+	struct paste_data	*pd = pb->pd;
+	const char		*data, *start, *end, *cp;
+	size_t			 len;
+	const int		 flags = VIS_OCTAL|VIS_CSTYLE|VIS_TAB;
+
+	if (pd->preview != NULL) {
+		*n = pd->npreview;
+		return (pd->preview);
+	}
+
+	data = end = paste_data_get(pd);
+	pd->preview = xcalloc(PASTE_PREVIEW_LINES, sizeof *pd->preview);
+	while (pd->npreview < PASTE_PREVIEW_LINES) {
+		start = end;
+		cp = memchr(start, '\n', data + pd->size - start);
+		if (cp == NULL)
+			end = data + pd->size;
+		else
+			end = cp;
+
+		len = end - start;
+		if (len > PASTE_PREVIEW_WIDTH)
+			len = PASTE_PREVIEW_WIDTH;
+		pd->preview[pd->npreview] = xreallocarray(NULL, 4, len + 1);
+		utf8_strvis(pd->preview[pd->npreview], start, len, flags);
+		pd->npreview++;
+
+		if (end == data + pd->size)
+			break;
+		end++;
+	}
+	*n = pd->npreview;
+	return (pd->preview);
+}
+
+/*
+ * Write the next piece of a paste into a pane, replacing linefeeds with the
+ * separator. Returns 1 if the paste is finished.
+ */
+static int
+paste_pane_write(struct window_pane_paste *wpp, struct evbuffer *evb)
+{
+	struct paste_data	*pd = wpp->pd;
+	size_t			 end;
+	const char		*line;
+
+	if (!wpp->started) {
+		if (wpp->bracket)
+			evbuffer_add(evb, "\033[200~", 6);
+		wpp->started = 1;
+	}
+
+	end = wpp->offset + PASTE_PANE_CHUNK;
+	if (end > pd->size)
+		end = pd->size;
+	while (wpp->offset != end) {
+		line = NULL;
+		if (wpp->sep != NULL)
+			line = memchr(pd->data + wpp->offset, '\n',
+			    end - wpp->offset);
+		if (line == NULL) {
+			paste_data_add(pd, evb, wpp->offset, end - wpp->offset);
+			wpp->offset = end;
+			break;
+		}
+		paste_data_add(pd, evb, wpp->offset,
+		    line - (pd->data + wpp->offset));
+		evbuffer_add(evb, wpp->sep, wpp->seplen);
+		wpp->offset = (line + 1) - pd->data;
+	}
+
+	if (wpp->offset != pd->size)
+		return (0);
+	if (wpp->bracket)
+		evbuffer_add(evb, "\033[201~", 6);
+	return (1);
+}
+
+/* Free a pane paste. */
+static void
+paste_pane_free(struct window_pane *wp, struct window_pane_paste *wpp)
+{
+	TAILQ_REMOVE(&wp->pastes, wpp, entry);
+	paste_data_free(wpp->pd);
+	free(wpp->sep);
+	free(wpp);
+}
+
+/*
+ * Write pastes into a pane until there is a chunk waiting to be written. Called
+ * again each time the pane's output drains.
+ */
+void
+paste_pane_continue(struct window_pane *wp)
+{
+	struct window_pane_paste	*wpp;
+	struct evbuffer			*evb;
+
+	if (wp->event == NULL)
+		return;
+	evb = wp->event->output;
+
+	while ((wpp = TAILQ_FIRST(&wp->pastes)) != NULL) {
+		if (EVBUFFER_LENGTH(evb) >= PASTE_PANE_CHUNK)
+			break;
+		if (paste_pane_write(wpp, evb)) {
+			paste_pane_free(wp, wpp);
+			server_status_window(wp->window);
+		}
+	}
+}
+
+/*
+ * Paste a buffer into a pane. Large buffers are written a piece at a time as
+ * the pane takes them.
+ */
+void
+paste_pane(struct window_pane *wp, struct paste_buffer *pb, const char *sep,
+    int bracket)
+{
+	struct window_pane_paste	*wpp;
+
+	if (wp->event == NULL)
+		return;
+
+	wpp = xcalloc(1, sizeof *wpp);
+	wpp->pd = pb->pd;
+	wpp->pd->references++;
+	paste_data_get(wpp->pd);
+
+	if (strcmp(sep, "\n") != 0) {
+		wpp->sep = xstrdup(sep);
+		wpp->seplen = strlen(sep);
+	}
+	wpp->bracket = bracket;
+
+	TAILQ_INSERT_TAIL(&wp->pastes, wpp, entry);
+	paste_pane_continue(wp);
+}
+
+/*
+ * Cancel any pastes into a pane. If a paste has been started, the end of the
+ * bracketed paste is still written.
+ */
+void
+paste_pane_cancel(struct window_pane *wp)
+{
+	struct window_pane_paste	*wpp, *wpp1;
+
+	if (TAILQ_EMPTY(&wp->pastes))
+		return;
+	TAILQ_FOREACH_SAFE(wpp, &wp->pastes, entry, wpp1) {
+		if (wpp->started && wpp->bracket && wp->event != NULL)
+			bufferevent_write(wp->event, "\033[201~", 6);
+		paste_pane_free(wp, wpp);
+	}
+	server_status_window(wp->window);
+}
+
+/* Get the bytes of paste left to write into a pane and the total. */
+size_t
+paste_pane_left(struct window_pane *wp, size_t *size)
+{
+	struct window_pane_paste	*wpp;
+	size_t				 left = 0;
+
+	if (size != NULL)
+		*size = 0;
+	TAILQ_FOREACH(wpp, &wp->pastes, entry) {
+		left += wpp->pd->size - wpp->offset;
+		if (size != NULL)
+			*size += wpp->pd->size;
+	}
+	return (left);
+}
@@ -32,6 +32,10 @@ struct popup_data {
 	int			  flags;
 
 	struct screen		  s;
+	bitstr_t		 *damage;
+	u_int			  damage_size;
+	int			  damaged;
+	int			  redraw;
 	struct job		 *job;
 	struct input_ctx	 *ictx;
 	int			  status;
@@ -58,12 +62,50 @@ struct popup_editor {
 	void			*arg;
 };
 
+/*
+ * Mark lines of the popup contents to be drawn. If the whole popup is already
+ * going to be drawn there is nothing to do, otherwise only the damaged lines
+ * are drawn rather than the box and every line.
+ */
+static int
+popup_damage(struct popup_data *pd, u_int py, u_int ny)
+{
+	struct client	*c = pd->c;
+	u_int		 sy = screen_size_y(&pd->s);
+
+	if ((c->flags & CLIENT_REDRAWOVERLAY) && !pd->damaged)
+		return (0);
+	if (pd->damage == NULL || pd->damage_size != sy) {
+		free(pd->damage);
+		if ((pd->damage = bit_alloc(sy)) == NULL)
+			fatal("bit_alloc failed");
+		pd->damage_size = sy;
+	}
+	if (py < sy && ny != 0) {
+		if (ny > sy - py)
+			ny = sy - py;
+		bit_nset(pd->damage, py, py + ny - 1);
+	}
+	pd->damaged = 1;
+	c->flags |= CLIENT_REDRAWOVERLAY;
+	return (1);
+}
+
 static void
 popup_redraw_cb(const struct tty_ctx *ttyctx)
 {
 	struct popup_data	*pd = ttyctx->arg;
 
-	pd->c->flags |= CLIENT_REDRAWOVERLAY;
+	if (popup_damage(pd, 0, screen_size_y(&pd->s)))
+		pd->redraw = 1;
+}
+
+static void
+popup_damage_cb(const struct tty_ctx *ttyctx, u_int py, u_int ny)
+{
+	struct popup_data	*pd = ttyctx->arg;
+
+	popup_damage(pd, py, ny);
 }
 
 static int
@@ -73,7 +115,12 @@ popup_set_client_cb(struct tty_ctx *ttyctx, struct client *c)
 
 	if (c != pd->c)
 		return (0);
-	if (pd->c->flags & CLIENT_REDRAWOVERLAY)
+
+	/*
+	 * Output is not needed if every line is going to be drawn anyway, but
+	 * must still be written if only some lines are damaged.
+	 */
+	if ((c->flags & CLIENT_REDRAWOVERLAY) && (!pd->damaged || pd->redraw))
 		return (0);
 
 	ttyctx->bigger = 0;
@@ -94,6 +141,7 @@ popup_init_ctx_cb(struct screen_write_ctx *ctx, struct tty_ctx *ttyctx)
 	struct popup_data	*pd = ctx->arg;
 
 	ttyctx->redraw_cb = popup_redraw_cb;
+	ttyctx->damage_cb = popup_damage_cb;
 	ttyctx->set_client_cb = popup_set_client_cb;
 	ttyctx->arg = pd;
 }
@@ -128,6 +176,30 @@ popup_draw_cb(struct client *c, __unused struct screen_redraw_ctx *ctx0)
 	struct screen		 s;
 	struct screen_write_ctx	 ctx;
 	u_int			 i, px = pd->px, py = pd->py;
+	int			 damaged = pd->damaged;
+
+	pd->damaged = pd->redraw = 0;
+
+	/*
+	 * If nothing but the contents of the popup has changed, draw only the
+	 * damaged lines.
+	 */
+	if (damaged &&
+	    (c->flags & CLIENT_ALLREDRAWFLAGS) == CLIENT_REDRAWOVERLAY &&
+	    pd->damage_size == screen_size_y(&pd->s)) {
+		c->overlay_check = NULL;
+		for (i = 0; i < pd->damage_size; i++) {
+			if (!bit_test(pd->damage, i))
+				continue;
+			tty_draw_line(tty, &pd->s, 0, i, pd->sx - 2, px + 1,
+			    py + 1 + i, &grid_default_cell, NULL);
+		}
+		c->overlay_check = popup_check_cb;
+		bit_nclear(pd->damage, 0, pd->damage_size - 1);
+		return;
+	}
+	if (pd->damage != NULL)
+		bit_nclear(pd->damage, 0, pd->damage_size - 1);
 
 	screen_init(&s, pd->sx, pd->sy, 0);
 	screen_write_start(&ctx, &s);
@@ -167,6 +239,7 @@ popup_free_cb(struct client *c)
 	input_free(pd->ictx);
 
 	screen_free(&pd->s);
+	free(pd->damage);
 	free(pd);
 }
 
@@ -195,7 +268,8 @@ popup_handle_drag(struct client *c, struct popup_data *pd,
 		pd->py = py;
 		pd->dx = m->x - pd->px;
 		pd->dy = m->y - pd->py;
-		server_redraw_client(c);
+		server_client_set_overlay_area(c, pd->px, pd->py, pd->sx,
+		    pd->sy);
 	} else if (pd->dragging == SIZE) {
 		if (m->x < pd->px + 3)
 			return;
@@ -207,8 +281,10 @@ popup_handle_drag(struct client *c, struct popup_data *pd,
 		screen_resize(&pd->s, pd->sx - 2, pd->sy - 2, 0);
 		if (pd->job != NULL)
 			job_resize(pd->job, pd->sx - 2, pd->sy - 2);
-		server_redraw_client(c);
+		server_client_set_overlay_area(c, pd->px, pd->py, pd->sx,
+		    pd->sy);
 	}
+	pd->damaged = pd->redraw = 0;
 }
 
 static int
@@ -354,6 +430,7 @@ popup_display(int flags, struct cmdq_item *item, u_int px, u_int py, u_int sx,
 
 	server_client_set_overlay(c, 0, popup_check_cb, popup_mode_cb,
 	    popup_draw_cb, popup_key_cb, popup_free_cb, pd);
+	server_client_set_overlay_area(c, px, py, sx, sy);
 	return (0);
 }
 
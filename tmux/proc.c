@@ -17,6 +17,7 @@
  */
 
 #include <sys/types.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
 #include <sys/utsname.h>
@@ -33,6 +34,13 @@
 
 #include "tmux.h"
 
+/*
+ * Socket send buffer size for peers. Messages are queued by proc_send and only
+ * written when the socket is writable, so everything sent in one loop is
+ * written together; a bigger buffer lets more of it go in one write.
+ */
+#define PROC_SNDBUF (512 * 1024)
+
 struct tmuxproc {
 	const char	 *name;
 	int		  exit;
@@ -56,10 +64,14 @@ struct tmuxpeer {
 
 	struct imsgbuf	 ibuf;
 	struct event	 event;
+	short		 events;
+	int		 priority;
 
 	int		 flags;
 #define PEER_BAD 0x1
 
+	struct proc_stats stats;
+
 	void		(*dispatchcb)(struct imsg *, void *);
 	void		 *arg;
 
@@ -77,6 +89,7 @@ proc_event_cb(__unused int fd, short events, void *arg)
 	struct imsg	 imsg;
 
 	if (!(peer->flags & PEER_BAD) && (events & EV_READ)) {
+		peer->stats.reads++;
 		if (((n = imsg_read(&peer->ibuf)) == -1 && errno != EAGAIN) ||
 		    n == 0) {
 			peer->dispatchcb(NULL, peer->arg);
@@ -89,6 +102,7 @@ proc_event_cb(__unused int fd, short events, void *arg)
 			}
 			if (n == 0)
 				break;
+			peer->stats.received++;
 			log_debug("peer %p message %d", peer, imsg.hdr.type);
 
 			if (peer_check_version(peer, &imsg) != 0) {
@@ -104,6 +118,7 @@ proc_event_cb(__unused int fd, short events, void *arg)
 	}
 
 	if (events & EV_WRITE) {
+		peer->stats.writes++;
 		if (msgbuf_write(&peer->ibuf.w) <= 0 && errno != EAGAIN) {
 			peer->dispatchcb(NULL, peer->arg);
 			return;
@@ -143,21 +158,45 @@ peer_check_version(struct tmuxpeer *peer, struct imsg *imsg)
 	return (0);
 }
 
+/*
+ * Update the events for a peer. The event is persistent, so it is only changed
+ * when it needs to start or stop waiting to write; this is usually not the
+ * case after the first message sent in a loop.
+ */
 static void
 proc_update_event(struct tmuxpeer *peer)
 {
 	short	events;
 
-	event_del(&peer->event);
-
 	events = EV_READ;
 	if (peer->ibuf.w.queued > 0)
 		events |= EV_WRITE;
-	event_set(&peer->event, peer->ibuf.fd, events, proc_event_cb, peer);
+	if (events == peer->events)
+		return;
+	peer->events = events;
 
+	event_del(&peer->event);
+	event_set(&peer->event, peer->ibuf.fd, events|EV_PERSIST, proc_event_cb,
+	    peer);
+	event_priority_set(&peer->event, peer->priority);
 	event_add(&peer->event, NULL);
 }
 
+/* Change the priority of events for a peer. */
+void
+proc_set_priority(struct tmuxpeer *peer, int priority)
+{
+	if (peer->priority == priority)
+		return;
+	peer->priority = priority;
+
+	if (peer->events != 0) {
+		event_del(&peer->event);
+		event_priority_set(&peer->event, priority);
+		event_add(&peer->event, NULL);
+	}
+}
+
 int
 proc_send(struct tmuxpeer *peer, enum msgtype type, int fd, const void *buf,
     size_t len)
@@ -173,10 +212,25 @@ proc_send(struct tmuxpeer *peer, enum msgtype type, int fd, const void *buf,
 	retval = imsg_compose(ibuf, type, PROTOCOL_VERSION, -1, fd, vp, len);
 	if (retval != 1)
 		return (-1);
+	peer->stats.sent++;
 	proc_update_event(peer);
 	return (0);
 }
 
+/* Get the number of messages waiting to be sent to a peer. */
+u_int
+proc_queued(struct tmuxpeer *peer)
+{
+	return (peer->ibuf.w.queued);
+}
+
+/* Get message and system call counts for a peer. */
+void
+proc_get_stats(struct tmuxpeer *peer, struct proc_stats *ps)
+{
+	memcpy(ps, &peer->stats, sizeof *ps);
+}
+
 struct tmuxproc *
 proc_start(const char *name)
 {
@@ -308,12 +362,23 @@ proc_add_peer(struct tmuxproc *tp, int fd,
     void (*dispatchcb)(struct imsg *, void *), void *arg)
 {
 	struct tmuxpeer	*peer;
+	int		 size;
+	socklen_t	 len = sizeof size;
 
 	peer = xcalloc(1, sizeof *peer);
 	peer->parent = tp;
 
 	peer->dispatchcb = dispatchcb;
 	peer->arg = arg;
+	peer->priority = PROC_PRIORITY_CLIENT;
+
+	if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, &len) == 0 &&
+	    size < PROC_SNDBUF) {
+		size = PROC_SNDBUF;
+		if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size,
+		    sizeof size) != 0)
+			log_debug("peer %d: SO_SNDBUF failed", fd);
+	}
 
 	imsg_init(&peer->ibuf, fd);
 	event_set(&peer->event, fd, EV_READ, proc_event_cb, peer);
@@ -329,7 +394,9 @@ void
 proc_remove_peer(struct tmuxpeer *peer)
 {
 	TAILQ_REMOVE(&peer->parent->peers, peer, entry);
-	log_debug("remove peer %p", peer);
+	log_debug("remove peer %p: sent %lu messages in %lu writes, received "
+	    "%lu in %lu reads", peer, peer->stats.sent, peer->stats.writes,
+	    peer->stats.received, peer->stats.reads);
 
 	event_del(&peer->event);
 	imsg_clear(&peer->ibuf);
@@ -350,6 +417,55 @@ proc_toggle_log(struct tmuxproc *tp)
 	log_toggle(tp->name);
 }
 
+#ifdef PROC_SPAWN
+/*
+ * Start a child with vfork() so the server's memory is not copied, and execute
+ * path with the given arguments and environment. The child only makes system
+ * calls, since it shares memory with the server until it executes. Signals
+ * must be blocked by the caller; the child restores oldset. If tty is set, in
+ * becomes the controlling terminal of a new session.
+ */
+pid_t
+proc_spawn(const char *path, char **argv, char **envp, const char *cwd,
+    int in, int out, int err, int tty, sigset_t *oldset)
+{
+	static const int	 signals[] = { SIGPIPE, SIGTSTP, SIGINT, SIGQUIT,
+				     SIGHUP, SIGCHLD, SIGCONT, SIGTERM, SIGUSR1,
+				     SIGUSR2, SIGWINCH };
+	struct sigaction	 sa;
+	const char		*home = find_home();
+	pid_t			 pid;
+	u_int			 i;
+
+	memset(&sa, 0, sizeof sa);
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = SIG_DFL;
+
+	if ((pid = vfork()) != 0)
+		return (pid);
+
+	for (i = 0; i < nitems(signals); i++)
+		sigaction(signals[i], &sa, NULL);
+	sigprocmask(SIG_SETMASK, oldset, NULL);
+
+	if (tty && (setsid() == -1 || ioctl(in, TIOCSCTTY, 0) == -1))
+		_exit(1);
+	if ((cwd == NULL || chdir(cwd) != 0) &&
+	    (home == NULL || chdir(home) != 0) &&
+	    chdir("/") != 0)
+		_exit(1);
+
+	if (dup2(in, STDIN_FILENO) == -1 ||
+	    dup2(out, STDOUT_FILENO) == -1 ||
+	    dup2(err, STDERR_FILENO) == -1)
+		_exit(1);
+	closefrom(STDERR_FILENO + 1);
+
+	execve(path, argv, envp);
+	_exit(1);
+}
+#endif
+
 pid_t
 proc_fork_and_daemon(int *fd)
 {
@@ -19,10 +19,83 @@
 #include <sys/types.h>
 
 #include <regex.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "tmux.h"
 
+/* Compiled regular expression kept for reuse. */
+struct regsub_entry {
+	char				*pattern;
+	int				 flags;
+	regex_t				 r;
+
+	RB_ENTRY(regsub_entry)		 entry;
+	TAILQ_ENTRY(regsub_entry)	 lru;
+};
+static int regsub_cmp(struct regsub_entry *, struct regsub_entry *);
+static RB_HEAD(regsub_tree, regsub_entry) regsub_entries =
+    RB_INITIALIZER(&regsub_entries);
+RB_GENERATE_STATIC(regsub_tree, regsub_entry, entry, regsub_cmp);
+static TAILQ_HEAD(, regsub_entry) regsub_lru =
+    TAILQ_HEAD_INITIALIZER(regsub_lru);
+static u_int regsub_count;
+
+/* Number of compiled regular expressions kept. */
+#define REGSUB_LIMIT 64
+
+static int
+regsub_cmp(struct regsub_entry *re1, struct regsub_entry *re2)
+{
+	if (re1->flags < re2->flags)
+		return (-1);
+	if (re1->flags > re2->flags)
+		return (1);
+	return (strcmp(re1->pattern, re2->pattern));
+}
+
+/*
+ * Get a compiled regular expression, compiling it if it is not already kept.
+ * The result is valid until the next call and must not be freed. Returns
+ * NULL if the pattern is not valid.
+ */
+const regex_t *
+regsub_compile(const char *pattern, int flags)
+{
+	struct regsub_entry	*re, *re1, find;
+
+	find.pattern = (char *)pattern;
+	find.flags = flags;
+	re = RB_FIND(regsub_tree, &regsub_entries, &find);
+	if (re != NULL) {
+		TAILQ_REMOVE(&regsub_lru, re, lru);
+		TAILQ_INSERT_TAIL(&regsub_lru, re, lru);
+		return (&re->r);
+	}
+
+	re = xcalloc(1, sizeof *re);
+	if (regcomp(&re->r, pattern, flags) != 0) {
+		free(re);
+		return (NULL);
+	}
+	re->pattern = xstrdup(pattern);
+	re->flags = flags;
+
+	if (regsub_count == REGSUB_LIMIT) {
+		re1 = TAILQ_FIRST(&regsub_lru);
+		TAILQ_REMOVE(&regsub_lru, re1, lru);
+		RB_REMOVE(regsub_tree, &regsub_entries, re1);
+		regfree(&re1->r);
+		free(re1->pattern);
+		free(re1);
+		regsub_count--;
+	}
+	RB_INSERT(regsub_tree, &regsub_entries, re);
+	TAILQ_INSERT_TAIL(&regsub_lru, re, lru);
+	regsub_count++;
+	return (&re->r);
+}
+
 static void
 regsub_copy(char **buf, size_t *len, const char *text, size_t start, size_t end)
 {
@@ -60,7 +133,7 @@ regsub_expand(char **buf, size_t *len, const char *with, const char *text,
 char *
 regsub(const char *pattern, const char *with, const char *text, int flags)
 {
-	regex_t		 r;
+	const regex_t	*r;
 	regmatch_t	 m[10];
 	ssize_t		 start, end, last, len = 0;
 	int		 empty = 0;
@@ -68,7 +141,7 @@ regsub(const char *pattern, const char *with, const char *text, int flags)
 
 	if (*text == '\0')
 		return (xstrdup(""));
-	if (regcomp(&r, pattern, flags) != 0)
+	if ((r = regsub_compile(pattern, flags)) == NULL)
 		return (NULL);
 
 	start = 0;
@@ -76,7 +149,7 @@ regsub(const char *pattern, const char *with, const char *text, int flags)
 	end = strlen(text);
 
 	while (start <= end) {
-		if (regexec(&r, text + start, nitems(m), m, 0) != 0) {
+		if (regexec(r, text + start, nitems(m), m, 0) != 0) {
 			regsub_copy(&buf, &len, text, start, end);
 			break;
 		}
@@ -115,6 +188,5 @@ regsub(const char *pattern, const char *with, const char *text, int flags)
 	}
 	buf[len] = '\0';
 
-	regfree(&r);
 	return (buf);
 }
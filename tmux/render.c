@@ -0,0 +1,478 @@
+/* $OpenBSD$ */
+
+/*
+ * Copyright (c) 2021 The tmux authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER
+ * IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tmux.h"
+
+/*
+ * Client rendering. For clients with the client-render flag, the server does
+ * not write to the terminal itself. Instead it builds the screen as cells and
+ * sends each line which has changed since it was last sent to the client,
+ * which turns the cells into escape sequences and writes them. This moves the
+ * work of encoding the output out of the server and into each client process.
+ *
+ * A line is sent as one or more MSG_RENDER_LINE messages, each holding at most
+ * RENDER_CHUNK cells. Each cell is a header byte with the size of the UTF-8
+ * data and the width, then the style if it has changed from the cell before,
+ * then the data. A cell with a size of zero is padding after a wide character
+ * and is not written.
+ *
+ * Terminal modes, the title and the clipboard are still written by the
+ * server. The client uses ECMA-48 sequences and the server reduces colours to
+ * those supported by the terminal before sending them. Overlays draw straight
+ * to the terminal, so while one is shown the client stops and the server
+ * writes the whole screen itself.
+ */
+
+#define RENDER_CHUNK 256
+
+#define RENDER_SIZE 0x1f
+#define RENDER_WIDTH_SHIFT 5
+#define RENDER_STYLE 0x80
+
+/* Style of a cell as sent. */
+struct render_style {
+	u_short	attr;
+	int	fg;
+	int	bg;
+};
+
+/* A line as last sent to the client. */
+struct render_line {
+	u_char	*data;
+	size_t	 size;
+};
+
+/* Per-client rendering state in the server. */
+struct render {
+	u_int			 sx;
+	u_int			 sy;
+	struct grid_cell	*cells;
+	struct render_line	*lines;
+
+	int			 changed;
+	u_int			 cx;
+	u_int			 cy;
+};
+
+/* Pending output in the client. */
+static struct evbuffer	*render_buffer;
+static struct event	 render_event;
+static struct render_style render_last;
+
+/* Is the client encoding its own output at the moment? */
+int
+render_active(struct client *c)
+{
+	return ((c->flags & CLIENT_RENDER) && c->overlay_draw == NULL);
+}
+
+/* Reduce a colour to what the client terminal supports. */
+static int
+render_colour(struct tty_term *term, int c, int fg, u_short *attr)
+{
+	u_char	r, g, b;
+	u_int	colours;
+
+	if (c & COLOUR_FLAG_RGB) {
+		if (term->flags & TERM_RGBCOLOURS)
+			return (c);
+		colour_split_rgb(c, &r, &g, &b);
+		c = colour_find_rgb(r, g, b);
+	}
+
+	if (term->flags & TERM_256COLOURS)
+		colours = 256;
+	else
+		colours = tty_term_number(term, TTYC_COLORS);
+
+	if (c & COLOUR_FLAG_256) {
+		if (colours >= 256)
+			return (c);
+		c = colour_256to16(c);
+		if (c & 8) {
+			c &= 7;
+			if (colours >= 16)
+				c += 90;
+			else if (fg)
+				*attr |= GRID_ATTR_BRIGHT;
+		}
+		return (c);
+	}
+
+	if (c >= 90 && c <= 97 && colours < 16) {
+		c -= 90;
+		if (fg)
+			*attr |= GRID_ATTR_BRIGHT;
+	}
+	return (c);
+}
+
+/* Add a line in chunks to a buffer. */
+static void
+render_build_line(struct client *c, struct render *r, u_int y,
+    struct evbuffer *evb)
+{
+	struct grid_cell	*gc;
+	struct render_style	 style, last;
+	struct msg_render_line	 msg;
+	u_char			 header;
+	u_int			 i, j;
+
+	memset(&last, 0, sizeof last);
+	for (i = 0; i < r->sx; i += RENDER_CHUNK) {
+		msg.x = i;
+		msg.y = y;
+		msg.n = r->sx - i;
+		if (msg.n > RENDER_CHUNK)
+			msg.n = RENDER_CHUNK;
+		evbuffer_add(evb, &msg, sizeof msg);
+
+		for (j = i; j < i + msg.n; j++) {
+			gc = &r->cells[y * r->sx + j];
+
+			memset(&style, 0, sizeof style);
+			style.attr = gc->attr;
+			style.fg = render_colour(c->tty.term, gc->fg, 1,
+			    &style.attr);
+			style.bg = render_colour(c->tty.term, gc->bg, 0,
+			    &style.attr);
+
+			if (gc->flags & GRID_FLAG_PADDING)
+				header = 0;
+			else
+				header = gc->data.size & RENDER_SIZE;
+			header |= (gc->data.width << RENDER_WIDTH_SHIFT);
+			if (j == i || memcmp(&style, &last, sizeof style) != 0)
+				header |= RENDER_STYLE;
+			evbuffer_add(evb, &header, sizeof header);
+
+			if (header & RENDER_STYLE) {
+				evbuffer_add(evb, &style, sizeof style);
+				memcpy(&last, &style, sizeof last);
+			}
+			if (header & RENDER_SIZE)
+				evbuffer_add(evb, gc->data.data, gc->data.size);
+		}
+	}
+}
+
+/* Send a line, a chunk at a time. */
+static void
+render_send_line(struct client *c, const u_char *data, size_t size)
+{
+	struct msg_render_line	 msg;
+	struct render_style	 style;
+	size_t			 off = 0, start;
+	u_int			 i;
+	u_char			 header;
+
+	while (off < size) {
+		start = off;
+		memcpy(&msg, data + off, sizeof msg);
+		off += sizeof msg;
+		for (i = 0; i < msg.n; i++) {
+			header = data[off++];
+			if (header & RENDER_STYLE)
+				off += sizeof style;
+			off += (header & RENDER_SIZE);
+		}
+		proc_send(c->peer, MSG_RENDER_LINE, -1, data + start,
+		    off - start);
+	}
+}
+
+/* Send the lines of a client which have changed since they were last sent. */
+void
+render_update(struct client *c)
+{
+	struct render		*r = c->render;
+	struct render_line	*rl;
+	struct evbuffer		*evb;
+	u_int			 y;
+	size_t			 size;
+	u_char			*data;
+
+	if (r != NULL &&
+	    (r->sx != c->tty.sx ||
+	    r->sy != c->tty.sy ||
+	    (c->flags & CLIENT_REDRAWWINDOW)))
+		render_free(c);
+	if ((r = c->render) == NULL) {
+		r = c->render = xcalloc(1, sizeof *r);
+		r->sx = c->tty.sx;
+		r->sy = c->tty.sy;
+		r->cells = xreallocarray(NULL, (size_t)r->sx * r->sy,
+		    sizeof *r->cells);
+		r->lines = xcalloc(r->sy, sizeof *r->lines);
+		r->cx = r->cy = UINT_MAX;
+		proc_send(c->peer, MSG_RENDER_RESET, -1, NULL, 0);
+	}
+	screen_redraw_compose(c, r->cells);
+
+	evb = evbuffer_new();
+	if (evb == NULL)
+		fatalx("out of memory");
+	for (y = 0; y < r->sy; y++) {
+		render_build_line(c, r, y, evb);
+		data = EVBUFFER_DATA(evb);
+		size = EVBUFFER_LENGTH(evb);
+
+		rl = &r->lines[y];
+		if (rl->data == NULL ||
+		    rl->size != size ||
+		    memcmp(rl->data, data, size) != 0) {
+			render_send_line(c, data, size);
+			rl->data = xrealloc(rl->data, size);
+			memcpy(rl->data, data, size);
+			rl->size = size;
+			r->changed = 1;
+		}
+		evbuffer_drain(evb, size);
+	}
+	evbuffer_free(evb);
+
+	/*
+	 * The server does not see the client write the lines, so the echo of
+	 * a key is counted once it has been sent.
+	 */
+	if (r->changed && c->input_state == CLIENT_INPUT_ECHOED) {
+		c->input_state = CLIENT_INPUT_QUEUED;
+		server_client_input_written(c);
+	}
+}
+
+/* Send the cursor position if it has moved or lines have been sent. */
+void
+render_cursor(struct client *c, u_int cx, u_int cy)
+{
+	struct render			*r = c->render;
+	struct msg_render_cursor	 msg;
+
+	if (r == NULL)
+		return;
+	if (!r->changed && r->cx == cx && r->cy == cy)
+		return;
+	r->changed = 0;
+	r->cx = msg.cx = cx;
+	r->cy = msg.cy = cy;
+	proc_send(c->peer, MSG_RENDER_CURSOR, -1, &msg, sizeof msg);
+}
+
+/* Free rendering state for a client. */
+void
+render_free(struct client *c)
+{
+	struct render	*r = c->render;
+	u_int		 y;
+
+	if (r == NULL)
+		return;
+	for (y = 0; y < r->sy; y++)
+		free(r->lines[y].data);
+	free(r->lines);
+	free(r->cells);
+	free(r);
+	c->render = NULL;
+}
+
+/* Write pending output in the client. */
+static void
+render_write_callback(__unused int fd, __unused short events,
+    __unused void *data)
+{
+	if (evbuffer_write(render_buffer, STDIN_FILENO) == -1 &&
+	    errno != EAGAIN &&
+	    errno != EINTR) {
+		evbuffer_drain(render_buffer, EVBUFFER_LENGTH(render_buffer));
+		return;
+	}
+	if (EVBUFFER_LENGTH(render_buffer) != 0)
+		event_add(&render_event, NULL);
+}
+
+/* Add a colour to an SGR sequence. */
+static void
+render_add_colour(int c, int fg)
+{
+	u_char	r, g, b;
+
+	if (c & COLOUR_FLAG_RGB) {
+		colour_split_rgb(c, &r, &g, &b);
+		evbuffer_add_printf(render_buffer, ";%d;2;%u;%u;%u",
+		    fg ? 38 : 48, r, g, b);
+	} else if (c & COLOUR_FLAG_256) {
+		evbuffer_add_printf(render_buffer, ";%d;5;%d", fg ? 38 : 48,
+		    c & 0xff);
+	} else if (c >= 0 && c <= 7)
+		evbuffer_add_printf(render_buffer, ";%d", (fg ? 30 : 40) + c);
+	else if (c >= 90 && c <= 97)
+		evbuffer_add_printf(render_buffer, ";%d", (fg ? 0 : 10) + c);
+}
+
+/* Write the sequence to change to a style. */
+static void
+render_add_style(const struct render_style *style)
+{
+	if (render_last.attr & GRID_ATTR_CHARSET)
+		evbuffer_add(render_buffer, "\033(B", 3);
+	memcpy(&render_last, style, sizeof render_last);
+
+	evbuffer_add(render_buffer, "\033[0", 3);
+	if (style->attr & GRID_ATTR_BRIGHT)
+		evbuffer_add(render_buffer, ";1", 2);
+	if (style->attr & GRID_ATTR_DIM)
+		evbuffer_add(render_buffer, ";2", 2);
+	if (style->attr & GRID_ATTR_ITALICS)
+		evbuffer_add(render_buffer, ";3", 2);
+	if (style->attr & GRID_ATTR_ALL_UNDERSCORE)
+		evbuffer_add(render_buffer, ";4", 2);
+	if (style->attr & GRID_ATTR_BLINK)
+		evbuffer_add(render_buffer, ";5", 2);
+	if (style->attr & GRID_ATTR_REVERSE)
+		evbuffer_add(render_buffer, ";7", 2);
+	if (style->attr & GRID_ATTR_HIDDEN)
+		evbuffer_add(render_buffer, ";8", 2);
+	if (style->attr & GRID_ATTR_STRIKETHROUGH)
+		evbuffer_add(render_buffer, ";9", 2);
+	if (style->attr & GRID_ATTR_OVERLINE)
+		evbuffer_add(render_buffer, ";53", 3);
+	render_add_colour(style->fg, 1);
+	render_add_colour(style->bg, 0);
+	evbuffer_add(render_buffer, "m", 1);
+
+	if (style->attr & GRID_ATTR_CHARSET)
+		evbuffer_add(render_buffer, "\033(0", 3);
+}
+
+/* Write a line in the client. */
+static void
+render_add_line(const u_char *data, size_t size, uint64_t flags)
+{
+	struct msg_render_line	 msg;
+	struct render_style	 style;
+	u_int			 i, j, width;
+	size_t			 off, n;
+	u_char			 header;
+	int			 moved = 0;
+
+	if (size < sizeof msg)
+		fatalx("bad MSG_RENDER_LINE size");
+	memcpy(&msg, data, sizeof msg);
+	off = sizeof msg;
+
+	for (i = 0; i < msg.n; i++) {
+		if (off == size)
+			fatalx("bad MSG_RENDER_LINE cell");
+		header = data[off++];
+		if (header & RENDER_STYLE) {
+			if (size - off < sizeof style)
+				fatalx("bad MSG_RENDER_LINE style");
+			memcpy(&style, data + off, sizeof style);
+			off += sizeof style;
+			render_add_style(&style);
+		}
+
+		n = (header & RENDER_SIZE);
+		if (size - off < n)
+			fatalx("bad MSG_RENDER_LINE data");
+		if (n == 0)
+			continue;
+
+		/*
+		 * Move to the first cell which is not padding, in case the
+		 * line starts in the middle of a wide character.
+		 */
+		if (!moved) {
+			evbuffer_add_printf(render_buffer, "\033[%u;%uH",
+			    msg.y + 1, msg.x + i + 1);
+			moved = 1;
+		}
+		if (n > 1 && (~flags & CLIENT_UTF8)) {
+			width = (header >> RENDER_WIDTH_SHIFT);
+			for (j = 0; j < width; j++)
+				evbuffer_add(render_buffer, "_", 1);
+		} else
+			evbuffer_add(render_buffer, data + off, n);
+		off += n;
+	}
+	evbuffer_add(render_buffer, "\033[0m", 4);
+	if (render_last.attr & GRID_ATTR_CHARSET)
+		evbuffer_add(render_buffer, "\033(B", 3);
+	memset(&render_last, 0, sizeof render_last);
+}
+
+/* Handle a rendering message in the client. */
+void
+render_dispatch(struct imsg *imsg, uint64_t flags)
+{
+	struct msg_render_cursor	 msg;
+	u_char				*data = imsg->data;
+	size_t				 size;
+
+	size = imsg->hdr.len - IMSG_HEADER_SIZE;
+	if (render_buffer == NULL) {
+		render_buffer = evbuffer_new();
+		if (render_buffer == NULL)
+			fatalx("out of memory");
+		event_set(&render_event, STDIN_FILENO, EV_WRITE,
+		    render_write_callback, NULL);
+	}
+
+	switch (imsg->hdr.type) {
+	case MSG_RENDER_RESET:
+		if (size != 0)
+			fatalx("bad MSG_RENDER_RESET size");
+		evbuffer_drain(render_buffer, EVBUFFER_LENGTH(render_buffer));
+		evbuffer_add(render_buffer, "\033[0m\033[H\033[2J", 11);
+		break;
+	case MSG_RENDER_LINE:
+		render_add_line(data, size, flags);
+		break;
+	case MSG_RENDER_CURSOR:
+		if (size != sizeof msg)
+			fatalx("bad MSG_RENDER_CURSOR size");
+		memcpy(&msg, data, sizeof msg);
+		evbuffer_add_printf(render_buffer, "\033[%u;%uH", msg.cy + 1,
+		    msg.cx + 1);
+		break;
+	}
+	if (!event_pending(&render_event, EV_WRITE, NULL))
+		event_add(&render_event, NULL);
+}
+
+/*
+ * Discard any output not yet written, when the client is leaving the terminal
+ * or the server is taking over writing to it again.
+ */
+void
+render_stop(void)
+{
+	if (render_buffer == NULL)
+		return;
+	event_del(&render_event);
+	evbuffer_free(render_buffer);
+	render_buffer = NULL;
+	memset(&render_last, 0, sizeof render_last);
+}
@@ -22,6 +22,20 @@
 
 #include "tmux.h"
 
+/*
+ * Window sizes are not worked out as soon as something changes; sessions whose
+ * windows need their size checked are flagged and all are done together from
+ * the server loop, so a burst of changes (such as many clients being resized at
+ * once) is only worked out once. While this is happening, each session has a
+ * list of its clients, so a window only looks at the clients of sessions it is
+ * in rather than all clients.
+ */
+static int		 resize_pending;
+static int		 resize_all;
+static int		 resize_indexed;
+static struct client	**resize_list;
+static u_int		 resize_list_size;
+
 void
 resize_window(struct window *w, u_int sx, u_int sy, int xpixel, int ypixel)
 {
@@ -92,13 +106,58 @@ ignore_client_size(struct client *c)
 	return (0);
 }
 
+/* Add a client to the list to be looked at. */
+static void
+clients_add(struct client *c, u_int *n)
+{
+	if (*n == resize_list_size) {
+		resize_list_size = (resize_list_size == 0) ? 16 :
+		    resize_list_size * 2;
+		resize_list = xreallocarray(resize_list, resize_list_size,
+		    sizeof *resize_list);
+	}
+	resize_list[(*n)++] = c;
+}
+
+/*
+ * Get the clients which may affect the size of a window: those attached to a
+ * session containing the window if the sessions' lists are built, otherwise
+ * all clients.
+ */
 static u_int
-clients_with_window(struct window *w)
+clients_for_window(struct window *w)
 {
 	struct client	*loop;
+	struct winlink	*wl, *wl1;
 	u_int		 n = 0;
 
-	TAILQ_FOREACH(loop, &clients, entry) {
+	if (w == NULL || !resize_indexed) {
+		TAILQ_FOREACH(loop, &clients, entry)
+			clients_add(loop, &n);
+		return (n);
+	}
+	TAILQ_FOREACH(wl, &w->winlinks, wentry) {
+		TAILQ_FOREACH(wl1, &w->winlinks, wentry) {
+			if (wl1 == wl || wl1->session == wl->session)
+				break;
+		}
+		if (wl1 != wl)
+			continue;
+		loop = wl->session->size_clients;
+		for (; loop != NULL; loop = loop->size_next)
+			clients_add(loop, &n);
+	}
+	return (n);
+}
+
+static u_int
+clients_with_window(struct window *w, u_int nclients)
+{
+	struct client	*loop;
+	u_int		 i, n = 0;
+
+	for (i = 0; i < nclients; i++) {
+		loop = resize_list[i];
 		if (ignore_client_size(loop) || !session_has(loop->session, w))
 			continue;
 		if (++n > 1)
@@ -114,7 +173,7 @@ clients_calculate_size(int type, int current, struct client *c,
     u_int *xpixel, u_int *ypixel)
 {
 	struct client	*loop;
-	u_int		 cx, cy, n = 0;
+	u_int		 cx, cy, i, nclients, n = 0;
 
 	/* Manual windows do not have their size changed based on a client. */
 	if (type == WINDOW_SIZE_MANUAL) {
@@ -136,11 +195,13 @@ clients_calculate_size(int type, int current, struct client *c,
 	 * For latest, count the number of clients with this window. We only
 	 * care if there is more than one.
 	 */
+	nclients = clients_for_window(w);
 	if (type == WINDOW_SIZE_LATEST && w != NULL)
-		n = clients_with_window(w);
+		n = clients_with_window(w, nclients);
 
 	/* Loop over the clients and work out the size. */
-	TAILQ_FOREACH(loop, &clients, entry) {
+	for (i = 0; i < nclients; i++) {
+		loop = resize_list[i];
 		if (loop != c && ignore_client_size(loop)) {
 			log_debug("%s: ignoring %s", __func__, loop->name);
 			continue;
@@ -347,22 +408,17 @@ recalculate_size(struct window *w, int now)
 		w->new_ypixel = ypixel;
 
 		w->flags |= WINDOW_RESIZE;
+		window_queue_check(w);
 		tty_update_window_offset(w);
 	}
 }
 
-void
-recalculate_sizes(void)
-{
-	recalculate_sizes_now(0);
-}
-
-void
-recalculate_sizes_now(int now)
+/* Update attached counts and status line state for sessions and clients. */
+static void
+recalculate_sizes_update(void)
 {
 	struct session	*s;
 	struct client	*c;
-	struct window	*w;
 
 	/*
 	 * Clear attached count and update saved status line information for
@@ -388,8 +444,78 @@ recalculate_sizes_now(int now)
 		else
 			c->flags &= ~CLIENT_STATUSOFF;
 	}
+}
+
+/* Work out the size of all windows from the server loop. */
+void
+recalculate_sizes(void)
+{
+	recalculate_sizes_update();
+	resize_all = resize_pending = 1;
+}
+
+/*
+ * Work out the size of windows in a session from the server loop. This is for
+ * changes which only affect clients attached to the session.
+ */
+void
+recalculate_sizes_session(struct session *s)
+{
+	recalculate_sizes_update();
+	if (s == NULL)
+		resize_all = 1;
+	else
+		s->flags |= SESSION_RESIZE;
+	resize_pending = 1;
+}
+
+/* Work out the size of all windows immediately. */
+void
+recalculate_sizes_now(int now)
+{
+	struct window	*w;
 
-	/* Walk each window and adjust the size. */
+	recalculate_sizes_update();
 	RB_FOREACH(w, windows, &windows)
 		recalculate_size(w, now);
 }
+
+/* Work out the size of windows which need it. */
+void
+recalculate_sizes_check(void)
+{
+	struct session	*s;
+	struct client	*c;
+	struct window	*w;
+	struct winlink	*wl;
+
+	if (!resize_pending)
+		return;
+
+	RB_FOREACH(s, sessions, &sessions)
+		s->size_clients = NULL;
+	TAILQ_FOREACH_REVERSE(c, &clients, clients, entry) {
+		if ((s = c->session) == NULL)
+			continue;
+		c->size_next = s->size_clients;
+		s->size_clients = c;
+	}
+	resize_indexed = 1;
+
+	if (resize_all) {
+		RB_FOREACH(w, windows, &windows)
+			recalculate_size(w, 0);
+	} else {
+		RB_FOREACH(s, sessions, &sessions) {
+			if (~s->flags & SESSION_RESIZE)
+				continue;
+			RB_FOREACH(wl, winlinks, &s->windows)
+				recalculate_size(wl->window, 0);
+		}
+	}
+	RB_FOREACH(s, sessions, &sessions)
+		s->flags &= ~SESSION_RESIZE;
+
+	resize_indexed = 0;
+	resize_all = resize_pending = 0;
+}
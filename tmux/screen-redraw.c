@@ -27,9 +27,11 @@ static void	screen_redraw_draw_borders(struct screen_redraw_ctx *);
 static void	screen_redraw_draw_panes(struct screen_redraw_ctx *);
 static void	screen_redraw_draw_status(struct screen_redraw_ctx *);
 static void	screen_redraw_draw_pane(struct screen_redraw_ctx *,
-		    struct window_pane *);
+		    struct window_pane *, bitstr_t *);
 static void	screen_redraw_set_context(struct client *,
 		    struct screen_redraw_ctx *);
+static int	screen_redraw_clip(struct screen_redraw_ctx *,
+		    struct screen *, u_int, u_int *, u_int *, u_int *, u_int);
 
 #define CELL_INSIDE 0
 #define CELL_TOPBOTTOM 1
@@ -399,6 +401,81 @@ screen_redraw_check_is(u_int px, u_int py, int pane_status,
 	return (0);
 }
 
+/*
+ * Free the border map of a window so it is rebuilt when next needed. The pane
+ * status lines are drawn over the borders so they are also redrawn.
+ */
+void
+screen_redraw_free_borders(struct window *w)
+{
+	struct window_pane	*wp;
+
+	TAILQ_FOREACH(wp, &w->panes, entry) {
+		free(wp->status_text);
+		wp->status_text = NULL;
+	}
+
+	free(w->border_types);
+	w->border_types = NULL;
+	free(w->border_owners);
+	w->border_owners = NULL;
+}
+
+/*
+ * Build the border map of a window, holding the type of each cell and the
+ * pane it belongs to. This only changes with the layout, the pane status and
+ * the active pane, so it is kept until one of them changes rather than looking
+ * through every pane for every cell each time the borders are drawn.
+ */
+static void
+screen_redraw_make_borders(struct client *c, int pane_status)
+{
+	struct window		*w = c->session->curw->window;
+	struct window_pane	*active = server_client_get_pane(c), *wp;
+	u_int			 px, py, i;
+
+	if (w->border_types != NULL &&
+	    w->border_sx == w->sx &&
+	    w->border_sy == w->sy &&
+	    w->border_status == pane_status &&
+	    w->border_active == active)
+		return;
+	screen_redraw_free_borders(w);
+
+	w->border_sx = w->sx;
+	w->border_sy = w->sy;
+	w->border_status = pane_status;
+	w->border_active = active;
+
+	w->border_types = xreallocarray(NULL, w->sx + 1, w->sy + 1);
+	w->border_owners = xcalloc((size_t)(w->sx + 1) * (w->sy + 1),
+	    sizeof *w->border_owners);
+	for (py = 0; py <= w->sy; py++) {
+		for (px = 0; px <= w->sx; px++) {
+			i = py * (w->sx + 1) + px;
+			w->border_types[i] = screen_redraw_check_cell(c, px, py,
+			    pane_status, &wp);
+			w->border_owners[i] = wp;
+		}
+	}
+}
+
+/* Look up a cell in the border map. */
+static int
+screen_redraw_get_cell(struct window *w, u_int px, u_int py,
+    struct window_pane **wpp)
+{
+	u_int	i;
+
+	if (px > w->border_sx || py > w->border_sy) {
+		*wpp = NULL;
+		return (CELL_OUTSIDE);
+	}
+	i = py * (w->border_sx + 1) + px;
+	*wpp = w->border_owners[i];
+	return (w->border_types[i]);
+}
+
 /* Update pane status. */
 static int
 screen_redraw_make_pane_status(struct client *c, struct window_pane *wp,
@@ -424,11 +501,29 @@ screen_redraw_make_pane_status(struct client *c, struct window_pane *wp,
 	fmt = options_get_string(w->options, "pane-border-format");
 
 	expanded = format_expand_time(ft, fmt);
+	format_free(ft);
 	if (wp->sx < 4)
 		wp->status_size = width = 0;
 	else
 		wp->status_size = width = wp->sx - 4;
 
+	/*
+	 * If the expanded format, style and border lines are the same as last
+	 * time and the layout has not changed, the status line is unchanged.
+	 */
+	if (wp->status_text != NULL &&
+	    strcmp(expanded, wp->status_text) == 0 &&
+	    grid_cells_equal(&gc, &wp->status_gc) &&
+	    gc.us == wp->status_gc.us &&
+	    pane_lines == wp->status_lines) {
+		free(expanded);
+		return (0);
+	}
+	free(wp->status_text);
+	wp->status_text = xstrdup(expanded);
+	memcpy(&wp->status_gc, &gc, sizeof wp->status_gc);
+	wp->status_lines = pane_lines;
+
 	memcpy(&old, &wp->status_screen, sizeof old);
 	screen_init(&wp->status_screen, width, 1, 0);
 	wp->status_screen.mode = 0;
@@ -452,7 +547,6 @@ screen_redraw_make_pane_status(struct client *c, struct window_pane *wp,
 	screen_write_stop(&ctx);
 
 	free(expanded);
-	format_free(ft);
 
 	if (grid_compare(wp->status_screen.grid, old.grid) == 0) {
 		screen_free(&old);
@@ -462,16 +556,21 @@ screen_redraw_make_pane_status(struct client *c, struct window_pane *wp,
 	return (1);
 }
 
-/* Draw pane status. */
+/*
+ * Draw pane status. If cells is not NULL, the status lines are put into it
+ * instead of drawn to the terminal.
+ */
 static void
-screen_redraw_draw_pane_status(struct screen_redraw_ctx *ctx)
+screen_redraw_draw_pane_status(struct screen_redraw_ctx *ctx,
+    struct grid_cell *cells)
 {
 	struct client		*c = ctx->c;
 	struct window		*w = c->session->curw->window;
 	struct tty		*tty = &c->tty;
 	struct window_pane	*wp;
 	struct screen		*s;
-	u_int			 i, x, width, xoff, yoff, size;
+	struct grid_cell	*gc;
+	u_int			 i, j, x, width, xoff, yoff, size;
 
 	log_debug("%s: %s @%u", __func__, c->name, w->id);
 
@@ -517,21 +616,32 @@ screen_redraw_draw_pane_status(struct screen_redraw_ctx *ctx)
 
 		if (ctx->statustop)
 			yoff += ctx->statuslines;
+		if (!screen_redraw_clip(ctx, s, 0, &i, &width, &x,
+		    yoff - ctx->oy))
+			continue;
+		if (cells != NULL) {
+			gc = &cells[(yoff - ctx->oy) * tty->sx + x];
+			for (j = 0; j < width; j++)
+				grid_view_get_cell(s->grid, i + j, 0, &gc[j]);
+			continue;
+		}
 		tty_draw_line(tty, s, i, 0, width, x, yoff - ctx->oy,
 		    &grid_default_cell, NULL);
 	}
-	tty_cursor(tty, 0, 0);
+	if (cells == NULL)
+		tty_cursor(tty, 0, 0);
 }
 
 /* Update status line and change flags if unchanged. */
-static int
-screen_redraw_update(struct client *c, int flags)
+static uint64_t
+screen_redraw_update(struct client *c, uint64_t flags)
 {
 	struct window		*w = c->session->curw->window;
 	struct window_pane	*wp;
 	struct options		*wo = w->options;
 	int			 redraw, lines;
 	struct screen_redraw_ctx ctx;
+	uint64_t		 start = get_timer_usec();
 
 	if (c->message_string != NULL)
 		redraw = status_message_redraw(c);
@@ -539,6 +649,7 @@ screen_redraw_update(struct client *c, int flags)
 		redraw = status_prompt_redraw(c);
 	else
 		redraw = status_redraw(c);
+	server_client_add_timing(c, CLIENT_TIMING_STATUS, start);
 	if (!redraw && (~flags & CLIENT_REDRAWSTATUSALWAYS))
 		flags &= ~CLIENT_REDRAWSTATUS;
 
@@ -589,20 +700,161 @@ screen_redraw_set_context(struct client *c, struct screen_redraw_ctx *ctx)
 	    ctx->statustop);
 }
 
+/*
+ * Narrow a line about to be drawn to the region being redrawn, without
+ * splitting wide characters at either edge. Returns 0 if none of the line is
+ * inside the region.
+ */
+static int
+screen_redraw_clip(struct screen_redraw_ctx *ctx, struct screen *s, u_int py,
+    u_int *px, u_int *nx, u_int *atx, u_int aty)
+{
+	struct grid_cell	gc;
+	u_int			skip, extra, width;
+
+	if (!ctx->clipped)
+		return (1);
+	if (aty < ctx->ry || aty >= ctx->ry + ctx->rsy)
+		return (0);
+
+	width = *nx;
+	if (width > screen_size_x(s) - *px)
+		width = screen_size_x(s) - *px;
+	if (*atx >= ctx->rx + ctx->rsx || *atx + width <= ctx->rx)
+		return (0);
+
+	if (*atx < ctx->rx) {
+		for (skip = ctx->rx - *atx; skip != 0; skip--) {
+			grid_view_get_cell(s->grid, *px + skip, py, &gc);
+			if (~gc.flags & GRID_FLAG_PADDING)
+				break;
+		}
+		*px += skip;
+		*atx += skip;
+		width -= skip;
+	}
+	if (*atx + width > ctx->rx + ctx->rsx) {
+		skip = *atx + width - (ctx->rx + ctx->rsx);
+		grid_view_get_cell(s->grid, *px + width - skip - 1, py, &gc);
+		if (gc.data.width > 1) {
+			extra = gc.data.width - 1;
+			skip = (extra < skip) ? skip - extra : 0;
+		}
+		width -= skip;
+	}
+	*nx = width;
+	return (1);
+}
+
+/*
+ * Redraw the region left by an overlay, except for anything already redrawn
+ * in full.
+ */
+static void
+screen_redraw_draw_region(struct screen_redraw_ctx *ctx, uint64_t flags)
+{
+	struct client	*c = ctx->c;
+
+	ctx->clipped = 1;
+	ctx->rx = c->region_px;
+	ctx->ry = c->region_py;
+	ctx->rsx = c->region_sx;
+	ctx->rsy = c->region_sy;
+
+	if (~flags & CLIENT_REDRAWBORDERS) {
+		if (ctx->pane_status != PANE_STATUS_OFF)
+			screen_redraw_draw_pane_status(ctx, NULL);
+		screen_redraw_draw_borders(ctx);
+	}
+	screen_redraw_draw_panes(ctx);
+	if (ctx->statuslines != 0 &&
+	    (~flags & (CLIENT_REDRAWSTATUS|CLIENT_REDRAWSTATUSALWAYS)))
+		screen_redraw_draw_status(ctx);
+
+	ctx->clipped = 0;
+}
+
+/*
+ * Can a redraw of this client be shared with other clients? Only redraws of
+ * the whole window without an overlay, message or prompt are shared, and only
+ * if other clients are attached to the session.
+ */
+static int
+screen_redraw_can_share(struct client *c, uint64_t flags)
+{
+	if (c->session->attached < 2)
+		return (0);
+	if (~flags & CLIENT_REDRAWWINDOW)
+		return (0);
+	if (c->overlay_draw != NULL || c->overlay_check != NULL)
+		return (0);
+	return (c->status.active == &c->status.screen);
+}
+
+/*
+ * Copy the redraw of another client attached to the same session if it was of
+ * the same terminal, in the same state and drawing the same status line.
+ * Returns 1 if copied.
+ */
+static int
+screen_redraw_copy(struct client *c, uint64_t flags)
+{
+	struct client	*loop = c->session->redraw_client;
+	u_int		 lines = status_line_size(c);
+
+	if (loop == NULL || loop == c || loop->session != c->session)
+		return (0);
+	if (!screen_redraw_can_share(c, flags) || loop->redraw_flags != flags)
+		return (0);
+	if (!tty_term_equal(c->tty.term, loop->tty.term))
+		return (0);
+	if (lines != status_line_size(loop))
+		return (0);
+	if (lines != 0 &&
+	    grid_compare(c->status.screen.grid, loop->status.screen.grid) != 0)
+		return (0);
+	if (tty_state_hash(&c->tty) != loop->redraw_hash)
+		return (0);
+
+	log_debug("%s: copying redraw from %s", c->name, loop->name);
+	tty_copy_output(&c->tty, &loop->tty, loop->redraw_offset);
+	tty_copy_state(&c->tty, &loop->tty);
+	c->flags &= ~CLIENT_OVERLAYMISSED;
+	return (1);
+}
+
 /* Redraw entire screen. */
 void
 screen_redraw_screen(struct client *c)
 {
 	struct screen_redraw_ctx	ctx;
-	int				flags;
+	uint64_t			flags, start;
+	int				share;
 
 	if (c->flags & CLIENT_SUSPENDED)
 		return;
+	start = get_timer_usec();
 
 	flags = screen_redraw_update(c, c->flags);
 	if ((flags & CLIENT_ALLREDRAWFLAGS) == 0)
 		return;
 
+	/*
+	 * If the redraw may be shared, keep the state of the terminal before
+	 * drawing and where the output starts, so other clients can use it.
+	 */
+	share = screen_redraw_can_share(c, flags);
+	if (share) {
+		if (screen_redraw_copy(c, flags)) {
+			server_client_add_timing(c, CLIENT_TIMING_SCREEN,
+			    start);
+			return;
+		}
+		c->redraw_flags = flags;
+		c->redraw_hash = tty_state_hash(&c->tty);
+		c->redraw_offset = tty_pending(&c->tty);
+	}
+
 	screen_redraw_set_context(c, &ctx);
 	tty_sync_start(&c->tty);
 	tty_update_mode(&c->tty, c->tty.mode, NULL);
@@ -610,40 +862,54 @@ screen_redraw_screen(struct client *c)
 	if (flags & (CLIENT_REDRAWWINDOW|CLIENT_REDRAWBORDERS)) {
 		log_debug("%s: redrawing borders", c->name);
 		if (ctx.pane_status != PANE_STATUS_OFF)
-			screen_redraw_draw_pane_status(&ctx);
+			screen_redraw_draw_pane_status(&ctx, NULL);
 		screen_redraw_draw_borders(&ctx);
 	}
 	if (flags & CLIENT_REDRAWWINDOW) {
 		log_debug("%s: redrawing panes", c->name);
 		screen_redraw_draw_panes(&ctx);
+		c->flags &= ~CLIENT_OVERLAYMISSED;
 	}
 	if (ctx.statuslines != 0 &&
 	    (flags & (CLIENT_REDRAWSTATUS|CLIENT_REDRAWSTATUSALWAYS))) {
 		log_debug("%s: redrawing status", c->name);
 		screen_redraw_draw_status(&ctx);
 	}
+	if ((flags & (CLIENT_REDRAWREGION|CLIENT_REDRAWWINDOW)) ==
+	    CLIENT_REDRAWREGION) {
+		log_debug("%s: redrawing region %u,%u %ux%u", c->name,
+		    c->region_px, c->region_py, c->region_sx, c->region_sy);
+		screen_redraw_draw_region(&ctx, flags);
+	}
 	if (c->overlay_draw != NULL && (flags & CLIENT_REDRAWOVERLAY)) {
 		log_debug("%s: redrawing overlay", c->name);
 		c->overlay_draw(c, &ctx);
 	}
 
 	tty_reset(&c->tty);
+	if (share && (~c->tty.flags & TTY_BLOCK))
+		c->session->redraw_client = c;
+	server_client_add_timing(c, CLIENT_TIMING_SCREEN, start);
 }
 
-/* Redraw a single pane. */
+/* Redraw a single pane, or only the lines set in damage if not NULL. */
 void
-screen_redraw_pane(struct client *c, struct window_pane *wp)
+screen_redraw_pane(struct client *c, struct window_pane *wp, bitstr_t *damage)
 {
 	struct screen_redraw_ctx	 ctx;
 
-	if (c->overlay_draw != NULL || !window_pane_visible(wp))
+	if (!window_pane_visible(wp))
+		return;
+	if (c->overlay_draw != NULL) {
+		c->flags |= CLIENT_OVERLAYMISSED;
 		return;
+	}
 
 	screen_redraw_set_context(c, &ctx);
 	tty_sync_start(&c->tty);
 	tty_update_mode(&c->tty, c->tty.mode, NULL);
 
-	screen_redraw_draw_pane(&ctx, wp);
+	screen_redraw_draw_pane(&ctx, wp, damage);
 
 	tty_reset(&c->tty);
 }
@@ -690,7 +956,7 @@ screen_redraw_draw_borders_cell(struct screen_redraw_ctx *ctx, u_int i, u_int j)
 	if (c->overlay_check != NULL && !c->overlay_check(c, x, y))
 		return;
 
-	cell_type = screen_redraw_check_cell(c, x, y, pane_status, &wp);
+	cell_type = screen_redraw_get_cell(s->curw->window, x, y, &wp);
 	if (cell_type == CELL_INSIDE)
 		return;
 
@@ -734,15 +1000,32 @@ screen_redraw_draw_borders(struct screen_redraw_ctx *ctx)
 	struct session		*s = c->session;
 	struct window		*w = s->curw->window;
 	struct window_pane	*wp;
-	u_int		 	 i, j;
+	u_int		 	 i, j, sx, sy, x = 0, y = 0, top = 0;
 
 	log_debug("%s: %s @%u", __func__, c->name, w->id);
 
 	TAILQ_FOREACH(wp, &w->panes, entry)
 		wp->border_gc_set = 0;
+	screen_redraw_make_borders(c, ctx->pane_status);
+
+	sx = c->tty.sx;
+	sy = c->tty.sy - ctx->statuslines;
+	if (ctx->clipped) {
+		if (ctx->statustop)
+			top = ctx->statuslines;
+		if (ctx->ry + ctx->rsy <= top)
+			return;
+		if (ctx->ry > top)
+			y = ctx->ry - top;
+		if (ctx->ry + ctx->rsy - top < sy)
+			sy = ctx->ry + ctx->rsy - top;
+		x = ctx->rx;
+		if (ctx->rx + ctx->rsx < sx)
+			sx = ctx->rx + ctx->rsx;
+	}
 
-	for (j = 0; j < c->tty.sy - ctx->statuslines; j++) {
-		for (i = 0; i < c->tty.sx; i++)
+	for (j = y; j < sy; j++) {
+		for (i = x; i < sx; i++)
 			screen_redraw_draw_borders_cell(ctx, i, j);
 	}
 }
@@ -759,7 +1042,7 @@ screen_redraw_draw_panes(struct screen_redraw_ctx *ctx)
 
 	TAILQ_FOREACH(wp, &w->panes, entry) {
 		if (window_pane_visible(wp))
-			screen_redraw_draw_pane(ctx, wp);
+			screen_redraw_draw_pane(ctx, wp, NULL);
 	}
 }
 
@@ -771,7 +1054,7 @@ screen_redraw_draw_status(struct screen_redraw_ctx *ctx)
 	struct window	*w = c->session->curw->window;
 	struct tty	*tty = &c->tty;
 	struct screen	*s = c->status.active;
-	u_int		 i, y;
+	u_int		 i, y, px, nx, atx;
 
 	log_debug("%s: %s @%u", __func__, c->name, w->id);
 
@@ -780,14 +1063,19 @@ screen_redraw_draw_status(struct screen_redraw_ctx *ctx)
 	else
 		y = c->tty.sy - ctx->statuslines;
 	for (i = 0; i < ctx->statuslines; i++) {
-		tty_draw_line(tty, s, 0, i, UINT_MAX, 0, y + i,
+		px = atx = 0;
+		nx = UINT_MAX;
+		if (!screen_redraw_clip(ctx, s, i, &px, &nx, &atx, y + i))
+			continue;
+		tty_draw_line(tty, s, px, i, nx, atx, y + i,
 		    &grid_default_cell, NULL);
 	}
 }
 
 /* Draw one pane. */
 static void
-screen_redraw_draw_pane(struct screen_redraw_ctx *ctx, struct window_pane *wp)
+screen_redraw_draw_pane(struct screen_redraw_ctx *ctx, struct window_pane *wp,
+    bitstr_t *damage)
 {
 	struct client	*c = ctx->c;
 	struct window	*w = c->session->curw->window;
@@ -809,6 +1097,8 @@ screen_redraw_draw_pane(struct screen_redraw_ctx *ctx, struct window_pane *wp)
 	for (j = 0; j < wp->sy; j++) {
 		if (wp->yoff + j < ctx->oy || wp->yoff + j >= ctx->oy + ctx->sy)
 			continue;
+		if (damage != NULL && !bit_test(damage, j))
+			continue;
 		y = top + wp->yoff + j - ctx->oy;
 
 		if (wp->xoff >= ctx->ox &&
@@ -834,6 +1124,8 @@ screen_redraw_draw_pane(struct screen_redraw_ctx *ctx, struct window_pane *wp)
 			x = wp->xoff - ctx->ox;
 			width = ctx->sx - x;
 		}
+		if (!screen_redraw_clip(ctx, s, j, &i, &width, &x, y))
+			continue;
 		log_debug("%s: %s %%%u line %u,%u at %u,%u, width %u",
 		    __func__, c->name, wp->id, i, j, x, y, width);
 
@@ -842,3 +1134,129 @@ screen_redraw_draw_pane(struct screen_redraw_ctx *ctx, struct window_pane *wp)
 		    wp->palette);
 	}
 }
+
+/* Get the cell at a position in the window for a client. */
+static void
+screen_redraw_compose_cell(struct screen_redraw_ctx *ctx, u_int i, u_int j,
+    struct grid_cell *gc)
+{
+	struct client		*c = ctx->c;
+	struct session		*s = c->session;
+	struct window_pane	*wp;
+	struct grid_cell	 defaults;
+	u_int			 cell_type, x = ctx->ox + i, y = ctx->oy + j;
+	int			 colour;
+	const struct grid_cell	*tmp;
+
+	cell_type = screen_redraw_get_cell(s->curw->window, x, y, &wp);
+	if (cell_type == CELL_INSIDE) {
+		if (wp == NULL ||
+		    x < wp->xoff || x - wp->xoff >= screen_size_x(wp->screen) ||
+		    y < wp->yoff || y - wp->yoff >= screen_size_y(wp->screen)) {
+			memcpy(gc, &grid_default_cell, sizeof *gc);
+			return;
+		}
+		grid_view_get_cell(wp->screen->grid, x - wp->xoff, y - wp->yoff,
+		    gc);
+		if (gc->flags & GRID_FLAG_SELECTED) {
+			memcpy(&defaults, gc, sizeof defaults);
+			screen_select_cell(wp->screen, gc, &defaults);
+		}
+
+		tty_default_colours(&defaults, wp);
+		if (COLOUR_DEFAULT(gc->fg))
+			gc->fg = defaults.fg;
+		if (COLOUR_DEFAULT(gc->bg))
+			gc->bg = defaults.bg;
+		if (~gc->flags & GRID_FLAG_NOPALETTE) {
+			colour = gc->fg;
+			if (colour < 8 && (gc->attr & GRID_ATTR_BRIGHT))
+				colour += 90;
+			colour = tty_get_palette(wp->palette, colour);
+			if (colour != -1)
+				gc->fg = colour;
+			colour = tty_get_palette(wp->palette, gc->bg);
+			if (colour != -1)
+				gc->bg = colour;
+		}
+		return;
+	}
+
+	if (wp == NULL)
+		memcpy(gc, &grid_default_cell, sizeof *gc);
+	else {
+		tmp = screen_redraw_draw_borders_style(ctx, x, y, wp);
+		memcpy(gc, tmp, sizeof *gc);
+		if (server_is_marked(s, s->curw, marked_pane.wp) &&
+		    screen_redraw_check_is(x, y, ctx->pane_status,
+		    marked_pane.wp))
+			gc->attr ^= GRID_ATTR_REVERSE;
+	}
+	screen_redraw_border_set(wp, ctx->pane_lines, cell_type, gc);
+}
+
+/*
+ * Build the whole screen for a client into an array of cells, one row after
+ * another, for clients which encode their own output. Overlays are not
+ * included.
+ */
+void
+screen_redraw_compose(struct client *c, struct grid_cell *cells)
+{
+	struct screen_redraw_ctx	 ctx;
+	struct window			*w = c->session->curw->window;
+	struct window_pane		*wp;
+	struct screen			*s = c->status.active;
+	struct grid_cell		*gc;
+	const char			*acs;
+	u_int				 i, j, y, top, sy;
+
+	screen_redraw_update(c, c->flags);
+	screen_redraw_set_context(c, &ctx);
+
+	TAILQ_FOREACH(wp, &w->panes, entry)
+		wp->border_gc_set = 0;
+	screen_redraw_make_borders(c, ctx.pane_status);
+
+	if (ctx.statustop)
+		top = ctx.statuslines;
+	else
+		top = 0;
+	sy = c->tty.sy - ctx.statuslines;
+
+	for (j = 0; j < c->tty.sy; j++) {
+		for (i = 0; i < c->tty.sx; i++) {
+			gc = &cells[j * c->tty.sx + i];
+			if (j >= top && j - top < sy) {
+				screen_redraw_compose_cell(&ctx, i, j - top, gc);
+				continue;
+			}
+			if (j < top)
+				y = j;
+			else
+				y = j - sy;
+			if (i < screen_size_x(s) && y < screen_size_y(s))
+				grid_view_get_cell(s->grid, i, y, gc);
+			else
+				memcpy(gc, &grid_default_cell, sizeof *gc);
+		}
+	}
+	if (ctx.pane_status != PANE_STATUS_OFF)
+		screen_redraw_draw_pane_status(&ctx, cells);
+
+	/* Line drawing is sent as UTF-8 unless the terminal needs ACS. */
+	if (tty_acs_needed(&c->tty))
+		return;
+	for (i = 0; i < c->tty.sx * c->tty.sy; i++) {
+		gc = &cells[i];
+		if (~gc->attr & GRID_ATTR_CHARSET)
+			continue;
+		acs = tty_acs_get(&c->tty, *gc->data.data);
+		if (acs != NULL && strlen(acs) <= UTF8_SIZE) {
+			gc->data.size = gc->data.have = strlen(acs);
+			memcpy(gc->data.data, acs, gc->data.size);
+			gc->data.width = 1;
+			gc->attr &= ~GRID_ATTR_CHARSET;
+		}
+	}
+}
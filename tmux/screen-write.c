@@ -18,13 +18,17 @@
 
 #include <sys/types.h>
 
+#include <netinet/in.h>
+
+#include <resolv.h>
 #include <stdlib.h>
 #include <string.h>
 
+#define XMALLOC_TAG XMALLOC_GRID
 #include "tmux.h"
 
-static struct screen_write_citem *screen_write_collect_trim(
-		    struct screen_write_ctx *, u_int, u_int, u_int, int *);
+static u_int	screen_write_collect_trim(struct screen_write_ctx *, u_int,
+		    u_int, u_int, int *);
 static void	screen_write_collect_clear(struct screen_write_ctx *, u_int,
 		    u_int);
 static void	screen_write_collect_scroll(struct screen_write_ctx *, u_int);
@@ -32,7 +36,7 @@ static void	screen_write_collect_flush(struct screen_write_ctx *, int,
 		    const char *);
 
 static int	screen_write_overwrite(struct screen_write_ctx *,
-		    struct grid_cell *, u_int);
+		    const struct grid_char *, u_int);
 static const struct grid_cell *screen_write_combine(struct screen_write_ctx *,
 		    const struct utf8_data *, u_int *);
 
@@ -45,34 +49,75 @@ struct screen_write_citem {
 	u_int				bg;
 
 	struct grid_cell		gc;
-
-	TAILQ_ENTRY(screen_write_citem) entry;
 };
+
+/*
+ * Items collected for each line are kept in an array in order of x position,
+ * so trimming and flushing are a scan over it. The array is kept when the line
+ * is flushed so it does not need to be allocated again.
+ */
 struct screen_write_cline {
 	char				*data;
-	TAILQ_HEAD(, screen_write_citem) items;
+
+	struct screen_write_citem	*items;
+	u_int				 count;
+	u_int				 space;
 };
-TAILQ_HEAD(, screen_write_citem)  screen_write_citem_freelist =
-    TAILQ_HEAD_INITIALIZER(screen_write_citem_freelist);
+
+/* Spare item for the next context, to save allocating for every write. */
+static struct screen_write_citem *screen_write_citem_spare;
 
 static struct screen_write_citem *
 screen_write_get_citem(void)
 {
-    struct screen_write_citem	*ci;
+	struct screen_write_citem	*ci;
 
-    ci = TAILQ_FIRST(&screen_write_citem_freelist);
-    if (ci != NULL) {
-        TAILQ_REMOVE(&screen_write_citem_freelist, ci, entry);
-        memset(ci, 0, sizeof *ci);
-        return (ci);
-    }
-    return (xcalloc(1, sizeof *ci));
+	ci = screen_write_citem_spare;
+	if (ci != NULL) {
+		screen_write_citem_spare = NULL;
+		memset(ci, 0, sizeof *ci);
+		return (ci);
+	}
+	return (xcalloc(1, sizeof *ci));
 }
 
 static void
 screen_write_free_citem(struct screen_write_citem *ci)
 {
-    TAILQ_INSERT_TAIL(&screen_write_citem_freelist, ci, entry);
+	if (screen_write_citem_spare == NULL)
+		screen_write_citem_spare = ci;
+	else
+		free(ci);
+}
+
+/*
+ * Get the collected line for a line of the screen. The lines are a ring
+ * starting at write_first, so scrolling the whole screen only moves the start.
+ */
+static struct screen_write_cline *
+screen_write_get_cline(struct screen *s, u_int y)
+{
+	return (&s->write_list[(s->write_first + y) % screen_size_y(s)]);
+}
+
+/* Insert an empty item into a collected line and return it. */
+static struct screen_write_citem *
+screen_write_insert_citem(struct screen_write_cline *cl, u_int idx)
+{
+	struct screen_write_citem	*ci;
+
+	if (cl->count == cl->space) {
+		cl->space = (cl->space == 0) ? 8 : cl->space * 2;
+		cl->items = xreallocarray(cl->items, cl->space,
+		    sizeof *cl->items);
+	}
+	ci = &cl->items[idx];
+	if (idx != cl->count)
+		memmove(ci + 1, ci, (cl->count - idx) * sizeof *ci);
+	cl->count++;
+
+	memset(ci, 0, sizeof *ci);
+	return (ci);
 }
 
 static void
@@ -126,6 +171,18 @@ screen_write_redraw_cb(const struct tty_ctx *ttyctx)
 		wp->flags |= PANE_REDRAW;
 }
 
+/* Mark lines to be redrawn rather than drawing them now. */
+static void
+screen_write_damage_cb(const struct tty_ctx *ttyctx, u_int py, u_int ny)
+{
+	struct window_pane	*wp = ttyctx->arg;
+
+	if (wp != NULL) {
+		window_pane_damage(wp, py, ny);
+		wp->flags |= PANE_DAMAGED;
+	}
+}
+
 /* Update context for client. */
 static int
 screen_write_set_client_cb(struct tty_ctx *ttyctx, struct client *c)
@@ -162,6 +219,19 @@ screen_write_set_client_cb(struct tty_ctx *ttyctx, struct client *c)
 	return (1);
 }
 
+/*
+ * Mark lines of a coalesced pane to be redrawn. Lines of any pane which are
+ * changed are no longer known to be what was last redrawn.
+ */
+static void
+screen_write_damage(struct screen_write_ctx *ctx, u_int py, u_int ny)
+{
+	if (ctx->wp != NULL)
+		window_pane_forget_lines(ctx->wp, py, ny);
+	if (ctx->flags & SCREEN_WRITE_DAMAGE)
+		window_pane_damage(ctx->wp, py, ny);
+}
+
 /* Set up context for TTY command. */
 static void
 screen_write_initctx(struct screen_write_ctx *ctx, struct tty_ctx *ttyctx,
@@ -171,6 +241,19 @@ screen_write_initctx(struct screen_write_ctx *ctx, struct tty_ctx *ttyctx,
 
 	memset(ttyctx, 0, sizeof *ttyctx);
 
+	/*
+	 * Mark the cursor line as changed, so if the pane is shown but its
+	 * output is being coalesced it is redrawn later; commands which change
+	 * more than that line mark the rest themselves. Nothing will be drawn
+	 * for a hidden pane, at most it is redrawn.
+	 */
+	screen_write_damage(ctx, s->cy, 1);
+	if (ctx->flags & SCREEN_WRITE_HIDDEN) {
+		ttyctx->redraw_cb = screen_write_redraw_cb;
+		ttyctx->arg = ctx->wp;
+		return;
+	}
+
 	if (ctx->wp != NULL) {
 		tty_default_colours(&ttyctx->defaults, ctx->wp);
 		ttyctx->palette = ctx->wp->palette;
@@ -193,7 +276,8 @@ screen_write_initctx(struct screen_write_ctx *ctx, struct tty_ctx *ttyctx,
 		ctx->init_ctx_cb(ctx, ttyctx);
 	else {
 		ttyctx->redraw_cb = screen_write_redraw_cb;
-		if (ctx->wp == NULL)
+		ttyctx->damage_cb = screen_write_damage_cb;
+		if (ctx->wp == NULL || (ctx->flags & SCREEN_WRITE_HIDDEN))
 			ttyctx->set_client_cb = NULL;
 		else
 			ttyctx->set_client_cb = screen_write_set_client_cb;
@@ -201,7 +285,7 @@ screen_write_initctx(struct screen_write_ctx *ctx, struct tty_ctx *ttyctx,
 	}
 
 	if (ctx->wp != NULL &&
-	    (~ctx->flags & SCREEN_WRITE_SYNC) &&
+	    (~ctx->flags & (SCREEN_WRITE_SYNC|SCREEN_WRITE_HIDDEN)) &&
 	    (sync || ctx->wp != ctx->wp->window->active)) {
 		tty_write(tty_cmd_syncstart, ttyctx);
 		ctx->flags |= SCREEN_WRITE_SYNC;
@@ -212,11 +296,8 @@ screen_write_initctx(struct screen_write_ctx *ctx, struct tty_ctx *ttyctx,
 void
 screen_write_make_list(struct screen *s)
 {
-	u_int	y;
-
 	s->write_list = xcalloc(screen_size_y(s), sizeof *s->write_list);
-	for (y = 0; y < screen_size_y(s); y++)
-		TAILQ_INIT(&s->write_list[y].items);
+	s->write_first = 0;
 }
 
 /* Free write list. */
@@ -225,8 +306,10 @@ screen_write_free_list(struct screen *s)
 {
 	u_int	y;
 
-	for (y = 0; y < screen_size_y(s); y++)
+	for (y = 0; y < screen_size_y(s); y++) {
 		free(s->write_list[y].data);
+		free(s->write_list[y].items);
+	}
 	free(s->write_list);
 }
 
@@ -246,6 +329,24 @@ screen_write_init(struct screen_write_ctx *ctx, struct screen *s)
 	ctx->bg = 8;
 }
 
+/*
+ * Check if a pane is on any client which could be drawn to, if not there is
+ * no need to try to write to any terminals.
+ */
+static int
+screen_write_pane_shown(struct window_pane *wp)
+{
+	struct client	*c;
+
+	if (wp->layout_cell == NULL)
+		return (0);
+	TAILQ_FOREACH(c, &clients, entry) {
+		if (tty_client_ready(c) && c->session->curw->window == wp->window)
+			return (1);
+	}
+	return (0);
+}
+
 /* Initialize writing with a pane. */
 void
 screen_write_start_pane(struct screen_write_ctx *ctx, struct window_pane *wp,
@@ -255,6 +356,10 @@ screen_write_start_pane(struct screen_write_ctx *ctx, struct window_pane *wp,
 		s = wp->screen;
 	screen_write_init(ctx, s);
 	ctx->wp = wp;
+	if (!screen_write_pane_shown(wp))
+		ctx->flags |= SCREEN_WRITE_HIDDEN;
+	else if (window_pane_scroll_coalesce(wp))
+		ctx->flags |= (SCREEN_WRITE_HIDDEN|SCREEN_WRITE_DAMAGE);
 
 	if (log_get_level() != 0) {
 		log_debug("%s: size %ux%u, pane %%%u (at %u,%u)",
@@ -921,6 +1026,7 @@ screen_write_alignmenttest(struct screen_write_ctx *ctx)
 	s->rlower = screen_size_y(s) - 1;
 
 	screen_write_initctx(ctx, &ttyctx, 1);
+	screen_write_damage(ctx, 0, screen_size_y(s));
 
 	screen_write_collect_clear(ctx, 0, screen_size_y(s) - 1);
 	tty_write(tty_cmd_alignmenttest, &ttyctx);
@@ -1028,6 +1134,7 @@ screen_write_insertline(struct screen_write_ctx *ctx, u_int ny, u_int bg)
 			return;
 
 		screen_write_initctx(ctx, &ttyctx, 1);
+		screen_write_damage(ctx, s->cy, screen_size_y(s) - s->cy);
 		ttyctx.bg = bg;
 
 		grid_view_insert_lines(gd, s->cy, ny, bg);
@@ -1044,6 +1151,7 @@ screen_write_insertline(struct screen_write_ctx *ctx, u_int ny, u_int bg)
 		return;
 
 	screen_write_initctx(ctx, &ttyctx, 1);
+	screen_write_damage(ctx, s->cy, s->rlower + 1 - s->cy);
 	ttyctx.bg = bg;
 
 	if (s->cy < s->rupper || s->cy > s->rlower)
@@ -1075,6 +1183,7 @@ screen_write_deleteline(struct screen_write_ctx *ctx, u_int ny, u_int bg)
 			return;
 
 		screen_write_initctx(ctx, &ttyctx, 1);
+		screen_write_damage(ctx, s->cy, screen_size_y(s) - s->cy);
 		ttyctx.bg = bg;
 
 		grid_view_delete_lines(gd, s->cy, ny, bg);
@@ -1091,6 +1200,7 @@ screen_write_deleteline(struct screen_write_ctx *ctx, u_int ny, u_int bg)
 		return;
 
 	screen_write_initctx(ctx, &ttyctx, 1);
+	screen_write_damage(ctx, s->cy, s->rlower + 1 - s->cy);
 	ttyctx.bg = bg;
 
 	if (s->cy < s->rupper || s->cy > s->rlower)
@@ -1110,7 +1220,7 @@ screen_write_clearline(struct screen_write_ctx *ctx, u_int bg)
 	struct screen			*s = ctx->s;
 	struct grid_line		*gl;
 	u_int				 sx = screen_size_x(s);
-	struct screen_write_citem	*ci = ctx->item;
+	struct screen_write_citem	*ci;
 
 	gl = grid_get_line(s->grid, s->grid->hsize + s->cy);
 	if (gl->cellsize == 0 && COLOUR_DEFAULT(bg))
@@ -1119,12 +1229,11 @@ screen_write_clearline(struct screen_write_ctx *ctx, u_int bg)
 	grid_view_clear(s->grid, 0, s->cy, sx, 1, bg);
 
 	screen_write_collect_clear(ctx, s->cy, 1);
+	ci = screen_write_insert_citem(screen_write_get_cline(s, s->cy), 0);
 	ci->x = 0;
 	ci->used = sx;
 	ci->type = CLEAR;
 	ci->bg = bg;
-	TAILQ_INSERT_TAIL(&ctx->s->write_list[s->cy].items, ci, entry);
-	ctx->item = screen_write_get_citem();
 }
 
 /* Clear to end of line from cursor. */
@@ -1133,8 +1242,8 @@ screen_write_clearendofline(struct screen_write_ctx *ctx, u_int bg)
 {
 	struct screen			*s = ctx->s;
 	struct grid_line		*gl;
-	u_int				 sx = screen_size_x(s);
-	struct screen_write_citem	*ci = ctx->item, *before;
+	u_int				 sx = screen_size_x(s), idx;
+	struct screen_write_citem	*ci;
 
 	if (s->cx == 0) {
 		screen_write_clearline(ctx, bg);
@@ -1147,16 +1256,12 @@ screen_write_clearendofline(struct screen_write_ctx *ctx, u_int bg)
 
 	grid_view_clear(s->grid, s->cx, s->cy, sx - s->cx, 1, bg);
 
- 	before = screen_write_collect_trim(ctx, s->cy, s->cx, sx - s->cx, NULL);
+	idx = screen_write_collect_trim(ctx, s->cy, s->cx, sx - s->cx, NULL);
+	ci = screen_write_insert_citem(screen_write_get_cline(s, s->cy), idx);
 	ci->x = s->cx;
 	ci->used = sx - s->cx;
 	ci->type = CLEAR;
 	ci->bg = bg;
-	if (before == NULL)
-		TAILQ_INSERT_TAIL(&ctx->s->write_list[s->cy].items, ci, entry);
-	else
-		TAILQ_INSERT_BEFORE(before, ci, entry);
-	ctx->item = screen_write_get_citem();
 }
 
 /* Clear to start of line from cursor. */
@@ -1164,8 +1269,8 @@ void
 screen_write_clearstartofline(struct screen_write_ctx *ctx, u_int bg)
 {
 	struct screen			 *s = ctx->s;
-	u_int				 sx = screen_size_x(s);
-	struct screen_write_citem	*ci = ctx->item, *before;
+	u_int				 sx = screen_size_x(s), idx;
+	struct screen_write_citem	*ci;
 
 	if (s->cx >= sx - 1) {
 		screen_write_clearline(ctx, bg);
@@ -1177,16 +1282,12 @@ screen_write_clearstartofline(struct screen_write_ctx *ctx, u_int bg)
 	else
 		grid_view_clear(s->grid, 0, s->cy, s->cx + 1, 1, bg);
 
-	before = screen_write_collect_trim(ctx, s->cy, 0, s->cx + 1, NULL);
+	idx = screen_write_collect_trim(ctx, s->cy, 0, s->cx + 1, NULL);
+	ci = screen_write_insert_citem(screen_write_get_cline(s, s->cy), idx);
 	ci->x = 0;
 	ci->used = s->cx + 1;
 	ci->type = CLEAR;
 	ci->bg = bg;
-	if (before == NULL)
-		TAILQ_INSERT_TAIL(&ctx->s->write_list[s->cy].items, ci, entry);
-	else
-		TAILQ_INSERT_BEFORE(before, ci, entry);
-	ctx->item = screen_write_get_citem();
 }
 
 /* Move cursor to px,py. */
@@ -1224,6 +1325,7 @@ screen_write_reverseindex(struct screen_write_ctx *ctx, u_int bg)
 		screen_write_collect_flush(ctx, 0, __func__);
 
 		screen_write_initctx(ctx, &ttyctx, 1);
+		screen_write_damage(ctx, s->rupper, s->rlower + 1 - s->rupper);
 		ttyctx.bg = bg;
 
 		tty_write(tty_cmd_reverseindex, &ttyctx);
@@ -1279,6 +1381,8 @@ screen_write_linefeed(struct screen_write_ctx *ctx, int wrapped, u_int bg)
 		grid_view_scroll_region_up(gd, s->rupper, s->rlower, bg);
 		screen_write_collect_scroll(ctx, bg);
 		ctx->scrolled++;
+		if (ctx->wp != NULL)
+			ctx->wp->scroll_lines++;
 	} else if (s->cy < screen_size_y(s) - 1)
 		screen_write_set_cursor(ctx, -1, s->cy + 1);
 }
@@ -1318,6 +1422,7 @@ screen_write_scrolldown(struct screen_write_ctx *ctx, u_int lines, u_int bg)
 	u_int		 i;
 
 	screen_write_initctx(ctx, &ttyctx, 1);
+	screen_write_damage(ctx, s->rupper, s->rlower + 1 - s->rupper);
 	ttyctx.bg = bg;
 
 	if (lines == 0)
@@ -1350,6 +1455,7 @@ screen_write_clearendofscreen(struct screen_write_ctx *ctx, u_int bg)
 	u_int		 sx = screen_size_x(s), sy = screen_size_y(s);
 
 	screen_write_initctx(ctx, &ttyctx, 1);
+	screen_write_damage(ctx, s->cy, sy - s->cy);
 	ttyctx.bg = bg;
 
 	/* Scroll into history if it is enabled and clearing entire screen. */
@@ -1375,6 +1481,7 @@ screen_write_clearstartofscreen(struct screen_write_ctx *ctx, u_int bg)
 	u_int		 sx = screen_size_x(s);
 
 	screen_write_initctx(ctx, &ttyctx, 1);
+	screen_write_damage(ctx, 0, s->cy + 1);
 	ttyctx.bg = bg;
 
 	if (s->cy > 0)
@@ -1398,6 +1505,7 @@ screen_write_clearscreen(struct screen_write_ctx *ctx, u_int bg)
 	u_int		 sx = screen_size_x(s), sy = screen_size_y(s);
 
 	screen_write_initctx(ctx, &ttyctx, 1);
+	screen_write_damage(ctx, 0, sy);
 	ttyctx.bg = bg;
 
 	/* Scroll into history if it is enabled. */
@@ -1417,103 +1525,85 @@ screen_write_clearhistory(struct screen_write_ctx *ctx)
 	grid_clear_history(ctx->s->grid);
 }
 
-/* Trim collected items. */
-static struct screen_write_citem *
+/*
+ * Trim collected items to make space for a new item from x to x + used - 1 and
+ * return where it should be inserted.
+ */
+static u_int
 screen_write_collect_trim(struct screen_write_ctx *ctx, u_int y, u_int x,
     u_int used, int *wrapped)
 {
-	struct screen_write_cline	*cl = &ctx->s->write_list[y];
-	struct screen_write_citem	*ci, *ci2, *tmp, *before = NULL;
+	struct screen_write_cline	*cl = screen_write_get_cline(ctx->s, y);
+	struct screen_write_citem	*ci, *ci2;
 	u_int				 sx = x, ex = x + used - 1;
-	u_int				 csx, cex;
-
-	if (TAILQ_EMPTY(&cl->items))
-		return (NULL);
-	TAILQ_FOREACH_SAFE(ci, &cl->items, entry, tmp) {
-		csx = ci->x;
-		cex = ci->x + ci->used - 1;
-
-		/* Item is entirely before. */
-		if (cex < sx) {
-			log_debug("%s: %p %u-%u before %u-%u", __func__, ci,
-			    csx, cex, sx, ex);
-			continue;
-		}
+	u_int				 csx, cex, i, j;
 
-		/* Item is entirely after. */
-		if (csx > ex) {
-			log_debug("%s: %p %u-%u after %u-%u", __func__, ci,
-			    csx, cex, sx, ex);
-			before = ci;
+	/* Skip items entirely before. */
+	for (i = 0; i < cl->count; i++) {
+		ci = &cl->items[i];
+		if (ci->x + ci->used - 1 >= sx)
 			break;
-		}
-
-		/* Item is entirely inside. */
-		if (csx >= sx && cex <= ex) {
-			log_debug("%s: %p %u-%u inside %u-%u", __func__, ci,
-			    csx, cex, sx, ex);
-			TAILQ_REMOVE(&cl->items, ci, entry);
-			screen_write_free_citem(ci);
-			if (csx == 0 && ci->wrapped && wrapped != NULL)
-				*wrapped = 1;
-			continue;
-		}
-
-		/* Item under the start. */
-		if (csx < sx && cex >= sx && cex <= ex) {
-			log_debug("%s: %p %u-%u start %u-%u", __func__, ci,
-			    csx, cex, sx, ex);
+	}
+	if (i == cl->count)
+		return (i);
+
+	/* Item under the start, which may also cover the end. */
+	ci = &cl->items[i];
+	csx = ci->x;
+	cex = ci->x + ci->used - 1;
+	if (csx < sx) {
+		if (cex > ex) {
+			log_debug("%s: %u-%u under %u-%u", __func__, csx, cex,
+			    sx, ex);
+			ci2 = screen_write_insert_citem(cl, i + 1);
+			ci = &cl->items[i]; /* may have moved */
+			ci2->type = ci->type;
+			ci2->bg = ci->bg;
+			memcpy(&ci2->gc, &ci->gc, sizeof ci2->gc);
+			ci2->x = ex + 1;
+			ci2->used = cex - ex;
 			ci->used = sx - csx;
-			log_debug("%s: %p now %u-%u", __func__, ci, ci->x,
-			    ci->x + ci->used + 1);
-			continue;
+			return (i + 1);
 		}
+		log_debug("%s: %u-%u start %u-%u", __func__, csx, cex, sx, ex);
+		ci->used = sx - csx;
+		i++;
+	}
 
-		/* Item covers the end. */
-		if (cex > ex && csx >= sx && csx <= ex) {
-			log_debug("%s: %p %u-%u end %u-%u", __func__, ci,
-			    csx, cex, sx, ex);
-			ci->x = ex + 1;
-			ci->used = cex - ex;
-			log_debug("%s: %p now %u-%u", __func__, ci, ci->x,
-			    ci->x + ci->used + 1);
-			before = ci;
+	/* Remove items entirely inside. */
+	for (j = i; j < cl->count; j++) {
+		ci = &cl->items[j];
+		if (ci->x + ci->used - 1 > ex)
 			break;
-		}
-
-		/* Item must cover both sides. */
-		log_debug("%s: %p %u-%u under %u-%u", __func__, ci,
-		    csx, cex, sx, ex);
-		ci2 = screen_write_get_citem();
-		ci2->type = ci->type;
-		ci2->bg = ci->bg;
-		memcpy(&ci2->gc, &ci->gc, sizeof ci2->gc);
-		TAILQ_INSERT_AFTER(&cl->items, ci, ci2, entry);
-
-		ci->used = sx - csx;
-		ci2->x = ex + 1;
-		ci2->used = cex - ex;
+		if (ci->x == 0 && ci->wrapped && wrapped != NULL)
+			*wrapped = 1;
+	}
+	if (j != i) {
+		log_debug("%s: %u inside %u-%u", __func__, j - i, sx, ex);
+		memmove(&cl->items[i], &cl->items[j],
+		    (cl->count - j) * sizeof *cl->items);
+		cl->count -= j - i;
+	}
 
-		log_debug("%s: %p now %u-%u (%p) and %u-%u (%p)", __func__, ci,
-		    ci->x, ci->x + ci->used - 1, ci, ci2->x,
-		    ci2->x + ci2->used - 1, ci2);
-		before = ci2;
-		break;
+	/* Item covering the end. */
+	if (i != cl->count && cl->items[i].x <= ex) {
+		ci = &cl->items[i];
+		cex = ci->x + ci->used - 1;
+		log_debug("%s: %u-%u end %u-%u", __func__, ci->x, cex, sx, ex);
+		ci->x = ex + 1;
+		ci->used = cex - ex;
 	}
-	return (before);
+	return (i);
 }
 
 /* Clear collected lines. */
 static void
 screen_write_collect_clear(struct screen_write_ctx *ctx, u_int y, u_int n)
 {
-	struct screen_write_cline	*cl;
-	u_int				 i;
+	u_int	i;
 
-	for (i = y; i < y + n; i++) {
-		cl = &ctx->s->write_list[i];
-		TAILQ_CONCAT(&screen_write_citem_freelist, &cl->items, entry);
-	}
+	for (i = y; i < y + n; i++)
+		screen_write_get_cline(ctx->s, i)->count = 0;
 }
 
 /* Scroll collected lines up. */
@@ -1521,29 +1611,70 @@ static void
 screen_write_collect_scroll(struct screen_write_ctx *ctx, u_int bg)
 {
 	struct screen			*s = ctx->s;
-	struct screen_write_cline	*cl;
-	u_int				 y;
-	char				*saved;
+	struct screen_write_cline	 saved;
 	struct screen_write_citem	*ci;
+	u_int				 y;
 
 	log_debug("%s: at %u,%u (region %u-%u)", __func__, s->cx, s->cy,
 	    s->rupper, s->rlower);
 
+	/*
+	 * The top line is cleared and becomes the bottom line. If the region
+	 * is the whole screen, this is only a move of the start of the ring.
+	 */
 	screen_write_collect_clear(ctx, s->rupper, 1);
-	saved = ctx->s->write_list[s->rupper].data;
-	for (y = s->rupper; y < s->rlower; y++) {
-		cl = &ctx->s->write_list[y + 1];
-		TAILQ_CONCAT(&ctx->s->write_list[y].items, &cl->items, entry);
-		ctx->s->write_list[y].data = cl->data;
+	if (s->rupper == 0 && s->rlower == screen_size_y(s) - 1)
+		s->write_first = (s->write_first + 1) % screen_size_y(s);
+	else {
+		memcpy(&saved, screen_write_get_cline(s, s->rupper),
+		    sizeof saved);
+		for (y = s->rupper; y < s->rlower; y++) {
+			memcpy(screen_write_get_cline(s, y),
+			    screen_write_get_cline(s, y + 1), sizeof saved);
+		}
+		memcpy(screen_write_get_cline(s, s->rlower), &saved,
+		    sizeof saved);
 	}
-	ctx->s->write_list[s->rlower].data = saved;
 
-	ci = screen_write_get_citem();
+	ci = screen_write_insert_citem(screen_write_get_cline(s, s->rlower), 0);
 	ci->x = 0;
 	ci->used = screen_size_x(s);
 	ci->type = CLEAR;
 	ci->bg = bg;
-	TAILQ_INSERT_TAIL(&ctx->s->write_list[s->rlower].items, ci, entry);
+}
+
+/*
+ * Throw away collected lines for a hidden pane. The cells are already in the
+ * grid, so there is nothing to do but free the items and, if the pane is
+ * being coalesced, mark the lines which would have been drawn.
+ */
+static void
+screen_write_collect_discard(struct screen_write_ctx *ctx, int scroll_only,
+    const char *from)
+{
+	struct screen			*s = ctx->s;
+	struct screen_write_cline	*cl;
+	u_int				 y, items = 0;
+
+	if (ctx->scrolled != 0)
+		screen_write_damage(ctx, s->rupper, s->rlower + 1 - s->rupper);
+	ctx->scrolled = 0;
+	ctx->bg = 8;
+
+	if (scroll_only)
+		return;
+
+	for (y = 0; y < screen_size_y(s); y++) {
+		cl = screen_write_get_cline(s, y);
+		if (cl->count != 0) {
+			screen_write_damage(ctx, y, 1);
+			if (ctx->wp != NULL)
+				ctx->wp->scroll_lines++;
+			items += cl->count;
+		}
+		cl->count = 0;
+	}
+	log_debug("%s: discarded %u items (%s)", __func__, items, from);
 }
 
 /* Flush collected lines. */
@@ -1552,11 +1683,16 @@ screen_write_collect_flush(struct screen_write_ctx *ctx, int scroll_only,
     const char *from)
 {
 	struct screen			*s = ctx->s;
-	struct screen_write_citem	*ci, *tmp;
+	struct screen_write_citem	*ci;
 	struct screen_write_cline	*cl;
-	u_int				 y, cx, cy, last, items = 0;
+	u_int				 y, i, cx, cy, last, items = 0;
 	struct tty_ctx			 ttyctx;
 
+	if (ctx->flags & SCREEN_WRITE_HIDDEN) {
+		screen_write_collect_discard(ctx, scroll_only, from);
+		return;
+	}
+
 	if (ctx->scrolled != 0) {
 		log_debug("%s: scrolled %u (region %u-%u)", __func__,
 		    ctx->scrolled, s->rupper, s->rlower);
@@ -1564,6 +1700,7 @@ screen_write_collect_flush(struct screen_write_ctx *ctx, int scroll_only,
 			ctx->scrolled = s->rlower - s->rupper + 1;
 
 		screen_write_initctx(ctx, &ttyctx, 1);
+		screen_write_damage(ctx, s->rupper, s->rlower + 1 - s->rupper);
 		ttyctx.num = ctx->scrolled;
 		ttyctx.bg = ctx->bg;
 		tty_write(tty_cmd_scrollup, &ttyctx);
@@ -1576,9 +1713,10 @@ screen_write_collect_flush(struct screen_write_ctx *ctx, int scroll_only,
 
 	cx = s->cx; cy = s->cy;
 	for (y = 0; y < screen_size_y(s); y++) {
-		cl = &ctx->s->write_list[y];
+		cl = screen_write_get_cline(ctx->s, y);
 		last = UINT_MAX;
-		TAILQ_FOREACH_SAFE(ci, &cl->items, entry, tmp) {
+		for (i = 0; i < cl->count; i++) {
+			ci = &cl->items[i];
 			if (last != UINT_MAX && ci->x <= last) {
 				fatalx("collect list not in order: %u <= %u",
 				    ci->x, last);
@@ -1598,11 +1736,11 @@ screen_write_collect_flush(struct screen_write_ctx *ctx, int scroll_only,
 				tty_write(tty_cmd_cells, &ttyctx);
 			}
 			items++;
-
-			TAILQ_REMOVE(&cl->items, ci, entry);
-			screen_write_free_citem(ci);
 			last = ci->x;
 		}
+		if (cl->count != 0 && ctx->wp != NULL)
+			ctx->wp->scroll_lines++;
+		cl->count = 0;
 	}
 	s->cx = cx; s->cy = cy;
 
@@ -1614,37 +1752,34 @@ void
 screen_write_collect_end(struct screen_write_ctx *ctx)
 {
 	struct screen			*s = ctx->s;
-	struct screen_write_citem	*ci = ctx->item, *before;
-	struct screen_write_cline	*cl = &s->write_list[s->cy];
-	struct grid_cell		 gc;
-	u_int				 xx;
+	struct screen_write_citem	*ci = ctx->item;
+	struct screen_write_cline	*cl = screen_write_get_cline(s, s->cy);
+	struct grid_char		 gch;
+	u_int				 xx, idx;
 	int				 wrapped = ci->wrapped;
 
 	if (ci->used == 0)
 		return;
 
-	before = screen_write_collect_trim(ctx, s->cy, s->cx, ci->used,
-	    &wrapped);
+	idx = screen_write_collect_trim(ctx, s->cy, s->cx, ci->used, &wrapped);
 	ci->x = s->cx;
 	ci->wrapped = wrapped;
-	if (before == NULL)
-		TAILQ_INSERT_TAIL(&cl->items, ci, entry);
-	else
-		TAILQ_INSERT_BEFORE(before, ci, entry);
-	ctx->item = screen_write_get_citem();
+	ci = screen_write_insert_citem(cl, idx);
+	memcpy(ci, ctx->item, sizeof *ci);
+	memset(ctx->item, 0, sizeof *ctx->item);
 
 	log_debug("%s: %u %.*s (at %u,%u)", __func__, ci->used,
 	    (int)ci->used, cl->data + ci->x, s->cx, s->cy);
 
 	if (s->cx != 0) {
 		for (xx = s->cx; xx > 0; xx--) {
-			grid_view_get_cell(s->grid, xx, s->cy, &gc);
-			if (~gc.flags & GRID_FLAG_PADDING)
+			grid_view_get_char(s->grid, xx, s->cy, &gch);
+			if (~gch.flags & GRID_FLAG_PADDING)
 				break;
 			grid_view_set_cell(s->grid, xx, s->cy,
 			    &grid_default_cell);
 		}
-		if (gc.data.width > 1) {
+		if (utf8_char_width(gch.data) > 1) {
 			grid_view_set_cell(s->grid, xx, s->cy,
 			    &grid_default_cell);
 		}
@@ -1655,8 +1790,8 @@ screen_write_collect_end(struct screen_write_ctx *ctx)
 	screen_write_set_cursor(ctx, s->cx + ci->used, -1);
 
 	for (xx = s->cx; xx < screen_size_x(s); xx++) {
-		grid_view_get_cell(s->grid, xx, s->cy, &gc);
-		if (~gc.flags & GRID_FLAG_PADDING)
+		grid_view_get_char(s->grid, xx, s->cy, &gch);
+		if (~gch.flags & GRID_FLAG_PADDING)
 			break;
 		grid_view_set_cell(s->grid, xx, s->cy, &grid_default_cell);
 	}
@@ -1668,6 +1803,7 @@ screen_write_collect_add(struct screen_write_ctx *ctx,
     const struct grid_cell *gc)
 {
 	struct screen			*s = ctx->s;
+	struct screen_write_cline	*cl;
 	struct screen_write_citem	*ci;
 	u_int				 sx = screen_size_x(s);
 	int				 collect;
@@ -1709,9 +1845,68 @@ screen_write_collect_add(struct screen_write_ctx *ctx,
 
 	if (ci->used == 0)
 		memcpy(&ci->gc, gc, sizeof ci->gc);
-	if (ctx->s->write_list[s->cy].data == NULL)
-		ctx->s->write_list[s->cy].data = xmalloc(screen_size_x(ctx->s));
-	ctx->s->write_list[s->cy].data[s->cx + ci->used++] = gc->data.data[0];
+	cl = screen_write_get_cline(s, s->cy);
+	if (cl->data == NULL)
+		cl->data = xmalloc(screen_size_x(ctx->s));
+	cl->data[s->cx + ci->used++] = gc->data.data[0];
+}
+
+/*
+ * Write a run of printable ASCII characters with the same attributes,
+ * collecting as much of each line as will fit at once.
+ */
+void
+screen_write_collect_add_string(struct screen_write_ctx *ctx,
+    const struct grid_cell *gc, const u_char *data, size_t len)
+{
+	struct screen			*s = ctx->s;
+	struct screen_write_cline	*cl;
+	struct screen_write_citem	*ci;
+	struct grid_cell		 tmp_gc;
+	u_int				 sx = screen_size_x(s);
+	size_t				 n;
+
+	if ((gc->attr & GRID_ATTR_CHARSET) ||
+	    (~s->mode & MODE_WRAP) ||
+	    (s->mode & MODE_INSERT) ||
+	    s->sel != NULL) {
+		memcpy(&tmp_gc, gc, sizeof tmp_gc);
+		for (n = 0; n < len; n++) {
+			utf8_set(&tmp_gc.data, data[n]);
+			screen_write_collect_add(ctx, &tmp_gc);
+		}
+		return;
+	}
+
+	while (len != 0) {
+		if (s->cx > sx - 1 || ctx->item->used > sx - 1 - s->cx)
+			screen_write_collect_end(ctx);
+		ci = ctx->item; /* may have changed */
+
+		if (s->cx > sx - 1) {
+			log_debug("%s: wrapped at %u,%u", __func__, s->cx,
+			    s->cy);
+			ci->wrapped = 1;
+			screen_write_linefeed(ctx, 1, 8);
+			screen_write_set_cursor(ctx, 0, -1);
+		}
+
+		if (ci->used == 0) {
+			memcpy(&ci->gc, gc, sizeof ci->gc);
+			utf8_set(&ci->gc.data, *data);
+		}
+		cl = screen_write_get_cline(s, s->cy);
+		if (cl->data == NULL)
+			cl->data = xmalloc(sx);
+
+		n = sx - s->cx - ci->used;
+		if (n > len)
+			n = len;
+		memcpy(cl->data + s->cx + ci->used, data, n);
+		ci->used += n;
+		data += n;
+		len -= n;
+	}
 }
 
 /* Write cell data. */
@@ -1722,7 +1917,8 @@ screen_write_cell(struct screen_write_ctx *ctx, const struct grid_cell *gc)
 	struct grid		*gd = s->grid;
 	struct grid_line	*gl;
 	struct grid_cell_entry	*gce;
-	struct grid_cell 	 tmp_gc, now_gc;
+	struct grid_cell 	 tmp_gc;
+	struct grid_char	 now_gch;
 	struct tty_ctx		 ttyctx;
 	u_int			 sx = screen_size_x(s), sy = screen_size_y(s);
 	u_int		 	 width = gc->data.width, xx, last, cx, cy;
@@ -1777,8 +1973,8 @@ screen_write_cell(struct screen_write_ctx *ctx, const struct grid_cell *gc)
 	/* Handle overwriting of UTF-8 characters. */
 	gl = grid_get_line(s->grid, s->grid->hsize + s->cy);
 	if (gl->flags & GRID_LINE_EXTENDED) {
-		grid_view_get_cell(gd, s->cx, s->cy, &now_gc);
-		if (screen_write_overwrite(ctx, &now_gc, width))
+		grid_view_get_char(gd, s->cx, s->cy, &now_gch);
+		if (screen_write_overwrite(ctx, &now_gch, width))
 			skip = 0;
 	}
 
@@ -1915,16 +2111,16 @@ screen_write_combine(struct screen_write_ctx *ctx, const struct utf8_data *ud,
  * by the same character.
  */
 static int
-screen_write_overwrite(struct screen_write_ctx *ctx, struct grid_cell *gc,
-    u_int width)
+screen_write_overwrite(struct screen_write_ctx *ctx,
+    const struct grid_char *gch, u_int width)
 {
 	struct screen		*s = ctx->s;
 	struct grid		*gd = s->grid;
-	struct grid_cell	 tmp_gc;
+	struct grid_char	 tmp_gch;
 	u_int			 xx;
 	int			 done = 0;
 
-	if (gc->flags & GRID_FLAG_PADDING) {
+	if (gch->flags & GRID_FLAG_PADDING) {
 		/*
 		 * A padding cell, so clear any following and leading padding
 		 * cells back to the character. Don't overwrite the current
@@ -1932,8 +2128,8 @@ screen_write_overwrite(struct screen_write_ctx *ctx, struct grid_cell *gc,
 		 */
 		xx = s->cx + 1;
 		while (--xx > 0) {
-			grid_view_get_cell(gd, xx, s->cy, &tmp_gc);
-			if (~tmp_gc.flags & GRID_FLAG_PADDING)
+			grid_view_get_char(gd, xx, s->cy, &tmp_gch);
+			if (~tmp_gch.flags & GRID_FLAG_PADDING)
 				break;
 			log_debug("%s: padding at %u,%u", __func__, xx, s->cy);
 			grid_view_set_cell(gd, xx, s->cy, &grid_default_cell);
@@ -1950,12 +2146,12 @@ screen_write_overwrite(struct screen_write_ctx *ctx, struct grid_cell *gc,
 	 * we'll be overwriting with the current character.
 	 */
 	if (width != 1 ||
-	    gc->data.width != 1 ||
-	    gc->flags & GRID_FLAG_PADDING) {
+	    utf8_char_width(gch->data) != 1 ||
+	    gch->flags & GRID_FLAG_PADDING) {
 		xx = s->cx + width - 1;
 		while (++xx < screen_size_x(s)) {
-			grid_view_get_cell(gd, xx, s->cy, &tmp_gc);
-			if (~tmp_gc.flags & GRID_FLAG_PADDING)
+			grid_view_get_char(gd, xx, s->cy, &tmp_gch);
+			if (~tmp_gch.flags & GRID_FLAG_PADDING)
 				break;
 			log_debug("%s: overwrite at %u,%u", __func__, xx,
 			    s->cy);
@@ -1967,15 +2163,33 @@ screen_write_overwrite(struct screen_write_ctx *ctx, struct grid_cell *gc,
 	return (done);
 }
 
-/* Set external clipboard. */
+/*
+ * Set external clipboard. The data is encoded once here rather than for each
+ * client.
+ */
 void
 screen_write_setselection(struct screen_write_ctx *ctx, u_char *str, u_int len)
+{
+	char	*encoded;
+	size_t	 size;
+
+	size = 4 * ((len + 2) / 3) + 1; /* storage for base64 */
+	encoded = xmalloc(size);
+	b64_ntop(str, len, encoded, size);
+
+	screen_write_setselection_encoded(ctx, encoded);
+	free(encoded);
+}
+
+/* Set external clipboard from data which is already base64. */
+void
+screen_write_setselection_encoded(struct screen_write_ctx *ctx,
+    const char *encoded)
 {
 	struct tty_ctx	ttyctx;
 
 	screen_write_initctx(ctx, &ttyctx, 0);
-	ttyctx.ptr = str;
-	ttyctx.num = len;
+	ttyctx.ptr = (char *)encoded;
 
 	tty_write(tty_cmd_setselection, &ttyctx);
 }
@@ -22,6 +22,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#define XMALLOC_TAG XMALLOC_GRID
 #include "tmux.h"
 
 /* Selected area in screen. */
@@ -36,6 +37,12 @@ struct screen_sel {
 	u_int		 ex;
 	u_int		 ey;
 
+	int		 line_valid; /* columns selected on line */
+	u_int		 line;
+	int		 line_selected;
+	u_int		 line_first;
+	u_int		 line_last;
+
 	struct grid_cell cell;
 };
 
@@ -324,6 +331,7 @@ screen_resize_y(struct screen *s, u_int sy, int eat_empty, u_int *cy)
 		if (gd->flags & GRID_HISTORY) {
 			gd->hscrolled += needed;
 			gd->hsize += needed;
+			grid_index_add(gd, needed);
 		} else if (needed > 0 && available > 0) {
 			if (available > needed)
 				available = needed;
@@ -349,6 +357,7 @@ screen_resize_y(struct screen *s, u_int sy, int eat_empty, u_int *cy)
 				available = needed;
 			gd->hscrolled -= available;
 			gd->hsize -= available;
+			grid_index_remove(gd, available);
 		} else
 			available = 0;
 		needed -= available;
@@ -381,6 +390,8 @@ screen_set_selection(struct screen *s, u_int sx, u_int sy,
 	s->sel->sy = sy;
 	s->sel->ex = ex;
 	s->sel->ey = ey;
+
+	s->sel->line_valid = 0;
 }
 
 /* Clear selection. */
@@ -399,30 +410,21 @@ screen_hide_selection(struct screen *s)
 		s->sel->hidden = 1;
 }
 
-/* Check if cell in selection. */
-int
-screen_check_selection(struct screen *s, u_int px, u_int py)
+/*
+ * Work out the columns of a line in the selection, from first to last. Returns
+ * 0 if none are.
+ */
+static int
+screen_selection_line(struct screen_sel *sel, u_int py, u_int *first,
+    u_int *last)
 {
-	struct screen_sel	*sel = s->sel;
-	u_int			 xx;
-
-	if (sel == NULL || sel->hidden)
-		return (0);
+	int	emacs = (sel->modekeys == MODEKEY_EMACS);
 
 	if (sel->rectangle) {
-		if (sel->sy < sel->ey) {
-			/* start line < end line -- downward selection. */
-			if (py < sel->sy || py > sel->ey)
-				return (0);
-		} else if (sel->sy > sel->ey) {
-			/* start line > end line -- upward selection. */
-			if (py > sel->sy || py < sel->ey)
-				return (0);
-		} else {
-			/* starting line == ending line. */
-			if (py != sel->sy)
-				return (0);
-		}
+		if (py < sel->sy && py < sel->ey)
+			return (0);
+		if (py > sel->sy && py > sel->ey)
+			return (0);
 
 		/*
 		 * Need to include the selection start row, but not the cursor
@@ -430,79 +432,85 @@ screen_check_selection(struct screen *s, u_int px, u_int py)
 		 * one is on the left.
 		 */
 		if (sel->ex < sel->sx) {
-			/* Cursor (ex) is on the left. */
-			if (px < sel->ex)
-				return (0);
-
-			if (px > sel->sx)
-				return (0);
+			*first = sel->ex;
+			*last = sel->sx;
 		} else {
-			/* Selection start (sx) is on the left. */
-			if (px < sel->sx)
-				return (0);
-
-			if (px > sel->ex)
-				return (0);
+			*first = sel->sx;
+			*last = sel->ex;
 		}
-	} else {
-		/*
-		 * Like emacs, keep the top-left-most character, and drop the
-		 * bottom-right-most, regardless of copy direction.
-		 */
-		if (sel->sy < sel->ey) {
-			/* starting line < ending line -- downward selection. */
-			if (py < sel->sy || py > sel->ey)
-				return (0);
-
-			if (py == sel->sy && px < sel->sx)
-				return (0);
+		return (1);
+	}
 
-			if (sel->modekeys == MODEKEY_EMACS)
-				xx = (sel->ex == 0 ? 0 : sel->ex - 1);
-			else
-				xx = sel->ex;
-			if (py == sel->ey && px > xx)
-				return (0);
-		} else if (sel->sy > sel->ey) {
-			/* starting line > ending line -- upward selection. */
-			if (py > sel->sy || py < sel->ey)
-				return (0);
-
-			if (py == sel->ey && px < sel->ex)
-				return (0);
-
-			if (sel->modekeys == MODEKEY_EMACS)
-				xx = sel->sx - 1;
-			else
-				xx = sel->sx;
-			if (py == sel->sy && (sel->sx == 0 || px > xx))
-				return (0);
+	/*
+	 * Like emacs, keep the top-left-most character, and drop the
+	 * bottom-right-most, regardless of copy direction.
+	 */
+	if (sel->sy < sel->ey) {
+		/* starting line < ending line -- downward selection. */
+		if (py < sel->sy || py > sel->ey)
+			return (0);
+		*first = (py == sel->sy ? sel->sx : 0);
+		if (py != sel->ey)
+			*last = UINT_MAX;
+		else if (emacs)
+			*last = (sel->ex == 0 ? 0 : sel->ex - 1);
+		else
+			*last = sel->ex;
+	} else if (sel->sy > sel->ey) {
+		/* starting line > ending line -- upward selection. */
+		if (py > sel->sy || py < sel->ey)
+			return (0);
+		*first = (py == sel->ey ? sel->ex : 0);
+		if (py != sel->sy)
+			*last = UINT_MAX;
+		else if (sel->sx == 0)
+			return (0);
+		else if (emacs)
+			*last = sel->sx - 1;
+		else
+			*last = sel->sx;
+	} else {
+		/* starting line == ending line. */
+		if (py != sel->sy)
+			return (0);
+		if (sel->ex < sel->sx) {
+			/* cursor (ex) is on the left */
+			*first = sel->ex;
+			*last = (emacs ? sel->sx - 1 : sel->sx);
 		} else {
-			/* starting line == ending line. */
-			if (py != sel->sy)
-				return (0);
-
-			if (sel->ex < sel->sx) {
-				/* cursor (ex) is on the left */
-				if (sel->modekeys == MODEKEY_EMACS)
-					xx = sel->sx - 1;
-				else
-					xx = sel->sx;
-				if (px > xx || px < sel->ex)
-					return (0);
-			} else {
-				/* selection start (sx) is on the left */
-				if (sel->modekeys == MODEKEY_EMACS)
-					xx = (sel->ex == 0 ? 0 : sel->ex - 1);
-				else
-					xx = sel->ex;
-				if (px < sel->sx || px > xx)
-					return (0);
-			}
+			/* selection start (sx) is on the left */
+			*first = sel->sx;
+			if (emacs)
+				*last = (sel->ex == 0 ? 0 : sel->ex - 1);
+			else
+				*last = sel->ex;
 		}
 	}
+	return (*first <= *last);
+}
 
-	return (1);
+/*
+ * Check if cell in selection. This is called for every cell written while
+ * there is a selection, so the columns selected on the last line checked are
+ * kept.
+ */
+int
+screen_check_selection(struct screen *s, u_int px, u_int py)
+{
+	struct screen_sel	*sel = s->sel;
+
+	if (sel == NULL || sel->hidden)
+		return (0);
+
+	if (!sel->line_valid || sel->line != py) {
+		sel->line = py;
+		sel->line_valid = 1;
+		sel->line_selected = screen_selection_line(sel, py,
+		    &sel->line_first, &sel->line_last);
+	}
+	if (!sel->line_selected)
+		return (0);
+	return (px >= sel->line_first && px <= sel->line_last);
 }
 
 /* Get selected grid cell. */
@@ -546,8 +554,8 @@ screen_reflow(struct screen *s, u_int new_x, u_int *cx, u_int *cy, int cursor)
 }
 
 /*
- * Enter alternative screen mode. A copy of the visible screen is saved and the
- * history is not updated.
+ * Enter alternative screen mode. The lines of the visible screen are moved
+ * (not copied) to the saved grid and the history is not updated.
  */
 void
 screen_alternate_on(struct screen *s, struct grid_cell *gc, int cursor)
@@ -560,7 +568,7 @@ screen_alternate_on(struct screen *s, struct grid_cell *gc, int cursor)
 	sy = screen_size_y(s);
 
 	s->saved_grid = grid_create(sx, sy, 0);
-	grid_duplicate_lines(s->saved_grid, 0, s->grid, screen_hsize(s), sy);
+	grid_transfer_lines(s->saved_grid, 0, s->grid, screen_hsize(s), sy);
 	if (cursor) {
 		s->saved_cx = s->cx;
 		s->saved_cy = s->cy;
@@ -573,7 +581,7 @@ screen_alternate_on(struct screen *s, struct grid_cell *gc, int cursor)
 	s->grid->flags &= ~GRID_HISTORY;
 }
 
-/* Exit alternate screen mode and restore the copied grid. */
+/* Exit alternate screen mode and move the saved lines back. */
 void
 screen_alternate_off(struct screen *s, struct grid_cell *gc, int cursor)
 {
@@ -607,7 +615,7 @@ screen_alternate_off(struct screen *s, struct grid_cell *gc, int cursor)
 	}
 
 	/* Restore the saved grid. */
-	grid_duplicate_lines(s->grid, screen_hsize(s), s->saved_grid, 0,
+	grid_transfer_lines(s->grid, screen_hsize(s), s->saved_grid, 0,
 	    s->saved_grid->sy);
 
 	/*
@@ -32,11 +32,15 @@
 static void	server_client_free(int, short, void *);
 static void	server_client_check_pane_focus(struct window_pane *);
 static void	server_client_check_pane_resize(struct window_pane *);
-static void	server_client_check_pane_buffer(struct window_pane *);
+static int	server_client_check_pane_buffer(struct window_pane *);
 static void	server_client_check_window_resize(struct window *);
+static void	server_client_clear_pane_flags(struct window_pane *);
 static key_code	server_client_check_mouse(struct client *, struct key_event *);
+static void	server_client_queue_drag(struct client *, struct mouse_event *);
+static void	server_client_update_drag(struct client *);
 static void	server_client_repeat_timer(int, short, void *);
 static void	server_client_click_timer(int, short, void *);
+static void	server_client_redraw_timer(int, short, void *);
 static void	server_client_check_exit(struct client *);
 static void	server_client_check_redraw(struct client *);
 static void	server_client_check_modes(struct client *);
@@ -78,6 +82,56 @@ server_client_how_many(void)
 	return (n);
 }
 
+/*
+ * Number of clients which are still connecting or which are running commands
+ * without a terminal. A client whose commands are waiting (for wait-for or a
+ * shell command, for example) is not counted.
+ */
+u_int
+server_client_how_many_busy(void)
+{
+	struct client  	*c;
+	u_int		 n;
+
+	n = 0;
+	TAILQ_FOREACH(c, &clients, entry) {
+		if (c->flags & (CLIENT_EXIT|CLIENT_DEAD))
+			continue;
+		if (c->flags & CLIENT_IDENTIFIED) {
+			if (~c->flags & CLIENT_COMMANDONLY)
+				continue;
+			if (cmdq_waiting(c))
+				continue;
+		}
+		n++;
+	}
+	return (n);
+}
+
+/* Send the client its flags. */
+static void
+server_client_send_flags(struct client *c)
+{
+	uint64_t	flags = c->flags;
+
+	if (!render_active(c))
+		flags &= ~CLIENT_RENDER;
+	proc_send(c->peer, MSG_FLAGS, -1, &flags, sizeof flags);
+}
+
+/*
+ * Switch between the client and the server writing to the terminal. The
+ * terminal no longer looks like the writer thinks it does, so forget what it
+ * has and redraw it.
+ */
+static void
+server_client_render_changed(struct client *c)
+{
+	render_free(c);
+	tty_resize(&c->tty);
+	server_redraw_client(c);
+}
+
 /* Overlay timer callback. */
 static void
 server_client_overlay_timer(__unused int fd, __unused short events, void *data)
@@ -113,10 +167,71 @@ server_client_set_overlay(struct client *c, u_int delay,
 	c->overlay_free = freecb;
 	c->overlay_data = data;
 
+	c->overlay_sx = c->overlay_sy = 0;
+	c->flags &= ~CLIENT_OVERLAYMISSED;
+
 	c->tty.flags |= TTY_FREEZE;
 	if (c->overlay_mode == NULL)
 		c->tty.flags |= TTY_NOCURSOR;
-	server_redraw_client(c);
+	if (c->flags & CLIENT_RENDER) {
+		server_client_render_changed(c);
+		server_client_send_flags(c);
+	} else
+		server_redraw_client(c);
+}
+
+/*
+ * Redraw the area covered by the overlay. Only that area is redrawn unless
+ * the overlay covered the whole client or anything outside it was not drawn
+ * while it was shown.
+ */
+static void
+server_client_redraw_overlay_area(struct client *c)
+{
+	u_int	px = c->overlay_px, py = c->overlay_py;
+	u_int	ex = px + c->overlay_sx, ey = py + c->overlay_sy;
+
+	if (c->overlay_sx == 0 ||
+	    c->overlay_sy == 0 ||
+	    (c->flags & CLIENT_OVERLAYMISSED)) {
+		server_redraw_client(c);
+		return;
+	}
+
+	if ((c->flags & (CLIENT_REDRAWREGION|CLIENT_REDRAWWINDOW)) ==
+	    CLIENT_REDRAWREGION) {
+		if (c->region_px < px)
+			px = c->region_px;
+		if (c->region_py < py)
+			py = c->region_py;
+		if (c->region_px + c->region_sx > ex)
+			ex = c->region_px + c->region_sx;
+		if (c->region_py + c->region_sy > ey)
+			ey = c->region_py + c->region_sy;
+	}
+	c->region_px = px;
+	c->region_py = py;
+	c->region_sx = ex - px;
+	c->region_sy = ey - py;
+	c->flags |= CLIENT_REDRAWREGION;
+}
+
+/*
+ * Set the area covered by the overlay, redrawing whatever was under it before
+ * if it has moved.
+ */
+void
+server_client_set_overlay_area(struct client *c, u_int px, u_int py, u_int sx,
+    u_int sy)
+{
+	if (c->overlay_sx != 0 && c->overlay_sy != 0)
+		server_client_redraw_overlay_area(c);
+
+	c->overlay_px = px;
+	c->overlay_py = py;
+	c->overlay_sx = sx;
+	c->overlay_sy = sy;
+	c->flags |= CLIENT_REDRAWOVERLAY;
 }
 
 /* Clear overlay mode on client. */
@@ -140,7 +255,147 @@ server_client_clear_overlay(struct client *c)
 	c->overlay_data = NULL;
 
 	c->tty.flags &= ~(TTY_FREEZE|TTY_NOCURSOR);
-	server_redraw_client(c);
+	if ((c->flags & (CLIENT_RENDER|CLIENT_DEAD)) == CLIENT_RENDER) {
+		server_client_render_changed(c);
+		server_client_send_flags(c);
+	} else
+		server_client_redraw_overlay_area(c);
+
+	c->overlay_sx = c->overlay_sy = 0;
+	c->flags &= ~CLIENT_OVERLAYMISSED;
+}
+
+/* Names of client timings. */
+static const char *server_client_timing_names[] = {
+	"redraw",
+	"screen",
+	"status",
+	"update",
+	"write",
+	"input"
+};
+
+/* Get the name of a client timing. */
+const char *
+server_client_timing_name(enum client_timing_type type)
+{
+	return (server_client_timing_names[type]);
+}
+
+/*
+ * Add the time since start to a client timing. Once enough samples have been
+ * collected, the existing counts are halved so the histogram follows recent
+ * times.
+ */
+void
+server_client_add_timing(struct client *c, enum client_timing_type type,
+    uint64_t start)
+{
+	struct client_timing	*ct = &c->timings[type];
+	uint64_t		 usec = get_timer_usec() - start;
+	u_int			 i, n = 0;
+
+	while (n < CLIENT_TIMING_BUCKETS - 1 && usec >= (2ULL << n))
+		n++;
+
+	if (ct->count == CLIENT_TIMING_SAMPLES) {
+		ct->count = 0;
+		for (i = 0; i < CLIENT_TIMING_BUCKETS; i++) {
+			ct->buckets[i] /= 2;
+			ct->count += ct->buckets[i];
+		}
+	}
+	ct->buckets[n]++;
+	ct->count++;
+	ct->last = (usec > UINT_MAX) ? UINT_MAX : usec;
+}
+
+/*
+ * Estimate a percentile of a client timing in microseconds, assuming the times
+ * in the bucket it falls in are evenly spread.
+ */
+u_int
+server_client_get_timing(struct client *c, enum client_timing_type type,
+    u_int percent)
+{
+	struct client_timing	*ct = &c->timings[type];
+	u_int			 i, seen = 0, want, lower, upper;
+
+	if (ct->count == 0)
+		return (0);
+	want = ((uint64_t)ct->count * percent + 99) / 100;
+	if (want == 0)
+		want = 1;
+	for (i = 0; i < CLIENT_TIMING_BUCKETS - 1; i++) {
+		if (seen + ct->buckets[i] >= want)
+			break;
+		seen += ct->buckets[i];
+	}
+	lower = (i == 0) ? 0 : (1U << i);
+	upper = 2U << i;
+	if (ct->buckets[i] == 0)
+		return (upper);
+	return (lower + ((uint64_t)(upper - lower) * (want - seen)) /
+	    ct->buckets[i]);
+}
+
+/*
+ * A key read from the client's terminal at time has been sent to a pane. If
+ * the client is not already waiting for one, start timing how long until the
+ * pane's output in reply reaches the terminal. Keys that get no output are
+ * forgotten after CLIENT_INPUT_TIMEOUT.
+ */
+void
+server_client_input_sent(struct client *c, struct window_pane *wp,
+    key_code key, uint64_t time)
+{
+	if (KEYC_IS_MOUSE(key) || !TAILQ_EMPTY(&wp->modes) || wp->fd == -1)
+		return;
+	if (c->input_state != CLIENT_INPUT_NONE &&
+	    time - c->input_time < CLIENT_INPUT_TIMEOUT)
+		return;
+
+	c->input_time = time;
+	c->input_pane = wp->id;
+	c->input_state = CLIENT_INPUT_SENT;
+	wp->flags |= PANE_INPUTWAIT;
+	trace_event(TRACE_KEY_SENT, c->pid, wp->id, 0);
+}
+
+/* Output has been read from a pane that clients sent keys to. */
+void
+server_client_input_echoed(struct window_pane *wp)
+{
+	struct client	*c;
+	uint64_t	 now = get_timer_usec();
+
+	wp->flags &= ~PANE_INPUTWAIT;
+	TAILQ_FOREACH(c, &clients, entry) {
+		if (c->input_state != CLIENT_INPUT_SENT ||
+		    c->input_pane != wp->id)
+			continue;
+		if (now - c->input_time >= CLIENT_INPUT_TIMEOUT) {
+			c->input_state = CLIENT_INPUT_NONE;
+			continue;
+		}
+		c->input_state = CLIENT_INPUT_ECHOED;
+		trace_event(TRACE_KEY_ECHOED, c->pid, wp->id, 0);
+	}
+}
+
+/*
+ * The client's terminal output has all been written. If it included output
+ * from a pane in reply to a key, add the time since the key was read.
+ */
+void
+server_client_input_written(struct client *c)
+{
+	if (c->input_state != CLIENT_INPUT_QUEUED)
+		return;
+	server_client_add_timing(c, CLIENT_TIMING_INPUT, c->input_time);
+	trace_event(TRACE_KEY_WRITTEN, c->pid, c->input_pane,
+	    c->timings[CLIENT_TIMING_INPUT].last);
+	c->input_state = CLIENT_INPUT_NONE;
 }
 
 /* Check if this client is inside this server. */
@@ -148,17 +403,12 @@ int
 server_client_check_nested(struct client *c)
 {
 	struct environ_entry	*envent;
-	struct window_pane	*wp;
 
 	envent = environ_find(c->environ, "TMUX");
 	if (envent == NULL || *envent->value == '\0')
 		return (0);
 
-	RB_FOREACH(wp, window_pane_tree, &all_window_panes) {
-		if (strcmp(wp->tty, c->ttyname) == 0)
-			return (1);
-	}
-	return (0);
+	return (window_pane_find_by_tty(c->ttyname) != NULL);
 }
 
 /* Set client key table. */
@@ -232,6 +482,7 @@ server_client_create(int fd)
 
 	evtimer_set(&c->repeat_timer, server_client_repeat_timer, c);
 	evtimer_set(&c->click_timer, server_client_click_timer, c);
+	evtimer_set(&c->redraw_timer, server_client_redraw_timer, c);
 
 	TAILQ_INSERT_TAIL(&clients, c, entry);
 	log_debug("new client %p", c);
@@ -330,6 +581,7 @@ server_client_lost(struct client *c)
 
 	TAILQ_REMOVE(&clients, c, entry);
 	log_debug("lost client %p", c);
+	format_lists_changed();
 
 	if (c->flags & CLIENT_ATTACHED) {
 		server_client_attached_lost(c);
@@ -340,6 +592,7 @@ server_client_lost(struct client *c)
 		control_stop(c);
 	if (c->flags & CLIENT_TERMINAL)
 		tty_free(&c->tty);
+	render_free(c);
 	free(c->ttyname);
 
 	free(c->term_name);
@@ -353,6 +606,7 @@ server_client_lost(struct client *c)
 
 	evtimer_del(&c->repeat_timer);
 	evtimer_del(&c->click_timer);
+	evtimer_del(&c->redraw_timer);
 
 	key_bindings_unref_table(c->keytable);
 
@@ -364,12 +618,14 @@ server_client_lost(struct client *c)
 	free(c->prompt_string);
 	free(c->prompt_buffer);
 
-	format_lost_client(c);
 	environ_free(c->environ);
 
 	proc_remove_peer(c->peer);
 	c->peer = NULL;
 
+	file_ring_free(c->ring);
+	c->ring = NULL;
+
 	if (c->out_fd != -1)
 		close(c->out_fd);
 	if (c->fd != -1) {
@@ -471,6 +727,40 @@ server_client_exec(struct client *c, const char *cmd)
 	free(msg);
 }
 
+/*
+ * Queue a mouse drag update. Updates are applied at most once each time round
+ * the server loop (so at the rate the client can be redrawn) rather than for
+ * every motion event: the latest position is kept but the last position is
+ * left as it was for the first event, so no movement is lost.
+ */
+static void
+server_client_queue_drag(struct client *c, struct mouse_event *m)
+{
+	struct tty		*tty = &c->tty;
+	struct mouse_event	*dm = &tty->mouse_drag_event;
+	u_int			 lx = dm->lx, ly = dm->ly;
+
+	memcpy(dm, m, sizeof *dm);
+	if (tty->mouse_drag_pending) {
+		dm->lx = lx;
+		dm->ly = ly;
+	}
+	tty->mouse_drag_pending = 1;
+}
+
+/* Apply any queued mouse drag update. */
+static void
+server_client_update_drag(struct client *c)
+{
+	struct tty	*tty = &c->tty;
+
+	if (!tty->mouse_drag_pending)
+		return;
+	tty->mouse_drag_pending = 0;
+	if (tty->mouse_drag_update != NULL)
+		tty->mouse_drag_update(c, &tty->mouse_drag_event);
+}
+
 /* Check for mouse keys. */
 static key_code
 server_client_check_mouse(struct client *c, struct key_event *event)
@@ -670,6 +960,7 @@ have_event:
 
 	/* Stop dragging if needed. */
 	if (type != DRAG && type != WHEEL && c->tty.mouse_drag_flag) {
+		server_client_update_drag(c);
 		if (c->tty.mouse_drag_release != NULL)
 			c->tty.mouse_drag_release(c, m);
 
@@ -1146,6 +1437,16 @@ server_client_key_callback(struct cmdq_item *item, void *data)
 	int				 xtimeout, flags;
 	struct cmd_find_state		 fs;
 	key_code			 key0;
+	struct key_event		*next;
+	struct cmdq_item		*new_item;
+	u_int				 count, i;
+
+	/* Any more mouse events will need a new item. */
+	if (c->mouse_item == item)
+		c->mouse_item = NULL;
+	count = event->count;
+	if (count == 0)
+		count = 1;
 
 	/* Check the client is good to accept input. */
 	if (s == NULL || (c->flags & CLIENT_UNATTACHEDFLAGS))
@@ -1159,7 +1460,9 @@ server_client_key_callback(struct cmdq_item *item, void *data)
 
 	/* Check for mouse keys. */
 	m->valid = 0;
-	if (key == KEYC_MOUSE || key == KEYC_DOUBLECLICK) {
+	if (key != KEYC_MOUSE && key != KEYC_DOUBLECLICK)
+		server_client_update_drag(c);
+	else {
 		if (c->flags & CLIENT_READONLY)
 			goto out;
 		key = server_client_check_mouse(c, event);
@@ -1170,11 +1473,11 @@ server_client_key_callback(struct cmdq_item *item, void *data)
 		m->key = key;
 
 		/*
-		 * Mouse drag is in progress, so fire the callback (now that
+		 * Mouse drag is in progress, so queue the callback (now that
 		 * the mouse event is valid).
 		 */
 		if ((key & KEYC_MASK_KEY) == KEYC_DRAGGING) {
-			c->tty.mouse_drag_update(c, m);
+			server_client_queue_drag(c, m);
 			goto out;
 		}
 		event->key = key;
@@ -1274,8 +1577,26 @@ try_again:
 		}
 		server_status_client(c);
 
-		/* Execute the key binding. */
-		key_bindings_dispatch(bd, item, c, event, &fs);
+		/*
+		 * Execute the key binding. If the event stands for several
+		 * identical events and the binding cannot run once for all of
+		 * them, run it for the first and queue the rest to be looked
+		 * up again after it.
+		 */
+		if (count == 1 || key_bindings_can_repeat(bd))
+			key_bindings_dispatch(bd, item, c, event, &fs);
+		else {
+			event->count = 1;
+			new_item = key_bindings_dispatch(bd, item, c, event,
+			    &fs);
+
+			next = xmalloc(sizeof *next);
+			memcpy(next, event, sizeof *next);
+			next->key = KEYC_MOUSE;
+			next->count = count - 1;
+			cmdq_insert_after(new_item,
+			    cmdq_get_callback(server_client_key_callback, next));
+		}
 		key_bindings_unref_table(table);
 		goto out;
 	}
@@ -1318,8 +1639,12 @@ try_again:
 forward_key:
 	if (c->flags & CLIENT_READONLY)
 		goto out;
-	if (wp != NULL)
-		window_pane_key(wp, c, s, wl, key, m);
+	if (wp != NULL) {
+		for (i = 0; i < count; i++)
+			window_pane_key(wp, c, s, wl, key, m);
+		if (event->time != 0)
+			server_client_input_sent(c, wp, key, event->time);
+	}
 
 out:
 	if (s != NULL && key != KEYC_FOCUS_OUT)
@@ -1328,6 +1653,35 @@ out:
 	return (CMD_RETURN_NORMAL);
 }
 
+/*
+ * Add a mouse event to the last one queued if they are the same. A wheel event
+ * adds to the count, a drag event to the same position would be ignored so is
+ * discarded.
+ */
+static int
+server_client_coalesce_mouse(struct client *c, struct key_event *event)
+{
+	struct mouse_event	*m = &event->m, *lm;
+
+	if (c->mouse_item == NULL || cmdq_last(c) != c->mouse_item)
+		return (0);
+	if (event->key != KEYC_MOUSE)
+		return (0);
+	lm = &c->mouse_event->m;
+
+	if (m->b != lm->b || m->x != lm->x || m->y != lm->y)
+		return (0);
+	if (m->sgr_type != lm->sgr_type || m->sgr_b != lm->sgr_b)
+		return (0);
+	if (MOUSE_WHEEL(m->b)) {
+		c->mouse_event->count++;
+		return (1);
+	}
+	if (MOUSE_DRAG(m->b) && MOUSE_BUTTONS(m->b) != 3)
+		return (1);
+	return (0);
+}
+
 /* Handle a key event. */
 int
 server_client_handle_key(struct client *c, struct key_event *event)
@@ -1368,10 +1722,22 @@ server_client_handle_key(struct client *c, struct key_event *event)
 
 	/*
 	 * Add the key to the queue so it happens after any commands queued by
-	 * previous keys.
+	 * previous keys. Mouse wheel and drag events often arrive in bursts, so
+	 * if this is the same as a mouse event still waiting at the end of the
+	 * queue, add it to that instead.
 	 */
+	if (server_client_coalesce_mouse(c, event)) {
+		free(event);
+		return (1);
+	}
+	event->count = 1;
 	item = cmdq_get_callback(server_client_key_callback, event);
 	cmdq_append(c, item);
+	if (event->key == KEYC_MOUSE) {
+		c->mouse_item = item;
+		c->mouse_event = event;
+	} else
+		c->mouse_item = NULL;
 	return (1);
 }
 
@@ -1380,12 +1746,22 @@ void
 server_client_loop(void)
 {
 	struct client		*c;
-	struct window		*w;
-	struct window_pane	*wp;
-	int			 focus;
+	struct session		*s;
+	struct window		*w, *w1;
+	struct window_pane	*wp, *wp1;
+	int			 focus, keep;
 
-	/* Check for window resize. This is done before redrawing. */
-	RB_FOREACH(w, windows, &windows)
+	/*
+	 * Work out any window sizes which may have changed, then check for
+	 * window resize. This is done before redrawing. Only windows which have
+	 * been queued for checks can need anything done.
+	 */
+	TAILQ_FOREACH(c, &clients, entry) {
+		if (c->session != NULL)
+			server_client_update_drag(c);
+	}
+	recalculate_sizes_check();
+	TAILQ_FOREACH(w, &window_checks, check_entry)
 		server_client_check_window_resize(w);
 
 	/* Check clients. */
@@ -1398,25 +1774,100 @@ server_client_loop(void)
 		}
 	}
 
+	/*
+	 * Status lines and redraws may only be shared while clients are being
+	 * drawn.
+	 */
+	RB_FOREACH(s, sessions, &sessions) {
+		s->status_client = NULL;
+		s->redraw_client = NULL;
+	}
+
 	/*
 	 * Any windows will have been redrawn as part of clients, so clear
-	 * their flags now. Also check pane focus and resize.
+	 * their flags now. Only windows current in a client can have been
+	 * drawn; flags on others are left until they are.
 	 */
-	focus = options_get_number(global_options, "focus-events");
-	RB_FOREACH(w, windows, &windows) {
+	TAILQ_FOREACH(c, &clients, entry) {
+		if (c->session == NULL || c->session->curw == NULL)
+			continue;
+		w = c->session->curw->window;
 		TAILQ_FOREACH(wp, &w->panes, entry) {
-			if (wp->fd != -1) {
-				if (focus)
-					server_client_check_pane_focus(wp);
-				server_client_check_pane_resize(wp);
-				server_client_check_pane_buffer(wp);
-			}
-			wp->flags &= ~PANE_REDRAW;
+			server_client_clear_pane_flags(wp);
+			window_pane_start_reflow(wp, 0);
+		}
+	}
+
+	/*
+	 * Check pane focus. Panes which are focused are kept queued, so they
+	 * are checked first; otherwise a pane can only become focused by being
+	 * the active pane of the current window in a focused client.
+	 */
+	focus = options_get_number(global_options, "focus-events");
+	if (focus) {
+		TAILQ_FOREACH(wp, &window_pane_checks, check_entry) {
+			if (wp->fd != -1)
+				server_client_check_pane_focus(wp);
+		}
+		TAILQ_FOREACH(c, &clients, entry) {
+			if (c->session == NULL || !(c->flags & CLIENT_FOCUSED))
+				continue;
+			if (c->session->attached == 0)
+				continue;
+			wp = c->session->curw->window->active;
+			if (wp == NULL || wp->fd == -1)
+				continue;
+			server_client_check_pane_focus(wp);
+			if (wp->flags & PANE_FOCUSED)
+				window_pane_queue_check(wp);
 		}
+	}
+
+	/* Check queued panes for resize and buffered output. */
+	TAILQ_FOREACH_SAFE(wp, &window_pane_checks, check_entry, wp1) {
+		keep = 0;
+		if (wp->fd != -1) {
+			server_client_check_pane_resize(wp);
+			keep = server_client_check_pane_buffer(wp);
+		}
+		if (!TAILQ_EMPTY(&wp->resize_queue) ||
+		    window_pane_input_backlog(wp) != 0 ||
+		    (wp->flags & (PANE_FOCUSED|PANE_FOCUSPUSH)))
+			keep = 1;
+		if (!keep)
+			window_pane_unqueue_check(wp);
+	}
+
+	/* Check queued windows for name changes. */
+	TAILQ_FOREACH_SAFE(w, &window_checks, check_entry, w1) {
 		check_window_name(w);
+		if (~w->flags & WINDOW_RESIZE)
+			window_unqueue_check(w);
+	}
+
+	/* Flush output staged for clients while drawing. */
+	TAILQ_FOREACH(c, &clients, entry) {
+		if (c->tty.flags & TTY_OPENED)
+			tty_flush(&c->tty);
 	}
 }
 
+/* Clear the redraw flags of a pane after it has been drawn. */
+static void
+server_client_clear_pane_flags(struct window_pane *wp)
+{
+	if ((wp->flags & PANE_DAMAGED) && wp->damage != NULL)
+		bit_nclear(wp->damage, 0, wp->damage_size - 1);
+
+	/*
+	 * If the pane was redrawn without checking its lines, what was drawn
+	 * is no longer known.
+	 */
+	if ((wp->flags & PANE_REDRAW) && (~wp->flags & PANE_REDRAWLINES))
+		window_pane_forget_lines(wp, 0, wp->drawn_size);
+	wp->flags &= ~(PANE_REDRAW|PANE_DAMAGED|PANE_REDRAWLINES);
+}
+
 /* Check if window needs to be resized. */
 static void
 server_client_check_window_resize(struct window *w)
@@ -1520,8 +1971,11 @@ server_client_check_pane_resize(struct window_pane *wp)
 }
 
 
-/* Check pane buffer size. */
-static void
+/*
+ * Check pane buffer size. Returns 1 if the pane needs to be checked again,
+ * because data is left in the buffer or reading is turned off.
+ */
+static int
 server_client_check_pane_buffer(struct window_pane *wp)
 {
 	struct evbuffer			*evb = wp->event->input;
@@ -1556,7 +2010,7 @@ server_client_check_pane_buffer(struct window_pane *wp)
 		if (!flag)
 			off = 0;
 
-		window_pane_get_new_data(wp, wpo, &new_size);
+		new_size = window_pane_get_new_size(wp, wpo);
 		log_debug("%s: %s has %zu bytes used and %zu left for %%%u",
 		    __func__, c->name, wpo->used - wp->base_offset, new_size,
 		    wp->id);
@@ -1601,11 +2055,13 @@ out:
 	 * clients, all of which are control clients which are not able to
 	 * accept any more data.
 	 */
+	if (window_pane_input_backlog(wp) != 0)
+		off = 1;
+	if (wp->pipe_fd != -1 && (wp->flags & PANE_PIPESTALLED))
+		off = 1;
 	log_debug("%s: pane %%%u is %s", __func__, wp->id, off ? "off" : "on");
-	if (off)
-		bufferevent_disable(wp->event, EV_READ);
-	else
-		bufferevent_enable(wp->event, EV_READ);
+	window_pane_set_reading(wp, !off);
+	return (off || EVBUFFER_LENGTH(evb) != 0);
 }
 
 /* Check whether pane should be focused. */
@@ -1715,7 +2171,10 @@ server_client_reset_state(struct client *c)
 			mode &= ~MODE_CURSOR;
 	}
 	log_debug("%s: cursor to %u,%u", __func__, cx, cy);
-	tty_cursor(tty, cx, cy);
+	if (render_active(c))
+		render_cursor(c, cx, cy);
+	else
+		tty_cursor(tty, cx, cy);
 
 	/*
 	 * Set mouse mode if requested. To support dragging, always use button
@@ -1741,8 +2200,11 @@ server_client_reset_state(struct client *c)
 	tty_update_mode(tty, mode, s);
 	tty_reset(tty);
 
-	/* All writing must be done, send a sync end (if it was started). */
-	tty_sync_end(tty);
+	/*
+	 * All writing must be done, send a sync end (if it was started and is
+	 * not being held open for other panes).
+	 */
+	tty_sync_end_maybe(tty);
 	tty->flags |= flags;
 }
 
@@ -1776,6 +2238,7 @@ server_client_click_timer(__unused int fd, __unused short events, void *data)
 		event = xmalloc(sizeof *event);
 		event->key = KEYC_DOUBLECLICK;
 		memcpy(&event->m, &c->click_event, sizeof event->m);
+		event->time = 0;
 		if (!server_client_handle_key(c, event))
 			free(event);
 	}
@@ -1871,21 +2334,38 @@ server_client_check_redraw(struct client *c)
 	struct window		*w = c->session->curw->window;
 	struct window_pane	*wp;
 	int			 needed, flags, mode = tty->mode, new_flags = 0;
-	int			 redraw;
-	u_int			 bit = 0;
+	int			 redraw, missed;
+	u_int			 bit = 0, count;
+	bitstr_t		*changed;
 	struct timeval		 tv = { .tv_usec = 1000 };
 	static struct event	 ev;
 	size_t			 left;
+	u_int			 interval, wait;
+	uint64_t		 elapsed, start;
+	int			 deferred = 0;
 
 	if (c->flags & (CLIENT_CONTROL|CLIENT_SUSPENDED))
 		return;
+	start = get_timer_usec();
+
+	/*
+	 * Count each loop where updates were dropped because the client was
+	 * behind as a dropped frame, and resume updates if it has caught up.
+	 */
+	if (tty->flags & TTY_DROPPED) {
+		c->dropped_frames++;
+		tty->flags &= ~TTY_DROPPED;
+	}
+	tty_unblock(tty);
+
 	if (c->flags & CLIENT_ALLREDRAWFLAGS) {
-		log_debug("%s: redraw%s%s%s%s%s", c->name,
+		log_debug("%s: redraw%s%s%s%s%s%s", c->name,
 		    (c->flags & CLIENT_REDRAWWINDOW) ? " window" : "",
 		    (c->flags & CLIENT_REDRAWSTATUS) ? " status" : "",
 		    (c->flags & CLIENT_REDRAWBORDERS) ? " borders" : "",
 		    (c->flags & CLIENT_REDRAWOVERLAY) ? " overlay" : "",
-		    (c->flags & CLIENT_REDRAWPANES) ? " panes" : "");
+		    (c->flags & CLIENT_REDRAWPANES) ? " panes" : "",
+		    (c->flags & CLIENT_REDRAWREGION) ? " region" : "");
 	}
 
 	/*
@@ -1898,7 +2378,7 @@ server_client_check_redraw(struct client *c)
 		needed = 1;
 	else {
 		TAILQ_FOREACH(wp, &w->panes, entry) {
-			if (wp->flags & PANE_REDRAW) {
+			if (wp->flags & (PANE_REDRAW|PANE_DAMAGED)) {
 				needed = 1;
 				break;
 			}
@@ -1906,7 +2386,26 @@ server_client_check_redraw(struct client *c)
 		if (needed)
 			new_flags |= CLIENT_REDRAWPANES;
 	}
-	if (needed && (left = EVBUFFER_LENGTH(tty->out)) != 0) {
+
+	/*
+	 * A slow client is also not redrawn again until its frame interval has
+	 * passed, so it gets fewer frames with more changes in each.
+	 */
+	left = tty_pending(tty);
+	if (needed && left == 0 && (interval = tty_frame_interval(tty)) != 0) {
+		elapsed = get_timer() - c->redraw_time;
+		if (elapsed < interval) {
+			log_debug("%s: redraw deferred (%llu of %u ms)",
+			    c->name, (unsigned long long)elapsed, interval);
+			wait = interval - elapsed;
+			tv.tv_sec = wait / 1000;
+			tv.tv_usec = (wait % 1000) * 1000;
+			if (!evtimer_pending(&c->redraw_timer, NULL))
+				evtimer_add(&c->redraw_timer, &tv);
+			deferred = 1;
+		}
+	}
+	if (needed && left != 0) {
 		log_debug("%s: redraw deferred (%zu left)", c->name, left);
 		if (!evtimer_initialized(&ev))
 			evtimer_set(&ev, server_client_redraw_timer, NULL);
@@ -1914,10 +2413,12 @@ server_client_check_redraw(struct client *c)
 			log_debug("redraw timer started");
 			evtimer_add(&ev, &tv);
 		}
-
+		deferred = 1;
+	}
+	if (deferred) {
 		if (~c->flags & CLIENT_REDRAWWINDOW) {
 			TAILQ_FOREACH(wp, &w->panes, entry) {
-				if (wp->flags & PANE_REDRAW) {
+				if (wp->flags & (PANE_REDRAW|PANE_DAMAGED)) {
 					log_debug("%s: pane %%%u needs redraw",
 					    c->name, wp->id);
 					c->redraw_panes |= (1 << bit);
@@ -1940,6 +2441,23 @@ server_client_check_redraw(struct client *c)
 	} else if (needed)
 		log_debug("%s: redraw needed", c->name);
 
+	/*
+	 * A client which encodes its own output is sent the lines which have
+	 * changed instead. This waits like a redraw for anything the server
+	 * has written to the terminal itself.
+	 */
+	if (render_active(c)) {
+		if (needed) {
+			if (options_get_number(s->options, "set-titles"))
+				server_client_set_title(c);
+			render_update(c);
+			c->redraws++;
+		}
+		c->redraw_panes = 0;
+		c->flags &= ~(CLIENT_ALLREDRAWFLAGS|CLIENT_STATUSFORCE);
+		return;
+	}
+
 	flags = tty->flags & (TTY_BLOCK|TTY_FREEZE|TTY_NOCURSOR);
 	tty->flags = (tty->flags & ~(TTY_BLOCK|TTY_FREEZE))|TTY_NOCURSOR;
 
@@ -1949,16 +2467,41 @@ server_client_check_redraw(struct client *c)
 		 * needs to be redrawn.
 		 */
 		TAILQ_FOREACH(wp, &w->panes, entry) {
-			redraw = 0;
-			if (wp->flags & PANE_REDRAW)
-				redraw = 1;
-			else if (c->flags & CLIENT_REDRAWPANES)
-				redraw = !!(c->redraw_panes & (1 << bit));
+			missed = 0;
+			if (c->flags & CLIENT_REDRAWPANES)
+				missed = !!(c->redraw_panes & (1 << bit));
 			bit++;
+
+			/*
+			 * A redraw for a client which saw the last redraw of
+			 * the pane only needs to draw the lines which are not
+			 * the same.
+			 */
+			if ((wp->flags & PANE_REDRAW) && !missed) {
+				changed = window_pane_redraw_lines(wp, &count);
+				if (count == 0)
+					continue;
+				log_debug("%s: redrawing %u changed lines of "
+				    "pane %%%u", __func__, count, wp->id);
+				screen_redraw_pane(c, wp, changed);
+				continue;
+			}
+			redraw = missed;
+			if (!redraw && (wp->flags & PANE_DAMAGED)) {
+				if (wp->damage == NULL)
+					continue;
+				if (wp->damage_size == wp->sy) {
+					log_debug("%s: redrawing damaged lines "
+					    "of pane %%%u", __func__, wp->id);
+					screen_redraw_pane(c, wp, wp->damage);
+					continue;
+				}
+				redraw = 1;
+			}
 			if (!redraw)
 				continue;
 			log_debug("%s: redrawing pane %%%u", __func__, wp->id);
-			screen_redraw_pane(c, wp);
+			screen_redraw_pane(c, wp, NULL);
 		}
 		c->redraw_panes = 0;
 		c->flags &= ~CLIENT_REDRAWPANES;
@@ -1982,8 +2525,11 @@ server_client_check_redraw(struct client *c)
 		 * was empty, so we can record how many bytes the redraw
 		 * generated.
 		 */
-		c->redraw = EVBUFFER_LENGTH(tty->out);
+		c->redraw = tty_pending(tty);
+		c->redraw_time = get_timer();
 		log_debug("%s: redraw added %zu bytes", c->name, c->redraw);
+		server_client_add_timing(c, CLIENT_TIMING_REDRAW, start);
+		c->redraws++;
 	}
 }
 
@@ -2057,7 +2603,7 @@ server_client_dispatch(struct imsg *imsg, void *arg)
 		server_client_update_latest(c);
 		server_client_clear_overlay(c);
 		tty_resize(&c->tty);
-		recalculate_sizes();
+		recalculate_sizes_session(c->session);
 		server_redraw_client(c);
 		if (c->session != NULL)
 			notify_client("client-resized", c);
@@ -2066,6 +2612,7 @@ server_client_dispatch(struct imsg *imsg, void *arg)
 		if (datalen != 0)
 			fatalx("bad MSG_EXITING size");
 		c->session = NULL;
+		format_lists_changed();
 		tty_close(&c->tty);
 		proc_send(c->peer, MSG_EXITED, -1, NULL, 0);
 		break;
@@ -2101,6 +2648,16 @@ server_client_dispatch(struct imsg *imsg, void *arg)
 	case MSG_WRITE_READY:
 		file_write_ready(&c->files, imsg);
 		break;
+	case MSG_RING_OPEN:
+		if (datalen != 0)
+			fatalx("bad MSG_RING_OPEN size");
+		file_ring_open(c, imsg->fd);
+		break;
+	case MSG_RING_READY:
+		if (datalen != 0)
+			fatalx("bad MSG_RING_READY size");
+		file_ring_ready(&c->files);
+		break;
 	case MSG_READ:
 		file_read_data(&c->files, imsg);
 		break;
@@ -2116,6 +2673,8 @@ server_client_command_done(struct cmdq_item *item, __unused void *data)
 {
 	struct client	*c = cmdq_get_client(item);
 
+	if (c->flags & CLIENT_CONTROL_PIPE)
+		return (CMD_RETURN_NORMAL);
 	if (~c->flags & CLIENT_ATTACHED)
 		c->flags |= CLIENT_EXIT;
 	else if (~c->flags & CLIENT_EXIT)
@@ -2293,6 +2852,13 @@ server_client_dispatch_identify(struct client *c, struct imsg *imsg)
 		return;
 	c->flags |= CLIENT_IDENTIFIED;
 
+	/*
+	 * A client which only runs a command is handled after clients with a
+	 * terminal, so many of them at once do not hold up typing.
+	 */
+	if (c->flags & CLIENT_COMMANDONLY)
+		proc_set_priority(c->peer, PROC_PRIORITY_DEFAULT);
+
 	if (*c->ttyname != '\0')
 		name = xstrdup(c->ttyname);
 	else
@@ -2378,6 +2944,14 @@ server_client_control_flags(struct client *c, const char *next)
 		return (CLIENT_CONTROL_NOOUTPUT);
 	if (strcmp(next, "wait-exit") == 0)
 		return (CLIENT_CONTROL_WAITEXIT);
+	if (strcmp(next, "binary-output") == 0 &&
+	    (~c->flags & CLIENT_CONTROLCONTROL))
+		return (CLIENT_CONTROL_BINARY);
+#ifdef HAVE_ZLIB
+	if (strcmp(next, "compress") == 0 &&
+	    (~c->flags & CLIENT_CONTROLCONTROL))
+		return (CLIENT_CONTROL_COMPRESS);
+#endif
 	return (0);
 }
 
@@ -2405,6 +2979,9 @@ server_client_set_flags(struct client *c, const char *flags)
 			flag = CLIENT_IGNORESIZE;
 		else if (strcmp(next, "active-pane") == 0)
 			flag = CLIENT_ACTIVEPANE;
+		else if (strcmp(next, "client-render") == 0 &&
+		    (~c->flags & CLIENT_CONTROL))
+			flag = CLIENT_RENDER;
 		if (flag == 0)
 			continue;
 
@@ -2415,9 +2992,11 @@ server_client_set_flags(struct client *c, const char *flags)
 			c->flags |= flag;
 		if (flag == CLIENT_CONTROL_NOOUTPUT)
 			control_reset_offsets(c);
+		if (flag == CLIENT_RENDER && c->overlay_draw == NULL)
+			server_client_render_changed(c);
 	}
 	free(copy);
-	proc_send(c->peer, MSG_FLAGS, -1, &c->flags, sizeof c->flags);
+	server_client_send_flags(c);
 }
 
 /* Get client flags. This is only flags useful to show to users. */
@@ -2434,12 +3013,18 @@ server_client_get_flags(struct client *c)
 		strlcat(s, "focused,", sizeof s);
 	if (c->flags & CLIENT_CONTROL)
 		strlcat(s, "control-mode,", sizeof s);
+	if (c->flags & CLIENT_CONTROL_PIPE)
+		strlcat(s, "pipe-mode,", sizeof s);
 	if (c->flags & CLIENT_IGNORESIZE)
 		strlcat(s, "ignore-size,", sizeof s);
 	if (c->flags & CLIENT_CONTROL_NOOUTPUT)
 		strlcat(s, "no-output,", sizeof s);
 	if (c->flags & CLIENT_CONTROL_WAITEXIT)
 		strlcat(s, "wait-exit,", sizeof s);
+	if (c->flags & CLIENT_CONTROL_BINARY)
+		strlcat(s, "binary-output,", sizeof s);
+	if (c->flags & CLIENT_CONTROL_COMPRESS)
+		strlcat(s, "compress,", sizeof s);
 	if (c->flags & CLIENT_CONTROL_PAUSEAFTER) {
 		xsnprintf(tmp, sizeof tmp, "pause-after=%u,",
 		    c->pause_age / 1000);
@@ -2449,6 +3034,8 @@ server_client_get_flags(struct client *c)
 		strlcat(s, "read-only,", sizeof s);
 	if (c->flags & CLIENT_ACTIVEPANE)
 		strlcat(s, "active-pane,", sizeof s);
+	if (c->flags & CLIENT_RENDER)
+		strlcat(s, "client-render,", sizeof s);
 	if (c->flags & CLIENT_SUSPENDED)
 		strlcat(s, "suspended,", sizeof s);
 	if (c->flags & CLIENT_UTF8)
@@ -318,6 +318,9 @@ server_destroy_pane(struct window_pane *wp, int notify)
 #ifdef HAVE_UTEMPTER
 		utempter_remove_record(wp->fd);
 #endif
+		paste_pane_cancel(wp);
+		window_pane_splice_stop(wp);
+		event_del(&wp->read_event);
 		bufferevent_free(wp->event);
 		wp->event = NULL;
 		close(wp->fd);
@@ -436,6 +439,8 @@ server_destroy_session(struct session *s)
 	struct session	*s_new;
 	int		 detach_on_destroy;
 
+	format_lists_changed();
+
 	detach_on_destroy = options_get_number(s->options, "detach-on-destroy");
 	if (detach_on_destroy == 0)
 		s_new = server_next_session(s);
@@ -46,13 +46,31 @@ static int		 server_fd = -1;
 static uint64_t		 server_client_flags;
 static int		 server_exit;
 static struct event	 server_ev_accept;
+static int		 server_accept_held;
 static struct event	 server_ev_tidy;
+static struct event	 server_ev_compact;
+static int		 server_compact_fired;
+static struct event	 server_ev_input;
+static char		*server_exec_path;
+static uint64_t		 server_exec_time;
+static struct event	 server_ev_exec;
 
 struct cmd_find_state	 marked_pane;
 
 static u_int		 message_next;
 struct message_list	 message_log;
 
+struct server_stats	 server_stats;
+
+/* Most connections accepted each time the server socket is ready. */
+#define SERVER_ACCEPT_MAX 32
+
+/*
+ * Most clients connecting or running commands without a terminal at once.
+ * While there are this many, new connections wait in the listen queue.
+ */
+#define SERVER_BUSY_MAX 64
+
 static int	server_loop(void);
 static void	server_send_exit(void);
 static void	server_accept(int, short, void *);
@@ -168,6 +186,69 @@ server_tidy_event(__unused int fd, __unused short events, __unused void *data)
     evtimer_add(&server_ev_tidy, &tv);
 }
 
+/* Compact pane grids a few lines at a time after the server is idle. */
+static void
+server_compact_event(__unused int fd, __unused short events,
+    __unused void *data)
+{
+	struct timeval		 tv = { .tv_sec = 1 };
+	struct window_pane	*wp;
+	size_t			 freed = 0;
+	int			 more = 0;
+
+	RB_FOREACH(wp, window_pane_tree, &all_window_panes)
+		more |= grid_compact(wp->base.grid, &freed);
+	if (freed != 0)
+		log_debug("%s: %zu bytes reclaimed", __func__, freed);
+
+	if (more)
+		evtimer_add(&server_ev_compact, &tv);
+	server_compact_fired = 1;
+}
+
+/* Wake the loop to parse more pane input, which it does every time round. */
+static void
+server_input_event(__unused int fd, __unused short events,
+    __unused void *data)
+{
+}
+
+/* Set up the server state. */
+static void
+server_init(void)
+{
+	input_key_build();
+	RB_INIT(&windows);
+	RB_INIT(&all_window_panes);
+	TAILQ_INIT(&clients);
+	RB_INIT(&sessions);
+	key_bindings_init();
+	TAILQ_INIT(&message_log);
+
+	gettimeofday(&start_time, NULL);
+}
+
+/* Start the timers and run the server until it exits. */
+static __dead void
+server_run(void)
+{
+	struct timeval	 tv = { .tv_sec = 3600 };
+
+	evtimer_set(&server_ev_tidy, server_tidy_event, NULL);
+	evtimer_add(&server_ev_tidy, &tv);
+
+	evtimer_set(&server_ev_compact, server_compact_event, NULL);
+	evtimer_set(&server_ev_input, server_input_event, NULL);
+
+	server_add_accept(0);
+	proc_loop(server_proc, server_loop);
+
+	job_kill_all();
+	status_prompt_save_history();
+
+	exit(0);
+}
+
 /* Fork new server. */
 int
 server_start(struct tmuxproc *client, int flags, struct event_base *base,
@@ -177,7 +258,6 @@ server_start(struct tmuxproc *client, int flags, struct event_base *base,
 	sigset_t	 set, oldset;
 	struct client	*c = NULL;
 	char		*cause = NULL;
-	struct timeval	 tv = { .tv_sec = 3600 };
 
 	sigfillset(&set);
 	sigprocmask(SIG_BLOCK, &set, &oldset);
@@ -193,6 +273,8 @@ server_start(struct tmuxproc *client, int flags, struct event_base *base,
 
 	if (event_reinit(base) != 0)
 		fatalx("event_reinit failed");
+	if (event_base_priority_init(base, PROC_PRIORITIES) != 0)
+		log_debug("event_base_priority_init failed");
 	server_proc = proc_start("server");
 
 	proc_set_signals(server_proc, server_signal);
@@ -204,15 +286,7 @@ server_start(struct tmuxproc *client, int flags, struct event_base *base,
 	    "tty ps", NULL) != 0)
 		fatal("pledge failed");
 
-	input_key_build();
-	RB_INIT(&windows);
-	RB_INIT(&all_window_panes);
-	TAILQ_INIT(&clients);
-	RB_INIT(&sessions);
-	key_bindings_init();
-	TAILQ_INIT(&message_log);
-
-	gettimeofday(&start_time, NULL);
+	server_init();
 
 	server_fd = server_create_socket(flags, &cause);
 	if (server_fd != -1)
@@ -236,16 +310,90 @@ server_start(struct tmuxproc *client, int flags, struct event_base *base,
 		free(cause);
 	}
 
-	evtimer_set(&server_ev_tidy, server_tidy_event, NULL);
-	evtimer_add(&server_ev_tidy, &tv);
+	server_run();
+}
 
-	server_add_accept(0);
-	proc_loop(server_proc, server_loop);
+/*
+ * Restore the snapshot once the default key bindings have been added. Signals
+ * stay blocked until now so no pane processes are waited for before their
+ * panes exist.
+ */
+static enum cmd_retval
+server_resume_done(__unused struct cmdq_item *item, void *data)
+{
+	struct evbuffer	*evb = data;
+	sigset_t	 set;
 
-	job_kill_all();
-	status_prompt_save_history();
+	snapshot_restore(NULL, EVBUFFER_DATA(evb), EVBUFFER_LENGTH(evb),
+	    SNAPSHOT_LIVE);
+	evbuffer_free(evb);
+	status_prompt_load_history();
 
-	exit(0);
+	sigemptyset(&set);
+	sigprocmask(SIG_SETMASK, &set, NULL);
+	kill(getpid(), SIGCHLD);
+
+	return (CMD_RETURN_NORMAL);
+}
+
+/*
+ * Start a server replacing the previous one in the same process with exec().
+ * The listening socket and the panes are kept and the rest of the state is
+ * read from a live snapshot.
+ */
+__dead void
+server_resume(struct event_base *base, int fd, int statefd)
+{
+	struct evbuffer	*evb;
+	int		 n;
+
+	if (event_base_priority_init(base, PROC_PRIORITIES) != 0)
+		log_debug("event_base_priority_init failed");
+	server_proc = proc_start("server");
+	proc_set_signals(server_proc, server_signal);
+
+	if (log_get_level() > 1)
+		tty_create_log();
+	if (pledge("stdio rpath wpath cpath fattr unix getpw recvfd proc exec "
+	    "tty ps", NULL) != 0)
+		fatal("pledge failed");
+
+	server_init();
+
+	server_exec_time = get_timer();
+	server_fd = fd;
+	setblocking(server_fd, 0);
+	server_update_socket();
+	cfg_finished = 1;
+
+	evb = evbuffer_new();
+	if (evb == NULL)
+		fatalx("out of memory");
+	while ((n = evbuffer_read(evb, statefd, -1)) != 0) {
+		if (n == -1 && errno != EINTR) {
+			log_debug("%s: read failed: %s", __func__,
+			    strerror(errno));
+			break;
+		}
+	}
+	close(statefd);
+	cmdq_append(NULL, cmdq_get_callback(server_resume_done, evb));
+
+	server_run();
+}
+
+/* Add the time taken by one server loop to the statistics. */
+static void
+server_add_loop_time(uint64_t start)
+{
+	uint64_t	usec = get_timer_usec() - start;
+	u_int		n = 0;
+
+	while (n < SERVER_STATS_BUCKETS - 1 && usec >= (2ULL << n))
+		n++;
+	server_stats.loop_buckets[n]++;
+	server_stats.loop_time += usec;
+	server_stats.loops++;
 }
 
 /* Server loop callback. */
@@ -253,7 +401,9 @@ static int
 server_loop(void)
 {
 	struct client	*c;
+	struct timeval	 tv = { .tv_sec = 1 }, zero = { 0 };
 	u_int		 items;
+	uint64_t	 start = get_timer_usec();
 
 	do {
 		items = cmdq_next(NULL);
@@ -262,9 +412,39 @@ server_loop(void)
 				items += cmdq_next(c);
 		}
 	} while (items != 0);
+	control_notify_flush();
+
+	/*
+	 * Give each pane with input left over another turn, and come back
+	 * straight away if any still has more.
+	 */
+	if (window_pane_parse_backlog())
+		evtimer_add(&server_ev_input, &zero);
 
 	server_client_loop();
+	server_add_loop_time(start);
 
+	/* Start accepting again once enough clients are no longer busy. */
+	if (server_accept_held &&
+	    server_client_how_many_busy() < SERVER_BUSY_MAX) {
+		server_accept_held = 0;
+		server_add_accept(0);
+	}
+
+	/*
+	 * Put off compacting until nothing else has happened for a second.
+	 * This loop also runs after the compact event itself, which restarts
+	 * the timer only if there is more to do.
+	 */
+	if (server_compact_fired)
+		server_compact_fired = 0;
+	else
+		evtimer_add(&server_ev_compact, &tv);
+
+	/* Give clients time to attach again after exec-server. */
+	if (server_exec_path != NULL ||
+	    (server_exec_time != 0 && get_timer() - server_exec_time < 5000))
+		return (0);
 	if (!options_get_number(global_options, "exit-empty") && !server_exit)
 		return (0);
 
@@ -351,34 +531,53 @@ server_update_socket(void)
 	}
 }
 
-/* Callback for server socket. */
+/*
+ * Callback for server socket. Several connections are accepted at once, until
+ * too many clients are busy; then the accept event is removed until the server
+ * loop finds that some have finished.
+ */
 static void
 server_accept(int fd, short events, __unused void *data)
 {
 	struct sockaddr_storage	sa;
-	socklen_t		slen = sizeof sa;
+	socklen_t		slen;
 	int			newfd;
+	u_int			i, busy;
 
 	server_add_accept(0);
 	if (!(events & EV_READ))
 		return;
 
-	newfd = accept(fd, (struct sockaddr *) &sa, &slen);
-	if (newfd == -1) {
-		if (errno == EAGAIN || errno == EINTR || errno == ECONNABORTED)
+	busy = server_client_how_many_busy();
+	for (i = 0; i < SERVER_ACCEPT_MAX; i++) {
+		if (busy >= SERVER_BUSY_MAX) {
+			log_debug("%s: %u clients busy", __func__, busy);
+			event_del(&server_ev_accept);
+			server_accept_held = 1;
 			return;
-		if (errno == ENFILE || errno == EMFILE) {
-			/* Delete and don't try again for 1 second. */
-			server_add_accept(1);
+		}
+
+		slen = sizeof sa;
+		newfd = accept(fd, (struct sockaddr *) &sa, &slen);
+		if (newfd == -1) {
+			if (errno == EAGAIN ||
+			    errno == EINTR ||
+			    errno == ECONNABORTED)
+				return;
+			if (errno == ENFILE || errno == EMFILE) {
+				/* Delete and don't try again for 1 second. */
+				server_add_accept(1);
+				return;
+			}
+			fatal("accept failed");
+		}
+		if (server_exit) {
+			close(newfd);
 			return;
 		}
-		fatal("accept failed");
+		server_client_create(newfd);
+		busy++;
 	}
-	if (server_exit) {
-		close(newfd);
-		return;
-	}
-	server_client_create(newfd);
 }
 
 /*
@@ -395,10 +594,14 @@ server_add_accept(int timeout)
 
 	if (event_initialized(&server_ev_accept))
 		event_del(&server_ev_accept);
+	if (server_exec_path != NULL)
+		return;
+	server_accept_held = 0;
 
 	if (timeout == 0) {
 		event_set(&server_ev_accept, server_fd, EV_READ, server_accept,
 		    NULL);
+		event_priority_set(&server_ev_accept, PROC_PRIORITY_CLIENT);
 		event_add(&server_ev_accept, NULL);
 	} else {
 		event_set(&server_ev_accept, server_fd, EV_TIMEOUT,
@@ -538,3 +741,173 @@ server_add_message(const char *fmt, ...)
 		free(msg);
 	}
 }
+
+/* Add a string to a command quoted for the shell. */
+static void
+server_exec_quote(struct evbuffer *evb, const char *s)
+{
+	evbuffer_add(evb, "'", 1);
+	for (; *s != '\0'; s++) {
+		if (*s == '\'')
+			evbuffer_add(evb, "'\\''", 4);
+		else
+			evbuffer_add(evb, s, 1);
+	}
+	evbuffer_add(evb, "'", 1);
+}
+
+/*
+ * Replace the server process. The pane and listening socket descriptors are
+ * left open over exec() and the snapshot is in an unlinked temporary file.
+ */
+static void
+server_exec_replace(void)
+{
+	struct client		*c, *c1;
+	struct window_pane	*wp;
+	struct evbuffer		*evb;
+	char			 path[] = _PATH_TMP "tmux.XXXXXXXX";
+	char			*value, **argv = NULL;
+	const u_char		*data;
+	size_t			 size;
+	ssize_t			 n;
+	int			 fd, argc = 0, level, saved_errno;
+	sigset_t		 set, oldset;
+
+	TAILQ_FOREACH_SAFE(c, &clients, entry, c1)
+		server_client_lost(c);
+	job_kill_all();
+	status_prompt_save_history();
+	while (window_pane_parse_backlog())
+		/* nothing */;
+
+	if ((fd = mkstemp(path)) == -1) {
+		saved_errno = errno;
+		goto fail;
+	}
+	unlink(path);
+	evb = snapshot_save(SNAPSHOT_CONTENTS|SNAPSHOT_LIVE);
+	data = EVBUFFER_DATA(evb);
+	size = EVBUFFER_LENGTH(evb);
+	while (size != 0) {
+		n = write(fd, data, size);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1) {
+			saved_errno = errno;
+			evbuffer_free(evb);
+			close(fd);
+			goto fail;
+		}
+		data += n;
+		size -= n;
+	}
+	log_debug("%s: snapshot is %zu bytes", __func__, EVBUFFER_LENGTH(evb));
+	evbuffer_free(evb);
+	lseek(fd, 0, SEEK_SET);
+
+	fcntl(server_fd, F_SETFD, 0);
+	RB_FOREACH(wp, window_pane_tree, &all_window_panes) {
+		if (wp->fd != -1)
+			fcntl(wp->fd, F_SETFD, 0);
+		if (wp->pipe_fd != -1)
+			fcntl(wp->pipe_fd, F_SETFD, FD_CLOEXEC);
+	}
+	xasprintf(&value, "%d,%d", server_fd, fd);
+	setenv("TMUX_EXEC_SERVER", value, 1);
+	free(value);
+
+	argv = xreallocarray(argv, argc + 3, sizeof *argv);
+	argv[argc++] = server_exec_path;
+	argv[argc++] = xstrdup("-S");
+	argv[argc++] = xstrdup(socket_path);
+	for (level = log_get_level(); level > 0; level--) {
+		argv = xreallocarray(argv, argc + 1, sizeof *argv);
+		argv[argc++] = xstrdup("-v");
+	}
+	argv = xreallocarray(argv, argc + 1, sizeof *argv);
+	argv[argc] = NULL;
+
+	log_debug("%s: exec %s", __func__, server_exec_path);
+	log_close();
+	sigfillset(&set);
+	sigprocmask(SIG_BLOCK, &set, &oldset);
+	execv(server_exec_path, argv);
+	saved_errno = errno;
+	sigprocmask(SIG_SETMASK, &oldset, NULL);
+	log_open("server");
+
+	unsetenv("TMUX_EXEC_SERVER");
+	close(fd);
+	while (--argc > 0)
+		free(argv[argc]);
+	free(argv);
+
+fail:
+	server_add_message("exec %s failed: %s", server_exec_path,
+	    strerror(saved_errno));
+	free(server_exec_path);
+	server_exec_path = NULL;
+	server_add_accept(0);
+}
+
+/* Wait for clients to go before replacing the server. */
+static void
+server_exec_event(__unused int fd, __unused short events,
+    __unused void *data)
+{
+	struct timeval	tv = { .tv_usec = 10000 };
+
+	if (!TAILQ_EMPTY(&clients) && get_timer() - server_exec_time < 1000) {
+		evtimer_add(&server_ev_exec, &tv);
+		return;
+	}
+	server_exec_replace();
+}
+
+/*
+ * Start replacing the server with a new binary. New clients are not accepted
+ * and attached clients are asked to run the new binary to attach again.
+ */
+int
+server_exec(const char *path)
+{
+	struct client	*c;
+	struct evbuffer	*evb;
+	struct timeval	 tv = { 0 };
+
+	if (server_exec_path != NULL)
+		return (-1);
+	server_exec_path = xstrdup(path);
+	server_exec_time = get_timer();
+	log_debug("%s: %s", __func__, path);
+
+	if (event_initialized(&server_ev_accept))
+		event_del(&server_ev_accept);
+
+	evb = evbuffer_new();
+	if (evb == NULL)
+		fatalx("out of memory");
+	TAILQ_FOREACH(c, &clients, entry) {
+		if (c->session == NULL || (c->flags & CLIENT_EXIT))
+			continue;
+		if (c->flags & CLIENT_CONTROL) {
+			server_client_detach(c, MSG_DETACH);
+			continue;
+		}
+		evbuffer_add(evb, "exec ", 5);
+		server_exec_quote(evb, path);
+		evbuffer_add(evb, " -S ", 4);
+		server_exec_quote(evb, socket_path);
+		evbuffer_add_printf(evb, " attach%s -t '$%u'",
+		    (c->flags & CLIENT_READONLY) ? " -r" : "", c->session->id);
+		evbuffer_add(evb, "", 1);
+		server_client_exec(c, (char *)EVBUFFER_DATA(evb));
+		evbuffer_drain(evb, EVBUFFER_LENGTH(evb));
+	}
+	evbuffer_free(evb);
+
+	evtimer_set(&server_ev_exec, server_exec_event, NULL);
+	evtimer_add(&server_ev_exec, &tv);
+	return (0);
+}
@@ -47,6 +47,34 @@ session_cmp(struct session *s1, struct session *s2)
 }
 RB_GENERATE(sessions, session, entry, session_cmp);
 
+/*
+ * Sessions are also indexed by id and by address, so they can be found by id
+ * and checked for being alive without looking through every session.
+ */
+static int
+session_id_cmp(struct session *s1, struct session *s2)
+{
+	if (s1->id < s2->id)
+		return (-1);
+	return (s1->id > s2->id);
+}
+RB_HEAD(session_ids, session);
+RB_GENERATE_STATIC(session_ids, session, id_entry, session_id_cmp);
+static struct session_ids session_ids = RB_INITIALIZER(&session_ids);
+
+static int
+session_alive_cmp(struct session *s1, struct session *s2)
+{
+	if ((uintptr_t)s1 < (uintptr_t)s2)
+		return (-1);
+	return ((uintptr_t)s1 > (uintptr_t)s2);
+}
+RB_HEAD(session_alive_tree, session);
+RB_GENERATE_STATIC(session_alive_tree, session, alive_entry,
+    session_alive_cmp);
+static struct session_alive_tree session_alive_tree =
+    RB_INITIALIZER(&session_alive_tree);
+
 static int
 session_group_cmp(struct session_group *s1, struct session_group *s2)
 {
@@ -61,13 +89,7 @@ RB_GENERATE_STATIC(session_groups, session_group, entry, session_group_cmp);
 int
 session_alive(struct session *s)
 {
-	struct session *s_loop;
-
-	RB_FOREACH(s_loop, sessions, &sessions) {
-		if (s_loop == s)
-			return (1);
-	}
-	return (0);
+	return (RB_FIND(session_alive_tree, &session_alive_tree, s) != NULL);
 }
 
 /* Find session by name. */
@@ -100,13 +122,23 @@ session_find_by_id_str(const char *s)
 struct session *
 session_find_by_id(u_int id)
 {
-	struct session	*s;
+	struct session	s;
 
-	RB_FOREACH(s, sessions, &sessions) {
-		if (s->id == id)
-			return (s);
-	}
-	return (NULL);
+	s.id = id;
+	return (RB_FIND(session_ids, &session_ids, &s));
+}
+
+/* Get or set the next session ID, so a new server can keep the same IDs. */
+u_int
+session_get_next_id(void)
+{
+	return (next_session_id);
+}
+
+void
+session_set_next_id(u_int id)
+{
+	next_session_id = id;
 }
 
 /* Create a new session. */
@@ -150,6 +182,8 @@ session_create(const char *prefix, const char *name, const char *cwd,
 		} while (RB_FIND(sessions, &sessions, s) != NULL);
 	}
 	RB_INSERT(sessions, &sessions, s);
+	RB_INSERT(session_ids, &session_ids, s);
+	RB_INSERT(session_alive_tree, &session_alive_tree, s);
 
 	log_debug("new session %s $%u", s->name, s->id);
 
@@ -190,6 +224,7 @@ session_free(__unused int fd, __unused short events, void *arg)
 	if (s->references == 0) {
 		environ_free(s->environ);
 		options_free(s->options);
+		format_free_list(&s->attached_list);
 
 		free(s->name);
 		free(s);
@@ -206,6 +241,8 @@ session_destroy(struct session *s, int notify, const char *from)
 	s->curw = NULL;
 
 	RB_REMOVE(sessions, &sessions, s);
+	RB_REMOVE(session_ids, &session_ids, s);
+	RB_REMOVE(session_alive_tree, &session_alive_tree, s);
 	if (notify)
 		notify_session("session-closed", s);
 
@@ -628,17 +665,43 @@ session_group_synchronize_from(struct session *target)
 	}
 }
 
+/* Link a window into a session to match a target winlink. */
+static void
+session_group_link(struct session *s, struct winlink *twl)
+{
+	struct winlink	*wl;
+
+	wl = winlink_add(&s->windows, twl->idx);
+	wl->session = s;
+	winlink_set_window(wl, twl->window);
+	notify_session_window("window-linked", s, wl->window);
+	wl->flags |= twl->flags & WINLINK_ALERTFLAGS;
+}
+
+/* Unlink a winlink from a session which is no longer in the target. */
+static void
+session_group_unlink(struct session *target, struct session *s,
+    struct winlink *wl)
+{
+	if (s->curw == wl)
+		s->curw = NULL;
+	winlink_stack_remove(&s->lastw, wl);
+	if (winlink_find_by_window(&target->windows, wl->window) == NULL)
+		notify_session_window("window-unlinked", s, wl->window);
+	winlink_remove(&s->windows, wl);
+}
+
 /*
- * Synchronize a session with a target session. This means destroying all
- * winlinks then recreating them, then updating the current window, last window
- * stack and alerts.
+ * Synchronize a session with a target session. Both sets of winlinks are in
+ * index order, so walk them together and only add, remove or change the
+ * winlinks which differ, then fix up the current window and alerts.
  */
 static void
 session_group_synchronize1(struct session *target, struct session *s)
 {
-	struct winlinks		 old_windows, *ww;
-	struct winlink_stack	 old_lastw;
-	struct winlink		*wl, *wl2;
+	struct winlinks		*ww;
+	struct winlink		*wl, *wl1, *twl;
+	struct window		*w;
 
 	/* Don't do anything if the session is empty (it'll be destroyed). */
 	ww = &target->windows;
@@ -651,42 +714,38 @@ session_group_synchronize1(struct session *target, struct session *s)
 	    session_last(s) != 0 && session_previous(s, 0) != 0)
 		session_next(s, 0);
 
-	/* Save the old pointer and reset it. */
-	memcpy(&old_windows, &s->windows, sizeof old_windows);
-	RB_INIT(&s->windows);
+	wl = RB_MIN(winlinks, &s->windows);
+	twl = RB_MIN(winlinks, ww);
+	while (wl != NULL || twl != NULL) {
+		if (wl == NULL || (twl != NULL && twl->idx < wl->idx)) {
+			session_group_link(s, twl);
+			twl = winlink_next(twl);
+			continue;
+		}
+		if (twl == NULL || wl->idx < twl->idx) {
+			wl1 = winlink_next(wl);
+			session_group_unlink(target, s, wl);
+			wl = wl1;
+			continue;
+		}
+
+		if (wl->window != twl->window) {
+			w = wl->window;
+			if (winlink_find_by_window(ww, w) == NULL)
+				notify_session_window("window-unlinked", s, w);
+			winlink_set_window(wl, twl->window);
+			notify_session_window("window-linked", s, wl->window);
+		}
+		wl->flags &= ~WINLINK_ALERTFLAGS;
+		wl->flags |= twl->flags & WINLINK_ALERTFLAGS;
 
-	/* Link all the windows from the target. */
-	RB_FOREACH(wl, winlinks, ww) {
-		wl2 = winlink_add(&s->windows, wl->idx);
-		wl2->session = s;
-		winlink_set_window(wl2, wl->window);
-		notify_session_window("window-linked", s, wl2->window);
-		wl2->flags |= wl->flags & WINLINK_ALERTFLAGS;
+		wl = winlink_next(wl);
+		twl = winlink_next(twl);
 	}
 
 	/* Fix up the current window. */
-	if (s->curw != NULL)
-		s->curw = winlink_find_by_index(&s->windows, s->curw->idx);
-	else
+	if (s->curw == NULL)
 		s->curw = winlink_find_by_index(&s->windows, target->curw->idx);
-
-	/* Fix up the last window stack. */
-	memcpy(&old_lastw, &s->lastw, sizeof old_lastw);
-	TAILQ_INIT(&s->lastw);
-	TAILQ_FOREACH(wl, &old_lastw, sentry) {
-		wl2 = winlink_find_by_index(&s->windows, wl->idx);
-		if (wl2 != NULL)
-			TAILQ_INSERT_TAIL(&s->lastw, wl2, sentry);
-	}
-
-	/* Then free the old winlinks list. */
-	while (!RB_EMPTY(&old_windows)) {
-		wl = RB_ROOT(&old_windows);
-		wl2 = winlink_find_by_window_id(&s->windows, wl->window->id);
-		if (wl2 == NULL)
-			notify_session_window("window-unlinked", s, wl->window);
-		winlink_remove(&old_windows, wl);
-	}
 }
 
 /* Renumber the windows across winlinks attached to a specific session. */
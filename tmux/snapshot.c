@@ -0,0 +1,1544 @@
+/* $OpenBSD$ */
+
+/*
+ * Copyright (c) 2021 The tmux authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER
+ * IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <arpa/inet.h>
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "tmux.h"
+
+/*
+ * Save sessions, windows and panes into a buffer and restore them.
+ *
+ * The buffer is a header followed by records, each a type byte, a 32-bit
+ * length and the payload. Numbers are in network byte order and strings are a
+ * length followed by the bytes. Records which are not understood are skipped
+ * and fields may be added to the end of a record. A window's panes follow it
+ * and the window is laid out when the next record which is not a pane is
+ * seen, so its options and contents come after. Pane contents are compressed
+ * if zlib is available.
+ *
+ * A live snapshot is for a new server started with exec() in the same process
+ * and also keeps the pane file descriptors and processes, the screens, object
+ * IDs and the global state.
+ */
+
+#define SNAPSHOT_MAGIC "TMUXSNAP"
+#define SNAPSHOT_VERSION 1
+
+enum snapshot_record {
+	SNAPSHOT_SESSION = 1,
+	SNAPSHOT_WINDOW,
+	SNAPSHOT_PANE,
+	SNAPSHOT_OPTION,
+	SNAPSHOT_GRID,
+	SNAPSHOT_END,
+	SNAPSHOT_IDS,
+	SNAPSHOT_LIVE_PANE,
+	SNAPSHOT_SCREEN,
+	SNAPSHOT_KEY,
+	SNAPSHOT_ENVIRON,
+	SNAPSHOT_BUFFER
+};
+
+enum snapshot_scope {
+	SNAPSHOT_SCOPE_SESSION,
+	SNAPSHOT_SCOPE_WINDOW,
+	SNAPSHOT_SCOPE_PANE,
+	SNAPSHOT_SCOPE_SERVER,
+	SNAPSHOT_SCOPE_GLOBAL_SESSION,
+	SNAPSHOT_SCOPE_GLOBAL_WINDOW
+};
+
+#define SNAPSHOT_WINDOW_ZOOMED 0x1
+#define SNAPSHOT_WINDOW_LINKED 0x2
+
+#define SNAPSHOT_PANE_FLAGS \
+	(PANE_EXITED|PANE_STATUSREADY|PANE_STATUSDRAWN|PANE_EMPTY)
+
+struct snapshot_save_data {
+	struct evbuffer		 *evb;
+	struct evbuffer		 *payload;
+	int			  flags;
+
+	struct window		**windows;
+	u_int			  nwindows;
+};
+
+struct snapshot_window {
+	u_int			  id;
+	struct window		 *w;
+};
+
+struct snapshot_restore_data {
+	struct cmdq_item	 *item;
+	int			  flags;
+
+	u_char			 *buf;
+	size_t			  off;
+	size_t			  end;
+
+	int			  ids;
+	u_int			  next_session;
+	u_int			  next_window;
+	u_int			  next_pane;
+	int			  keys;
+	int			  environ;
+
+	struct session		 *s;
+	int			  curw;
+
+	int			  idx;
+	u_int			  id;
+	char			 *name;
+	struct winlink		 *wl;
+	struct window_pane	**panes;
+	u_int			  npanes;
+	char			 *layout;
+	u_int			  active;
+	int			  wflags;
+
+	struct snapshot_window	 *windows;
+	u_int			  nwindows;
+};
+
+static void
+snapshot_put8(struct evbuffer *evb, u_char v)
+{
+	evbuffer_add(evb, &v, sizeof v);
+}
+
+static void
+snapshot_put32(struct evbuffer *evb, u_int v)
+{
+	uint32_t	n = htonl(v);
+
+	evbuffer_add(evb, &n, sizeof n);
+}
+
+static void
+snapshot_put64(struct evbuffer *evb, unsigned long long v)
+{
+	snapshot_put32(evb, v >> 32);
+	snapshot_put32(evb, v & 0xffffffffU);
+}
+
+static void
+snapshot_put_data(struct evbuffer *evb, const void *data, size_t size)
+{
+	snapshot_put32(evb, size);
+	evbuffer_add(evb, data, size);
+}
+
+static void
+snapshot_put_string(struct evbuffer *evb, const char *s)
+{
+	if (s == NULL)
+		s = "";
+	snapshot_put_data(evb, s, strlen(s));
+}
+
+/* Add a record, emptying the payload buffer. */
+static void
+snapshot_record(struct snapshot_save_data *sd, enum snapshot_record type)
+{
+	snapshot_put8(sd->evb, type);
+	snapshot_put32(sd->evb, EVBUFFER_LENGTH(sd->payload));
+	evbuffer_add_buffer(sd->evb, sd->payload);
+}
+
+static void
+snapshot_save_option(struct snapshot_save_data *sd, enum snapshot_scope scope,
+    u_int pane, const char *name, const char *value)
+{
+	snapshot_put8(sd->payload, scope);
+	snapshot_put32(sd->payload, pane);
+	snapshot_put_string(sd->payload, name);
+	snapshot_put_string(sd->payload, value);
+	snapshot_record(sd, SNAPSHOT_OPTION);
+}
+
+/*
+ * Save the options set directly in an options tree, not inherited ones. An
+ * array is saved as its name with no value, which empties it, and then each
+ * item.
+ */
+static void
+snapshot_save_options(struct snapshot_save_data *sd, struct options *oo,
+    enum snapshot_scope scope, u_int pane)
+{
+	struct options_entry			*o;
+	const struct options_table_entry	*oe;
+	struct options_array_item		*a;
+	const char				*name;
+	char					*value, *full;
+	u_int					 idx;
+
+	for (o = options_first(oo); o != NULL; o = options_next(o)) {
+		name = options_name(o);
+		oe = options_table_entry(o);
+		if (oe == NULL || (~oe->flags & OPTIONS_TABLE_IS_ARRAY)) {
+			value = options_to_string(o, -1, 0);
+			snapshot_save_option(sd, scope, pane, name, value);
+			free(value);
+			continue;
+		}
+		snapshot_save_option(sd, scope, pane, name, NULL);
+		a = options_array_first(o);
+		while (a != NULL) {
+			idx = options_array_item_index(a);
+			xasprintf(&full, "%s[%u]", name, idx);
+			value = options_to_string(o, idx, 0);
+			snapshot_save_option(sd, scope, pane, full, value);
+			free(value);
+			free(full);
+			a = options_array_next(a);
+		}
+	}
+}
+
+static void
+snapshot_save_environ(struct snapshot_save_data *sd, struct environ *env,
+    enum snapshot_scope scope)
+{
+	struct environ_entry	*envent;
+
+	envent = environ_first(env);
+	while (envent != NULL) {
+		snapshot_put8(sd->payload, scope);
+		snapshot_put_string(sd->payload, envent->name);
+		snapshot_put8(sd->payload, envent->value != NULL);
+		snapshot_put_string(sd->payload, envent->value);
+		snapshot_put32(sd->payload, envent->flags);
+		snapshot_record(sd, SNAPSHOT_ENVIRON);
+		envent = environ_next(envent);
+	}
+}
+
+static void
+snapshot_save_keys(struct snapshot_save_data *sd)
+{
+	struct key_table	*table;
+	struct key_binding	*bd;
+	char			*cmd;
+
+	table = key_bindings_first_table();
+	while (table != NULL) {
+		bd = key_bindings_first(table);
+		while (bd != NULL) {
+			cmd = cmd_list_print(bd->cmdlist, 0);
+			snapshot_put_string(sd->payload, table->name);
+			snapshot_put64(sd->payload, bd->key);
+			snapshot_put_string(sd->payload, bd->note);
+			snapshot_put32(sd->payload, bd->flags);
+			snapshot_put_string(sd->payload, cmd);
+			snapshot_record(sd, SNAPSHOT_KEY);
+			free(cmd);
+			bd = key_bindings_next(table, bd);
+		}
+		table = key_bindings_next_table(table);
+	}
+}
+
+/* Save paste buffers oldest first so they are added back in order. */
+static void
+snapshot_save_buffers(struct snapshot_save_data *sd)
+{
+	struct paste_buffer	 *pb, **list = NULL;
+	const char		 *data;
+	size_t			  size;
+	u_int			  n = 0, i;
+
+	pb = NULL;
+	while ((pb = paste_walk(pb)) != NULL) {
+		list = xreallocarray(list, n + 1, sizeof *list);
+		list[n++] = pb;
+	}
+	for (i = n; i > 0; i--) {
+		pb = list[i - 1];
+		data = paste_buffer_data(pb, &size);
+		snapshot_put_string(sd->payload, paste_buffer_name(pb));
+		snapshot_put8(sd->payload, paste_buffer_automatic(pb));
+		snapshot_put_data(sd->payload, data, size);
+		snapshot_record(sd, SNAPSHOT_BUFFER);
+	}
+	free(list);
+}
+
+/* Add pane contents to a record, compressed if possible. */
+static void
+snapshot_put_contents(struct evbuffer *payload, struct evbuffer *data)
+{
+	u_char	*buf = EVBUFFER_DATA(data);
+	size_t	 size = EVBUFFER_LENGTH(data);
+#ifdef HAVE_ZLIB
+	u_char	*zdata;
+	uLongf	 zsize;
+
+	zsize = compressBound(size);
+	zdata = xmalloc(zsize);
+	if (compress(zdata, &zsize, buf, size) == Z_OK && zsize < size) {
+		snapshot_put32(payload, size);
+		snapshot_put_data(payload, zdata, zsize);
+		free(zdata);
+		return;
+	}
+	free(zdata);
+#endif
+	snapshot_put32(payload, 0);
+	snapshot_put_data(payload, buf, size);
+}
+
+/*
+ * Add lines with their attributes as they would be written to a terminal.
+ * Wrapped lines are left untrimmed and without a newline so they wrap again.
+ */
+static void
+snapshot_add_lines(struct evbuffer *data, struct grid *gd, u_int start,
+    u_int end, int last)
+{
+	const struct grid_line	*gl;
+	struct grid_cell	*gc = NULL;
+	char			*line;
+	u_int			 py;
+	int			 wrapped;
+
+	for (py = start; py < end; py++) {
+		gl = grid_get_line(gd, py);
+		wrapped = (gl->flags & GRID_LINE_WRAPPED);
+		line = grid_string_cells(gd, 0, py, gd->sx, &gc, 1, 0,
+		    !wrapped);
+		evbuffer_add(data, line, strlen(line));
+		if (!wrapped && (last || py != end - 1))
+			evbuffer_add(data, "\r\n", 2);
+		free(line);
+	}
+}
+
+/*
+ * Save the history and the visible lines above the cursor. The cursor line is
+ * left out since it is usually the prompt of the shell and the new shell will
+ * print another.
+ */
+static void
+snapshot_save_grid(struct snapshot_save_data *sd, struct window_pane *wp,
+    u_int pane)
+{
+	struct grid	*gd = wp->base.grid;
+	struct evbuffer	*data;
+
+	data = evbuffer_new();
+	if (data == NULL)
+		fatalx("out of memory");
+	snapshot_add_lines(data, gd, 0, gd->hsize + wp->base.cy, 1);
+	if (EVBUFFER_LENGTH(data) != 0) {
+		evbuffer_add(data, "\033[0m", 4);
+		snapshot_put32(sd->payload, pane);
+		snapshot_put_contents(sd->payload, data);
+		snapshot_record(sd, SNAPSHOT_GRID);
+	}
+	evbuffer_free(data);
+}
+
+/*
+ * Save the whole screen of a pane which is being kept. If the alternate
+ * screen is in use, the normal screen is written first and then the
+ * alternate screen is entered with the cursor where it was saved.
+ */
+static void
+snapshot_save_screen(struct snapshot_save_data *sd, struct window_pane *wp,
+    u_int pane)
+{
+	struct screen	*s = &wp->base;
+	struct grid	*gd = s->grid;
+	struct evbuffer	*data;
+
+	data = evbuffer_new();
+	if (data == NULL)
+		fatalx("out of memory");
+	if (s->saved_grid == NULL)
+		snapshot_add_lines(data, gd, 0, gd->hsize + gd->sy, 0);
+	else {
+		snapshot_add_lines(data, gd, 0, gd->hsize, 1);
+		snapshot_add_lines(data, s->saved_grid, 0, s->saved_grid->sy,
+		    0);
+		evbuffer_add_printf(data, "\033[%u;%uH\033[?1049h\033[H",
+		    s->saved_cy + 1, s->saved_cx + 1);
+		snapshot_add_lines(data, gd, gd->hsize, gd->hsize + gd->sy,
+		    0);
+	}
+	evbuffer_add(data, "\033[0m", 4);
+
+	snapshot_put32(sd->payload, pane);
+	snapshot_put32(sd->payload, s->mode);
+	snapshot_put32(sd->payload, s->cx);
+	snapshot_put32(sd->payload, s->cy);
+	snapshot_put32(sd->payload, s->rupper);
+	snapshot_put32(sd->payload, s->rlower);
+	snapshot_put_string(sd->payload, s->title);
+	snapshot_put_contents(sd->payload, data);
+	snapshot_record(sd, SNAPSHOT_SCREEN);
+	evbuffer_free(data);
+}
+
+static void
+snapshot_save_pane(struct snapshot_save_data *sd, struct window_pane *wp)
+{
+	const char	*cwd;
+	int		 i;
+
+	if (wp->fd == -1 || (cwd = osdep_get_cwd(wp->fd)) == NULL)
+		cwd = wp->cwd;
+	if (sd->flags & SNAPSHOT_LIVE)
+		snapshot_put32(sd->payload, wp->id);
+	snapshot_put_string(sd->payload, cwd);
+	snapshot_put32(sd->payload, wp->argc);
+	for (i = 0; i < wp->argc; i++)
+		snapshot_put_string(sd->payload, wp->argv[i]);
+	if (~sd->flags & SNAPSHOT_LIVE) {
+		snapshot_record(sd, SNAPSHOT_PANE);
+		return;
+	}
+	snapshot_put_string(sd->payload, wp->shell);
+	snapshot_put32(sd->payload, wp->pid);
+	snapshot_put32(sd->payload, wp->fd);
+	snapshot_put_string(sd->payload, wp->tty);
+	snapshot_put32(sd->payload, wp->flags & SNAPSHOT_PANE_FLAGS);
+	snapshot_put32(sd->payload, wp->status);
+	snapshot_record(sd, SNAPSHOT_LIVE_PANE);
+}
+
+static void
+snapshot_save_window(struct snapshot_save_data *sd, struct winlink *wl)
+{
+	struct window		*w = wl->window;
+	struct window_pane	*wp;
+	char			*layout;
+	u_int			 active = 0, n;
+	int			 flags = 0;
+
+	/* A window linked into more than one session is saved once. */
+	for (n = 0; n < sd->nwindows; n++) {
+		if (sd->windows[n] == w)
+			break;
+	}
+	if (n != sd->nwindows)
+		flags |= SNAPSHOT_WINDOW_LINKED;
+	else {
+		sd->windows = xreallocarray(sd->windows, sd->nwindows + 1,
+		    sizeof *sd->windows);
+		sd->windows[sd->nwindows++] = w;
+	}
+
+	window_pane_index(w->active, &active);
+	active -= options_get_number(w->options, "pane-base-index");
+	if (w->flags & WINDOW_ZOOMED)
+		flags |= SNAPSHOT_WINDOW_ZOOMED;
+	layout = layout_dump_window(w, 0);
+
+	snapshot_put32(sd->payload, wl->idx);
+	snapshot_put_string(sd->payload, w->name);
+	snapshot_put_string(sd->payload, layout);
+	snapshot_put32(sd->payload, active);
+	snapshot_put32(sd->payload, flags);
+	snapshot_put32(sd->payload, w->id);
+	snapshot_record(sd, SNAPSHOT_WINDOW);
+	free(layout);
+	if (flags & SNAPSHOT_WINDOW_LINKED)
+		return;
+
+	TAILQ_FOREACH(wp, &w->panes, entry)
+		snapshot_save_pane(sd, wp);
+
+	snapshot_save_options(sd, w->options, SNAPSHOT_SCOPE_WINDOW, 0);
+	n = 0;
+	TAILQ_FOREACH(wp, &w->panes, entry) {
+		snapshot_save_options(sd, wp->options, SNAPSHOT_SCOPE_PANE, n);
+		if (sd->flags & SNAPSHOT_LIVE)
+			snapshot_save_screen(sd, wp, n);
+		else if (sd->flags & SNAPSHOT_CONTENTS)
+			snapshot_save_grid(sd, wp, n);
+		n++;
+	}
+}
+
+static void
+snapshot_save_session(struct snapshot_save_data *sd, struct session *s)
+{
+	struct session_group	*sg = session_group_contains(s);
+	struct winlink		*wl;
+
+	snapshot_put_string(sd->payload, s->name);
+	snapshot_put_string(sd->payload, s->cwd);
+	snapshot_put32(sd->payload, s->curw == NULL ? 0 : s->curw->idx);
+	snapshot_put_string(sd->payload, sg == NULL ? NULL : sg->name);
+	snapshot_put32(sd->payload, s->id);
+	snapshot_record(sd, SNAPSHOT_SESSION);
+
+	if (sd->flags & SNAPSHOT_LIVE) {
+		snapshot_save_environ(sd, s->environ,
+		    SNAPSHOT_SCOPE_SESSION);
+	}
+	snapshot_save_options(sd, s->options, SNAPSHOT_SCOPE_SESSION, 0);
+
+	/* Only the first session in a group has the windows. */
+	if (sg != NULL && TAILQ_FIRST(&sg->sessions) != s)
+		return;
+	RB_FOREACH(wl, winlinks, &s->windows)
+		snapshot_save_window(sd, wl);
+}
+
+/* Save the server into a new buffer. */
+struct evbuffer *
+snapshot_save(int flags)
+{
+	struct snapshot_save_data	 sd;
+	struct session			*s;
+
+	memset(&sd, 0, sizeof sd);
+	sd.flags = flags;
+	sd.evb = evbuffer_new();
+	sd.payload = evbuffer_new();
+	if (sd.evb == NULL || sd.payload == NULL)
+		fatalx("out of memory");
+
+	evbuffer_add(sd.evb, SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC));
+	snapshot_put32(sd.evb, SNAPSHOT_VERSION);
+
+	if (flags & SNAPSHOT_LIVE) {
+		snapshot_put32(sd.payload, session_get_next_id());
+		snapshot_put32(sd.payload, window_get_next_id());
+		snapshot_put32(sd.payload, window_pane_get_next_id());
+		snapshot_record(&sd, SNAPSHOT_IDS);
+
+		snapshot_save_options(&sd, global_options,
+		    SNAPSHOT_SCOPE_SERVER, 0);
+		snapshot_save_options(&sd, global_s_options,
+		    SNAPSHOT_SCOPE_GLOBAL_SESSION, 0);
+		snapshot_save_options(&sd, global_w_options,
+		    SNAPSHOT_SCOPE_GLOBAL_WINDOW, 0);
+		snapshot_save_environ(&sd, global_environ,
+		    SNAPSHOT_SCOPE_SERVER);
+		snapshot_save_keys(&sd);
+		snapshot_save_buffers(&sd);
+	}
+
+	RB_FOREACH(s, sessions, &sessions)
+		snapshot_save_session(&sd, s);
+	snapshot_record(&sd, SNAPSHOT_END);
+
+	evbuffer_free(sd.payload);
+	free(sd.windows);
+	return (sd.evb);
+}
+
+static void printflike(2, 3)
+snapshot_error(struct snapshot_restore_data *rd, const char *fmt, ...)
+{
+	va_list	 ap;
+	char	*msg;
+
+	va_start(ap, fmt);
+	xvasprintf(&msg, fmt, ap);
+	va_end(ap);
+
+	if (rd->item != NULL)
+		cmdq_error(rd->item, "%s", msg);
+	else
+		log_debug("snapshot: %s", msg);
+	free(msg);
+}
+
+static int
+snapshot_get8(struct snapshot_restore_data *rd, u_int *v)
+{
+	if (rd->end - rd->off < 1)
+		return (-1);
+	*v = rd->buf[rd->off++];
+	return (0);
+}
+
+static int
+snapshot_get32(struct snapshot_restore_data *rd, u_int *v)
+{
+	uint32_t	n;
+
+	if (rd->end - rd->off < sizeof n)
+		return (-1);
+	memcpy(&n, rd->buf + rd->off, sizeof n);
+	rd->off += sizeof n;
+	*v = ntohl(n);
+	return (0);
+}
+
+static int
+snapshot_get64(struct snapshot_restore_data *rd, unsigned long long *v)
+{
+	u_int	hi, lo;
+
+	if (snapshot_get32(rd, &hi) != 0 || snapshot_get32(rd, &lo) != 0)
+		return (-1);
+	*v = ((unsigned long long)hi << 32) | lo;
+	return (0);
+}
+
+/* Get a number added to the end of a record, which older records lack. */
+static int
+snapshot_get32_optional(struct snapshot_restore_data *rd, u_int *v,
+    u_int dflt)
+{
+	if (rd->off == rd->end) {
+		*v = dflt;
+		return (0);
+	}
+	return (snapshot_get32(rd, v));
+}
+
+static int
+snapshot_get_data(struct snapshot_restore_data *rd, u_char **data,
+    size_t *size)
+{
+	u_int	n;
+
+	if (snapshot_get32(rd, &n) != 0 || rd->end - rd->off < n)
+		return (-1);
+	*data = rd->buf + rd->off;
+	*size = n;
+	rd->off += n;
+	return (0);
+}
+
+/* Get a string. The caller must free it, even if this fails. */
+static int
+snapshot_get_string(struct snapshot_restore_data *rd, char **s)
+{
+	u_char	*data;
+	size_t	 size;
+
+	*s = NULL;
+	if (snapshot_get_data(rd, &data, &size) != 0)
+		return (-1);
+	*s = xmalloc(size + 1);
+	memcpy(*s, data, size);
+	(*s)[size] = '\0';
+	return (0);
+}
+
+/* Get pane contents, uncompressing them if needed. */
+static int
+snapshot_get_contents(struct snapshot_restore_data *rd, u_char **data,
+    size_t *size, u_char **copy)
+{
+	u_int	 original;
+#ifdef HAVE_ZLIB
+	uLongf	 zsize;
+#endif
+
+	*copy = NULL;
+	if (snapshot_get32(rd, &original) != 0 ||
+	    snapshot_get_data(rd, data, size) != 0)
+		return (-1);
+	if (original == 0)
+		return (0);
+#ifdef HAVE_ZLIB
+	*copy = xmalloc(original);
+	zsize = original;
+	if (uncompress(*copy, &zsize, *data, *size) != Z_OK ||
+	    zsize != original) {
+		free(*copy);
+		*copy = NULL;
+		return (-1);
+	}
+	*data = *copy;
+	*size = original;
+	return (0);
+#else
+	snapshot_error(rd, "contents are compressed but no zlib");
+	*size = 0;
+	return (0);
+#endif
+}
+
+/* Find the biggest pane, which will be split to make room for the next. */
+static struct window_pane *
+snapshot_biggest(struct window *w)
+{
+	struct window_pane	*wp, *found = NULL;
+
+	TAILQ_FOREACH(wp, &w->panes, entry) {
+		if (found == NULL || wp->sx * wp->sy > found->sx * found->sy)
+			found = wp;
+	}
+	return (found);
+}
+
+/* Split the biggest pane to make a cell for a new pane. */
+static struct layout_cell *
+snapshot_split(struct snapshot_restore_data *rd, struct window_pane **wp0)
+{
+	struct layout_cell	*lc;
+	enum layout_type	 type;
+
+	*wp0 = snapshot_biggest(rd->wl->window);
+	if ((*wp0)->sx > (*wp0)->sy * 2)
+		type = LAYOUT_LEFTRIGHT;
+	else
+		type = LAYOUT_TOPBOTTOM;
+	if ((lc = layout_split_pane(*wp0, type, -1, 0)) == NULL)
+		snapshot_error(rd, "no space for new pane");
+	return (lc);
+}
+
+static void
+snapshot_add_window(struct snapshot_restore_data *rd, u_int id,
+    struct window *w)
+{
+	rd->windows = xreallocarray(rd->windows, rd->nwindows + 1,
+	    sizeof *rd->windows);
+	rd->windows[rd->nwindows].id = id;
+	rd->windows[rd->nwindows].w = w;
+	rd->nwindows++;
+}
+
+static void
+snapshot_add_pane(struct snapshot_restore_data *rd, struct window_pane *wp)
+{
+	rd->panes = xreallocarray(rd->panes, rd->npanes + 1,
+	    sizeof *rd->panes);
+	rd->panes[rd->npanes++] = wp;
+}
+
+/*
+ * Lay out the window once all its panes have been created. The panes are put
+ * back in the order they were saved and the layout assigns them to cells in
+ * that order.
+ */
+static void
+snapshot_layout(struct snapshot_restore_data *rd)
+{
+	struct window		*w;
+	struct window_pane	*wp;
+	u_int			 i;
+
+	if (rd->layout == NULL || rd->wl == NULL) {
+		free(rd->layout);
+		rd->layout = NULL;
+		return;
+	}
+	w = rd->wl->window;
+
+	for (i = 0; i < rd->npanes; i++) {
+		TAILQ_REMOVE(&w->panes, rd->panes[i], entry);
+		TAILQ_INSERT_TAIL(&w->panes, rd->panes[i], entry);
+	}
+	if (layout_parse(w, rd->layout) != 0)
+		snapshot_error(rd, "invalid layout: %s", rd->layout);
+	if (rd->active < rd->npanes) {
+		wp = rd->panes[rd->active];
+		window_set_active_pane(w, wp, 0);
+		if (rd->wflags & SNAPSHOT_WINDOW_ZOOMED)
+			window_zoom(wp);
+	}
+
+	free(rd->layout);
+	rd->layout = NULL;
+}
+
+static void
+snapshot_finish_window(struct snapshot_restore_data *rd)
+{
+	snapshot_layout(rd);
+
+	free(rd->name);
+	rd->name = NULL;
+	rd->wl = NULL;
+	rd->npanes = 0;
+}
+
+static void
+snapshot_finish_session(struct snapshot_restore_data *rd)
+{
+	struct session	*s = rd->s;
+
+	snapshot_finish_window(rd);
+	if (s == NULL)
+		return;
+	rd->s = NULL;
+
+	if (RB_EMPTY(&s->windows)) {
+		session_destroy(s, 0, __func__);
+		return;
+	}
+	if (winlink_find_by_index(&s->windows, rd->curw) != NULL)
+		session_select(s, rd->curw);
+	notify_session("session-created", s);
+}
+
+static int
+snapshot_restore_ids(struct snapshot_restore_data *rd)
+{
+	if (snapshot_get32(rd, &rd->next_session) != 0 ||
+	    snapshot_get32(rd, &rd->next_window) != 0 ||
+	    snapshot_get32(rd, &rd->next_pane) != 0)
+		return (-1);
+	if (rd->flags & SNAPSHOT_LIVE)
+		rd->ids = 1;
+	return (0);
+}
+
+static int
+snapshot_restore_session(struct snapshot_restore_data *rd)
+{
+	struct session		*s;
+	struct session_group	*sg;
+	char			*name = NULL, *cwd = NULL, *group = NULL;
+	u_int			 curw, id;
+	int			 retval = -1;
+
+	snapshot_finish_session(rd);
+
+	if (snapshot_get_string(rd, &name) != 0 ||
+	    snapshot_get_string(rd, &cwd) != 0 ||
+	    snapshot_get32(rd, &curw) != 0 ||
+	    snapshot_get_string(rd, &group) != 0 ||
+	    snapshot_get32_optional(rd, &id, 0) != 0)
+		goto out;
+	retval = 0;
+
+	if (session_find(name) != NULL) {
+		snapshot_error(rd, "duplicate session: %s", name);
+		goto out;
+	}
+	if (rd->ids)
+		session_set_next_id(id);
+	s = session_create(NULL, name, cwd, environ_create(),
+	    options_create(global_s_options), NULL);
+	rd->s = s;
+	rd->curw = curw;
+
+	/* Later sessions in a group take their windows from the first. */
+	if (*group != '\0') {
+		if ((sg = session_group_find(group)) == NULL)
+			sg = session_group_new(group);
+		session_group_add(sg, s);
+		if (TAILQ_FIRST(&sg->sessions) != s)
+			session_group_synchronize_to(s);
+	}
+
+out:
+	free(name);
+	free(cwd);
+	free(group);
+	return (retval);
+}
+
+/* Link a window which has already been restored into another session. */
+static void
+snapshot_link_window(struct snapshot_restore_data *rd, int idx, u_int id)
+{
+	struct session	*s = rd->s;
+	struct winlink	*wl;
+	struct window	*w = NULL;
+	u_int		 i;
+
+	for (i = 0; i < rd->nwindows; i++) {
+		if (rd->windows[i].id == id) {
+			w = rd->windows[i].w;
+			break;
+		}
+	}
+	if (w == NULL)
+		return;
+	if ((wl = winlink_add(&s->windows, idx)) == NULL) {
+		snapshot_error(rd, "couldn't add window %d", idx);
+		return;
+	}
+	if (s->curw == NULL)
+		s->curw = wl;
+	wl->session = s;
+	winlink_set_window(wl, w);
+	notify_session_window("window-linked", s, w);
+	session_group_synchronize_from(s);
+}
+
+static int
+snapshot_restore_window(struct snapshot_restore_data *rd)
+{
+	u_int	 idx, active, flags, id;
+	char	*name = NULL, *layout = NULL;
+
+	snapshot_finish_window(rd);
+
+	if (snapshot_get32(rd, &idx) != 0 ||
+	    snapshot_get_string(rd, &name) != 0 ||
+	    snapshot_get_string(rd, &layout) != 0 ||
+	    snapshot_get32(rd, &active) != 0 ||
+	    snapshot_get32(rd, &flags) != 0 ||
+	    snapshot_get32_optional(rd, &id, 0) != 0) {
+		free(name);
+		free(layout);
+		return (-1);
+	}
+	if (rd->s == NULL || (flags & SNAPSHOT_WINDOW_LINKED)) {
+		if (rd->s != NULL)
+			snapshot_link_window(rd, idx, id);
+		free(name);
+		free(layout);
+		return (0);
+	}
+
+	/* The window is created with its first pane. */
+	rd->idx = idx;
+	rd->id = id;
+	rd->name = name;
+	rd->layout = layout;
+	rd->active = active;
+	rd->wflags = flags;
+	return (0);
+}
+
+/*
+ * Create a pane. The first creates the window, which is made the size of the
+ * layout so there is room to split the biggest pane for each of the others.
+ * The processes are started without waiting for any of them.
+ */
+static int
+snapshot_restore_pane(struct snapshot_restore_data *rd)
+{
+	struct spawn_context	 sc;
+	struct window		*w;
+	struct window_pane	*wp;
+	char			*cwd = NULL, **argv = NULL, *cause;
+	u_int			 argc = 0, i, sx, sy;
+	int			 retval = -1;
+
+	if (snapshot_get_string(rd, &cwd) != 0 ||
+	    snapshot_get32(rd, &argc) != 0 ||
+	    argc > (rd->end - rd->off) / 4)
+		goto out;
+	argv = xcalloc(argc + 1, sizeof *argv);
+	for (i = 0; i < argc; i++) {
+		if (snapshot_get_string(rd, &argv[i]) != 0)
+			goto out;
+	}
+	retval = 0;
+	if (rd->s == NULL || rd->layout == NULL)
+		goto out;
+
+	memset(&sc, 0, sizeof sc);
+	sc.item = rd->item;
+	sc.s = rd->s;
+
+	sc.argc = argc;
+	sc.argv = argv;
+
+	sc.cwd = (*cwd == '\0' ? NULL : cwd);
+	sc.flags = SPAWN_DETACHED;
+
+	if (rd->wl == NULL) {
+		sc.idx = rd->idx;
+		if ((rd->wl = spawn_window(&sc, &cause)) == NULL) {
+			snapshot_error(rd, "create window failed: %s", cause);
+			free(cause);
+			free(rd->layout);
+			rd->layout = NULL;
+			goto out;
+		}
+		w = rd->wl->window;
+		wp = w->active;
+		snapshot_add_window(rd, rd->id, w);
+
+		free(w->name);
+		w->name = rd->name;
+		rd->name = NULL;
+
+		if (sscanf(rd->layout, "%*x,%ux%u,", &sx, &sy) == 2)
+			resize_window(w, sx, sy, w->xpixel, w->ypixel);
+	} else {
+		if ((sc.lc = snapshot_split(rd, &sc.wp0)) == NULL)
+			goto out;
+		sc.wl = rd->wl;
+		sc.idx = -1;
+		if ((wp = spawn_pane(&sc, &cause)) == NULL) {
+			snapshot_error(rd, "create pane failed: %s", cause);
+			free(cause);
+			goto out;
+		}
+	}
+	snapshot_add_pane(rd, wp);
+
+out:
+	free(cwd);
+	if (argv != NULL) {
+		for (i = 0; i < argc; i++)
+			free(argv[i]);
+		free(argv);
+	}
+	return (retval);
+}
+
+/* Create a window for a pane which is being kept, without a process. */
+static struct winlink *
+snapshot_live_window(struct snapshot_restore_data *rd)
+{
+	struct session	*s = rd->s;
+	struct winlink	*wl;
+	struct window	*w;
+	u_int		 sx, sy;
+
+	if ((wl = winlink_add(&s->windows, rd->idx)) == NULL) {
+		snapshot_error(rd, "couldn't add window %d", rd->idx);
+		free(rd->layout);
+		rd->layout = NULL;
+		return (NULL);
+	}
+	if (sscanf(rd->layout, "%*x,%ux%u,", &sx, &sy) != 2) {
+		sx = 80;
+		sy = 24;
+	}
+	if (rd->ids)
+		window_set_next_id(rd->id);
+	w = window_create(sx, sy, 0, 0);
+	snapshot_add_window(rd, rd->id, w);
+
+	free(w->name);
+	w->name = rd->name;
+	rd->name = NULL;
+
+	if (s->curw == NULL)
+		s->curw = wl;
+	wl->session = s;
+	winlink_set_window(wl, w);
+	notify_session_window("window-linked", s, w);
+	session_group_synchronize_from(s);
+	return (wl);
+}
+
+/*
+ * Create a pane for a process and pty which are being kept. The descriptors
+ * are only trusted from a live snapshot; from anywhere else the record is
+ * ignored.
+ */
+static int
+snapshot_restore_live_pane(struct snapshot_restore_data *rd)
+{
+	struct session		*s = rd->s;
+	struct window		*w;
+	struct window_pane	*wp, *wp0;
+	struct layout_cell	*lc;
+	char			*cwd = NULL, **argv = NULL, *shell = NULL;
+	char			*tty = NULL;
+	u_int			 id, argc = 0, i, pid, fd, flags, status;
+	u_int			 hlimit;
+	int			 retval = -1, keep = 0;
+
+	if (snapshot_get32(rd, &id) != 0 ||
+	    snapshot_get_string(rd, &cwd) != 0 ||
+	    snapshot_get32(rd, &argc) != 0 ||
+	    argc > (rd->end - rd->off) / 4)
+		goto out;
+	argv = xcalloc(argc + 1, sizeof *argv);
+	for (i = 0; i < argc; i++) {
+		if (snapshot_get_string(rd, &argv[i]) != 0)
+			goto out;
+	}
+	if (snapshot_get_string(rd, &shell) != 0 ||
+	    snapshot_get32(rd, &pid) != 0 ||
+	    snapshot_get32(rd, &fd) != 0 ||
+	    snapshot_get_string(rd, &tty) != 0 ||
+	    snapshot_get32(rd, &flags) != 0 ||
+	    snapshot_get32(rd, &status) != 0)
+		goto out;
+	retval = 0;
+	if (~rd->flags & SNAPSHOT_LIVE)
+		goto out;
+	keep = ((int)fd != -1);
+	if (s == NULL || rd->layout == NULL)
+		goto out;
+
+	hlimit = options_get_number(s->options, "history-limit");
+	if (rd->ids)
+		window_pane_set_next_id(id);
+	if (rd->wl == NULL) {
+		if ((rd->wl = snapshot_live_window(rd)) == NULL)
+			goto out;
+		w = rd->wl->window;
+		wp = window_add_pane(w, NULL, hlimit, 0);
+		layout_init(w, wp);
+		window_set_active_pane(w, wp, 0);
+	} else {
+		w = rd->wl->window;
+		if ((lc = snapshot_split(rd, &wp0)) == NULL)
+			goto out;
+		wp = window_add_pane(w, wp0, hlimit, 0);
+		layout_assign_pane(lc, wp, 0);
+	}
+	wp->base.grid->hcompress = options_get_number(s->options,
+	    "history-compress");
+	wp->base.grid->hmemlimit = options_get_number(s->options,
+	    "history-memory-limit");
+	if (options_get_number(s->options, "history-index"))
+		grid_index_enable(wp->base.grid);
+
+	if (argc != 0) {
+		cmd_free_argv(wp->argc, wp->argv);
+		wp->argc = argc;
+		wp->argv = cmd_copy_argv(argc, argv);
+	}
+	free(wp->shell);
+	wp->shell = xstrdup(shell);
+	free(wp->cwd);
+	wp->cwd = xstrdup(cwd);
+
+	wp->pid = pid;
+	wp->flags |= (flags & SNAPSHOT_PANE_FLAGS);
+	wp->status = status;
+	window_pane_set_tty(wp, tty);
+	if (keep) {
+		wp->fd = fd;
+		window_pane_set_event(wp);
+		keep = 0;
+	} else
+		wp->ictx = input_init(wp, NULL);
+	snapshot_add_pane(rd, wp);
+
+out:
+	if (keep)
+		close(fd);
+	free(cwd);
+	free(shell);
+	free(tty);
+	if (argv != NULL) {
+		for (i = 0; i < argc; i++)
+			free(argv[i]);
+		free(argv);
+	}
+	return (retval);
+}
+
+static void
+snapshot_set_option(struct snapshot_restore_data *rd, struct options *oo,
+    struct options *global, const char *name, const char *value)
+{
+	struct options_entry			*o;
+	const struct options_table_entry	*oe = NULL;
+	char					*base, *cause = NULL;
+	int					 idx;
+
+	if ((base = options_parse(name, &idx)) == NULL) {
+		snapshot_error(rd, "invalid option: %s", name);
+		return;
+	}
+	if (*base != '@') {
+		if ((o = options_get_only(global, base)) == NULL) {
+			snapshot_error(rd, "invalid option: %s", name);
+			goto out;
+		}
+		oe = options_table_entry(o);
+	}
+
+	if (oe == NULL && idx == -1)
+		options_set_string(oo, base, 0, "%s", value);
+	else if (oe != NULL && (oe->flags & OPTIONS_TABLE_IS_ARRAY)) {
+		if ((o = options_get_only(oo, base)) == NULL)
+			o = options_empty(oo, oe);
+		if (idx == -1)
+			options_array_clear(o);
+		else if (options_array_set(o, idx, value, 0, &cause) != 0)
+			goto fail;
+	} else if (idx == -1) {
+		if (options_from_string(oo, oe, base, value, 0, &cause) != 0)
+			goto fail;
+	} else {
+		snapshot_error(rd, "not an array: %s", name);
+		goto out;
+	}
+	options_push_changes(base);
+	goto out;
+
+fail:
+	if (cause != NULL) {
+		snapshot_error(rd, "%s: %s", name, cause);
+		free(cause);
+	} else
+		snapshot_error(rd, "invalid value: %s", name);
+out:
+	free(base);
+}
+
+static int
+snapshot_restore_option(struct snapshot_restore_data *rd)
+{
+	struct options	*oo, *global;
+	char		*name = NULL, *value = NULL;
+	u_int		 scope, pane;
+	int		 retval = -1;
+
+	if (snapshot_get8(rd, &scope) != 0 ||
+	    snapshot_get32(rd, &pane) != 0 ||
+	    snapshot_get_string(rd, &name) != 0 ||
+	    snapshot_get_string(rd, &value) != 0)
+		goto out;
+	retval = 0;
+
+	switch (scope) {
+	case SNAPSHOT_SCOPE_SESSION:
+		if (rd->s == NULL)
+			goto out;
+		oo = rd->s->options;
+		global = global_s_options;
+		break;
+	case SNAPSHOT_SCOPE_WINDOW:
+		if (rd->s == NULL || rd->wl == NULL)
+			goto out;
+		oo = rd->wl->window->options;
+		global = global_w_options;
+		break;
+	case SNAPSHOT_SCOPE_PANE:
+		if (rd->s == NULL || rd->wl == NULL || pane >= rd->npanes)
+			goto out;
+		oo = rd->panes[pane]->options;
+		global = global_w_options;
+		break;
+	case SNAPSHOT_SCOPE_SERVER:
+		oo = global = global_options;
+		break;
+	case SNAPSHOT_SCOPE_GLOBAL_SESSION:
+		oo = global = global_s_options;
+		break;
+	case SNAPSHOT_SCOPE_GLOBAL_WINDOW:
+		oo = global = global_w_options;
+		break;
+	default:
+		goto out;
+	}
+	snapshot_set_option(rd, oo, global, name, value);
+
+out:
+	free(name);
+	free(value);
+	return (retval);
+}
+
+static int
+snapshot_restore_grid(struct snapshot_restore_data *rd)
+{
+	struct window_pane	*wp;
+	u_char			*data, *copy;
+	size_t			 size;
+	u_int			 pane;
+
+	if (snapshot_get32(rd, &pane) != 0 ||
+	    snapshot_get_contents(rd, &data, &size, &copy) != 0)
+		return (-1);
+	if (rd->wl != NULL && pane < rd->npanes) {
+		wp = rd->panes[pane];
+		if (wp->ictx != NULL)
+			input_parse_buffer(wp, data, size);
+	}
+	free(copy);
+	return (0);
+}
+
+static int
+snapshot_restore_screen(struct snapshot_restore_data *rd)
+{
+	struct window_pane	*wp;
+	struct screen		*s;
+	u_char			*data, *copy = NULL;
+	size_t			 size;
+	u_int			 pane, mode, cx, cy, rupper, rlower;
+	char			*title = NULL;
+	int			 retval = -1;
+
+	if (snapshot_get32(rd, &pane) != 0 ||
+	    snapshot_get32(rd, &mode) != 0 ||
+	    snapshot_get32(rd, &cx) != 0 ||
+	    snapshot_get32(rd, &cy) != 0 ||
+	    snapshot_get32(rd, &rupper) != 0 ||
+	    snapshot_get32(rd, &rlower) != 0 ||
+	    snapshot_get_string(rd, &title) != 0 ||
+	    snapshot_get_contents(rd, &data, &size, &copy) != 0)
+		goto out;
+	retval = 0;
+	if (rd->wl == NULL || pane >= rd->npanes)
+		goto out;
+	wp = rd->panes[pane];
+	s = &wp->base;
+
+	input_parse_buffer(wp, data, size);
+	s->mode = mode;
+	screen_set_title(s, title);
+	if (cx < screen_size_x(s) && cy < screen_size_y(s)) {
+		s->cx = cx;
+		s->cy = cy;
+	}
+	if (rupper < rlower && rlower < screen_size_y(s)) {
+		s->rupper = rupper;
+		s->rlower = rlower;
+	}
+
+out:
+	free(title);
+	free(copy);
+	return (retval);
+}
+
+/* Bindings are replaced, so the first removes any which already exist. */
+static int
+snapshot_restore_key(struct snapshot_restore_data *rd)
+{
+	struct key_table	*table, *table1;
+	struct key_binding	*bd, *bd1;
+	struct cmd_parse_result	*pr;
+	char			*name = NULL, *note = NULL, *cmd = NULL;
+	unsigned long long	 key;
+	u_int			 flags;
+	int			 retval = -1;
+
+	if (snapshot_get_string(rd, &name) != 0 ||
+	    snapshot_get64(rd, &key) != 0 ||
+	    snapshot_get_string(rd, &note) != 0 ||
+	    snapshot_get32(rd, &flags) != 0 ||
+	    snapshot_get_string(rd, &cmd) != 0)
+		goto out;
+	retval = 0;
+
+	if (!rd->keys) {
+		table = key_bindings_first_table();
+		while (table != NULL) {
+			table1 = key_bindings_next_table(table);
+			bd = key_bindings_first(table);
+			while (bd != NULL) {
+				bd1 = key_bindings_next(table, bd);
+				key_bindings_remove(table->name, bd->key);
+				bd = bd1;
+			}
+			table = table1;
+		}
+		rd->keys = 1;
+	}
+
+	pr = cmd_parse_from_string(cmd, NULL);
+	switch (pr->status) {
+	case CMD_PARSE_EMPTY:
+		snapshot_error(rd, "empty command for key %s in table %s",
+		    key_string_lookup_key(key, 0), name);
+		break;
+	case CMD_PARSE_ERROR:
+		snapshot_error(rd, "%s", pr->error);
+		free(pr->error);
+		break;
+	case CMD_PARSE_SUCCESS:
+		key_bindings_add(name, key, *note == '\0' ? NULL : note,
+		    flags & KEY_BINDING_REPEAT, pr->cmdlist);
+		break;
+	}
+
+out:
+	free(name);
+	free(note);
+	free(cmd);
+	return (retval);
+}
+
+/* The global environment is replaced, so the first empties it. */
+static int
+snapshot_restore_environ(struct snapshot_restore_data *rd)
+{
+	struct environ		*env;
+	struct environ_entry	*envent;
+	char			*name = NULL, *value = NULL;
+	u_int			 scope, set, flags;
+	int			 retval = -1;
+
+	if (snapshot_get8(rd, &scope) != 0 ||
+	    snapshot_get_string(rd, &name) != 0 ||
+	    snapshot_get8(rd, &set) != 0 ||
+	    snapshot_get_string(rd, &value) != 0 ||
+	    snapshot_get32(rd, &flags) != 0)
+		goto out;
+	retval = 0;
+
+	switch (scope) {
+	case SNAPSHOT_SCOPE_SERVER:
+		env = global_environ;
+		if (!rd->environ) {
+			while ((envent = environ_first(env)) != NULL)
+				environ_unset(env, envent->name);
+			rd->environ = 1;
+		}
+		break;
+	case SNAPSHOT_SCOPE_SESSION:
+		if (rd->s == NULL)
+			goto out;
+		env = rd->s->environ;
+		break;
+	default:
+		goto out;
+	}
+	if (set)
+		environ_set(env, name, flags, "%s", value);
+	else
+		environ_clear(env, name);
+
+out:
+	free(name);
+	free(value);
+	return (retval);
+}
+
+static int
+snapshot_restore_buffer(struct snapshot_restore_data *rd)
+{
+	char	*name = NULL, *copy;
+	u_char	*data;
+	size_t	 size;
+	u_int	 automatic;
+
+	if (snapshot_get_string(rd, &name) != 0 ||
+	    snapshot_get8(rd, &automatic) != 0 ||
+	    snapshot_get_data(rd, &data, &size) != 0) {
+		free(name);
+		return (-1);
+	}
+	if (size != 0) {
+		copy = xmalloc(size);
+		memcpy(copy, data, size);
+		if (automatic || *name == '\0')
+			paste_add(NULL, copy, size);
+		else
+			paste_set(copy, size, name, NULL);
+	}
+	free(name);
+	return (0);
+}
+
+static void
+snapshot_parse(struct snapshot_restore_data *rd, u_char *buf, size_t len)
+{
+	size_t	 hdrlen = strlen(SNAPSHOT_MAGIC), end;
+	u_int	 version, type, size;
+	int	 retval;
+
+	rd->buf = buf;
+	rd->end = len;
+	if (len < hdrlen || memcmp(buf, SNAPSHOT_MAGIC, hdrlen) != 0) {
+		snapshot_error(rd, "not a saved server");
+		return;
+	}
+	rd->off = hdrlen;
+	if (snapshot_get32(rd, &version) != 0 || version != SNAPSHOT_VERSION) {
+		snapshot_error(rd, "unsupported version");
+		return;
+	}
+
+	for (;;) {
+		rd->end = len;
+		if (snapshot_get8(rd, &type) != 0 ||
+		    snapshot_get32(rd, &size) != 0 ||
+		    size > len - rd->off) {
+			snapshot_error(rd, "file is truncated");
+			break;
+		}
+		end = rd->end = rd->off + size;
+
+		if (type != SNAPSHOT_PANE && type != SNAPSHOT_LIVE_PANE)
+			snapshot_layout(rd);
+		switch (type) {
+		case SNAPSHOT_SESSION:
+			retval = snapshot_restore_session(rd);
+			break;
+		case SNAPSHOT_WINDOW:
+			retval = snapshot_restore_window(rd);
+			break;
+		case SNAPSHOT_PANE:
+			retval = snapshot_restore_pane(rd);
+			break;
+		case SNAPSHOT_OPTION:
+			retval = snapshot_restore_option(rd);
+			break;
+		case SNAPSHOT_GRID:
+			retval = snapshot_restore_grid(rd);
+			break;
+		case SNAPSHOT_IDS:
+			retval = snapshot_restore_ids(rd);
+			break;
+		case SNAPSHOT_LIVE_PANE:
+			retval = snapshot_restore_live_pane(rd);
+			break;
+		case SNAPSHOT_SCREEN:
+			retval = snapshot_restore_screen(rd);
+			break;
+		case SNAPSHOT_KEY:
+			retval = snapshot_restore_key(rd);
+			break;
+		case SNAPSHOT_ENVIRON:
+			retval = snapshot_restore_environ(rd);
+			break;
+		case SNAPSHOT_BUFFER:
+			retval = snapshot_restore_buffer(rd);
+			break;
+		default:
+			retval = 0;
+			break;
+		}
+		if (retval != 0) {
+			snapshot_error(rd, "bad record at offset %zu",
+			    end - size);
+			break;
+		}
+		if (type == SNAPSHOT_END)
+			break;
+		rd->off = end;
+	}
+	snapshot_finish_session(rd);
+}
+
+/*
+ * Restore from a buffer. Errors are reported to the item if there is one. Pane
+ * descriptors are only used if SNAPSHOT_LIVE is given.
+ */
+void
+snapshot_restore(struct cmdq_item *item, u_char *buf, size_t len, int flags)
+{
+	struct snapshot_restore_data	rd;
+
+	memset(&rd, 0, sizeof rd);
+	rd.item = item;
+	rd.flags = flags;
+	snapshot_parse(&rd, buf, len);
+
+	if (rd.ids) {
+		session_set_next_id(rd.next_session);
+		window_set_next_id(rd.next_window);
+		window_pane_set_next_id(rd.next_pane);
+	}
+	free(rd.panes);
+	free(rd.windows);
+	recalculate_sizes();
+}
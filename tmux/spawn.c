@@ -197,6 +197,82 @@ spawn_window(struct spawn_context *sc, char **cause)
 	return (sc->wl);
 }
 
+#ifdef PROC_SPAWN
+/*
+ * Start the process for a pane running a shell without copying the server.
+ * Returns the pid with the pane's pty open, or -1.
+ */
+static pid_t
+spawn_pane_start(struct session *s, struct window_pane *wp,
+    struct environ *base, struct environ *child, char *tty,
+    struct winsize *ws, sigset_t *oldset)
+{
+	struct termios	  now;
+	key_code	  key;
+	char		**envp, *argv0, *argv[4];
+	const char	 *cp;
+	int		  slave;
+	pid_t		  pid;
+
+	if (openpty(&wp->fd, &slave, tty, NULL, ws) != 0)
+		return (-1);
+
+	/*
+	 * Update terminal escape characters from the session if available and
+	 * force VERASE to tmux's backspace.
+	 */
+	if (tcgetattr(slave, &now) != 0)
+		goto fail;
+	if (s->tio != NULL)
+		memcpy(now.c_cc, s->tio->c_cc, sizeof now.c_cc);
+	key = options_get_number(global_options, "backspace");
+	if (key >= 0x7f)
+		now.c_cc[VERASE] = '\177';
+	else
+		now.c_cc[VERASE] = key;
+#ifdef IUTF8
+	now.c_iflag |= IUTF8;
+#endif
+	if (tcsetattr(slave, TCSANOW, &now) != 0)
+		goto fail;
+
+	/* Run the one argument with $SHELL -c or create a login shell. */
+	cp = strrchr(wp->shell, '/');
+	if (wp->argc == 1) {
+		if (cp != NULL && cp[1] != '\0')
+			xasprintf(&argv0, "%s", cp + 1);
+		else
+			xasprintf(&argv0, "%s", wp->shell);
+		argv[1] = (char *)"-c";
+		argv[2] = wp->argv[0];
+		argv[3] = NULL;
+	} else {
+		if (cp != NULL && cp[1] != '\0')
+			xasprintf(&argv0, "-%s", cp + 1);
+		else
+			xasprintf(&argv0, "-%s", wp->shell);
+		argv[1] = NULL;
+	}
+	argv[0] = argv0;
+
+	envp = environ_exec(base, child);
+	pid = proc_spawn(wp->shell, argv, envp, wp->cwd, slave, slave, slave, 1,
+	    oldset);
+	environ_free_exec(envp);
+	free(argv0);
+
+	if (pid == -1)
+		goto fail;
+	close(slave);
+	return (pid);
+
+fail:
+	close(slave);
+	close(wp->fd);
+	return (-1);
+}
+#endif
+
 struct window_pane *
 spawn_pane(struct spawn_context *sc, char **cause)
 {
@@ -206,10 +282,11 @@ spawn_pane(struct spawn_context *sc, char **cause)
 	struct session		 *s = sc->s;
 	struct window		 *w = sc->wl->window;
 	struct window_pane	 *new_wp;
-	struct environ		 *child;
+	struct environ		 *base, *child;
 	struct environ_entry	 *ee;
 	char			**argv, *cp, **argvp, *argv0, *cwd;
 	const char		 *cmd, *tmp;
+	char			  tty[TTY_NAME_MAX];
 	int			  argc;
 	u_int			  idx;
 	struct termios		  now;
@@ -245,6 +322,8 @@ spawn_pane(struct spawn_context *sc, char **cause)
 			return (NULL);
 		}
 		if (sc->wp0->fd != -1) {
+			window_pane_splice_stop(sc->wp0);
+			event_del(&sc->wp0->read_event);
 			bufferevent_free(sc->wp0->event);
 			close(sc->wp0->fd);
 		}
@@ -264,6 +343,12 @@ spawn_pane(struct spawn_context *sc, char **cause)
 		else
 			layout_assign_pane(sc->lc, new_wp, 0);
 	}
+	new_wp->base.grid->hcompress = options_get_number(s->options,
+	    "history-compress");
+	new_wp->base.grid->hmemlimit = options_get_number(s->options,
+	    "history-memory-limit");
+	if (options_get_number(s->options, "history-index"))
+		grid_index_enable(new_wp->base.grid);
 
 	/*
 	 * Now we have a pane with nothing running in it ready for the new
@@ -298,8 +383,13 @@ spawn_pane(struct spawn_context *sc, char **cause)
 		new_wp->argv = cmd_copy_argv(argc, argv);
 	}
 
-	/* Create an environment for this pane. */
-	child = environ_for_session(s, 0);
+	/*
+	 * Create an environment for this pane. This holds only the variables
+	 * which differ from the session environment, which is shared by all
+	 * new panes until it changes.
+	 */
+	base = environ_session(s);
+	child = environ_create();
 	if (sc->environ != NULL)
 		environ_copy(sc->environ, child);
 	environ_set(child, "TMUX_PANE", 0, "%%%u", new_wp->id);
@@ -314,7 +404,8 @@ spawn_pane(struct spawn_context *sc, char **cause)
 		if (ee != NULL)
 			environ_set(child, "PATH", 0, "%s", ee->value);
 	}
-	if (environ_find(child, "PATH") == NULL)
+	if (environ_find(child, "PATH") == NULL &&
+	    environ_find(base, "PATH") == NULL)
 		environ_set(child, "PATH", 0, "%s", _PATH_DEFPATH);
 
 	/* Then the shell. If respawning, use the old one. */
@@ -358,8 +449,17 @@ spawn_pane(struct spawn_context *sc, char **cause)
 		goto complete;
 	}
 
-	/* Fork the new process. */
-	new_wp->pid = fdforkpty(ptm_fd, &new_wp->fd, new_wp->tty, NULL, &ws);
+	/*
+	 * Fork the new process. A shell can be started without copying the
+	 * server; a command with arguments needs execvp() in the child.
+	 */
+#ifdef PROC_SPAWN
+	if (new_wp->argc <= 1) {
+		new_wp->pid = spawn_pane_start(s, new_wp, base, child, tty, &ws,
+		    &oldset);
+	} else
+#endif
+	new_wp->pid = fdforkpty(ptm_fd, &new_wp->fd, tty, NULL, &ws);
 	if (new_wp->pid == -1) {
 		xasprintf(cause, "fork failed: %s", strerror(errno));
 		new_wp->fd = -1;
@@ -374,8 +474,10 @@ spawn_pane(struct spawn_context *sc, char **cause)
 	}
 
 	/* In the parent process, everything is done now. */
-	if (new_wp->pid != 0)
+	if (new_wp->pid != 0) {
+		window_pane_set_tty(new_wp, tty);
 		goto complete;
+	}
 
 	/*
 	 * Child process. Change to the working directory or home if that
@@ -410,7 +512,7 @@ spawn_pane(struct spawn_context *sc, char **cause)
 	proc_clear_signals(server_proc, 1);
 	sigprocmask(SIG_SETMASK, &oldset, NULL);
 	log_close();
-	environ_push(child);
+	environ_push(base, child);
 
 	/*
 	 * If given multiple arguments, use execvp(). Copy the arguments to
@@ -49,10 +49,18 @@ struct status_prompt_menu {
 	char		  flag;
 };
 
-/* Status prompt history. */
-#define PROMPT_HISTORY 100
+/*
+ * Status prompt history. The entries are in hlist from hfirst, oldest first,
+ * so the oldest can be removed without moving the others. hunsaved is how
+ * many of the newest are not yet in the history file and hfile how many
+ * lines the file has.
+ */
 static char	**status_prompt_hlist;
+static u_int	  status_prompt_hfirst;
 static u_int	  status_prompt_hsize;
+static u_int	  status_prompt_halloc;
+static u_int	  status_prompt_hunsaved;
+static u_int	  status_prompt_hfile;
 
 /* Find the history file to load/save from/to. */
 static char *
@@ -98,6 +106,7 @@ status_prompt_load_history(void)
 	for (;;) {
 		if ((line = fgetln(f, &length)) == NULL)
 			break;
+		status_prompt_hfile++;
 
 		if (length > 0) {
 			if (line[length - 1] == '\n') {
@@ -113,21 +122,39 @@ status_prompt_load_history(void)
 		}
 	}
 	fclose(f);
+	status_prompt_hunsaved = 0;
 }
 
-/* Save status prompt history to file. */
+/*
+ * Save status prompt history to file. Commands added since it was loaded are
+ * appended, unless that would make the file more than twice as long as the
+ * history, in which case it is written again with only the history.
+ */
 void
 status_prompt_save_history(void)
 {
-	FILE	*f;
-	u_int	 i;
-	char	*history_file;
+	FILE		*f;
+	u_int		 i, limit;
+	char		*history_file;
+	const char	*mode;
 
+	if (status_prompt_hunsaved == 0)
+		return;
 	if ((history_file = status_prompt_find_history_file()) == NULL)
 		return;
-	log_debug("saving history to %s", history_file);
 
-	f = fopen(history_file, "w");
+	limit = options_get_number(global_options, "prompt-history-limit");
+	if (status_prompt_hfile + status_prompt_hunsaved > limit * 2) {
+		mode = "w";
+		i = 0;
+		status_prompt_hfile = 0;
+	} else {
+		mode = "a";
+		i = status_prompt_hsize - status_prompt_hunsaved;
+	}
+	log_debug("saving history to %s (%s)", history_file, mode);
+
+	f = fopen(history_file, mode);
 	if (f == NULL) {
 		log_debug("%s: %s", history_file, strerror(errno));
 		free(history_file);
@@ -135,38 +162,86 @@ status_prompt_save_history(void)
 	}
 	free(history_file);
 
-	for (i = 0; i < status_prompt_hsize; i++) {
-		fputs(status_prompt_hlist[i], f);
+	for (; i < status_prompt_hsize; i++) {
+		fputs(status_prompt_hlist[status_prompt_hfirst + i], f);
 		fputc('\n', f);
+		status_prompt_hfile++;
 	}
 	fclose(f);
+	status_prompt_hunsaved = 0;
+}
 
+/*
+ * Check if the status line might be different from when it was last
+ * expanded, without anything having asked for it to be redrawn.
+ */
+static int
+status_changed(struct client *c)
+{
+	struct status_line	*sl = &c->status;
+
+	if (sl->uses & FORMAT_USES_STATE)
+		return (1);
+	if ((sl->uses & FORMAT_USES_TIME) && time(NULL) >= sl->time_next)
+		return (1);
+	return (0);
 }
 
-/* Status timer callback. */
+/*
+ * Add the status timer. If the status line only depends on the time, it need
+ * not be checked again until the time changes; if it depends on nothing that
+ * can change without a redraw, it need not be checked at all.
+ */
 static void
-status_timer_callback(__unused int fd, __unused short events, void *arg)
+status_timer_add(struct client *c)
 {
-	struct client	*c = arg;
-	struct session	*s = c->session;
-	struct timeval	 tv;
+	struct status_line	*sl = &c->status;
+	struct session		*s = c->session;
+	struct timeval		 tv;
+	time_t			 t;
 
-	evtimer_del(&c->status.timer);
+	if (!event_initialized(&sl->timer))
+		return;
+	evtimer_del(&sl->timer);
 
 	if (s == NULL)
 		return;
 
-	if (c->message_string == NULL && c->prompt_string == NULL)
-		c->flags |= CLIENT_REDRAWSTATUS;
-
 	timerclear(&tv);
 	tv.tv_sec = options_get_number(s->options, "status-interval");
+	if (tv.tv_sec == 0)
+		return;
 
-	if (tv.tv_sec != 0)
-		evtimer_add(&c->status.timer, &tv);
+	if (~sl->uses & FORMAT_USES_STATE) {
+		if (~sl->uses & FORMAT_USES_TIME) {
+			log_debug("client %p, status timer not needed", c);
+			return;
+		}
+		t = time(NULL);
+		if (sl->time_next > t + tv.tv_sec)
+			tv.tv_sec = sl->time_next - t;
+	}
+
+	evtimer_add(&sl->timer, &tv);
 	log_debug("client %p, status interval %d", c, (int)tv.tv_sec);
 }
 
+/* Status timer callback. */
+static void
+status_timer_callback(__unused int fd, __unused short events, void *arg)
+{
+	struct client	*c = arg;
+
+	if (c->session == NULL)
+		return;
+
+	if (c->message_string == NULL &&
+	    c->prompt_string == NULL &&
+	    status_changed(c))
+		c->flags |= CLIENT_REDRAWSTATUS;
+	status_timer_add(c);
+}
+
 /* Start status timer for client. */
 void
 status_timer_start(struct client *c)
@@ -259,6 +334,82 @@ status_free_ranges(struct style_ranges *srs)
 	}
 }
 
+/*
+ * Copy the status line of another client attached to the same session if it
+ * was drawn for the same size and window offset and did not depend on
+ * anything else about the client itself. Returns -1 if it cannot be used,
+ * otherwise if the status line has changed.
+ */
+static int
+status_copy(struct client *c, u_int lines)
+{
+	struct status_line		*sl = &c->status, *from;
+	struct client			*loop = c->session->status_client;
+	struct status_line_entry	*sle, *fe;
+	struct style_range		*sr, *new;
+	u_int				 i, width = c->tty.sx;
+	u_int				 ox[2], oy[2], sx[2], sy[2];
+	int				 bigger[2], changed = 0;
+
+	if (loop == NULL || loop == c || (c->flags & CLIENT_STATUSFORCE))
+		return (-1);
+	from = &loop->status;
+	if (loop->session != c->session ||
+	    from->active != &from->screen ||
+	    screen_size_x(&from->screen) != width ||
+	    screen_size_y(&from->screen) != lines)
+		return (-1);
+	bigger[0] = tty_window_offset(&c->tty, &ox[0], &oy[0], &sx[0], &sy[0]);
+	bigger[1] = tty_window_offset(&loop->tty, &ox[1], &oy[1], &sx[1],
+	    &sy[1]);
+	if (bigger[0] != bigger[1] ||
+	    ox[0] != ox[1] ||
+	    oy[0] != oy[1] ||
+	    sx[0] != sx[1] ||
+	    sy[0] != sy[1])
+		return (-1);
+
+	if (!grid_cells_equal(&from->style, &sl->style)) {
+		changed = 1;
+		memcpy(&sl->style, &from->style, sizeof sl->style);
+	}
+	if (screen_size_x(&sl->screen) != width ||
+	    screen_size_y(&sl->screen) != lines) {
+		screen_resize(&sl->screen, width, lines, 0);
+		changed = 1;
+	}
+	grid_duplicate_lines(sl->screen.grid, 0, from->screen.grid, 0, lines);
+
+	for (i = 0; i < lines; i++) {
+		sle = &sl->entries[i];
+		fe = &from->entries[i];
+
+		status_free_ranges(&sle->ranges);
+		TAILQ_FOREACH(sr, &fe->ranges, entry) {
+			new = xmalloc(sizeof *new);
+			memcpy(new, sr, sizeof *new);
+			TAILQ_INSERT_TAIL(&sle->ranges, new, entry);
+		}
+
+		if (sle->expanded != NULL &&
+		    fe->expanded != NULL &&
+		    strcmp(sle->expanded, fe->expanded) == 0)
+			continue;
+		if (sle->expanded == NULL && fe->expanded == NULL)
+			continue;
+		changed = 1;
+		free(sle->expanded);
+		if (fe->expanded != NULL)
+			sle->expanded = xstrdup(fe->expanded);
+		else
+			sle->expanded = NULL;
+	}
+
+	sl->uses = from->uses;
+	sl->time_next = from->time_next;
+	return (changed);
+}
+
 /* Save old status line. */
 static void
 status_push_screen(struct client *c)
@@ -297,6 +448,8 @@ status_init(struct client *c)
 
 	screen_init(&sl->screen, c->tty.sx, 1, 0);
 	sl->active = &sl->screen;
+
+	sl->uses = FORMAT_USES_STATE;
 }
 
 /* Free status line. */
@@ -332,6 +485,7 @@ status_redraw(struct client *c)
 	struct grid_cell		 gc;
 	u_int				 lines, i, n, width = c->tty.sx;
 	int				 flags, force = 0, changed = 0, fg, bg;
+	int				 copied;
 	struct options_entry		*o;
 	union options_value		*ov;
 	struct format_tree		*ft;
@@ -348,6 +502,13 @@ status_redraw(struct client *c)
 	if (c->tty.sy == 0 || lines == 0)
 		return (1);
 
+	/* Use the same status line as another client if possible. */
+	if ((copied = status_copy(c, lines)) != -1) {
+		status_timer_add(c);
+		log_debug("%s exit: copied, changed=%d", __func__, copied);
+		return (copied);
+	}
+
 	/* Create format tree. */
 	flags = FORMAT_STATUS;
 	if (c->flags & CLIENT_STATUSFORCE)
@@ -415,9 +576,15 @@ status_redraw(struct client *c)
 	}
 	screen_write_stop(&ctx);
 
-	/* Free the format tree. */
+	/* Keep what the status line depends on and free the format tree. */
+	sl->uses = format_get_uses(ft, &sl->time_next);
 	format_free(ft);
 
+	/* Let other clients of the session use this status line. */
+	if (~sl->uses & FORMAT_USES_CLIENT)
+		s->status_client = c;
+	status_timer_add(c);
+
 	/* Return if the status line has changed. */
 	log_debug("%s exit: force=%d, changed=%d", __func__, force, changed);
 	return (force || changed);
@@ -1358,7 +1525,8 @@ status_prompt_up_history(u_int *idx)
 	if (status_prompt_hsize == 0 || *idx == status_prompt_hsize)
 		return (NULL);
 	(*idx)++;
-	return (status_prompt_hlist[status_prompt_hsize - *idx]);
+	return (status_prompt_hlist[status_prompt_hfirst + status_prompt_hsize -
+	    *idx]);
 }
 
 /* Get next line from the history. */
@@ -1370,32 +1538,55 @@ status_prompt_down_history(u_int *idx)
 	(*idx)--;
 	if (*idx == 0)
 		return ("");
-	return (status_prompt_hlist[status_prompt_hsize - *idx]);
+	return (status_prompt_hlist[status_prompt_hfirst + status_prompt_hsize -
+	    *idx]);
 }
 
-/* Add line to the history. */
+/*
+ * Add line to the history, removing the oldest if there are more than the
+ * limit. When the end of the array is reached, it is made bigger if at least
+ * half is in use, otherwise the entries are moved back to the start.
+ */
 static void
 status_prompt_add_history(const char *line)
 {
-	size_t	size;
+	char	**hlist;
+	u_int	  limit;
 
-	if (status_prompt_hsize > 0 &&
-	    strcmp(status_prompt_hlist[status_prompt_hsize - 1], line) == 0)
+	limit = options_get_number(global_options, "prompt-history-limit");
+	if (limit == 0)
 		return;
 
-	if (status_prompt_hsize == PROMPT_HISTORY) {
-		free(status_prompt_hlist[0]);
-
-		size = (PROMPT_HISTORY - 1) * sizeof *status_prompt_hlist;
-		memmove(&status_prompt_hlist[0], &status_prompt_hlist[1], size);
-
-		status_prompt_hlist[status_prompt_hsize - 1] = xstrdup(line);
+	hlist = status_prompt_hlist + status_prompt_hfirst;
+	if (status_prompt_hsize > 0 &&
+	    strcmp(hlist[status_prompt_hsize - 1], line) == 0)
 		return;
+
+	if (status_prompt_hfirst + status_prompt_hsize == status_prompt_halloc) {
+		if (status_prompt_hsize * 2 >= status_prompt_halloc) {
+			if (status_prompt_halloc == 0)
+				status_prompt_halloc = 64;
+			else
+				status_prompt_halloc *= 2;
+			status_prompt_hlist = xreallocarray(status_prompt_hlist,
+			    status_prompt_halloc, sizeof *status_prompt_hlist);
+		} else {
+			memmove(status_prompt_hlist, hlist,
+			    status_prompt_hsize * sizeof *status_prompt_hlist);
+			status_prompt_hfirst = 0;
+		}
+		hlist = status_prompt_hlist + status_prompt_hfirst;
 	}
+	hlist[status_prompt_hsize++] = xstrdup(line);
+	status_prompt_hunsaved++;
 
-	status_prompt_hlist = xreallocarray(status_prompt_hlist,
-	    status_prompt_hsize + 1, sizeof *status_prompt_hlist);
-	status_prompt_hlist[status_prompt_hsize++] = xstrdup(line);
+	while (status_prompt_hsize > limit) {
+		free(status_prompt_hlist[status_prompt_hfirst]);
+		status_prompt_hfirst++;
+		status_prompt_hsize--;
+	}
+	if (status_prompt_hunsaved > status_prompt_hsize)
+		status_prompt_hunsaved = status_prompt_hsize;
 }
 
 /* Build completion list. */
@@ -53,8 +53,10 @@ static __dead void
 usage(void)
 {
 	fprintf(stderr,
-	    "usage: %s [-2CDlNuvV] [-c shell-command] [-f file] [-L socket-name]\n"
-	    "            [-S socket-path] [-T features] [command [flags]]\n",
+	    "usage: %s [-2CDlNPuvV] [-c shell-command] [-f file]\n"
+	    "            [-k cache-file] [-L socket-name] [-S socket-path]\n"
+	    "            [-T features]\n"
+	    "            [command [flags]]\n",
 	    getprogname());
 	exit(1);
 }
@@ -257,6 +259,17 @@ get_timer(void)
 	return ((ts.tv_sec * 1000ULL) + (ts.tv_nsec / 1000000ULL));
 }
 
+/* Get a timestamp in microseconds, for timing short operations. */
+uint64_t
+get_timer_usec(void)
+{
+	struct timespec	ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		clock_gettime(CLOCK_REALTIME, &ts);
+	return ((ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000ULL));
+}
+
 const char *
 sig2name(int signo)
 {
@@ -329,6 +342,7 @@ main(int argc, char **argv)
 	char					*cause, **var;
 	const char				*s, *cwd;
 	int					 opt, keys, feat = 0, fflag = 0;
+	int					 fd, statefd;
 	uint64_t				 flags = 0;
 	const struct options_table_entry	*oe;
 	u_int					 i;
@@ -355,7 +369,7 @@ main(int argc, char **argv)
 		environ_set(global_environ, "PWD", 0, "%s", cwd);
 	expand_paths(TMUX_CONF, &cfg_files, &cfg_nfiles, 1);
 
-	while ((opt = getopt(argc, argv, "2c:CDdf:lL:NqS:T:uUvV")) != -1) {
+	while ((opt = getopt(argc, argv, "2c:CDdf:k:lL:NPqS:T:uUvV")) != -1) {
 		switch (opt) {
 		case '2':
 			tty_add_features(&feat, "256", ":,");
@@ -384,6 +398,10 @@ main(int argc, char **argv)
 			cfg_files[cfg_nfiles++] = xstrdup(optarg);
 			cfg_quiet = 0;
 			break;
+		case 'k':
+			free(cfg_cache_file);
+			cfg_cache_file = xstrdup(optarg);
+			break;
  		case 'V':
 			printf("%s %s\n", getprogname(), getversion());
  			exit(0);
@@ -397,6 +415,10 @@ main(int argc, char **argv)
 		case 'N':
 			flags |= CLIENT_NOSTARTSERVER;
 			break;
+		case 'P':
+			flags |= (CLIENT_CONTROL|CLIENT_CONTROL_PIPE|
+			    CLIENT_CONTROL_NOOUTPUT);
+			break;
 		case 'q':
 			break;
 		case 'S':
@@ -423,6 +445,8 @@ main(int argc, char **argv)
 		usage();
 	if ((flags & CLIENT_NOFORK) && argc != 0)
 		usage();
+	if (flags & CLIENT_CONTROL_PIPE)
+		flags &= ~CLIENT_CONTROLCONTROL;
 
 	if ((ptm_fd = getptmfd()) == -1)
 		err(1, "getptmfd");
@@ -509,6 +533,15 @@ main(int argc, char **argv)
 	socket_path = path;
 	free(label);
 
+	/* If replacing a server with exec-server, start the new one. */
+	if ((s = getenv("TMUX_EXEC_SERVER")) != NULL) {
+		if (sscanf(s, "%d,%d", &fd, &statefd) != 2)
+			errx(1, "bad TMUX_EXEC_SERVER: %s", s);
+		unsetenv("TMUX_EXEC_SERVER");
+		environ_unset(global_environ, "TMUX_EXEC_SERVER");
+		server_resume(osdep_event_init(), fd, statefd);
+	}
+
 	/* Pass control to the client. */
 	exit(client_main(osdep_event_init(), argc, argv, flags, feat));
 }
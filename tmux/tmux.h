@@ -23,6 +23,7 @@
 #include <sys/uio.h>
 
 #include <limits.h>
+#include <regex.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <termios.h>
@@ -47,8 +48,10 @@ struct cmdq_state;
 struct cmds;
 struct control_state;
 struct environ;
-struct format_job_tree;
 struct format_tree;
+struct grid_index;
+struct grid_index_query;
+struct grid_styles;
 struct input_ctx;
 struct job;
 struct mode_tree_data;
@@ -56,6 +59,7 @@ struct mouse_event;
 struct options;
 struct options_array_item;
 struct options_entry;
+struct render;
 struct screen_write_citem;
 struct screen_write_cline;
 struct screen_write_ctx;
@@ -64,6 +68,9 @@ struct tty_ctx;
 struct tmuxpeer;
 struct tmuxproc;
 struct winlink;
+struct window_pane_paste;
+struct window_pane_splice;
+struct file_ring;
 
 /* Client-server protocol version. */
 #define PROTOCOL_VERSION 8
@@ -79,6 +86,13 @@ struct winlink;
 /* Minimum layout cell size, NOT including border lines. */
 #define PANE_MINIMUM 1
 
+/*
+ * Most pane output queued to write to a pipe-pane pipe, and the level at which
+ * more is added.
+ */
+#define PANE_PIPE_HIGH (1024 * 1024)
+#define PANE_PIPE_LOW (256 * 1024)
+
 /* Minimum and maximum window size. */
 #define WINDOW_MINIMUM PANE_MINIMUM
 #define WINDOW_MAXIMUM 10000
@@ -86,6 +100,9 @@ struct winlink;
 /* Automatic name refresh interval, in microseconds. Must be < 1 second. */
 #define NAME_INTERVAL 500000
 
+/* Size of output staged for each terminal before it is queued. */
+#define TTY_OBUF_SIZE 8192
+
 /* Default pixel cell sizes. */
 #define DEFAULT_XPIXEL 16
 #define DEFAULT_YPIXEL 32
@@ -545,7 +562,14 @@ enum msgtype {
 	MSG_WRITE_OPEN,
 	MSG_WRITE,
 	MSG_WRITE_READY,
-	MSG_WRITE_CLOSE
+	MSG_WRITE_CLOSE,
+	MSG_WRITE_RING,
+	MSG_RING_OPEN,
+	MSG_RING_READY,
+
+	MSG_RENDER_RESET = 400,
+	MSG_RENDER_LINE,
+	MSG_RENDER_CURSOR
 };
 
 /*
@@ -590,6 +614,30 @@ struct msg_write_close {
 	int	stream;
 };
 
+struct msg_write_ring {
+	int	stream;
+	size_t	size;
+};
+
+struct msg_render_line {
+	u_int	x;
+	u_int	y;
+	u_int	n;
+}; /* followed by cells */
+
+struct msg_render_cursor {
+	u_int	cx;
+	u_int	cy;
+};
+
+/* Message counts for a peer. */
+struct proc_stats {
+	u_long	sent;		/* messages queued */
+	u_long	writes;		/* calls to write them */
+	u_long	received;	/* messages read */
+	u_long	reads;		/* calls to read them */
+};
+
 /* Mode keys. */
 #define MODEKEY_EMACS 0
 #define MODEKEY_VI 1
@@ -615,6 +663,10 @@ struct msg_write_close {
 #define ALL_MODES 0xffffff
 #define ALL_MOUSE_MODES (MODE_MOUSE_STANDARD|MODE_MOUSE_BUTTON|MODE_MOUSE_ALL)
 #define MOTION_MOUSE_MODES (MODE_MOUSE_BUTTON|MODE_MOUSE_ALL)
+#define KEY_MODES (MODE_KCURSOR|MODE_KKEYPAD|MODE_KEXTENDED)
+
+/* Longest sequence a single key can be translated into. */
+#define INPUT_KEY_SIZE 64
 
 /* A single UTF-8 character. */
 typedef u_int utf8_char;
@@ -683,6 +735,7 @@ enum utf8_state {
 #define GRID_LINE_WRAPPED 0x1
 #define GRID_LINE_EXTENDED 0x2
 #define GRID_LINE_DEAD 0x4
+#define GRID_LINE_PACKED 0x8
 
 /* Grid cell data. */
 struct grid_cell {
@@ -694,19 +747,42 @@ struct grid_cell {
 	int			us;
 };
 
-/* Grid extended cell entry. */
-struct grid_extd_entry {
+/*
+ * Grid cell character and flags only, for callers which do not need the style
+ * or the character expanded into a struct utf8_data.
+ */
+struct grid_char {
 	utf8_char		data;
-	u_short			attr;
 	u_char			flags;
-	int			fg;
-	int			bg;
-	int			us;
-} __packed;
+};
+
+/*
+ * Grid entries and lines are packed by default to save memory. Building with
+ * --enable-aligned-cells instead makes the cell entry flags a full word so
+ * each entry is eight bytes with no padding, and leaves the structures
+ * naturally aligned. This uses more memory but avoids unaligned loads, which
+ * are slow on some processors.
+ */
+#ifdef HAVE_ALIGNED_CELLS
+#define GRID_PACKED
+typedef u_int grid_entry_flags;
+#else
+#define GRID_PACKED __packed
+typedef u_char grid_entry_flags;
+#endif
+
+/*
+ * Grid extended cell entry. The attributes and colours are stored once in the
+ * grid style table and referenced by index.
+ */
+struct grid_extd_entry {
+	utf8_char		data;
+	u_int			style;
+} GRID_PACKED;
 
 /* Grid cell entry. */
 struct grid_cell_entry {
-	u_char			flags;
+	grid_entry_flags	flags;
 	union {
 		u_int		offset;
 		struct {
@@ -716,24 +792,72 @@ struct grid_cell_entry {
 			u_char	data;
 		} data;
 	};
-} __packed;
+} GRID_PACKED;
+
+/* Grid spool file. Holds history which does not fit in memory. */
+struct grid_spool {
+	u_int			 references;
 
-/* Grid line. */
+	int			 fd;
+	off_t			 size;
+	u_int			 regions;
+};
+
+/*
+ * Grid arena. Holds the cell data of lines which have entered history. If
+ * spool is set, the data is a mapping of part of the spool file.
+ */
+struct grid_arena {
+	u_int			 references;
+
+	size_t			 size;
+	size_t			 used;
+	u_char			*data;
+
+	struct grid_spool	*spool;
+	off_t			 offset;
+};
+
+/*
+ * Grid line. If GRID_LINE_PACKED is set, the cells are compressed into
+ * packdata and must be unpacked before celldata and extddata can be used.
+ */
 struct grid_line {
 	u_int			 cellused;
 	u_int			 cellsize;
-	struct grid_cell_entry	*celldata;
+	union {
+		struct grid_cell_entry	*celldata;
+		u_char			*packdata;
+	};
 
-	u_int			 extdsize;
+	union {
+		u_int		 extdsize;
+		u_int		 packsize;
+	};
 	struct grid_extd_entry	*extddata;
 
+	struct grid_arena	*arena;
+
 	int			 flags;
-} __packed;
+} GRID_PACKED;
+
+/* Grid chunk. A fixed size block of lines. */
+struct grid_chunk {
+	struct grid_line	*linedata;
+	u_int			 size;
+	int			 spilled;
+
+	u_int			*shared; /* grids using linedata if shared */
+	int			 uncounted; /* lines not in byte counts */
+
+	struct grid_arena	*arena;
+};
 
 /* Entire grid of cells. */
 struct grid {
 	int			 flags;
 #define GRID_HISTORY 0x1 /* scroll lines into history */
+#define GRID_LAZYREFLOW 0x2 /* reflow old history later */
 
 	u_int			 sx;
 	u_int			 sy;
@@ -742,7 +866,29 @@ struct grid {
 	u_int			 hsize;
 	u_int			 hlimit;
 
-	struct grid_line	*linedata;
+	u_int			 hcompress; /* lines of history left unpacked */
+	u_int			 hunpacked;
+
+	u_int			 hmemlimit; /* bytes of history kept in memory */
+	struct grid_spool	*spool;
+
+	u_int			 hpending; /* history lines not yet reflowed */
+
+	struct grid_styles	*styles;
+
+	u_int			 compactnext; /* next line to compact */
+
+	size_t			 cellbytes; /* size of cells */
+	size_t			 extdbytes; /* size of extended cells */
+	size_t			 packbytes; /* size of packed lines */
+
+	struct grid_chunk	*chunks;
+	u_int			 nchunks;
+	u_int			 offset;
+
+	struct grid_index	*index; /* search index of history */
+
+	TAILQ_ENTRY(grid)	 reap_entry;
 };
 
 /* Virtual cursor in a grid. */
@@ -841,6 +987,7 @@ struct screen {
 	struct screen_sel		*sel;
 
 	struct screen_write_cline	*write_list;
+	u_int				 write_first;
 };
 
 /* Screen write context. */
@@ -852,6 +999,8 @@ struct screen_write_ctx {
 
 	int				 flags;
 #define SCREEN_WRITE_SYNC 0x1
+#define SCREEN_WRITE_HIDDEN 0x2
+#define SCREEN_WRITE_DAMAGE 0x4
 
 	screen_write_init_ctx_cb	 init_ctx_cb;
 	void				*arg;
@@ -875,6 +1024,12 @@ struct screen_redraw_ctx {
 	u_int		 sy;
 	u_int		 ox;
 	u_int		 oy;
+
+	int		 clipped;	/* only drawing the region */
+	u_int		 rx;
+	u_int		 ry;
+	u_int		 rsx;
+	u_int		 rsy;
 };
 
 /* Screen size. */
@@ -942,6 +1097,17 @@ struct window_pane_offset {
 	size_t	used;
 };
 
+/* Memory used by a pane. */
+struct window_pane_memory {
+	size_t				cells;
+	size_t				extended;
+	size_t				packed;
+	size_t				headers;
+	size_t				styles;
+	size_t				input;
+	size_t				total;
+};
+
 /* Queued pane resize. */
 struct window_pane_resize {
 	u_int				sx;
@@ -978,7 +1144,7 @@ struct window_pane {
 #define PANE_REDRAW 0x1
 #define PANE_DROP 0x2
 #define PANE_FOCUSED 0x4
-/* 0x8 unused */
+#define TTY_DROPPED 0x8
 /* 0x10 unused */
 #define PANE_FOCUSPUSH 0x20
 #define PANE_INPUTOFF 0x40
@@ -988,6 +1154,10 @@ struct window_pane {
 #define PANE_STATUSDRAWN 0x400
 #define PANE_EMPTY 0x800
 #define PANE_STYLECHANGED 0x1000
+#define PANE_DAMAGED 0x2000
+#define PANE_REDRAWLINES 0x4000
+#define PANE_PIPESTALLED 0x8000
+#define PANE_INPUTWAIT 0x10000
 
 	int		 argc;
 	char	       **argv;
@@ -998,14 +1168,42 @@ struct window_pane {
 	char		 tty[TTY_NAME_MAX];
 	int		 status;
 
+	pid_t		 proc_pgrp;	/* cached foreground process */
+	uint64_t	 proc_since;
+	uint64_t	 proc_time;
+	int		 proc_flags;
+#define PANE_PROC_NAME 0x1
+#define PANE_PROC_CWD 0x2
+	char		*proc_name;
+	char		*proc_cwd;
+
 	int		 fd;
 	struct bufferevent *event;
+	struct event	 read_event;	/* pty reads, not the bufferevent */
+	int		 reading;
+	size_t		 reads;
+	size_t		 read_bytes;
+	size_t		 parsed_bytes;
 
 	struct window_pane_offset offset;
 	size_t		 base_offset;
 
 	struct window_pane_resizes resize_queue;
 	struct event	 resize_timer;
+	struct event	 reflow_timer;
+
+	u_int		 scroll_lines;
+	uint64_t	 scroll_time;
+	int		 scroll_fast;
+	struct event	 scroll_timer;
+	bitstr_t	*damage;
+	u_int		 damage_size;
+
+	uint64_t	*drawn;		/* line hashes when drawn */
+	u_int		 drawn_size;
+	struct grid_cell drawn_defaults;
+	bitstr_t	*redraw_lines;
+	u_int		 redraw_count;
 
 	struct input_ctx *ictx;
 
@@ -1016,14 +1214,21 @@ struct window_pane {
 	int		 pipe_fd;
 	struct bufferevent *pipe_event;
 	struct window_pane_offset pipe_offset;
+	size_t		 pipe_written;
+	u_int		 pipe_stalls;
+	struct window_pane_splice *pipe_splice;
 
 	struct screen	*screen;
 	struct screen	 base;
 
 	struct screen	 status_screen;
 	size_t		 status_size;
+	char		*status_text;
+	struct grid_cell status_gc;
+	int		 status_lines;
 
 	TAILQ_HEAD(, window_mode_entry) modes;
+	TAILQ_HEAD(, window_pane_paste) pastes;
 
 	char		*searchstr;
 	int		 searchregex;
@@ -1031,22 +1236,48 @@ struct window_pane {
 	int		 border_gc_set;
 	struct grid_cell border_gc;
 
+	int		 check_queued;
+	TAILQ_ENTRY(window_pane) check_entry;
+
 	TAILQ_ENTRY(window_pane) entry;
 	RB_ENTRY(window_pane) tree_entry;
+	RB_ENTRY(window_pane) tty_entry;
 };
 TAILQ_HEAD(window_panes, window_pane);
+TAILQ_HEAD(window_pane_checks, window_pane);
 RB_HEAD(window_pane_tree, window_pane);
 
+/*
+ * List of sessions or clients kept for a format until sessions, windows or
+ * clients change.
+ */
+struct format_list {
+	u_int		 generation;
+	char		*value;
+};
+
+/* Dumped layout string of a layout tree, kept until the layout changes. */
+struct layout_dump {
+	struct layout_cell	*root;
+	u_int			 generation;
+	char			*dump;
+};
+
 /* Window structure. */
 struct window {
 	u_int		 id;
 	void		*latest;
 
 	char		*name;
-	struct event	 name_event;
 	struct timeval	 name_time;
-
-	struct event	 alerts_timer;
+	int		 name_queued;
+	TAILQ_ENTRY(window) name_entry;
+	char		*name_key;	/* inputs of last automatic name */
+
+	uint64_t	 silence_time;	/* when silence is due */
+	int		 silence_queued;
+	u_int		 silence_slot;
+	TAILQ_ENTRY(window) silence_entry;
 	struct event	 offset_timer;
 
 	struct timeval	 activity_time;
@@ -1060,6 +1291,16 @@ struct window {
 	struct layout_cell *saved_layout_root;
 	char		*old_layout;
 
+	u_int		 layout_generation;
+	struct layout_dump layout_dumps[2];
+
+	u_char		*border_types;
+	struct window_pane **border_owners;
+	u_int		 border_sx;
+	u_int		 border_sy;
+	int		 border_status;
+	struct window_pane *border_active;
+
 	u_int		 sx;
 	u_int		 sy;
 	u_int		 xpixel;
@@ -1082,14 +1323,22 @@ struct window {
 	int		 alerts_queued;
 	TAILQ_ENTRY(window) alerts_entry;
 
+	int		 check_queued;
+	TAILQ_ENTRY(window) check_entry;
+
 	struct options	*options;
 
 	u_int		 references;
 	TAILQ_HEAD(, winlink) winlinks;
 
+	struct format_list linked_sessions_list;
+	struct format_list active_sessions_list;
+	struct format_list active_clients_list;
+
 	RB_ENTRY(window) entry;
 };
 RB_HEAD(windows, window);
+TAILQ_HEAD(window_checks, window);
 
 /* Entry on local window list. */
 struct winlink {
@@ -1103,6 +1352,8 @@ struct winlink {
 #define WINLINK_SILENCE 0x4
 #define WINLINK_ALERTFLAGS (WINLINK_BELL|WINLINK_ACTIVITY|WINLINK_SILENCE)
 
+	struct format_cache *format_cache;
+
 	RB_ENTRY(winlink) entry;
 	TAILQ_ENTRY(winlink) wentry;
 	TAILQ_ENTRY(winlink) sentry;
@@ -1195,14 +1446,25 @@ struct session {
 
 	int		 statusat;
 	u_int		 statuslines;
+	struct client	*status_client;
+	struct client	*redraw_client;
+	struct client	*size_clients;	/* only valid while sizing */
 
 	struct options	*options;
 
 #define SESSION_PASTING 0x1
-#define SESSION_ALERTED 0x2
+#define SESSION_BELLALERTED 0x2
+#define SESSION_ALERTSTATUS 0x4
+#define SESSION_ACTIVITYALERTED 0x8
+#define SESSION_SILENCEALERTED 0x10
+#define SESSION_ALERTFLAGS \
+	(SESSION_BELLALERTED|SESSION_ALERTSTATUS|SESSION_ACTIVITYALERTED| \
+	 SESSION_SILENCEALERTED)
+#define SESSION_RESIZE 0x20
 	int		 flags;
 
 	u_int		 attached;
+	struct format_list attached_list;
 
 	struct termios	*tio;
 
@@ -1212,6 +1474,8 @@ struct session {
 
 	TAILQ_ENTRY(session) gentry;
 	RB_ENTRY(session)    entry;
+	RB_ENTRY(session)    id_entry;
+	RB_ENTRY(session)    alive_entry;
 };
 RB_HEAD(sessions, session);
 
@@ -1266,6 +1530,9 @@ struct mouse_event {
 struct key_event {
 	key_code		key;
 	struct mouse_event	m;
+
+	u_int			count;	/* identical events coalesced */
+	uint64_t		time;	/* when read from terminal, or 0 */
 };
 
 /* TTY information. */
@@ -1279,10 +1546,24 @@ struct tty_key {
 	struct tty_key	*next;
 };
 
+/*
+ * State in the compiled key table, reached after matching a key or the start
+ * of one. The state for the following byte is found in the transitions from
+ * next, which cover bytes first to first + count - 1.
+ */
+struct tty_key_state {
+	key_code	 key;
+	int		 more;
+
+	u_char		 first;
+	u_short		 count;
+	u_int		 next;
+};
+
 struct tty_code;
 struct tty_term {
 	char		*name;
-	struct tty	*tty;
+	u_int		 references;
 	int		 features;
 
 	char		 acs[UCHAR_MAX + 1][2];
@@ -1297,6 +1578,12 @@ struct tty_term {
 #define TERM_VT100LIKE 0x20
 	int		 flags;
 
+	char		**caps;		/* capabilities created from */
+	u_int		 ncaps;
+	int		 create_features;
+	int		 features_out;
+	u_int		 generation;
+
 	LIST_ENTRY(tty_term) entry;
 };
 LIST_HEAD(tty_terms, tty_term);
@@ -1333,7 +1620,8 @@ struct tty {
 	struct evbuffer	*in;
 	struct event	 event_out;
 	struct evbuffer	*out;
-	struct event	 timer;
+	u_char		 obuf[TTY_OBUF_SIZE];
+	size_t		 olen;
 	size_t		 discarded;
 
 	struct termios	 tio;
@@ -1341,17 +1629,27 @@ struct tty {
 	struct grid_cell cell;
 	struct grid_cell last_cell;
 
+	uint64_t	 sync_time;
+	uint64_t	 sync_end_time;
+	struct event	 sync_timer;
+
+	struct tty_shadow_cell *shadow;
+	u_int		 shadow_sx;
+	u_int		 shadow_sy;
+	u_int		 shadow_generation;
+
 #define TTY_NOCURSOR 0x1
 #define TTY_FREEZE 0x2
 #define TTY_TIMER 0x4
-/* 0x8 unused */
+#define TTY_DROPPED 0x8
 #define TTY_STARTED 0x10
 #define TTY_OPENED 0x20
-/* 0x40 unused */
+#define TTY_SHADOWDRAW 0x40
 #define TTY_BLOCK 0x80
 #define TTY_HAVEDA 0x100
 #define TTY_HAVEXDA 0x200
 #define TTY_SYNCING 0x400
+#define TTY_HAVEDECRQM 0x800
 	int		 flags;
 
 	struct tty_term	*term;
@@ -1360,23 +1658,43 @@ struct tty {
 	u_int		 mouse_last_y;
 	u_int		 mouse_last_b;
 	int		 mouse_drag_flag;
+	int		 mouse_drag_pending;
+	struct mouse_event	 mouse_drag_event;
 	void		(*mouse_drag_update)(struct client *,
 			    struct mouse_event *);
 	void		(*mouse_drag_release)(struct client *,
 			    struct mouse_event *);
 
-	struct event	 key_timer;
-	struct tty_key	*key_tree;
+	struct event		 key_timer;
+	struct tty_key_state	*key_states;
+	u_int			*key_transitions;
+};
+
+/* Terminal cell as last drawn by tty_draw_line. */
+struct tty_shadow_cell {
+	u_int		 generation;
+	utf8_char	 data;
+	u_short		 attr;
+	u_char		 flags;
+	u_char		 width;
+	int		 fg;
+	int		 bg;
+	int		 us;
+	int		 dfg;
+	int		 dbg;
+	int		*palette;
 };
 
 /* TTY command context. */
 typedef void (*tty_ctx_redraw_cb)(const struct tty_ctx *);
 typedef int (*tty_ctx_set_client_cb)(struct tty_ctx *, struct client *);
+typedef void (*tty_ctx_damage_cb)(const struct tty_ctx *, u_int, u_int);
 struct tty_ctx {
 	struct screen		*s;
 
 	tty_ctx_redraw_cb	 redraw_cb;
 	tty_ctx_set_client_cb	 set_client_cb;
+	tty_ctx_damage_cb	 damage_cb;
 	void			*arg;
 
 	const struct grid_cell	*cell;
@@ -1431,11 +1749,16 @@ TAILQ_HEAD(message_list, message_entry);
 
 /* Parsed arguments structures. */
 struct args_entry;
-RB_HEAD(args_tree, args_entry);
 struct args {
-	struct args_tree	  tree;
+	uint64_t		  set;		/* flags present */
+	struct args_entry	 *entries;
+	struct args_value	 *values;
+
+	int			  first;	/* first argument in copy */
 	int			  argc;
 	char			**argv;
+
+	u_int			  lookup;	/* cached lookup of argv[0] */
 };
 
 /* Command find structures. */
@@ -1542,6 +1865,7 @@ struct cmd_entry {
 #define CMD_CLIENT_CFLAG 0x8
 #define CMD_CLIENT_TFLAG 0x10
 #define CMD_CLIENT_CANFAIL 0x20
+#define CMD_CLIENTENV 0x40
 	int		 flags;
 
 	enum cmd_retval	 (*exec)(struct cmd *, struct cmdq_item *);
@@ -1562,6 +1886,9 @@ struct status_line {
 
 	struct grid_cell	 style;
 	struct status_line_entry entries[STATUS_LINES_LIMIT];
+
+	int			 uses;
+	time_t			 time_next;
 };
 
 /* File in client. */
@@ -1579,6 +1906,7 @@ struct client_file {
 	struct bufferevent		*event;
 
 	int				 fd;
+	struct event			 timer;
 	int				 error;
 	int				 closed;
 
@@ -1597,6 +1925,46 @@ struct client_window {
 };
 RB_HEAD(client_windows, client_window);
 
+/*
+ * Client timing histogram. Bucket n holds times of at least 2^n and less than
+ * 2^(n+1) microseconds (bucket 0 also holds times under one microsecond).
+ */
+#define CLIENT_TIMING_BUCKETS 24
+#define CLIENT_TIMING_SAMPLES 1024
+enum client_timing_type {
+	CLIENT_TIMING_REDRAW,
+	CLIENT_TIMING_SCREEN,
+	CLIENT_TIMING_STATUS,
+	CLIENT_TIMING_UPDATE,
+	CLIENT_TIMING_WRITE,
+	CLIENT_TIMING_INPUT
+};
+#define CLIENT_TIMING_TYPES 6
+
+/* Microseconds to wait for pane output in reply to a key before giving up. */
+#define CLIENT_INPUT_TIMEOUT 1000000
+struct client_timing {
+	u_int		 buckets[CLIENT_TIMING_BUCKETS];
+	u_int		 count;
+	u_int		 last;
+};
+
+/*
+ * Server counters for show-stats. These are never reset. Loop bucket n counts
+ * server loops taking at least 2^n and less than 2^(n+1) microseconds, like
+ * client timings.
+ */
+#define SERVER_STATS_BUCKETS 24
+struct server_stats {
+	uint64_t	 loops;
+	uint64_t	 loop_time;
+	uint64_t	 loop_buckets[SERVER_STATS_BUCKETS];
+
+	uint64_t	 grid_lines;
+	uint64_t	 formats;
+	uint64_t	 jobs;
+};
+
 /* Client connection. */
 typedef int (*prompt_input_cb)(struct client *, void *, const char *, int);
 typedef void (*prompt_free_cb)(void *);
@@ -1625,7 +1993,6 @@ struct client {
 	struct timeval	 activity_time;
 
 	struct environ	*environ;
-	struct format_job_tree	*jobs;
 
 	char		*title;
 	const char	*cwd;
@@ -1638,10 +2005,35 @@ struct client {
 
 	char		*ttyname;
 	struct tty	 tty;
+	struct render	*render;
 
 	size_t		 written;
 	size_t		 discarded;
 	size_t		 redraw;
+	uint64_t	 redraws;
+	uint64_t	 redraw_flags;
+	uint64_t	 redraw_hash;
+	size_t		 redraw_offset;
+	u_int		 dropped_frames;
+
+	size_t		 rate;
+	size_t		 rate_written;
+	uint64_t	 rate_time;
+
+	uint64_t	 queued_time;
+	u_int		 latency;
+	uint64_t	 redraw_time;
+	struct event	 redraw_timer;
+
+	struct client_timing timings[CLIENT_TIMING_TYPES];
+
+	uint64_t	 input_time;
+	u_int		 input_pane;
+	int		 input_state;
+#define CLIENT_INPUT_NONE 0
+#define CLIENT_INPUT_SENT 1
+#define CLIENT_INPUT_ECHOED 2
+#define CLIENT_INPUT_QUEUED 3
 
 	struct event	 repeat_timer;
 
@@ -1649,6 +2041,9 @@ struct client {
 	u_int		 click_button;
 	struct mouse_event click_event;
 
+	struct cmdq_item *mouse_item;	/* queued mouse event */
+	struct key_event *mouse_event;
+
 	struct status_line status;
 
 #define CLIENT_TERMINAL 0x1
@@ -1685,13 +2080,23 @@ struct client {
 #define CLIENT_ACTIVEPANE 0x80000000ULL
 #define CLIENT_CONTROL_PAUSEAFTER 0x100000000ULL
 #define CLIENT_CONTROL_WAITEXIT 0x200000000ULL
+#define CLIENT_REDRAWREGION 0x400000000ULL
+#define CLIENT_OVERLAYMISSED 0x800000000ULL
+#define CLIENT_CONTROL_BINARY 0x1000000000ULL
+#define CLIENT_CONTROL_COMPRESS 0x2000000000ULL
+#define CLIENT_RING 0x4000000000ULL
+#define CLIENT_RINGWAIT 0x8000000000ULL
+#define CLIENT_COMMANDONLY 0x10000000000ULL
+#define CLIENT_CONTROL_PIPE 0x20000000000ULL
+#define CLIENT_RENDER 0x40000000000ULL
 #define CLIENT_ALLREDRAWFLAGS		\
 	(CLIENT_REDRAWWINDOW|		\
 	 CLIENT_REDRAWSTATUS|		\
 	 CLIENT_REDRAWSTATUSALWAYS|	\
 	 CLIENT_REDRAWBORDERS|		\
 	 CLIENT_REDRAWOVERLAY|		\
-	 CLIENT_REDRAWPANES)
+	 CLIENT_REDRAWPANES|		\
+	 CLIENT_REDRAWREGION)
 #define CLIENT_UNATTACHEDFLAGS	\
 	(CLIENT_DEAD|		\
 	 CLIENT_SUSPENDED|	\
@@ -1742,6 +2147,7 @@ struct client {
 
 	struct session	*session;
 	struct session	*last_session;
+	struct client	*size_next;
 
 	int		 references;
 
@@ -1756,8 +2162,18 @@ struct client {
 	overlay_free_cb	 overlay_free;
 	void		*overlay_data;
 	struct event	 overlay_timer;
+	u_int		 overlay_px;	/* area covered by overlay */
+	u_int		 overlay_py;
+	u_int		 overlay_sx;
+	u_int		 overlay_sy;
+
+	u_int		 region_px;	/* area to redraw */
+	u_int		 region_py;
+	u_int		 region_sx;
+	u_int		 region_sy;
 
 	struct client_files files;
+	struct file_ring *ring;
 
 	TAILQ_ENTRY(client) entry;
 };
@@ -1772,6 +2188,18 @@ enum control_sub_type {
 	CONTROL_SUB_ALL_WINDOWS
 };
 
+/* Control mode statistic type. */
+enum control_stat_type {
+	CONTROL_STAT_BACKLOG,
+	CONTROL_STAT_AGE,
+	CONTROL_STAT_PAUSES,
+	CONTROL_STAT_WRITTEN,
+	CONTROL_STAT_STALL
+};
+
+/* Shortest time between checks of a subscription in milliseconds. */
+#define CONTROL_SUB_MINIMUM 50
+
 /* Key binding and key table. */
 struct key_binding {
 	key_code		 key;
@@ -1790,6 +2218,9 @@ struct key_table {
 	struct key_bindings	 key_bindings;
 	struct key_bindings	 default_key_bindings;
 
+	struct key_binding	**index;
+	u_int			 index_size;
+
 	u_int			 references;
 
 	RB_ENTRY(key_table)	 entry;
@@ -1914,14 +2345,37 @@ extern const char	*shell_command;
 int		 checkshell(const char *);
 void		 setblocking(int, int);
 uint64_t	 get_timer(void);
+uint64_t	 get_timer_usec(void);
 const char	*sig2name(int);
 const char	*find_cwd(void);
 const char	*find_home(void);
 const char	*getversion(void);
 
+/*
+ * Children can be started with vfork() where the pty can be opened before and
+ * descriptors closed after without library calls; fdforkpty needs a pty
+ * device opened at startup.
+ */
+#if defined(HAVE_OPENPTY) && defined(HAVE_VFORK) && \
+    defined(HAVE_CLOSEFROM) && !defined(HAVE_FDFORKPTY)
+#define PROC_SPAWN
+#endif
+
+/*
+ * Event priorities in the server. Everything is done in one event loop, so
+ * when it is busy with pane output, input from clients (keys and commands)
+ * is handled first. Other events, including messages from clients which only
+ * run a command, have the default, lower, priority.
+ */
+#define PROC_PRIORITIES 2
+#define PROC_PRIORITY_CLIENT 0
+#define PROC_PRIORITY_DEFAULT 1
+
 /* proc.c */
 struct imsg;
 int	proc_send(struct tmuxpeer *, enum msgtype, int, const void *, size_t);
+u_int	proc_queued(struct tmuxpeer *);
+void	proc_get_stats(struct tmuxpeer *, struct proc_stats *);
 struct tmuxproc *proc_start(const char *);
 void	proc_loop(struct tmuxproc *, int (*)(void));
 void	proc_exit(struct tmuxproc *);
@@ -1931,7 +2385,12 @@ struct tmuxpeer *proc_add_peer(struct tmuxproc *, int,
 	    void (*)(struct imsg *, void *), void *);
 void	proc_remove_peer(struct tmuxpeer *);
 void	proc_kill_peer(struct tmuxpeer *);
+void	proc_set_priority(struct tmuxpeer *, int);
 void	proc_toggle_log(struct tmuxproc *);
+#ifdef PROC_SPAWN
+pid_t	proc_spawn(const char *, char **, char **, const char *, int, int,
+	    int, int, sigset_t *);
+#endif
 pid_t	proc_fork_and_daemon(int *);
 
 /* cfg.c */
@@ -1940,6 +2399,7 @@ extern struct client *cfg_client;
 extern char **cfg_files;
 extern u_int cfg_nfiles;
 extern int cfg_quiet;
+extern char *cfg_cache_file;
 void	start_cfg(void);
 int	load_cfg(const char *, struct client *, struct cmdq_item *, int,
 	    struct cmdq_item **);
@@ -1948,13 +2408,19 @@ int	load_cfg_from_buffer(const void *, size_t, const char *,
 void printflike(1, 2) cfg_add_cause(const char *, ...);
 void	cfg_print_causes(struct cmdq_item *);
 void	cfg_show_causes(struct session *);
+void	cfg_add_command_timing(struct cmd *, uint64_t);
+int	cfg_print_timings(struct cmdq_item *, int);
 
 /* paste.c */
 struct paste_buffer;
 const char	*paste_buffer_name(struct paste_buffer *);
 u_int		 paste_buffer_order(struct paste_buffer *);
-time_t		 paste_buffer_created(struct paste_buffer *);
+int		 paste_buffer_automatic(struct paste_buffer *);
+struct timeval	*paste_buffer_created(struct paste_buffer *);
 const char	*paste_buffer_data(struct paste_buffer *, size_t *);
+size_t		 paste_buffer_size(struct paste_buffer *);
+void		 paste_buffer_reference(struct paste_buffer *, struct evbuffer *,
+		     size_t, size_t);
 struct paste_buffer *paste_walk(struct paste_buffer *);
 struct paste_buffer *paste_get_top(const char **);
 struct paste_buffer *paste_get_name(const char *);
@@ -1963,7 +2429,13 @@ void		 paste_add(const char *, char *, size_t);
 int		 paste_rename(const char *, const char *, char **);
 int		 paste_set(char *, size_t, const char *, char **);
 void		 paste_replace(struct paste_buffer *, char *, size_t);
-char		*paste_make_sample(struct paste_buffer *);
+const char	*paste_buffer_sample(struct paste_buffer *);
+char	       **paste_buffer_preview(struct paste_buffer *, u_int *);
+void		 paste_pane(struct window_pane *, struct paste_buffer *,
+		     const char *, int);
+void		 paste_pane_continue(struct window_pane *);
+void		 paste_pane_cancel(struct window_pane *);
+size_t		 paste_pane_left(struct window_pane *, size_t *);
 
 /* format.c */
 #define FORMAT_STATUS 0x1
@@ -1971,10 +2443,15 @@ char		*paste_make_sample(struct paste_buffer *);
 #define FORMAT_NOJOBS 0x4
 #define FORMAT_VERBOSE 0x8
 #define FORMAT_NONE 0
+#define FORMAT_USES_STATE 0x1
+#define FORMAT_USES_TIME 0x2
+#define FORMAT_USES_CLIENT 0x4
+#define FORMAT_USES_UNKNOWN 0x8
 #define FORMAT_PANE 0x80000000U
 #define FORMAT_WINDOW 0x40000000U
 struct format_tree;
 struct format_modifier;
+struct format_cache;
 typedef void *(*format_cb)(struct format_tree *);
 void		 format_tidy_jobs(void);
 const char	*format_skip(const char *, const char *);
@@ -1982,7 +2459,15 @@ int		 format_true(const char *);
 struct format_tree *format_create(struct client *, struct cmdq_item *, int,
 		     int);
 void		 format_free(struct format_tree *);
+void		 format_clear(struct format_tree *);
 void		 format_merge(struct format_tree *, struct format_tree *);
+void		 format_set_state(struct format_tree *, struct cmdq_state *);
+void		 format_free_cache(struct format_cache *);
+void		 format_lists_changed(void);
+void		 format_free_list(struct format_list *);
+void		 format_set_profile(int);
+int		 format_print_profile(struct cmdq_item *, int);
+int		 format_get_uses(struct format_tree *, time_t *);
 struct window_pane *format_get_pane(struct format_tree *);
 void printflike(3, 4) format_add(struct format_tree *, const char *,
 		     const char *, ...);
@@ -1993,6 +2478,8 @@ void		 format_each(struct format_tree *, void (*)(const char *,
 		     const char *, void *), void *);
 char		*format_expand_time(struct format_tree *, const char *);
 char		*format_expand(struct format_tree *, const char *);
+char		*format_expand_cache(struct format_tree *, const char *,
+		     struct format_cache **);
 char		*format_single(struct cmdq_item *, const char *,
 		     struct client *, struct session *, struct winlink *,
 		     struct window_pane *);
@@ -2011,7 +2498,6 @@ void		 format_defaults_pane(struct format_tree *,
 		     struct window_pane *);
 void		 format_defaults_paste_buffer(struct format_tree *,
 		     struct paste_buffer *);
-void		 format_lost_client(struct client *);
 char		*format_grid_word(struct grid *, u_int, u_int);
 char		*format_grid_line(struct grid *, u_int);
 
@@ -2050,6 +2536,7 @@ const struct options_table_entry *options_table_entry(struct options_entry *);
 struct options_entry *options_get_only(struct options *, const char *);
 struct options_entry *options_get(struct options *, const char *);
 void		 options_array_clear(struct options_entry *);
+int		 options_hook_may_be_set(const char *);
 union options_value *options_array_get(struct options_entry *, u_int);
 int		 options_array_set(struct options_entry *, u_int, const char *,
 		     int, char **);
@@ -2099,6 +2586,8 @@ typedef void (*job_free_cb) (void *);
 #define JOB_NOWAIT 0x1
 #define JOB_KEEPWRITE 0x2
 #define JOB_PTY 0x4
+#define JOB_LIMIT 0x8
+#define JOB_LOWPRIORITY 0x10
 struct job	*job_run(const char *, int, char **, struct session *,
 		     const char *, job_update_cb, job_complete_cb, job_free_cb,
 		     void *, int, int, int);
@@ -2108,9 +2597,12 @@ void		 job_check_died(pid_t, int);
 int		 job_get_status(struct job *);
 void		*job_get_data(struct job *);
 struct bufferevent *job_get_event(struct job *);
+void		 job_set_limit(struct job *, size_t);
 void		 job_kill_all(void);
 int		 job_still_running(void);
 void		 job_print_summary(struct cmdq_item *, int);
+struct job	*job_walk(struct job *);
+void		 job_add_formats(struct job *, struct format_tree *);
 
 /* environ.c */
 struct environ *environ_create(void);
@@ -2125,8 +2617,11 @@ void	environ_clear(struct environ *, const char *);
 void	environ_put(struct environ *, const char *, int);
 void	environ_unset(struct environ *, const char *);
 void	environ_update(struct options *, struct environ *, struct environ *);
-void	environ_push(struct environ *);
+void	environ_push(struct environ *, struct environ *);
+char  **environ_exec(struct environ *, struct environ *);
+void	environ_free_exec(char **);
 void printflike(2, 3) environ_log(struct environ *, const char *, ...);
+struct environ *environ_session(struct session *);
 struct environ *environ_for_session(struct session *, int);
 
 /* tty.c */
@@ -2156,6 +2651,7 @@ void	tty_cell(struct tty *, const struct grid_cell *,
 	    const struct grid_cell *, int *);
 int	tty_init(struct tty *, struct client *);
 void	tty_resize(struct tty *);
+void	tty_invalidate_shadow(struct tty *);
 void	tty_set_size(struct tty *, u_int, u_int, u_int, u_int);
 void	tty_start_tty(struct tty *);
 void	tty_send_requests(struct tty *);
@@ -2166,11 +2662,21 @@ void	tty_draw_line(struct tty *, struct screen *, u_int, u_int, u_int,
 	    u_int, u_int, const struct grid_cell *, int *);
 void	tty_sync_start(struct tty *);
 void	tty_sync_end(struct tty *);
+void	tty_sync_end_maybe(struct tty *);
 int	tty_open(struct tty *, char **);
 void	tty_close(struct tty *);
 void	tty_free(struct tty *);
+void	tty_unblock(struct tty *);
+size_t	tty_pending(struct tty *);
+void	tty_copy_output(struct tty *, struct tty *, size_t);
+uint64_t tty_state_hash(struct tty *);
+void	tty_copy_state(struct tty *, struct tty *);
+void	tty_flush(struct tty *);
+u_int	tty_frame_interval(struct tty *);
 void	tty_update_features(struct tty *);
 void	tty_set_selection(struct tty *, const char *, size_t);
+void	tty_set_selection_encoded(struct tty *, const char *);
+int	tty_client_ready(struct client *);
 void	tty_write(void (*)(struct tty *, const struct tty_ctx *),
 	    struct tty_ctx *);
 void	tty_cmd_alignmenttest(struct tty *, const struct tty_ctx *);
@@ -2196,15 +2702,18 @@ void	tty_cmd_setselection(struct tty *, const struct tty_ctx *);
 void	tty_cmd_rawstring(struct tty *, const struct tty_ctx *);
 void	tty_cmd_syncstart(struct tty *, const struct tty_ctx *);
 void	tty_default_colours(struct grid_cell *, struct window_pane *);
+int	tty_get_palette(int *, int);
 
 /* tty-term.c */
 extern struct tty_terms tty_terms;
 u_int		 tty_term_ncodes(void);
 void		 tty_term_apply(struct tty_term *, const char *, int);
 void		 tty_term_apply_overrides(struct tty_term *);
-struct tty_term *tty_term_create(struct tty *, char *, char **, u_int, int *,
-		     char **);
+void		 tty_term_options_changed(void);
+struct tty_term *tty_term_create(char *, char **, u_int, int *, char **);
+struct tty_term *tty_term_modify(struct tty_term *);
 void		 tty_term_free(struct tty_term *);
+int		 tty_term_equal(struct tty_term *, struct tty_term *);
 int		 tty_term_read_list(const char *, int, char ***, u_int *,
 		     char **);
 void		 tty_term_free_list(char **, u_int);
@@ -2240,7 +2749,6 @@ void		tty_keys_free(struct tty *);
 int		tty_keys_next(struct tty *);
 
 /* arguments.c */
-void		 args_set(struct args *, u_char, const char *);
 struct args	*args_parse(const char *, int, char **);
 void		 args_free(struct args *);
 char		*args_print(struct args *);
@@ -2298,6 +2806,8 @@ void		 cmd_free_argv(int, char **);
 char		*cmd_stringify_argv(int, char **);
 char		*cmd_get_alias(const char *);
 const struct cmd_entry *cmd_get_entry(struct cmd *);
+void		 cmd_add_executed(const struct cmd_entry *);
+uint64_t	 cmd_get_executed(const struct cmd_entry *);
 struct args	*cmd_get_args(struct cmd *);
 u_int		 cmd_get_group(struct cmd *);
 void		 cmd_get_source(struct cmd *, const char **, u_int *);
@@ -2327,6 +2837,11 @@ enum cmd_retval	 cmd_attach_session(struct cmdq_item *, const char *, int, int,
 /* cmd-parse.c */
 void		 cmd_parse_empty(struct cmd_parse_input *);
 struct cmd_parse_result *cmd_parse_from_file(FILE *, struct cmd_parse_input *);
+struct cmd_parse_result *cmd_parse_from_file_save(FILE *,
+		     struct cmd_parse_input *, struct evbuffer *);
+struct cmd_parse_result *cmd_parse_from_saved(const void *, size_t,
+		     struct cmd_parse_input *);
+void		 cmd_parse_clear_cache(void);
 struct cmd_parse_result *cmd_parse_from_string(const char *,
 		     struct cmd_parse_input *);
 enum cmd_parse_status cmd_parse_and_insert(const char *,
@@ -2349,6 +2864,7 @@ void		  cmdq_free_state(struct cmdq_state *);
 void printflike(3, 4) cmdq_add_format(struct cmdq_state *, const char *,
 		     const char *, ...);
 void		  cmdq_merge_formats(struct cmdq_item *, struct format_tree *);
+struct format_tree *cmdq_get_formats(struct cmdq_state *);
 struct cmdq_list *cmdq_new(void);
 void cmdq_free(struct cmdq_list *);
 const char	 *cmdq_get_name(struct cmdq_item *);
@@ -2366,11 +2882,13 @@ struct cmdq_item *cmdq_get_callback1(const char *, cmdq_cb, void *);
 struct cmdq_item *cmdq_get_error(const char *);
 struct cmdq_item *cmdq_insert_after(struct cmdq_item *, struct cmdq_item *);
 struct cmdq_item *cmdq_append(struct client *, struct cmdq_item *);
+struct cmdq_item *cmdq_last(struct client *);
 void		 cmdq_insert_hook(struct session *, struct cmdq_item *,
 		     struct cmd_find_state *, const char *, ...);
 void		 cmdq_continue(struct cmdq_item *);
 u_int		 cmdq_next(struct client *);
 struct cmdq_item *cmdq_running(struct client *);
+int		 cmdq_waiting(struct client *);
 void		 cmdq_guard(struct cmdq_item *, const char *, int);
 void printflike(2, 3) cmdq_print(struct cmdq_item *, const char *, ...);
 void printflike(2, 3) cmdq_error(struct cmdq_item *, const char *, ...);
@@ -2381,6 +2899,14 @@ void	cmd_wait_for_flush(void);
 /* client.c */
 int	client_main(struct event_base *, int, char **, uint64_t, int);
 
+/* render.c */
+int	render_active(struct client *);
+void	render_update(struct client *);
+void	render_cursor(struct client *, u_int, u_int);
+void	render_free(struct client *);
+void	render_dispatch(struct imsg *, uint64_t);
+void	render_stop(void);
+
 /* key-bindings.c */
 struct key_table *key_bindings_get_table(const char *, int);
 struct key_table *key_bindings_first_table(void);
@@ -2397,6 +2923,7 @@ void	 key_bindings_reset(const char *, key_code);
 void	 key_bindings_remove_table(const char *);
 void	 key_bindings_reset_table(const char *);
 void	 key_bindings_init(void);
+int	 key_bindings_can_repeat(struct key_binding *);
 struct cmdq_item *key_bindings_dispatch(struct key_binding *,
 	     struct cmdq_item *, struct client *, struct key_event *,
 	     struct cmd_find_state *);
@@ -2407,6 +2934,7 @@ const char	*key_string_lookup_key(key_code, int);
 
 /* alerts.c */
 void	alerts_reset_all(void);
+void	alerts_remove(struct window *);
 void	alerts_queue(struct window *, int);
 void	alerts_check_session(struct session *);
 
@@ -2424,8 +2952,9 @@ int	 file_can_print(struct client *);
 void printflike(2, 3) file_print(struct client *, const char *, ...);
 void	 file_vprint(struct client *, const char *, va_list);
 void	 file_print_buffer(struct client *, void *, size_t);
+size_t	 file_print_left(struct client *);
 void printflike(2, 3) file_error(struct client *, const char *, ...);
-void	 file_write(struct client *, const char *, int, const void *, size_t,
+void	 file_write(struct client *, const char *, int, struct evbuffer *,
 	     client_file_cb, void *);
 void	 file_read(struct client *, const char *, client_file_cb, void *);
 void	 file_push(struct client_file *);
@@ -2433,18 +2962,25 @@ int	 file_write_left(struct client_files *);
 void	 file_write_open(struct client_files *, struct tmuxpeer *,
 	     struct imsg *, int, int, client_file_cb, void *);
 void	 file_write_data(struct client_files *, struct imsg *);
+void	 file_write_ring(struct client_files *, struct file_ring *,
+	     struct imsg *);
 void	 file_write_close(struct client_files *, struct imsg *);
 void	 file_read_open(struct client_files *, struct tmuxpeer *, struct imsg *,
 	     int, int, client_file_cb, void *);
 void	 file_write_ready(struct client_files *, struct imsg *);
 void	 file_read_data(struct client_files *, struct imsg *);
 void	 file_read_done(struct client_files *, struct imsg *);
+struct file_ring *file_ring_create(struct tmuxpeer *);
+void	 file_ring_open(struct client *, int);
+void	 file_ring_free(struct file_ring *);
+void	 file_ring_ready(struct client_files *);
 
 /* server.c */
 extern struct tmuxproc *server_proc;
 extern struct clients clients;
 extern struct cmd_find_state marked_pane;
 extern struct message_list message_log;
+extern struct server_stats server_stats;
 void	 server_set_marked(struct session *, struct winlink *,
 	     struct window_pane *);
 void	 server_clear_marked(void);
@@ -2454,15 +2990,29 @@ int	 server_check_marked(void);
 int	 server_start(struct tmuxproc *, int, struct event_base *, int, char *);
 void	 server_update_socket(void);
 void	 server_add_accept(int);
+int	 server_exec(const char *);
+__dead void server_resume(struct event_base *, int, int);
 void printflike(1, 2) server_add_message(const char *, ...);
 
 /* server-client.c */
 RB_PROTOTYPE(client_windows, client_window, entry, server_client_window_cmp);
 u_int	 server_client_how_many(void);
+u_int	 server_client_how_many_busy(void);
 void	 server_client_set_overlay(struct client *, u_int, overlay_check_cb,
 	     overlay_mode_cb, overlay_draw_cb, overlay_key_cb,
 	     overlay_free_cb, void *);
+void	 server_client_set_overlay_area(struct client *, u_int, u_int,
+	     u_int, u_int);
 void	 server_client_clear_overlay(struct client *);
+void	 server_client_add_timing(struct client *, enum client_timing_type,
+	     uint64_t);
+u_int	 server_client_get_timing(struct client *, enum client_timing_type,
+	     u_int);
+const char *server_client_timing_name(enum client_timing_type);
+void	 server_client_input_sent(struct client *, struct window_pane *,
+	     key_code, uint64_t);
+void	 server_client_input_echoed(struct window_pane *);
+void	 server_client_input_written(struct client *);
 void	 server_client_set_key_table(struct client *, const char *);
 const char *server_client_get_key_table(struct client *);
 int	 server_client_check_nested(struct client *);
@@ -2538,14 +3088,16 @@ void	 default_window_size(struct client *, struct session *, struct window *,
 	     u_int *, u_int *, u_int *, u_int *, int);
 void	 recalculate_size(struct window *, int);
 void	 recalculate_sizes(void);
+void	 recalculate_sizes_session(struct session *);
 void	 recalculate_sizes_now(int);
+void	 recalculate_sizes_check(void);
 
 /* input.c */
 struct input_ctx *input_init(struct window_pane *, struct bufferevent *);
 void	 input_free(struct input_ctx *);
 void	 input_reset(struct input_ctx *, int);
 struct evbuffer *input_pending(struct input_ctx *);
-void	 input_parse_pane(struct window_pane *);
+size_t	 input_parse_pane(struct window_pane *);
 void	 input_parse_buffer(struct window_pane *, u_char *, size_t);
 void	 input_parse_screen(struct input_ctx *, struct screen *,
 	     screen_write_init_ctx_cb, void *, u_char *, size_t);
@@ -2553,6 +3105,8 @@ void	 input_parse_screen(struct input_ctx *, struct screen *,
 /* input-key.c */
 void	 input_key_build(void);
 int	 input_key_pane(struct window_pane *, key_code, struct mouse_event *);
+void	 input_key_clear_cache(void);
+int	 input_key_translate(int, key_code, char *, size_t *);
 int	 input_key(struct screen *, struct bufferevent *, key_code);
 int	 input_key_get_mouse(struct screen *, struct mouse_event *, u_int,
 	     u_int, const char **, size_t *);
@@ -2580,13 +3134,21 @@ int	 grid_cells_look_equal(const struct grid_cell *,
 struct grid *grid_create(u_int, u_int, u_int);
 void	 grid_destroy(struct grid *);
 int	 grid_compare(struct grid *, struct grid *);
+uint64_t grid_hash_line(struct grid *, u_int);
 void	 grid_collect_history(struct grid *);
 void	 grid_remove_history(struct grid *, u_int );
+void	 grid_scroll_screen(struct grid *, u_int);
 void	 grid_scroll_history(struct grid *, u_int);
 void	 grid_scroll_history_region(struct grid *, u_int, u_int, u_int);
 void	 grid_clear_history(struct grid *);
+void	 grid_pack_history(struct grid *);
+int	 grid_compact(struct grid *, size_t *);
+size_t	 grid_styles_size(struct grid *);
 const struct grid_line *grid_peek_line(struct grid *, u_int);
+const struct grid_line *grid_peek_line_packed(struct grid *, u_int);
 void	 grid_get_cell(struct grid *, u_int, u_int, struct grid_cell *);
+void	 grid_get_char(struct grid *, u_int, u_int, struct grid_char *);
+u_int	 grid_line_run(const struct grid_line *, u_int, u_int);
 void	 grid_set_cell(struct grid *, u_int, u_int, const struct grid_cell *);
 void	 grid_set_padding(struct grid *, u_int, u_int);
 void	 grid_set_cells(struct grid *, u_int, u_int, const struct grid_cell *,
@@ -2599,13 +3161,32 @@ void	 grid_move_lines(struct grid *, u_int, u_int, u_int, u_int);
 void	 grid_move_cells(struct grid *, u_int, u_int, u_int, u_int, u_int);
 char	*grid_string_cells(struct grid *, u_int, u_int, u_int,
 	     struct grid_cell **, int, int, int);
+size_t	 grid_string_text(struct grid *, u_int, u_int, u_int, char *, int);
 void	 grid_duplicate_lines(struct grid *, u_int, struct grid *, u_int,
 	     u_int);
+void	 grid_transfer_lines(struct grid *, u_int, struct grid *, u_int,
+	     u_int);
+void	 grid_snapshot(struct grid *, struct grid *, u_int, u_int);
 void	 grid_reflow(struct grid *, u_int);
+u_int	 grid_reflow_pending(struct grid *, int);
 void	 grid_wrap_position(struct grid *, u_int, u_int, u_int *, u_int *);
 void	 grid_unwrap_position(struct grid *, u_int *, u_int *, u_int, u_int);
 u_int	 grid_line_length(struct grid *, u_int);
 
+/* grid-index.c */
+void	 grid_index_enable(struct grid *);
+void	 grid_index_free(struct grid_index *);
+struct grid_index *grid_index_copy(struct grid_index *);
+void	 grid_index_rebuild(struct grid *);
+void	 grid_index_invalidate(struct grid *);
+void	 grid_index_add(struct grid *, u_int);
+void	 grid_index_remove(struct grid *, u_int);
+void	 grid_index_trim(struct grid *);
+void	 grid_index_clear(struct grid *);
+struct grid_index_query *grid_index_start(struct grid *, struct grid *);
+int	 grid_index_check(struct grid_index_query *, u_int);
+void	 grid_index_end(struct grid_index_query *);
+
 /* grid-reader.c */
 void	 grid_reader_start(struct grid_reader *, struct grid *, u_int, u_int);
 void	 grid_reader_get_cursor(struct grid_reader *, u_int *, u_int *);
@@ -2629,6 +3210,7 @@ void	 grid_reader_cursor_back_to_indentation(struct grid_reader *);
 
 /* grid-view.c */
 void	 grid_view_get_cell(struct grid *, u_int, u_int, struct grid_cell *);
+void	 grid_view_get_char(struct grid *, u_int, u_int, struct grid_char *);
 void	 grid_view_set_cell(struct grid *, u_int, u_int,
 	     const struct grid_cell *);
 void	 grid_view_set_padding(struct grid *, u_int, u_int);
@@ -2706,10 +3288,14 @@ void	 screen_write_clearstartofscreen(struct screen_write_ctx *, u_int);
 void	 screen_write_clearscreen(struct screen_write_ctx *, u_int);
 void	 screen_write_clearhistory(struct screen_write_ctx *);
 void	 screen_write_collect_end(struct screen_write_ctx *);
+void	 screen_write_collect_add_string(struct screen_write_ctx *,
+	     const struct grid_cell *, const u_char *, size_t);
 void	 screen_write_collect_add(struct screen_write_ctx *,
 	     const struct grid_cell *);
 void	 screen_write_cell(struct screen_write_ctx *, const struct grid_cell *);
 void	 screen_write_setselection(struct screen_write_ctx *, u_char *, u_int);
+void	 screen_write_setselection_encoded(struct screen_write_ctx *,
+	     const char *);
 void	 screen_write_rawstring(struct screen_write_ctx *, u_char *, u_int);
 void	 screen_write_alternateon(struct screen_write_ctx *,
 	     struct grid_cell *, int);
@@ -2718,7 +3304,9 @@ void	 screen_write_alternateoff(struct screen_write_ctx *,
 
 /* screen-redraw.c */
 void	 screen_redraw_screen(struct client *);
-void	 screen_redraw_pane(struct client *, struct window_pane *);
+void	 screen_redraw_pane(struct client *, struct window_pane *, bitstr_t *);
+void	 screen_redraw_free_borders(struct window *);
+void	 screen_redraw_compose(struct client *, struct grid_cell *);
 
 /* screen.c */
 void	 screen_init(struct screen *, u_int, u_int, u_int);
@@ -2746,6 +3334,8 @@ void	 screen_alternate_off(struct screen *, struct grid_cell *, int);
 /* window.c */
 extern struct windows windows;
 extern struct window_pane_tree all_window_panes;
+extern struct window_checks window_checks;
+extern struct window_pane_checks window_pane_checks;
 int		 window_cmp(struct window *, struct window *);
 RB_PROTOTYPE(windows, window, entry, window_cmp);
 int		 winlink_cmp(struct winlink *, struct winlink *);
@@ -2769,7 +3359,15 @@ void		 winlink_stack_push(struct winlink_stack *, struct winlink *);
 void		 winlink_stack_remove(struct winlink_stack *, struct winlink *);
 struct window	*window_find_by_id_str(const char *);
 struct window	*window_find_by_id(u_int);
+u_int		 window_get_next_id(void);
+void		 window_set_next_id(u_int);
+u_int		 window_pane_get_next_id(void);
+void		 window_pane_set_next_id(u_int);
 void		 window_update_activity(struct window *);
+void		 window_queue_check(struct window *);
+void		 window_unqueue_check(struct window *);
+void		 window_pane_queue_check(struct window_pane *);
+void		 window_pane_unqueue_check(struct window_pane *);
 struct window	*window_create(u_int, u_int, u_int, u_int);
 void		 window_pane_set_event(struct window_pane *);
 struct window_pane *window_get_active_at(struct window *, u_int, u_int);
@@ -2799,8 +3397,11 @@ u_int		 window_count_panes(struct window *);
 void		 window_destroy_panes(struct window *);
 struct window_pane *window_pane_find_by_id_str(const char *);
 struct window_pane *window_pane_find_by_id(u_int);
+struct window_pane *window_pane_find_by_tty(const char *);
+void		 window_pane_set_tty(struct window_pane *, const char *);
 int		 window_pane_destroy_ready(struct window_pane *);
 void		 window_pane_resize(struct window_pane *, u_int, u_int);
+void		 window_pane_start_reflow(struct window_pane *, int);
 void		 window_pane_set_palette(struct window_pane *, u_int, int);
 void		 window_pane_unset_palette(struct window_pane *, u_int);
 void		 window_pane_reset_palette(struct window_pane *);
@@ -2813,7 +3414,20 @@ void		 window_pane_reset_mode_all(struct window_pane *);
 int		 window_pane_key(struct window_pane *, struct client *,
 		     struct session *, struct winlink *, key_code,
 		     struct mouse_event *);
+void		 window_pane_key_literal(struct window_pane *, const char *);
 int		 window_pane_visible(struct window_pane *);
+int		 window_pane_scroll_coalesce(struct window_pane *);
+void		 window_pane_damage(struct window_pane *, u_int, u_int);
+void		 window_pane_forget_lines(struct window_pane *, u_int,
+		     u_int);
+bitstr_t	*window_pane_redraw_lines(struct window_pane *, u_int *);
+size_t		 window_pane_input_backlog(struct window_pane *);
+const char	*window_pane_get_proc_name(struct window_pane *);
+const char	*window_pane_get_proc_cwd(struct window_pane *);
+int		 window_pane_proc_settled(struct window_pane *);
+int		 window_pane_parse_backlog(void);
+void		 window_pane_memory(struct window_pane *,
+		     struct window_pane_memory *);
 u_int		 window_pane_search(struct window_pane *, const char *, int,
 		     int);
 const char	*window_printable_flags(struct winlink *, int);
@@ -2828,8 +3442,15 @@ void		 winlink_clear_flags(struct winlink *);
 int		 winlink_shuffle_up(struct session *, struct winlink *, int);
 int		 window_pane_start_input(struct window_pane *,
 		     struct cmdq_item *, char **);
-void		*window_pane_get_new_data(struct window_pane *,
+size_t		 window_pane_get_new_size(struct window_pane *,
+		     struct window_pane_offset *);
+void		*window_pane_peek_new_data(struct window_pane *,
 		     struct window_pane_offset *, size_t *);
+void		 window_pane_pipe_write(struct window_pane *);
+size_t		 window_pane_pipe_queued(struct window_pane *);
+int		 window_pane_splice_start(struct window_pane *);
+void		 window_pane_splice_stop(struct window_pane *);
+void		 window_pane_set_reading(struct window_pane *, int);
 void		 window_pane_update_used_data(struct window_pane *,
 		     struct window_pane_offset *, size_t);
 
@@ -2868,6 +3489,7 @@ void		 layout_spread_out(struct window_pane *);
 
 /* layout-custom.c */
 char		*layout_dump(struct layout_cell *);
+char		*layout_dump_window(struct window *, int);
 int		 layout_parse(struct window *, const char *);
 
 /* layout-set.c */
@@ -2885,6 +3507,7 @@ typedef int (*mode_tree_search_cb)(void *, void *, const char *);
 typedef void (*mode_tree_menu_cb)(void *, struct client *, key_code);
 typedef u_int (*mode_tree_height_cb)(void *, u_int);
 typedef key_code (*mode_tree_key_cb)(void *, void *, u_int);
+typedef char *(*mode_tree_text_cb)(void *, void *);
 typedef void (*mode_tree_each_cb)(void *, void *, struct client *, key_code);
 u_int	 mode_tree_count_tagged(struct mode_tree_data *);
 void	*mode_tree_get_current(struct mode_tree_data *);
@@ -2899,8 +3522,9 @@ void	 mode_tree_up(struct mode_tree_data *, int);
 void	 mode_tree_down(struct mode_tree_data *, int);
 struct mode_tree_data *mode_tree_start(struct window_pane *, struct args *,
 	     mode_tree_build_cb, mode_tree_draw_cb, mode_tree_search_cb,
-	     mode_tree_menu_cb, mode_tree_height_cb, mode_tree_key_cb, void *,
-	     const struct menu_item *, const char **, u_int, struct screen **);
+	     mode_tree_menu_cb, mode_tree_height_cb, mode_tree_key_cb,
+	     mode_tree_text_cb, void *, const struct menu_item *, const char **,
+	     u_int, struct screen **);
 void	 mode_tree_zoom(struct mode_tree_data *, struct args *);
 void	 mode_tree_build(struct mode_tree_data *);
 void	 mode_tree_free(struct mode_tree_data *);
@@ -2910,6 +3534,8 @@ struct mode_tree_item *mode_tree_add(struct mode_tree_data *,
 	     const char *, int);
 void	 mode_tree_draw_as_parent(struct mode_tree_item *);
 void	 mode_tree_no_tag(struct mode_tree_item *);
+int	 mode_tree_defer_children(struct mode_tree_data *,
+	     struct mode_tree_item *);
 void	 mode_tree_remove(struct mode_tree_data *, struct mode_tree_item *);
 void	 mode_tree_draw(struct mode_tree_data *);
 int	 mode_tree_key(struct mode_tree_data *, struct client *, key_code *,
@@ -2945,6 +3571,7 @@ extern const struct window_mode window_customize_mode;
 
 /* names.c */
 void	 check_window_name(struct window *);
+void	 cancel_window_name(struct window *);
 char	*default_window_name(struct window *);
 char	*parse_window_name(const char *);
 
@@ -2952,18 +3579,27 @@ char	*parse_window_name(const char *);
 void	control_discard(struct client *);
 void	control_start(struct client *);
 void	control_stop(struct client *);
+void	control_guard(struct client *, const char *, long, u_int, int);
 void	control_set_pane_on(struct client *, struct window_pane *);
 void	control_set_pane_off(struct client *, struct window_pane *);
 void	control_continue_pane(struct client *, struct window_pane *);
 void	control_pause_pane(struct client *, struct window_pane *);
+void	control_add_pane_credit(struct client *, struct window_pane *, size_t);
+void	control_clear_pane_credit(struct client *, struct window_pane *);
+void	control_set_pane_lines(struct client *, struct window_pane *, int);
+uint64_t control_get_stat(struct client *, struct window_pane *,
+	     enum control_stat_type);
+void	control_write_stats(struct client *, struct window_pane *);
+void	control_write_lines(struct client *, struct window_pane *);
 struct window_pane_offset *control_pane_offset(struct client *,
 	   struct window_pane *, int *);
 void	control_reset_offsets(struct client *);
 void printflike(2, 3) control_write(struct client *, const char *, ...);
 void	control_write_output(struct client *, struct window_pane *);
+void	control_free_chunks(struct window_pane *);
 int	control_all_done(struct client *);
 void	control_add_sub(struct client *, const char *, enum control_sub_type,
-    	   int, const char *);
+    	   int, const char *, u_int);
 void	control_remove_sub(struct client *, const char *);
 
 /* control-notify.c */
@@ -2981,6 +3617,7 @@ void	control_notify_session_renamed(struct session *);
 void	control_notify_session_created(struct session *);
 void	control_notify_session_closed(struct session *);
 void	control_notify_session_window_changed(struct session *);
+void	control_notify_flush(void);
 
 /* session.c */
 extern struct sessions sessions;
@@ -2990,6 +3627,8 @@ int		 session_alive(struct session *);
 struct session	*session_find(const char *);
 struct session	*session_find_by_id_str(const char *);
 struct session	*session_find_by_id(u_int);
+u_int		 session_get_next_id(void);
+void		 session_set_next_id(u_int);
 struct session	*session_create(const char *, const char *, const char *,
 		     struct environ *, struct options *, struct termios *);
 void		 session_destroy(struct session *, int,	 const char *);
@@ -3025,6 +3664,8 @@ void		 session_renumber_windows(struct session *);
 utf8_char	 utf8_build_one(u_char);
 enum utf8_state	 utf8_from_data(const struct utf8_data *, utf8_char *);
 void		 utf8_to_data(utf8_char, struct utf8_data *);
+u_int		 utf8_char_width(utf8_char);
+size_t		 utf8_table_size(void);
 void		 utf8_set(struct utf8_data *, u_char);
 void		 utf8_copy(struct utf8_data *, const struct utf8_data *);
 enum utf8_state	 utf8_open(struct utf8_data *, u_char);
@@ -3058,6 +3699,40 @@ void printflike(1, 2) log_debug(const char *, ...);
 __dead void printflike(1, 2) fatal(const char *, ...);
 __dead void printflike(1, 2) fatalx(const char *, ...);
 
+/* trace.c */
+#define TRACE_INPUT 0
+#define TRACE_UTF8 1
+#define TRACE_TTY 2
+#define TRACE_PANE 3
+#define TRACE_KEY 4
+#define TRACE_SUBSYSTEMS 5
+#define TRACE_EVENT(s, n) (((s) << 8)|(n))
+enum trace_event {
+	TRACE_INPUT_PARSE = TRACE_EVENT(TRACE_INPUT, 0),
+	TRACE_UTF8_FOUND = TRACE_EVENT(TRACE_UTF8, 0),
+	TRACE_UTF8_ADDED,
+	TRACE_UTF8_FROM,
+	TRACE_UTF8_TO,
+	TRACE_TTY_READ = TRACE_EVENT(TRACE_TTY, 0),
+	TRACE_TTY_ADD,
+	TRACE_TTY_WRITE,
+	TRACE_PANE_READ = TRACE_EVENT(TRACE_PANE, 0),
+	TRACE_PANE_DATA,
+	TRACE_KEY_SENT = TRACE_EVENT(TRACE_KEY, 0),
+	TRACE_KEY_ECHOED,
+	TRACE_KEY_WRITTEN
+};
+#define trace_event(e, a, b, c) do {					\
+	if (trace_mask & (1U << ((e) >> 8)))				\
+		trace_add(e, a, b, c);					\
+} while (0)
+extern u_int	trace_mask;
+int	trace_parse_subsystems(const char *, u_int *, char **);
+void	trace_start(u_int, u_int);
+void	trace_stop(void);
+void	trace_add(u_int, u_int, u_int, u_int);
+void	trace_print(struct cmdq_item *);
+
 /* menu.c */
 #define MENU_NOMOUSE 0x1
 #define MENU_TAB 0x2
@@ -3100,7 +3775,14 @@ void		 style_copy(struct style *, struct style *);
 struct winlink	*spawn_window(struct spawn_context *, char **);
 struct window_pane *spawn_pane(struct spawn_context *, char **);
 
+/* snapshot.c */
+#define SNAPSHOT_CONTENTS 0x1
+#define SNAPSHOT_LIVE 0x2
+struct evbuffer	*snapshot_save(int);
+void		 snapshot_restore(struct cmdq_item *, u_char *, size_t, int);
+
 /* regsub.c */
+const regex_t	*regsub_compile(const char *, int);
 char		*regsub(const char *, const char *, const char *, int);
 
 #endif /* TMUX_H */
@@ -0,0 +1,190 @@
+/* $OpenBSD$ */
+
+/*
+ * Copyright (c) 2021 The tmux authors
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF MIND, USE, DATA OR PROFITS, WHETHER
+ * IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tmux.h"
+
+/*
+ * Trace buffer. Events on busy paths are recorded as fixed size records in a
+ * ring rather than formatted into the log, so tracing is cheap enough to leave
+ * on while a problem happens. Nothing is formatted until the trace is shown.
+ */
+
+struct trace_record {
+	uint64_t	 time;
+	u_int		 event;
+	u_int		 args[3];
+};
+
+static const char *trace_subsystem_names[TRACE_SUBSYSTEMS] = {
+	"input",
+	"utf8",
+	"tty",
+	"pane",
+	"key"
+};
+
+static const struct trace_event_entry {
+	u_int		 event;
+	const char	*name;
+	const char	*args[3];
+	u_int		 hex;	/* bit for each argument shown in hex */
+} trace_event_table[] = {
+	{ TRACE_INPUT_PARSE, "input-parse", { "pane", "bytes", NULL } },
+	{ TRACE_UTF8_FOUND, "utf8-found", { "index", "size", NULL } },
+	{ TRACE_UTF8_ADDED, "utf8-added", { "index", "size", NULL } },
+	{ TRACE_UTF8_FROM, "utf8-from", { "char", NULL, NULL }, 0x1 },
+	{ TRACE_UTF8_TO, "utf8-to", { "char", NULL, NULL }, 0x1 },
+	{ TRACE_TTY_READ, "tty-read", { "client", "bytes", "queued" } },
+	{ TRACE_TTY_ADD, "tty-add", { "client", "bytes", NULL } },
+	{ TRACE_TTY_WRITE, "tty-write", { "client", "bytes", "queued" } },
+	{ TRACE_PANE_READ, "pane-read", { "pane", "bytes", "reads" } },
+	{ TRACE_PANE_DATA, "pane-data", { "pane", "bytes", NULL } },
+	{ TRACE_KEY_SENT, "key-sent", { "client", "pane", NULL } },
+	{ TRACE_KEY_ECHOED, "key-echoed", { "client", "pane", NULL } },
+	{ TRACE_KEY_WRITTEN, "key-written", { "client", "pane", "us" } }
+};
+
+u_int			 trace_mask;
+static struct trace_record *trace_ring;
+static u_int		 trace_size;
+static u_int		 trace_next;
+static uint64_t		 trace_total;
+
+/* Get subsystem mask from a comma-separated list of names. */
+int
+trace_parse_subsystems(const char *s, u_int *mask, char **cause)
+{
+	char	*copy, *next, *name;
+	u_int	 i;
+
+	*mask = 0;
+	copy = next = xstrdup(s);
+	while ((name = strsep(&next, ",")) != NULL) {
+		if (strcmp(name, "all") == 0) {
+			*mask = (1U << TRACE_SUBSYSTEMS) - 1;
+			continue;
+		}
+		for (i = 0; i < TRACE_SUBSYSTEMS; i++) {
+			if (strcmp(name, trace_subsystem_names[i]) == 0)
+				break;
+		}
+		if (i == TRACE_SUBSYSTEMS) {
+			xasprintf(cause, "unknown subsystem: %s", name);
+			free(copy);
+			return (-1);
+		}
+		*mask |= (1U << i);
+	}
+	free(copy);
+	return (0);
+}
+
+/* Start tracing, discarding any existing records. */
+void
+trace_start(u_int mask, u_int size)
+{
+	if (size != trace_size) {
+		free(trace_ring);
+		trace_ring = xcalloc(size, sizeof *trace_ring);
+		trace_size = size;
+	}
+	trace_next = 0;
+	trace_total = 0;
+	trace_mask = mask;
+	log_debug("%s: mask %x, %u records", __func__, mask, size);
+}
+
+/* Stop tracing. Records are kept until tracing is started again. */
+void
+trace_stop(void)
+{
+	trace_mask = 0;
+	log_debug("%s: %llu records", __func__,
+	    (unsigned long long)trace_total);
+}
+
+/* Add a record. Use trace_event rather than calling this directly. */
+void
+trace_add(u_int event, u_int a, u_int b, u_int c)
+{
+	struct trace_record	*tr = &trace_ring[trace_next];
+
+	tr->time = get_timer_usec();
+	tr->event = event;
+	tr->args[0] = a;
+	tr->args[1] = b;
+	tr->args[2] = c;
+
+	if (++trace_next == trace_size)
+		trace_next = 0;
+	trace_total++;
+}
+
+/* Print the records in the ring, oldest first. */
+void
+trace_print(struct cmdq_item *item)
+{
+	const struct trace_event_entry	*te;
+	struct trace_record		*tr;
+	char				 buf[128];
+	u_int				 i, j, n, first;
+	size_t				 off;
+	uint64_t			 start;
+
+	if (trace_total == 0)
+		return;
+	if (trace_total < trace_size) {
+		n = trace_total;
+		first = 0;
+	} else {
+		n = trace_size;
+		first = trace_next;
+	}
+	start = trace_ring[first].time;
+
+	cmdq_print(item, "%llu events (%llu lost), mask %x",
+	    (unsigned long long)trace_total,
+	    (unsigned long long)(trace_total - n), trace_mask);
+	for (i = 0; i < n; i++) {
+		tr = &trace_ring[(first + i) % trace_size];
+		te = NULL;
+		for (j = 0; j < nitems(trace_event_table); j++) {
+			if (trace_event_table[j].event == tr->event) {
+				te = &trace_event_table[j];
+				break;
+			}
+		}
+		if (te == NULL)
+			continue;
+
+		off = 0;
+		for (j = 0; j < nitems(te->args) && te->args[j] != NULL; j++) {
+			off += snprintf(buf + off, sizeof buf - off,
+			    (te->hex & (1U << j)) ? " %s=%08x" : " %s=%u",
+			    te->args[j], tr->args[j]);
+		}
+		cmdq_print(item, "%10llu %s%.*s",
+		    (unsigned long long)(tr->time - start), te->name, (int)off,
+		    buf);
+	}
+}
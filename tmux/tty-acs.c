@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#define XMALLOC_TAG XMALLOC_TTY
 #include "tmux.h"
 
 /* Table mapping ACS entries to UTF-8. */
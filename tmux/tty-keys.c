@@ -29,20 +29,23 @@
 #include <termios.h>
 #include <unistd.h>
 
+#define XMALLOC_TAG XMALLOC_TTY
 #include "tmux.h"
 
 /*
  * Handle keys input from the outside terminal. tty_default_*_keys[] are a base
  * table of supported keys which are looked up in terminfo(5) and translated
- * into a ternary tree.
+ * into a ternary tree. The tree is then compiled into a table of states with
+ * the transitions for each byte, so matching is one lookup for each byte.
  */
 
 static void	tty_keys_add1(struct tty_key **, const char *, key_code);
-static void	tty_keys_add(struct tty *, const char *, key_code);
+static void	tty_keys_add(struct tty_key **, const char *, key_code);
 static void	tty_keys_free1(struct tty_key *);
 static struct tty_key *tty_keys_find1(struct tty_key *, const char *, size_t,
 		    size_t *);
-static struct tty_key *tty_keys_find(struct tty *, const char *, size_t,
+static void	tty_keys_compile(struct tty *, struct tty_key *);
+static struct tty_key_state *tty_keys_find(struct tty *, const char *, size_t,
 		    size_t *);
 static int	tty_keys_next1(struct tty *, const char *, size_t, key_code *,
 		    size_t *, int);
@@ -51,8 +54,12 @@ static int	tty_keys_extended_key(struct tty *, const char *, size_t,
 		    size_t *, key_code *);
 static int	tty_keys_mouse(struct tty *, const char *, size_t, size_t *,
 		    struct mouse_event *);
+static int	tty_keys_mouse_superseded(struct tty *, const char *, size_t,
+		    struct mouse_event *);
 static int	tty_keys_clipboard(struct tty *, const char *, size_t,
 		    size_t *);
+static int	tty_keys_mode_report(struct tty *, const char *, size_t,
+		    size_t *);
 static int	tty_keys_device_attributes(struct tty *, const char *, size_t,
 		    size_t *);
 static int	tty_keys_extended_device_attributes(struct tty *, const char *,
@@ -417,16 +424,16 @@ static const struct tty_default_key_code tty_default_code_keys[] = {
 
 /* Add key to tree. */
 static void
-tty_keys_add(struct tty *tty, const char *s, key_code key)
+tty_keys_add(struct tty_key **tree, const char *s, key_code key)
 {
 	struct tty_key	*tk;
-	size_t		 size;
+	size_t		 size = 0;
 	const char	*keystr;
 
 	keystr = key_string_lookup_key(key, 1);
-	if ((tk = tty_keys_find(tty, s, strlen(s), &size)) == NULL) {
+	if ((tk = tty_keys_find1(*tree, s, strlen(s), &size)) == NULL) {
 		log_debug("new key %s: 0x%llx (%s)", s, key, keystr);
-		tty_keys_add1(&tty->key_tree, s, key);
+		tty_keys_add1(tree, s, key);
 	} else {
 		log_debug("replacing key %s: 0x%llx (%s)", s, key, keystr);
 		tk->key = key;
@@ -485,10 +492,9 @@ tty_keys_build(struct tty *tty)
 	union options_value			*ov;
 	char					 copy[16];
 	key_code				 key;
+	struct tty_key				*tree = NULL;
 
-	if (tty->key_tree != NULL)
-		tty_keys_free(tty);
-	tty->key_tree = NULL;
+	tty_keys_free(tty);
 
 	for (i = 0; i < nitems(tty_default_xterm_keys); i++) {
 		tdkx = &tty_default_xterm_keys[i];
@@ -497,7 +503,7 @@ tty_keys_build(struct tty *tty)
 			copy[strcspn(copy, "_")] = '0' + j;
 
 			key = tdkx->key|tty_default_xterm_modifiers[j];
-			tty_keys_add(tty, copy, key);
+			tty_keys_add(&tree, copy, key);
 		}
 	}
 	for (i = 0; i < nitems(tty_default_raw_keys); i++) {
@@ -505,14 +511,14 @@ tty_keys_build(struct tty *tty)
 
 		s = tdkr->string;
 		if (*s != '\0')
-			tty_keys_add(tty, s, tdkr->key);
+			tty_keys_add(&tree, s, tdkr->key);
 	}
 	for (i = 0; i < nitems(tty_default_code_keys); i++) {
 		tdkc = &tty_default_code_keys[i];
 
 		s = tty_term_string(tty->term, tdkc->code);
 		if (*s != '\0')
-			tty_keys_add(tty, s, tdkc->key);
+			tty_keys_add(&tree, s, tdkc->key);
 
 	}
 
@@ -522,23 +528,31 @@ tty_keys_build(struct tty *tty)
 		while (a != NULL) {
 			i = options_array_item_index(a);
 			ov = options_array_item_value(a);
-			tty_keys_add(tty, ov->string, KEYC_USER + i);
+			tty_keys_add(&tree, ov->string, KEYC_USER + i);
 			a = options_array_next(a);
 		}
 	}
+
+	tty_keys_compile(tty, tree);
+	tty_keys_free1(tree);
 }
 
-/* Free the entire key tree. */
+/* Free the compiled key table. */
 void
 tty_keys_free(struct tty *tty)
 {
-	tty_keys_free1(tty->key_tree);
+	free(tty->key_states);
+	tty->key_states = NULL;
+	free(tty->key_transitions);
+	tty->key_transitions = NULL;
 }
 
 /* Free a single key. */
 static void
 tty_keys_free1(struct tty_key *tk)
 {
+	if (tk == NULL)
+		return;
 	if (tk->next != NULL)
 		tty_keys_free1(tk->next);
 	if (tk->left != NULL)
@@ -548,12 +562,129 @@ tty_keys_free1(struct tty_key *tk)
 	free(tk);
 }
 
-/* Lookup a key in the tree. */
-static struct tty_key *
+/* Find the lowest and highest bytes in one level of a tree. */
+static void
+tty_keys_range(struct tty_key *tk, u_char *first, u_char *last)
+{
+	if (tk == NULL)
+		return;
+	if ((u_char)tk->ch < *first)
+		*first = tk->ch;
+	if ((u_char)tk->ch > *last)
+		*last = tk->ch;
+	tty_keys_range(tk->left, first, last);
+	tty_keys_range(tk->right, first, last);
+}
+
+/* Count the nodes in a tree. */
+static u_int
+tty_keys_count(struct tty_key *tk)
+{
+	if (tk == NULL)
+		return (0);
+	return (1 + tty_keys_count(tk->left) + tty_keys_count(tk->right) +
+	    tty_keys_count(tk->next));
+}
+
+static void	tty_keys_compile_node(struct tty *, struct tty_key *, u_int,
+		    u_int *, u_int *);
+
+/* Add the transitions from a state for one level of the tree. */
+static void
+tty_keys_compile_level(struct tty *tty, struct tty_key *tk, u_int from,
+    u_int *nstates, u_int *nnext)
+{
+	struct tty_key_state	*ts = &tty->key_states[from];
+	u_char			 first = UCHAR_MAX, last = 0;
+
+	if (tk == NULL)
+		return;
+	tty_keys_range(tk, &first, &last);
+
+	ts->first = first;
+	ts->count = (u_int)last - first + 1;
+	ts->next = *nnext;
+	*nnext += ts->count;
+
+	tty->key_transitions = xreallocarray(tty->key_transitions, *nnext,
+	    sizeof *tty->key_transitions);
+	memset(tty->key_transitions + ts->next, 0,
+	    ts->count * sizeof *tty->key_transitions);
+
+	tty_keys_compile_node(tty, tk, from, nstates, nnext);
+}
+
+/* Add a state for a node and its transition from the previous state. */
+static void
+tty_keys_compile_node(struct tty *tty, struct tty_key *tk, u_int from,
+    u_int *nstates, u_int *nnext)
+{
+	struct tty_key_state	*ts = &tty->key_states[from];
+	u_int			 to;
+
+	if (tk == NULL)
+		return;
+
+	to = (*nstates)++;
+	tty->key_transitions[ts->next + ((u_char)tk->ch - ts->first)] = to;
+	tty->key_states[to].key = tk->key;
+	tty->key_states[to].more = (tk->next != NULL);
+	tty_keys_compile_level(tty, tk->next, to, nstates, nnext);
+
+	tty_keys_compile_node(tty, tk->left, from, nstates, nnext);
+	tty_keys_compile_node(tty, tk->right, from, nstates, nnext);
+}
+
+/*
+ * Compile a tree into a table of states. State zero is the start and is never
+ * the target of a transition, so a zero transition means no match.
+ */
+static void
+tty_keys_compile(struct tty *tty, struct tty_key *tree)
+{
+	u_int	nstates = 1, nnext = 0;
+
+	tty->key_states = xcalloc(1 + tty_keys_count(tree),
+	    sizeof *tty->key_states);
+	tty->key_states[0].key = KEYC_UNKNOWN;
+	tty->key_states[0].more = 1;
+	tty_keys_compile_level(tty, tree, 0, &nstates, &nnext);
+
+	log_debug("%s: %u key states, %u transitions", __func__, nstates,
+	    nnext);
+}
+
+/* Lookup a key in the compiled table. */
+static struct tty_key_state *
 tty_keys_find(struct tty *tty, const char *buf, size_t len, size_t *size)
 {
+	struct tty_key_state	*ts;
+	u_int			 state = 0;
+	u_char			 ch;
+
 	*size = 0;
-	return (tty_keys_find1(tty->key_tree, buf, len, size));
+	if (tty->key_states == NULL)
+		return (NULL);
+	while (len != 0) {
+		ts = &tty->key_states[state];
+		ch = *buf;
+		if (ch < ts->first || ch - ts->first >= ts->count)
+			return (NULL);
+		state = tty->key_transitions[ts->next + (ch - ts->first)];
+		if (state == 0)
+			return (NULL);
+		buf++; len--;
+		(*size)++;
+
+		/*
+		 * At the end of the data or of a key which is not the start of
+		 * any longer key, return this state.
+		 */
+		ts = &tty->key_states[state];
+		if (len == 0 || (!ts->more && ts->key != KEYC_UNKNOWN))
+			return (ts);
+	}
+	return (NULL);
 }
 
 /* Find the next node. */
@@ -597,7 +728,7 @@ tty_keys_next1(struct tty *tty, const char *buf, size_t len, key_code *key,
     size_t *size, int expired)
 {
 	struct client		*c = tty->client;
-	struct tty_key		*tk, *tk1;
+	struct tty_key_state	*ts;
 	struct utf8_data	 ud;
 	enum utf8_state		 more;
 	utf8_char		 uc;
@@ -607,15 +738,13 @@ tty_keys_next1(struct tty *tty, const char *buf, size_t len, key_code *key,
 	    (int)len, buf, expired);
 
 	/* Is this a known key? */
-	tk = tty_keys_find(tty, buf, len, size);
-	if (tk != NULL && tk->key != KEYC_UNKNOWN) {
-		tk1 = tk;
-		do
-			log_debug("%s: keys in list: %#llx", c->name, tk1->key);
-		while ((tk1 = tk1->next) != NULL);
-		if (tk->next != NULL && !expired)
+	ts = tty_keys_find(tty, buf, len, size);
+	if (ts != NULL && ts->key != KEYC_UNKNOWN) {
+		log_debug("%s: key in table: %#llx%s", c->name, ts->key,
+		    ts->more ? " (and longer)" : "");
+		if (ts->more && !expired)
 			return (1);
-		*key = tk->key;
+		*key = ts->key;
 		return (0);
 	}
 
@@ -666,6 +795,13 @@ tty_keys_next(struct tty *tty)
 		return (0);
 	log_debug("%s: keys are %zu (%.*s)", c->name, len, (int)len, buf);
 
+	/*
+	 * Responses, mouse and extended keys all start with an escape, so
+	 * anything else can go straight to the key table.
+	 */
+	if (*buf != '\033')
+		goto first_key;
+
 	/* Is this a clipboard response? */
 	switch (tty_keys_clipboard(tty, buf, len, &size)) {
 	case 0:		/* yes */
@@ -677,6 +813,17 @@ tty_keys_next(struct tty *tty)
 		goto partial_key;
 	}
 
+	/* Is this a mode report? */
+	switch (tty_keys_mode_report(tty, buf, len, &size)) {
+	case 0:		/* yes */
+		key = KEYC_UNKNOWN;
+		goto complete_key;
+	case -1:	/* no, or not valid */
+		break;
+	case 1:		/* partial */
+		goto partial_key;
+	}
+
 	/* Is this a device attributes response? */
 	switch (tty_keys_device_attributes(tty, buf, len, &size)) {
 	case 0:		/* yes */
@@ -703,6 +850,8 @@ tty_keys_next(struct tty *tty)
 	switch (tty_keys_mouse(tty, buf, len, &size, &m)) {
 	case 0:		/* yes */
 		key = KEYC_MOUSE;
+		if (tty_keys_mouse_superseded(tty, buf + size, len - size, &m))
+			goto discard_key;
 		goto complete_key;
 	case -1:	/* no, or not valid */
 		break;
@@ -830,6 +979,7 @@ complete_key:
 		event = xmalloc(sizeof *event);
 		event->key = key;
 		memcpy(&event->m, &m, sizeof event->m);
+		event->time = get_timer_usec();
 		if (!server_client_handle_key(c, event))
 			free(event);
 	}
@@ -1133,6 +1283,37 @@ tty_keys_mouse(struct tty *tty, const char *buf, size_t len, size_t *size,
 	return (0);
 }
 
+/*
+ * Check if a motion event is immediately followed in the buffer by another
+ * motion with the same buttons and modifiers, so only the later position need
+ * be dispatched. If so, put back the last mouse state so the later event still
+ * reports the position from before this one.
+ */
+static int
+tty_keys_mouse_superseded(struct tty *tty, const char *buf, size_t len,
+    struct mouse_event *m)
+{
+	struct mouse_event	next = { 0 };
+	size_t			size;
+
+	if (!MOUSE_DRAG(m->b) || MOUSE_WHEEL(m->b) || len == 0)
+		return (0);
+
+	/* The last mouse state is only changed if a complete event is found. */
+	if (tty_keys_mouse(tty, buf, len, &size, &next) != 0)
+		return (0);
+	if (next.b != m->b || next.sgr_type != m->sgr_type) {
+		tty->mouse_last_x = m->x;
+		tty->mouse_last_y = m->y;
+		tty->mouse_last_b = m->b;
+		return (0);
+	}
+	tty->mouse_last_x = m->lx;
+	tty->mouse_last_y = m->ly;
+	tty->mouse_last_b = m->lb;
+	return (1);
+}
+
 /*
  * Handle OSC 52 clipboard input. Returns 0 for success, -1 for failure, 1 for
  * partial.
@@ -1220,6 +1401,58 @@ tty_keys_clipboard(__unused struct tty *tty, const char *buf, size_t len,
 	return (0);
 }
 
+/*
+ * Handle a report of the DECLRMM mode (69), which is requested to find if the
+ * terminal supports left and right margins even if its description and
+ * device attributes do not say so. Returns 0 for success, -1 for failure, 1
+ * for partial.
+ */
+static int
+tty_keys_mode_report(struct tty *tty, const char *buf, size_t len,
+    size_t *size)
+{
+	struct client	*c = tty->client;
+	const char	*prefix = "\033[?69;";
+	size_t		 plen = strlen(prefix), i;
+	u_int		 value;
+
+	*size = 0;
+	if (tty->flags & TTY_HAVEDECRQM)
+		return (-1);
+
+	/* First bytes are always \033[?69; then the value and $y. */
+	for (i = 0; i < plen; i++) {
+		if (i == len)
+			return (1);
+		if (buf[i] != prefix[i])
+			return (-1);
+	}
+	if (len == plen)
+		return (1);
+	if (buf[plen] < '0' || buf[plen] > '9')
+		return (-1);
+	value = buf[plen] - '0';
+	if (len == plen + 1)
+		return (1);
+	if (buf[plen + 1] != '$')
+		return (-1);
+	if (len == plen + 2)
+		return (1);
+	if (buf[plen + 2] != 'y')
+		return (-1);
+	*size = plen + 3;
+	log_debug("%s: received DECLRMM mode %u", c->name, value);
+
+	/* Zero means not recognized and 1 to 4 are set or reset. */
+	if (value >= 1 && value <= 4) {
+		tty_add_features(&c->term_features, "margins", ",");
+		tty_update_features(tty);
+	}
+	tty->flags |= TTY_HAVEDECRQM;
+
+	return (0);
+}
+
 /*
  * Handle secondary device attributes input. Returns 0 for success, -1 for
  * failure, 1 for partial.
@@ -28,12 +28,20 @@
 #include <string.h>
 #include <term.h>
 
+#define XMALLOC_TAG XMALLOC_TTY
 #include "tmux.h"
 
 static char	*tty_term_strip(const char *);
+static void	 tty_term_compile(struct tty_code *);
 
 struct tty_terms tty_terms = LIST_HEAD_INITIALIZER(tty_terms);
 
+/*
+ * Changed when terminal-overrides or terminal-features changes, so terminals
+ * created before are not used for new clients.
+ */
+static u_int tty_term_generation;
+
 enum tty_code_type {
 	TTYCODE_NONE = 0,
 	TTYCODE_STRING,
@@ -41,6 +49,25 @@ enum tty_code_type {
 	TTYCODE_FLAG,
 };
 
+/* Operations in a compiled string capability. */
+enum tty_term_op_type {
+	TTYOP_LITERAL,
+	TTYOP_PARAM,
+	TTYOP_CONSTANT,
+	TTYOP_INCREMENT,
+	TTYOP_DECIMAL,
+	TTYOP_BINARY,
+	TTYOP_UNARY,
+	TTYOP_JUMPFALSE,
+	TTYOP_JUMP,
+};
+
+struct tty_term_op {
+	enum tty_term_op_type	type;
+	int			value;
+	u_int			size;
+};
+
 struct tty_code {
 	enum tty_code_type	type;
 	union {
@@ -48,6 +75,9 @@ struct tty_code {
 		int		number;
 		int		flag;
 	} value;
+
+	struct tty_term_op     *ops;
+	u_int			nops;
 };
 
 struct tty_term_code_entry {
@@ -398,6 +428,10 @@ tty_term_apply(struct tty_term *term, const char *capabilities, int quiet)
 				continue;
 			code = &term->codes[i];
 
+			free(code->ops);
+			code->ops = NULL;
+			code->nops = 0;
+
 			if (remove) {
 				code->type = TTYCODE_NONE;
 				continue;
@@ -438,6 +472,7 @@ tty_term_apply_overrides(struct tty_term *term)
 	const char			*s, *acs;
 	size_t				 offset;
 	char				*first;
+	u_int				 i;
 
 	/* Update capabilities from the option. */
 	o = options_get_only(global_options, "terminal-overrides");
@@ -510,11 +545,55 @@ tty_term_apply_overrides(struct tty_term *term)
 		acs = "a#j+k+l+m+n+o-p-q-r-s-t+u+v+w+x|y<z>~.";
 	for (; acs[0] != '\0' && acs[1] != '\0'; acs += 2)
 		term->acs[(u_char) acs[0]][0] = acs[1];
+
+	/* Compile the string capabilities. */
+	for (i = 0; i < tty_term_ncodes(); i++) {
+		if (term->codes[i].type == TTYCODE_STRING)
+			tty_term_compile(&term->codes[i]);
+	}
+}
+
+/* Terminal options have changed, so do not share existing terminals. */
+void
+tty_term_options_changed(void)
+{
+	tty_term_generation++;
+}
+
+/*
+ * Find an existing terminal created from the same capabilities and features
+ * with the same options, which can be shared.
+ */
+static struct tty_term *
+tty_term_find(const char *name, char **caps, u_int ncaps, int feat)
+{
+	struct tty_term	*term;
+	u_int		 i;
+
+	LIST_FOREACH(term, &tty_terms, entry) {
+		if (term->caps == NULL ||
+		    term->generation != tty_term_generation ||
+		    term->create_features != feat ||
+		    term->ncaps != ncaps ||
+		    strcmp(term->name, name) != 0)
+			continue;
+		for (i = 0; i < ncaps; i++) {
+			if (strcmp(term->caps[i], caps[i]) != 0)
+				break;
+		}
+		if (i == ncaps)
+			return (term);
+	}
+	return (NULL);
 }
 
+/*
+ * Create a terminal from the capabilities sent by the client. Clients with
+ * the same terminal share it, so it must be unshared with tty_term_modify
+ * before being changed.
+ */
 struct tty_term *
-tty_term_create(struct tty *tty, char *name, char **caps, u_int ncaps,
-    int *feat, char **cause)
+tty_term_create(char *name, char **caps, u_int ncaps, int *feat, char **cause)
 {
 	struct tty_term				*term;
 	const struct tty_term_code_entry	*ent;
@@ -527,14 +606,30 @@ tty_term_create(struct tty *tty, char *name, char **caps, u_int ncaps,
 	size_t					 offset, namelen;
 	char					*first;
 
+	if ((term = tty_term_find(name, caps, ncaps, *feat)) != NULL) {
+		term->references++;
+		*feat = term->features_out;
+		log_debug("sharing term %s (%u references)", name,
+		    term->references);
+		return (term);
+	}
 	log_debug("adding term %s", name);
 
 	term = xcalloc(1, sizeof *term);
-	term->tty = tty;
+	term->references = 1;
 	term->name = xstrdup(name);
 	term->codes = xcalloc(tty_term_ncodes(), sizeof *term->codes);
 	LIST_INSERT_HEAD(&tty_terms, term, entry);
 
+	term->generation = tty_term_generation;
+	term->create_features = *feat;
+	if (ncaps != 0) {
+		term->caps = xreallocarray(NULL, ncaps, sizeof *term->caps);
+		for (i = 0; i < ncaps; i++)
+			term->caps[i] = xstrdup(caps[i]);
+		term->ncaps = ncaps;
+	}
+
 	/* Fill in codes. */
 	for (i = 0; i < ncaps; i++) {
 		namelen = strcspn(caps[i], "=");
@@ -635,6 +730,7 @@ tty_term_create(struct tty *tty, char *name, char **caps, u_int ncaps,
 	for (i = 0; i < tty_term_ncodes(); i++)
 		log_debug("%s%s", name, tty_term_describe(term, i));
 
+	term->features_out = *feat;
 	return (term);
 
 error:
@@ -642,24 +738,113 @@ error:
 	return (NULL);
 }
 
+/*
+ * Get a terminal which can be changed. If it is shared, it is copied;
+ * otherwise it is no longer the same as it was created, so it cannot be
+ * shared with new clients.
+ */
+struct tty_term *
+tty_term_modify(struct tty_term *term)
+{
+	struct tty_term	*new;
+	struct tty_code	*code;
+	u_int		 i;
+
+	if (term->references == 1) {
+		tty_term_free_list(term->caps, term->ncaps);
+		term->caps = NULL;
+		term->ncaps = 0;
+		return (term);
+	}
+	term->references--;
+	log_debug("copying term %s (%u references)", term->name,
+	    term->references);
+
+	new = xcalloc(1, sizeof *new);
+	new->references = 1;
+	new->name = xstrdup(term->name);
+	new->features = term->features;
+	memcpy(new->acs, term->acs, sizeof new->acs);
+	new->flags = term->flags;
+	LIST_INSERT_HEAD(&tty_terms, new, entry);
+
+	new->codes = xcalloc(tty_term_ncodes(), sizeof *new->codes);
+	for (i = 0; i < tty_term_ncodes(); i++) {
+		code = &new->codes[i];
+		code->type = term->codes[i].type;
+		code->value = term->codes[i].value;
+		if (code->type == TTYCODE_STRING) {
+			code->value.string = xstrdup(code->value.string);
+			tty_term_compile(code);
+		}
+	}
+	return (new);
+}
+
 void
 tty_term_free(struct tty_term *term)
 {
 	u_int	i;
 
+	if (--term->references != 0)
+		return;
 	log_debug("removing term %s", term->name);
 
 	for (i = 0; i < tty_term_ncodes(); i++) {
 		if (term->codes[i].type == TTYCODE_STRING)
 			free(term->codes[i].value.string);
+		free(term->codes[i].ops);
 	}
 	free(term->codes);
+	if (term->caps != NULL)
+		tty_term_free_list(term->caps, term->ncaps);
 
 	LIST_REMOVE(term, entry);
 	free(term->name);
 	free(term);
 }
 
+/* Check if two terminals have the same capabilities. */
+int
+tty_term_equal(struct tty_term *term1, struct tty_term *term2)
+{
+	const struct tty_code	*code1, *code2;
+	u_int			 i;
+
+	if (term1 == term2)
+		return (1);
+	if (strcmp(term1->name, term2->name) != 0 ||
+	    term1->features != term2->features ||
+	    term1->flags != term2->flags ||
+	    memcmp(term1->acs, term2->acs, sizeof term1->acs) != 0)
+		return (0);
+
+	for (i = 0; i < tty_term_ncodes(); i++) {
+		code1 = &term1->codes[i];
+		code2 = &term2->codes[i];
+		if (code1->type != code2->type)
+			return (0);
+		switch (code1->type) {
+		case TTYCODE_NONE:
+			break;
+		case TTYCODE_STRING:
+			if (strcmp(code1->value.string,
+			    code2->value.string) != 0)
+				return (0);
+			break;
+		case TTYCODE_NUMBER:
+			if (code1->value.number != code2->value.number)
+				return (0);
+			break;
+		case TTYCODE_FLAG:
+			if (code1->value.flag != code2->value.flag)
+				return (0);
+			break;
+		}
+	}
+	return (1);
+}
+
 int
 tty_term_read_list(const char *name, int fd, char ***caps, u_int *ncaps,
     char **cause)
@@ -758,15 +943,296 @@ tty_term_string(struct tty_term *term, enum tty_code_code code)
 	return (term->codes[code].value.string);
 }
 
+/* Add an operation to a compiled capability. */
+static u_int
+tty_term_add_op(struct tty_term_op **ops, u_int *nops,
+    enum tty_term_op_type type, int value, u_int size)
+{
+	struct tty_term_op	*op;
+
+	*ops = xreallocarray(*ops, *nops + 1, sizeof **ops);
+	op = &(*ops)[*nops];
+	op->type = type;
+	op->value = value;
+	op->size = size;
+	return ((*nops)++);
+}
+
+/*
+ * Compile a string capability into a list of operations so it can be expanded
+ * with a few integer conversions rather than by tparm(3) each time. Only the
+ * common parts of the terminfo(5) parameter language are supported; strings
+ * using anything else are left for tparm.
+ */
+static void
+tty_term_compile(struct tty_code *code)
+{
+	const char		*string = code->value.string, *s = string;
+	const char		*start;
+	struct tty_term_op	*ops = NULL;
+	u_int			 nops = 0, depth = 0;
+	int			 n, next, jump[8], chain[8];
+
+	free(code->ops);
+	code->ops = NULL;
+	code->nops = 0;
+	if (strchr(string, '%') == NULL)
+		return;
+
+	while (*s != '\0') {
+		if (*s != '%') {
+			start = s;
+			while (*s != '\0' && *s != '%')
+				s++;
+			tty_term_add_op(&ops, &nops, TTYOP_LITERAL,
+			    start - string, s - start);
+			continue;
+		}
+		s++;
+		switch (*s++) {
+		case '%':
+			tty_term_add_op(&ops, &nops, TTYOP_LITERAL,
+			    (s - 1) - string, 1);
+			break;
+		case 'd':
+			tty_term_add_op(&ops, &nops, TTYOP_DECIMAL, 0, 0);
+			break;
+		case 'p':
+			if (*s < '1' || *s > '9')
+				goto fail;
+			n = *s++ - '1';
+			tty_term_add_op(&ops, &nops, TTYOP_PARAM, n, 0);
+			break;
+		case '{':
+			for (n = 0; *s >= '0' && *s <= '9'; s++) {
+				if (n > (INT_MAX - 9) / 10)
+					goto fail;
+				n = (n * 10) + (*s - '0');
+			}
+			if (*s++ != '}')
+				goto fail;
+			tty_term_add_op(&ops, &nops, TTYOP_CONSTANT, n, 0);
+			break;
+		case '\'':
+			if (s[0] == '\0' || s[1] != '\'')
+				goto fail;
+			n = (u_char)*s;
+			tty_term_add_op(&ops, &nops, TTYOP_CONSTANT, n, 0);
+			s += 2;
+			break;
+		case 'i':
+			tty_term_add_op(&ops, &nops, TTYOP_INCREMENT, 0, 0);
+			break;
+		case '+':
+		case '-':
+		case '*':
+		case '/':
+		case 'm':
+		case '&':
+		case '|':
+		case '^':
+		case '=':
+		case '>':
+		case '<':
+		case 'A':
+		case 'O':
+			tty_term_add_op(&ops, &nops, TTYOP_BINARY, s[-1], 0);
+			break;
+		case '!':
+		case '~':
+			tty_term_add_op(&ops, &nops, TTYOP_UNARY, s[-1], 0);
+			break;
+		case '?':
+			if (depth == nitems(jump))
+				goto fail;
+			jump[depth] = chain[depth] = -1;
+			depth++;
+			break;
+		case 't':
+			if (depth == 0 || jump[depth - 1] != -1)
+				goto fail;
+			jump[depth - 1] = tty_term_add_op(&ops, &nops,
+			    TTYOP_JUMPFALSE, 0, 0);
+			break;
+		case 'e':
+			if (depth == 0)
+				goto fail;
+			chain[depth - 1] = tty_term_add_op(&ops, &nops,
+			    TTYOP_JUMP, chain[depth - 1], 0);
+			if (jump[depth - 1] != -1)
+				ops[jump[depth - 1]].value = nops;
+			jump[depth - 1] = -1;
+			break;
+		case ';':
+			if (depth == 0)
+				goto fail;
+			depth--;
+			if (jump[depth] != -1)
+				ops[jump[depth]].value = nops;
+			for (n = chain[depth]; n != -1; n = next) {
+				next = ops[n].value;
+				ops[n].value = nops;
+			}
+			break;
+		default:
+			goto fail;
+		}
+	}
+	if (depth != 0)
+		goto fail;
+
+	code->ops = ops;
+	code->nops = nops;
+	return;
+
+fail:
+	free(ops);
+}
+
+/*
+ * Expand a compiled string capability with up to three parameters. Returns
+ * NULL if the capability is not compiled or if it cannot be expanded.
+ */
+static const char *
+tty_term_expand(struct tty_term *term, enum tty_code_code code, int a, int b,
+    int c)
+{
+	static char		 buf[1024];
+	struct tty_code		*tc = &term->codes[code];
+	const struct tty_term_op *op;
+	int			 params[9] = { a, b, c }, stack[16], x, y;
+	u_int			 nstack = 0, len = 0, i = 0, size;
+	int			 incremented = 0;
+	char			 digits[16];
+
+	if (tc->type != TTYCODE_STRING || tc->ops == NULL)
+		return (NULL);
+
+	while (i < tc->nops) {
+		op = &tc->ops[i++];
+		switch (op->type) {
+		case TTYOP_LITERAL:
+			if (len + op->size >= sizeof buf)
+				return (NULL);
+			memcpy(buf + len, tc->value.string + op->value,
+			    op->size);
+			len += op->size;
+			break;
+		case TTYOP_PARAM:
+		case TTYOP_CONSTANT:
+			if (nstack == nitems(stack))
+				return (NULL);
+			if (op->type == TTYOP_PARAM)
+				stack[nstack++] = params[op->value];
+			else
+				stack[nstack++] = op->value;
+			break;
+		case TTYOP_INCREMENT:
+			if (!incremented) {
+				params[0]++;
+				params[1]++;
+				incremented = 1;
+			}
+			break;
+		case TTYOP_DECIMAL:
+			x = y = (nstack == 0 ? 0 : stack[--nstack]);
+			size = 0;
+			do {
+				digits[size++] = '0' + abs(x % 10);
+				x /= 10;
+			} while (x != 0);
+			if (y < 0)
+				digits[size++] = '-';
+			if (len + size >= sizeof buf)
+				return (NULL);
+			while (size != 0)
+				buf[len++] = digits[--size];
+			break;
+		case TTYOP_BINARY:
+			y = (nstack == 0 ? 0 : stack[--nstack]);
+			x = (nstack == 0 ? 0 : stack[--nstack]);
+			switch (op->value) {
+			case '+':
+				x += y;
+				break;
+			case '-':
+				x -= y;
+				break;
+			case '*':
+				x *= y;
+				break;
+			case '/':
+				x = (y == 0 ? 0 : x / y);
+				break;
+			case 'm':
+				x = (y == 0 ? 0 : x % y);
+				break;
+			case '&':
+				x &= y;
+				break;
+			case '|':
+				x |= y;
+				break;
+			case '^':
+				x ^= y;
+				break;
+			case '=':
+				x = (x == y);
+				break;
+			case '>':
+				x = (x > y);
+				break;
+			case '<':
+				x = (x < y);
+				break;
+			case 'A':
+				x = (x && y);
+				break;
+			case 'O':
+				x = (x || y);
+				break;
+			}
+			stack[nstack++] = x;
+			break;
+		case TTYOP_UNARY:
+			x = (nstack == 0 ? 0 : stack[--nstack]);
+			if (op->value == '!')
+				x = !x;
+			else
+				x = ~x;
+			stack[nstack++] = x;
+			break;
+		case TTYOP_JUMPFALSE:
+			x = (nstack == 0 ? 0 : stack[--nstack]);
+			if (x == 0)
+				i = op->value;
+			break;
+		case TTYOP_JUMP:
+			i = op->value;
+			break;
+		}
+	}
+	buf[len] = '\0';
+	return (buf);
+}
+
 const char *
 tty_term_string1(struct tty_term *term, enum tty_code_code code, int a)
 {
+	const char	*s;
+
+	if ((s = tty_term_expand(term, code, a, 0, 0)) != NULL)
+		return (s);
 	return (tparm((char *) tty_term_string(term, code), a, 0, 0, 0, 0, 0, 0, 0, 0));
 }
 
 const char *
 tty_term_string2(struct tty_term *term, enum tty_code_code code, int a, int b)
 {
+	const char	*s;
+
+	if ((s = tty_term_expand(term, code, a, b, 0)) != NULL)
+		return (s);
 	return (tparm((char *) tty_term_string(term, code), a, b, 0, 0, 0, 0, 0, 0, 0));
 }
 
@@ -774,6 +1240,10 @@ const char *
 tty_term_string3(struct tty_term *term, enum tty_code_code code, int a, int b,
     int c)
 {
+	const char	*s;
+
+	if ((s = tty_term_expand(term, code, a, b, c)) != NULL)
+		return (s);
 	return (tparm((char *) tty_term_string(term, code), a, b, c, 0, 0, 0, 0, 0, 0));
 }
 
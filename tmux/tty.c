@@ -25,16 +25,44 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <resolv.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
 #include <unistd.h>
 
+#define XMALLOC_TAG XMALLOC_TTY
 #include "tmux.h"
 
 static int	tty_log_fd = -1;
 
-static int	tty_client_ready(struct client *);
+/* Cursor movement step, either a character or a code repeated. */
+struct tty_cursor_step {
+	u_char			 ch;
+	enum tty_code_code	 code;
+	int			 arg;
+	u_int			 n;
+};
+
+/* Cheapest cursor movement found, along a row and then a column or both. */
+struct tty_cursor_plan {
+	struct tty_cursor_step	 steps[3];
+	u_int			 nsteps;
+	u_int			 cost;
+};
+
+/* Cell collected into a group with the same attributes by tty_draw_line. */
+struct tty_draw_cell {
+	u_int			 offset;
+	u_int			 x;
+	int			 changed;
+};
+
+/* Cleared cell as recorded in the shadow when clearing to the end of line. */
+static const struct grid_cell tty_shadow_cleared_cell = {
+	{ { ' ' }, 0, 1, 1 }, 0, GRID_FLAG_CLEARED, 8, 8, 0
+};
+
 
 static void	tty_set_italics(struct tty *);
 static int	tty_try_colour(struct tty *, int, const char *);
@@ -44,6 +72,15 @@ static void	tty_cursor_pane(struct tty *, const struct tty_ctx *, u_int,
 static void	tty_cursor_pane_unless_wrap(struct tty *,
 		    const struct tty_ctx *, u_int, u_int);
 static void	tty_invalidate(struct tty *);
+static void	tty_sync_timer_callback(int, short, void *);
+static struct tty_shadow_cell *tty_shadow_get(struct tty *, u_int, u_int);
+static void	tty_shadow_forget(struct tty *, u_int, u_int, u_int);
+static void	tty_shadow_forget_lines(struct tty *, u_int, u_int);
+static void	tty_shadow_forget_pane(struct tty *, const struct tty_ctx *,
+		    u_int, u_int);
+static int	tty_shadow_update(struct tty *, u_int, u_int,
+		    const struct grid_cell *, const struct grid_cell *, int *);
+static int	tty_shadow_empty(struct tty *, u_int, u_int, u_int);
 static void	tty_colours(struct tty *, const struct grid_cell *);
 static void	tty_check_fg(struct tty *, int *, struct grid_cell *);
 static void	tty_check_bg(struct tty *, int *, struct grid_cell *);
@@ -67,15 +104,19 @@ static void	tty_repeat_space(struct tty *, u_int);
 static void	tty_draw_pane(struct tty *, const struct tty_ctx *, u_int);
 static void	tty_default_attributes(struct tty *, const struct grid_cell *,
 		    int *, u_int);
+static void	tty_cursor_plan(struct tty *, u_int, u_int, u_int, u_int,
+		    struct tty_cursor_plan *);
 
 #define tty_use_margin(tty) \
 	(tty->term->flags & TERM_DECSLRM)
 #define tty_full_width(tty, ctx) \
 	((ctx)->xoff == 0 && (ctx)->sx >= (tty)->sx)
 
-#define TTY_BLOCK_INTERVAL (100000 /* 100 milliseconds */)
 #define TTY_BLOCK_START(tty) (1 + ((tty)->sx * (tty)->sy) * 8)
-#define TTY_BLOCK_STOP(tty) (1 + ((tty)->sx * (tty)->sy) / 8)
+#define TTY_RATE_INTERVAL 1000 /* 1 second */
+#define TTY_SLOW_LATENCY 20 /* milliseconds */
+#define TTY_MAX_FRAME_INTERVAL 1000 /* 1 second */
+#define TTY_SYNC_INTERVAL 16 /* milliseconds */
 
 void
 tty_create_log(void)
@@ -101,6 +142,8 @@ tty_init(struct tty *tty, struct client *c)
 	tty->cstyle = 0;
 	tty->ccolour = xstrdup("");
 
+	tty->shadow_generation = 1;
+
 	if (tcgetattr(c->fd, &tty->tio) != 0)
 		return (-1);
 	return (0);
@@ -166,55 +209,109 @@ tty_read_callback(__unused int fd, __unused short events, void *data)
 		server_client_lost(tty->client);
 		return;
 	}
-	log_debug("%s: read %d bytes (already %zu)", name, nread, size);
+	trace_event(TRACE_TTY_READ, c->pid, nread, size);
 
 	while (tty_keys_next(tty))
 		;
 }
 
-static void
-tty_timer_callback(__unused int fd, __unused short events, void *data)
+/*
+ * Stop sending updates to a client which has fallen behind. Nothing already
+ * queued is thrown away; instead, pane updates are dropped and the client
+ * redrawn in one go once the queue has been written, so only the latest frame
+ * is sent. Bytes from the last redraw do not count towards the limit.
+ */
+static int
+tty_block_maybe(struct tty *tty)
 {
-	struct tty	*tty = data;
 	struct client	*c = tty->client;
-	struct timeval	 tv = { .tv_usec = TTY_BLOCK_INTERVAL };
+	size_t		 size = tty_pending(tty);
+
+	if (tty->flags & TTY_BLOCK)
+		return (1);
+	if (size < c->redraw + TTY_BLOCK_START(tty))
+		return (0);
+	tty->flags |= TTY_BLOCK;
 
-	log_debug("%s: %zu discarded", c->name, tty->discarded);
+	log_debug("%s: can't keep up, %zu queued", c->name, size);
+	tty->discarded = 0;
+	return (1);
+}
 
-	c->flags |= CLIENT_ALLREDRAWFLAGS;
-	c->discarded += tty->discarded;
+/* Start sending updates to a blocked client again if it has caught up. */
+void
+tty_unblock(struct tty *tty)
+{
+	struct client	*c = tty->client;
 
-	if (tty->discarded < TTY_BLOCK_STOP(tty)) {
-		tty->flags &= ~TTY_BLOCK;
-		tty_invalidate(tty);
+	if (~tty->flags & TTY_BLOCK)
+		return;
+	if (tty_pending(tty) != 0)
 		return;
+	tty->flags &= ~TTY_BLOCK;
+
+	log_debug("%s: caught up, %zu discarded", c->name, tty->discarded);
+
+	/*
+	 * Anything else written while blocked was lost, so the terminal state
+	 * is no longer known.
+	 */
+	if (tty->discarded != 0) {
+		c->discarded += tty->discarded;
+		tty->discarded = 0;
+		tty_invalidate(tty);
+		c->flags |= CLIENT_ALLREDRAWFLAGS;
 	}
-	tty->discarded = 0;
-	evtimer_add(&tty->timer, &tv);
 }
 
-static int
-tty_block_maybe(struct tty *tty)
+/*
+ * Get the minimum time between frames for a client. This is zero unless the
+ * client takes a long time to consume its output, in which case it is sent a
+ * frame only as often as it can take one.
+ */
+u_int
+tty_frame_interval(struct tty *tty)
 {
 	struct client	*c = tty->client;
-	size_t		 size = EVBUFFER_LENGTH(tty->out);
-	struct timeval	 tv = { .tv_usec = TTY_BLOCK_INTERVAL };
 
-	if (size < TTY_BLOCK_START(tty))
+	if (c->latency < TTY_SLOW_LATENCY)
 		return (0);
+	if (c->latency > TTY_MAX_FRAME_INTERVAL)
+		return (TTY_MAX_FRAME_INTERVAL);
+	return (c->latency);
+}
 
-	if (tty->flags & TTY_BLOCK)
-		return (1);
-	tty->flags |= TTY_BLOCK;
+/*
+ * Decide whether to drop an update to a slow client. Updates are held back
+ * while the last frame is still being written or until enough time has passed
+ * since it, and are sent as one redraw instead.
+ */
+static int
+tty_throttle(struct tty *tty)
+{
+	struct client	*c = tty->client;
+	u_int		 interval;
 
-	log_debug("%s: can't keep up, %zu discarded", c->name, size);
+	if ((interval = tty_frame_interval(tty)) == 0)
+		return (0);
+	if (tty_pending(tty) != 0)
+		return (1);
+	return (get_timer() - c->redraw_time < interval);
+}
 
-	evbuffer_drain(tty->out, size);
-	c->discarded += size;
+/* Update the output rate of a client. */
+static void
+tty_update_rate(struct tty *tty, size_t written)
+{
+	struct client	*c = tty->client;
+	uint64_t	 t = get_timer();
 
-	tty->discarded = 0;
-	evtimer_add(&tty->timer, &tv);
-	return (1);
+	c->rate_written += written;
+	if (t - c->rate_time < TTY_RATE_INTERVAL)
+		return;
+	c->rate = (c->rate_written * 1000) / (t - c->rate_time);
+	c->rate_written = 0;
+	c->rate_time = t;
 }
 
 static void
@@ -222,13 +319,32 @@ tty_write_callback(__unused int fd, __unused short events, void *data)
 {
 	struct tty	*tty = data;
 	struct client	*c = tty->client;
-	size_t		 size = EVBUFFER_LENGTH(tty->out);
+	size_t		 size;
+	uint64_t	 latency, start;
 	int		 nwrite;
 
+	tty_flush(tty);
+	size = EVBUFFER_LENGTH(tty->out);
+
+	start = get_timer_usec();
 	nwrite = evbuffer_write(tty->out, c->fd);
+	server_client_add_timing(c, CLIENT_TIMING_WRITE, start);
 	if (nwrite == -1)
 		return;
-	log_debug("%s: wrote %d bytes (of %zu)", c->name, nwrite, size);
+	trace_event(TRACE_TTY_WRITE, c->pid, nwrite, size);
+	tty_update_rate(tty, nwrite);
+
+	/*
+	 * Measure how long the output took to be consumed, from when it was
+	 * first queued until the buffer is empty.
+	 */
+	if (EVBUFFER_LENGTH(tty->out) == 0) {
+		latency = get_timer() - c->queued_time;
+		c->latency = (c->latency * 3 + latency) / 4;
+		log_debug("%s: latency %llu ms (average %u ms)", c->name,
+		    (unsigned long long)latency, c->latency);
+		server_client_input_written(c);
+	}
 
 	if (c->redraw > 0) {
 		if ((size_t)nwrite >= c->redraw)
@@ -237,8 +353,7 @@ tty_write_callback(__unused int fd, __unused short events, void *data)
 			c->redraw -= nwrite;
 		log_debug("%s: waiting for redraw, %zu bytes left", c->name,
 		    c->redraw);
-	} else if (tty_block_maybe(tty))
-		return;
+	}
 
 	if (EVBUFFER_LENGTH(tty->out) != 0)
 		event_add(&tty->event_out, NULL);
@@ -249,8 +364,8 @@ tty_open(struct tty *tty, char **cause)
 {
 	struct client	*c = tty->client;
 
-	tty->term = tty_term_create(tty, c->term_name, c->term_caps,
-	    c->term_ncaps, &c->term_features, cause);
+	tty->term = tty_term_create(c->term_name, c->term_caps, c->term_ncaps,
+	    &c->term_features, cause);
 	if (tty->term == NULL) {
 		tty_close(tty);
 		return (-1);
@@ -261,6 +376,7 @@ tty_open(struct tty *tty, char **cause)
 
 	event_set(&tty->event_in, c->fd, EV_PERSIST|EV_READ,
 	    tty_read_callback, tty);
+	event_priority_set(&tty->event_in, PROC_PRIORITY_CLIENT);
 	tty->in = evbuffer_new();
 	if (tty->in == NULL)
 		fatal("out of memory");
@@ -269,8 +385,9 @@ tty_open(struct tty *tty, char **cause)
 	tty->out = evbuffer_new();
 	if (tty->out == NULL)
 		fatal("out of memory");
+	tty->olen = 0;
 
-	evtimer_set(&tty->timer, tty_timer_callback, tty);
+	evtimer_set(&tty->sync_timer, tty_sync_timer_callback, tty);
 
 	tty_start_tty(tty);
 
@@ -288,7 +405,7 @@ tty_start_timer_callback(__unused int fd, __unused short events, void *data)
 	log_debug("%s: start timer fired", c->name);
 	if ((tty->flags & (TTY_HAVEDA|TTY_HAVEXDA)) == 0)
 		tty_update_features(tty);
-	tty->flags |= (TTY_HAVEDA|TTY_HAVEXDA);
+	tty->flags |= (TTY_HAVEDA|TTY_HAVEXDA|TTY_HAVEDECRQM);
 }
 
 void
@@ -339,6 +456,7 @@ tty_start_tty(struct tty *tty)
 		tty_force_cursor_colour(tty, "");
 
 	tty->mouse_drag_flag = 0;
+	tty->mouse_drag_pending = 0;
 	tty->mouse_drag_update = NULL;
 	tty->mouse_drag_release = NULL;
 }
@@ -354,8 +472,19 @@ tty_send_requests(struct tty *tty)
 			tty_puts(tty, "\033[>c");
 		if (~tty->flags & TTY_HAVEXDA)
 			tty_puts(tty, "\033[>q");
+		/*
+		 * Ask whether left and right margins are supported, but only
+		 * if the terminal looks like xterm, because terminals which do
+		 * not understand the intermediate may print the final byte.
+		 */
+		if (~tty->flags & TTY_HAVEDECRQM) {
+			if (tty_term_flag(tty->term, TTYC_XT))
+				tty_puts(tty, "\033[?69$p");
+			else
+				tty->flags |= TTY_HAVEDECRQM;
+		}
 	} else
-		tty->flags |= (TTY_HAVEDA|TTY_HAVEXDA);
+		tty->flags |= (TTY_HAVEDA|TTY_HAVEXDA|TTY_HAVEDECRQM);
 }
 
 void
@@ -369,8 +498,8 @@ tty_stop_tty(struct tty *tty)
 	tty->flags &= ~TTY_STARTED;
 
 	evtimer_del(&tty->start_timer);
+	evtimer_del(&tty->sync_timer);
 
-	event_del(&tty->timer);
 	tty->flags &= ~TTY_BLOCK;
 
 	event_del(&tty->event_in);
@@ -446,6 +575,7 @@ tty_free(struct tty *tty)
 {
 	tty_close(tty);
 	free(tty->ccolour);
+	free(tty->shadow);
 }
 
 void
@@ -453,8 +583,12 @@ tty_update_features(struct tty *tty)
 {
 	struct client	*c = tty->client;
 
-	if (tty_apply_features(tty->term, c->term_features))
-		tty_term_apply_overrides(tty->term);
+	if ((tty->term->features | c->term_features) != tty->term->features) {
+		tty->term = tty_term_modify(tty->term);
+		if (tty_apply_features(tty->term, c->term_features))
+			tty_term_apply_overrides(tty->term);
+	}
+	tty_invalidate_shadow(tty);
 
 	if (tty_use_margin(tty))
 		tty_putcode(tty, TTYC_ENMG);
@@ -542,12 +676,65 @@ tty_add(struct tty *tty, const char *buf, size_t len)
 		return;
 	}
 
-	evbuffer_add(tty->out, buf, len);
-	log_debug("%s: %.*s", c->name, (int)len, buf);
+	if (tty_pending(tty) == 0)
+		c->queued_time = get_timer();
+	if (len > sizeof tty->obuf - tty->olen)
+		tty_flush(tty);
+	if (len > sizeof tty->obuf) {
+		evbuffer_add(tty->out, buf, len);
+		if (tty->flags & TTY_STARTED)
+			event_add(&tty->event_out, NULL);
+	} else {
+		memcpy(tty->obuf + tty->olen, buf, len);
+		tty->olen += len;
+	}
+	trace_event(TRACE_TTY_ADD, c->pid, len, 0);
 	c->written += len;
+	if (c->input_state == CLIENT_INPUT_ECHOED)
+		c->input_state = CLIENT_INPUT_QUEUED;
 
 	if (tty_log_fd != -1)
 		write(tty_log_fd, buf, len);
+}
+
+/* Get the number of bytes waiting to be written to the terminal. */
+size_t
+tty_pending(struct tty *tty)
+{
+	return (EVBUFFER_LENGTH(tty->out) + tty->olen);
+}
+
+/*
+ * Add the output waiting for one terminal from offset onwards to another, so
+ * the same drawing can be sent to both.
+ */
+void
+tty_copy_output(struct tty *tty, struct tty *from, size_t offset)
+{
+	size_t	len = EVBUFFER_LENGTH(from->out);
+
+	if (offset < len) {
+		tty_add(tty, EVBUFFER_DATA(from->out) + offset, len - offset);
+		offset = 0;
+	} else
+		offset -= len;
+	if (offset < from->olen)
+		tty_add(tty, from->obuf + offset, from->olen - offset);
+}
+
+/*
+ * Move staged output into the output buffer. Output is collected in a fixed
+ * buffer in the tty so that the many small writes made while drawing are only
+ * a copy each, rather than a call into libevent; it is flushed when full and
+ * at the end of each server loop.
+ */
+void
+tty_flush(struct tty *tty)
+{
+	if (tty->olen == 0)
+		return;
+	evbuffer_add(tty->out, tty->obuf, tty->olen);
+	tty->olen = 0;
 	if (tty->flags & TTY_STARTED)
 		event_add(&tty->event_out, NULL);
 }
@@ -570,6 +757,9 @@ tty_putc(struct tty *tty, u_char ch)
 	    tty->cx + 1 >= tty->sx)
 		return;
 
+	if ((~tty->flags & TTY_SHADOWDRAW) && ch >= 0x20 && ch != 0x7f)
+		tty_shadow_forget(tty, tty->cx, tty->cy, 1);
+
 	if (tty->cell.attr & GRID_ATTR_CHARSET) {
 		acs = tty_acs_get(tty, ch);
 		if (acs != NULL)
@@ -581,6 +771,11 @@ tty_putc(struct tty *tty, u_char ch)
 
 	if (ch >= 0x20 && ch != 0x7f) {
 		if (tty->cx >= tty->sx) {
+			if (tty->cy == tty->rlower)
+				tty_invalidate_shadow(tty);
+			else if (~tty->flags & TTY_SHADOWDRAW)
+				tty_shadow_forget(tty, 0, tty->cy + 1, 1);
+
 			tty->cx = 1;
 			if (tty->cy != tty->rlower)
 				tty->cy++;
@@ -605,8 +800,15 @@ tty_putn(struct tty *tty, const void *buf, size_t len, u_int width)
 	    tty->cx + len >= tty->sx)
 		len = tty->sx - tty->cx - 1;
 
+	if (~tty->flags & TTY_SHADOWDRAW)
+		tty_shadow_forget(tty, tty->cx, tty->cy, width);
+
 	tty_add(tty, buf, len);
 	if (tty->cx + width > tty->sx) {
+		if (tty->cy == tty->rlower)
+			tty_invalidate_shadow(tty);
+		else if (~tty->flags & TTY_SHADOWDRAW)
+			tty_shadow_forget_lines(tty, tty->cy + 1, 1);
 		tty->cx = (tty->cx + width) - tty->sx;
 		if (tty->cx <= tty->sx)
 			tty->cy++;
@@ -892,7 +1094,7 @@ tty_update_client_offset(struct client *c)
 }
 
 /* Get a palette entry. */
-static int
+int
 tty_get_palette(int *palette, int c)
 {
 	int	new;
@@ -958,6 +1160,18 @@ tty_redraw_region(struct tty *tty, const struct tty_ctx *ctx)
 		return;
 	}
 
+	/*
+	 * Otherwise if possible mark the lines to be redrawn at the end of the
+	 * server loop, so a narrow pane scrolling several times only redraws
+	 * them once.
+	 */
+	if (ctx->damage_cb != NULL) {
+		log_debug("%s: %s deferred redraw", __func__, c->name);
+		ctx->damage_cb(ctx, ctx->orupper,
+		    ctx->orlower - ctx->orupper + 1);
+		return;
+	}
+
 	for (i = ctx->orupper; i <= ctx->orlower; i++)
 		tty_draw_pane(tty, ctx, i);
 }
@@ -1277,6 +1491,68 @@ tty_check_overlay(struct tty *tty, u_int px, u_int py)
 	return (c->overlay_check(c, px, py));
 }
 
+/*
+ * Draw a group of cells with the same attributes collected by tty_draw_line.
+ * Only cells that have changed are written, and the unchanged cells between
+ * them are written again only if that is cheaper than moving the cursor over
+ * them. The last entry in the cells array is the end of the group.
+ */
+static void
+tty_draw_group(struct tty *tty, const struct grid_cell *gc,
+    const struct grid_cell *defaults, int *palette, const char *buf,
+    const struct tty_draw_cell *cells, u_int ncells, u_int px, u_int py,
+    int wrapped)
+{
+	struct tty_cursor_plan	plan;
+	u_int			i, start, end, next;
+
+	for (i = 0; i < ncells && !cells[i].changed; i++)
+		/* nothing */;
+	if (i == ncells) {
+		log_debug("%s: %u unchanged", __func__, ncells);
+		return;
+	}
+	tty_attributes(tty, gc, defaults, palette);
+
+	if (gc->flags & GRID_FLAG_CLEARED) {
+		for (end = ncells; !cells[end - 1].changed; end--)
+			/* nothing */;
+		log_debug("%s: %u cleared", __func__, end - i);
+		tty_clear_line(tty, defaults, py, px + cells[i].x,
+		    cells[end].x - cells[i].x, gc->bg);
+		return;
+	}
+
+	while (i < ncells) {
+		start = i;
+		end = i + 1;
+		for (;;) {
+			while (end < ncells && cells[end].changed)
+				end++;
+			for (next = end; next < ncells; next++) {
+				if (cells[next].changed)
+					break;
+			}
+			if (next == ncells)
+				break;
+			tty_cursor_plan(tty, px + cells[end].x, py,
+			    px + cells[next].x, py, &plan);
+			if (cells[next].offset - cells[end].offset > plan.cost)
+				break;
+			end = next;
+		}
+
+		if (!wrapped || start != 0)
+			tty_cursor(tty, px + cells[start].x, py);
+		tty_putn(tty, buf + cells[start].offset,
+		    cells[end].offset - cells[start].offset,
+		    cells[end].x - cells[start].x);
+
+		for (i = end; i < ncells && !cells[i].changed; i++)
+			/* nothing */;
+	}
+}
+
 void
 tty_draw_line(struct tty *tty, struct screen *s, u_int px, u_int py, u_int nx,
     u_int atx, u_int aty, const struct grid_cell *defaults, int *palette)
@@ -1285,11 +1561,13 @@ tty_draw_line(struct tty *tty, struct screen *s, u_int px, u_int py, u_int nx,
 	struct grid_cell	 gc, last;
 	const struct grid_cell	*gcp;
 	struct grid_line	*gl;
-	u_int			 i, j, ux, sx, width;
-	int			 flags, cleared = 0, wrapped = 0;
+	const struct grid_line	*line;
+	u_int			 i, j, n, ux, sx, width;
+	int			 flags, cleared = 0, wrapped = 0, same = 1;
 	char			 buf[512];
+	struct tty_draw_cell	 cells[(sizeof buf) + 1];
 	size_t			 len;
-	u_int			 cellsize;
+	u_int			 cellsize, ncells;
 
 	log_debug("%s: px=%u py=%u nx=%u atx=%u aty=%u", __func__,
 	    px, py, nx, atx, aty);
@@ -1307,6 +1585,12 @@ tty_draw_line(struct tty *tty, struct screen *s, u_int px, u_int py, u_int nx,
 	tty_region_off(tty);
 	tty_margin_off(tty);
 
+	/*
+	 * Cells are recorded in the shadow as they are collected and a group of
+	 * cells is only written if the terminal is not already showing it.
+	 */
+	tty->flags |= TTY_SHADOWDRAW;
+
 	/*
 	 * Clamp the width to cellsize - note this is not cellused, because
 	 * there may be empty background cells after it (from BCE).
@@ -1331,15 +1615,23 @@ tty_draw_line(struct tty *tty, struct screen *s, u_int px, u_int py, u_int nx,
 	    (~gl->flags & GRID_LINE_WRAPPED) ||
 	    atx != 0 ||
 	    tty->cx < tty->sx ||
+	    aty == 0 ||
+	    tty->cy != aty - 1 ||
 	    nx < tty->sx) {
 		if (nx < tty->sx &&
 		    atx == 0 &&
 		    px + sx != nx &&
 		    tty_term_has(tty->term, TTYC_EL1) &&
-		    !tty_fake_bce(tty, defaults, 8)) {
+		    !tty_fake_bce(tty, defaults, 8) &&
+		    tty_shadow_empty(tty, 0, aty, nx)) {
 			tty_default_attributes(tty, defaults, palette, 8);
 			tty_cursor(tty, nx - 1, aty);
 			tty_putcode(tty, TTYC_EL1);
+			for (i = 0; i < nx; i++) {
+				tty_shadow_update(tty, i, aty,
+				    &tty_shadow_cleared_cell, defaults,
+				    palette);
+			}
 			cleared = 1;
 		}
 	} else {
@@ -1350,7 +1642,9 @@ tty_draw_line(struct tty *tty, struct screen *s, u_int px, u_int py, u_int nx,
 	memcpy(&last, &grid_default_cell, sizeof last);
 	len = 0;
 	width = 0;
+	ncells = 0;
 
+	line = grid_peek_line(gd, gd->hsize + py);
 	for (i = 0; i < sx; i++) {
 		grid_view_get_cell(gd, px + i, py, &gc);
 		gcp = tty_check_codeset(tty, &gc);
@@ -1364,21 +1658,18 @@ tty_draw_line(struct tty *tty, struct screen *s, u_int px, u_int py, u_int nx,
 		    gcp->us != last.us ||
 		    ux + width + gcp->data.width > nx ||
 		    (sizeof buf) - len < gcp->data.size)) {
-			tty_attributes(tty, &last, defaults, palette);
-			if (last.flags & GRID_FLAG_CLEARED) {
-				log_debug("%s: %zu cleared", __func__, len);
-				tty_clear_line(tty, defaults, aty, atx + ux,
-				    width, last.bg);
-			} else {
-				if (!wrapped || atx != 0 || ux != 0)
-					tty_cursor(tty, atx + ux, aty);
-				tty_putn(tty, buf, len, width);
-			}
+			cells[ncells].offset = len;
+			cells[ncells].x = width;
+			tty_draw_group(tty, &last, defaults, palette, buf,
+			    cells, ncells, atx + ux, aty,
+			    wrapped && atx == 0 && ux == 0);
 			ux += width;
 
 			len = 0;
 			width = 0;
+			ncells = 0;
 			wrapped = 0;
+			same = 1;
 		}
 
 		if (gcp->flags & GRID_FLAG_SELECTED)
@@ -1389,6 +1680,7 @@ tty_draw_line(struct tty *tty, struct screen *s, u_int px, u_int py, u_int nx,
 			if (~gcp->flags & GRID_FLAG_PADDING)
 				ux += gcp->data.width;
 		} else if (ux + gcp->data.width > nx) {
+			tty_shadow_forget(tty, atx + ux, aty, gcp->data.width);
 			tty_attributes(tty, &last, defaults, palette);
 			tty_cursor(tty, atx + ux, aty);
 			for (j = 0; j < gcp->data.width; j++) {
@@ -1398,38 +1690,88 @@ tty_draw_line(struct tty *tty, struct screen *s, u_int px, u_int py, u_int nx,
 				ux++;
 			}
 		} else if (gcp->attr & GRID_ATTR_CHARSET) {
-			tty_attributes(tty, &last, defaults, palette);
-			tty_cursor(tty, atx + ux, aty);
-			for (j = 0; j < gcp->data.size; j++)
-				tty_putc(tty, gcp->data.data[j]);
+			if (!tty_shadow_update(tty, atx + ux, aty, &last,
+			    defaults, palette)) {
+				tty_attributes(tty, &last, defaults, palette);
+				tty_cursor(tty, atx + ux, aty);
+				for (j = 0; j < gcp->data.size; j++)
+					tty_putc(tty, gcp->data.data[j]);
+			}
 			ux += gcp->data.width;
 		} else if (~gcp->flags & GRID_FLAG_PADDING) {
+			cells[ncells].offset = len;
+			cells[ncells].x = width;
+			cells[ncells].changed = !tty_shadow_update(tty,
+			    atx + ux + width, aty, &last, defaults, palette);
+			if (cells[ncells++].changed)
+				same = 0;
 			memcpy(buf + len, gcp->data.data, gcp->data.size);
 			len += gcp->data.size;
 			width += gcp->data.width;
+
+			/*
+			 * Following cells with the same attributes and plain
+			 * ASCII can be added to the group without fetching
+			 * and checking each one. The run stops at anything
+			 * that would end the group so that cell is handled as
+			 * normal.
+			 */
+			if (line == NULL)
+				continue;
+			n = grid_line_run(line, px + i, sx - i - 1);
+			for (j = 0; j < n; j++) {
+				if (ux + width + 1 > nx || len == sizeof buf)
+					break;
+				if (!tty_check_overlay(tty, atx + ux + width,
+				    aty))
+					break;
+				utf8_set(&last.data,
+				    line->celldata[px + i + 1 + j].data.data);
+				cells[ncells].offset = len;
+				cells[ncells].x = width;
+				cells[ncells].changed = !tty_shadow_update(tty,
+				    atx + ux + width, aty, &last, defaults,
+				    palette);
+				if (cells[ncells++].changed)
+					same = 0;
+				buf[len++] = *last.data.data;
+				width++;
+			}
+			i += j;
 		}
 	}
 	if (len != 0 && ((~last.flags & GRID_FLAG_CLEARED) || last.bg != 8)) {
-		tty_attributes(tty, &last, defaults, palette);
-		if (last.flags & GRID_FLAG_CLEARED) {
-			log_debug("%s: %zu cleared (end)", __func__, len);
-			tty_clear_line(tty, defaults, aty, atx + ux, width,
-			    last.bg);
-		} else {
-			if (!wrapped || atx != 0 || ux != 0)
-				tty_cursor(tty, atx + ux, aty);
-			tty_putn(tty, buf, len, width);
-		}
+		cells[ncells].offset = len;
+		cells[ncells].x = width;
+		tty_draw_group(tty, &last, defaults, palette, buf, cells,
+		    ncells, atx + ux, aty, wrapped && atx == 0 && ux == 0);
 		ux += width;
+		same = 1;
 	}
 
 	if (!cleared && ux < nx) {
-		log_debug("%s: %u to end of line (%zu cleared)", __func__,
-		    nx - ux, len);
-		tty_default_attributes(tty, defaults, palette, 8);
-		tty_clear_line(tty, defaults, aty, atx + ux, nx - ux, 8);
+		/*
+		 * Any cells left over here have been recorded but not drawn,
+		 * so the clear is needed unless they were already unchanged.
+		 */
+		for (i = ux; i < nx; i++) {
+			if (!tty_shadow_update(tty, atx + i, aty,
+			    &tty_shadow_cleared_cell, defaults, palette))
+				same = 0;
+		}
+		if (same) {
+			log_debug("%s: %u to end of line unchanged", __func__,
+			    nx - ux);
+		} else {
+			log_debug("%s: %u to end of line (%zu cleared)",
+			    __func__, nx - ux, len);
+			tty_default_attributes(tty, defaults, palette, 8);
+			tty_clear_line(tty, defaults, aty, atx + ux, nx - ux,
+			    8);
+		}
 	}
 
+	tty->flags &= ~TTY_SHADOWDRAW;
 	tty->flags = (tty->flags & ~TTY_NOCURSOR) | flags;
 	tty_update_mode(tty, tty->mode, s);
 }
@@ -1442,6 +1784,7 @@ tty_sync_start(struct tty *tty)
 	if (tty->flags & TTY_SYNCING)
 		return;
 	tty->flags |= TTY_SYNCING;
+	tty->sync_time = get_timer();
 
 	if (tty_term_has(tty->term, TTYC_SYNC)) {
 		log_debug("%s sync start", tty->client->name);
@@ -1457,6 +1800,8 @@ tty_sync_end(struct tty *tty)
 	if (~tty->flags & TTY_SYNCING)
 		return;
 	tty->flags &= ~TTY_SYNCING;
+	tty->sync_end_time = get_timer();
+	evtimer_del(&tty->sync_timer);
 
 	if (tty_term_has(tty->term, TTYC_SYNC)) {
  		log_debug("%s sync end", tty->client->name);
@@ -1464,7 +1809,48 @@ tty_sync_end(struct tty *tty)
 	}
 }
 
-static int
+static void
+tty_sync_timer_callback(__unused int fd, __unused short events, void *data)
+{
+	struct tty	*tty = data;
+
+	tty_sync_end(tty);
+}
+
+/*
+ * End a synchronized update once all writing for a server loop is done. If the
+ * last one ended less than a frame ago, output is arriving quickly, so leave
+ * this one open until it has lasted a frame; the terminal then shows updates
+ * from all panes in the next few loops at once. A timer ends it if nothing
+ * else does.
+ */
+void
+tty_sync_end_maybe(struct tty *tty)
+{
+	struct timeval	tv = { 0 };
+	uint64_t	t, elapsed;
+
+	if (~tty->flags & TTY_SYNCING)
+		return;
+	if (!tty_term_has(tty->term, TTYC_SYNC)) {
+		tty_sync_end(tty);
+		return;
+	}
+
+	t = get_timer();
+	elapsed = t - tty->sync_time;
+	if (t - tty->sync_end_time >= TTY_SYNC_INTERVAL ||
+	    elapsed >= TTY_SYNC_INTERVAL) {
+		tty_sync_end(tty);
+		return;
+	}
+	if (!evtimer_pending(&tty->sync_timer, NULL)) {
+		tv.tv_usec = (TTY_SYNC_INTERVAL - elapsed) * 1000;
+		evtimer_add(&tty->sync_timer, &tv);
+	}
+}
+
+int
 tty_client_ready(struct client *c)
 {
 	if (c->session == NULL || c->tty.term == NULL)
@@ -1481,25 +1867,74 @@ tty_write(void (*cmdfn)(struct tty *, const struct tty_ctx *),
     struct tty_ctx *ctx)
 {
 	struct client	*c;
-	int		 state;
+	int		 state, flags;
+	uint64_t	 start;
 
 	if (ctx->set_client_cb == NULL)
 		return;
 	TAILQ_FOREACH(c, &clients, entry) {
-		if (!tty_client_ready(c))
+		if (!tty_client_ready(c)) {
+			/*
+			 * If an overlay is holding back an update, more than
+			 * the area under the overlay must be redrawn when it
+			 * goes away.
+			 */
+			if (c->overlay_draw != NULL &&
+			    (c->tty.flags & TTY_FREEZE) &&
+			    (~c->flags & CLIENT_OVERLAYMISSED) &&
+			    c->session != NULL &&
+			    ctx->set_client_cb(ctx, c) == 1)
+				c->flags |= CLIENT_OVERLAYMISSED;
 			continue;
+		}
 		state = ctx->set_client_cb(ctx, c);
 		if (state == -1)
 			break;
 		if (state == 0)
 			continue;
+
+		/*
+		 * A client which encodes its own output is sent the changed
+		 * lines on the next redraw. Only the clipboard and raw strings
+		 * are still written by the server.
+		 */
+		if (render_active(c) &&
+		    cmdfn != tty_cmd_setselection &&
+		    cmdfn != tty_cmd_rawstring) {
+			c->flags |= CLIENT_REDRAWPANES;
+			continue;
+		}
+
+		/*
+		 * The clipboard and raw strings cannot be redrawn, so they are
+		 * queued even if the client is behind.
+		 */
+		if (cmdfn == tty_cmd_setselection ||
+		    cmdfn == tty_cmd_rawstring) {
+			flags = (c->tty.flags & TTY_BLOCK);
+			c->tty.flags &= ~TTY_BLOCK;
+			cmdfn(&c->tty, ctx);
+			c->tty.flags |= flags;
+			continue;
+		}
+		if (tty_block_maybe(&c->tty) || tty_throttle(&c->tty)) {
+			/* Drop the update and redraw when caught up. */
+			c->tty.flags |= TTY_DROPPED;
+			c->flags |= CLIENT_REDRAWWINDOW;
+			continue;
+		}
+		start = get_timer_usec();
 		cmdfn(&c->tty, ctx);
+		server_client_add_timing(c, CLIENT_TIMING_UPDATE, start);
+
 	}
 }
 
 void
 tty_cmd_insertcharacter(struct tty *tty, const struct tty_ctx *ctx)
 {
+	tty_shadow_forget_pane(tty, ctx, ctx->ocy, 1);
+
 	if (ctx->bigger ||
 	    !tty_full_width(tty, ctx) ||
 	    tty_fake_bce(tty, &ctx->defaults, ctx->bg) ||
@@ -1519,6 +1954,8 @@ tty_cmd_insertcharacter(struct tty *tty, const struct tty_ctx *ctx)
 void
 tty_cmd_deletecharacter(struct tty *tty, const struct tty_ctx *ctx)
 {
+	tty_shadow_forget_pane(tty, ctx, ctx->ocy, 1);
+
 	if (ctx->bigger ||
 	    !tty_full_width(tty, ctx) ||
 	    tty_fake_bce(tty, &ctx->defaults, ctx->bg) ||
@@ -1538,6 +1975,8 @@ tty_cmd_deletecharacter(struct tty *tty, const struct tty_ctx *ctx)
 void
 tty_cmd_clearcharacter(struct tty *tty, const struct tty_ctx *ctx)
 {
+	tty_shadow_forget_pane(tty, ctx, ctx->ocy, 1);
+
 	tty_default_attributes(tty, &ctx->defaults, ctx->palette, ctx->bg);
 
 	tty_clear_pane_line(tty, ctx, ctx->ocy, ctx->ocx, ctx->num, ctx->bg);
@@ -1546,6 +1985,8 @@ tty_cmd_clearcharacter(struct tty *tty, const struct tty_ctx *ctx)
 void
 tty_cmd_insertline(struct tty *tty, const struct tty_ctx *ctx)
 {
+	tty_shadow_forget_pane(tty, ctx, 0, ctx->sy);
+
 	if (ctx->bigger ||
 	    !tty_full_width(tty, ctx) ||
 	    tty_fake_bce(tty, &ctx->defaults, ctx->bg) ||
@@ -1570,6 +2011,8 @@ tty_cmd_insertline(struct tty *tty, const struct tty_ctx *ctx)
 void
 tty_cmd_deleteline(struct tty *tty, const struct tty_ctx *ctx)
 {
+	tty_shadow_forget_pane(tty, ctx, 0, ctx->sy);
+
 	if (ctx->bigger ||
 	    !tty_full_width(tty, ctx) ||
 	    tty_fake_bce(tty, &ctx->defaults, ctx->bg) ||
@@ -1594,6 +2037,8 @@ tty_cmd_deleteline(struct tty *tty, const struct tty_ctx *ctx)
 void
 tty_cmd_clearline(struct tty *tty, const struct tty_ctx *ctx)
 {
+	tty_shadow_forget_pane(tty, ctx, ctx->ocy, 1);
+
 	tty_default_attributes(tty, &ctx->defaults, ctx->palette, ctx->bg);
 
 	tty_clear_pane_line(tty, ctx, ctx->ocy, 0, ctx->sx, ctx->bg);
@@ -1604,6 +2049,8 @@ tty_cmd_clearendofline(struct tty *tty, const struct tty_ctx *ctx)
 {
 	u_int	nx = ctx->sx - ctx->ocx;
 
+	tty_shadow_forget_pane(tty, ctx, ctx->ocy, 1);
+
 	tty_default_attributes(tty, &ctx->defaults, ctx->palette, ctx->bg);
 
 	tty_clear_pane_line(tty, ctx, ctx->ocy, ctx->ocx, nx, ctx->bg);
@@ -1612,6 +2059,8 @@ tty_cmd_clearendofline(struct tty *tty, const struct tty_ctx *ctx)
 void
 tty_cmd_clearstartofline(struct tty *tty, const struct tty_ctx *ctx)
 {
+	tty_shadow_forget_pane(tty, ctx, ctx->ocy, 1);
+
 	tty_default_attributes(tty, &ctx->defaults, ctx->palette, ctx->bg);
 
 	tty_clear_pane_line(tty, ctx, ctx->ocy, 0, ctx->ocx + 1, ctx->bg);
@@ -1623,6 +2072,8 @@ tty_cmd_reverseindex(struct tty *tty, const struct tty_ctx *ctx)
 	if (ctx->ocy != ctx->orupper)
 		return;
 
+	tty_shadow_forget_pane(tty, ctx, 0, ctx->sy);
+
 	if (ctx->bigger ||
 	    (!tty_full_width(tty, ctx) && !tty_use_margin(tty)) ||
 	    tty_fake_bce(tty, &ctx->defaults, 8) ||
@@ -1653,6 +2104,8 @@ tty_cmd_linefeed(struct tty *tty, const struct tty_ctx *ctx)
 	if (ctx->ocy != ctx->orlower)
 		return;
 
+	tty_shadow_forget_pane(tty, ctx, 0, ctx->sy);
+
 	if (ctx->bigger ||
 	    (!tty_full_width(tty, ctx) && !tty_use_margin(tty)) ||
 	    tty_fake_bce(tty, &ctx->defaults, 8) ||
@@ -1691,6 +2144,8 @@ tty_cmd_scrollup(struct tty *tty, const struct tty_ctx *ctx)
 {
 	u_int	i;
 
+	tty_shadow_forget_pane(tty, ctx, 0, ctx->sy);
+
 	if (ctx->bigger ||
 	    (!tty_full_width(tty, ctx) && !tty_use_margin(tty)) ||
 	    tty_fake_bce(tty, &ctx->defaults, 8) ||
@@ -1727,6 +2182,8 @@ tty_cmd_scrolldown(struct tty *tty, const struct tty_ctx *ctx)
 {
 	u_int	i;
 
+	tty_shadow_forget_pane(tty, ctx, 0, ctx->sy);
+
 	if (ctx->bigger ||
 	    (!tty_full_width(tty, ctx) && !tty_use_margin(tty)) ||
 	    tty_fake_bce(tty, &ctx->defaults, 8) ||
@@ -1758,6 +2215,8 @@ tty_cmd_clearendofscreen(struct tty *tty, const struct tty_ctx *ctx)
 {
 	u_int	px, py, nx, ny;
 
+	tty_shadow_forget_pane(tty, ctx, 0, ctx->sy);
+
 	tty_default_attributes(tty, &ctx->defaults, ctx->palette, ctx->bg);
 
 	tty_region_pane(tty, ctx, 0, ctx->sy - 1);
@@ -1782,6 +2241,8 @@ tty_cmd_clearstartofscreen(struct tty *tty, const struct tty_ctx *ctx)
 {
 	u_int	px, py, nx, ny;
 
+	tty_shadow_forget_pane(tty, ctx, 0, ctx->sy);
+
 	tty_default_attributes(tty, &ctx->defaults, ctx->palette, ctx->bg);
 
 	tty_region_pane(tty, ctx, 0, ctx->sy - 1);
@@ -1806,6 +2267,8 @@ tty_cmd_clearscreen(struct tty *tty, const struct tty_ctx *ctx)
 {
 	u_int	px, py, nx, ny;
 
+	tty_shadow_forget_pane(tty, ctx, 0, ctx->sy);
+
 	tty_default_attributes(tty, &ctx->defaults, ctx->palette, ctx->bg);
 
 	tty_region_pane(tty, ctx, 0, ctx->sy - 1);
@@ -1824,6 +2287,8 @@ tty_cmd_alignmenttest(struct tty *tty, const struct tty_ctx *ctx)
 {
 	u_int	i, j;
 
+	tty_shadow_forget_pane(tty, ctx, 0, ctx->sy);
+
 	if (ctx->bigger) {
 		ctx->redraw_cb(ctx);
 		return;
@@ -1890,7 +2355,7 @@ tty_cmd_cells(struct tty *tty, const struct tty_ctx *ctx)
 void
 tty_cmd_setselection(struct tty *tty, const struct tty_ctx *ctx)
 {
-	tty_set_selection(tty, ctx->ptr, ctx->num);
+	tty_set_selection_encoded(tty, ctx->ptr);
 }
 
 void
@@ -1908,11 +2373,21 @@ tty_set_selection(struct tty *tty, const char *buf, size_t len)
 	encoded = xmalloc(size);
 
 	b64_ntop(buf, len, encoded, size);
-	tty_putcode_ptr2(tty, TTYC_MS, "", encoded);
+	tty_set_selection_encoded(tty, encoded);
 
 	free(encoded);
 }
 
+void
+tty_set_selection_encoded(struct tty *tty, const char *encoded)
+{
+	if (~tty->flags & TTY_STARTED)
+		return;
+	if (!tty_term_has(tty->term, TTYC_MS))
+		return;
+	tty_putcode_ptr2(tty, TTYC_MS, "", encoded);
+}
+
 void
 tty_cmd_rawstring(struct tty *tty, const struct tty_ctx *ctx)
 {
@@ -1983,6 +2458,8 @@ tty_invalidate(struct tty *tty)
 	tty->rupper = tty->rleft = UINT_MAX;
 	tty->rlower = tty->rright = UINT_MAX;
 
+	tty_invalidate_shadow(tty);
+
 	if (tty->flags & TTY_STARTED) {
 		if (tty_use_margin(tty))
 			tty_putcode(tty, TTYC_ENMG);
@@ -1998,6 +2475,257 @@ tty_invalidate(struct tty *tty)
 		tty->mode = MODE_CURSOR;
 }
 
+/*
+ * Forget the whole shadow because the terminal contents are no longer known.
+ * Each cell carries the generation it was drawn in, so this only has to bump
+ * the current generation.
+ */
+void
+tty_invalidate_shadow(struct tty *tty)
+{
+	if (++tty->shadow_generation != 0)
+		return;
+	if (tty->shadow != NULL) {
+		memset(tty->shadow, 0, (size_t)tty->shadow_sx * tty->shadow_sy *
+		    sizeof *tty->shadow);
+	}
+	tty->shadow_generation = 1;
+}
+
+/* Get a shadow cell, reallocating the shadow if the terminal size changed. */
+static struct tty_shadow_cell *
+tty_shadow_get(struct tty *tty, u_int px, u_int py)
+{
+	if (px >= tty->sx || py >= tty->sy)
+		return (NULL);
+	if (tty->shadow_sx != tty->sx || tty->shadow_sy != tty->sy) {
+		free(tty->shadow);
+		tty->shadow = xcalloc((size_t)tty->sx * tty->sy,
+		    sizeof *tty->shadow);
+		tty->shadow_sx = tty->sx;
+		tty->shadow_sy = tty->sy;
+	}
+	return (&tty->shadow[py * tty->shadow_sx + px]);
+}
+
+/* Forget part of a line in the shadow. */
+static void
+tty_shadow_forget(struct tty *tty, u_int px, u_int py, u_int nx)
+{
+	struct tty_shadow_cell	*tsc;
+	u_int			 i;
+
+	for (i = 0; i < nx; i++) {
+		if ((tsc = tty_shadow_get(tty, px + i, py)) == NULL)
+			break;
+		tsc->generation = 0;
+	}
+}
+
+/* Forget entire lines in the shadow. */
+static void
+tty_shadow_forget_lines(struct tty *tty, u_int py, u_int ny)
+{
+	u_int	i;
+
+	for (i = 0; i < ny; i++)
+		tty_shadow_forget(tty, 0, py + i, tty->sx);
+}
+
+/* Forget the terminal lines covered by lines of a pane. */
+static void
+tty_shadow_forget_pane(struct tty *tty, const struct tty_ctx *ctx, u_int py,
+    u_int ny)
+{
+	u_int	y = ctx->yoff + py, end = y + ny;
+
+	if (y < ctx->woy)
+		y = ctx->woy;
+	if (y < end)
+		tty_shadow_forget_lines(tty, y - ctx->woy, end - y);
+}
+
+/*
+ * Record a cell drawn on the terminal in the shadow. Returns 1 if the terminal
+ * was already showing exactly the same cell.
+ */
+static int
+tty_shadow_update(struct tty *tty, u_int px, u_int py,
+    const struct grid_cell *gc, const struct grid_cell *defaults,
+    int *palette)
+{
+	struct tty_shadow_cell	*tsc, new;
+	const struct utf8_data	*ud = &gc->data;
+	u_int			 i, width = ud->width;
+	int			 same = 1;
+
+	memset(&new, 0, sizeof new);
+	new.generation = tty->shadow_generation;
+	if (ud->size <= 3) {
+		new.data = ((utf8_char)ud->width << 28)|
+		    ((utf8_char)ud->size << 24)|
+		    ((utf8_char)ud->data[2] << 16)|
+		    ((utf8_char)ud->data[1] << 8)|
+		    ((utf8_char)ud->data[0]);
+	} else if (utf8_from_data(ud, &new.data) != UTF8_DONE) {
+		new.generation = 0;
+		same = 0;
+	}
+	new.attr = gc->attr;
+	new.flags = gc->flags;
+	new.width = width;
+	new.fg = gc->fg;
+	new.bg = gc->bg;
+	new.us = gc->us;
+	new.dfg = defaults->fg;
+	new.dbg = defaults->bg;
+	new.palette = palette;
+
+	if (width == 0)
+		width = 1;
+	for (i = 0; i < width; i++) {
+		if ((tsc = tty_shadow_get(tty, px + i, py)) == NULL)
+			return (0);
+		if (same && memcmp(tsc, &new, sizeof *tsc) != 0)
+			same = 0;
+		memcpy(tsc, &new, sizeof *tsc);
+		new.width = 0;
+	}
+	return (same);
+}
+
+/* Check if nothing is known about part of a line. */
+static int
+tty_shadow_empty(struct tty *tty, u_int px, u_int py, u_int nx)
+{
+	struct tty_shadow_cell	*tsc;
+	u_int			 i;
+
+	for (i = 0; i < nx; i++) {
+		if ((tsc = tty_shadow_get(tty, px + i, py)) == NULL)
+			break;
+		if (tsc->generation == tty->shadow_generation)
+			return (0);
+	}
+	return (1);
+}
+
+/* Add bytes to a terminal state hash. */
+static uint64_t
+tty_hash_add(uint64_t hash, const void *buf, size_t len)
+{
+	const u_char	*cp = buf;
+	size_t		 i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= cp[i];
+		hash *= 1099511628211ULL;
+	}
+	return (hash);
+}
+
+/* Add the attributes of a cell to a terminal state hash. */
+static uint64_t
+tty_hash_add_cell(uint64_t hash, const struct grid_cell *gc)
+{
+	hash = tty_hash_add(hash, &gc->flags, sizeof gc->flags);
+	hash = tty_hash_add(hash, &gc->attr, sizeof gc->attr);
+	hash = tty_hash_add(hash, &gc->fg, sizeof gc->fg);
+	hash = tty_hash_add(hash, &gc->bg, sizeof gc->bg);
+	return (tty_hash_add(hash, &gc->us, sizeof gc->us));
+}
+
+/*
+ * Hash the state of the terminal which affects what drawing writes to it: the
+ * cursor, attributes, modes, scroll region and what the shadow says is on the
+ * terminal. Terminals with the same hash get the same output for the same
+ * drawing.
+ */
+uint64_t
+tty_state_hash(struct tty *tty)
+{
+	struct client		*c = tty->client;
+	struct tty_shadow_cell	*tsc;
+	uint64_t		 hash = 14695981039346656037ULL;
+	size_t			 offset = offsetof(struct tty_shadow_cell, data);
+	u_int			 values[17], i, j;
+
+	values[0] = tty->sx;
+	values[1] = tty->sy;
+	values[2] = tty->cx;
+	values[3] = tty->cy;
+	values[4] = tty->cstyle;
+	values[5] = tty->oflag;
+	values[6] = tty->oox;
+	values[7] = tty->ooy;
+	values[8] = tty->osx;
+	values[9] = tty->osy;
+	values[10] = tty->mode;
+	values[11] = tty->rupper;
+	values[12] = tty->rlower;
+	values[13] = tty->rleft;
+	values[14] = tty->rright;
+	values[15] = tty->flags & (TTY_NOCURSOR|TTY_STARTED|TTY_SYNCING);
+	values[16] = !!(c->flags & CLIENT_UTF8);
+	hash = tty_hash_add(hash, values, sizeof values);
+	hash = tty_hash_add(hash, tty->ccolour, strlen(tty->ccolour) + 1);
+	hash = tty_hash_add_cell(hash, &tty->cell);
+	hash = tty_hash_add_cell(hash, &tty->last_cell);
+
+	for (j = 0; j < tty->sy; j++) {
+		for (i = 0; i < tty->sx; i++) {
+			tsc = tty_shadow_get(tty, i, j);
+			if (tsc->generation != tty->shadow_generation)
+				hash = tty_hash_add(hash, "", 1);
+			else {
+				hash = tty_hash_add(hash, (u_char *)tsc + offset,
+				    sizeof *tsc - offset);
+			}
+		}
+	}
+	return (hash);
+}
+
+/*
+ * Put a terminal into the state of another which was in the same state and
+ * has had the same output added.
+ */
+void
+tty_copy_state(struct tty *tty, struct tty *from)
+{
+	struct tty_shadow_cell	*tsc, *ftsc;
+	u_int			 i, j;
+
+	tty->cx = from->cx;
+	tty->cy = from->cy;
+	tty->cstyle = from->cstyle;
+	free(tty->ccolour);
+	tty->ccolour = xstrdup(from->ccolour);
+	tty->mode = from->mode;
+	tty->rupper = from->rupper;
+	tty->rlower = from->rlower;
+	tty->rleft = from->rleft;
+	tty->rright = from->rright;
+	memcpy(&tty->cell, &from->cell, sizeof tty->cell);
+	memcpy(&tty->last_cell, &from->last_cell, sizeof tty->last_cell);
+
+	tty->flags = (tty->flags & ~TTY_SYNCING)|(from->flags & TTY_SYNCING);
+	tty->sync_time = from->sync_time;
+
+	for (j = 0; j < tty->sy; j++) {
+		for (i = 0; i < tty->sx; i++) {
+			tsc = tty_shadow_get(tty, i, j);
+			ftsc = tty_shadow_get(from, i, j);
+			if (ftsc->generation != from->shadow_generation)
+				tsc->generation = 0;
+			else {
+				memcpy(tsc, ftsc, sizeof *tsc);
+				tsc->generation = tty->shadow_generation;
+			}
+		}
+	}
+}
+
 /* Turn off margin. */
 void
 tty_region_off(struct tty *tty)
@@ -2106,142 +2834,247 @@ tty_cursor_pane(struct tty *tty, const struct tty_ctx *ctx, u_int cx, u_int cy)
 	tty_cursor(tty, ctx->xoff + cx - ctx->wox, ctx->yoff + cy - ctx->woy);
 }
 
-/* Move cursor to absolute position. */
-void
-tty_cursor(struct tty *tty, u_int cx, u_int cy)
+/* Fill in a cursor movement step. */
+static void
+tty_cursor_set_step(struct tty_cursor_step *step, u_char ch,
+    enum tty_code_code code, int arg, u_int n)
 {
-	struct tty_term	*term = tty->term;
-	u_int		 thisx, thisy;
-	int		 change;
+	step->ch = ch;
+	step->code = code;
+	step->arg = arg;
+	step->n = n;
+}
 
-	if (tty->flags & TTY_BLOCK)
-		return;
+/* Number of bytes needed for a cursor movement step. */
+static u_int
+tty_cursor_step_cost(struct tty *tty, const struct tty_cursor_step *step)
+{
+	const char	*s;
 
-	if (cx > tty->sx - 1)
-		cx = tty->sx - 1;
+	if (step->ch != '\0')
+		return (step->n);
+	if (step->arg == -1)
+		s = tty_term_string(tty->term, step->code);
+	else
+		s = tty_term_string1(tty->term, step->code, step->arg);
+	return (strlen(s) * step->n);
+}
 
-	thisx = tty->cx;
-	thisy = tty->cy;
+/* Use a cursor movement if it is cheaper than the best so far. */
+static void
+tty_cursor_consider(struct tty *tty, struct tty_cursor_plan *best,
+    const struct tty_cursor_step *steps, u_int nsteps)
+{
+	u_int	i, cost = 0;
 
-	/* No change. */
-	if (cx == thisx && cy == thisy)
+	for (i = 0; i < nsteps; i++)
+		cost += tty_cursor_step_cost(tty, &steps[i]);
+	if (cost < best->cost) {
+		memcpy(best->steps, steps, nsteps * sizeof *steps);
+		best->nsteps = nsteps;
+		best->cost = cost;
+	}
+}
+
+/* Find the cheapest way to move the cursor along a line. */
+static void
+tty_cursor_column(struct tty *tty, u_int thisx, u_int cx,
+    struct tty_cursor_plan *best)
+{
+	struct tty_term		*term = tty->term;
+	struct tty_cursor_step	 steps[2];
+	u_int			 n;
+
+	best->nsteps = 0;
+	if (cx == thisx) {
+		best->cost = 0;
 		return;
+	}
+	best->cost = UINT_MAX;
 
-	/* Very end of the line, just use absolute movement. */
-	if (thisx > tty->sx - 1)
-		goto absolute;
+	if (tty_term_has(term, TTYC_HPA)) {
+		tty_cursor_set_step(&steps[0], '\0', TTYC_HPA, cx, 1);
+		tty_cursor_consider(tty, best, steps, 1);
+	}
 
-	/* Move to home position (0, 0). */
-	if (cx == 0 && cy == 0 && tty_term_has(term, TTYC_HOME)) {
-		tty_putcode(tty, TTYC_HOME);
-		goto out;
+	if (cx < thisx) {
+		n = thisx - cx;
+		if (tty_term_has(term, TTYC_CUB1)) {
+			tty_cursor_set_step(&steps[0], '\0', TTYC_CUB1, -1, n);
+			tty_cursor_consider(tty, best, steps, 1);
+		}
+		if (tty_term_has(term, TTYC_CUB) && !tty_use_margin(tty)) {
+			tty_cursor_set_step(&steps[0], '\0', TTYC_CUB, n, 1);
+			tty_cursor_consider(tty, best, steps, 1);
+		}
+	} else {
+		n = cx - thisx;
+		if (tty_term_has(term, TTYC_CUF1)) {
+			tty_cursor_set_step(&steps[0], '\0', TTYC_CUF1, -1, n);
+			tty_cursor_consider(tty, best, steps, 1);
+		}
+		if (tty_term_has(term, TTYC_CUF) && !tty_use_margin(tty)) {
+			tty_cursor_set_step(&steps[0], '\0', TTYC_CUF, n, 1);
+			tty_cursor_consider(tty, best, steps, 1);
+		}
 	}
 
-	/* Zero on the next line. */
-	if (cx == 0 && cy == thisy + 1 && thisy != tty->rlower &&
-	    (!tty_use_margin(tty) || tty->rleft == 0)) {
-		tty_putc(tty, '\r');
-		tty_putc(tty, '\n');
-		goto out;
+	/* Carriage return to the left edge, then move right if needed. */
+	if (cx > thisx || (tty_use_margin(tty) && tty->rleft != 0))
+		return;
+	tty_cursor_set_step(&steps[0], '\r', 0, -1, 1);
+	if (cx == 0) {
+		tty_cursor_consider(tty, best, steps, 1);
+		return;
+	}
+	if (tty_term_has(term, TTYC_CUF1)) {
+		tty_cursor_set_step(&steps[1], '\0', TTYC_CUF1, -1, cx);
+		tty_cursor_consider(tty, best, steps, 2);
+	}
+	if (tty_term_has(term, TTYC_CUF) && !tty_use_margin(tty)) {
+		tty_cursor_set_step(&steps[1], '\0', TTYC_CUF, cx, 1);
+		tty_cursor_consider(tty, best, steps, 2);
 	}
+}
 
-	/* Moving column or row. */
+/* Find the cheapest way to move the cursor up or down a column. */
+static void
+tty_cursor_row(struct tty *tty, u_int thisx, u_int thisy, u_int cy,
+    struct tty_cursor_plan *best)
+{
+	struct tty_term		*term = tty->term;
+	struct tty_cursor_step	 steps[1];
+	u_int			 n;
+
+	best->nsteps = 0;
 	if (cy == thisy) {
-		/*
-		 * Moving column only, row staying the same.
-		 */
+		best->cost = 0;
+		return;
+	}
+	best->cost = UINT_MAX;
 
-		/* To left edge. */
-		if (cx == 0 && (!tty_use_margin(tty) || tty->rleft == 0)) {
-			tty_putc(tty, '\r');
-			goto out;
-		}
+	if (tty_term_has(term, TTYC_VPA)) {
+		tty_cursor_set_step(&steps[0], '\0', TTYC_VPA, cy, 1);
+		tty_cursor_consider(tty, best, steps, 1);
+	}
 
-		/* One to the left. */
-		if (cx == thisx - 1 && tty_term_has(term, TTYC_CUB1)) {
-			tty_putcode(tty, TTYC_CUB1);
-			goto out;
+	/* Relative movement stops at the scroll region, so cannot cross it. */
+	if (cy < thisy) {
+		if (thisy >= tty->rupper && cy < tty->rupper)
+			return;
+		n = thisy - cy;
+		if (tty_term_has(term, TTYC_CUU1)) {
+			tty_cursor_set_step(&steps[0], '\0', TTYC_CUU1, -1, n);
+			tty_cursor_consider(tty, best, steps, 1);
 		}
-
-		/* One to the right. */
-		if (cx == thisx + 1 && tty_term_has(term, TTYC_CUF1)) {
-			tty_putcode(tty, TTYC_CUF1);
-			goto out;
+		if (tty_term_has(term, TTYC_CUU)) {
+			tty_cursor_set_step(&steps[0], '\0', TTYC_CUU, n, 1);
+			tty_cursor_consider(tty, best, steps, 1);
+		}
+	} else {
+		if (thisy <= tty->rlower && cy > tty->rlower)
+			return;
+		n = cy - thisy;
+		if (tty_term_has(term, TTYC_CUD1)) {
+			tty_cursor_set_step(&steps[0], '\0', TTYC_CUD1, -1, n);
+			tty_cursor_consider(tty, best, steps, 1);
+		}
+		if (tty_term_has(term, TTYC_CUD)) {
+			tty_cursor_set_step(&steps[0], '\0', TTYC_CUD, n, 1);
+			tty_cursor_consider(tty, best, steps, 1);
+		}
+		if (thisx == 0 && (!tty_use_margin(tty) || tty->rleft == 0)) {
+			tty_cursor_set_step(&steps[0], '\n', 0, -1, n);
+			tty_cursor_consider(tty, best, steps, 1);
 		}
+	}
+}
 
-		/* Calculate difference. */
-		change = thisx - cx;	/* +ve left, -ve right */
+/* Combine a row and a column movement if cheaper than the best so far. */
+static void
+tty_cursor_combine(struct tty_cursor_plan *best,
+    const struct tty_cursor_plan *first, const struct tty_cursor_plan *second)
+{
+	if (first->cost == UINT_MAX || second->cost == UINT_MAX)
+		return;
+	if (first->cost + second->cost >= best->cost)
+		return;
+	memcpy(best->steps, first->steps, first->nsteps * sizeof *best->steps);
+	memcpy(best->steps + first->nsteps, second->steps,
+	    second->nsteps * sizeof *best->steps);
+	best->nsteps = first->nsteps + second->nsteps;
+	best->cost = first->cost + second->cost;
+}
 
-		/*
-		 * Use HPA if change is larger than absolute, otherwise move
-		 * the cursor with CUB/CUF.
-		 */
-		if ((u_int) abs(change) > cx && tty_term_has(term, TTYC_HPA)) {
-			tty_putcode1(tty, TTYC_HPA, cx);
-			goto out;
-		} else if (change > 0 &&
-		    tty_term_has(term, TTYC_CUB) &&
-		    !tty_use_margin(tty)) {
-			if (change == 2 && tty_term_has(term, TTYC_CUB1)) {
-				tty_putcode(tty, TTYC_CUB1);
-				tty_putcode(tty, TTYC_CUB1);
-				goto out;
-			}
-			tty_putcode1(tty, TTYC_CUB, change);
-			goto out;
-		} else if (change < 0 &&
-		    tty_term_has(term, TTYC_CUF) &&
-		    !tty_use_margin(tty)) {
-			tty_putcode1(tty, TTYC_CUF, -change);
-			goto out;
-		}
-	} else if (cx == thisx) {
-		/*
-		 * Moving row only, column staying the same.
-		 */
+/*
+ * Work out the cheapest way to move the cursor from one position to another,
+ * using the lengths of the sequences in the terminal description. Absolute
+ * movement is always possible if the position is not known.
+ */
+static void
+tty_cursor_plan(struct tty *tty, u_int thisx, u_int thisy, u_int cx, u_int cy,
+    struct tty_cursor_plan *best)
+{
+	struct tty_cursor_plan	col, row;
+	struct tty_cursor_step	steps[1];
 
-		/* One above. */
-		if (thisy != tty->rupper &&
-		    cy == thisy - 1 && tty_term_has(term, TTYC_CUU1)) {
-			tty_putcode(tty, TTYC_CUU1);
-			goto out;
-		}
+	tty_cursor_set_step(&best->steps[0], '\0', TTYC_CUP, -1, 1);
+	best->nsteps = 1;
+	best->cost = strlen(tty_term_string2(tty->term, TTYC_CUP, cy, cx));
 
-		/* One below. */
-		if (thisy != tty->rlower &&
-		    cy == thisy + 1 && tty_term_has(term, TTYC_CUD1)) {
-			tty_putcode(tty, TTYC_CUD1);
-			goto out;
-		}
+	/* Very end of the line or unknown, just use absolute movement. */
+	if (thisx > tty->sx - 1 || thisy > tty->sy - 1)
+		return;
 
-		/* Calculate difference. */
-		change = thisy - cy;	/* +ve up, -ve down */
+	/* Move to home position (0, 0). */
+	if (cx == 0 && cy == 0 && tty_term_has(tty->term, TTYC_HOME)) {
+		tty_cursor_set_step(&steps[0], '\0', TTYC_HOME, -1, 1);
+		tty_cursor_consider(tty, best, steps, 1);
+	}
 
-		/*
-		 * Try to use VPA if change is larger than absolute or if this
-		 * change would cross the scroll region, otherwise use CUU/CUD.
-		 */
-		if ((u_int) abs(change) > cy ||
-		    (change < 0 && cy - change > tty->rlower) ||
-		    (change > 0 && cy - change < tty->rupper)) {
-			    if (tty_term_has(term, TTYC_VPA)) {
-				    tty_putcode1(tty, TTYC_VPA, cy);
-				    goto out;
-			    }
-		} else if (change > 0 && tty_term_has(term, TTYC_CUU)) {
-			tty_putcode1(tty, TTYC_CUU, change);
-			goto out;
-		} else if (change < 0 && tty_term_has(term, TTYC_CUD)) {
-			tty_putcode1(tty, TTYC_CUD, -change);
-			goto out;
+	/* Along the line and then up or down. */
+	tty_cursor_column(tty, thisx, cx, &col);
+	tty_cursor_row(tty, cx, thisy, cy, &row);
+	tty_cursor_combine(best, &col, &row);
+
+	/* Up or down and then along the line. */
+	tty_cursor_row(tty, thisx, thisy, cy, &row);
+	tty_cursor_combine(best, &row, &col);
+}
+
+/* Move cursor to absolute position. */
+void
+tty_cursor(struct tty *tty, u_int cx, u_int cy)
+{
+	struct tty_cursor_plan		 plan;
+	const struct tty_cursor_step	*step;
+	u_int				 i, j;
+
+	if (tty->flags & TTY_BLOCK)
+		return;
+
+	if (cx > tty->sx - 1)
+		cx = tty->sx - 1;
+
+	/* No change. */
+	if (cx == tty->cx && cy == tty->cy)
+		return;
+
+	tty_cursor_plan(tty, tty->cx, tty->cy, cx, cy, &plan);
+	for (i = 0; i < plan.nsteps; i++) {
+		step = &plan.steps[i];
+		for (j = 0; j < step->n; j++) {
+			if (step->ch != '\0')
+				tty_putc(tty, step->ch);
+			else if (step->code == TTYC_CUP)
+				tty_putcode2(tty, TTYC_CUP, cy, cx);
+			else if (step->arg == -1)
+				tty_putcode(tty, step->code);
+			else
+				tty_putcode1(tty, step->code, step->arg);
 		}
 	}
 
-absolute:
-	/* Absolute movement. */
-	tty_putcode2(tty, TTYC_CUP, cy, cx);
-
-out:
 	tty->cx = cx;
 	tty->cy = cy;
 }
@@ -163,7 +163,7 @@ window_buffer_build(void *modedata, struct mode_tree_sort_criteria *sort_crit,
 	struct window_buffer_itemdata	*item;
 	u_int				 i;
 	struct paste_buffer		*pb;
-	char				*text, *cp;
+	char				*cp;
 	struct format_tree		*ft;
 	struct session			*s = NULL;
 	struct winlink			*wl = NULL;
@@ -179,7 +179,7 @@ window_buffer_build(void *modedata, struct mode_tree_sort_criteria *sort_crit,
 	while ((pb = paste_walk(pb)) != NULL) {
 		item = window_buffer_add_item(data);
 		item->name = xstrdup(paste_buffer_name(pb));
-		paste_buffer_data(pb, &item->size);
+		item->size = paste_buffer_size(pb);
 		item->order = paste_buffer_order(pb);
 	}
 
@@ -199,26 +199,22 @@ window_buffer_build(void *modedata, struct mode_tree_sort_criteria *sort_crit,
 		pb = paste_get_name(item->name);
 		if (pb == NULL)
 			continue;
-		ft = format_create(NULL, NULL, FORMAT_NONE, 0);
-		format_defaults(ft, NULL, s, wl, wp);
-		format_defaults_paste_buffer(ft, pb);
 
 		if (filter != NULL) {
+			ft = format_create(NULL, NULL, FORMAT_NONE, 0);
+			format_defaults(ft, NULL, s, wl, wp);
+			format_defaults_paste_buffer(ft, pb);
 			cp = format_expand(ft, filter);
+			format_free(ft);
 			if (!format_true(cp)) {
 				free(cp);
-				format_free(ft);
 				continue;
 			}
 			free(cp);
 		}
 
-		text = format_expand(ft, data->format);
 		mode_tree_add(data->data, NULL, item, item->order, item->name,
-		    text, -1);
-		free(text);
-
-		format_free(ft);
+		    NULL, -1);
 	}
 
 }
@@ -229,34 +225,21 @@ window_buffer_draw(__unused void *modedata, void *itemdata,
 {
 	struct window_buffer_itemdata	*item = itemdata;
 	struct paste_buffer		*pb;
-	const char			*pdata, *start, *end;
-	char				*buf = NULL;
-	size_t				 psize;
-	u_int				 i, cx = ctx->s->cx, cy = ctx->s->cy;
+	char				**lines;
+	u_int				  i, n, cx = ctx->s->cx, cy = ctx->s->cy;
 
 	pb = paste_get_name(item->name);
 	if (pb == NULL)
 		return;
 
-	pdata = end = paste_buffer_data(pb, &psize);
-	for (i = 0; i < sy; i++) {
-		start = end;
-		while (end != pdata + psize && *end != '\n')
-			end++;
-		buf = xreallocarray(buf, 4, end - start + 1);
-		utf8_strvis(buf, start, end - start,
-		    VIS_OCTAL|VIS_CSTYLE|VIS_TAB);
-		if (*buf != '\0') {
+	lines = paste_buffer_preview(pb, &n);
+	for (i = 0; i < sy && i < n; i++) {
+		if (*lines[i] != '\0') {
 			screen_write_cursormove(ctx, cx, cy + i, 0);
 			screen_write_nputs(ctx, sx, &grid_default_cell, "%s",
-			    buf);
+			    lines[i]);
 		}
-
-		if (end == pdata + psize)
-			break;
-		end++;
 	}
-	free(buf);
 }
 
 static int
@@ -288,6 +271,35 @@ window_buffer_menu(void *modedata, struct client *c, key_code key)
 	window_buffer_key(wme, c, NULL, NULL, key, NULL);
 }
 
+static char *
+window_buffer_get_text(void *modedata, void *itemdata)
+{
+	struct window_buffer_modedata	*data = modedata;
+	struct window_buffer_itemdata	*item = itemdata;
+	struct format_tree		*ft;
+	struct session			*s = NULL;
+	struct winlink			*wl = NULL;
+	struct window_pane		*wp = NULL;
+	struct paste_buffer		*pb;
+	char				*text;
+
+	if (cmd_find_valid_state(&data->fs)) {
+		s = data->fs.s;
+		wl = data->fs.wl;
+		wp = data->fs.wp;
+	}
+	pb = paste_get_name(item->name);
+	if (pb == NULL)
+		return (NULL);
+
+	ft = format_create(NULL, NULL, FORMAT_NONE, 0);
+	format_defaults(ft, NULL, s, wl, wp);
+	format_defaults_paste_buffer(ft, pb);
+	text = format_expand(ft, data->format);
+	format_free(ft);
+	return (text);
+}
+
 static key_code
 window_buffer_get_key(void *modedata, void *itemdata, u_int line)
 {
@@ -350,7 +362,8 @@ window_buffer_init(struct window_mode_entry *wme, struct cmd_find_state *fs,
 
 	data->data = mode_tree_start(wp, args, window_buffer_build,
 	    window_buffer_draw, window_buffer_search, window_buffer_menu, NULL,
-	    window_buffer_get_key, data, window_buffer_menu_items,
+	    window_buffer_get_key, window_buffer_get_text, data,
+	    window_buffer_menu_items,
 	    window_buffer_sort_list, nitems(window_buffer_sort_list), &s);
 	mode_tree_zoom(data->data, args);
 
@@ -27,6 +27,7 @@
 #include "tmux.h"
 
 struct window_copy_mode_data;
+struct window_copy_search_text;
 
 static const char *window_copy_key_table(struct window_mode_entry *);
 static void	window_copy_command(struct window_mode_entry *, struct client *,
@@ -55,27 +56,31 @@ static void	window_copy_write_lines(struct window_mode_entry *,
 static char    *window_copy_match_at_cursor(struct window_copy_mode_data *);
 static void	window_copy_scroll_to(struct window_mode_entry *, u_int, u_int,
 		    int);
-static int	window_copy_search_compare(struct grid *, u_int, u_int,
-		    struct grid *, u_int, int);
-static int	window_copy_search_lr(struct grid *, struct grid *, u_int *,
-		    u_int, u_int, u_int, int);
-static int	window_copy_search_rl(struct grid *, struct grid *, u_int *,
-		    u_int, u_int, u_int, int);
-static int	window_copy_last_regex(struct grid *, u_int, u_int, u_int,
-		    u_int, u_int *, u_int *, const char *, const regex_t *,
-		    int);
+static void	window_copy_search_text_init(struct window_copy_search_text *,
+		    struct grid *, struct grid *, int);
+static void	window_copy_search_text_free(struct window_copy_search_text *);
+static int	window_copy_search_lr(struct window_copy_search_text *,
+		    u_int *, u_int, u_int, u_int);
+static int	window_copy_search_rl(struct window_copy_search_text *,
+		    u_int *, u_int, u_int, u_int);
+static int	window_copy_last_regex(struct window_copy_search_text *,
+		    u_int, u_int, u_int, u_int *, u_int *, size_t,
+		    const regex_t *, int);
 static int	window_copy_search_mark_at(struct window_copy_mode_data *,
 		    u_int, u_int, u_int *);
 static char    *window_copy_stringify(struct grid *, u_int, u_int, u_int,
 		    char *, u_int *);
-static void	window_copy_cstrtocellpos(struct grid *, u_int, u_int *,
-		    u_int *, const char *);
 static int	window_copy_search_marks(struct window_mode_entry *,
 		    struct screen *, int, int);
 static void	window_copy_clear_marks(struct window_mode_entry *);
+static void	window_copy_search_count_timer(int, short, void *);
+static void	window_copy_search_count_start(struct window_mode_entry *,
+		    int);
+static void	window_copy_search_count_stop(struct window_copy_mode_data *);
 static int	window_copy_is_lowercase(const char *);
-static void	window_copy_search_back_overlap(struct grid *, regex_t *,
-		    u_int *, u_int *, u_int *, u_int);
+static void	window_copy_search_back_overlap(
+		    struct window_copy_search_text *, const regex_t *, u_int *,
+		    u_int *, u_int *, u_int);
 static int	window_copy_search_jump(struct window_mode_entry *,
 		    struct grid *, struct grid *, u_int, u_int, u_int, int, int,
 		    int, int);
@@ -103,7 +108,7 @@ static void	window_copy_copy_selection(struct window_mode_entry *,
 		    const char *);
 static void	window_copy_append_selection(struct window_mode_entry *);
 static void	window_copy_clear_selection(struct window_mode_entry *);
-static void	window_copy_copy_line(struct window_mode_entry *, char **,
+static void	window_copy_copy_line(struct window_mode_entry *, char *,
 		    size_t *, u_int, u_int, u_int);
 static int	window_copy_in_set(struct window_mode_entry *, u_int, u_int,
 		    const char *);
@@ -203,6 +208,45 @@ struct window_copy_cmd_state {
 	struct winlink			*wl;
 };
 
+/*
+ * A search flattens the line being searched and any lines it wraps onto into
+ * UTF-8 text, with the cell each byte came from. A plain search uses memmem
+ * on it rather than comparing each cell in turn and a regular expression
+ * search passes it to regexec. The text for the last line is kept until the
+ * search moves to a line outside it, so searching the same line again or the
+ * other lines it wraps onto does not convert it again.
+ */
+struct window_copy_search_text {
+	struct grid	*gd;
+	int		 cis;
+
+	char		*needle;
+	size_t		 nlen;
+
+	u_int		 py;
+	u_int		 lines;
+	char		*text;
+	u_int		*cells;
+	size_t		 len;
+	size_t		 size;
+};
+
+/*
+ * Matches outside the visible lines are counted in the background, a slice at
+ * a time from a timer, so a search of a large history does not stop the
+ * server. The count is shown as it goes and stops if the marks are cleared.
+ */
+struct window_copy_search_count {
+	struct screen			 ss;
+	int				 regex;
+	const regex_t			*reg;
+	struct grid_index_query		*q;
+	struct window_copy_search_text	 st;
+
+	u_int				 py;
+	u_int				 nfound;
+};
+
 /*
  * Copy mode's visible screen (the "screen" field) is filled from one of two
  * sources: the original contents of the pane (used when we actually enter via
@@ -280,8 +324,12 @@ struct window_copy_mode_data {
 	int		 searchregex;
 	char		*searchstr;
 	u_char		*searchmark;
+	u_int		 searchmarkpy;	/* first line in searchmark */
+	u_int		 searchmarkny;
 	int		 searchcount;
 	int		 searchmore;
+	struct window_copy_search_count *searchcounter;
+	struct event	 searchtimer;
 	int		 searchall;
 	int		 searchx;
 	int		 searchy;
@@ -290,7 +338,7 @@ struct window_copy_mode_data {
 
 	int		 timeout;	/* search has timed out */
 #define WINDOW_COPY_SEARCH_TIMEOUT 10000
-#define WINDOW_COPY_SEARCH_ALL_TIMEOUT 200
+#define WINDOW_COPY_SEARCH_COUNT_TIME 10
 
 	int			 jumptype;
 	struct utf8_data	*jumpchar;
@@ -334,6 +382,7 @@ window_copy_clone_screen(struct screen *src, struct screen *hint, u_int *cx,
 
 	dst = xcalloc(1, sizeof *dst);
 
+	grid_reflow_pending(src->grid, 1);
 	sy = screen_hsize(src) + screen_size_y(src);
 	if (trim) {
 		while (sy > screen_hsize(src)) {
@@ -346,14 +395,15 @@ window_copy_clone_screen(struct screen *src, struct screen *hint, u_int *cx,
 	log_debug("%s: target screen is %ux%u, source %ux%u", __func__,
 	    screen_size_x(src), sy, screen_size_x(hint),
 	    screen_hsize(src) + screen_size_y(src));
-	screen_init(dst, screen_size_x(src), sy, screen_hlimit(src));
+	screen_init(dst, screen_size_x(src), screen_size_y(src),
+	    screen_hlimit(src));
 
 	/*
 	 * Ensure history is on for the backing grid so lines are not deleted
 	 * during resizing.
 	 */
 	dst->grid->flags |= GRID_HISTORY;
-	grid_duplicate_lines(dst->grid, 0, src->grid, 0, sy);
+	grid_snapshot(dst->grid, src->grid, 0, sy);
 
 	dst->grid->sy = sy - screen_hsize(src);
 	dst->grid->hsize = screen_hsize(src);
@@ -415,6 +465,7 @@ window_copy_common_init(struct window_mode_entry *wme)
 	data->modekeys = options_get_number(wp->window->options, "mode-keys");
 
 	evtimer_set(&data->dragtimer, window_copy_scroll_timer, wme);
+	evtimer_set(&data->searchtimer, window_copy_search_count_timer, wme);
 
 	return (data);
 }
@@ -487,6 +538,7 @@ window_copy_free(struct window_mode_entry *wme)
 	struct window_copy_mode_data	*data = wme->data;
 
 	evtimer_del(&data->dragtimer);
+	window_copy_search_count_stop(data);
 
 	free(data->searchmark);
 	free(data->searchstr);
@@ -520,6 +572,7 @@ window_copy_vadd(struct window_pane *wp, const char *fmt, va_list ap)
 	u_int				 old_hsize, old_cy;
 
 	memcpy(&gc, &grid_default_cell, sizeof gc);
+	window_copy_search_count_stop(data);
 
 	old_hsize = screen_hsize(data->backing);
 	screen_write_start(&back_ctx, backing);
@@ -1294,6 +1347,7 @@ window_copy_cmd_previous_matching_bracket(struct window_copy_cmd_state *cs)
 	char				 tried, found, start, *cp;
 	u_int				 px, py, xx, n;
 	struct grid_cell		 gc;
+	struct grid_char		 gch;
 	int				 failed;
 
 	for (; np != 0; np--) {
@@ -1351,12 +1405,11 @@ window_copy_cmd_previous_matching_bracket(struct window_copy_cmd_state *cs)
 			} else
 				px--;
 
-			grid_get_cell(s->grid, px, py, &gc);
-			if (gc.data.size == 1 &&
-			    (~gc.flags & GRID_FLAG_PADDING)) {
-				if (*gc.data.data == found)
+			grid_get_char(s->grid, px, py, &gch);
+			if (~gch.flags & GRID_FLAG_PADDING) {
+				if (gch.data == utf8_build_one(found))
 					n++;
-				else if (*gc.data.data == start)
+				else if (gch.data == utf8_build_one(start))
 					n--;
 			}
 		} while (n != 0);
@@ -1380,6 +1433,7 @@ window_copy_cmd_next_matching_bracket(struct window_copy_cmd_state *cs)
 	char				 tried, found, end, *cp;
 	u_int				 px, py, xx, yy, sx, sy, n;
 	struct grid_cell		 gc;
+	struct grid_char		 gch;
 	int				 failed;
 	struct grid_line		*gl;
 
@@ -1473,12 +1527,11 @@ window_copy_cmd_next_matching_bracket(struct window_copy_cmd_state *cs)
 			} else
 				px++;
 
-			grid_get_cell(s->grid, px, py, &gc);
-			if (gc.data.size == 1 &&
-			    (~gc.flags & GRID_FLAG_PADDING)) {
-				if (*gc.data.data == found)
+			grid_get_char(s->grid, px, py, &gch);
+			if (~gch.flags & GRID_FLAG_PADDING) {
+				if (gch.data == utf8_build_one(found))
 					n++;
-				else if (*gc.data.data == end)
+				else if (gch.data == utf8_build_one(end))
 					n--;
 			}
 		} while (n != 0);
@@ -2231,6 +2284,7 @@ window_copy_cmd_refresh_from_pane(struct window_copy_cmd_state *cs)
 	if (data->viewmode)
 		return (WINDOW_COPY_CMD_NOTHING);
 
+	window_copy_search_count_stop(data);
 	screen_free(data->backing);
 	free(data->backing);
 	data->backing = window_copy_clone_screen(&wp->base, &data->screen, NULL,
@@ -2423,16 +2477,32 @@ window_copy_command(struct window_mode_entry *wme, struct client *c,
 	cs.s = s;
 	cs.wl = wl;
 
-	action = WINDOW_COPY_CMD_NOTHING;
-	for (i = 0; i < nitems(window_copy_cmd_table); i++) {
-		if (strcmp(window_copy_cmd_table[i].command, command) == 0) {
-			if (args->argc - 1 < window_copy_cmd_table[i].minargs ||
-			    args->argc - 1 > window_copy_cmd_table[i].maxargs)
+	/*
+	 * The arguments of a key binding are kept, so remember which command
+	 * was found in them (plus one) to avoid searching the table again each
+	 * time the key is pressed.
+	 */
+	i = args->lookup;
+	if (i == 0 ||
+	    i > nitems(window_copy_cmd_table) ||
+	    strcmp(window_copy_cmd_table[i - 1].command, command) != 0) {
+		for (i = 0; i < nitems(window_copy_cmd_table); i++) {
+			if (strcmp(window_copy_cmd_table[i].command,
+			    command) == 0)
 				break;
-			clear = window_copy_cmd_table[i].clear;
-			action = window_copy_cmd_table[i].f (&cs);
-			break;
 		}
+		if (i != nitems(window_copy_cmd_table))
+			args->lookup = ++i;
+		else
+			i = 0;
+	}
+
+	action = WINDOW_COPY_CMD_NOTHING;
+	if (i != 0 &&
+	    args->argc - 1 >= window_copy_cmd_table[i - 1].minargs &&
+	    args->argc - 1 <= window_copy_cmd_table[i - 1].maxargs) {
+		clear = window_copy_cmd_table[i - 1].clear;
+		action = window_copy_cmd_table[i - 1].f (&cs);
 	}
 
 	if (strncmp(command, "search-", 7) != 0 && data->searchmark != NULL) {
@@ -2489,110 +2559,218 @@ window_copy_scroll_to(struct window_mode_entry *wme, u_int px, u_int py,
 		window_copy_redraw_screen(wme);
 }
 
-static int
-window_copy_search_compare(struct grid *gd, u_int px, u_int py,
-    struct grid *sgd, u_int spx, int cis)
+/* Add the text of a grid line to the search text. */
+static void
+window_copy_search_text_add(struct window_copy_search_text *st,
+    struct grid *gd, u_int py, int fold)
 {
-	struct grid_cell	 gc, sgc;
-	const struct utf8_data	*ud, *sud;
+	const struct grid_line		*gl = grid_peek_line(gd, py);
+	const struct grid_cell_entry	*gce;
+	struct utf8_data		 ud;
+	u_int				 px, cell;
+	const u_char			*data;
+	size_t				 size;
+
+	if (st->size < st->len + gd->sx * UTF8_SIZE + 1) {
+		st->size = st->len + gd->sx * UTF8_SIZE + 1;
+		st->text = xrealloc(st->text, st->size);
+		st->cells = xreallocarray(st->cells, st->size,
+		    sizeof *st->cells);
+	}
+
+	cell = st->lines * gd->sx;
+	for (px = 0; px < gd->sx; px++, cell++) {
+		if (px >= gl->cellsize) {
+			data = (const u_char *)" ";
+			size = 1;
+		} else {
+			gce = &gl->celldata[px];
+			if (gce->flags & GRID_FLAG_PADDING)
+				continue;
+			if (~gce->flags & GRID_FLAG_EXTENDED) {
+				data = &gce->data.data;
+				size = 1;
+			} else {
+				utf8_to_data(gl->extddata[gce->offset].data,
+				    &ud);
+				data = ud.data;
+				size = ud.size;
+			}
+		}
+		if (size == 1 && fold)
+			st->text[st->len] = tolower(*data);
+		else
+			memcpy(st->text + st->len, data, size);
+		while (size-- != 0)
+			st->cells[st->len++] = cell;
+	}
+	st->lines++;
+}
 
-	grid_get_cell(gd, px, py, &gc);
-	ud = &gc.data;
-	grid_get_cell(sgd, spx, 0, &sgc);
-	sud = &sgc.data;
+/* Set up search text for searching grid for the first line of sgd. */
+static void
+window_copy_search_text_init(struct window_copy_search_text *st,
+    struct grid *gd, struct grid *sgd, int cis)
+{
+	memset(st, 0, sizeof *st);
 
-	if (ud->size != sud->size || ud->width != sud->width)
-		return (0);
+	window_copy_search_text_add(st, sgd, 0, 0);
+	st->needle = st->text;
+	st->nlen = st->len;
+	free(st->cells);
 
-	if (cis && ud->size == 1)
-		return (tolower(ud->data[0]) == sud->data[0]);
+	st->gd = gd;
+	st->cis = cis;
+	st->text = NULL;
+	st->cells = NULL;
+	st->len = st->size = st->lines = 0;
+}
 
-	return (memcmp(ud->data, sud->data, ud->size) == 0);
+/* Free search text. */
+static void
+window_copy_search_text_free(struct window_copy_search_text *st)
+{
+	free(st->needle);
+	free(st->text);
+	free(st->cells);
+}
+
+/*
+ * Make sure the search text holds the line containing py and return the cell
+ * where py starts.
+ */
+static u_int
+window_copy_search_text_line(struct window_copy_search_text *st, u_int py)
+{
+	struct grid		*gd = st->gd;
+	const struct grid_line	*gl;
+	u_int			 endline = gd->hsize + gd->sy - 1;
+
+	if (st->lines != 0 && py >= st->py && py < st->py + st->lines)
+		return ((py - st->py) * gd->sx);
+
+	st->py = py;
+	while (st->py > 0) {
+		gl = grid_peek_line_packed(gd, st->py - 1);
+		if (~gl->flags & GRID_LINE_WRAPPED)
+			break;
+		st->py--;
+	}
+	st->len = 0;
+	st->lines = 0;
+	for (;;) {
+		window_copy_search_text_add(st, gd, st->py + st->lines,
+		    st->cis);
+		if (st->py + st->lines > endline)
+			break;
+		gl = grid_peek_line_packed(gd, st->py + st->lines - 1);
+		if (~gl->flags & GRID_LINE_WRAPPED)
+			break;
+	}
+	st->text[st->len] = '\0';
+	return ((py - st->py) * gd->sx);
+}
+
+/* Get the cell for a byte in the search text. */
+static u_int
+window_copy_search_text_cell(struct window_copy_search_text *st, size_t b)
+{
+	if (b >= st->len)
+		return (st->lines * st->gd->sx);
+	return (st->cells[b]);
 }
 
+/*
+ * Find the next match in the search text at or after byte b and starting
+ * before cell end. A match must start and end on a cell boundary.
+ */
 static int
-window_copy_search_lr(struct grid *gd, struct grid *sgd, u_int *ppx, u_int py,
-    u_int first, u_int last, int cis)
+window_copy_search_text_next(struct window_copy_search_text *st, size_t *b,
+    u_int end)
 {
-	u_int			 ax, bx, px, pywrap, endline;
-	int			 matched;
-	struct grid_line	*gl;
+	const char	*found;
+	size_t		 e, at = *b;
 
-	endline = gd->hsize + gd->sy - 1;
-	for (ax = first; ax < last; ax++) {
-		for (bx = 0; bx < sgd->sx; bx++) {
-			px = ax + bx;
-			pywrap = py;
-			/* Wrap line. */
-			while (px >= gd->sx && pywrap < endline) {
-				gl = grid_get_line(gd, pywrap);
-				if (~gl->flags & GRID_LINE_WRAPPED)
-					break;
-				px -= gd->sx;
-				pywrap++;
-			}
-			/* We have run off the end of the grid. */
-			if (px >= gd->sx)
-				break;
-			matched = window_copy_search_compare(gd, px, pywrap,
-			    sgd, bx, cis);
-			if (!matched)
-				break;
-		}
-		if (bx == sgd->sx) {
-			*ppx = ax;
+	while (at + st->nlen <= st->len) {
+		found = memmem(st->text + at, st->len - at, st->needle,
+		    st->nlen);
+		if (found == NULL)
+			break;
+		at = found - st->text;
+		if (st->cells[at] >= end)
+			break;
+		e = at + st->nlen;
+		if ((at == 0 || st->cells[at - 1] != st->cells[at]) &&
+		    (e == st->len || st->cells[e] != st->cells[e - 1])) {
+			*b = at;
 			return (1);
 		}
+		at++;
 	}
 	return (0);
 }
 
+/* Find the first byte in the search text from cell or after. */
+static size_t
+window_copy_search_text_find(struct window_copy_search_text *st, u_int cell)
+{
+	size_t	lo = 0, hi = st->len, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (st->cells[mid] < cell)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo);
+}
+
 static int
-window_copy_search_rl(struct grid *gd,
-    struct grid *sgd, u_int *ppx, u_int py, u_int first, u_int last, int cis)
-{
-	u_int			 ax, bx, px, pywrap, endline;
-	int			 matched;
-	struct grid_line	*gl;
-
-	endline = gd->hsize + gd->sy - 1;
-	for (ax = last; ax > first; ax--) {
-		for (bx = 0; bx < sgd->sx; bx++) {
-			px = ax - 1 + bx;
-			pywrap = py;
-			/* Wrap line. */
-			while (px >= gd->sx && pywrap < endline) {
-				gl = grid_get_line(gd, pywrap);
-				if (~gl->flags & GRID_LINE_WRAPPED)
-					break;
-				px -= gd->sx;
-				pywrap++;
-			}
-			/* We have run off the end of the grid. */
-			if (px >= gd->sx)
-				break;
-			matched = window_copy_search_compare(gd, px, pywrap,
-			    sgd, bx, cis);
-			if (!matched)
-				break;
-		}
-		if (bx == sgd->sx) {
-			*ppx = ax - 1;
-			return (1);
-		}
+window_copy_search_lr(struct window_copy_search_text *st, u_int *ppx,
+    u_int py, u_int first, u_int last)
+{
+	u_int	off;
+	size_t	b;
+
+	if (st->nlen == 0 || first >= last)
+		return (0);
+	off = window_copy_search_text_line(st, py);
+	b = window_copy_search_text_find(st, off + first);
+	if (!window_copy_search_text_next(st, &b, off + last))
+		return (0);
+	*ppx = st->cells[b] - off;
+	return (1);
+}
+
+static int
+window_copy_search_rl(struct window_copy_search_text *st, u_int *ppx,
+    u_int py, u_int first, u_int last)
+{
+	u_int	off;
+	size_t	b;
+	int	found = 0;
+
+	if (st->nlen == 0 || first >= last)
+		return (0);
+	off = window_copy_search_text_line(st, py);
+	b = window_copy_search_text_find(st, off + first);
+	while (window_copy_search_text_next(st, &b, off + last)) {
+		*ppx = st->cells[b] - off;
+		found = 1;
+		b++;
 	}
-	return (0);
+	return (found);
 }
 
 static int
-window_copy_search_lr_regex(struct grid *gd, u_int *ppx, u_int *psx, u_int py,
-    u_int first, u_int last, regex_t *reg)
+window_copy_search_lr_regex(struct window_copy_search_text *st, u_int *ppx,
+    u_int *psx, u_int py, u_int first, u_int last, const regex_t *reg)
 {
-	int			eflags = 0;
-	u_int			endline, foundx, foundy, len, pywrap, size = 1;
-	char		       *buf;
-	regmatch_t		regmatch;
-	struct grid_line       *gl;
+	int		eflags = 0;
+	u_int		off, start, end;
+	size_t		b;
+	regmatch_t	regmatch;
 
 	/*
 	 * This can happen during search if the last match was the last
@@ -2606,86 +2784,46 @@ window_copy_search_lr_regex(struct grid *gd, u_int *ppx, u_int *psx, u_int py,
 		eflags |= REG_NOTBOL;
 
 	/* Need to look at the entire string. */
-	buf = xmalloc(size);
-	buf[0] = '\0';
-	buf = window_copy_stringify(gd, py, first, gd->sx, buf, &size);
-	len = gd->sx - first;
-	endline = gd->hsize + gd->sy - 1;
-	pywrap = py;
-	while (buf != NULL && pywrap <= endline) {
-		gl = grid_get_line(gd, pywrap);
-		if (~gl->flags & GRID_LINE_WRAPPED)
-			break;
-		pywrap++;
-		buf = window_copy_stringify(gd, pywrap, 0, gd->sx, buf, &size);
-		len += gd->sx;
-	}
+	off = window_copy_search_text_line(st, py);
+	b = window_copy_search_text_find(st, off + first);
 
-	if (regexec(reg, buf, 1, &regmatch, eflags) == 0 &&
+	if (regexec(reg, st->text + b, 1, &regmatch, eflags) == 0 &&
 	    regmatch.rm_so != regmatch.rm_eo) {
-		foundx = first;
-		foundy = py;
-		window_copy_cstrtocellpos(gd, len, &foundx, &foundy,
-		    buf + regmatch.rm_so);
-		if (foundy == py && foundx < last) {
-			*ppx = foundx;
-			len -= foundx - first;
-			window_copy_cstrtocellpos(gd, len, &foundx, &foundy,
-			    buf + regmatch.rm_eo);
-			*psx = foundx;
-			while (foundy > py) {
-				*psx += gd->sx;
-				foundy--;
-			}
-			*psx -= *ppx;
-			free(buf);
+		start = window_copy_search_text_cell(st, b + regmatch.rm_so);
+		if (start < off + last) {
+			end = window_copy_search_text_cell(st,
+			    b + regmatch.rm_eo);
+			*ppx = start - off;
+			*psx = end - start;
 			return (1);
 		}
 	}
 
-	free(buf);
 	*ppx = 0;
 	*psx = 0;
 	return (0);
 }
 
 static int
-window_copy_search_rl_regex(struct grid *gd, u_int *ppx, u_int *psx, u_int py,
-    u_int first, u_int last, regex_t *reg)
+window_copy_search_rl_regex(struct window_copy_search_text *st, u_int *ppx,
+    u_int *psx, u_int py, u_int first, u_int last, const regex_t *reg)
 {
-	int			eflags = 0;
-	u_int			endline, len, pywrap, size = 1;
-	char		       *buf;
-	struct grid_line       *gl;
+	int	eflags = 0;
+	u_int	off;
+	size_t	b;
 
 	/* Set flags for regex search. */
 	if (first != 0)
 		eflags |= REG_NOTBOL;
 
 	/* Need to look at the entire string. */
-	buf = xmalloc(size);
-	buf[0] = '\0';
-	buf = window_copy_stringify(gd, py, first, gd->sx, buf, &size);
-	len = gd->sx - first;
-	endline = gd->hsize + gd->sy - 1;
-	pywrap = py;
-	while (buf != NULL && (pywrap <= endline)) {
-		gl = grid_get_line(gd, pywrap);
-		if (~gl->flags & GRID_LINE_WRAPPED)
-			break;
-		pywrap++;
-		buf = window_copy_stringify(gd, pywrap, 0, gd->sx, buf, &size);
-		len += gd->sx;
-	}
+	off = window_copy_search_text_line(st, py);
+	b = window_copy_search_text_find(st, off + first);
 
-	if (window_copy_last_regex(gd, py, first, last, len, ppx, psx, buf,
-	    reg, eflags))
-	{
-		free(buf);
+	if (window_copy_last_regex(st, off, first, last, ppx, psx, b, reg,
+	    eflags))
 		return (1);
-	}
 
-	free(buf);
 	*ppx = 0;
 	*psx = 0;
 	return (0);
@@ -2728,42 +2866,28 @@ window_copy_cellstring(const struct grid_line *gl, u_int px, size_t *size,
 
 /* Find last match in given range. */
 static int
-window_copy_last_regex(struct grid *gd, u_int py, u_int first, u_int last,
-    u_int len, u_int *ppx, u_int *psx, const char *buf, const regex_t *preg,
-    int eflags)
+window_copy_last_regex(struct window_copy_search_text *st, u_int off,
+    u_int first, u_int last, u_int *ppx, u_int *psx, size_t b,
+    const regex_t *preg, int eflags)
 {
-	u_int		foundx, foundy, oldx, px = 0, savepx, savesx = 0;
+	u_int		start, end, savepx = 0, savesx = 0;
 	regmatch_t	regmatch;
 
-	foundx = first;
-	foundy = py;
-	oldx = first;
-	while (regexec(preg, buf + px, 1, &regmatch, eflags) == 0) {
+	while (regexec(preg, st->text + b, 1, &regmatch, eflags) == 0) {
 		if (regmatch.rm_so == regmatch.rm_eo)
 			break;
-		window_copy_cstrtocellpos(gd, len, &foundx, &foundy,
-		    buf + px + regmatch.rm_so);
-		if (foundy > py || foundx >= last)
+		start = window_copy_search_text_cell(st, b + regmatch.rm_so);
+		if (start >= off + last)
 			break;
-		len -= foundx - oldx;
-		savepx = foundx;
-		window_copy_cstrtocellpos(gd, len, &foundx, &foundy,
-		    buf + px + regmatch.rm_eo);
-		if (foundy > py || foundx >= last) {
-			*ppx = savepx;
-			*psx = foundx;
-			while (foundy > py) {
-				*psx += gd->sx;
-				foundy--;
-			}
-			*psx -= *ppx;
+		end = window_copy_search_text_cell(st, b + regmatch.rm_eo);
+		if (end >= off + last) {
+			*ppx = start - off;
+			*psx = end - start;
 			return (1);
-		} else {
-			savesx = foundx - savepx;
-			len -= savesx;
-			oldx = foundx;
 		}
-		px += regmatch.rm_eo;
+		savepx = start - off;
+		savesx = end - start;
+		b += regmatch.rm_eo;
 	}
 
 	if (savesx > 0) {
@@ -2816,95 +2940,6 @@ window_copy_stringify(struct grid *gd, u_int py, u_int first, u_int last,
 	return (buf);
 }
 
-/* Map start of C string containing UTF-8 data to grid cell position. */
-static void
-window_copy_cstrtocellpos(struct grid *gd, u_int ncells, u_int *ppx, u_int *ppy,
-    const char *str)
-{
-	u_int			 cell, ccell, px, pywrap, pos, len;
-	int			 match;
-	const struct grid_line	*gl;
-	const char		*d;
-	size_t			 dlen;
-	struct {
-		const char	*d;
-		size_t		 dlen;
-		int		 allocated;
-	} *cells;
-
-	/* Populate the array of cell data. */
-	cells = xreallocarray(NULL, ncells, sizeof cells[0]);
-	cell = 0;
-	px = *ppx;
-	pywrap = *ppy;
-	gl = grid_peek_line(gd, pywrap);
-	while (cell < ncells) {
-		cells[cell].d = window_copy_cellstring(gl, px,
-		    &cells[cell].dlen, &cells[cell].allocated);
-		cell++;
-		px++;
-		if (px == gd->sx) {
-			px = 0;
-			pywrap++;
-			gl = grid_peek_line(gd, pywrap);
-		}
-	}
-
-	/* Locate starting cell. */
-	cell = 0;
-	len = strlen(str);
-	while (cell < ncells) {
-		ccell = cell;
-		pos = 0;
-		match = 1;
-		while (ccell < ncells) {
-			if (str[pos] == '\0') {
-				match = 0;
-				break;
-			}
-			d = cells[ccell].d;
-			dlen = cells[ccell].dlen;
-			if (dlen == 1) {
-				if (str[pos] != *d) {
-					match = 0;
-					break;
-				}
-				pos++;
-			} else {
-				if (dlen > len - pos)
-					dlen = len - pos;
-				if (memcmp(str + pos, d, dlen) != 0) {
-					match = 0;
-					break;
-				}
-				pos += dlen;
-			}
-			ccell++;
-		}
-		if (match)
-			break;
-		cell++;
-	}
-
-	/* If not found this will be one past the end. */
-	px = *ppx + cell;
-	pywrap = *ppy;
-	while (px >= gd->sx) {
-		px -= gd->sx;
-		pywrap++;
-	}
-
-	*ppx = px;
-	*ppy = pywrap;
-
-	/* Free cell data. */
-	for (cell = 0; cell < ncells; cell++) {
-		if (cells[cell].allocated)
-			free((void *)cells[cell].d);
-	}
-	free(cells);
-}
-
 static void
 window_copy_move_left(struct screen *s, u_int *fx, u_int *fy, int wrapflag)
 {
@@ -2955,11 +2990,12 @@ window_copy_is_lowercase(const char *ptr)
  * find the longest overlapping match from previous wrapped lines.
  */
 static void
-window_copy_search_back_overlap(struct grid *gd, regex_t *preg, u_int *ppx,
-    u_int *psx, u_int *ppy, u_int endline)
+window_copy_search_back_overlap(struct window_copy_search_text *st,
+    const regex_t *preg, u_int *ppx, u_int *psx, u_int *ppy, u_int endline)
 {
-	u_int	endx, endy, oldendx, oldendy, px, py, sx;
-	int	found = 1;
+	struct grid	*gd = st->gd;
+	u_int		 endx, endy, oldendx, oldendy, px, py, sx;
+	int		 found = 1;
 
 	oldendx = *ppx + *psx;
 	oldendy = *ppy - 1;
@@ -2975,7 +3011,7 @@ window_copy_search_back_overlap(struct grid *gd, regex_t *preg, u_int *ppx,
 	       grid_get_line(gd, py - 2)->flags & GRID_LINE_WRAPPED &&
 	       endx == oldendx && endy == oldendy) {
 		py--;
-		found = window_copy_search_rl_regex(gd, &px, &sx, py - 1, 0,
+		found = window_copy_search_rl_regex(st, &px, &sx, py - 1, 0,
 		    gd->sx, preg);
 		if (found) {
 			endx = px + sx;
@@ -3003,10 +3039,12 @@ window_copy_search_jump(struct window_mode_entry *wme, struct grid *gd,
     struct grid *sgd, u_int fx, u_int fy, u_int endline, int cis, int wrap,
     int direction, int regex)
 {
-	u_int	 i, px, sx, ssize = 1;
-	int	 found = 0, cflags = REG_EXTENDED;
-	char	*sbuf;
-	regex_t	 reg;
+	u_int			 i, px, sx, ssize = 1;
+	int			 found = 0, cflags = REG_EXTENDED;
+	char			*sbuf;
+	const regex_t		*reg = NULL;
+	struct grid_index_query	*q = NULL;
+	struct window_copy_search_text st;
 
 	if (regex) {
 		sbuf = xmalloc(ssize);
@@ -3014,21 +3052,22 @@ window_copy_search_jump(struct window_mode_entry *wme, struct grid *gd,
 		sbuf = window_copy_stringify(sgd, 0, 0, sgd->sx, sbuf, &ssize);
 		if (cis)
 			cflags |= REG_ICASE;
-		if (regcomp(&reg, sbuf, cflags) != 0) {
-			free(sbuf);
-			return (0);
-		}
+		reg = regsub_compile(sbuf, cflags);
 		free(sbuf);
-	}
+		if (reg == NULL)
+			return (0);
+	} else
+		q = grid_index_start(gd, sgd);
+	window_copy_search_text_init(&st, gd, sgd, !regex && cis);
 
 	if (direction) {
 		for (i = fy; i <= endline; i++) {
 			if (regex) {
-				found = window_copy_search_lr_regex(gd,
-				    &px, &sx, i, fx, gd->sx, &reg);
-			} else {
-				found = window_copy_search_lr(gd, sgd,
-				    &px, i, fx, gd->sx, cis);
+				found = window_copy_search_lr_regex(&st,
+				    &px, &sx, i, fx, gd->sx, reg);
+			} else if (q == NULL || grid_index_check(q, i)) {
+				found = window_copy_search_lr(&st, &px, i, fx,
+				    gd->sx);
 			}
 			if (found)
 				break;
@@ -3037,15 +3076,15 @@ window_copy_search_jump(struct window_mode_entry *wme, struct grid *gd,
 	} else {
 		for (i = fy + 1; endline < i; i--) {
 			if (regex) {
-				found = window_copy_search_rl_regex(gd,
-				    &px, &sx, i - 1, 0, fx + 1, &reg);
+				found = window_copy_search_rl_regex(&st,
+				    &px, &sx, i - 1, 0, fx + 1, reg);
 				if (found) {
-					window_copy_search_back_overlap(gd,
-					    &reg, &px, &sx, &i, endline);
+					window_copy_search_back_overlap(&st,
+					    reg, &px, &sx, &i, endline);
 				}
-			} else {
-				found = window_copy_search_rl(gd, sgd,
-				    &px, i - 1, 0, fx + 1, cis);
+			} else if (q == NULL || grid_index_check(q, i - 1)) {
+				found = window_copy_search_rl(&st, &px, i - 1,
+				    0, fx + 1);
 			}
 			if (found) {
 				i--;
@@ -3054,9 +3093,8 @@ window_copy_search_jump(struct window_mode_entry *wme, struct grid *gd,
 			fx = gd->sx - 1;
 		}
 	}
-	if (regex)
-		regfree(&reg);
-
+	grid_index_end(q);
+	window_copy_search_text_free(&st);
 	if (found) {
 		window_copy_scroll_to(wme, px, i, 1);
 		return (1);
@@ -3235,33 +3273,46 @@ window_copy_search(struct window_mode_entry *wme, int direction, int regex)
 	return (found);
 }
 
+/*
+ * Get the lines to mark: the visible lines with a margin of half a screen above
+ * and below, so scrolling a little does not need the marks to be found again.
+ * The search starts from the beginning of the first line if it is wrapped.
+ */
 static void
-window_copy_visible_lines(struct window_copy_mode_data *data, u_int *start,
-    u_int *end)
+window_copy_search_mark_lines(struct window_copy_mode_data *data,
+    u_int *first, u_int *start, u_int *end)
 {
 	struct grid		*gd = data->backing->grid;
 	const struct grid_line	*gl;
+	u_int			 top = gd->hsize - data->oy;
+	u_int			 margin = gd->sy / 2;
+
+	if (top > margin)
+		*first = top - margin;
+	else
+		*first = 0;
+	*end = top + gd->sy + margin;
+	if (*end > gd->hsize + gd->sy)
+		*end = gd->hsize + gd->sy;
 
-	for (*start = gd->hsize - data->oy; *start > 0; (*start)--) {
-		gl = grid_peek_line(gd, (*start) - 1);
+	for (*start = *first; *start > 0; (*start)--) {
+		gl = grid_peek_line_packed(gd, (*start) - 1);
 		if (~gl->flags & GRID_LINE_WRAPPED)
 			break;
 	}
-	*end = gd->hsize - data->oy + gd->sy;
 }
 
 static int
 window_copy_search_mark_at(struct window_copy_mode_data *data, u_int px,
     u_int py, u_int *at)
 {
-	struct screen	*s = data->backing;
-	struct grid	*gd = s->grid;
+	struct grid	*gd = data->backing->grid;
 
-	if (py < gd->hsize - data->oy)
+	if (py < data->searchmarkpy)
 		return (-1);
-	if (py > gd->hsize - data->oy + gd->sy - 1)
+	if (py >= data->searchmarkpy + data->searchmarkny)
 		return (-1);
-	*at = ((py - (gd->hsize - data->oy)) * gd->sx) + px;
+	*at = ((py - data->searchmarkpy) * gd->sx) + px;
 	return (0);
 }
 
@@ -3273,13 +3324,26 @@ window_copy_search_marks(struct window_mode_entry *wme, struct screen *ssp,
 	struct screen			*s = data->backing, ss;
 	struct screen_write_ctx		 ctx;
 	struct grid			*gd = s->grid;
-	int				 found, cis, stopped = 0;
+	int				 found, cis;
 	int				 cflags = REG_EXTENDED;
-	u_int				 px, py, i, b, nfound = 0, width;
-	u_int				 ssize = 1, start, end;
+	u_int				 px, py, i, b, width, first, top;
+	u_int				 ssize = 1, start, end, size;
 	char				*sbuf;
-	regex_t				 reg;
-	uint64_t			 stop = 0, tstart, t;
+	const regex_t			*reg = NULL;
+	uint64_t			 tstart;
+	struct grid_index_query		*q = NULL;
+	struct window_copy_search_text	 st;
+
+	/*
+	 * If only the visible lines are needed and they are already marked,
+	 * there is nothing to do.
+	 */
+	top = gd->hsize - data->oy;
+	if (visible_only &&
+	    data->searchmark != NULL &&
+	    top >= data->searchmarkpy &&
+	    top + gd->sy <= data->searchmarkpy + data->searchmarkny)
+		return (1);
 
 	if (ssp == NULL) {
 		width = screen_write_strlen("%s", data->searchstr);
@@ -3301,46 +3365,44 @@ window_copy_search_marks(struct window_mode_entry *wme, struct screen *ssp,
 		    sbuf, &ssize);
 		if (cis)
 			cflags |= REG_ICASE;
-		if (regcomp(&reg, sbuf, cflags) != 0) {
-			free(sbuf);
-			return (0);
-		}
+		reg = regsub_compile(sbuf, cflags);
 		free(sbuf);
-	}
+		if (reg == NULL)
+			return (0);
+	} else
+		q = grid_index_start(gd, ssp->grid);
+	window_copy_search_text_init(&st, gd, ssp->grid, !regex && cis);
 	tstart = get_timer();
 
-	if (visible_only)
-		window_copy_visible_lines(data, &start, &end);
-	else {
-		start = 0;
-		end = gd->hsize + gd->sy;
-		stop = get_timer() + WINDOW_COPY_SEARCH_ALL_TIMEOUT;
-	}
+	window_copy_search_mark_lines(data, &first, &start, &end);
 
-again:
 	free(data->searchmark);
-	data->searchmark = xcalloc(gd->sx, gd->sy);
+	data->searchmarkpy = first;
+	data->searchmarkny = end - first;
+	data->searchmark = xcalloc(gd->sx, data->searchmarkny);
 	data->searchgen = 1;
+	size = gd->sx * data->searchmarkny;
 
 	for (py = start; py < end; py++) {
+		if (q != NULL && !grid_index_check(q, py))
+			continue;
 		px = 0;
 		for (;;) {
 			if (regex) {
-				found = window_copy_search_lr_regex(gd,
-				    &px, &width, py, px, gd->sx, &reg);
+				found = window_copy_search_lr_regex(&st,
+				    &px, &width, py, px, gd->sx, reg);
 				if (!found)
 					break;
 			} else {
-				found = window_copy_search_lr(gd, ssp->grid,
-				    &px, py, px, gd->sx, cis);
+				found = window_copy_search_lr(&st, &px, py, px,
+				    gd->sx);
 				if (!found)
 					break;
 			}
-			nfound++;
 
 			if (window_copy_search_mark_at(data, px, py, &b) == 0) {
-				if (b + width > gd->sx * gd->sy)
-					width = (gd->sx * gd->sy) - b;
+				if (b + width > size)
+					width = size - b;
 				for (i = b; i < b + width; i++) {
 					if (data->searchmark[i] != 0)
 						continue;
@@ -3354,50 +3416,25 @@ again:
 			px += width;
 		}
 
-		t = get_timer();
-		if (t - tstart > WINDOW_COPY_SEARCH_TIMEOUT) {
+		if (get_timer() - tstart > WINDOW_COPY_SEARCH_TIMEOUT) {
 			data->timeout = 1;
 			break;
 		}
-		if (stop != 0 && t > stop) {
-			stopped = 1;
-			break;
-		}
 	}
 	if (data->timeout) {
 		window_copy_clear_marks(wme);
 		goto out;
 	}
 
-	if (stopped && stop != 0) {
-		/* Try again but just the visible context. */
-		window_copy_visible_lines(data, &start, &end);
-		stop = 0;
-		goto again;
-	}
-
-	if (!visible_only) {
-		if (stopped) {
-			if (nfound > 1000)
-				data->searchcount = 1000;
-			else if (nfound > 100)
-				data->searchcount = 100;
-			else if (nfound > 10)
-				data->searchcount = 10;
-			else
-				data->searchcount = -1;
-			data->searchmore = 1;
-		} else {
-			data->searchcount = nfound;
-			data->searchmore = 0;
-		}
-	}
+	/* Count all the matches in the background. */
+	if (!visible_only)
+		window_copy_search_count_start(wme, regex);
 
 out:
+	grid_index_end(q);
+	window_copy_search_text_free(&st);
 	if (ssp == &ss)
 		screen_free(&ss);
-	if (regex)
-		regfree(&reg);
 	return (1);
 }
 
@@ -3406,10 +3443,141 @@ window_copy_clear_marks(struct window_mode_entry *wme)
 {
 	struct window_copy_mode_data	*data = wme->data;
 
+	window_copy_search_count_stop(data);
+
 	free(data->searchmark);
 	data->searchmark = NULL;
 }
 
+/* Count matches until the end of the grid or the time slice is used up. */
+static int
+window_copy_search_count_slice(struct window_copy_mode_data *data)
+{
+	struct window_copy_search_count	*sc = data->searchcounter;
+	struct grid			*gd = data->backing->grid;
+	u_int				 px, width, end = gd->hsize + gd->sy;
+	uint64_t			 stop;
+	int				 found;
+
+	stop = get_timer() + WINDOW_COPY_SEARCH_COUNT_TIME;
+	while (sc->py < end) {
+		if (sc->q == NULL || grid_index_check(sc->q, sc->py)) {
+			px = 0;
+			width = screen_size_x(&sc->ss);
+			for (;;) {
+				if (sc->regex) {
+					found = window_copy_search_lr_regex(
+					    &sc->st, &px, &width, sc->py, px,
+					    gd->sx, sc->reg);
+				} else {
+					found = window_copy_search_lr(&sc->st,
+					    &px, sc->py, px, gd->sx);
+				}
+				if (!found)
+					break;
+				sc->nfound++;
+				px += width;
+			}
+		}
+		sc->py++;
+		if (sc->py % 64 == 0 && get_timer() > stop)
+			break;
+	}
+
+	data->searchcount = sc->nfound;
+	if (sc->py != end)
+		return (0);
+	data->searchmore = 0;
+	window_copy_search_count_stop(data);
+	return (1);
+}
+
+/* Count the next slice of matches and show the count so far. */
+static void
+window_copy_search_count_timer(__unused int fd, __unused short events,
+    void *arg)
+{
+	struct window_mode_entry	*wme = arg;
+	struct window_copy_mode_data	*data = wme->data;
+	struct timeval			 tv = { .tv_usec = 0 };
+
+	if (data->searchcounter == NULL)
+		return;
+	if (!window_copy_search_count_slice(data))
+		evtimer_add(&data->searchtimer, &tv);
+	if (TAILQ_FIRST(&wme->wp->modes) == wme)
+		window_copy_redraw_lines(wme, 0, 1);
+}
+
+/*
+ * Start counting the matches for the search string. The first slice is
+ * counted immediately so the count is complete at once for small histories.
+ */
+static void
+window_copy_search_count_start(struct window_mode_entry *wme, int regex)
+{
+	struct window_copy_mode_data	*data = wme->data;
+	struct grid			*gd = data->backing->grid;
+	struct window_copy_search_count	*sc;
+	struct screen_write_ctx		 ctx;
+	struct timeval			 tv = { .tv_usec = 0 };
+	char				*sbuf;
+	u_int				 ssize = 1;
+	int				 cis, cflags = REG_EXTENDED;
+
+	window_copy_search_count_stop(data);
+
+	sc = xcalloc(1, sizeof *sc);
+	screen_init(&sc->ss, screen_write_strlen("%s", data->searchstr), 1, 0);
+	screen_write_start(&ctx, &sc->ss);
+	screen_write_nputs(&ctx, -1, &grid_default_cell, "%s",
+	    data->searchstr);
+	screen_write_stop(&ctx);
+
+	cis = window_copy_is_lowercase(data->searchstr);
+	if (regex) {
+		sbuf = xmalloc(ssize);
+		sbuf[0] = '\0';
+		sbuf = window_copy_stringify(sc->ss.grid, 0, 0, sc->ss.grid->sx,
+		    sbuf, &ssize);
+		if (cis)
+			cflags |= REG_ICASE;
+		sc->reg = regsub_compile(sbuf, cflags);
+		free(sbuf);
+		if (sc->reg == NULL) {
+			screen_free(&sc->ss);
+			free(sc);
+			return;
+		}
+	} else
+		sc->q = grid_index_start(gd, sc->ss.grid);
+	sc->regex = regex;
+	window_copy_search_text_init(&sc->st, gd, sc->ss.grid, !regex && cis);
+
+	data->searchcounter = sc;
+	data->searchcount = 0;
+	data->searchmore = 1;
+	if (!window_copy_search_count_slice(data))
+		evtimer_add(&data->searchtimer, &tv);
+}
+
+/* Stop counting matches, leaving the count so far. */
+static void
+window_copy_search_count_stop(struct window_copy_mode_data *data)
+{
+	struct window_copy_search_count	*sc = data->searchcounter;
+
+	if (sc == NULL)
+		return;
+	evtimer_del(&data->searchtimer);
+
+	grid_index_end(sc->q);
+	window_copy_search_text_free(&sc->st);
+	screen_free(&sc->ss);
+	free(sc);
+	data->searchcounter = NULL;
+}
+
 static int
 window_copy_search_up(struct window_mode_entry *wme, int regex)
 {
@@ -3445,7 +3613,7 @@ window_copy_match_start_end(struct window_copy_mode_data *data, u_int at,
     u_int *start, u_int *end)
 {
 	struct grid	*gd = data->backing->grid;
-	u_int		 last = (gd->sy * gd->sx) - 1;
+	u_int		 last = (data->searchmarkny * gd->sx) - 1;
 	u_char		 mark = data->searchmark[at];
 
 	*start = *end = at;
@@ -3490,7 +3658,7 @@ window_copy_match_at_cursor(struct window_copy_mode_data *data)
 		py = at / sx;
 		px = at - (py * sx);
 
-		grid_get_cell(gd, px, gd->hsize + py - data->oy, &gc);
+		grid_get_cell(gd, px, data->searchmarkpy + py, &gc);
 		buf = xrealloc(buf, len + gc.data.size + 1);
 		memcpy(buf + len, gc.data.data, gc.data.size);
 		len += gc.data.size;
@@ -3957,7 +4125,7 @@ window_copy_get_selection(struct window_mode_entry *wme, size_t *len)
 	struct window_copy_mode_data	*data = wme->data;
 	struct screen			*s = &data->screen;
 	char				*buf;
-	size_t				 off;
+	size_t				 off, size;
 	u_int				 i, xx, yy, sx, sy, ex, ey, ey_last;
 	u_int				 firstsx, lastex, restex, restsx, selx;
 	int				 keys;
@@ -3971,11 +4139,6 @@ window_copy_get_selection(struct window_mode_entry *wme, size_t *len)
 		return (buf);
 	}
 
-	buf = xmalloc(1);
-	off = 0;
-
-	*buf = '\0';
-
 	/*
 	 * The selection extends from selx,sely to (adjusted) cx,cy on
 	 * the base screen.
@@ -4049,19 +4212,27 @@ window_copy_get_selection(struct window_mode_entry *wme, size_t *len)
 		restsx = 0;
 	}
 
-	/* Copy the lines. */
+	/* Work out the size of the text, then copy the lines. */
+	size = 0;
 	for (i = sy; i <= ey; i++) {
-		window_copy_copy_line(wme, &buf, &off, i,
+		window_copy_copy_line(wme, NULL, &size, i,
 		    (i == sy ? firstsx : restsx),
 		    (i == ey ? lastex : restex));
 	}
 
 	/* Don't bother if no data. */
-	if (off == 0) {
-		free(buf);
+	if (size == 0) {
 		*len = 0;
 		return (NULL);
 	}
+
+	buf = xmalloc(size);
+	off = 0;
+	for (i = sy; i <= ey; i++) {
+		window_copy_copy_line(wme, buf, &off, i,
+		    (i == sy ? firstsx : restsx),
+		    (i == ey ? lastex : restex));
+	}
 	 /* Remove final \n (unless at end in vi mode). */
 	if (keys == MODEKEY_EMACS || lastex <= ey_last) {
 		if (~grid_get_line(data->backing->grid, ey)->flags &
@@ -4173,16 +4344,13 @@ window_copy_append_selection(struct window_mode_entry *wme)
 }
 
 static void
-window_copy_copy_line(struct window_mode_entry *wme, char **buf, size_t *off,
+window_copy_copy_line(struct window_mode_entry *wme, char *buf, size_t *off,
     u_int sy, u_int sx, u_int ex)
 {
 	struct window_copy_mode_data	*data = wme->data;
 	struct grid			*gd = data->backing->grid;
-	struct grid_cell		 gc;
-	struct grid_line		*gl;
-	struct utf8_data		 ud;
-	u_int				 i, xx, wrapped = 0;
-	const char			*s;
+	const struct grid_line		*gl;
+	u_int				 xx, wrapped = 0;
 
 	if (sx > ex)
 		return;
@@ -4191,7 +4359,7 @@ window_copy_copy_line(struct window_mode_entry *wme, char **buf, size_t *off,
 	 * Work out if the line was wrapped at the screen edge and all of it is
 	 * on screen.
 	 */
-	gl = grid_get_line(gd, sy);
+	gl = grid_peek_line(gd, sy);
 	if (gl->flags & GRID_LINE_WRAPPED && gl->cellsize <= gd->sx)
 		wrapped = 1;
 
@@ -4206,29 +4374,15 @@ window_copy_copy_line(struct window_mode_entry *wme, char **buf, size_t *off,
 		sx = xx;
 
 	if (sx < ex) {
-		for (i = sx; i < ex; i++) {
-			grid_get_cell(gd, i, sy, &gc);
-			if (gc.flags & GRID_FLAG_PADDING)
-				continue;
-			utf8_copy(&ud, &gc.data);
-			if (ud.size == 1 && (gc.attr & GRID_ATTR_CHARSET)) {
-				s = tty_acs_get(NULL, ud.data[0]);
-				if (s != NULL && strlen(s) <= sizeof ud.data) {
-					ud.size = strlen(s);
-					memcpy(ud.data, s, ud.size);
-				}
-			}
-
-			*buf = xrealloc(*buf, (*off) + ud.size);
-			memcpy(*buf + *off, ud.data, ud.size);
-			*off += ud.size;
-		}
+		*off += grid_string_text(gd, sx, sy, ex - sx,
+		    buf == NULL ? NULL : buf + *off, 1);
 	}
 
 	/* Only add a newline if the line wasn't wrapped. */
 	if (!wrapped || ex != xx) {
-		*buf = xrealloc(*buf, (*off) + 1);
-		(*buf)[(*off)++] = '\n';
+		if (buf != NULL)
+			buf[*off] = '\n';
+		(*off)++;
 	}
 }
 
@@ -4791,6 +4945,11 @@ window_copy_scroll_up(struct window_mode_entry *wme, u_int ny)
 		window_copy_search_marks(wme, NULL, data->searchregex, 1);
 	window_copy_update_selection(wme, 0, 0);
 
+	if (ny >= screen_size_y(s)) {
+		window_copy_redraw_screen(wme);
+		return;
+	}
+
 	screen_write_start_pane(&ctx, wp, NULL);
 	screen_write_cursormove(&ctx, 0, 0, 0);
 	screen_write_deleteline(&ctx, ny, 8);
@@ -4827,6 +4986,11 @@ window_copy_scroll_down(struct window_mode_entry *wme, u_int ny)
 		window_copy_search_marks(wme, NULL, data->searchregex, 1);
 	window_copy_update_selection(wme, 0, 0);
 
+	if (ny >= screen_size_y(s)) {
+		window_copy_redraw_screen(wme);
+		return;
+	}
+
 	screen_write_start_pane(&ctx, wp, NULL);
 	screen_write_cursormove(&ctx, 0, 0, 0);
 	screen_write_insertline(&ctx, ny, 8);
@@ -5039,10 +5203,11 @@ window_copy_acquire_cursor_up(struct window_mode_entry *wme, u_int hsize,
 		cy = py - yy;
 		nd = oldy - cy + 1;
 	}
-	while (ny > 0) {
+	/* Scroll most of the way at once, then one line to fix the cursor. */
+	if (ny > 1)
+		window_copy_scroll_down(wme, ny - 1);
+	if (ny > 0)
 		window_copy_cursor_up(wme, 1);
-		ny--;
-	}
 	window_copy_update_cursor(wme, px, cy);
 	if (window_copy_update_selection(wme, 1, 0))
 		window_copy_redraw_lines(wme, cy, nd);
@@ -5065,10 +5230,11 @@ window_copy_acquire_cursor_down(struct window_mode_entry *wme, u_int hsize,
 		ny = 0;
 		nd = cy - oldy + 1;
 	}
-	while (ny > 0) {
-	  window_copy_cursor_down(wme, 1);
-	  ny--;
-	}
+	/* Scroll most of the way at once, then one line to fix the cursor. */
+	if (ny > 1)
+		window_copy_scroll_up(wme, ny - 1);
+	if (ny > 0)
+		window_copy_cursor_down(wme, 1);
 	if (cy > yy)
 		window_copy_update_cursor(wme, px, yy);
 	else
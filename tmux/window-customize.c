@@ -383,6 +383,8 @@ window_customize_build_options(struct window_customize_modedata *data,
 
 	top = mode_tree_add(data->data, NULL, NULL, tag, title, NULL, 0);
 	mode_tree_no_tag(top);
+	if (mode_tree_defer_children(data->data, top))
+		return;
 
 	/*
 	 * We get the options from the first tree, but build it using the
@@ -457,6 +459,8 @@ window_customize_build_keys(struct window_customize_modedata *data,
 	top = mode_tree_add(data->data, NULL, NULL, tag, title, NULL, 0);
 	mode_tree_no_tag(top);
 	free(title);
+	if (mode_tree_defer_children(data->data, top))
+		return;
 
 	ft = format_create_from_state(NULL, NULL, fs);
 	format_add(ft, "is_option", "0");
@@ -471,6 +475,7 @@ window_customize_build_keys(struct window_customize_modedata *data,
 			expanded = format_expand(ft, filter);
 			if (!format_true(expanded)) {
 				free(expanded);
+				bd = key_bindings_next(kt, bd);
 				continue;
 			}
 			free(expanded);
@@ -890,8 +895,8 @@ window_customize_init(struct window_mode_entry *wme, struct cmd_find_state *fs,
 
 	data->data = mode_tree_start(wp, args, window_customize_build,
 	    window_customize_draw, NULL, window_customize_menu,
-	    window_customize_height, NULL, data, window_customize_menu_items,
-	    NULL, 0, &s);
+	    window_customize_height, NULL, NULL, data,
+	    window_customize_menu_items, NULL, 0, &s);
 	mode_tree_zoom(data->data, args);
 
 	mode_tree_build(data->data);
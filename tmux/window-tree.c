@@ -296,7 +296,7 @@ window_tree_build_pane(struct session *s, struct winlink *wl,
 {
 	struct window_tree_modedata	*data = modedata;
 	struct window_tree_itemdata	*item;
-	char				*name, *text;
+	char				*name;
 	u_int				 idx;
 
 	window_pane_index(wp, &idx);
@@ -307,11 +307,9 @@ window_tree_build_pane(struct session *s, struct winlink *wl,
 	item->winlink = wl->idx;
 	item->pane = wp->id;
 
-	text = format_single(NULL, data->format, NULL, s, wl, wp);
 	xasprintf(&name, "%u", idx);
 
-	mode_tree_add(data->data, parent, item, (uint64_t)wp, name, text, -1);
-	free(text);
+	mode_tree_add(data->data, parent, item, (uint64_t)wp, name, NULL, -1);
 	free(name);
 }
 
@@ -340,7 +338,7 @@ window_tree_build_window(struct session *s, struct winlink *wl,
 	struct window_tree_modedata	*data = modedata;
 	struct window_tree_itemdata	*item;
 	struct mode_tree_item		*mti;
-	char				*name, *text;
+	char				*name;
 	struct window_pane		*wp, **l;
 	u_int				 n, i;
 	int				 expanded;
@@ -351,7 +349,6 @@ window_tree_build_window(struct session *s, struct winlink *wl,
 	item->winlink = wl->idx;
 	item->pane = -1;
 
-	text = format_single(NULL, data->format, NULL, s, wl, NULL);
 	xasprintf(&name, "%u", wl->idx);
 
 	if (data->type == WINDOW_TREE_SESSION ||
@@ -359,9 +356,8 @@ window_tree_build_window(struct session *s, struct winlink *wl,
 		expanded = 0;
 	else
 		expanded = 1;
-	mti = mode_tree_add(data->data, parent, item, (uint64_t)wl, name, text,
+	mti = mode_tree_add(data->data, parent, item, (uint64_t)wl, name, NULL,
 	    expanded);
-	free(text);
 	free(name);
 
 	if ((wp = TAILQ_FIRST(&wl->window->panes)) == NULL)
@@ -406,7 +402,6 @@ window_tree_build_session(struct session *s, void *modedata,
 	struct window_tree_modedata	*data = modedata;
 	struct window_tree_itemdata	*item;
 	struct mode_tree_item		*mti;
-	char				*text;
 	struct winlink			*wl, **l;
 	u_int				 n, i, empty;
 	int				 expanded;
@@ -417,15 +412,12 @@ window_tree_build_session(struct session *s, void *modedata,
 	item->winlink = -1;
 	item->pane = -1;
 
-	text = format_single(NULL, data->format, NULL, s, NULL, NULL);
-
 	if (data->type == WINDOW_TREE_SESSION)
 		expanded = 0;
 	else
 		expanded = 1;
-	mti = mode_tree_add(data->data, NULL, item, (uint64_t)s, s->name, text,
+	mti = mode_tree_add(data->data, NULL, item, (uint64_t)s, s->name, NULL,
 	    expanded);
-	free(text);
 
 	l = NULL;
 	n = 0;
@@ -826,8 +818,7 @@ window_tree_search(__unused void *modedata, void *itemdata, const char *ss)
 	struct session			*s;
 	struct winlink			*wl;
 	struct window_pane		*wp;
-	char				*cmd;
-	int				 retval;
+	const char			*cmd;
 
 	window_tree_pull_item(item, &s, &wl, &wp);
 
@@ -845,12 +836,10 @@ window_tree_search(__unused void *modedata, void *itemdata, const char *ss)
 	case WINDOW_TREE_PANE:
 		if (s == NULL || wl == NULL || wp == NULL)
 			break;
-		cmd = osdep_get_name(wp->fd, wp->tty);
+		cmd = window_pane_get_proc_name(wp);
 		if (cmd == NULL || *cmd == '\0')
 			return (0);
-		retval = (strstr(cmd, ss) != NULL);
-		free(cmd);
-		return (retval);
+		return (strstr(cmd, ss) != NULL);
 	}
 	return (0);
 }
@@ -897,6 +886,25 @@ window_tree_get_key(void *modedata, void *itemdata, u_int line)
 	return key;
 }
 
+static char *
+window_tree_get_text(void *modedata, void *itemdata)
+{
+	struct window_tree_modedata	*data = modedata;
+	struct window_tree_itemdata	*item = itemdata;
+	struct session			*s;
+	struct winlink			*wl;
+	struct window_pane		*wp;
+
+	window_tree_pull_item(item, &s, &wl, &wp);
+	if (s == NULL)
+		return (NULL);
+	if (item->type == WINDOW_TREE_SESSION)
+		return (format_single(NULL, data->format, NULL, s, NULL, NULL));
+	if (item->type == WINDOW_TREE_WINDOW)
+		return (format_single(NULL, data->format, NULL, s, wl, NULL));
+	return (format_single(NULL, data->format, NULL, s, wl, wp));
+}
+
 static struct screen *
 window_tree_init(struct window_mode_entry *wme, struct cmd_find_state *fs,
     struct args *args)
@@ -933,8 +941,9 @@ window_tree_init(struct window_mode_entry *wme, struct cmd_find_state *fs,
 
 	data->data = mode_tree_start(wp, args, window_tree_build,
 	    window_tree_draw, window_tree_search, window_tree_menu, NULL,
-	    window_tree_get_key, data, window_tree_menu_items,
-	    window_tree_sort_list, nitems(window_tree_sort_list), &s);
+	    window_tree_get_key, window_tree_get_text, data,
+	    window_tree_menu_items, window_tree_sort_list,
+	    nitems(window_tree_sort_list), &s);
 	mode_tree_zoom(data->data, args);
 
 	mode_tree_build(data->data);
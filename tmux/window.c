@@ -18,6 +18,7 @@
 
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 
 #include <ctype.h>
 #include <errno.h>
@@ -55,12 +56,55 @@
 /* Global window list. */
 struct windows windows;
 
+/* How long a cached pane foreground process lookup is kept, in milliseconds. */
+#define PANE_PROC_INTERVAL 1000
+
 /* Global panes tree. */
 struct window_pane_tree all_window_panes;
+
+/*
+ * Windows and panes which may need work in the server loop, so it need not
+ * look at every one each time. They stay on the lists until the loop finds
+ * nothing left to do.
+ */
+struct window_checks window_checks = TAILQ_HEAD_INITIALIZER(window_checks);
+struct window_pane_checks window_pane_checks =
+    TAILQ_HEAD_INITIALIZER(window_pane_checks);
+
+/* Panes by pty name, so a client can quickly find the pane it is inside. */
+RB_HEAD(window_pane_ttys, window_pane);
+static struct window_pane_ttys all_window_pane_ttys =
+    RB_INITIALIZER(&all_window_pane_ttys);
 static u_int	next_window_pane_id;
 static u_int	next_window_id;
 static u_int	next_active_point;
 
+/* Period over which pane scroll rate is measured and redraw interval. */
+#define WINDOW_PANE_SCROLL_PERIOD 100
+#define WINDOW_PANE_SCROLL_REDRAW 50
+
+/*
+ * With pipe-pane -s on Linux, pane output is spliced from the pty into a pipe
+ * (in) and copied in the kernel with tee(2) into a second pipe (out), which is
+ * then spliced into the pipe-pane socket; tmux only reads the first pipe to
+ * parse the output. The out pipe is made PANE_PIPE_HIGH in size and nothing
+ * more is read from the pty than fits in it, so if the pipe command is slow
+ * the pane stalls as it would otherwise. If anything fails, the pane goes back
+ * to being read normally.
+ */
+#define WINDOW_PANE_SPLICE_READ 65536
+struct window_pane_splice {
+	int		 in[2];
+	int		 out[2];
+	size_t		 size;
+
+	int		 reading;
+	struct event	 read_event;
+	struct event	 write_event;
+
+	struct evbuffer	*pending;
+};
+
 struct window_pane_input_data {
 	struct cmdq_item	*item;
 	u_int			 wp;
@@ -69,11 +113,27 @@ struct window_pane_input_data {
 static struct window_pane *window_pane_create(struct window *, u_int, u_int,
 		    u_int);
 static void	window_pane_destroy(struct window_pane *);
+static void	window_pane_palette_changed(struct window_pane *);
+static size_t	window_pane_splice_queued(struct window_pane_splice *);
 
 RB_GENERATE(windows, window, entry, window_cmp);
 RB_GENERATE(winlinks, winlink, entry, winlink_cmp);
 RB_GENERATE(window_pane_tree, window_pane, tree_entry, window_pane_cmp);
 
+static int
+window_pane_tty_cmp(struct window_pane *wp1, struct window_pane *wp2)
+{
+	int	retval;
+
+	if ((retval = strcmp(wp1->tty, wp2->tty)) != 0)
+		return (retval);
+	if (wp1->id < wp2->id)
+		return (-1);
+	return (wp1->id > wp2->id);
+}
+RB_GENERATE_STATIC(window_pane_ttys, window_pane, tty_entry,
+    window_pane_tty_cmp);
+
 int
 window_cmp(struct window *w1, struct window *w2)
 {
@@ -92,13 +152,17 @@ window_pane_cmp(struct window_pane *wp1, struct window_pane *wp2)
 	return (wp1->id - wp2->id);
 }
 
+/*
+ * Find a window in a set of winlinks. A window is linked far fewer times than
+ * there are winlinks, so look through its links for one in this set.
+ */
 struct winlink *
 winlink_find_by_window(struct winlinks *wwl, struct window *w)
 {
 	struct winlink	*wl;
 
-	RB_FOREACH(wl, winlinks, wwl) {
-		if (wl->window == w)
+	TAILQ_FOREACH(wl, &w->winlinks, wentry) {
+		if (RB_FIND(winlinks, wwl, wl) == wl)
 			return (wl);
 	}
 
@@ -120,13 +184,11 @@ winlink_find_by_index(struct winlinks *wwl, int idx)
 struct winlink *
 winlink_find_by_window_id(struct winlinks *wwl, u_int id)
 {
-	struct winlink *wl;
+	struct window	*w;
 
-	RB_FOREACH(wl, winlinks, wwl) {
-		if (wl->window->id == id)
-			return (wl);
-	}
-	return (NULL);
+	if ((w = window_find_by_id(id)) == NULL)
+		return (NULL);
+	return (winlink_find_by_window(wwl, w));
 }
 
 static int
@@ -187,6 +249,7 @@ winlink_set_window(struct winlink *wl, struct window *w)
 	TAILQ_INSERT_TAIL(&w->winlinks, wl, wentry);
 	wl->window = w;
 	window_add_ref(w, __func__);
+	format_lists_changed();
 }
 
 void
@@ -197,9 +260,11 @@ winlink_remove(struct winlinks *wwl, struct winlink *wl)
 	if (w != NULL) {
 		TAILQ_REMOVE(&w->winlinks, wl, wentry);
 		window_remove_ref(w, __func__);
+		format_lists_changed();
 	}
 
 	RB_REMOVE(winlinks, wwl, wl);
+	format_free_cache(wl->format_cache);
 	free(wl);
 }
 
@@ -287,6 +352,32 @@ window_find_by_id(u_int id)
 	return (RB_FIND(windows, &windows, &w));
 }
 
+/* Get or set the next window ID, so a new server can keep the same IDs. */
+u_int
+window_get_next_id(void)
+{
+	return (next_window_id);
+}
+
+void
+window_set_next_id(u_int id)
+{
+	next_window_id = id;
+}
+
+/* Get or set the next pane ID. */
+u_int
+window_pane_get_next_id(void)
+{
+	return (next_window_pane_id);
+}
+
+void
+window_pane_set_next_id(u_int id)
+{
+	next_window_pane_id = id;
+}
+
 void
 window_update_activity(struct window *w)
 {
@@ -334,6 +425,46 @@ window_create(u_int sx, u_int sy, u_int xpixel, u_int ypixel)
 	return (w);
 }
 
+/* Queue a window to be checked in the server loop. */
+void
+window_queue_check(struct window *w)
+{
+	if (!w->check_queued) {
+		w->check_queued = 1;
+		TAILQ_INSERT_TAIL(&window_checks, w, check_entry);
+	}
+}
+
+/* Remove a window from the server loop checks. */
+void
+window_unqueue_check(struct window *w)
+{
+	if (w->check_queued) {
+		w->check_queued = 0;
+		TAILQ_REMOVE(&window_checks, w, check_entry);
+	}
+}
+
+/* Queue a pane to be checked in the server loop. */
+void
+window_pane_queue_check(struct window_pane *wp)
+{
+	if (!wp->check_queued) {
+		wp->check_queued = 1;
+		TAILQ_INSERT_TAIL(&window_pane_checks, wp, check_entry);
+	}
+}
+
+/* Remove a pane from the server loop checks. */
+void
+window_pane_unqueue_check(struct window_pane *wp)
+{
+	if (wp->check_queued) {
+		wp->check_queued = 0;
+		TAILQ_REMOVE(&window_pane_checks, wp, check_entry);
+	}
+}
+
 static void
 window_destroy(struct window *w)
 {
@@ -346,20 +477,26 @@ window_destroy(struct window *w)
 	if (w->saved_layout_root != NULL)
 		layout_free_cell(w->saved_layout_root);
 	free(w->old_layout);
+	free(w->layout_dumps[0].dump);
+	free(w->layout_dumps[1].dump);
 
 	window_destroy_panes(w);
 
-	if (event_initialized(&w->name_event))
-		evtimer_del(&w->name_event);
+	/* Destroying panes can queue the window again, so do this after. */
+	window_unqueue_check(w);
+	cancel_window_name(w);
 
-	if (event_initialized(&w->alerts_timer))
-		evtimer_del(&w->alerts_timer);
+	alerts_remove(w);
 	if (event_initialized(&w->offset_timer))
 		event_del(&w->offset_timer);
 
 	options_free(w->options);
+	format_free_list(&w->linked_sessions_list);
+	format_free_list(&w->active_sessions_list);
+	format_free_list(&w->active_clients_list);
 
 	free(w->name);
+	free(w->name_key);
 	free(w);
 }
 
@@ -369,12 +506,15 @@ window_pane_destroy_ready(struct window_pane *wp)
 	int	n;
 
 	if (wp->pipe_fd != -1) {
-		if (EVBUFFER_LENGTH(wp->pipe_event->output) != 0)
+		if (window_pane_pipe_queued(wp) != 0)
 			return (0);
 		if (ioctl(wp->fd, FIONREAD, &n) != -1 && n > 0)
 			return (0);
 	}
 
+	if (window_pane_input_backlog(wp) != 0)
+		return (0);
+
 	if (~wp->flags & PANE_EXITED)
 		return (0);
 	return (1);
@@ -477,6 +617,7 @@ window_set_active_pane(struct window *w, struct window_pane *wp, int notify)
 	w->active = wp;
 	w->active->active_point = next_active_point++;
 	w->active->flags |= PANE_CHANGED;
+	window_queue_check(w);
 
 	tty_update_window_offset(w);
 
@@ -699,6 +840,7 @@ window_lost_pane(struct window *w, struct window_pane *wp)
 		}
 		if (w->active != NULL) {
 			w->active->flags |= PANE_CHANGED;
+			window_queue_check(w);
 			notify_window("window-pane-changed", w);
 		}
 	} else if (wp == w->last)
@@ -709,6 +851,7 @@ void
 window_remove_pane(struct window *w, struct window_pane *wp)
 {
 	window_lost_pane(w, wp);
+	screen_redraw_free_borders(w);
 
 	TAILQ_REMOVE(&w->panes, wp, entry);
 	window_pane_destroy(wp);
@@ -786,6 +929,7 @@ window_destroy_panes(struct window *w)
 {
 	struct window_pane	*wp;
 
+	screen_redraw_free_borders(w);
 	while (!TAILQ_EMPTY(&w->panes)) {
 		wp = TAILQ_FIRST(&w->panes);
 		TAILQ_REMOVE(&w->panes, wp, entry);
@@ -846,6 +990,43 @@ window_pane_find_by_id(u_int id)
 	return (RB_FIND(window_pane_tree, &all_window_panes, &wp));
 }
 
+/*
+ * Find the pane with a pty, preferring one which is still running. The same
+ * pty may be reused by a new pane while a dead pane that had it remains.
+ */
+struct window_pane *
+window_pane_find_by_tty(const char *tty)
+{
+	struct window_pane	 find, *wp, *found = NULL;
+
+	if (*tty == '\0')
+		return (NULL);
+	if (strlcpy(find.tty, tty, sizeof find.tty) >= sizeof find.tty)
+		return (NULL);
+	find.id = 0;
+
+	wp = RB_NFIND(window_pane_ttys, &all_window_pane_ttys, &find);
+	while (wp != NULL && strcmp(wp->tty, tty) == 0) {
+		if (wp->fd != -1)
+			return (wp);
+		if (found == NULL)
+			found = wp;
+		wp = RB_NEXT(window_pane_ttys, &all_window_pane_ttys, wp);
+	}
+	return (found);
+}
+
+/* Set the pty for a pane after it is started. */
+void
+window_pane_set_tty(struct window_pane *wp, const char *tty)
+{
+	if (*wp->tty != '\0')
+		RB_REMOVE(window_pane_ttys, &all_window_pane_ttys, wp);
+	strlcpy(wp->tty, tty, sizeof wp->tty);
+	if (*wp->tty != '\0')
+		RB_INSERT(window_pane_ttys, &all_window_pane_ttys, wp);
+}
+
 static struct window_pane *
 window_pane_create(struct window *w, u_int sx, u_int sy, u_int hlimit)
 {
@@ -866,6 +1047,7 @@ window_pane_create(struct window *w, u_int sx, u_int sy, u_int hlimit)
 	wp->bg = 8;
 
 	TAILQ_INIT(&wp->modes);
+	TAILQ_INIT(&wp->pastes);
 
 	TAILQ_INIT (&wp->resize_queue);
 
@@ -875,6 +1057,7 @@ window_pane_create(struct window *w, u_int sx, u_int sy, u_int hlimit)
 	wp->pipe_fd = -1;
 
 	screen_init(&wp->base, sx, sy, hlimit);
+	wp->base.grid->flags |= GRID_LAZYREFLOW;
 	wp->screen = &wp->base;
 
 	screen_init(&wp->status_screen, 1, 1, 0);
@@ -892,12 +1075,19 @@ window_pane_destroy(struct window_pane *wp)
 	struct window_pane_resize	*r1;
 
 	window_pane_reset_mode_all(wp);
+	window_pane_unqueue_check(wp);
 	free(wp->searchstr);
+	free(wp->proc_name);
+	free(wp->proc_cwd);
+	control_free_chunks(wp);
+	paste_pane_cancel(wp);
+	window_pane_splice_stop(wp);
 
 	if (wp->fd != -1) {
 #ifdef HAVE_UTEMPTER
 		utempter_remove_record(wp->fd);
 #endif
+		event_del(&wp->read_event);
 		bufferevent_free(wp->event);
 		close(wp->fd);
 	}
@@ -905,6 +1095,7 @@ window_pane_destroy(struct window_pane *wp)
 		input_free(wp->ictx);
 
 	screen_free(&wp->status_screen);
+	free(wp->status_text);
 
 	screen_free(&wp->base);
 
@@ -915,18 +1106,29 @@ window_pane_destroy(struct window_pane *wp)
 
 	if (event_initialized(&wp->resize_timer))
 		event_del(&wp->resize_timer);
+	if (event_initialized(&wp->reflow_timer))
+		event_del(&wp->reflow_timer);
+	if (event_initialized(&wp->scroll_timer))
+		event_del(&wp->scroll_timer);
+	free(wp->damage);
 	TAILQ_FOREACH_SAFE(r, &wp->resize_queue, entry, r1) {
 		TAILQ_REMOVE(&wp->resize_queue, r, entry);
 		free(r);
 	}
 
 	RB_REMOVE(window_pane_tree, &all_window_panes, wp);
+	if (*wp->tty != '\0')
+		RB_REMOVE(window_pane_ttys, &all_window_pane_ttys, wp);
 
 	options_free(wp->options);
 	free((void *)wp->cwd);
 	free(wp->shell);
 	cmd_free_argv(wp->argc, wp->argv);
+	if (wp->palette != NULL)
+		window_pane_palette_changed(wp);
 	free(wp->palette);
+	free(wp->drawn);
+	free(wp->redraw_lines);
 	free(wp);
 }
 
@@ -935,27 +1137,33 @@ window_pane_read_callback(__unused struct bufferevent *bufev, void *data)
 {
 	struct window_pane		*wp = data;
 	struct evbuffer			*evb = wp->event->input;
-	struct window_pane_offset	*wpo = &wp->pipe_offset;
 	size_t				 size = EVBUFFER_LENGTH(evb);
-	char				*new_data;
-	size_t				 new_size;
 	struct client			*c;
 
-	if (wp->pipe_fd != -1) {
-		new_data = window_pane_get_new_data(wp, wpo, &new_size);
-		if (new_size > 0) {
-			bufferevent_write(wp->pipe_event, new_data, new_size);
-			window_pane_update_used_data(wp, wpo, new_size);
-		}
-	}
+	window_pane_queue_check(wp);
+	wp->proc_time = 0;
+	window_pane_pipe_write(wp);
 
-	log_debug("%%%u has %zu bytes", wp->id, size);
+	trace_event(TRACE_PANE_DATA, wp->id, size, 0);
 	TAILQ_FOREACH(c, &clients, entry) {
 		if (c->session != NULL && (c->flags & CLIENT_CONTROL))
 			control_write_output(c, wp);
 	}
 	input_parse_pane(wp);
-	bufferevent_disable(wp->event, EV_READ);
+	TAILQ_FOREACH(c, &clients, entry) {
+		if (c->session != NULL && (c->flags & CLIENT_CONTROL))
+			control_write_lines(c, wp);
+	}
+	window_pane_set_reading(wp, 0);
+}
+
+static void
+window_pane_write_callback(__unused struct bufferevent *bufev, void *data)
+{
+	struct window_pane	*wp = data;
+
+	if (!TAILQ_EMPTY(&wp->pastes))
+		paste_pane_continue(wp);
 }
 
 static void
@@ -971,16 +1179,281 @@ window_pane_error_callback(__unused struct bufferevent *bufev,
 		server_destroy_pane(wp, 1);
 }
 
+/*
+ * Pane pty is readable. Read until there is nothing left or pane-read-size
+ * has been read, rather than once like the bufferevent, so a pane with a lot
+ * of output needs fewer trips round the event loop. The pty returns at most a
+ * few kilobytes each time on some platforms, so several reads may be needed.
+ */
+static void
+window_pane_pty_read_callback(__unused int fd, __unused short events,
+    void *arg)
+{
+	struct window_pane	*wp = arg;
+	struct evbuffer		*evb = wp->event->input;
+	struct evbuffer_iovec	 v[2];
+	struct iovec		 iov[2];
+	size_t			 size, total = 0;
+	ssize_t			 n = 0;
+	int			 i, nv;
+
+	wp->reading = 0;
+	size = options_get_number(global_options, "pane-read-size");
+
+	/* The bufferevent keeps the end of its input frozen outside reads. */
+	evbuffer_unfreeze(evb, 0);
+	while (total < size) {
+		nv = evbuffer_reserve_space(evb, size - total, v, 2);
+		if (nv <= 0)
+			fatalx("out of memory");
+		for (i = 0; i < nv; i++) {
+			iov[i].iov_base = v[i].iov_base;
+			iov[i].iov_len = v[i].iov_len;
+		}
+		n = readv(wp->fd, iov, nv);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		wp->reads++;
+		total += n;
+
+		for (i = 0; i < nv; i++) {
+			if ((size_t)n < v[i].iov_len)
+				v[i].iov_len = n;
+			n -= v[i].iov_len;
+		}
+		if (evbuffer_commit_space(evb, v, nv) != 0)
+			fatalx("out of memory");
+		n = 1;
+	}
+	evbuffer_freeze(evb, 0);
+	wp->read_bytes += total;
+	trace_event(TRACE_PANE_READ, wp->id, total, wp->reads);
+
+	if (total != 0)
+		window_pane_read_callback(wp->event, wp);
+	if (n == 0 || (n == -1 && errno != EAGAIN)) {
+		window_pane_set_reading(wp, 0);
+		window_pane_error_callback(wp->event,
+		    BEV_EVENT_READING|(n == 0 ? BEV_EVENT_EOF : BEV_EVENT_ERROR),
+		    wp);
+	} else if (total == 0)
+		window_pane_set_reading(wp, 1);
+}
+
 void
 window_pane_set_event(struct window_pane *wp)
 {
 	setblocking(wp->fd, 0);
 
 	wp->event = bufferevent_new(wp->fd, window_pane_read_callback,
-	    NULL, window_pane_error_callback, wp);
+	    window_pane_write_callback, window_pane_error_callback, wp);
 	wp->ictx = input_init(wp, wp->event);
 
-	bufferevent_enable(wp->event, EV_READ|EV_WRITE);
+	event_set(&wp->read_event, wp->fd, EV_READ,
+	    window_pane_pty_read_callback, wp);
+	wp->reading = 0;
+
+	bufferevent_enable(wp->event, EV_WRITE);
+	window_pane_set_reading(wp, 1);
+}
+
+/* Is this pane's window current for any client? */
+static int
+window_pane_shown(struct window_pane *wp)
+{
+	struct client	*c;
+
+	TAILQ_FOREACH(c, &clients, entry) {
+		if (c->session != NULL &&
+		    c->session->curw->window == wp->window)
+			return (1);
+	}
+	return (0);
+}
+
+/*
+ * Reflow another batch of pane history left over from a resize. This stops if
+ * the pane is not in the current window of any client and is restarted by
+ * window_pane_start_reflow when it is.
+ */
+static void
+window_pane_reflow_callback(__unused int fd, __unused short events, void *arg)
+{
+	struct window_pane	*wp = arg;
+	struct timeval		 tv = { .tv_usec = 1000 };
+
+	if (!window_pane_shown(wp)) {
+		log_debug("%s: %%%u not shown", __func__, wp->id);
+		return;
+	}
+	if (grid_reflow_pending(wp->base.grid, 0) != 0)
+		evtimer_add(&wp->reflow_timer, &tv);
+}
+
+/*
+ * Start reflowing pane history left over from a resize, after the reflow-delay
+ * option if the pane has just been resized (restarting the delay if it is
+ * still being resized) or immediately otherwise.
+ */
+void
+window_pane_start_reflow(struct window_pane *wp, int resized)
+{
+	struct timeval	tv = { .tv_usec = 1000 };
+	u_int		delay;
+
+	if (wp->base.grid->hpending == 0)
+		return;
+	if (!event_initialized(&wp->reflow_timer))
+		evtimer_set(&wp->reflow_timer, window_pane_reflow_callback, wp);
+	else if (!resized && evtimer_pending(&wp->reflow_timer, NULL))
+		return;
+
+	if (resized) {
+		delay = options_get_number(global_options, "reflow-delay");
+		tv.tv_sec = delay / 1000;
+		tv.tv_usec = (delay % 1000) * 1000L;
+	}
+	evtimer_add(&wp->reflow_timer, &tv);
+}
+
+static void
+window_pane_scroll_callback(__unused int fd, __unused short events, void *arg)
+{
+	struct window_pane	*wp = arg;
+
+	wp->flags |= PANE_DAMAGED;
+}
+
+/*
+ * Check if a pane is scrolling or updating lines faster than the
+ * scroll-redraw-rate option. If it is, the caller stops sending its output to
+ * terminals and instead marks the lines it changes as damaged; they are
+ * redrawn at most once every WINDOW_PANE_SCROLL_REDRAW milliseconds. The rate
+ * is measured over WINDOW_PANE_SCROLL_PERIOD milliseconds.
+ */
+int
+window_pane_scroll_coalesce(struct window_pane *wp)
+{
+	struct timeval	tv = { .tv_usec = WINDOW_PANE_SCROLL_REDRAW * 1000 };
+	uint64_t	now, elapsed;
+	u_int		rate;
+
+	rate = options_get_number(wp->options, "scroll-redraw-rate");
+	if (rate == 0) {
+		wp->scroll_fast = 0;
+		return (0);
+	}
+
+	now = get_timer();
+	elapsed = now - wp->scroll_time;
+	if (elapsed >= WINDOW_PANE_SCROLL_PERIOD) {
+		wp->scroll_fast = (wp->scroll_lines * 1000ULL / elapsed >= rate);
+		if (wp->scroll_fast) {
+			log_debug("%s: %%%u scrolled %u lines in %llu ms",
+			    __func__, wp->id, wp->scroll_lines,
+			    (unsigned long long)elapsed);
+		}
+		wp->scroll_lines = 0;
+		wp->scroll_time = now;
+	}
+	if (!wp->scroll_fast)
+		return (0);
+
+	if (!event_initialized(&wp->scroll_timer))
+		evtimer_set(&wp->scroll_timer, window_pane_scroll_callback, wp);
+	if (!evtimer_pending(&wp->scroll_timer, NULL))
+		evtimer_add(&wp->scroll_timer, &tv);
+	return (1);
+}
+
+/* Mark lines of a pane as damaged so they are redrawn. */
+void
+window_pane_damage(struct window_pane *wp, u_int py, u_int ny)
+{
+	if (wp->damage == NULL || wp->damage_size != wp->sy) {
+		free(wp->damage);
+		if ((wp->damage = bit_alloc(wp->sy)) == NULL)
+			fatal("bit_alloc failed");
+		wp->damage_size = wp->sy;
+	}
+	if (py >= wp->damage_size || ny == 0)
+		return;
+	if (ny > wp->damage_size - py)
+		ny = wp->damage_size - py;
+	bit_nset(wp->damage, py, py + ny - 1);
+}
+
+/*
+ * Forget how lines of a pane were last drawn, because they have been changed
+ * on terminals by something other than a redraw.
+ */
+void
+window_pane_forget_lines(struct window_pane *wp, u_int py, u_int ny)
+{
+	if (wp->drawn == NULL || py >= wp->drawn_size || ny == 0)
+		return;
+	if (ny > wp->drawn_size - py)
+		ny = wp->drawn_size - py;
+	memset(wp->drawn + py, 0, ny * sizeof *wp->drawn);
+}
+
+/*
+ * Work out which lines of a pane need to be redrawn, which are those that are
+ * not the same as when they were last drawn. This is done once in each loop
+ * and the same lines redrawn on every client which saw the last redraw.
+ */
+bitstr_t *
+window_pane_redraw_lines(struct window_pane *wp, u_int *count)
+{
+	struct screen		*s = wp->screen;
+	struct grid		*gd = s->grid;
+	struct grid_cell	 defaults;
+	uint64_t		 hash;
+	u_int			 y;
+
+	if (wp->flags & PANE_REDRAWLINES) {
+		*count = wp->redraw_count;
+		return (wp->redraw_lines);
+	}
+	wp->flags |= PANE_REDRAWLINES;
+
+	if (wp->drawn == NULL || wp->drawn_size != wp->sy) {
+		free(wp->drawn);
+		wp->drawn = xcalloc(wp->sy, sizeof *wp->drawn);
+		free(wp->redraw_lines);
+		if ((wp->redraw_lines = bit_alloc(wp->sy)) == NULL)
+			fatal("bit_alloc failed");
+		wp->drawn_size = wp->sy;
+	}
+
+	/* If the default colours have changed, every line looks different. */
+	tty_default_colours(&defaults, wp);
+	if (!grid_cells_equal(&defaults, &wp->drawn_defaults)) {
+		window_pane_forget_lines(wp, 0, wp->drawn_size);
+		memcpy(&wp->drawn_defaults, &defaults, sizeof defaults);
+	}
+
+	wp->redraw_count = 0;
+	for (y = 0; y < wp->drawn_size; y++) {
+		if (y < screen_size_y(s))
+			hash = grid_hash_line(gd, gd->hsize + y);
+		else
+			hash = 0;
+		if (hash != 0 && hash == wp->drawn[y]) {
+			bit_clear(wp->redraw_lines, y);
+			continue;
+		}
+		wp->drawn[y] = hash;
+		bit_set(wp->redraw_lines, y);
+		wp->redraw_count++;
+	}
+	log_debug("%s: %%%u has %u of %u lines changed", __func__, wp->id,
+	    wp->redraw_count, wp->drawn_size);
+
+	*count = wp->redraw_count;
+	return (wp->redraw_lines);
 }
 
 void
@@ -991,6 +1464,7 @@ window_pane_resize(struct window_pane *wp, u_int sx, u_int sy)
 
 	if (sx == wp->sx && sy == wp->sy)
 		return;
+	screen_redraw_free_borders(wp->window);
 
 	r = xmalloc (sizeof *r);
 	r->sx = sx;
@@ -998,18 +1472,35 @@ window_pane_resize(struct window_pane *wp, u_int sx, u_int sy)
 	r->osx = wp->sx;
 	r->osy = wp->sy;
 	TAILQ_INSERT_TAIL (&wp->resize_queue, r, entry);
+	window_pane_queue_check(wp);
 
 	wp->sx = sx;
 	wp->sy = sy;
 
 	log_debug("%s: %%%u resize %ux%u", __func__, wp->id, sx, sy);
 	screen_resize(&wp->base, sx, sy, wp->base.saved_grid == NULL);
+	window_pane_start_reflow(wp, 1);
 
 	wme = TAILQ_FIRST(&wp->modes);
 	if (wme != NULL && wme->mode->resize != NULL)
 		wme->mode->resize(wme, sx, sy);
 }
 
+/*
+ * The palette has changed, so cells drawn on any terminal with the old palette
+ * may no longer match what the pane would draw.
+ */
+static void
+window_pane_palette_changed(struct window_pane *wp)
+{
+	struct client	*c;
+
+	TAILQ_FOREACH(c, &clients, entry)
+		tty_invalidate_shadow(&c->tty);
+	window_pane_forget_lines(wp, 0, wp->drawn_size);
+	wp->flags |= PANE_REDRAW;
+}
+
 void
 window_pane_set_palette(struct window_pane *wp, u_int n, int colour)
 {
@@ -1020,7 +1511,7 @@ window_pane_set_palette(struct window_pane *wp, u_int n, int colour)
 		wp->palette = xcalloc(0x100, sizeof *wp->palette);
 
 	wp->palette[n] = colour;
-	wp->flags |= PANE_REDRAW;
+	window_pane_palette_changed(wp);
 }
 
 void
@@ -1030,7 +1521,7 @@ window_pane_unset_palette(struct window_pane *wp, u_int n)
 		return;
 
 	wp->palette[n] = 0;
-	wp->flags |= PANE_REDRAW;
+	window_pane_palette_changed(wp);
 }
 
 void
@@ -1041,7 +1532,7 @@ window_pane_reset_palette(struct window_pane *wp)
 
 	free(wp->palette);
 	wp->palette = NULL;
-	wp->flags |= PANE_REDRAW;
+	window_pane_palette_changed(wp);
 }
 
 int
@@ -1093,6 +1584,7 @@ window_pane_set_mode(struct window_pane *wp, struct window_pane *swp,
 
 	wp->screen = wme->screen;
 	wp->flags |= (PANE_REDRAW|PANE_CHANGED);
+	window_queue_check(wp->window);
 
 	server_redraw_window_borders(wp->window);
 	server_status_window(wp->window);
@@ -1125,6 +1617,7 @@ window_pane_reset_mode(struct window_pane *wp)
 			next->mode->resize(next, wp->sx, wp->sy);
 	}
 	wp->flags |= (PANE_REDRAW|PANE_CHANGED);
+	window_queue_check(wp->window);
 
 	server_redraw_window_borders(wp->window);
 	server_status_window(wp->window);
@@ -1138,19 +1631,87 @@ window_pane_reset_mode_all(struct window_pane *wp)
 		window_pane_reset_mode(wp);
 }
 
-static void
-window_pane_copy_key(struct window_pane *wp, key_code key)
+/* Should a key typed in one pane be copied to another? */
+static int
+window_pane_copy_target(struct window_pane *wp, struct window_pane *loop,
+    int sync, const char *group)
+{
+	const char	*value;
+
+	if (loop == wp ||
+	    !TAILQ_EMPTY(&loop->modes) ||
+	    loop->fd == -1 ||
+	    (loop->flags & PANE_INPUTOFF) ||
+	    !window_pane_visible(loop))
+		return (0);
+	if (sync &&
+	    loop->window == wp->window &&
+	    options_get_number(loop->options, "synchronize-panes"))
+		return (1);
+	if (*group == '\0')
+		return (0);
+	value = options_get_string(loop->options, "synchronize-group");
+	return (strcmp(value, group) == 0);
+}
+
+/* Get the next pane after loop (or the first if NULL) to copy a key to. */
+static struct window_pane *
+window_pane_copy_next(struct window_pane *wp, struct window_pane *loop,
+    int sync, const char *group)
 {
- 	struct window_pane	*loop;
+	struct window_pane_tree	*tree = &all_window_panes;
 
-	TAILQ_FOREACH(loop, &wp->window->panes, entry) {
-		if (loop != wp &&
-		    TAILQ_EMPTY(&loop->modes) &&
-		    loop->fd != -1 &&
-		    (~loop->flags & PANE_INPUTOFF) &&
-		    window_pane_visible(loop) &&
-		    options_get_number(loop->options, "synchronize-panes"))
-			input_key_pane(loop, key, NULL);
+	do {
+		if (*group != '\0') {
+			if (loop == NULL)
+				loop = RB_MIN(window_pane_tree, tree);
+			else
+				loop = RB_NEXT(window_pane_tree, tree, loop);
+		} else {
+			if (loop == NULL)
+				loop = TAILQ_FIRST(&wp->window->panes);
+			else
+				loop = TAILQ_NEXT(loop, entry);
+		}
+	} while (loop != NULL &&
+	    !window_pane_copy_target(wp, loop, sync, group));
+	return (loop);
+}
+
+/*
+ * Copy a key to the other panes in the window with synchronize-panes and to
+ * panes in any window with the same synchronize-group. The key is translated
+ * once for each set of key modes in use rather than once for every pane.
+ */
+static void
+window_pane_copy_key(struct window_pane *wp, key_code key, int sync,
+    const char *group)
+{
+	struct window_pane	*loop = NULL;
+	struct window_pane_copy {
+		int	mode;
+		int	error;
+		char	buf[INPUT_KEY_SIZE];
+		size_t	len;
+	}			 cache[8], *ce;
+	u_int			 ncache = 0, i;
+	int			 mode;
+
+	while ((loop = window_pane_copy_next(wp, loop, sync, group)) != NULL) {
+		mode = loop->screen->mode & KEY_MODES;
+		for (i = 0; i < ncache; i++) {
+			if (cache[i].mode == mode)
+				break;
+		}
+		ce = &cache[i];
+		if (i == ncache) {
+			ce->mode = mode;
+			ce->error = input_key_translate(mode, key, ce->buf,
+			    &ce->len);
+			ncache++;
+		}
+		if (ce->error == 0 && ce->len != 0)
+			bufferevent_write(loop->event, ce->buf, ce->len);
 	}
 }
 
@@ -1159,6 +1720,8 @@ window_pane_key(struct window_pane *wp, struct client *c, struct session *s,
     struct winlink *wl, key_code key, struct mouse_event *m)
 {
 	struct window_mode_entry	*wme;
+	const char			*group;
+	int				 sync;
 
 	if (KEYC_IS_MOUSE(key) && m == NULL)
 		return (-1);
@@ -1175,16 +1738,71 @@ window_pane_key(struct window_pane *wp, struct client *c, struct session *s,
 	if (wp->fd == -1 || wp->flags & PANE_INPUTOFF)
 		return (0);
 
+	/* A key pressed during a paste cancels the rest of it. */
+	if (!KEYC_IS_MOUSE(key))
+		paste_pane_cancel(wp);
+
 	if (input_key_pane(wp, key, m) != 0)
 		return (-1);
 
 	if (KEYC_IS_MOUSE(key))
 		return (0);
-	if (options_get_number(wp->options, "synchronize-panes"))
-		window_pane_copy_key(wp, key);
+	sync = options_get_number(wp->options, "synchronize-panes");
+	group = options_get_string(wp->options, "synchronize-group");
+	if (sync || *group != '\0')
+		window_pane_copy_key(wp, key, sync, group);
 	return (0);
 }
 
+/*
+ * Write a string of literal keys to a pane which is not in a mode. This is
+ * the same as passing each UTF-8 character to window_pane_key but is written
+ * to the pane (and any it is synchronized with) all at once.
+ */
+void
+window_pane_key_literal(struct window_pane *wp, const char *s)
+{
+	struct window_pane	*loop = NULL;
+	struct utf8_data	*ud, *uloop;
+	utf8_char		 uc;
+	const char		*group;
+	char			*buf;
+	size_t			 len = 0;
+	int			 sync;
+
+	if (wp->fd == -1 || wp->flags & PANE_INPUTOFF)
+		return;
+
+	buf = xmalloc(strlen(s) + 1);
+	ud = utf8_fromcstr(s);
+	for (uloop = ud; uloop->size != 0; uloop++) {
+		if (uloop->size != 1 || uloop->data[0] > 0x7f) {
+			if (utf8_from_data(uloop, &uc) != UTF8_DONE)
+				continue;
+		}
+		memcpy(buf + len, uloop->data, uloop->size);
+		len += uloop->size;
+	}
+	free(ud);
+	if (len == 0) {
+		free(buf);
+		return;
+	}
+	log_debug("writing %zu literal bytes to %%%u", len, wp->id);
+
+	paste_pane_cancel(wp);
+	bufferevent_write(wp->event, buf, len);
+
+	sync = options_get_number(wp->options, "synchronize-panes");
+	group = options_get_string(wp->options, "synchronize-group");
+	if (sync || *group != '\0') {
+		while ((loop = window_pane_copy_next(wp, loop, sync,
+		    group)) != NULL)
+			bufferevent_write(loop->event, buf, len);
+	}
+	free(buf);
+}
+
 int
 window_pane_visible(struct window_pane *wp)
 {
@@ -1193,48 +1811,209 @@ window_pane_visible(struct window_pane *wp)
 	return (wp == wp->window->active);
 }
 
+/*
+ * Check the cached foreground process name and working directory. They are
+ * looked up again if the foreground process group has changed, if the pane
+ * has had output since (a shell prints a prompt after cd), or if they are
+ * older than PANE_PROC_INTERVAL. A new process group may not have called
+ * exec yet, so nothing is kept until it has been there for a while.
+ */
+static void
+window_pane_check_proc(struct window_pane *wp)
+{
+	pid_t		pgrp = -1;
+	uint64_t	now;
+
+	if (wp->fd != -1)
+		pgrp = tcgetpgrp(wp->fd);
+	now = get_timer();
+	if (pgrp != wp->proc_pgrp) {
+		wp->proc_pgrp = pgrp;
+		wp->proc_since = now;
+	} else if (now - wp->proc_since >= PANE_PROC_INTERVAL &&
+	    now - wp->proc_time < PANE_PROC_INTERVAL)
+		return;
+
+	free(wp->proc_name);
+	wp->proc_name = NULL;
+	free(wp->proc_cwd);
+	wp->proc_cwd = NULL;
+	wp->proc_flags = 0;
+
+	wp->proc_time = now;
+}
+
+/* Get the name of the foreground process in a pane. */
+const char *
+window_pane_get_proc_name(struct window_pane *wp)
+{
+	window_pane_check_proc(wp);
+	if (~wp->proc_flags & PANE_PROC_NAME) {
+		if (wp->proc_pgrp != -1)
+			wp->proc_name = osdep_get_name(wp->fd, wp->tty);
+		wp->proc_flags |= PANE_PROC_NAME;
+	}
+	return (wp->proc_name);
+}
+
+/* Get the working directory of the foreground process in a pane. */
+const char *
+window_pane_get_proc_cwd(struct window_pane *wp)
+{
+	const char	*cwd;
+
+	window_pane_check_proc(wp);
+	if (~wp->proc_flags & PANE_PROC_CWD) {
+		if (wp->fd != -1 && (cwd = osdep_get_cwd(wp->fd)) != NULL)
+			wp->proc_cwd = xstrdup(cwd);
+		wp->proc_flags |= PANE_PROC_CWD;
+	}
+	return (wp->proc_cwd);
+}
+
+/* Has the foreground process been there long enough to be kept? */
+int
+window_pane_proc_settled(struct window_pane *wp)
+{
+	if (wp->proc_pgrp == -1)
+		return (1);
+	return (get_timer() - wp->proc_since >= PANE_PROC_INTERVAL);
+}
+
+/* Get the amount of pane input read but not yet parsed. */
+size_t
+window_pane_input_backlog(struct window_pane *wp)
+{
+	if (wp->event == NULL)
+		return (0);
+	return (window_pane_get_new_size(wp, &wp->offset));
+}
+
+/*
+ * Give each pane with input left over from an earlier read another turn at
+ * parsing it. Returns 1 if any still have some left.
+ */
+int
+window_pane_parse_backlog(void)
+{
+	struct window_pane	*wp, *wp1;
+	int			 left = 0;
+
+	/* Panes with input left are kept queued for checks until it is gone. */
+	TAILQ_FOREACH_SAFE(wp, &window_pane_checks, check_entry, wp1) {
+		if (window_pane_input_backlog(wp) == 0)
+			continue;
+		if (input_parse_pane(wp) != 0)
+			left = 1;
+		else if (window_pane_destroy_ready(wp))
+			server_destroy_pane(wp, 1);
+	}
+	return (left);
+}
+
+/* Work out the memory used by a pane's grids and pending input. */
+void
+window_pane_memory(struct window_pane *wp, struct window_pane_memory *wpm)
+{
+	struct grid	*gd[] = { wp->base.grid, wp->base.saved_grid };
+	u_int		 i;
+
+	memset(wpm, 0, sizeof *wpm);
+	for (i = 0; i < nitems(gd); i++) {
+		if (gd[i] == NULL)
+			continue;
+		wpm->cells += gd[i]->cellbytes;
+		wpm->extended += gd[i]->extdbytes;
+		wpm->packed += gd[i]->packbytes;
+		wpm->headers += (gd[i]->hsize + gd[i]->sy) *
+		    sizeof (struct grid_line);
+		wpm->styles += grid_styles_size(gd[i]);
+	}
+	if (wp->event != NULL)
+		wpm->input = EVBUFFER_LENGTH(wp->event->input);
+
+	wpm->total = wpm->cells + wpm->extended + wpm->packed + wpm->headers +
+	    wpm->styles + wpm->input;
+}
+
+/*
+ * Put the text of a visible line into a buffer kept between searches, without
+ * trailing spaces.
+ */
+static const char *
+window_pane_search_line(struct screen *s, u_int py)
+{
+	static char	*buf;
+	static size_t	 size;
+	struct grid	*gd = s->grid;
+	size_t		 off;
+	u_int		 sx = screen_size_x(s);
+
+	if (size < sx * UTF8_SIZE + 1) {
+		size = sx * UTF8_SIZE + 1;
+		buf = xrealloc(buf, size);
+	}
+	off = grid_string_text(gd, 0, gd->hsize + py, sx, buf, 0);
+	while (off > 0 && isspace((u_char)buf[off - 1]))
+		off--;
+	buf[off] = '\0';
+	return (buf);
+}
+
+/*
+ * Search the visible lines of a pane. A term with no pattern characters is
+ * searched for as a string rather than with fnmatch; ignoring case this is
+ * only done for ASCII, so the case folding is the same.
+ */
 u_int
 window_pane_search(struct window_pane *wp, const char *term, int regex,
     int ignore)
 {
 	struct screen	*s = &wp->base;
-	regex_t		 r;
-	char		*new = NULL, *line;
+	const regex_t	*r = NULL;
+	const char	*line, *cp;
+	char		*new = NULL;
 	u_int		 i;
-	int		 flags = 0, found;
-	size_t		 n;
+	int		 flags = 0, found, plain = 0;
 
 	if (!regex) {
-		if (ignore)
-			flags |= FNM_CASEFOLD;
-		xasprintf(&new, "*%s*", term);
+		if (strpbrk(term, "*?[\\") == NULL) {
+			plain = 1;
+			for (cp = term; ignore && *cp != '\0'; cp++) {
+				if ((u_char)*cp > 0x7f) {
+					plain = 0;
+					break;
+				}
+			}
+		}
+		if (!plain) {
+			if (ignore)
+				flags |= FNM_CASEFOLD;
+			xasprintf(&new, "*%s*", term);
+		}
 	} else {
 		if (ignore)
 			flags |= REG_ICASE;
-		if (regcomp(&r, term, flags|REG_EXTENDED) != 0)
+		r = regsub_compile(term, flags|REG_EXTENDED);
+		if (r == NULL)
 			return (0);
 	}
 
 	for (i = 0; i < screen_size_y(s); i++) {
-		line = grid_view_string_cells(s->grid, 0, i, screen_size_x(s));
-		for (n = strlen(line); n > 0; n--) {
-			if (!isspace((u_char)line[n - 1]))
-				break;
-			line[n - 1] = '\0';
-		}
+		line = window_pane_search_line(s, i);
 		log_debug("%s: %s", __func__, line);
-		if (!regex)
+		if (plain && ignore)
+			found = (strcasestr(line, term) != NULL);
+		else if (plain)
+			found = (strstr(line, term) != NULL);
+		else if (!regex)
 			found = (fnmatch(new, line, flags) == 0);
 		else
-			found = (regexec(&r, line, 0, NULL, 0) == 0);
-		free(line);
+			found = (regexec(r, line, 0, NULL, 0) == 0);
 		if (found)
 			break;
 	}
-	if (!regex)
-		free(new);
-	else
-		regfree(&r);
+	free(new);
 
 	if (i == screen_size_y(s))
 		return (0);
@@ -1567,14 +2346,417 @@ window_pane_start_input(struct window_pane *wp, struct cmdq_item *item,
 	return (0);
 }
 
+size_t
+window_pane_get_new_size(struct window_pane *wp,
+    struct window_pane_offset *wpo)
+{
+	size_t	used = wpo->used - wp->base_offset;
+
+	return (EVBUFFER_LENGTH(wp->event->input) - used);
+}
+
+/*
+ * Write new pane output to the pipe (pipe-pane). No more than
+ * PANE_PIPE_HIGH is queued in the pipe's bufferevent; anything more is
+ * left in the pane's input buffer and the pane is marked as stalled, which
+ * stops it being read until the pipe has caught up. Output is thrown away if
+ * the pipe is only for input.
+ */
+void
+window_pane_pipe_write(struct window_pane *wp)
+{
+	struct window_pane_offset	*wpo = &wp->pipe_offset;
+	struct evbuffer			*out;
+	char				*new_data;
+	size_t				 new_size, space;
+	int				 writing;
+
+	if (wp->pipe_fd == -1)
+		return;
+	if (wp->pipe_splice != NULL) {
+		/* Already copied into the pipe by tee(2). */
+		while ((new_data = window_pane_peek_new_data(wp, wpo,
+		    &new_size)) != NULL)
+			window_pane_update_used_data(wp, wpo, new_size);
+		return;
+	}
+	out = wp->pipe_event->output;
+	writing = bufferevent_get_enabled(wp->pipe_event) & EV_WRITE;
+
+	while ((new_data = window_pane_peek_new_data(wp, wpo,
+	    &new_size)) != NULL) {
+		if (writing) {
+			if (EVBUFFER_LENGTH(out) >= PANE_PIPE_HIGH)
+				break;
+			space = PANE_PIPE_HIGH - EVBUFFER_LENGTH(out);
+			if (new_size > space)
+				new_size = space;
+			bufferevent_write(wp->pipe_event, new_data, new_size);
+			wp->pipe_written += new_size;
+		}
+		window_pane_update_used_data(wp, wpo, new_size);
+	}
+
+	if (new_data == NULL)
+		wp->flags &= ~PANE_PIPESTALLED;
+	else if (~wp->flags & PANE_PIPESTALLED) {
+		log_debug("%%%u pipe stalled", wp->id);
+		wp->flags |= PANE_PIPESTALLED;
+		wp->pipe_stalls++;
+	}
+}
+
+/* Get the amount of output waiting to be written to the pipe. */
+size_t
+window_pane_pipe_queued(struct window_pane *wp)
+{
+	size_t	queued;
+
+	if (wp->pipe_fd == -1)
+		return (0);
+	queued = EVBUFFER_LENGTH(wp->pipe_event->output);
+	if (wp->event != NULL)
+		queued += window_pane_get_new_size(wp, &wp->pipe_offset);
+	if (wp->pipe_splice != NULL)
+		queued += window_pane_splice_queued(wp->pipe_splice);
+	return (queued);
+}
+
+/* Start or stop reading from a pane. */
+void
+window_pane_set_reading(struct window_pane *wp, int on)
+{
+	struct window_pane_splice	*ws = wp->pipe_splice;
+
+	if (ws == NULL) {
+		if (on && !wp->reading)
+			event_add(&wp->read_event, NULL);
+		else if (!on && wp->reading)
+			event_del(&wp->read_event);
+		wp->reading = on;
+		return;
+	}
+	if (on && !ws->reading)
+		event_add(&ws->read_event, NULL);
+	else if (!on && ws->reading)
+		event_del(&ws->read_event);
+	ws->reading = on;
+}
+
+#if defined(HAVE_SPLICE) && defined(HAVE_TEE)
+/* Read a known amount from a pipe into a buffer. */
+static int
+window_pane_splice_read(struct evbuffer *evb, int fd, size_t size)
+{
+	struct evbuffer_iovec	v;
+	ssize_t			n;
+
+	while (size != 0) {
+		if (evbuffer_reserve_space(evb, size, &v, 1) != 1)
+			return (-1);
+		n = read(fd, v.iov_base, size);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (-1);
+		v.iov_len = n;
+		if (evbuffer_commit_space(evb, &v, 1) != 0)
+			return (-1);
+		size -= n;
+	}
+	return (0);
+}
+
+/* Get the amount of pane output waiting to be spliced into the pipe. */
+static size_t
+window_pane_splice_queued(struct window_pane_splice *ws)
+{
+	int	n;
+
+	if (ioctl(ws->out[0], FIONREAD, &n) == -1 || n < 0)
+		n = 0;
+	return (n + EVBUFFER_LENGTH(ws->pending));
+}
+
+/* Move anything waiting into the pipe. */
+static void
+window_pane_splice_flush(struct window_pane *wp)
+{
+	struct window_pane_splice	*ws = wp->pipe_splice;
+	ssize_t				 n;
+	int				 queued;
+
+	for (;;) {
+		if (ioctl(ws->out[0], FIONREAD, &queued) == -1)
+			queued = 0;
+		if (queued > 0) {
+			n = splice(ws->out[0], NULL, wp->pipe_fd, NULL, queued,
+			    SPLICE_F_NONBLOCK|SPLICE_F_MOVE);
+			if (n == -1 && errno == EINTR)
+				continue;
+			if (n == -1 && errno == EAGAIN) {
+				event_add(&ws->write_event, NULL);
+				return;
+			}
+			if (n <= 0) {
+				log_debug("%%%u splice failed", wp->id);
+				window_pane_splice_stop(wp);
+				return;
+			}
+			log_debug("%%%u spliced %zd to pipe", wp->id, n);
+			continue;
+		}
+
+		/* Output which could not be copied by tee(2) goes next. */
+		if (EVBUFFER_LENGTH(ws->pending) == 0)
+			break;
+		n = evbuffer_write(ws->pending, ws->out[1]);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			window_pane_splice_stop(wp);
+			return;
+		}
+	}
+
+	if (wp->flags & PANE_PIPESTALLED) {
+		log_debug("%%%u pipe no longer stalled", wp->id);
+		wp->flags &= ~PANE_PIPESTALLED;
+	}
+}
+
+/* Pipe-pane socket is writable. */
+static void
+window_pane_splice_write_callback(__unused int fd, __unused short events,
+    void *arg)
+{
+	struct window_pane	*wp = arg;
+
+	window_pane_splice_flush(wp);
+	if (window_pane_destroy_ready(wp))
+		server_destroy_pane(wp, 1);
+}
+
+/* Pane pty is readable: splice, tee and read the output. */
+static void
+window_pane_splice_read_callback(__unused int fd, __unused short events,
+    void *arg)
+{
+	struct window_pane		*wp = arg;
+	struct window_pane_splice	*ws = wp->pipe_splice;
+	struct evbuffer			*evb = wp->event->input;
+	struct evbuffer_ptr		 ptr;
+	size_t				 queued, space;
+	ssize_t				 n, t;
+	char				*buf;
+
+	ws->reading = 0;
+	window_pane_queue_check(wp);
+	wp->proc_time = 0;
+
+	queued = window_pane_splice_queued(ws);
+	if (EVBUFFER_LENGTH(ws->pending) != 0 || queued >= ws->size) {
+		if (~wp->flags & PANE_PIPESTALLED) {
+			log_debug("%%%u pipe stalled", wp->id);
+			wp->flags |= PANE_PIPESTALLED;
+			wp->pipe_stalls++;
+		}
+		return;
+	}
+	space = ws->size - queued;
+	if (space > WINDOW_PANE_SPLICE_READ)
+		space = WINDOW_PANE_SPLICE_READ;
+
+	n = splice(wp->fd, NULL, ws->in[1], NULL, space, SPLICE_F_NONBLOCK);
+	if (n == -1 && (errno == EINTR || errno == EAGAIN)) {
+		window_pane_set_reading(wp, 1);
+		return;
+	}
+	if (n <= 0) {
+		/* Let a normal read find the end of file or error. */
+		window_pane_splice_stop(wp);
+		window_pane_set_reading(wp, 1);
+		return;
+	}
+	wp->reads++;
+	wp->read_bytes += n;
+
+	t = tee(ws->in[0], ws->out[1], n, SPLICE_F_NONBLOCK);
+	if (t < 0)
+		t = 0;
+	/* The bufferevent keeps the end of its input frozen outside reads. */
+	evbuffer_unfreeze(evb, 0);
+	if (window_pane_splice_read(evb, ws->in[0], n) != 0)
+		fatal("read failed");
+	evbuffer_freeze(evb, 0);
+	wp->pipe_written += n;
+	log_debug("%%%u spliced %zd from pty, tee %zd", wp->id, n, t);
+
+	/*
+	 * tee(2) may not copy everything if the pipe has run out of pages
+	 * rather than space, so keep the rest to write to it later.
+	 */
+	if (t != n) {
+		evbuffer_ptr_set(evb, &ptr, EVBUFFER_LENGTH(evb) - (n - t),
+		    EVBUFFER_PTR_SET);
+		buf = xmalloc(n - t);
+		evbuffer_copyout_from(evb, &ptr, buf, n - t);
+		evbuffer_add(ws->pending, buf, n - t);
+		free(buf);
+	}
+
+	if (!event_pending(&ws->write_event, EV_WRITE, NULL))
+		window_pane_splice_flush(wp);
+	if (wp->pipe_splice != NULL)
+		window_pane_read_callback(wp->event, wp);
+}
+
+/*
+ * Start copying pane output to the pipe with splice(2) and tee(2). Returns -1
+ * if it is not possible and the output should be copied normally.
+ */
+int
+window_pane_splice_start(struct window_pane *wp)
+{
+	struct window_pane_splice	*ws;
+	struct window_pane_offset	*wpo = &wp->pipe_offset;
+	char				*new_data;
+	size_t				 new_size;
+	int				 size;
+
+	if (wp->fd == -1 || wp->event == NULL || wp->pipe_fd == -1)
+		return (-1);
+	if (~bufferevent_get_enabled(wp->pipe_event) & EV_WRITE)
+		return (-1);
+
+	ws = xcalloc(1, sizeof *ws);
+	if (pipe(ws->in) != 0) {
+		free(ws);
+		return (-1);
+	}
+	if (pipe(ws->out) != 0) {
+		close(ws->in[0]);
+		close(ws->in[1]);
+		free(ws);
+		return (-1);
+	}
+	fcntl(ws->out[1], F_SETPIPE_SZ, PANE_PIPE_HIGH);
+	if ((size = fcntl(ws->out[1], F_GETPIPE_SZ)) <= 0)
+		size = WINDOW_PANE_SPLICE_READ;
+	ws->size = size;
+	setblocking(ws->in[0], 0);
+	setblocking(ws->in[1], 0);
+	setblocking(ws->out[0], 0);
+	setblocking(ws->out[1], 0);
+	fcntl(ws->in[0], F_SETFD, FD_CLOEXEC);
+	fcntl(ws->in[1], F_SETFD, FD_CLOEXEC);
+	fcntl(ws->out[0], F_SETFD, FD_CLOEXEC);
+	fcntl(ws->out[1], F_SETFD, FD_CLOEXEC);
+
+	ws->pending = evbuffer_new();
+	if (ws->pending == NULL)
+		fatalx("out of memory");
+
+	/* Output read but not yet parsed goes into the pipe first. */
+	while ((new_data = window_pane_peek_new_data(wp, wpo,
+	    &new_size)) != NULL) {
+		evbuffer_add(ws->pending, new_data, new_size);
+		wp->pipe_written += new_size;
+		window_pane_update_used_data(wp, wpo, new_size);
+	}
+
+	event_set(&ws->read_event, wp->fd, EV_READ,
+	    window_pane_splice_read_callback, wp);
+	event_set(&ws->write_event, wp->pipe_fd, EV_WRITE,
+	    window_pane_splice_write_callback, wp);
+	window_pane_set_reading(wp, 0);
+	wp->pipe_splice = ws;
+	log_debug("%%%u splice started (pipe %zu)", wp->id, ws->size);
+
+	window_pane_set_reading(wp, 1);
+	window_pane_splice_flush(wp);
+	return (0);
+}
+
+/*
+ * Stop using splice(2). Anything still waiting is moved to the pipe's
+ * bufferevent.
+ */
+void
+window_pane_splice_stop(struct window_pane *wp)
+{
+	struct window_pane_splice	*ws = wp->pipe_splice;
+	int				 queued, reading;
+
+	if (ws == NULL)
+		return;
+	reading = ws->reading;
+	wp->pipe_splice = NULL;
+	log_debug("%%%u splice stopped", wp->id);
+
+	event_del(&ws->read_event);
+	event_del(&ws->write_event);
+
+	if (wp->pipe_fd != -1) {
+		if (ioctl(ws->out[0], FIONREAD, &queued) != -1 && queued > 0)
+			window_pane_splice_read(wp->pipe_event->output,
+			    ws->out[0], queued);
+		evbuffer_add_buffer(wp->pipe_event->output, ws->pending);
+	}
+	evbuffer_free(ws->pending);
+
+	close(ws->in[0]);
+	close(ws->in[1]);
+	close(ws->out[0]);
+	close(ws->out[1]);
+	free(ws);
+
+	wp->flags &= ~PANE_PIPESTALLED;
+	if (reading)
+		window_pane_set_reading(wp, 1);
+}
+#else
+static size_t
+window_pane_splice_queued(__unused struct window_pane_splice *ws)
+{
+	return (0);
+}
+
+int
+window_pane_splice_start(__unused struct window_pane *wp)
+{
+	return (-1);
+}
+
+void
+window_pane_splice_stop(__unused struct window_pane *wp)
+{
+}
+#endif
+
+/*
+ * Get the next piece of data after an offset. The buffer is not made
+ * contiguous, so this may be less than all the data after the offset and size
+ * is set to the size of this piece only.
+ */
 void *
-window_pane_get_new_data(struct window_pane *wp,
+window_pane_peek_new_data(struct window_pane *wp,
     struct window_pane_offset *wpo, size_t *size)
 {
-	size_t	used = wpo->used - wp->base_offset;
+	struct evbuffer		*evb = wp->event->input;
+	struct evbuffer_ptr	 ptr;
+	struct evbuffer_iovec	 v;
+	size_t			 used = wpo->used - wp->base_offset;
 
-	*size = EVBUFFER_LENGTH(wp->event->input) - used;
-	return (EVBUFFER_DATA(wp->event->input) + used);
+	*size = 0;
+	if (used >= EVBUFFER_LENGTH(evb))
+		return (NULL);
+	if (evbuffer_ptr_set(evb, &ptr, used, EVBUFFER_PTR_SET) != 0)
+		return (NULL);
+	if (evbuffer_peek(evb, -1, &ptr, &v, 1) < 1)
+		return (NULL);
+	*size = v.iov_len;
+	return (v.iov_base);
 }
 
 void
@@ -23,11 +23,38 @@
 
 #include "tmux.h"
 
+#ifdef NEED_BENCH
+/* Count allocations for the benchmark. */
+u_long	xmalloc_count;
+#define XMALLOC_COUNT() xmalloc_count++
+#else
+#define XMALLOC_COUNT()
+#endif
+
+struct xmalloc_stats	 xmalloc_stats[XMALLOC_TAGS];
+const char		*xmalloc_tag_names[XMALLOC_TAGS] = {
+	"other",
+	"grid",
+	"format",
+	"cmdq",
+	"control",
+	"tty"
+};
+
+static void
+xmalloc_add(enum xmalloc_tag tag, size_t size)
+{
+	xmalloc_stats[tag].calls++;
+	xmalloc_stats[tag].bytes += size;
+}
+
 void *
-xmalloc(size_t size)
+xmalloc1(enum xmalloc_tag tag, size_t size)
 {
 	void *ptr;
 
+	XMALLOC_COUNT();
+	xmalloc_add(tag, size);
 	if (size == 0)
 		fatalx("xmalloc: zero size");
 	ptr = malloc(size);
@@ -38,10 +65,12 @@ xmalloc(size_t size)
 }
 
 void *
-xcalloc(size_t nmemb, size_t size)
+xcalloc1(enum xmalloc_tag tag, size_t nmemb, size_t size)
 {
 	void *ptr;
 
+	XMALLOC_COUNT();
+	xmalloc_add(tag, nmemb * size);
 	if (size == 0 || nmemb == 0)
 		fatalx("xcalloc: zero size");
 	ptr = calloc(nmemb, size);
@@ -52,16 +81,12 @@ xcalloc(size_t nmemb, size_t size)
 }
 
 void *
-xrealloc(void *ptr, size_t size)
-{
-	return xreallocarray(ptr, 1, size);
-}
-
-void *
-xreallocarray(void *ptr, size_t nmemb, size_t size)
+xreallocarray1(enum xmalloc_tag tag, void *ptr, size_t nmemb, size_t size)
 {
 	void *new_ptr;
 
+	XMALLOC_COUNT();
+	xmalloc_add(tag, nmemb * size);
 	if (nmemb == 0 || size == 0)
 		fatalx("xreallocarray: zero size");
 	new_ptr = reallocarray(ptr, nmemb, size);
@@ -72,10 +97,13 @@ xreallocarray(void *ptr, size_t nmemb, size_t size)
 }
 
 void *
-xrecallocarray(void *ptr, size_t oldnmemb, size_t nmemb, size_t size)
+xrecallocarray1(enum xmalloc_tag tag, void *ptr, size_t oldnmemb, size_t nmemb,
+    size_t size)
 {
 	void *new_ptr;
 
+	XMALLOC_COUNT();
+	xmalloc_add(tag, nmemb * size);
 	if (nmemb == 0 || size == 0)
 		fatalx("xrecallocarray: zero size");
 	new_ptr = recallocarray(ptr, oldnmemb, nmemb, size);
@@ -86,47 +114,53 @@ xrecallocarray(void *ptr, size_t oldnmemb, size_t nmemb, size_t size)
 }
 
 char *
-xstrdup(const char *str)
+xstrdup1(enum xmalloc_tag tag, const char *str)
 {
 	char *cp;
 
+	XMALLOC_COUNT();
 	if ((cp = strdup(str)) == NULL)
 		fatalx("xstrdup: %s", strerror(errno));
+	xmalloc_add(tag, strlen(cp) + 1);
 	return cp;
 }
 
 char *
-xstrndup(const char *str, size_t maxlen)
+xstrndup1(enum xmalloc_tag tag, const char *str, size_t maxlen)
 {
 	char *cp;
 
+	XMALLOC_COUNT();
 	if ((cp = strndup(str, maxlen)) == NULL)
 		fatalx("xstrndup: %s", strerror(errno));
+	xmalloc_add(tag, strlen(cp) + 1);
 	return cp;
 }
 
 int
-xasprintf(char **ret, const char *fmt, ...)
+xasprintf1(enum xmalloc_tag tag, char **ret, const char *fmt, ...)
 {
 	va_list ap;
 	int i;
 
 	va_start(ap, fmt);
-	i = xvasprintf(ret, fmt, ap);
+	i = xvasprintf1(tag, ret, fmt, ap);
 	va_end(ap);
 
 	return i;
 }
 
 int
-xvasprintf(char **ret, const char *fmt, va_list ap)
+xvasprintf1(enum xmalloc_tag tag, char **ret, const char *fmt, va_list ap)
 {
 	int i;
 
+	XMALLOC_COUNT();
 	i = vasprintf(ret, fmt, ap);
 
 	if (i == -1)
 		fatalx("xasprintf: %s", strerror(errno));
+	xmalloc_add(tag, i + 1);
 
 	return i;
 }
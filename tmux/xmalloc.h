@@ -23,18 +23,58 @@
 #define __bounded__(x, y, z)
 #endif
 
-void	*xmalloc(size_t);
-void	*xcalloc(size_t, size_t);
-void	*xrealloc(void *, size_t);
-void	*xreallocarray(void *, size_t, size_t);
-void	*xrecallocarray(void *, size_t, size_t, size_t);
-char	*xstrdup(const char *);
-char	*xstrndup(const char *, size_t);
-int	 xasprintf(char **, const char *, ...)
-		__attribute__((__format__ (printf, 2, 3)))
-		__attribute__((__nonnull__ (2)));
-int	 xvasprintf(char **, const char *, va_list)
-		__attribute__((__nonnull__ (2)));
+#ifdef NEED_BENCH
+extern u_long	 xmalloc_count;
+#endif
+
+/*
+ * Allocations are counted by the subsystem making them. A file sets its tag by
+ * defining XMALLOC_TAG before including this header; anything else is counted
+ * as other.
+ */
+enum xmalloc_tag {
+	XMALLOC_OTHER,
+	XMALLOC_GRID,
+	XMALLOC_FORMAT,
+	XMALLOC_CMDQ,
+	XMALLOC_CONTROL,
+	XMALLOC_TTY
+};
+#define XMALLOC_TAGS 6
+#ifndef XMALLOC_TAG
+#define XMALLOC_TAG XMALLOC_OTHER
+#endif
+
+struct xmalloc_stats {
+	u_long		 calls;
+	u_long		 bytes;
+};
+extern struct xmalloc_stats	 xmalloc_stats[XMALLOC_TAGS];
+extern const char		*xmalloc_tag_names[XMALLOC_TAGS];
+
+#define xmalloc(size) xmalloc1(XMALLOC_TAG, size)
+#define xcalloc(nmemb, size) xcalloc1(XMALLOC_TAG, nmemb, size)
+#define xrealloc(ptr, size) xreallocarray1(XMALLOC_TAG, ptr, 1, size)
+#define xreallocarray(ptr, nmemb, size) \
+	xreallocarray1(XMALLOC_TAG, ptr, nmemb, size)
+#define xrecallocarray(ptr, oldnmemb, nmemb, size) \
+	xrecallocarray1(XMALLOC_TAG, ptr, oldnmemb, nmemb, size)
+#define xstrdup(str) xstrdup1(XMALLOC_TAG, str)
+#define xstrndup(str, maxlen) xstrndup1(XMALLOC_TAG, str, maxlen)
+#define xasprintf(ret, ...) xasprintf1(XMALLOC_TAG, ret, __VA_ARGS__)
+#define xvasprintf(ret, fmt, ap) xvasprintf1(XMALLOC_TAG, ret, fmt, ap)
+
+void	*xmalloc1(enum xmalloc_tag, size_t);
+void	*xcalloc1(enum xmalloc_tag, size_t, size_t);
+void	*xreallocarray1(enum xmalloc_tag, void *, size_t, size_t);
+void	*xrecallocarray1(enum xmalloc_tag, void *, size_t, size_t, size_t);
+char	*xstrdup1(enum xmalloc_tag, const char *);
+char	*xstrndup1(enum xmalloc_tag, const char *, size_t);
+int	 xasprintf1(enum xmalloc_tag, char **, const char *, ...)
+		__attribute__((__format__ (printf, 3, 4)))
+		__attribute__((__nonnull__ (3)));
+int	 xvasprintf1(enum xmalloc_tag, char **, const char *, va_list)
+		__attribute__((__nonnull__ (3)));
 int	 xsnprintf(char *, size_t, const char *, ...)
 		__attribute__((__format__ (printf, 3, 4)))
 		__attribute__((__nonnull__ (3)))